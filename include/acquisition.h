@@ -0,0 +1,81 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Runs a graph of jobs concurrently, each in its own FreeRTOS task, and returns
+ * when all of them are done (FLAGS.PARALLEL_ACQUISITION). Jobs on the same bus
+ * take turns through a per-bus lock, so a wake up takes as long as its longest
+ * bus instead of the sum of all measurements. A job starts only once the jobs
+ * in its after mask are done, whatever their result. While every job waits,
+ * all tasks are blocked and the idle task gates the CPU clock.
+ * Jobs may run jobs of their own (eg. WaterSensors::log()), with BUS_NONE so
+ * they don't hold a lock their jobs need. In place jobs run in the calling task,
+ * for timing critical work or jobs that need its stack (eg. call home).
+ */
+namespace Acquisition
+{
+	/** Electrically independent buses measurement jobs lock */
+	enum Bus
+	{
+		/** SDI12 data line (Aquatroll, Atmos41, Teros12) */
+		BUS_SDI12,
+
+		/** Water level sensor UART/PWM/analog input */
+		BUS_WATER_LEVEL,
+
+		/** I2C sensors */
+		BUS_I2C,
+
+		/** Modem UART (connect, call home) */
+		BUS_MODEM,
+
+		BUS_COUNT,
+
+		/** Job locks no bus, eg. it only runs jobs of its own */
+		BUS_NONE = BUS_COUNT
+	};
+
+	typedef RetResult (*JobFunc)(void *ctx);
+
+	struct Job
+	{
+		/** Name to print */
+		const char *name;
+
+		Bus bus;
+
+		JobFunc run;
+
+		/** Passed to run */
+		void *ctx;
+
+		/** Result of run, set when done */
+		RetResult result;
+
+		/** Bits of jobs (by index) that must be done before this one starts */
+		uint32_t after;
+
+		/** Run in the calling task instead of a task of its own */
+		bool in_place;
+
+		/** Time waiting for jobs before and for the bus, set when done */
+		uint32_t wait_ms;
+
+		/** Time running, set when done */
+		uint32_t run_ms;
+	};
+
+	RetResult run(Job *jobs, int count);
+
+	/** After mask of a job index, 0 for a job not added (-1) */
+	inline uint32_t job_bit(int index) { return index >= 0 ? 1UL << index : 0; }
+
+	bool can_light_sleep();
+}
+
+#endif
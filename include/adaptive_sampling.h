@@ -0,0 +1,44 @@
+#ifndef ADAPTIVE_SAMPLING_H
+#define ADAPTIVE_SAMPLING_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "water_sensor_data.h"
+
+/**
+ * Moves the water sensors interval with the rate of change of water level, depth
+ * and conductivity over the last few measurements (FLAGS.ADAPTIVE_WATER_SAMPLING).
+ * Fast changes drop it to ADAPTIVE_SAMPLING_MIN_INT_MINS, calm periods stretch it
+ * up to ADAPTIVE_SAMPLING_MAX_INT_MINS. Applied to the schedule like PowerGovernor,
+ * so the scheduler realigns the water sensors deadline
+ */
+namespace AdaptiveSampling
+{
+	/** Measured values rate of change is tracked for */
+	struct Sample
+	{
+		uint32_t tstamp;
+		float water_level;
+		float depth_cm;
+		float conductivity;
+	};
+
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		Sample history[ADAPTIVE_SAMPLING_HISTORY_LEN];
+		int count;
+		int interval_mins;
+	};
+
+	void update(const WaterSensorData::Entry *data);
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[]);
+	int get_interval();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
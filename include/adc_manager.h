@@ -0,0 +1,49 @@
+#ifndef ADC_MANAGER_H
+#define ADC_MANAGER_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "sampling.h"
+
+/**
+ * Samples the analog channels in short bursts and converts to mV with the
+ * eFuse calibration (esp_adc_cal). Readings are cached so channels sampled
+ * together in one burst can be read separately
+ */
+namespace AdcManager
+{
+	enum Channel
+	{
+		CHANNEL_BATTERY,
+		CHANNEL_SOLAR,
+		CHANNEL_WATER_LEVEL,
+		CHANNEL_COUNT
+	};
+
+	/** A calibrated reading of a channel */
+	struct Reading
+	{
+		// Calibrated value of the filtered raw average
+		uint32_t mv;
+
+		// Sampling quality, raw ADC units
+		Sampling::Result stats;
+
+		// Millis the reading was taken
+		uint32_t tstamp_ms;
+
+		RetResult ret;
+	};
+
+	RetResult init();
+
+	RetResult sample(uint32_t channel_mask);
+
+	RetResult read(Channel channel, Reading *out);
+
+	int read_mv(Channel channel);
+
+	int mv_to_raw(Channel channel, uint32_t mv);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "Arduino.h"
 #include "sleep_scheduler.h"
 #include "sdi12_sensor.h"
+#include "board_features.h"
 
 /** FW Version */
 const int FW_VERSION = 165;
@@ -30,15 +31,41 @@ extern const int TB_PORT;
  */
 #define WIFI_DEBUG_CONSOLE false
 
+/**
+ * Interval Wifi debug console sends buffered messages at (ms)
+ */
+#define WIFI_DEBUG_CONSOLE_SEND_INTERVAL_MS 2000
+
 /**
  * Enable data submission through Wifi instead of GSM
  * For debugging purposes
  */
 #define WIFI_DATA_SUBMISSION false
 
+/**
+ * Submit data through WiFi when the network is in range, cellular otherwise.
+ * Bearer order is picked at every call home from connect and request stats of
+ * each bearer and its cost (see Bearer). Ignored with WIFI_DATA_SUBMISSION
+ */
+#define WIFI_BEARER false
+
+/** Relative cost of a bearer, weighs its stats when picking the order (see Bearer) */
+const uint8_t BEARER_COST_CELLULAR = 4;
+const uint8_t BEARER_COST_WIFI = 1;
+
+/**
+ * Static IP config of WiFi data submission, empty IP for DHCP. Without it the
+ * last DHCP lease is reused on fast reconnect (see WifiModem)
+ */
+const char WIFI_STATIC_IP[] = "";
+const char WIFI_STATIC_GATEWAY[] = "";
+const char WIFI_STATIC_SUBNET[] = "255.255.255.0";
+const char WIFI_STATIC_DNS[] = "";
+
 // Main switches
+// Compile time constants, not volatile, so checks of disabled features fold away
 
-volatile const FLAGS_T FLAGS
+constexpr FLAGS_T FLAGS
 {
     /** Debug mode enabled - set by build env*/
     #ifdef DEBUG
@@ -106,25 +133,186 @@ volatile const FLAGS_T FLAGS
     EXTERNAL_RTC_ENABLED: true,
 
     /** Submit data to IPFS */
-    IPFS: false
+    IPFS: false,
+
+    /** Keep logs in RAM (mirrored to RTC memory) and commit them to flash before
+     * sleep/restart instead of on every log */
+    LOG_BATCH_COMMIT: true,
+
+    /** Submit sensor data as packed binary (see TbBinaryBuilder) instead of JSON */
+    BINARY_TELEMETRY: false,
+
+    /** Gzip telemetry request bodies. Server (or proxy in front of it) must
+     * accept Content-Encoding: gzip. Needs PSRAM for the compressor state
+     * (PSRAM_STAGING), without it requests are sent uncompressed */
+    GZIP_TELEMETRY: false,
+
+    /** Send telemetry requests from a task on the other core while the next one is
+     * read from flash and built */
+    PIPELINED_UPLOAD: false,
+
+    /** Serialize telemetry straight into the HTTP connection instead of an output
+     * buffer, gzipped there with GZIP_TELEMETRY. Not used with MQTT, CoAP or
+     * pipelined upload */
+    STREAMED_TELEMETRY: false,
+
+    /** Build sensor telemetry with the ArduinoJson based Tb*JsonBuilder classes instead
+     * of TbJsonEmitter. For debugging */
+    DOM_JSON_BUILDERS: false,
+
+    /** Submit sensor telemetry as delta encoded columns instead of an entry array. Needs
+     * the server side converter. Ignored if BINARY_TELEMETRY is set */
+    COLUMNAR_TELEMETRY: false,
+
+    /** Deep sleep instead of light sleep for long sleeps. Module state is kept in RTC
+     * memory and boot takes a fast path on wake up. Not used with the lightning sensor */
+    DEEP_SLEEP: false,
+
+    /** After an unexpected reset (watchdog, panic, brown-out) skip boot measurements, GSM
+     * time sync and call home, and go straight to the schedule */
+    WARM_BOOT: false,
+
+    /** Keep the FO sniffer in continuous receive. Frames are queued on DI0 with a
+     * short wake up and decoded in batches instead of a full wake up per packet */
+    FO_CONTINUOUS_RX: false,
+
+    /** Leave the modem registered in PSM between call homes instead of powering
+     * it off (NBIoT mode only). Call home wakes it instead of a full attach */
+    GSM_PSM: false,
+
+    /** Leave the modem registered in slow clock sleep (AT+CSCLK=1, DTR high) after
+     * a call home instead of powering it off, when sleeping until the next call
+     * home costs less than a cold start and attach. Boards with PIN_GSM_DTR only */
+    GSM_SLOW_CLOCK: false,
+
+    /** In sleep charge mode, check battery level from the ULP coprocessor and wake
+     * up only when recharged instead of on every SLEEP_CHARGE_CHECK_INT_MINS */
+    ULP_SLEEP_CHARGE: false,
+
+    /** Move water sensors interval with the rate of change of the measurements
+     * (see AdaptiveSampling) */
+    ADAPTIVE_WATER_SAMPLING: false,
+
+    /** Roll sensor data files deleted by store cleanup up into ROLLUP_PERIOD_SECS
+     * mean/min/max entries instead of losing them (see Retention) */
+    ROLLUP_EVICTED_DATA: true,
+
+    /** Merge partially filled store files when awake with nothing due for a while
+     * (see DataStore::compact()) */
+    STORE_COMPACTION: true,
+
+    /** Pull next call home forward when stores fill up faster than call homes
+     * empty them (see SleepScheduler) */
+    BACKLOG_CALL_HOME: true,
+
+    /** Relay sensor data of leaf nodes over LoRa through a gateway node that calls
+     * home for all of them (see LoraRelay, LORA_RELAY_ROLE) */
+    LORA_RELAY: false,
+
+    /** Leaves get OTA images from the gateway over LoRa instead of each
+     * downloading it over cellular (see LoraOta). Needs LORA_RELAY */
+    LORA_OTA: false,
+
+    /** Run heavy work (OTA, backlog upload, compaction) only with energy to
+     * spare, up to a deadline (see SleepScheduler::may_run()) */
+    SOLAR_DEFERRAL: true,
+
+    /** FO only wake ups skip the external RTC, self test and banners (see
+     * SleepScheduler::WakeTier) */
+    TIERED_WAKE: true,
+
+    /** Catch up on a large backlog with back to back upload sessions on one
+     * attach, skipping non-essential phases (see BacklogDrain) */
+    BACKLOG_DRAIN: true,
+
+    /** Run the CPU slow and speed up only for CPU bursts, holding power locks
+     * (see PowerLock) */
+    DYNAMIC_FREQ: true,
+
+    /** Keep submitted store files in flash until space is needed, so the server
+     * can request a time range again (see DataStore::remove_file(), Backfill) */
+    STORE_ARCHIVE: true,
+
+    /** Run measurements of independent buses concurrently, each in its own task
+     * (see Acquisition) */
+    PARALLEL_ACQUISITION: true,
+
+    /** Read Teros12 from the DDI serial string it sends on power up instead of
+     * an SDI12 measure cycle, when it is alone on the bus. Falls back to SDI12 */
+    TEROS12_DDI_CAPTURE: true,
+
+    /** Publish only client attributes changed since last published, all of them
+     * every CLIENT_ATTR_FULL_REFRESH_SECS. Uptime is logged instead */
+    DELTA_CLIENT_ATTRIBUTES: true,
+
+    /** Limit time and charge of a call home, phases out of budget are deferred to
+     * the next one (see CallHomeBudget) */
+    CALL_HOME_BUDGET: true,
+
+    /** Submit attach time, bytes, RTTs, HTTP statuses and serving cell of every
+     * call home as telemetry (see UplinkMetrics) */
+    UPLINK_METRICS: true,
+
+    /** Move scratch arena, store buffers and OTA buffers to PSRAM on boards that
+     * have it (see Psram) */
+    PSRAM_STAGING: true,
+
+    /** Serve store downloads over a WiFi SoftAP when the config button is held
+     * for FIELD_OFFLOAD_BTN_HOLD_TIME_MS on boot (see FieldOffload) */
+    FIELD_OFFLOAD: true,
+
+    /** Record raw FO frames, FO UART lines and SDI12 transcripts with timing to
+     * flash, replayed through the decoders by Capture::replay() */
+    RAW_CAPTURE: false,
+
+    /** Submit flash usage and per store files, bytes, oldest file and fragmentation
+     * as telemetry on every call home (see StoreRegistry::build_fs_stats_payload()) */
+    FS_STATS: true
 }; 
 
+// Modules not built for the board (see board_features.h) can't be turned on
+static_assert(FEATURE_ATMOS41 || !FLAGS.ATMOS41_ENABLED, "Atmos41 is not built for this board");
+static_assert(FEATURE_SOIL_MOISTURE || !FLAGS.SOIL_MOISTURE_SENSOR_ENABLED, "Soil moisture sensor is not built for this board");
+static_assert(FEATURE_LIGHTNING || !FLAGS.LIGHTNING_SENSOR_ENABLED, "Lightning sensor is not built for this board");
+static_assert(FEATURE_IPFS || !FLAGS.IPFS, "IPFS is not built for this board");
+
 /** Print serial comms between the MCU and the GSM module (used by tinyGSM) */
 #define PRINT_GSM_AT_COMMS false
 
+/** Also print every raw capture record on serial, to collect captures without
+ * flash access (see Capture) */
+#define CAPTURE_TO_SERIAL false
+
+/** Run HTTP requests on the modem's own HTTP(S) client (SIM7000 AT+SH*) instead of
+ * ArduinoHttpClient over a modem socket. Whole body goes in one AT transfer */
+#define GSM_NATIVE_HTTP false
+
+/** Cached TLS session is resumed for this long after its full handshake, a full
+ * handshake is done about once a day (see TlsClient). Servers usually keep
+ * sessions and tickets for a day at most */
+const uint32_t TLS_SESSION_MAX_AGE_SECS = 86400;
+
 /** Size of DataStore's buffer that holds uncommited data. Once this buffer
  is full, data is commited to flash */
 const int DATA_STORE_BUFFER_ELEMENTS = 10;
 
+/** Size of DataStore's buffer when it is in PSRAM (see Psram). Log store keeps
+ * DATA_STORE_BUFFER_ELEMENTS, its buffer is shadowed in RTC memory */
+const int DATA_STORE_PSRAM_BUFFER_ELEMENTS = 200;
+
 /******************************************************************************
 * RTC/Time
 ******************************************************************************/
 /** NTP server used by GSM module for time sync */
 const char NTP_SERVER[] PROGMEM = "pool.ntp.org";
 
-/** Intervals on which RTC will be automatically synced when RTC auto sync is ON.
- * Interval is checked on call home so it is rounded to call home intervals */
-const int RTC_AUTOSYNC_INTERVAL_MIN = 240;
+/** When RTC auto sync is ON, time is synced on call home once the clock drift model
+ * predicts more error than this since last sync (see RTC::is_sync_needed) */
+const int RTC_AUTOSYNC_MAX_ERROR_SECS = 2;
+
+/** Max interval between auto syncs, whatever the predicted error.
+ * Checked on call home so it is rounded to call home intervals */
+const uint32_t RTC_AUTOSYNC_MAX_INTERVAL_SECS = 7 * 24 * 3600;
 /** 
  * Channel to use when capturing data from Water Level sensor 
 */
@@ -142,6 +330,12 @@ const AquatrollModel AQUATROLL_MODEL = AQUATROLL_MODEL_400;
 const FineOffsetSource FO_SOURCE = FO_SOURCE_SNIFFER;
 // const FineOffsetSource FO_SOURCE = FO_SOURCE_UART;
 
+/**
+ * LoRa relay role (FLAGS.LORA_RELAY): leaf/gateway
+ */
+const LoraRelayRole LORA_RELAY_ROLE = LORA_RELAY_ROLE_LEAF;
+// const LoraRelayRole LORA_RELAY_ROLE = LORA_RELAY_ROLE_GATEWAY;
+
 /**
  * Lightning sensor module to use
  */
@@ -172,6 +366,16 @@ const uint8_t LIGHTNING_TUNE_CAP = 8;
  */
 const int BAT_GAUGE_FULL_MAH = 3000;
 
+/**
+ * Internal env sensor (BME280) measurement profile. Every read is a single forced
+ * conversion. Oversampling 0 (skipped), 1, 2, 4, 8 or 16, IIR filter 0 (off) to 4.
+ * x1 with filter off is enough for enclosure monitoring (~8ms conversion)
+ */
+const uint8_t INT_ENV_TEMP_OVERSAMPLE = 1;
+const uint8_t INT_ENV_PRESS_OVERSAMPLE = 1;
+const uint8_t INT_ENV_HUM_OVERSAMPLE = 1;
+const uint8_t INT_ENV_FILTER = 0;
+
 
 
 /******************************************************************************
@@ -221,6 +425,15 @@ const float FO_SNIFFER_FREQ = 868.35;
 // const LightningEnvironment LIGHTNING_ENVIRONMENT = LIGHTNING_ENV_INDOOR;
 const LightningEnvironment LIGHTNING_ENVIRONMENT = LIGHTNING_ENV_OUTDOOR;
 
+/** Merge strikes of the same minute into one entry (closest distance, max energy)
+ * and log their distance/energy histograms (LIGHTNING_HISTOGRAM) */
+const bool LIGHTNING_AGGREGATE_MINUTES = false;
+
+/** Strikes this close (km) are sent as an alarm (CallHome::send_alarm()), at most
+ * every LIGHTNING_ALARM_MIN_INTERVAL_SECS. 0 disables, sensor reports 1 for overhead */
+const uint8_t LIGHTNING_ALARM_DISTANCE_KM = 0;
+const uint32_t LIGHTNING_ALARM_MIN_INTERVAL_SECS = 60 * 60;
+
 /******************************************************************************
  * Power
  *****************************************************************************/
@@ -240,4 +453,195 @@ const int BATTERY_LEVEL_SLEEP_RECHARGED = 35;
 
 const int SLEEP_CHARGE_CHECK_INT_MINS = 30;
 
+/** With FLAGS.ULP_SLEEP_CHARGE: ULP battery check interval, and timer wake up kept
+ * as a fallback in case the ULP never wakes the CPU up */
+const int ULP_BATTERY_CHECK_INT_SECS = 60;
+const int SLEEP_CHARGE_ULP_FALLBACK_MINS = 12 * 60;
+
+/**
+ * Water presence (FLAGS.WATER_PRESENCE_SENSOR_ENABLED): wake up on presence changes
+ * and log them right away (sensor output must stay valid while sleeping). A change
+ * can also be sent as an alarm (CallHome::send_alarm()), at most every
+ * UPLINK_MIN_INTERVAL_SECS
+ */
+const bool WATER_PRESENCE_EDGE_WAKEUP = true;
+const bool WATER_PRESENCE_EXPEDITED_UPLINK = false;
+const uint32_t WATER_PRESENCE_UPLINK_MIN_INTERVAL_SECS = 60 * 60;
+
+/**
+ * Adaptive water sampling (FLAGS.ADAPTIVE_WATER_SAMPLING). Water sensors interval
+ * moves between MIN and MAX (valid schedule values) with the rate of change over
+ * the last measurements. A field changing by its *_RATE per hour samples at MIN,
+ * all fields below CALM_RATE of theirs double the interval
+ */
+const int ADAPTIVE_SAMPLING_MIN_INT_MINS = 2;
+const int ADAPTIVE_SAMPLING_MAX_INT_MINS = 60;
+const float ADAPTIVE_SAMPLING_LEVEL_RATE = 10;          // cm/h
+const float ADAPTIVE_SAMPLING_DEPTH_RATE = 10;          // cm/h
+const float ADAPTIVE_SAMPLING_CONDUCTIVITY_RATE = 200;  // uS/cm/h
+const float ADAPTIVE_SAMPLING_CALM_RATE = 0.1;
+
+/**
+ * Power governor, scales the normal schedule with available energy.
+ * Intervals are stretched up to MAX_SCALE as the battery drops from FULL_PCT to
+ * BATTERY_LEVEL_LOW (battery low schedule is about MAX_SCALE times the default)
+ * and compressed down to MIN_SCALE when full and charging with SURPLUS_MA.
+ * Net drain over DRAIN_BUDGET_MA stretches up to twice more.
+ */
+const float POWER_GOVERNOR_MIN_SCALE = 0.5;
+const float POWER_GOVERNOR_MAX_SCALE = 4;
+const int POWER_GOVERNOR_FULL_PCT = 85;
+const float POWER_GOVERNOR_SURPLUS_MA = 100;
+const float POWER_GOVERNOR_DRAIN_BUDGET_MA = 10;
+
+/**
+ * Heartbeat of the report by exception filter (see Deadband), default until set
+ * by remote control. An entry is stored at least this often even if no field
+ * moved by its deadband
+ */
+const uint32_t DEADBAND_HEARTBEAT_SECS = 60 * 60;
+
+/**
+ * Store compaction (FLAGS.STORE_COMPACTION). Runs at the end of a wake up when
+ * the next deadline is at least MIN_IDLE_SECS away, merging up to MAX_FILES files
+ */
+const int STORE_COMPACT_MIN_IDLE_SECS = 60;
+const int STORE_COMPACT_MAX_FILES = 32;
+
+/**
+ * Solar-aware deferral of heavy work (FLAGS.SOLAR_DEFERRAL). Deferrable work
+ * runs while net battery current shows a SURPLUS_MA surplus, the panel is over
+ * SOLAR_MV or the battery is at BATTERY_PCT or above. Work deferred for longer
+ * than its deadline runs anyway.
+ */
+const float DEFERRAL_SURPLUS_MA = 20;
+const uint16_t DEFERRAL_SOLAR_MV = 5000;
+const int DEFERRAL_BATTERY_PCT = 80;
+const uint32_t DEFERRAL_DEADLINE_OTA_SECS = 3 * 24 * 3600;
+const uint32_t DEFERRAL_DEADLINE_BACKLOG_SECS = 2 * 24 * 3600;
+const uint32_t DEFERRAL_DEADLINE_COMPACTION_SECS = 24 * 3600;
+
+/**
+ * Max bytes a store may keep in flash, oldest files are deleted on cleanup when
+ * over it (see StoreRegistry). 0 for none, store is only limited by
+ * STORE_MAX_FILE_COUNT
+ */
+const uint32_t STORE_QUOTA_LOG_BYTES = 0;
+const uint32_t STORE_QUOTA_SENSOR_BYTES = 0;
+const uint32_t STORE_QUOTA_RELAY_BYTES = 0;
+const uint32_t STORE_QUOTA_ROLLUP_BYTES = 0;
+const uint32_t STORE_QUOTA_SDI12_LOG_BYTES = 64 * 1024;
+
+/**
+ * Call home is offset from the interval grid by a phase derived from the MAC, up
+ * to this (capped by the interval), unless set by remote control. Spreads call
+ * homes of devices with the same interval instead of all calling at :00
+ */
+const int CALL_HOME_PHASE_MAX_SECS = 60 * 60;
+
+/**
+ * Backlog call home (FLAGS.BACKLOG_CALL_HOME). Next call home is pulled forward
+ * to LEAD_SECS from now when a store reaches FILE_COUNT (cleanup starts at
+ * STORE_MAX_FILE_COUNT) or STORE_BYTES, or flash free space drops below
+ * MIN_FREE_BYTES. Up to MAX_EXTRA_CALL_HOMES a day
+ */
+const int BACKLOG_FILE_COUNT_WATERMARK = 750;
+const uint32_t BACKLOG_STORE_BYTES_WATERMARK = 256 * 1024;
+const uint32_t BACKLOG_MIN_FREE_BYTES = 128 * 1024;
+
+/**
+ * Archived store files (FLAGS.STORE_ARCHIVE) are pruned, oldest first, on cleanup
+ * while flash free space is below MIN_FREE_BYTES. Kept above
+ * BACKLOG_MIN_FREE_BYTES so the archive never pulls call homes forward.
+ */
+const uint32_t STORE_ARCHIVE_MIN_FREE_BYTES = 256 * 1024;
+const int BACKLOG_CALL_HOME_LEAD_SECS = 60;
+const int BACKLOG_MAX_EXTRA_CALL_HOMES = 4;
+
+/**
+ * Backlog drain (FLAGS.BACKLOG_DRAIN). Starts when telemetry stores hold
+ * ENTER_FILES files or more and there is energy to spare (see
+ * SleepScheduler::has_energy_surplus()), ends at EXIT_FILES or less, or when
+ * battery leaves normal mode. Up to MAX_SESSIONS telemetry sessions run per
+ * attach while a session still deletes MIN_SESSION_FILES files. Call homes are
+ * pulled forward without the daily limit while draining
+ */
+const int BACKLOG_DRAIN_ENTER_FILES = 1500;
+const int BACKLOG_DRAIN_EXIT_FILES = 50;
+const int BACKLOG_DRAIN_MAX_SESSIONS = 6;
+const int BACKLOG_DRAIN_MIN_SESSION_FILES = 4;
+
+/**
+ * Dynamic frequency scaling (FLAGS.DYNAMIC_FREQ). CPU runs at MIN_CPU_MHZ and at
+ * MAX_CPU_MHZ while LOCK_CPU_MAX is held (see PowerLock). Below 80MHz APB slows
+ * down with the CPU, peripherals not covered by LOCK_APB_MAX (eg. Wire inited
+ * at 80MHz) would lose their clock. AUTO_LIGHT_SLEEP needs an SDK with power
+ * management and tickless idle
+ */
+const int DFS_MAX_CPU_MHZ = 240;
+const int DFS_MIN_CPU_MHZ = 80;
+const bool DFS_AUTO_LIGHT_SLEEP = true;
+
+/**
+ * LoRa relay (FLAGS.LORA_RELAY). Gateway listens for leaves for RX_WINDOW_MS on
+ * call home, extended by RX_IDLE_MS after every frame up to RX_MAX_MS. Leaves
+ * retry a frame TX_RETRIES times, ACK_TIMEOUT_MS each, after a random delay of up
+ * to TX_JITTER_MS so leaves calling home together don't keep colliding. A leaf
+ * calls home itself when relaying fails or DIRECT_CALL_HOME_SECS passed since it
+ * last did, for remote control, logs and OTA
+ */
+const uint32_t LORA_RELAY_RX_WINDOW_MS = 20000;
+const uint32_t LORA_RELAY_RX_IDLE_MS = 5000;
+const uint32_t LORA_RELAY_RX_MAX_MS = 60000;
+const int LORA_RELAY_TX_RETRIES = 3;
+const uint32_t LORA_RELAY_ACK_TIMEOUT_MS = 1000;
+const uint32_t LORA_RELAY_TX_JITTER_MS = 500;
+const uint32_t LORA_RELAY_DIRECT_CALL_HOME_SECS = 24 * 3600;
+
+/**
+ * LoRa OTA (FLAGS.LORA_OTA). A leaf listens for chunks it requested until none
+ * came for RX_IDLE_MS, and downloads over cellular if the image is not complete
+ * TIMEOUT_SECS after it was requested
+ */
+const uint32_t LORA_OTA_RX_IDLE_MS = 3000;
+const uint32_t LORA_OTA_TIMEOUT_SECS = 14 * 24 * 3600;
+
+/** Period sensor data evicted by store cleanup is rolled up into (see Retention) */
+const uint32_t ROLLUP_PERIOD_SECS = 60 * 60;
+
+/**
+ * Call home budget (FLAGS.CALL_HOME_BUDGET), LOW_BATTERY_PERCENT of it when battery
+ * is not in normal mode. Charge is measured by the battery gauge, estimated at
+ * EST_CURRENT_MA without one. Split across phases by the *_PERCENT shares (sum is
+ * 100). Watchdog restarts the device WATCHDOG_GRACE_SECS past the session deadline
+ */
+const uint32_t CALL_HOME_BUDGET_SECS = 8 * 60;
+const float CALL_HOME_BUDGET_MAH = 20;
+const uint8_t CALL_HOME_BUDGET_LOW_BATTERY_PERCENT = 50;
+const float CALL_HOME_EST_CURRENT_MA = 150;
+const uint32_t CALL_HOME_WATCHDOG_GRACE_SECS = 60;
+const uint8_t CALL_HOME_BUDGET_ATTACH_PERCENT = 25;
+const uint8_t CALL_HOME_BUDGET_REMOTE_CONTROL_PERCENT = 5;
+const uint8_t CALL_HOME_BUDGET_OTA_PERCENT = 20;
+const uint8_t CALL_HOME_BUDGET_ATTRIBUTES_PERCENT = 5;
+const uint8_t CALL_HOME_BUDGET_TELEMETRY_PERCENT = 35;
+const uint8_t CALL_HOME_BUDGET_LOGS_PERCENT = 10;
+
+/** All client attributes are published at least this often (FLAGS.DELTA_CLIENT_ATTRIBUTES) */
+const uint32_t CLIENT_ATTR_FULL_REFRESH_SECS = 24 * 60 * 60;
+
+/** Span durations (see Trace) are summarized in the log on call home at most this often */
+const uint32_t TRACE_SUMMARY_INTERVAL_SECS = 6 * 60 * 60;
+
+/**
+ * Atmos41 is kept powered between readings when the weather station read
+ * interval is at most KEEP_POWERED_MAX_INT_MINS, and read with continuous (aRC)
+ * commands without a measurement wait. Trades power for latency: the sensor rail
+ * powers all sensors on it. 0 to always switch it off after reading
+ */
+const int ATMOS41_KEEP_POWERED_MAX_INT_MINS = 5;
+
+/** Park of a kept powered Atmos41 lasts the read interval plus this */
+const uint32_t ATMOS41_KEEP_POWERED_MARGIN_SECS = 60;
+
 #endif
\ No newline at end of file
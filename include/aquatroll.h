@@ -2,18 +2,44 @@
 #define WATER_QUALITY_H
 
 #include "water_sensor_data.h"
+#include "sdi12_registry.h"
 
 namespace Aquatroll
 {
+    /** Field of an Aquatroll value is not stored */
+    const uint8_t FIELD_NONE = 0xFF;
+
+    /**
+     * Aquatroll model. Values are listed in the order configured into the sensor,
+     * each with the offset of the WaterSensorData::Entry field it is stored in.
+     * Only one of depth_cm/depth_ft is measured, the other is derived
+     */
+    struct ModelDescriptor
+    {
+        const char *name;
+
+        /** Model discovered on the bus (see Sdi12Registry) */
+        Sdi12Registry::Model model;
+
+        /** Model set in config (AQUATROLL_MODEL) */
+        AquatrollModel config_model;
+
+        /** Values returned by a measurement */
+        uint8_t value_count;
+
+        /** Entry field offset of each value, FIELD_NONE if not stored */
+        uint8_t fields[AQUATROLL_MAX_VALUES];
+    };
+
     RetResult init();
 
     RetResult measure(WaterSensorData::Entry *data);
+    RetResult measure_model(const ModelDescriptor *model, WaterSensorData::Entry *data, char address = '0');
+    RetResult fill_entry(const ModelDescriptor *model, const float *values, uint8_t count, WaterSensorData::Entry *data);
 
-    RetResult measure_aquatroll400(WaterSensorData::Entry *data);
-    RetResult measure_aquatroll500(WaterSensorData::Entry *data);
-    RetResult measure_aquatroll600(WaterSensorData::Entry *data);
+    const ModelDescriptor* find_model(char *address_out);
 
     RetResult measure_dummy(WaterSensorData::Entry *data);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,95 @@
+#ifndef AT_STREAM_H
+#define AT_STREAM_H
+
+#include <Arduino.h>
+#include "const.h"
+
+/**
+ * Modem stream wrapper that times AT commands. Outgoing command lines start a
+ * measurement, the final result code read back ends it. A command written while
+ * the previous one is still waiting counts as a timeout of the previous one
+ * (the library gave up on it). Optionally echoes all traffic to a debug stream.
+ *
+ * TinyGSM and the HTTP client wait for responses by polling available() in
+ * busy loops. After AT_STREAM_IDLE_POLLS empty polls in a row every poll
+ * sleeps, so the CPU idles between bursts instead of spinning.
+ */
+class AtStream : public Stream
+{
+public:
+    /** Tracked command groups */
+    enum Command
+    {
+        CMD_CREG,
+        CMD_CGATT,
+        CMD_CIPSTART,
+        CMD_CIPSEND,
+        CMD_HTTP,
+        CMD_OTHER,
+        CMD_COUNT
+    };
+
+    /** Latencies of a command group since last clear */
+    struct Stats
+    {
+        uint16_t count;
+        uint16_t timeouts;
+        uint32_t total_ms;
+        /** Count per AT_LATENCY_BUCKET_MS bucket */
+        uint16_t hist[AT_LATENCY_BUCKETS];
+    };
+
+    AtStream(Stream &stream, Stream *echo = NULL);
+
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    const Stats* get_stats(Command cmd);
+    void log_stats();
+    void clear_stats();
+
+    uint32_t get_idle_ms() const;
+
+private:
+    /** Default constructor is private, user must provide the modem stream */
+    AtStream();
+
+    void on_tx(uint8_t c);
+    void on_rx(uint8_t c);
+    void end_command(bool timeout);
+    Command parse_command(const char *line);
+    bool is_final_result(const char *line);
+
+    /** Modem stream */
+    Stream &_stream;
+
+    /** All traffic is echoed here if set */
+    Stream *_echo;
+
+    /** Start of line being written */
+    char _tx_line[AT_STREAM_LINE_LEN];
+    int _tx_line_len = 0;
+
+    /** Start of line being read */
+    char _rx_line[AT_STREAM_LINE_LEN];
+    int _rx_line_len = 0;
+
+    /** Command waiting for its final result */
+    bool _pending = false;
+    Command _pending_cmd = CMD_OTHER;
+    uint32_t _pending_start_ms = 0;
+
+    Stats _stats[CMD_COUNT];
+
+    /** Empty polls in a row */
+    uint16_t _idle_polls = 0;
+
+    /** Time slept waiting for data since last clear */
+    uint32_t _idle_ms = 0;
+};
+
+#endif
@@ -12,6 +12,7 @@ namespace Atmos41
     RetResult measure(Atmos41Data::Entry *data);
 	RetResult measure_dummy(Atmos41Data::Entry *data);
 	RetResult measure_log();
+	RetResult log_values(const float *values, uint8_t count);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Resubmission of a time range of archived store data, requested by the server
+ * with remote control (do_backfill). Archived entries of the range
+ * (FLAGS.STORE_ARCHIVE) are found with DataStoreReader::seek() and copied to the
+ * backfill twin of their store, which CallHome::handle_telemetry() submits at low
+ * priority like any other store. Entries keep their seq so the server can drop
+ * the ones it already has.
+ * Stores with backfilled entries left are kept in DeviceConfig until submitted.
+ */
+namespace Backfill
+{
+	RetResult request(uint32_t from, uint32_t to, uint32_t store_mask);
+
+	bool is_pending(StoreId id);
+
+	void update();
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef BACKLOG_DRAIN_H
+#define BACKLOG_DRAIN_H
+
+#include <inttypes.h>
+#include <ArduinoJson.h>
+#include "struct.h"
+#include "app_config.h"
+
+/**
+ * Catch-up after a long outage (FLAGS.BACKLOG_DRAIN). When telemetry stores hold
+ * BACKLOG_DRAIN_ENTER_FILES files or more and there is energy to spare, call
+ * homes drain the backlog: telemetry sessions run back to back on the same
+ * attach, requests are as large as possible (gzipped only with
+ * FLAGS.GZIP_TELEMETRY, the server must accept it), client attributes carry
+ * progress only and IPFS uploads and FS stats are skipped. Call homes are pulled
+ * forward until BACKLOG_DRAIN_EXIT_FILES files are left.
+ */
+namespace BacklogDrain
+{
+	void update();
+	bool next_session(bool ok);
+
+	bool is_active();
+	int get_files_left();
+	uint8_t get_percent();
+
+	void add_attributes(JsonDocument &doc);
+}
+
+#endif
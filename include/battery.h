@@ -5,6 +5,13 @@
 
 namespace Battery
 {
+    /** State kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        bool sleep_charging;
+        int sleep_charge_wakeups;
+    };
+
     RetResult init();
     RetResult read_adc(uint16_t *voltage, uint16_t *pct);
     RetResult log_adc();
@@ -14,6 +21,9 @@ namespace Battery
     void sleep_charge();
     void print_mode();
     RetResult read_solar_mv(uint16_t *voltage);
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 }
 
 #endif
\ No newline at end of file
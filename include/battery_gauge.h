@@ -10,6 +10,7 @@ namespace BatteryGauge
 {
     RetResult init();
     RetResult log();
+    RetResult read_mah(float *mah);
     RetResult print();
 }
 
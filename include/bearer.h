@@ -0,0 +1,65 @@
+#ifndef BEARER_H
+#define BEARER_H
+
+#include <inttypes.h>
+#include <Client.h>
+#include <Udp.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Network bearer of a call home, WiFi or the cellular modem. With WIFI_BEARER
+ * both are tried in the order of their score: EWMA of connect time and request
+ * round-trip time weighted by bearer cost (BEARER_COST_*) and divided by the
+ * EWMA success rate of connects and requests, kept in RTC memory. WiFi connects with a short timeout
+ * (BEARER_WIFI_CONNECT_TIMEOUT_MS), a failing bearer is still retried first
+ * every BEARER_PROBE_INTERVAL call homes so it can recover.
+ * Without WIFI_BEARER the modem is the only bearer, WiFi with
+ * WIFI_DATA_SUBMISSION. HTTP, MQTT and CoAP clients are created for the active
+ * bearer with new_client()/new_udp().
+ */
+namespace Bearer
+{
+	enum Type
+	{
+		BEARER_CELLULAR,
+		BEARER_WIFI,
+		BEARER_COUNT
+	};
+
+	/** Stats of a bearer, in RTC memory */
+	struct Stats
+	{
+		/** EWMA of connect time (ms) */
+		uint32_t connect_ms;
+
+		/** EWMA of request round-trip time (ms) */
+		uint32_t rtt_ms;
+
+		/** EWMA of connect and request success (%) */
+		uint8_t success_percent;
+
+		/** Call homes since bearer was tried first */
+		uint8_t since_probe;
+
+		uint16_t attempts;
+	} __attribute__((packed));
+
+	RetResult start_connect();
+	RetResult wait_connect();
+	void off();
+
+	Type get_active();
+	bool is_connected();
+	int get_rssi();
+
+	Client* new_client(uint8_t mux);
+	UDP* new_udp(uint8_t mux);
+
+	void on_request(uint32_t rtt_ms, bool ok);
+
+	const Stats* get_stats(Type type);
+}
+
+#endif
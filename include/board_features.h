@@ -0,0 +1,37 @@
+#ifndef BOARD_FEATURES_H
+#define BOARD_FEATURES_H
+
+/******************************************************************************
+ * Features
+ * Modules built into the image, set per board in its board header. A module
+ * not built is left out of the image: its sources compile to nothing, its store
+ * is not in StoreRegistry and no store, reader or builder is instantiated for
+ * its data. Modules and their callers check these with #if.
+ * FLAGS turn modules that are built on and off, FLAGS of modules not built
+ * must be false (see app_config.h). Features a board doesn't set are not built.
+ *****************************************************************************/
+#ifndef FEATURE_ATMOS41
+    #define FEATURE_ATMOS41 0
+#endif
+
+#ifndef FEATURE_SOIL_MOISTURE
+    #define FEATURE_SOIL_MOISTURE 0
+#endif
+
+#ifndef FEATURE_LIGHTNING
+    #define FEATURE_LIGHTNING 0
+#endif
+
+#ifndef FEATURE_IPFS
+    #define FEATURE_IPFS 0
+#endif
+
+#if (FEATURE_ATMOS41 || FEATURE_SOIL_MOISTURE) && !defined(PIN_SDI12_DATA)
+    #error "SDI12 sensors need PIN_SDI12_DATA"
+#endif
+
+#if FEATURE_LIGHTNING && !defined(PIN_LIGHTNING_IRQ)
+    #error "Lightning sensor needs PIN_LIGHTNING_IRQ"
+#endif
+
+#endif
@@ -28,4 +28,17 @@
 #define PIN_WATER_LEVEL_PWR 14
 #define PIN_WATER_LEVEL_ANALOG 36
 
+/******************************************************************************
+ * Features
+ * Modules built into the image for this board (see board_features.h)
+ *****************************************************************************/
+/** Atmos41 weather station, SDI12 */
+#define FEATURE_ATMOS41 0
+/** Teros12 soil moisture sensor, SDI12 */
+#define FEATURE_SOIL_MOISTURE 0
+/** Lightning sensor, IRQ pin */
+#define FEATURE_LIGHTNING 0
+/** FO data submission to IPFS */
+#define FEATURE_IPFS 1
+
 #endif
@@ -16,11 +16,23 @@
 #define PIN_GSM_PWR_KEY 4
 #define PIN_GSM_RESET 5
 #define PIN_GSM_POWER_ON 23
+/** Modem RTS/CTS are not routed on the stock board. Define if wired to enable flow control */
+// #define PIN_GSM_RTS <gpio>
+// #define PIN_GSM_CTS <gpio>
+/** Modem STATUS pin is not routed on the stock board. Define if wired, power
+ * transitions are then awaited on it */
+// #define PIN_GSM_STATUS <gpio>
+
+/** Modem link baud rate set with AT+IPR after power on. SIM800 max is 460800 */
+#define GSM_SERIAL_FAST_BAUD 460800
 
 /** I2C pins for the main I2C bus */
 #define PIN_I2C1_SDA 21
 #define PIN_I2C1_SCL 22
 
+/** IP5306 PMU on the main bus is only specified for standard mode (100kHz) */
+#define BOARD_I2C_STANDARD_MODE
+
 /** I2C pins for the I2C-SDI12 adapter */
 #define PIN_SDI12_I2C1_SDA 32 // Nano pin A4
 #define PIN_SDI12_I2C1_SCL 33 // Nano pin A5 
@@ -40,4 +52,17 @@
 //#define PIN_ADC_BAT 39 // Custom pcb input
 #define PIN_ADC_BAT 35 // TCall
 
+/******************************************************************************
+ * Features
+ * Modules built into the image for this board (see board_features.h)
+ *****************************************************************************/
+/** Atmos41 weather station, SDI12 */
+#define FEATURE_ATMOS41 0
+/** Teros12 soil moisture sensor, SDI12 */
+#define FEATURE_SOIL_MOISTURE 0
+/** Lightning sensor, IRQ pin */
+#define FEATURE_LIGHTNING 0
+/** FO data submission to IPFS */
+#define FEATURE_IPFS 1
+
 #endif
\ No newline at end of file
@@ -26,6 +26,12 @@
 #define PIN_GSM_RESET 5
 #define PIN_GSM_POWER_ON 23
 #define PIN_GSM_DTR 25
+/** Modem RTS/CTS are not routed on the stock board. Define if wired to enable flow control */
+// #define PIN_GSM_RTS <gpio>
+// #define PIN_GSM_CTS <gpio>
+
+/** Modem link baud rate set with AT+IPR after power on */
+#define GSM_SERIAL_FAST_BAUD 921600
  
 /** I2C pins for the main I2C bus */
 #define PIN_I2C1_SDA 21
@@ -72,4 +78,21 @@
 /* Water presence sensor  */
 #define PIN_WATER_PRESENCE GPIO_NUM_34
 
+/* Ext RTC (DS3231) INT/SQW pin, wakes up on alarm (see RTC::set_wakeup_alarm()).
+ * Must be an RTC GPIO, with pull-up */
+// #define PIN_EXT_RTC_INT GPIO_NUM_39
+
+/******************************************************************************
+ * Features
+ * Modules built into the image for this board (see board_features.h)
+ *****************************************************************************/
+/** Atmos41 weather station, SDI12 */
+#define FEATURE_ATMOS41 1
+/** Teros12 soil moisture sensor, SDI12 */
+#define FEATURE_SOIL_MOISTURE 1
+/** Lightning sensor, IRQ pin */
+#define FEATURE_LIGHTNING 1
+/** FO data submission to IPFS */
+#define FEATURE_IPFS 1
+
 #endif
\ No newline at end of file
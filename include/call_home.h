@@ -3,17 +3,30 @@
 
 #include "struct.h"
 
+class MQTT;
+
 namespace CallHome
 {
+    /** Alarm conditions sent with send_alarm() */
+    enum Alarm
+    {
+        ALARM_WATER_PRESENCE,
+        ALARM_LIGHTNING_CLOSE,
+        ALARM_COUNT
+    };
+
     RetResult start();
 
+    RetResult send_alarm(Alarm alarm, int32_t value);
+
+    MQTT* get_mqtt();
+
 
     // TODO: Temp public for testing
     RetResult handle_remote_control();
     RetResult handle_client_attributes();
     RetResult handle_logs();
     RetResult handle_telemetry();
-    RetResult submit_ipfs();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef CALL_HOME_BUDGET_H
+#define CALL_HOME_BUDGET_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Time and energy budget of a call home session (FLAGS.CALL_HOME_BUDGET).
+ * CALL_HOME_BUDGET_SECS and CALL_HOME_BUDGET_MAH are split across the phases in
+ * session order, the deadline of a phase is the end of its share plus whatever
+ * earlier phases left unused. Phases check their deadline before every request
+ * and stop once it passed; what is left (store data, logs, OTA download) stays
+ * for the next session, where deferred phases may run until the session deadline.
+ * A watchdog restarts the device if a blocking call keeps the session running
+ * CALL_HOME_WATCHDOG_GRACE_SECS past the deadline.
+ */
+namespace CallHomeBudget
+{
+	/** Phases of a call home, in session order */
+	enum Phase
+	{
+		PHASE_ATTACH,
+		PHASE_REMOTE_CONTROL,
+		PHASE_OTA,
+		PHASE_ATTRIBUTES,
+		PHASE_TELEMETRY,
+		PHASE_LOGS,
+		PHASE_COUNT
+	};
+
+	void begin();
+	void end();
+
+	bool enter(Phase phase);
+	bool expired(Phase phase);
+
+	uint32_t get_deadline_ms(Phase phase);
+	uint32_t remaining_ms(Phase phase);
+}
+
+#endif
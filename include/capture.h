@@ -0,0 +1,76 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <inttypes.h>
+#include "struct.h"
+
+/**
+ * Raw capture of decoder inputs with FLAGS.RAW_CAPTURE: FO frames as received,
+ * FO UART response lines and SDI12 commands and responses, with timing and the
+ * result of the live decode. Records go to CAPTURE_PATH (and serial with
+ * CAPTURE_TO_SERIAL).
+ *
+ * replay() feeds a capture back through the same decoders at full speed, for a
+ * repeatable throughput benchmark and a regression corpus. Decode results that
+ * differ from the captured ones are counted as mismatches.
+ *
+ * File layout: FileHeader, then records of RecordHeader followed by len bytes
+ */
+namespace Capture
+{
+	enum Kind
+	{
+		/** FO_SNIFFER_FRAME_LEN bytes, ok if FoSniffer::decode_packet() succeeded */
+		KIND_FO_FRAME,
+		/** Line without EOL, ok if FoUart::parse_line() found a param */
+		KIND_FO_UART_LINE,
+		/** Command as written, always ok */
+		KIND_SDI12_CMD,
+		/** Response without <CR><LF>, ok if not empty */
+		KIND_SDI12_RESP,
+		KIND_COUNT
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+	}__attribute__((packed));
+
+	struct RecordHeader
+	{
+		/** Kind */
+		uint8_t kind;
+		/** Live decode succeeded */
+		uint8_t ok;
+		uint8_t len;
+		/** RTC time */
+		uint32_t tstamp;
+		/** Low 32 bits of uS since boot */
+		uint32_t us;
+	}__attribute__((packed));
+
+	/** Result of a replay */
+	struct ReplayStats
+	{
+		/** Records replayed per kind */
+		uint32_t records[KIND_COUNT];
+		/** Records decoded ok per kind */
+		uint32_t ok[KIND_COUNT];
+		/** Records whose decode result differs from the captured one */
+		uint32_t mismatches;
+		/** SDI12 data responses (after D/R commands) with a CRC failure */
+		uint32_t sdi12_crc_fails;
+		/** Time spent decoding, file reads excluded */
+		uint32_t decode_us;
+	};
+
+	void record(Kind kind, const void *data, int len, bool ok);
+	RetResult flush();
+
+	RetResult replay(ReplayStats *stats);
+	void print();
+	RetResult clear();
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef COAP_H
+#define COAP_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include <Udp.h>
+
+/******************************************************************************
+ * Minimal CoAP (RFC 7252) client for TB's CoAP device API. Only confirmable
+ * requests with piggybacked or separate responses are supported. Request
+ * payloads larger than a block are sent with block-wise transfer (Block1,
+ * RFC 7959).
+ ******************************************************************************/
+namespace Coap
+{
+    RetResult open(UDP *udp, const char *server, uint16_t port);
+
+    void close();
+
+    bool is_open();
+
+    RetResult post(const char *path, const uint8_t *payload, int payload_len);
+
+    RetResult get(const char *path, const char *query, char *resp_buff, int resp_buff_size);
+}
+
+#endif
@@ -7,6 +7,59 @@
 #include "wifi_serial.h"
 #endif
 
+/******************************************************************************
+ * Log levels. Prints above the level of a module are compiled out.
+ * Level is set with -D LOG_LEVEL=x in platformio.ini, and per module with
+ * -D LOG_LEVEL_<MODULE>=x. A module uses its own level by defining
+ * LOG_MODULE_LEVEL before any include, eg:
+ *   #define LOG_MODULE_LEVEL LOG_LEVEL_FO_SNIFFER
+ *****************************************************************************/
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+/** Packet dumps, request bodies etc. */
+#define LOG_LEVEL_TRACE 5
+
+#ifndef LOG_LEVEL
+    #if DEBUG
+        #define LOG_LEVEL LOG_LEVEL_TRACE
+    #elif RELEASE
+        #define LOG_LEVEL LOG_LEVEL_INFO
+    #else
+        #define LOG_LEVEL LOG_LEVEL_NONE
+    #endif
+#endif
+
+// Module levels
+#ifndef LOG_LEVEL_FO_SNIFFER
+    #define LOG_LEVEL_FO_SNIFFER LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_FO_UART
+    #define LOG_LEVEL_FO_UART LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_SLEEP_SCHEDULER
+    #define LOG_LEVEL_SLEEP_SCHEDULER LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_CALL_HOME
+    #define LOG_LEVEL_CALL_HOME LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_FLASH
+    #define LOG_LEVEL_FLASH LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_SDI12
+    #define LOG_LEVEL_SDI12 LOG_LEVEL
+#endif
+
+#ifndef LOG_MODULE_LEVEL
+    #define LOG_MODULE_LEVEL LOG_LEVEL
+#endif
+
+/** Check if prints of a level are compiled in current module. Constant, so
+ * code under it is removed when false */
+#define debug_level_enabled(level) ((level) <= LOG_MODULE_LEVEL)
+
 #if DEBUG || RELEASE
     #if WIFI_DEBUG_CONSOLE
         #define SERIAL_OBJECT WifiDebugSerial        
@@ -14,37 +67,43 @@
         #define SERIAL_OBJECT Serial
     #endif
 
-    #define debug_print(msg, ...); { SERIAL_OBJECT.print(msg, ##__VA_ARGS__); }
-    #define debug_print_e(msg, ...); { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_print_w(msg, ...); { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_print_i(msg, ...); { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
+    #define debug_print(msg, ...) { if(debug_level_enabled(LOG_LEVEL_DEBUG)) { SERIAL_OBJECT.print(msg, ##__VA_ARGS__); } }
+    #define debug_print_e(msg, ...) { if(debug_level_enabled(LOG_LEVEL_ERROR)) { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_print_w(msg, ...) { if(debug_level_enabled(LOG_LEVEL_WARNING)) { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_print_i(msg, ...) { if(debug_level_enabled(LOG_LEVEL_INFO)) { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.print(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_print_t(msg, ...) { if(debug_level_enabled(LOG_LEVEL_TRACE)) { SERIAL_OBJECT.print(msg, ##__VA_ARGS__); } }
 
     // #define debug_println(); SERIAL_OBJECT.println();
-    #define debug_println(msg, ...); { SERIAL_OBJECT.println(msg, ##__VA_ARGS__); }
-    #define debug_println_e(msg, ...); { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_println_w(msg, ...); { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_println_i(msg, ...); { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-
-    #define debug_printf(format, ...); { SERIAL_OBJECT.printf(format, ##__VA_ARGS__); }
-    #define debug_printf_e(format, ...); { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_printf_w(format, ...); { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
-    #define debug_printf_i(format, ...); { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); }
+    #define debug_println(msg, ...) { if(debug_level_enabled(LOG_LEVEL_DEBUG)) { SERIAL_OBJECT.println(msg, ##__VA_ARGS__); } }
+    #define debug_println_e(msg, ...) { if(debug_level_enabled(LOG_LEVEL_ERROR)) { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_println_w(msg, ...) { if(debug_level_enabled(LOG_LEVEL_WARNING)) { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_println_i(msg, ...) { if(debug_level_enabled(LOG_LEVEL_INFO)) { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.println(msg, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_println_t(msg, ...) { if(debug_level_enabled(LOG_LEVEL_TRACE)) { SERIAL_OBJECT.println(msg, ##__VA_ARGS__); } }
+
+    #define debug_printf(format, ...) { if(debug_level_enabled(LOG_LEVEL_DEBUG)) { SERIAL_OBJECT.printf(format, ##__VA_ARGS__); } }
+    #define debug_printf_e(format, ...) { if(debug_level_enabled(LOG_LEVEL_ERROR)) { Serial.print(DEBUG_LEVEL_ERROR_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_printf_w(format, ...) { if(debug_level_enabled(LOG_LEVEL_WARNING)) { Serial.print(DEBUG_LEVEL_WARNING_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_printf_i(format, ...) { if(debug_level_enabled(LOG_LEVEL_INFO)) { Serial.print(DEBUG_LEVEL_INFO_STYLE); SERIAL_OBJECT.printf(format, ##__VA_ARGS__); Utils::serial_style(STYLE_RESET); } }
+    #define debug_printf_t(format, ...) { if(debug_level_enabled(LOG_LEVEL_TRACE)) { SERIAL_OBJECT.printf(format, ##__VA_ARGS__); } }
 #else
-    #define debug_print(msg, ...); {}
-    #define debug_print_e(msg, ...); {}
-    #define debug_print_w(msg, ...); {}
-    #define debug_print_i(msg, ...); {}
-
-    #define debug_println(); {}
-    #define debug_println(msg, ...); {}
-    #define debug_println_e(msg, ...); {}
-    #define debug_println_w(msg, ...); {}
-    #define debug_println_i(msg, ...); {}
-
-    #define debug_printf(format, ...); {}
-    #define debug_printf_e(format, ...); {}
-    #define debug_printf_w(format, ...); {}
-    #define debug_printf_i(format, ...); {}
+    #define debug_print(msg, ...) {}
+    #define debug_print_e(msg, ...) {}
+    #define debug_print_w(msg, ...) {}
+    #define debug_print_i(msg, ...) {}
+    #define debug_print_t(msg, ...) {}
+
+    #define debug_println() {}
+    #define debug_println(msg, ...) {}
+    #define debug_println_e(msg, ...) {}
+    #define debug_println_w(msg, ...) {}
+    #define debug_println_i(msg, ...) {}
+    #define debug_println_t(msg, ...) {}
+
+    #define debug_printf(format, ...) {}
+    #define debug_printf_e(format, ...) {}
+    #define debug_printf_w(format, ...) {}
+    #define debug_printf_i(format, ...) {}
+    #define debug_printf_t(format, ...) {}
 
 #endif
 
@@ -31,6 +31,38 @@ const int MAX_SLEEP_TIME_SEC = 60 * 60 * 24; // One day
 
 const int MAX_SLEEP_CORRECTION_SEC = 60 * 5; // 5 mins
 
+/** When waking up on DS3231 alarm, timer wake up is kept as a fallback this much later */
+const int SLEEP_ALARM_FALLBACK_SEC = 60;
+
+/** Water measurements the adaptive sampling rate of change is calculated over */
+const int ADAPTIVE_SAMPLING_HISTORY_LEN = 4;
+
+/** Max seconds a tolerant wake up event may be delayed to share a wake up with a
+ * later one. 0 disables coalescing */
+const int SLEEP_COALESCE_WINDOW_SEC = 30;
+
+/** Marks deep sleep state in RTC memory as initialized */
+const uint32_t DEEP_SLEEP_STATE_MAGIC = 0x44534C50;
+
+/** Version of deep sleep state layout. Increase when DeepSleep::State changes */
+const uint16_t DEEP_SLEEP_STATE_VERSION = 27;
+
+/** Weight of a new scale decision, smooths schedule changes */
+const float POWER_GOVERNOR_SMOOTHING_ALPHA = 0.5;
+
+/** Min time between gauge readings for a net current measurement */
+const uint32_t POWER_GOVERNOR_MIN_BALANCE_SECS = 600;
+
+/** Shorter sleeps use light sleep, fast boot costs more than it saves */
+const int DEEP_SLEEP_MIN_SEC = 60;
+
+/** Marks warm boot counter in RTC memory as initialized */
+const uint32_t WARM_BOOT_MAGIC = 0x57424F31;
+
+/** Successive warm boots without a call home in between before forcing a full boot
+ * (eg. reset loop) */
+const int WARM_BOOT_MAX_SUCCESSIVE = 3;
+
 /** Min/max allowed values for calling home interval (mins) */
 const int CALL_HOME_INT_MINS_MIN = 1;           // 1 min
 const int CALL_HOME_INT_MINS_MAX = 24 * 60 * 2; // 2 days
@@ -45,15 +77,99 @@ const int MEASURE_WATER_SENSORS_INT_MINS_MAX = 24 * 60 * 1; // 1 day
 const unsigned long FAIL_CHECK_TIMESTAMP_START = 1567157191;
 const unsigned long FAIL_CHECK_TIMESTAMP_END = 2072091600;
 
-/** Samples configuration for analog */
-const int ADC_CYCLES = 128;
+/** Clock drift assumed until estimated from network syncs (ppm). DS3231 is +-2ppm plus aging,
+ * the RC slow clock ESP32 keeps time with in deep sleep is far worse */
+const float RTC_DRIFT_DEFAULT_EXT_RTC_PPM = 5;
+const float RTC_DRIFT_DEFAULT_SYSTEM_PPM = 500;
+
+/** Min interval a drift estimation is done over. Network time has 1 sec resolution,
+ * so over shorter intervals the estimation is mostly noise */
+const uint32_t RTC_DRIFT_MIN_INTERVAL_SECS = 2 * 24 * 3600;
+
+/** Weight of a new drift estimation in the model */
+const float RTC_DRIFT_GAIN = 0.5;
+
+/** Interval the RC slow clock is calibrated over against ext RTC. Ext RTC has 1 sec
+ * resolution, so an hour gives a period within ~300ppm */
+const uint32_t RTC_SLOW_CLOCK_CAL_INTERVAL_SECS = 60 * 60;
+
+/** Weight of a new slow clock calibration */
+const float RTC_SLOW_CLOCK_CAL_GAIN = 0.5;
+
+/** Max relative difference of calibrated period from boot calibration, else rejected */
+const float RTC_SLOW_CLOCK_MAX_ERROR = 0.1;
+
+/** Slow clock cycles used to calibrate DS3231 32K output (BOARD_EXT_32K_CLOCK) */
+const uint32_t RTC_SLOW_CLOCK_CAL_CYCLES = 1024;
+
+/** DS3231 converts temperature every 64 secs, a read within that returns the cached value */
+const uint32_t RTC_TEMP_CACHE_SECS = 64;
 
 /** Samples to average when reading battery voltage with internal ADC */
 const int ADC_BATTERY_LEVEL_SAMPLES = 20;
 
+/** Battery sampling stops early once the median's std error is below this (raw ADC) */
+const float ADC_BATTERY_CONVERGED_TOLERANCE_RAW = 2;
+
+/** Max samples when reading solar voltage with internal ADC */
+const int ADC_SOLAR_SAMPLES = 10;
+
+/** Solar sampling stops early once the median's std error is below this (raw ADC) */
+const float ADC_SOLAR_CONVERGED_TOLERANCE_RAW = 2;
+
+/** Vref used for ADC calibration when eFuse has none burned */
+const uint32_t ADC_DEFAULT_VREF_MV = 1100;
+
+/** ADC readings are reused for this long by AdcManager::read, channels sampled
+ * in one burst can be read separately */
+const uint32_t ADC_READING_MAX_AGE_MS = 1000;
+
+/** Max samples of a single sampling run (see Sampling) */
+const int SAMPLING_MAX_SAMPLES = 32;
+
+/** Samples further than this many std devs (estimated from MAD) from the median are outliers */
+const float SAMPLING_OUTLIER_MADS = 3;
+
+/** Scales MAD to std dev for normally distributed samples */
+const float SAMPLING_MAD_TO_STD_DEV = 1.4826;
+
 /** Time user has to hold button to enter config mode */
 const int CONFIG_MODE_BTN_HOLD_TIME_MS = 2000;
 
+/** Time user has to hold button to enter field offload mode instead (see FieldOffload) */
+const int FIELD_OFFLOAD_BTN_HOLD_TIME_MS = 6000;
+
+/******************************************************************************
+* Field offload
+******************************************************************************/
+/** SoftAP SSID, followed by the last 3 bytes of the MAC */
+const char FIELD_OFFLOAD_AP_SSID_PREFIX[] = "eliot-";
+
+/** HTTP port of downloads */
+const int FIELD_OFFLOAD_PORT = 80;
+
+/** Offload mode ends after this long without requests */
+const uint32_t FIELD_OFFLOAD_IDLE_TIMEOUT_MS = 10 * 60 * 1000;
+
+/** Server is polled for connections at this interval */
+const int FIELD_OFFLOAD_POLL_MS = 10;
+
+/** Timeout reading a request */
+const int FIELD_OFFLOAD_REQ_TIMEOUT_SECS = 3;
+
+/** Longest request or header line read, rest of it is dropped */
+const int FIELD_OFFLOAD_REQ_LINE_SIZE = 128;
+
+/** Bytes read from flash and sent at once. Two buffers from the scratch arena */
+const int FIELD_OFFLOAD_CHUNK_SIZE = 4096;
+
+/** Longest CSV row (timestamp, seq and schema fields) */
+const int FIELD_OFFLOAD_CSV_ROW_MAX_LEN = 512;
+
+/** Binary download header (see FieldOffload::OffloadHeader), "EOFL" */
+const uint32_t FIELD_OFFLOAD_BINARY_MAGIC = 0x4C464F45;
+const uint16_t FIELD_OFFLOAD_BINARY_VERSION = 1;
+
 /******************************************************************************
 * Debug
 ******************************************************************************/
@@ -66,6 +182,13 @@ const char TIMBER_AUTH_HEADER[] = "Bearer " TIMBER_API_KEY;
 
 /** Length of Wifi Serial buffer for storing messages temporarily */
 const int WIFI_SERIAL_BUFFER_SIZE = 512;
+/** Wifi Serial ring buffer of printed chars not sent yet. Chars are dropped when full */
+const int WIFI_SERIAL_RING_SIZE = 8192;
+/** Max size of a batch of messages sent to HTTP logging service */
+const int WIFI_SERIAL_FRAME_SIZE = 4096;
+/** Wifi Serial background task */
+const int WIFI_SERIAL_TASK_STACK_SIZE = 8192;
+const int WIFI_SERIAL_TASK_PRIORITY = 1;
 
 /******************************************************************************
 * WiFi
@@ -73,6 +196,36 @@ const int WIFI_SERIAL_BUFFER_SIZE = 512;
 /** Timeout when trying to connect to network */
 const int WIFI_CONNECT_TIMEOUT_SEC = 10;
 
+/** Timeout of fast reconnect to cached AP, full scan follows (see WifiModem) */
+const uint32_t WIFI_FAST_CONNECT_TIMEOUT_MS = 1500;
+
+/** Connection status is polled at this interval while connecting */
+const uint32_t WIFI_CONNECT_POLL_MS = 20;
+
+/** WiFi connect timeout when cellular is tried next (see Bearer) */
+const uint32_t BEARER_WIFI_CONNECT_TIMEOUT_MS = 5000;
+
+/** Bearer not tried first for this many call homes is tried first once */
+const uint8_t BEARER_PROBE_INTERVAL = 12;
+
+/** Weight of history in bearer stats, a new sample counts 1 / BEARER_EWMA_WEIGHT */
+const uint32_t BEARER_EWMA_WEIGHT = 4;
+
+/** Marks valid bearer stats in RTC memory */
+const uint32_t BEARER_STATS_MAGIC = 0x42524552;
+
+/** Marks valid backlog drain state in RTC memory */
+const uint32_t BACKLOG_DRAIN_MAGIC = 0x4E415244;
+
+/** Marks a valid fast reconnect cache in RTC memory */
+const uint32_t WIFI_FAST_CONNECT_MAGIC = 0x57494643;
+
+/** Marks valid phases carried to next call home in RTC memory (see CallHomeBudget) */
+const uint32_t CALL_HOME_BUDGET_MAGIC = 0x43484242;
+
+/** Marks a valid cached TLS session in RTC memory (see TlsClient) */
+const uint32_t TLS_SESSION_MAGIC = 0x544C5353;
+
 /******************************************************************************
  * Data stores
  *****************************************************************************/
@@ -90,10 +243,149 @@ const int STORE_CLEANUP_FILE_COUNT = 500;
  * is triggered */
 const int STORE_MAX_FILE_COUNT = 1000;
 
+/** Older entry layouts a store can be migrated from (see StoreRegistry::check_format()) */
+const int STORE_MAX_OLD_LAYOUTS = 2;
+
+/** Temp file used when truncating a partially written entry from a store file */
+const char* const DATA_STORE_TRUNCATE_TMP_PATH = "/trunc.tmp";
+
+/** Temp file store files are merged into by compaction, renamed into the store when complete */
+const char* const DATA_STORE_COMPACT_TMP_PATH = "/compact.tmp";
+
+/** Temp file a store file of an older entry layout is rewritten into (see DataStore::migrate()) */
+const char* const DATA_STORE_MIGRATE_TMP_PATH = "/migrate.tmp";
+
+/** Entries from file start checked to tell the layout of a store file by their CRC */
+const int DATA_STORE_MIGRATE_CHECK_ENTRIES = 4;
+
+/** Dir where stores keep the cursor of partially submitted files */
+const char* const DATA_STORE_CURSOR_DIR = "/cur";
+
+/** Dir where stores keep their sequence number state (see DataStore::next_seq()) */
+const char* const DATA_STORE_SEQ_DIR = "/seq";
+
+/** Dir prefix of archive twins of stores (see DataStore::remove_file()) */
+const char* const DATA_STORE_ARCHIVE_DIR = "/ar";
+
+/** Dir prefix of backfill twins of stores (see Backfill) */
+const char* const DATA_STORE_BACKFILL_DIR = "/bf";
+
+/** Sequence numbers reserved in flash at a time */
+const uint32_t DATA_STORE_SEQ_RESERVE = 256;
+
+/** Stores whose next sequence number is kept in RTC memory */
+const int DATA_STORE_SEQ_RTC_SLOTS = 16;
+
+/** Version of the store file format (DataStore::Entry). Bumped with every change
+ * of an entry layout, stores written with an older version are migrated on boot
+ * (see StoreRegistry::check_format()). 2: seq, 3: water sensor presence mask,
+ * 4: energy profile CPU max frequency time */
+const uint16_t DATA_STORE_FORMAT_VERSION = 4;
+
+/** File holding the store file format version */
+const char* const DATA_STORE_FORMAT_PATH = "/store_fmt";
+
+/** Entries read from flash with a single read by DataStoreReader. Store files hold
+ * up to *_ENTRIES_PER_SUBMIT_REQ entries, so a file is usually read at once. Max 32 */
+const int DATA_STORE_READER_BUFF_ENTRIES = 8;
+
+/** Readers that may iterate a store at the same time, each keeps one file open */
+const int DATA_STORE_MAX_READERS = 2;
+
+/******************************************************************************
+ * Ring store
+ *****************************************************************************/
+/** Label of raw data partition used by ring stores (see partitions_ringstore.csv) */
+const char* const RING_STORE_PARTITION_LABEL = "ringstore";
+
+/** Flash sector size, the unit a ring store is erased in */
+const int RING_STORE_SECTOR_SIZE = 4096;
+
+/** Marks a ring store sector as in use */
+const uint32_t RING_STORE_SECTOR_MAGIC = 0x52535431;
+
+/** Value of an erased flash word */
+const uint32_t RING_STORE_ERASED_WORD = 0xFFFFFFFF;
+
 /******************************************************************************
  * Telemetry data
  *****************************************************************************/
-const int TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE = 2048;
+/** Telemetry request output buffer. Allocated on heap while submitting */
+const int TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE = 4096;
+
+/** Max bytes of a single telemetry request body. Entries from multiple store
+ * files are packed into a request up to this size. Must be smaller than
+ * TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE */
+const int TELEMETRY_REQ_BYTE_BUDGET = 3072;
+
+/** Max bytes of a telemetry request streamed from the builder (FLAGS.STREAMED_TELEMETRY).
+ * No output buffer is used, requests are usually limited by the builder's doc size */
+const int TELEMETRY_STREAMED_REQ_BYTE_BUDGET = 8192;
+
+/** Max store files packed into a single telemetry request */
+const int TELEMETRY_MAX_FILES_PER_REQ = 8;
+
+/** Time budget (ms) of telemetry submission in a call home. Stores are deferred to
+ * the next call home once their share of it is used */
+const uint32_t TELEMETRY_TIME_BUDGET_MS = 5UL * 60 * 1000;
+
+/** Share (%) of the time budget low priority stores (debug data) may use */
+const uint8_t TELEMETRY_LOW_PRIORITY_BUDGET_PERCENT = 50;
+
+/** Requests per store before moving to the next one (round-robin) */
+const int TELEMETRY_SLICE_REQUESTS = 4;
+
+/** Telemetry store priorities, higher ones are submitted first in every round */
+const uint8_t TELEMETRY_PRIORITY_HIGH = 0;
+const uint8_t TELEMETRY_PRIORITY_NORMAL = 1;
+const uint8_t TELEMETRY_PRIORITY_LOW = 2;
+
+/** Output buffer of TbJsonEmitter, holds a whole request */
+const int TB_JSON_EMITTER_BUFF_SIZE = TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE;
+
+/** Max entries in a single TbJsonEmitter request */
+const int TB_JSON_EMITTER_MAX_ENTRIES = 128;
+
+/** Telemetry uploader task, sends requests while the next one is built */
+const int TELEMETRY_UPLOADER_STACK_SIZE = 8192;
+const int TELEMETRY_UPLOADER_PRIORITY = 1;
+/** Core uploader is pinned to. Arduino loop runs on core 1 */
+const int TELEMETRY_UPLOADER_CORE = 0;
+
+/** Deflate compressor probes (speed/ratio trade-off, see miniz tdefl flags) */
+const int GZIP_DEFLATE_PROBES = 128;
+
+/** Input fed to the compressor at a time (see GzipStream) */
+const int GZIP_STREAM_CHUNK_SIZE = 256;
+
+/** Binary telemetry payload format version (see TbBinaryBuilder) */
+const uint8_t BINARY_TELEMETRY_VERSION = 3;
+
+/** Raw binary payload buffer size. Base64 encoded it must fit TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE */
+const int BINARY_TELEMETRY_BUFF_SIZE = 2048;
+
+/** Telemetry key binary payload is sent as */
+#define BINARY_TELEMETRY_KEY "bin"
+
+/** Binary payload schema ids, one per entry struct. Must match server side converter */
+const uint8_t BINARY_SCHEMA_WATER_SENSOR_DATA = 1;
+const uint8_t BINARY_SCHEMA_ATMOS41_DATA = 2;
+const uint8_t BINARY_SCHEMA_SOIL_MOISTURE_DATA = 3;
+const uint8_t BINARY_SCHEMA_FO_DATA = 4;
+const uint8_t BINARY_SCHEMA_LIGHTNING_DATA = 5;
+const uint8_t BINARY_SCHEMA_ENERGY_PROFILE_DATA = 6;
+
+/** Columnar telemetry payload format version (see TbColumnarBuilder). Uses the binary schema ids */
+const uint8_t COLUMNAR_TELEMETRY_VERSION = 2;
+
+/** Telemetry key columnar payload is sent as */
+#define COLUMNAR_TELEMETRY_KEY "col"
+
+/** Decimals float fields without fixed rounding are scaled by */
+const int COLUMNAR_TELEMETRY_DEFAULT_DECIMALS = 2;
+
+/** Max entries in a single columnar request. Entries are kept raw until built */
+const int COLUMNAR_TELEMETRY_MAX_ENTRIES = 128;
 
 /******************************************************************************
  * Water Sensor data
@@ -102,7 +394,7 @@ const int TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE = 2048;
 const char* const WATER_SENSOR_DATA_PATH = "/was";
 
 /** Arduino JSON doc size */
-const int WATER_SENSOR_DATA_JSON_DOC_SIZE = 1024;
+const int WATER_SENSOR_DATA_JSON_DOC_SIZE = 4096;
 /** Sensor data entries to group into a single json packet for submission */
 const int WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ = 8;
 
@@ -127,7 +419,7 @@ const char WATER_SENSOR_DATA_KEY_WATER_PRESENCE[] = "s_presence";
 const char* const SOIL_MOISTURE_DATA_PATH = "/sm";
 
 /** Arduino JSON doc size */
-const int SOIL_MOISTURE_DATA_JSON_DOC_SIZE = 1024;
+const int SOIL_MOISTURE_DATA_JSON_DOC_SIZE = 4096;
 /** Sensor data entries to group into a single json packet for submission */
 const int SOIL_MOISTURE_DATA_ENTRIES_PER_SUBMIT_REQ = 8;
 
@@ -144,7 +436,7 @@ const char SOIL_MOISTURE_DATA_KEY_CONDUCTIVITY[] = "sm_cond";
 const char* const ATMOS41_DATA_PATH = "/wes";
 
 /** Arduino JSON doc size */
-const int ATMOS41_DATA_JSON_DOC_SIZE = 1024;
+const int ATMOS41_DATA_JSON_DOC_SIZE = 4096;
 /** Sensor data entries to group into a single json packet for submission */
 const int ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ = 4;
 
@@ -169,7 +461,7 @@ const char ATMOS41_DATA_KEY_DEW_POINT[] = "ws_dew_pt";
 const char* const LIGHTNING_DATA_PATH = "/ls";
 
 /** Arduino JSON doc size */
-const int LIGHTNING_DATA_JSON_DOC_SIZE = 1024;
+const int LIGHTNING_DATA_JSON_DOC_SIZE = 4096;
 /** Sensor data entries to group into a single json packet for submission */
 const int LIGHTNING_DATA_ENTRIES_PER_SUBMIT_REQ = 8;
 
@@ -201,6 +493,19 @@ const uint32_t LIGHTNING_IRQ_DEBOUNCE_MS = 1000;
 /** Time after which noise/disturber counter will be logged */
 const uint32_t LIGHTNING_REPORT_LOG_INTERVAL_SEC = 60 * 60;
 
+/** Strikes buffered in RTC memory before commiting to flash. Buffer is also
+ * commited on every scheduled wake up */
+const int LIGHTNING_BUFFER_LEN = 32;
+
+/** Marks RTC memory strike buffer as initialized */
+const uint32_t LIGHTNING_BUFFER_MAGIC = 0x4C42554E;
+
+/** Upper bounds of distance (km) and energy histogram buckets in aggregation mode,
+ * last bucket is everything above */
+const uint8_t LIGHTNING_HIST_DISTANCE_KM[] = {5, 15, 30};
+const uint32_t LIGHTNING_HIST_ENERGY[] = {10000, 100000, 1000000};
+const int LIGHTNING_HIST_BUCKETS = sizeof(LIGHTNING_HIST_DISTANCE_KM) / sizeof(LIGHTNING_HIST_DISTANCE_KM[0]) + 1;
+
 // Module specific constants
 
 /*
@@ -209,32 +514,264 @@ const uint32_t LIGHTNING_REPORT_LOG_INTERVAL_SEC = 60 * 60;
 #define LIGHTNING_SENSOR_CJMCU 1
 #define LIGHTNING_SENSOR_DFROBOT 2
 
+/******************************************************************************
+ * LoRa relay (see LoraRelay)
+ *****************************************************************************/
+/** Radio settings, same on leaves and gateway */
+const float LORA_RELAY_FREQ = 868.1;
+const float LORA_RELAY_BW = 125.0;
+const uint8_t LORA_RELAY_SF = 9;
+const uint8_t LORA_RELAY_CR = 5;
+const uint8_t LORA_RELAY_SYNC_WORD = 0x4E;
+const int8_t LORA_RELAY_TX_POWER = 14;
+
+/** First byte of every frame */
+const uint8_t LORA_RELAY_FRAME_MAGIC = 0xE1;
+
+/** Max LoRa payload */
+const int LORA_RELAY_MAX_FRAME_SIZE = 255;
+
+/** Leaves the gateway tracks duplicate (retried) frames of within an RX window */
+const int LORA_RELAY_MAX_LEAVES = 16;
+
+/** Path in data store where gateway keeps relayed entries */
+const char* const RELAY_DATA_PATH = "/rl";
+
+/******************************************************************************
+ * Firmware distribution over LoRa (see LoraOta)
+ *****************************************************************************/
+/** Image bytes per chunk frame */
+const int LORA_OTA_CHUNK_SIZE = 192;
+
+/** Chunks of a parity group, one XOR parity chunk recovers any one of them */
+const int LORA_OTA_FEC_GROUP = 8;
+
+/** Chunks a leaf requests at once, multiple of LORA_OTA_FEC_GROUP */
+const int LORA_OTA_REQUEST_WINDOW = 64;
+
+/** Largest image, size of the app partitions */
+const uint32_t LORA_OTA_MAX_IMAGE_SIZE = 0x1E0000;
+const int LORA_OTA_MAX_CHUNKS = (LORA_OTA_MAX_IMAGE_SIZE + LORA_OTA_CHUNK_SIZE - 1) / LORA_OTA_CHUNK_SIZE;
+
+/** Leaf download state, chunks received so far */
+const char* const LORA_OTA_STATE_PATH = "/lota";
+const uint32_t LORA_OTA_STATE_MAGIC = 0x41544F4C;
+
+/** Gateway image cache in RTC memory, "LIMG" */
+const uint32_t LORA_OTA_IMAGE_MAGIC = 0x474D494C;
+
+static_assert(LORA_OTA_REQUEST_WINDOW % LORA_OTA_FEC_GROUP == 0, "Request whole parity groups");
+
+/** Gateway API device name of a relayed device, followed by its id in hex */
+const char RELAY_DATA_DEVICE_NAME_PREFIX[] = "eliot-";
+
+/** Max size of a relayed sensor data struct */
+const int RELAY_DATA_MAX_ENTRY_SIZE = 72;
+
+/** Entries per store file */
+const int RELAY_DATA_ENTRIES_PER_SUBMIT_REQ = 8;
+
+// Telemetry key names
+const char RELAY_DATA_KEY_TS[] = "ts";
+/** RSSI of the frame an entry was relayed in */
+const char RELAY_DATA_KEY_RSSI[] = "relay_rssi";
+
+/******************************************************************************
+ * Rollups of evicted sensor data (see Retention)
+ *****************************************************************************/
+/** Path in data store where rollups are stored */
+const char* const ROLLUP_DATA_PATH = "/ru";
+
+/** Arduino JSON doc size. Keys are built per entry and copied into the doc */
+const int ROLLUP_DATA_JSON_DOC_SIZE = 6144;
+/** Rollups to group into a single json packet for submission */
+const int ROLLUP_DATA_ENTRIES_PER_SUBMIT_REQ = 2;
+
+/** Max fields of a store schema rolled up, rest are dropped */
+const int ROLLUP_MAX_FIELDS = 16;
+
+/** Max size of a rolled up sensor data struct, entries are read into a buffer of this size */
+const int ROLLUP_MAX_ENTRY_SIZE = 128;
+
+// Telemetry key names
+const char ROLLUP_DATA_KEY_TIMESTAMP[] = "ts";
+/** Suffixes of rollup keys, appended to "<store key>_<field key>" */
+const char ROLLUP_DATA_KEY_MEAN_SUFFIX[] = "_avg";
+const char ROLLUP_DATA_KEY_MIN_SUFFIX[] = "_min";
+const char ROLLUP_DATA_KEY_MAX_SUFFIX[] = "_max";
+/** Entries in rollup, appended to "<store key>" */
+const char ROLLUP_DATA_KEY_COUNT_SUFFIX[] = "_ru_n";
+
+/******************************************************************************
+ * Energy profile
+ *****************************************************************************/
+/** Path in data store where daily energy summaries are stored */
+const char* const ENERGY_PROFILE_DATA_PATH = "/ep";
+
+/** Arduino JSON doc size */
+const int ENERGY_PROFILE_DATA_JSON_DOC_SIZE = 4096;
+/** Summaries to group into a single json packet for submission */
+const int ENERGY_PROFILE_DATA_ENTRIES_PER_SUBMIT_REQ = 4;
+
+// Telemetry key names
+const char ENERGY_PROFILE_DATA_KEY_TIMESTAMP[] = "ts";
+const char ENERGY_PROFILE_DATA_KEY_SLEEP_SECS[] = "ep_sleep_s";
+const char ENERGY_PROFILE_DATA_KEY_ACTIVE_SECS[] = "ep_active_s";
+const char ENERGY_PROFILE_DATA_KEY_GSM_SECS[] = "ep_gsm_s";
+const char ENERGY_PROFILE_DATA_KEY_GPRS_SECS[] = "ep_gprs_s";
+const char ENERGY_PROFILE_DATA_KEY_RF_SECS[] = "ep_rf_s";
+const char ENERGY_PROFILE_DATA_KEY_SDI12_SECS[] = "ep_sdi12_s";
+const char ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_SECS[] = "ep_was_s";
+const char ENERGY_PROFILE_DATA_KEY_SLEEP_MAH[] = "ep_sleep_mah";
+const char ENERGY_PROFILE_DATA_KEY_ACTIVE_MAH[] = "ep_active_mah";
+const char ENERGY_PROFILE_DATA_KEY_GSM_MAH[] = "ep_gsm_mah";
+const char ENERGY_PROFILE_DATA_KEY_GPRS_MAH[] = "ep_gprs_mah";
+const char ENERGY_PROFILE_DATA_KEY_RF_MAH[] = "ep_rf_mah";
+const char ENERGY_PROFILE_DATA_KEY_SDI12_MAH[] = "ep_sdi12_mah";
+const char ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_MAH[] = "ep_was_mah";
+const char ENERGY_PROFILE_DATA_KEY_SOLAR_MAH[] = "ep_solar_mah";
+const char ENERGY_PROFILE_DATA_KEY_NVS_COMMITS[] = "ep_nvs_commits";
+const char ENERGY_PROFILE_DATA_KEY_NVS_COMMIT_MS[] = "ep_nvs_ms";
+const char ENERGY_PROFILE_DATA_KEY_CPU_MAX_SECS[] = "ep_cpu_max_s";
+const char ENERGY_PROFILE_DATA_KEY_CPU_MAX_MAH[] = "ep_cpu_max_mah";
+
+/** Lowest CPU frequency APB runs at 80MHz at (see PowerLock) */
+const int DFS_APB_MAX_CPU_MHZ = 80;
+
+/** Length of an accounting day */
+const uint32_t ENERGY_PROFILER_DAY_SECS = 60 * 60 * 24;
+
+/** Longer phases mean system time was set in between, they are dropped */
+const uint64_t ENERGY_PROFILER_MAX_PHASE_MS = (uint64_t)MAX_SLEEP_TIME_SEC * 2 * 1000;
+
 /******************************************************************************
  * Log
  *****************************************************************************/
 /** Path in data store where log data is stored */
-const char* const LOG_DATA_PATH = "/log";
+const char* const LOG_DATA_PATH = "/lg";
+/** Store of old, larger log entries. Converted on first boot after update */
+const char* const LOG_LEGACY_DATA_PATH = "/log";
 /** Log data entries to group into a single data packet for submission */
 const int LOG_ENTRIES_PER_SUBMIT_REQ = 8;
 /** Arduino JSON doc size */
-const int LOG_JSON_DOC_SIZE = 1024;
+const int LOG_JSON_DOC_SIZE = 4096;
 /** JSON output buffer size */
 const int LOG_JSON_OUTPUT_BUFF_SIZE = 1024;
+/** Marks RTC memory shadow of uncommited logs as initialized */
+const uint32_t LOG_RTC_SHADOW_MAGIC = 0x4C4F4702;
+/** Bytes for varint encoded meta values in a log entry */
+const int LOG_ENTRY_META_LEN = 8;
+/** Max meta values in a log entry */
+const int LOG_ENTRY_MAX_METAS = 4;
+/** Set in entry meta info when metas are stored as raw 32-bit values */
+const uint8_t LOG_ENTRY_META_RAW = 0x80;
+/** Entries logged and not yet moved to the log store. Must be a power of 2 */
+const int LOG_RING_LEN = 32;
+/** Max codes in log policy table, sizes state kept over deep sleep */
+const int LOG_POLICY_MAX = 8;
+/** Window entries of an aggregated code are summarized in */
+const uint32_t LOG_AGGREGATE_WINDOW_SECS = 60 * 60;
+/** Window in which only the first entry of a rate limited code is stored */
+const uint32_t LOG_RATE_LIMIT_WINDOW_SECS = 10 * 60;
+
+/******************************************************************************
+ * Trace
+ *****************************************************************************/
+/** Finished spans kept in RAM, oldest dropped */
+const int TRACE_RING_LEN = 256;
+
+/** Spans of armed wake cycles (see Trace::arm()), uploaded on call home */
+const char* const TRACE_PATH = "/trace";
+
+/** Cycles are dropped once the file grows to this size */
+const uint32_t TRACE_FILE_MAX_SIZE = 16 * 1024;
+
+/** Format version of uploaded cycles */
+const uint8_t TRACE_UPLOAD_VERSION = 1;
+
+/** Telemetry of a cycle, fits a full ring base64 encoded */
+const int TB_TRACE_PAYLOAD_SIZE = 3200;
+const char TB_TRACE_PAYLOAD_FORMAT[] = "{\"ts\":%llu,\"values\":{\"trace\":\"";
+
+/******************************************************************************
+ * Raw capture (see Capture)
+ *****************************************************************************/
+/** Capture file, records are appended until it is full */
+const char* const CAPTURE_PATH = "/cap";
+
+/** Capture stops once the file grows to this size */
+const uint32_t CAPTURE_MAX_FILE_SIZE = 64 * 1024;
+
+/** Records are buffered in RAM and appended to the file when full or before sleep */
+const int CAPTURE_BUFF_SIZE = 1024;
+
+/** Capture file header (see Capture::FileHeader), "ECAP" */
+const uint32_t CAPTURE_FILE_MAGIC = 0x50414345;
+const uint16_t CAPTURE_FILE_VERSION = 1;
+
+/******************************************************************************
+ * IPFS (see Ipfs)
+ *****************************************************************************/
+/** Blocks whose CID was submitted but not their content yet, as CAR sections */
+const char* const IPFS_PENDING_PATH = "/ipfs";
+
+/** New blocks are rejected (no CID submitted) once pending ones take this much */
+const uint32_t IPFS_PENDING_MAX_SIZE = 96 * 1024;
+
+/** Most blocks uploaded in one CAR, all are roots of its header */
+const int IPFS_MAX_BLOCKS_PER_UPLOAD = 64;
+
+/** Binary CIDv1 of a raw block with a sha2-256 multihash */
+const int IPFS_CID_LEN = 36;
+
+/** Base32 CID string: multibase prefix, 58 chars and NUL */
+const int IPFS_CID_STR_SIZE = 60;
+
+/** Kubo RPC, imports a CAR and pins its roots */
+const char* const IPFS_DAG_IMPORT_PATH = "/api/v0/dag/import?pin-roots=true";
+
+/** Multipart boundary of CAR uploads */
+const char* const IPFS_MULTIPART_BOUNDARY = "eliotcarboundary";
 
 /******************************************************************************
 * SDI12 debug log
 ******************************************************************************/
-const int SDI12_LOG_JSON_DOC_SIZE = 1024;
+const int SDI12_LOG_JSON_DOC_SIZE = 4096;
+
+/** RAM ring of the transcript of the current measurement, oldest lines dropped */
+const int SDI12_LOG_RING_SIZE = 2048;
+
+/** Persist request counter in RTC memory (see SDI12Log::request_persist()), "SLOG" */
+const uint32_t SDI12_LOG_PERSIST_MAGIC = 0x474F4C53;
 
 // Telemetry key names
 const char SDI12_LOG_KEY_TIMESTAMP[]  = "ts";
 const char SDI12_LOG_KEY_RAW_DATA[]  = "sdi12";
 
+/******************************************************************************
+ * Report by exception filter (see Deadband)
+ *****************************************************************************/
+/** Max fields of a store schema a deadband can be set for */
+const int DEADBAND_MAX_FIELDS = 20;
+
+/** Keys of sensor stores (SensorStore) in remote control deadbands and rollup telemetry */
+const char* const SENSOR_STORE_KEYS[] = {"was", "sm", "atmos41", "fo"};
+
+/** Shortest heartbeat accepted from remote control */
+const int DEADBAND_MIN_HEARTBEAT_SECS = 60;
+
 /******************************************************************************
  * Remote Control
  *****************************************************************************/
 /** JSON doc size for received remote config data */
-const int REMOTE_CONTROL_JSON_DOC_SIZE = 1024;
+const int REMOTE_CONTROL_JSON_DOC_SIZE = 1536;
+
+/** JSON doc size of filter with all remote control keys */
+const int REMOTE_CONTROL_FILTER_DOC_SIZE = 512;
+
+/** Response buffer of data id only request, checked before fetching all remote control data */
+const int REMOTE_CONTROL_ID_RESP_BUFF_LEN = 64;
+const int REMOTE_CONTROL_ID_JSON_DOC_SIZE = 96;
 
 // Sent/received JSON parameter names
 const char RC_TB_KEY_REMOTE_CONTROL_DATA_ID[] = "data_id";
@@ -251,6 +788,23 @@ const char RC_TB_KEY_DO_RTC_SYNC[] = "do_rtc";
 const char RC_TB_KEY_FW_URL[] = "fw_url";
 const char RC_TB_KEY_FW_VERSION[] = "fw_v";
 const char RC_TB_KEY_FW_MD5[] = "fw_md5";
+/** Patch to fw_v against the fw_delta_base version, used instead of fw_url when running that version */
+const char RC_TB_KEY_FW_DELTA_URL[] = "fw_delta_url";
+const char RC_TB_KEY_FW_DELTA_BASE[] = "fw_delta_base";
+const char RC_TB_KEY_DEADBANDS[] = "db";
+const char RC_TB_KEY_DEADBAND_HEARTBEAT[] = "db_hb";
+const char RC_TB_KEY_CALL_HOME_PHASE[] = "ch_phase";
+/** Resubmit archived data: {"from": tstamp, "to": tstamp, "stores": StoreId bitmask, 0 for all} */
+const char RC_TB_KEY_DO_BACKFILL[] = "do_backfill";
+const char RC_TB_KEY_BACKFILL_FROM[] = "from";
+const char RC_TB_KEY_BACKFILL_TO[] = "to";
+const char RC_TB_KEY_BACKFILL_STORES[] = "stores";
+/** Persist SDI12 transcripts of this many next measurements, failed or not */
+const char RC_TB_KEY_SDI12_LOG[] = "sdi12_log";
+/** Arm detailed tracing: {"cycles": wake cycles, "mins": minutes}, whichever lasts longer */
+const char RC_TB_KEY_TRACE[] = "trace";
+const char RC_TB_KEY_TRACE_CYCLES[] = "cycles";
+const char RC_TB_KEY_TRACE_MINS[] = "mins";
 
 /******************************************************************************
  * Client attributes
@@ -258,18 +812,33 @@ const char RC_TB_KEY_FW_MD5[] = "fw_md5";
 /** JSON doc size for client attributes request body */
 const int CLIENT_ATTRIBUTES_JSON_DOC_SIZE = 1024;
 
+/** Max client attributes tracked for delta publishing, more are always published */
+const int CLIENT_ATTR_MAX_KEYS = 32;
+
+/** Serialized size of an attribute value to hash */
+const int CLIENT_ATTR_VALUE_BUFF_SIZE = 48;
+
 // Client attribute names
 const char TB_ATTR_CUR_FW_V[] = "cur_fw_v";
 const char TB_ATTR_CUR_WAS_INT[] = "cur_was_int";
 const char TB_ATTR_CUR_WES_INT[] = "cur_wes_int";
 const char TB_ATTR_CUR_SM_INT[] = "cur_sm_int";
 const char TB_ATTR_CUR_CH_INT[] = "cur_ch_int";
+const char TB_ATTR_CUR_POWER_SCALE[] = "cur_pwr_scale";
 const char TB_ATTR_CUR_FO_ID[] = "cur_fo_id";
 const char TB_ATTR_CUR_FO_EN[] = "cur_fo_en";
 const char TB_ATTR_CUR_SYSTEM_TIME[] = "cur_time";
 const char TB_ATTR_UPTIME[] = "uptime";
 const char TB_ATTR_FLAGS[] = "flags";
 const char TB_ATTR_AQUATROLL_MODEL[] = "troll_model";
+/** Min free heap since boot. Per phase heap and per task stack are added too (see MemoryMonitor) */
+const char TB_ATTR_MEM_HEAP_MIN[] = "mem_heap_min";
+/** Max bytes used from scratch arena since boot */
+const char TB_ATTR_MEM_SCRATCH_PEAK[] = "mem_scratch_peak";
+const char TB_ATTR_MEM_PSRAM_FREE[] = "mem_psram_free";
+/** Backlog drain progress, only attributes published while draining (see BacklogDrain) */
+const char TB_ATTR_DRAIN_FILES_LEFT[] = "drain_files_left";
+const char TB_ATTR_DRAIN_PERCENT[] = "drain_pct";
 
 /******************************************************************************
  * Calling home
@@ -280,6 +849,45 @@ const char TB_ATTR_AQUATROLL_MODEL[] = "troll_model";
  */
 const char TB_TELEMETRY_URL_FORMAT[] = "/api/v1/%s/telemetry";
 
+/** Value every stored entry's sequence number is sent as (see DataStore::Entry) */
+const char TB_TELEMETRY_SEQ_KEY[] = "seq";
+
+/** Key of telemetry response (HTTP) acknowledging stored entries up to a sequence
+ * number, eg. {"ack_seq": 1234}. Those are skipped when a failed request is retried */
+const char TB_TELEMETRY_ACK_SEQ_KEY[] = "ack_seq";
+
+/** Telemetry response buffer, only an ack_seq object is expected */
+const int TB_TELEMETRY_RESP_BUFF_SIZE = 64;
+
+/**
+ * Alarm telemetry sent by CallHome::send_alarm() before anything else
+ * Params: timestamp (sec), alarm name, value
+ */
+const char TB_ALARM_PAYLOAD_FORMAT[] = "{\"ts\":%u000,\"values\":{\"alarm\":\"%s\",\"alarm_val\":%d}}";
+const int TB_ALARM_PAYLOAD_SIZE = 96;
+
+/**
+ * Uplink metrics telemetry sent by CallHome::end() (see UplinkMetrics)
+ * Params: timestamp (sec), attach ms, PDP ms, bytes sent, bytes received, requests,
+ * RTT median ms, RTT max ms, 2xx, 4xx, 5xx, other statuses, timeouts, retries,
+ * RSSI, RSRP, RSRQ, operator, GSM::Rat
+ */
+const char TB_UPLINK_METRICS_PAYLOAD_FORMAT[] = "{\"ts\":%u000,\"values\":{\"ul_att\":%u,\"ul_pdp\":%u,"
+	"\"ul_tx\":%u,\"ul_rx\":%u,\"ul_req\":%u,\"ul_rtt50\":%u,\"ul_rttmax\":%u,\"ul_2xx\":%u,\"ul_4xx\":%u,"
+	"\"ul_5xx\":%u,\"ul_oth\":%u,\"ul_to\":%u,\"ul_rtx\":%u,\"ul_rssi\":%d,\"ul_rsrp\":%d,\"ul_rsrq\":%d,"
+	"\"ul_op\":\"%s\",\"ul_rat\":%u}}";
+const int TB_UPLINK_METRICS_PAYLOAD_SIZE = 384;
+
+/**
+ * Flash health telemetry entry (see StoreRegistry::build_fs_stats_payload()),
+ * head followed by a store part per store with files, keyed by store dir.
+ * Head params: timestamp, used bytes, total bytes.
+ * Store params: files, bytes, oldest file timestamp, fragmentation %
+ */
+const char TB_FS_STATS_PAYLOAD_HEAD_FORMAT[] = "{\"ts\":%u000,\"values\":{\"fs_used\":%u,\"fs_total\":%u";
+const char TB_FS_STATS_STORE_FORMAT[] = ",\"fs_%s_f\":%d,\"fs_%s_b\":%u,\"fs_%s_old\":%u,\"fs_%s_frag\":%u";
+const int TB_FS_STATS_PAYLOAD_SIZE = 1024;
+
 /**
  * TB API URL for publishing client attributes
  * Params: device access token
@@ -290,7 +898,142 @@ const char TB_CLIENT_ATTRIBUTES_URL_FORMAT[] = "/api/v1/%s/attributes?clientKeys
  * TB API URL for getting shared attributes for remote control
  * Params: device access token
 */
-const char TB_SHARED_ATTRIBUTES_URL_FORMAT[] = "/api/v1/%s/attributes?sharedKeys=data_id,ch_int,fw_v,fw_url,fw_md5,was_int,wes_int,sm_int,ch_int,do_ota,do_reboot,do_format,do_rtc,do_fo_scan,fo_en";
+#define TB_SHARED_ATTRIBUTE_KEYS "data_id,ch_int,fw_v,fw_url,fw_md5,fw_delta_url,fw_delta_base,was_int,wes_int,sm_int,ch_int,do_ota,do_reboot,do_format,do_rtc,do_fo_scan,fo_en,db,db_hb,ch_phase"
+const char TB_SHARED_ATTRIBUTES_URL_FORMAT[] = "/api/v1/%s/attributes?sharedKeys=" TB_SHARED_ATTRIBUTE_KEYS;
+
+/** Shared attributes request with data id only, rest is requested only when id changed */
+#define TB_SHARED_ATTRIBUTE_ID_KEYS "data_id"
+const char TB_SHARED_ATTRIBUTES_ID_URL_FORMAT[] = "/api/v1/%s/attributes?sharedKeys=" TB_SHARED_ATTRIBUTE_ID_KEYS;
+
+/******************************************************************************
+ * MQTT transport (DeviceConfig transport setting)
+ *****************************************************************************/
+/** TB MQTT port */
+const uint16_t TB_MQTT_PORT = 1883;
+
+/** TB gateway API telemetry topic, payload keyed by device name (see TbGatewayJsonBuilder) */
+const char TB_MQTT_GATEWAY_TELEMETRY_TOPIC[] = "v1/gateway/telemetry";
+
+/** Arduino JSON doc size of a gateway API request */
+const int TB_GATEWAY_JSON_DOC_SIZE = 8192;
+/** Max entries (of all devices) in a gateway API request */
+const int TB_GATEWAY_JSON_MAX_ENTRIES = 64;
+/** Buffer size of a gateway API device name */
+const int TB_GATEWAY_DEVICE_NAME_SIZE = 32;
+
+/** TB device API topics */
+const char TB_MQTT_TELEMETRY_TOPIC[] = "v1/devices/me/telemetry";
+const char TB_MQTT_ATTRIBUTES_TOPIC[] = "v1/devices/me/attributes";
+const char TB_MQTT_ATTRIBUTES_REQ_TOPIC[] = "v1/devices/me/attributes/request/1";
+const char TB_MQTT_ATTRIBUTES_RESP_TOPIC[] = "v1/devices/me/attributes/response/+";
+
+/** Shared attributes request message */
+const char TB_MQTT_SHARED_ATTRIBUTES_REQ[] = "{\"sharedKeys\":\"" TB_SHARED_ATTRIBUTE_KEYS "\"}";
+const char TB_MQTT_SHARED_ATTRIBUTES_ID_REQ[] = "{\"sharedKeys\":\"" TB_SHARED_ATTRIBUTE_ID_KEYS "\"}";
+
+/** MQTT packet buffer, must fit a whole telemetry request */
+const int MQTT_BUFFER_SIZE = TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE + 128;
+
+/** Socket read timeout */
+const int MQTT_SOCKET_TIMEOUT_SEC = 15;
+
+/** Time to wait for response to a request (eg. shared attributes) */
+const uint32_t MQTT_RESPONSE_TIMEOUT = 10000;
+
+/** Modem socket (mux) used by MQTT */
+const uint8_t MQTT_MUX = 2;
+
+/******************************************************************************
+ * CoAP transport (DeviceConfig transport setting)
+ *****************************************************************************/
+/** TB CoAP port */
+const uint16_t TB_COAP_PORT = 5683;
+
+/** TB CoAP resource paths (without leading slash) */
+#define TB_COAP_TELEMETRY_PATH_FORMAT       "api/v1/%s/telemetry"
+#define TB_COAP_ATTRIBUTES_PATH_FORMAT      "api/v1/%s/attributes"
+
+/** Query for shared attributes request */
+const char TB_COAP_SHARED_ATTRIBUTES_QUERY[] = "sharedKeys=" TB_SHARED_ATTRIBUTE_KEYS;
+const char TB_COAP_SHARED_ATTRIBUTES_ID_QUERY[] = "sharedKeys=" TB_SHARED_ATTRIBUTE_ID_KEYS;
+
+/** Block size for block-wise transfer and its size exponent (size = 2^(SZX + 4)) */
+const int COAP_BLOCK_SIZE = 512;
+const uint8_t COAP_BLOCK_SZX = 5;
+
+/** Max CoAP message size (one block plus header and options) */
+const int COAP_MAX_MESSAGE_SIZE = COAP_BLOCK_SIZE + 128;
+
+/** Initial ACK timeout (ms), doubled on each retransmission (RFC 7252 4.8) */
+const uint32_t COAP_ACK_TIMEOUT = 2000;
+
+/** Max retransmissions of a confirmable message */
+const int COAP_MAX_RETRANSMIT = 4;
+
+/** Time to wait for a separate response after an empty ACK (ms) */
+const uint32_t COAP_SEPARATE_RESPONSE_TIMEOUT = 10000;
+
+/** Token length in bytes */
+const uint8_t COAP_TOKEN_LEN = 2;
+
+/** Protocol constants */
+const uint8_t COAP_VERSION = 1;
+const uint8_t COAP_TYPE_CON = 0;
+const uint8_t COAP_TYPE_NON = 1;
+const uint8_t COAP_TYPE_ACK = 2;
+const uint8_t COAP_CODE_EMPTY = 0x00;
+const uint8_t COAP_CODE_GET = 0x01;
+const uint8_t COAP_CODE_POST = 0x02;
+const uint8_t COAP_CODE_CONTINUE = 0x5F;
+const uint16_t COAP_OPTION_URI_PATH = 11;
+const uint16_t COAP_OPTION_CONTENT_FORMAT = 12;
+const uint16_t COAP_OPTION_URI_QUERY = 15;
+const uint16_t COAP_OPTION_BLOCK1 = 27;
+const uint8_t COAP_CONTENT_FORMAT_JSON = 50;
+const uint8_t COAP_PAYLOAD_MARKER = 0xFF;
+#define COAP_CODE_CLASS(code)               ((code) >> 5)
+
+/** Modem socket (mux) used by CoAP */
+const uint8_t COAP_MUX = 3;
+
+/** Timeouts for modem UDP socket AT commands (ms) */
+const uint32_t MODEM_UDP_AT_TIMEOUT = 5000;
+const uint32_t MODEM_UDP_OPEN_TIMEOUT = 30000;
+
+/******************************************************************************
+ * Uplink controller (link quality based request size/timeouts)
+ *****************************************************************************/
+/** RSSI (dBm) at or above which link is good/fair */
+const int UPLINK_RSSI_GOOD = -85;
+const int UPLINK_RSSI_FAIR = -100;
+
+/** Average request round-trip time (ms) at or below which link is good/fair */
+const uint32_t UPLINK_RTT_GOOD_MS = 2000;
+const uint32_t UPLINK_RTT_FAIR_MS = 6000;
+
+/** Latest requests kept in failure history (max 32) */
+const int UPLINK_HISTORY_LEN = 16;
+
+/** Failed requests in history at or below which link is good/fair */
+const int UPLINK_HISTORY_FAILURES_GOOD = 0;
+const int UPLINK_HISTORY_FAILURES_FAIR = 3;
+
+/** Smallest telemetry request size picked */
+const int UPLINK_MIN_REQ_BYTE_BUDGET = 512;
+
+/** HTTP response timeout on fair/bad links (ms) */
+const int UPLINK_FAIR_RESPONSE_TIMEOUT = 20000;
+const int UPLINK_BAD_RESPONSE_TIMEOUT = 30000;
+
+/** Wait after a failed request (ms), doubled for every failure in a row */
+const uint32_t UPLINK_RETRY_BACKOFF_MS = 1000;
+const uint32_t UPLINK_MAX_RETRY_BACKOFF_MS = 8000;
+
+/** Request round-trip times kept per session for the median (see UplinkMetrics) */
+const int UPLINK_METRICS_RTT_SAMPLES = 64;
+
+/** Failed requests before aborting telemetry submission on a bad link */
+const int UPLINK_BAD_FAILED_REQ_THRESHOLD = 2;
 
 /** Max failed requests before aborting telemetry submission */
 
@@ -302,63 +1045,275 @@ const int FAILED_TELEMETRY_REQ_THRESHOLD = 3;
  * where config struct is stored */
 const char DEVICE_CONFIG_NVS_NAMESPACE_NAME[] = "DevConf";
 
+/** Key in DeviceConfig namespace where network registration cache is stored */
+const char DEVICE_CONFIG_NETWORK_CACHE_KEY[] = "NetCache";
+
+/** Key in DeviceConfig namespace where progress of an interrupted OTA is stored */
+const char DEVICE_CONFIG_OTA_PROGRESS_KEY[] = "OtaProg";
+
+/** Key in DeviceConfig namespace where pending validation of a new image is stored */
+const char DEVICE_CONFIG_OTA_VALIDATION_KEY[] = "OtaVal";
+
+/** Key in DeviceConfig namespace where runtime flags (clean reboot, OTA flashed) are stored */
+const char DEVICE_CONFIG_RUNTIME_FLAGS_KEY[] = "DevFlags";
+
+/** Key in DeviceConfig namespace where the clock drift model is stored */
+const char DEVICE_CONFIG_CLOCK_MODEL_KEY[] = "ClkModel";
+
+/** Key in DeviceConfig namespace where deadbands of the report by exception filter are stored */
+const char DEVICE_CONFIG_DEADBANDS_KEY[] = "Deadbands";
+
+/** Key in DeviceConfig namespace where the call home phase is stored */
+const char DEVICE_CONFIG_CALL_HOME_PHASE_KEY[] = "ChPhase";
+
+/** Key in DeviceConfig namespace where stores with pending backfill are stored */
+const char DEVICE_CONFIG_BACKFILL_KEY[] = "Backfill";
+const char DEVICE_CONFIG_CLIENT_ATTR_KEY[] = "ClientAttr";
+
+/** Preferences api namespace name for Sdi12Registry. Also used as the single key */
+const char SDI12_REGISTRY_NVS_NAMESPACE_NAME[] = "Sdi12Reg";
+
 /******************************************************************************
  * GSM
  *****************************************************************************/
 /** HardwareSerial port to use for communication with the GSM module */
 const uint8_t GSM_SERIAL_PORT = 1;
 
+/** Baud rate the modem link starts at and falls back to. Boards can set a faster
+ * GSM_SERIAL_FAST_BAUD negotiated after power on */
 const int GSM_SERIAL_BAUD = 115200;
 
+/** UART RX ring buffer, holds a whole OTA chunk at fast baud rates */
+const int GSM_SERIAL_RX_BUFFER_SIZE = 4096;
+
+/** UART RX FIFO level (bytes of 128) the RX interrupt moves it to the ring buffer
+ * at. Leaves room for interrupt latency at fast baud rates and low CPU clock */
+const int GSM_SERIAL_RX_FIFO_THRESHOLD = 64;
+
+/** Start of AT command/response lines kept to tell them apart (see AtStream) */
+const int AT_STREAM_LINE_LEN = 16;
+
+/** Empty polls of the modem stream in a row before polling task sleeps
+ * IDLE_WAIT_MS per poll, letting the CPU idle while waiting for a response.
+ * The RX ring buffer keeps filling meanwhile */
+const int AT_STREAM_IDLE_POLLS = 16;
+const int AT_STREAM_IDLE_WAIT_MS = 2;
+
+/** AT command latency histogram buckets, upper bounds (ms). Last bucket is everything longer */
+const uint32_t AT_LATENCY_BUCKET_MS[] = {20, 100, 250, 500, 1000, 2500, 10000};
+const int AT_LATENCY_BUCKETS = sizeof(AT_LATENCY_BUCKET_MS) / sizeof(AT_LATENCY_BUCKET_MS[0]) + 1;
+
+/** RTS asserted when RX FIFO reaches this many bytes (when PIN_GSM_RTS/CTS defined) */
+const uint8_t GSM_SERIAL_RTS_THRESHOLD = 100;
+
 /** Time to wait for GSM network connection before timeout */
 const int GSM_DISCOVERY_TIMEOUT_MS = 30000;
 
+/** Time to wait for network connection when attaching with cached operator and band.
+ * Full scan follows on timeout */
+const int GSM_CACHED_DISCOVERY_TIMEOUT_MS = 10000;
+
+/** LTE band searched in NBIoT mode when no cached band */
+const uint8_t GSM_NBIOT_DEFAULT_BAND = 20;
+
+/** Weight of last attach time in attach time moving average/variance */
+const float GSM_ATTACH_STATS_ALPHA = 0.2;
+
 /** Times to try to execute a command on the GSM module before failing */
 const int GSM_TRIES = 3;
 /** Time to delay between tries */
 const int GSM_RETRY_DELAY_MS = 100;
 
-/** Time to wait after turning on GSM module until device ready */
-const int GSM_WAIT_AFTER_PWR_ON_MS = 6000;
+/** Max time from power key until the modem answers AT (see GSM::wait_ready()) */
+const int GSM_READY_TIMEOUT_MS = 20000;
+/** Modem is polled for readiness this often, the connect task sleeps in between */
+const int GSM_READY_POLL_MS = 250;
+/** Timeout of a single readiness poll (AT) */
+const int GSM_READY_AT_TIMEOUT_MS = 100;
 
 /** Time to wait after GSM power ON/OFF requested, before device power ready to be toggled again */
 const int GSM_WAIT_AFTER_PWR_TOGGLE_MS = 6000;
 
+/** Power down with AT+CPOWD takes up to this long, power key is used after */
+const int GSM_POWER_DOWN_TIMEOUT_MS = 5000;
+/** Time after a power down with AT+CPOWD before the power key may be used */
+const int GSM_WAIT_AFTER_POWER_DOWN_MS = 1000;
+
 /** Timeout for AT test command */
 const int GSM_TEST_AT_TIMEOUT = 3000;
 
+/** Modem info cached in RTC memory (see GSM::get_info()), "GINF" */
+const uint32_t GSM_INFO_MAGIC = 0x464E4947;
+
+/** Requested PSM periodic TAU (T3412 extended, 3GPP 24.008 GPRS Timer 3), 30 hours.
+ * Longer than the longest call home interval so the modem stays registered */
+const char GSM_PSM_T3412[] = "01000011";
+/** Requested PSM active time (T3324, GPRS Timer 2), 10 seconds. Modem stays
+ * reachable this long after going idle, then sleeps */
+const char GSM_PSM_T3324[] = "00000101";
+
+/** Request eDRX while in active time */
+const bool GSM_EDRX_ENABLED = true;
+/** Requested eDRX cycle (3GPP 24.008), 81.92 seconds */
+const char GSM_EDRX_VALUE[] = "0101";
+
+/** PWRKEY pulse that wakes the modem from PSM. Longer pulses power it off */
+const int GSM_PSM_WAKE_PULSE_MS = 100;
+/** Time for the modem to respond after a PSM wake up */
+const int GSM_PSM_WAKE_TIMEOUT_MS = 3000;
+
+/** Modem slow clock sleep (AT+CSCLK=1) current and the current of a cold start
+ * and attach, to pick it over a power off (mA) */
+const float GSM_SLOW_CLOCK_MA = 1.5;
+const float GSM_ATTACH_MA = 90;
+/** Cold start (power key to AT ready) assumed until one is measured */
+const uint32_t GSM_COLD_START_DEFAULT_MS = 16000;
+/** Attach time assumed without a network cache */
+const uint32_t GSM_ATTACH_DEFAULT_MS = 30000;
+/** Time for the modem UART to wake up after DTR is pulled low */
+const int GSM_SLOW_CLOCK_WAKE_MS = 50;
+
+/** Background connect task, registers while sensors are read (see GSM::start_connect) */
+const int GSM_CONNECT_TASK_STACK_SIZE = 8192;
+const int GSM_CONNECT_TASK_PRIORITY = 1;
+/** Core connect task is pinned to. Arduino loop runs on core 1 */
+const int GSM_CONNECT_TASK_CORE = 0;
+
 /** TinyGSM buffer size - Used by tinygsm*/
 #define TINY_GSM_RX_BUFFER	1024
 
 /******************************************************************************
  * HTTP
  *****************************************************************************/
-/** Generic global HTTP response buffer size. Buffer is large and thus stored in global scope 
- * to avoid stack overflow.
+/** Generic global HTTP response buffer size. Buffer is large and thus leased from the
+ * scratch arena to avoid stack overflow.
 */
 const int GLOBAL_HTTP_RESPONSE_BUFFER_LEN = 4096;
 
+/** Shared scratch arena size (see Scratch). Worst case is OTA download inside remote control
+ * handling: response buffer and docs of remote control, 2 OTA download buffers */
+const int SCRATCH_ARENA_SIZE = 14 * 1024;
+
+/** Scratch arena size when moved to PSRAM (see Psram) */
+const int SCRATCH_PSRAM_ARENA_SIZE = 256 * 1024;
+
+/** Buffer for beautified print of JSON builders (debug) */
+const int JSON_BUILDER_PRINT_BUFF_SIZE = 2048;
+
 /** Timeout when reading http client stream */
 const int HTTP_CLIENT_STREAM_TIMEOUT = 3000;
 
 /** HTTP response timeout */
 const int HTTL_CLIENT_REPONSE_TIMEOUT = 15000;
 
+/** Buffer of request bodies streamed to the client (see HttpRequest::BodyWriter),
+ * so bodies are not sent to the modem byte by byte */
+const int HTTP_STREAM_WRITE_BUFF_SIZE = 256;
+
+/** OTA download chunk. Two chunk buffers are used, one is received while the other
+ * is written to flash */
+const int OTA_CHUNK_LEN = GLOBAL_HTTP_RESPONSE_BUFFER_LEN;
+
+/** OTA download chunk when the scratch arena is in PSRAM, fewer and larger reads
+ * of the modem stream and flash writes */
+const int OTA_PSRAM_CHUNK_LEN = 32 * 1024;
+
+/** OTA download progress is saved every this many bytes. Must be a multiple of the flash
+ * sector size, download resumes from the last saved point */
+const int OTA_PROGRESS_SAVE_INTERVAL = 64 * 1024;
+
+/** Timeout when reading the OTA download stream */
+const int OTA_STREAM_TIMEOUT_MS = 10000;
+
+/** Time a new image has to complete a full call home before it is rolled back,
+ * at least DEADLINE_SECS and DEADLINE_CALL_HOMES call home intervals (scaled by
+ * PowerGovernor) so slow schedules get several attempts. Counts from the first
+ * call home attempt with valid time */
+const uint32_t OTA_VALIDATION_DEADLINE_SECS = 6 * 3600;
+const int OTA_VALIDATION_DEADLINE_CALL_HOMES = 3;
+
+/** Unexpected resets of a new image before it is rolled back, before the deadline */
+const int OTA_VALIDATION_MAX_RESETS = 3;
+
+/** Source read-ahead and output buffer of delta OTA patch applier */
+const int DELTA_PATCH_BUFF_LEN = 256;
+
+/** Task writing downloaded OTA chunks to flash */
+const int OTA_WRITER_TASK_STACK_SIZE = 4096;
+const int OTA_WRITER_TASK_PRIORITY = 1;
+const int OTA_WRITER_TASK_CORE = 0;
+
+/** Modem socket (mux) used by the persistent HttpSession, one-off requests use 0 */
+const uint8_t HTTP_SESSION_MUX = 1;
+
+/** Max request body of the modem HTTP client (GSM_NATIVE_HTTP). Larger bodies use
+ * the socket client */
+const int HTTP_MODEM_MAX_BODY_LEN = 4096;
+
+/** HTTP requests to this port are done over TLS (see TlsClient) */
+const int TLS_PORT = 443;
+
+/** Plaintext buffered before a TLS record is sent */
+const int TLS_CLIENT_WRITE_BUFF_SIZE = 512;
+
+/** Transport is polled at this interval while waiting for TLS data */
+const uint32_t TLS_CLIENT_POLL_MS = 5;
+
+/** Max TLS handshake duration */
+const uint32_t TLS_HANDSHAKE_TIMEOUT_MS = 30000;
+
+/** Largest session ticket kept in RTC memory. Larger ones are resumed by session ID */
+const int TLS_SESSION_TICKET_MAX_LEN = 256;
+
+/** Max header bytes of the modem HTTP client */
+const int HTTP_MODEM_MAX_HEADER_LEN = 350;
+
+/** Response bytes read from the modem HTTP client per AT+SHREAD */
+const int HTTP_MODEM_READ_CHUNK = 1024;
+
+/** Time to wait for modem HTTP client to connect to server */
+const int HTTP_MODEM_CONNECT_TIMEOUT_MS = 15000;
+
+/******************************************************************************
+ * Sensor acquisition
+ *****************************************************************************/
+/** Sensor measurement job tasks (see Acquisition). Not pinned, jobs spread over both cores */
+const int ACQUISITION_TASK_STACK_SIZE = 8192;
+const int ACQUISITION_TASK_PRIORITY = 1;
+/** Max jobs of a graph, one done bit each in an event group (24 usable) */
+const int ACQUISITION_MAX_JOBS = 8;
+/** Poll interval of SDI12 measurement waits that can't light sleep while other jobs run */
+const int ACQUISITION_WAIT_POLL_MS = 20;
+
 /******************************************************************************
  * SDI12 Sensors
  *****************************************************************************/
 /** UART to use for SDI12 comms */
 const int SDI12_UART_NUM = 2;
 
-/** Time to wait after sending a command and before reading back the response */
-const int SDI12_COMMAND_WAIT_TIME_MS = 50;
-
-/** Receive buffer size. Must be large enough to fit a single response */ 
-const int SDI12_RECV_BUFF_SIZE = 48;
+/** Receive buffer size. Must be large enough to fit a single response.
+ * Data responses to concurrent measurements carry up to 75 chars of values */ 
+const int SDI12_RECV_BUFF_SIZE = 88;
 
 /** Number of extra seconds to wait for measurement on top of what the sensors says */
 const int SDI12_MEASURE_EXTRA_WAIT_SECS = 1;
 
+/** Time to let a service request (a<CR><LF>) finish arriving after waking up on it */
+const int SDI12_SERVICE_REQUEST_DRAIN_MS = 50;
+
+/** Max sensors kept in the SDI12 registry */
+const int SDI12_REGISTRY_MAX_SENSORS = 4;
+
+/** Max chars of an aI! identification response kept in the registry */
+const int SDI12_ID_MAX_LEN = 36;
+
+/** Response timeout while discovering sensors. Sensors respond within 15ms,
+ * missing addresses must not wait for the full UART timeout */
+const int SDI12_DISCOVERY_TIMEOUT_MS = 100;
+
+/** Max concurrent measurement requests on the SDI12 bus */
+const int SDI12_BUS_MAX_REQUESTS = 4;
+
 /******************************************************************************
  * Weather Station
  *****************************************************************************/
@@ -377,6 +1332,26 @@ const int WEATHER_STATION_NUMBER_OF_MEASUREMENTS = 9;
 /** Time to wait for water sensors to boot after powering them up */
 const int WATER_SENSORS_POWER_ON_DELAY_MS = 2000;
 
+/** Time from sensor rail on until each device responds (see PowerControl) */
+const int AQUATROLL_SETTLE_MS = WATER_SENSORS_POWER_ON_DELAY_MS + 200;
+const int WATER_LEVEL_SETTLE_MS = WATER_SENSORS_POWER_ON_DELAY_MS + 200;
+const int ATMOS41_SETTLE_MS = WATER_SENSORS_POWER_ON_DELAY_MS;
+const int TEROS12_SETTLE_MS = WATER_SENSORS_POWER_ON_DELAY_MS + 200;
+const int SDI12_BUS_SETTLE_MS = WATER_SENSORS_POWER_ON_DELAY_MS + 200;
+
+/** Time to let a rail discharge after turning it off */
+const int RAIL_OFF_DELAY_MS = 100;
+
+/** Learned warm-up (see PowerControl). Percentile of the last HISTORY_LEN
+ * times from power on to first valid response is waited, less PROBE_MS so a
+ * shorter warm-up is found when the device gets faster, not below MIN_MS. A
+ * device not ready yet is polled every POLL_MS up to its settle time */
+const int POWER_WARMUP_HISTORY_LEN = 8;
+const int POWER_WARMUP_PERCENTILE = 90;
+const uint32_t POWER_WARMUP_PROBE_MS = 100;
+const uint32_t POWER_WARMUP_MIN_MS = 100;
+const uint32_t POWER_WARMUP_POLL_MS = 200;
+
 /** Max time to wait for sensor to prepare measurements after a 
  * measure command. Used in case sensor returns garbage values, to prevent
  * waiting for long amounts of time. Value must be adapted to water quality
@@ -392,6 +1367,13 @@ const int AQUATROLL500_NUMBER_OF_MEASUREMENTS = 8;
 /** Number of measurement values expected for Aquatroll 600 */
 const int AQUATROLL600_NUMBER_OF_MEASUREMENTS = 7;
 
+/** Max measurement values of any Aquatroll model (see Aquatroll::MODELS) */
+const int AQUATROLL_MAX_VALUES = 10;
+
+/** Tries requesting each data batch (aDx!) before aborting, only the failed
+ * batch is requested again */
+const int AQUATROLL_BATCH_TRIES = 3;
+
 /** Number of mS to wait before retrying after an error */
 const int WATER_QUALITY_RETRY_WAIT_MS = 1000;
 
@@ -410,6 +1392,14 @@ const int WATER_LEVEL_MIN_VALID_MEASUREMENTS = 10;
 
 /** Delay in mS between measurements */
 const int WATER_LEVEL_DELAY_BETWEEN_MEAS_MS = 5;
+
+/** Sampling stops early once the median's std error is below this (PWM and serial
+ * channels, mm) */
+const float WATER_LEVEL_CONVERGED_TOLERANCE_MM = 2;
+
+/** Sampling stops early once the median's std error is below this (analog channels,
+ * raw ADC) */
+const float WATER_LEVEL_CONVERGED_TOLERANCE_RAW = 2;
 /** Max range in centimeters */
 const int WATER_LEVEL_MAX_RANGE_MM = 9999;
 /** Number of seconds to wait before retrying after an error */
@@ -419,6 +1409,19 @@ const int WATER_LEVEL_RETRY_WAIT_MS = 1000;
 /** Timeout when waiting for PWM pulse */
 const int WATER_LEVEL_PWM_TIMEOUT_MS = 500;
 
+/** RMT channel capturing PWM pulses */
+const int WATER_LEVEL_PWM_RMT_CHANNEL = 0;
+
+/** A pulse ends an RMT frame after the line has been idle this long. Must be longer than
+ * the widest pulse (WATER_LEVEL_MAX_RANGE_MM uS) and fit in 16 bits */
+const uint16_t WATER_LEVEL_PWM_RMT_IDLE_US = 20000;
+
+/** Glitches shorter than this many APB ticks (80MHz) are ignored by the RMT receiver */
+const uint8_t WATER_LEVEL_PWM_RMT_FILTER_TICKS = 100;
+
+/** RMT ring buffer size, fits a whole sampling burst of pulses */
+const int WATER_LEVEL_PWM_RMT_BUFF_SIZE = 1024;
+
 /** Sensor returns max range when no target detected within range
 Since PWM has an offset a tolerance is taken into account when ignoring invalid values */
 const int WATER_LEVEL_PWM_MAX_VAL_TOL = 30;
@@ -450,6 +1453,10 @@ const int TEROS12_MEASURE_WAIT_SEC_MAX = 10;
 /** Number of measurement values expected from the sensor */
 const int TEROS12_NUMBER_OF_MEASUREMENTS = 3;
 
+/** Max time from power up until the DDI string starts (FLAGS.TEROS12_DDI_CAPTURE).
+ * The sensor sends it about 100ms after power up */
+const int TEROS12_DDI_TIMEOUT_MS = 400;
+
 /******************************************************************************
  * FineOffset weather station data
  *****************************************************************************/
@@ -460,7 +1467,7 @@ const char* const FO_DATA_STORE_PATH = "/fo";
 const int FO_DATA_STORE_ENTRIES_PER_SUBMIT_REQ = 5;
 
 /** Arduino JSON doc size */
-const int FO_DATA_JSON_DOC_SIZE = 1024;
+const int FO_DATA_JSON_DOC_SIZE = 4096;
 
 // Telemetry key names
 const char FO_DATA_KEY_TIMESTAMP[] = "ts";
@@ -476,6 +1483,9 @@ const char FO_DATA_KEY_UV[] = "fo_uv";
 const char FO_DATA_KEY_UV_INDEX[] = "fo_uv_index";
 const char FO_DATA_KEY_LIGHT[] = "fo_light";
 const char FO_DATA_KEY_SOLAR_RADIATION[] = "fo_sol_rad";
+const char FO_DATA_KEY_TEMP_STD[] = "fo_temp_std";
+const char FO_DATA_KEY_WIND_SPEED_STD[] = "fo_w_speed_std";
+const char FO_DATA_KEY_WIND_GUST_MAX[] = "fo_w_gust_max";
 
 /** Wind speed coefficient in sniffed packet */
 const float FO_WIND_SPEED_COEFF = 0.0644;
@@ -497,11 +1507,6 @@ const int FO_AGGREGATE_INTERVAL_SEC = 600;
 /** FO is disabled after X successive failed RX (both sniff and uart) to prevent battery drainage*/
 const uint8_t FO_FAILED_RX_THRESHOLD = 20;
 
-/******************************************************************************
- * FineOffset Buffer
- *****************************************************************************/
-const int FO_BUFFER_SIZE = 200;
-
 /******************************************************************************
  * FineOffset weather station sniffer
  *****************************************************************************/
@@ -532,9 +1537,41 @@ const int FO_SNIFFER_WAIT_PACKET_EARLY_WAKEUP_SEC = 3;
  */
 const int FO_SNIFFER_PACKET_WAIT_TIME_MS = 4000;
 
+/** Weight of a new packet in the fitted interval and jitter averages */
+const float FO_SNIFFER_TIMING_ALPHA = 0.125;
+
+/** Successive packets needed before the RX window is sized from measured timing */
+const int FO_SNIFFER_TIMING_MIN_SAMPLES = 8;
+
+/** Max missed packets between two received ones to still update the fit */
+const int FO_SNIFFER_TIMING_MAX_GAP_PACKETS = 64;
+
+/** Max deviation (ms) of the fitted interval from FO_SNIFFER_PACKET_INTERVAL_SEC */
+const int FO_SNIFFER_TIMING_MAX_DRIFT_MS = 160;
+
+/** Arrival error std devs the RX window is opened before/kept after expected arrival */
+const int FO_SNIFFER_RX_MARGIN_SIGMAS = 4;
+
+/** Min RX margin (ms) on each side of expected arrival, covers RX start-up */
+const int FO_SNIFFER_RX_MARGIN_MIN_MS = 150;
+
+/** Scheduled wake up is this much earlier than RX window start, covers the second
+ * resolution of the scheduler and boot time. Rest of the wait is light sleep */
+const int FO_SNIFFER_TIMING_WAKE_LEAD_MS = 1000;
+
 /* Time to scan for weather stations when scanning for new id */
 const int FO_SNIFFER_SCAN_TIME_MS = 25000;
 
+/** Bytes of a raw weather station frame (family code and node address included) */
+const int FO_SNIFFER_FRAME_LEN = 17;
+
+/** Raw frames queued in continuous RX mode. Queue is decoded when half full
+ * if no other wake up came first */
+const int FO_SNIFFER_RX_QUEUE_LEN = 16;
+
+/** Max ms to wait for the RX task to read a frame after waking up on DI0 */
+const int FO_SNIFFER_RX_SERVICE_WAIT_MS = 50;
+
 /******************************************************************************
  * FineOffset weather station UART
  *****************************************************************************/
@@ -550,6 +1587,15 @@ const uint8_t FO_UART_WAIT_BEFORE_REQ_SEC = 1;
 /* Timeout when waitng for weather station to send data after requesting a packet */
 const uint16_t FO_UART_RX_TIMEOUT_MS = 3000;
 
+/** UART baud rate of the weather station */
+const int FO_UART_BAUD_RATE = 9600;
+
+/** UART driver RX ring buffer size, must be larger than the HW FIFO (128) */
+const int FO_UART_RX_BUFF_SIZE = 256;
+
+/** UART driver event queue length, one event per response line */
+const int FO_UART_EVENT_QUEUE_SIZE = 16;
+
 /** Aggregate time window. Packets received from the weather station will be
  * aggregated into a single packet and commited to flash every this amount of
  * seconds (approx.) */
@@ -580,12 +1626,29 @@ const char FO_UART_RESPONSE_PARAM_NAMES[][15] =
 /** UART response param count */
 const uint16_t FO_UART_PARAM_COUNT = sizeof(FO_UART_RESPONSE_PARAM_NAMES) / sizeof(FO_UART_RESPONSE_PARAM_NAMES[0]);
 
+/******************************************************************************
+ * Main I2C bus
+ *****************************************************************************/
+/** Bus clock. DS3231, BME280, LTC2941, INA219, MAX1704X and AS3935 all support
+ * fast mode. Boards with a standard mode only device define BOARD_I2C_STANDARD_MODE */
+#ifdef BOARD_I2C_STANDARD_MODE
+const uint32_t I2C_BUS_FREQ_HZ = 100000;
+#else
+const uint32_t I2C_BUS_FREQ_HZ = 400000;
+#endif
+
 /******************************************************************************
  * BME280 (internal environment sensor 1)
  *****************************************************************************/
 const uint8_t BME280_I2C_ADDR1 = 0x76; 
 const uint8_t BME280_I2C_ADDR2 = 0x77; 
 
+/** Max forced conversion time, x16 oversampling of all measurements takes ~113ms */
+const uint32_t BME280_CONVERSION_TIMEOUT_MS = 150;
+
+/** Sea level pressure altitude is calculated against (Pa) */
+const float BME280_SEA_LEVEL_PRESSURE_PA = 101325;
+
 /******************************************************************************
  * IP5306 (TCall PMU ic)
  *****************************************************************************/
@@ -2,11 +2,40 @@
 #define DATA_STORE_H
 
 #include <inttypes.h>
-#include "SPIFFS.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "storage.h"
 #include "app_config.h"
 #include "struct.h"
 #include "const.h"
 
+template <class TStruct>
+class DataStoreReader;
+
+/** Bytes before the data struct in every DataStore::Entry (CRC32, seq), for code
+ * reading store files without the entry type (see Retention) */
+const int DATA_STORE_ENTRY_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+/** Bytes before the data struct in entries of format version 1 and before, CRC32
+ * only (see DataStore::migrate()) */
+const int DATA_STORE_LEGACY_ENTRY_HEADER_SIZE = sizeof(uint32_t);
+
+/** Sets the fields appended to a data struct since an older layout, in data
+ * migrated from it: old_data_size bytes of old data, the rest 0 (see DataStore::migrate()) */
+typedef void (*DataStoreUpgrader)(void *data, int old_data_size);
+
+/** Stores kept next to a store with the same entry type (see DataStore::get_twin()) */
+enum DataStoreTwin
+{
+    /** Files already submitted (FLAGS.STORE_ARCHIVE), pruned when flash space is needed */
+    DATA_STORE_TWIN_ARCHIVE,
+
+    /** Archived entries copied back for resubmission (see Backfill) */
+    DATA_STORE_TWIN_BACKFILL,
+
+    DATA_STORE_TWIN_COUNT
+};
+
 template <typename TStruct>
 class DataStore
 {
@@ -15,26 +44,111 @@ public:
     // Structs
     //
 
+    /** Reader type used to iterate store (see CallHome::submit_stored_telemetry) */
+    typedef DataStoreReader<TStruct> Reader;
+
+    /** Called with the path of each file cleanup() is about to delete and with NULL
+     * when done (see Retention) */
+    typedef void (*EvictHandler)(const char *path);
+
     /** A single entry in the data store */
     struct Entry
     {
         /** CRC32 of entry content */
         uint32_t crc32;
 
+        /** Sequence number, increasing over the life of the store. Sent with the
+         * entry so the server can drop entries of a request resent after it was
+         * accepted. 0 when not tracked (RingStore) */
+        uint32_t seq;
+
         /** The data struct itself */
         TStruct data;
     }__attribute__((packed));
 
-    DataStore(const char *dir_path, int max_entries_per_file);
+    /** In-RAM index of the store's files. Built once with a dir scan and then kept up
+     * to date on commit/delete, so dir doesn't have to be walked on every operation */
+    struct Index
+    {
+        /** Index has been built */
+        bool valid;
+
+        /** Flash generation the index was built on. Formatting flash invalidates it */
+        uint32_t flash_generation;
+
+        /** Number of files in store */
+        int file_count;
+
+        /** Total number of entries in all files */
+        int entry_count;
+
+        /** Size of current data file (bytes) */
+        int current_file_size;
+
+        /** Timestamps (taken from file names) of oldest / newest file */
+        uint32_t oldest_file_tstamp;
+        uint32_t newest_file_tstamp;
+    };
+
+    /** Submission progress of a partially submitted file, persisted in flash so
+     * submission resumes from where it stopped */
+    struct Cursor
+    {
+        /** File being submitted */
+        char file_path[FILE_PATH_BUFFER_SIZE];
+
+        /** Entries from file start already submitted */
+        uint32_t entries;
+
+        /** CRC32 of above fields */
+        uint32_t crc32;
+    }__attribute__((packed));
+
+    /** Sequence number state, persisted in flash */
+    struct SeqState
+    {
+        /** Sequence numbers below this may have been used. Reserved
+         * DATA_STORE_SEQ_RESERVE at a time so the file is not written on every add */
+        uint32_t reserved;
 
-    RetResult add(TStruct *data);
+        /** Entries up to this seq were acknowledged by the server (ack_seq response) */
+        uint32_t acked;
+
+        /** CRC32 of above fields */
+        uint32_t crc32;
+    }__attribute__((packed));
+
+    /** Holds the store mutex for a scope (see lock()) */
+    class ScopedLock
+    {
+    public:
+        ScopedLock(DataStore<TStruct> *store) : _store(store) { _store->lock(); }
+        ~ScopedLock() { _store->unlock(); }
+
+    private:
+        DataStore<TStruct> *_store;
+    };
+
+    DataStore(const char *dir_path, int max_entries_per_file, EvictHandler on_evict = NULL);
+
+    RetResult add(TStruct *data, uint32_t seq = 0);
+
+    TStruct* reserve();
+
+    RetResult publish(uint32_t seq = 0);
+
+    void cancel();
 
     RetResult commit();
     
     RetResult clear_buffer();
 
+    RetResult move_buffer(void *buffer, int capacity);
+
     RetResult clear_all();
 
+    int migrate(const int *old_data_sizes, int count, DataStoreUpgrader upgrade);
+
     unsigned int get_buffer_element_count() const;
 
     const Entry* get_buffer_element(unsigned int index) const;
@@ -42,6 +156,46 @@ public:
 	const char* get_dir_path() const;
 
     RetResult cleanup(bool force);
+
+    int compact(int max_sources);
+
+    const Index* get_index();
+
+    int get_file_count();
+
+    int get_max_entries_per_file() const;
+
+    void on_file_deleted(const char *path, int size);
+
+    RetResult remove_file(const char *path, int size);
+
+    DataStore<TStruct>* get_twin(DataStoreTwin twin);
+
+    void set_block_commit(bool enabled);
+
+    int get_cursor(const char *file_path);
+
+    RetResult set_cursor(const char *file_path, int entries);
+
+    RetResult clear_cursor();
+
+    uint32_t get_acked_seq();
+
+    RetResult set_acked_seq(uint32_t seq);
+
+    void lock();
+
+    void unlock();
+
+    uint32_t open_snapshot();
+
+    void close_snapshot();
+
+    void pin_file(const char *path);
+
+    void unpin_file(const char *path);
+
+    static uint32_t file_name_tstamp(const char *path);
 protected:
 	// Default constructor private
 	DataStore();
@@ -54,8 +208,50 @@ private:
 
     RetResult update_current_data_file_path();
 
+    RetResult build_index();
+
+    bool index_valid() const;
+
+    void invalidate_index();
+
+    uint32_t cleanup_cutoff_tstamp(File &dir);
+
+    /** File to be merged by compact() */
+    struct CompactSource
+    {
+        char path[FILE_PATH_BUFFER_SIZE];
+        int entries;
+        uint32_t tstamp;
+    };
+
+    int find_compact_sources(CompactSource *sources_out, int max_sources);
+
+    RetResult merge_files(const CompactSource *sources, int count);
+
+    RetResult truncate_partial_entry(const char *path, int size);
+
+    bool layout_matches(File &file, int header_size, int data_size);
+
+    RetResult migrate_file(const char *path, int header_size, int data_size, DataStoreUpgrader upgrade);
+
+    void get_cursor_path(char *buff, int buff_size) const;
+
+    uint32_t next_seq();
+
+    void load_seq_state();
+
+    RetResult save_seq_state();
+
     File open_file();
 
+    bool is_sealed(const char *path) const;
+
+    bool is_pinned(const char *path) const;
+
+    bool defer_delete(const char *path, int size);
+
+    void run_deferred_deletes();
+
     //
     // Vars
     //
@@ -64,18 +260,88 @@ private:
     char _current_data_file_path[FILE_PATH_BUFFER_SIZE] = {0};
 
     /** Data buffer. Data is stored temporarily here until buffer is full or when
-     * commit() is called in which case it is saved into flash memory and emptied */
-    Entry _buffer[DATA_STORE_BUFFER_ELEMENTS];
+     * commit() is called in which case it is saved into flash memory and emptied.
+     * Points to _internal_buffer unless moved by move_buffer() */
+    Entry *_buffer = _internal_buffer;
+
+    Entry _internal_buffer[DATA_STORE_BUFFER_ELEMENTS];
+
+    /** Elements _buffer holds */
+    uint32_t _buffer_capacity = DATA_STORE_BUFFER_ELEMENTS;
 
     /** Count of elements in buffer */
     uint32_t _buffer_element_count = 0;
 
+    /** Next buffer slot was handed out by reserve(), not published yet */
+    bool _slot_reserved = false;
+
 	/** Dir in SPIFFS where data will be stored */
 	const char* _dir_path = NULL;
 
     /** When writing data to flash, break it into x elements per file.
   	 *	A file is removed only when all of its data is marked as deleted. */
     int _max_entries_per_file = 0;
+
+    /** File index */
+    Index _index = {0};
+
+    /** Commit all entries that fit a file with a single write instead of one by one */
+    bool _block_commit = true;
+
+    /** Submission cursor, loaded from flash on first use */
+    Cursor _cursor = {0};
+
+    /** Cursor has been loaded */
+    bool _cursor_loaded = false;
+
+    /** Called before cleanup deletes a file */
+    EvictHandler _on_evict = NULL;
+
+    /** Sequence number of next entry */
+    uint32_t _next_seq = 0;
+
+    /** Sequence number state, loaded from flash on first use */
+    SeqState _seq_state = {0};
+
+    /** Sequence number state has been loaded */
+    bool _seq_loaded = false;
+
+    /** RTC memory slot next sequence number is kept in, -1 if none free */
+    int _seq_slot = -1;
+
+    /** Twin stores, created on first use */
+    DataStore<TStruct> *_twins[DATA_STORE_TWIN_COUNT] = {NULL};
+
+    /** Dir paths of twin stores */
+    char _twin_dir_paths[DATA_STORE_TWIN_COUNT][FILE_PATH_BUFFER_SIZE] = {{0}};
+
+    /** Store is a twin of another store */
+    bool _is_twin = false;
+
+    /** Guards buffer, index, cursor and files against other tasks. Recursive,
+     * held from reserve() to publish() */
+    SemaphoreHandle_t _mutex = NULL;
+
+    /** Readers iterating files (see open_snapshot()) */
+    int _readers = 0;
+
+    /** Files named up to this timestamp existed when the first reader started,
+     * they are not appended to while readers are open */
+    uint32_t _snapshot_tstamp = 0;
+
+    /** Files open by readers, deleting them is deferred until unpinned */
+    char _pinned[DATA_STORE_MAX_READERS][FILE_PATH_BUFFER_SIZE] = {{0}};
+
+    /** File delete deferred while pinned */
+    struct DeferredDelete
+    {
+        char path[FILE_PATH_BUFFER_SIZE];
+        int size;
+    };
+
+    DeferredDelete _deferred[DATA_STORE_MAX_READERS];
+
+    int _deferred_count = 0;
 };
 
 #endif
\ No newline at end of file
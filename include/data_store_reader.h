@@ -4,6 +4,11 @@
  * DataStore. The process is transparent, the class returns elements
  * from the buffer one by one and when the end is reached, it switches to the
  * flash memory until all data is iterated.
+ * Readers may run in another task than the one adding entries. Files are read
+ * from the snapshot the store had when next_file() was first called (see
+ * DataStore::open_snapshot()), entries committed meanwhile are left for the
+ * next reader. The open file is pinned, deleting it (eg. by cleanup()) waits
+ * until the reader moves on.
  ******************************************************************************/
 
 #ifndef DATA_STORE_READER
@@ -11,12 +16,34 @@
 
 #include "data_store.h"
 
+/**
+ * Timestamp (sec) of a stored entry, used by DataStoreReader::seek(). Specialized
+ * for structs without a uint32_t timestamp member (see data_store_reader.cpp)
+ */
+template <class TStruct>
+struct StoreEntryTstamp
+{
+    static uint32_t get(const TStruct *entry)
+    {
+        return entry->timestamp;
+    }
+};
+
+namespace SDI12Log { struct Entry; }
+namespace RelayData { struct Entry; }
+
+template <>
+uint32_t StoreEntryTstamp<SDI12Log::Entry>::get(const SDI12Log::Entry *entry);
+
+template <>
+uint32_t StoreEntryTstamp<RelayData::Entry>::get(const RelayData::Entry *entry);
+
 template <class TStruct>
 class DataStoreReader
 {
 public:
     ~DataStoreReader();
-	DataStoreReader(const DataStore<TStruct> *store);
+	DataStoreReader(DataStore<TStruct> *store);
 
     bool next_file();
     TStruct* next_entry();
@@ -25,16 +52,40 @@ public:
     void reset();
 
     bool entry_crc_valid();
+    uint32_t entry_seq();
+    bool entry_acked();
     RetResult delete_file();
 
+    RetResult ack_entries(int count);
+
+    void seek(uint32_t tstamp);
+
+    RetResult queue_delete_file();
+
+    RetResult commit_deletes(int count);
+
+    void discard_deletes(int count);
+
+    int get_queued_deletes() const;
+
 private:
 	// Default constructor private
     DataStoreReader();
 
     RetResult reset_data_state();
 
-    /** Data store to traverse */
-    const DataStore<TStruct> *_store = NULL;
+    int fill_read_buffer();
+
+    bool seek_in_file();
+
+    bool read_entry_at(int index, typename DataStore<TStruct>::Entry *entry);
+
+    void close_file();
+
+    void close_snapshot();
+
+    /** Data store to traverse. Not const, store index is updated when files are deleted */
+    DataStore<TStruct> *_store = NULL;
 
     /** Handle to store dir */
     File _dir;
@@ -42,8 +93,44 @@ private:
     /** Current file (when iterating) */
     File _cur_file;
 
-    /** Buffer to which entries are read and their data field  returned */
-    typename DataStore<TStruct>::Entry _cur_entry = {0};
+    /** Path current file is pinned by */
+    char _cur_path[FILE_PATH_BUFFER_SIZE] = {0};
+
+    /** Store snapshot is open, files named after its timestamp are skipped */
+    bool _snapshot_open = false;
+
+    uint32_t _snapshot_tstamp = 0;
+
+    /** Buffer to which file entries are read in chunks and their data field returned */
+    typename DataStore<TStruct>::Entry _read_buff[DATA_STORE_READER_BUFF_ENTRIES];
+
+    /** Number of entries in read buffer */
+    int _read_buff_count = 0;
+
+    /** Index of next entry to return from read buffer */
+    int _read_buff_index = 0;
+
+    /** CRC check results of read buffer entries (bit per entry) */
+    uint32_t _read_buff_crc_valid = 0;
+
+    /** Entries of current file skipped because they were submitted before (or are
+     * older than seek timestamp) */
+    int _cur_file_skipped = 0;
+
+    /** Entries older than this are skipped (see seek()), 0 for none */
+    uint32_t _seek_tstamp = 0;
+
+    /** Current entry (points into read buffer) */
+    typename DataStore<TStruct>::Entry *_cur_entry = NULL;
+
+    /** Files to be deleted together once the request they were packed into succeeds */
+    char _delete_queue[TELEMETRY_MAX_FILES_PER_REQ][FILE_PATH_BUFFER_SIZE];
+
+    /** Sizes of queued files, to update store index */
+    int _delete_queue_sizes[TELEMETRY_MAX_FILES_PER_REQ];
+
+    /** Number of queued files */
+    int _delete_queue_count = 0;
 
     /** Current state of file reader */
     uint8_t _state_files = STATE_PREPARE;
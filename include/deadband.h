@@ -0,0 +1,47 @@
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <inttypes.h>
+#include <ArduinoJson.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "tb_json_schema.h"
+
+/**
+ * Report by exception filter of sensor stores. An entry is stored only when a
+ * field moved by at least its deadband since the last stored entry of the store
+ * or the heartbeat interval has passed since it. Deadbands are set per telemetry
+ * key with remote control and are 0 (store everything) by default.
+ * Entries left out are counted and logged with the next stored one
+ * (DEADBAND_SUPPRESSED) so the server can hold the last value in between.
+ */
+namespace Deadband
+{
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		/** Field values of last stored entry, in schema order */
+		float last[SENSOR_STORE_COUNT][DEADBAND_MAX_FIELDS];
+		uint32_t last_tstamp[SENSOR_STORE_COUNT];
+		uint16_t suppressed[SENSOR_STORE_COUNT];
+		bool valid[SENSOR_STORE_COUNT];
+	};
+
+	bool should_store(SensorStore store, const TbJsonSchema *schema, const void *entry, uint32_t tstamp);
+
+	/** Decide on an entry of a sensor data struct with a TbJsonSchema */
+	template <typename TStruct>
+	bool should_store(SensorStore store, const TStruct *entry)
+	{
+		return should_store(store, &TbJsonSchemaOf<TStruct>::SCHEMA, entry, entry->timestamp);
+	}
+
+	RetResult set_config(JsonObject json, int32_t heartbeat_secs);
+	uint32_t get_heartbeat_secs();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
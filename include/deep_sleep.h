@@ -0,0 +1,84 @@
+#ifndef DEEP_SLEEP_H
+#define DEEP_SLEEP_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include "sleep_scheduler.h"
+#include "battery.h"
+#include "power_governor.h"
+#include "energy_profiler.h"
+#include "fo_sniffer.h"
+#include "fo_uart.h"
+#include "gsm.h"
+#include "log.h"
+#include "rtc.h"
+#include "trace.h"
+#include "water_presence.h"
+#include "adaptive_sampling.h"
+#include "deadband.h"
+#include "lora_relay.h"
+#include "power_control.h"
+
+/******************************************************************************
+ * Deep sleep with state kept in RTC slow memory (FLAGS.DEEP_SLEEP)
+ * RAM is powered off in deep sleep and the device boots on wake up. State that
+ * must survive is saved by each module into a versioned struct in RTC memory
+ * and restored on a fast boot path (see fast_boot() in main.cpp).
+ * Sensor stores commit on every add and uncommited logs are already kept in RTC
+ * memory, so DataStore buffers need nothing more.
+ ******************************************************************************/
+namespace DeepSleep
+{
+    /** What put the device in deep sleep, boot continues there */
+    enum Source
+    {
+        SOURCE_SLEEP_SCHEDULER = 1,
+        SOURCE_SLEEP_CHARGE = 2
+    };
+
+    /** State kept in RTC memory. Increase DEEP_SLEEP_STATE_VERSION when changed */
+    struct State
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        uint8_t source;
+
+        SleepScheduler::RetainedState sleep_scheduler;
+        Battery::RetainedState battery;
+        PowerGovernor::RetainedState power_governor;
+        EnergyProfiler::RetainedState energy_profiler;
+        GSM::RetainedState gsm;
+        FoSniffer::RetainedState fo_sniffer;
+        FoUart::RetainedState fo_uart;
+        int fo_wakeup_count;
+        Log::RetainedState log;
+        RTC::RetainedState rtc;
+        Trace::RetainedState trace;
+        WaterPresence::RetainedState water_presence;
+        AdaptiveSampling::RetainedState adaptive_sampling;
+        Deadband::RetainedState deadband;
+        LoraRelay::RetainedState lora_relay;
+        PowerControl::RetainedState power_control;
+
+        /** CRC32 of above fields */
+        uint32_t crc32;
+    };
+
+    bool allowed(int sleep_secs);
+
+    void start(uint64_t sleep_us, Source source);
+
+    void init();
+
+    bool woke_up();
+
+    uint16_t get_state_version();
+
+    Source get_source();
+
+    RetResult restore();
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <inttypes.h>
+#include <functional>
+#include "esp_partition.h"
+#include "struct.h"
+
+/**
+ * Streaming applier of detools sequential patches (uncompressed). Patch bytes
+ * are fed as they are downloaded, the new image is rebuilt from the running
+ * partition and handed to a writer in order, so neither the patch nor the
+ * image needs to be held in RAM.
+ */
+namespace DeltaPatch
+{
+	/** Receives rebuilt image data, in order */
+	typedef std::function<RetResult(const uint8_t *data, int len)> Writer;
+
+	RetResult begin(const esp_partition_t *source, Writer writer);
+	RetResult process(const uint8_t *data, int len);
+	bool is_finished();
+	uint32_t get_to_size();
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <Preferences.h>
+#include "rom/md5_hash.h"
 #include "remote_control.h"
 #include "struct.h"
 #include "utils.h"
@@ -14,19 +15,27 @@
  *****************************************************************************/
 namespace DeviceConfig
 {
+    /** Protocol used to talk to TB */
+    enum Transport
+    {
+        TRANSPORT_HTTP = 0,
+        TRANSPORT_MQTT = 1,
+        TRANSPORT_COAP = 2
+    };
+
     struct Data
     {
         /** CRC32 of whole structure. Calculated with crc32 = 0 */
         uint32_t crc32;
 
-        /** Set before doing a reboot. If not set during boot, reboot was unexpected. */
+        /** Deprecated, moved to RuntimeFlags. Kept for struct layout, only read to
+         * migrate on first boot after update */
         bool clean_reboot;
        
         /** Current wake up schedule as set by user or loaded from defaults */
         SleepScheduler::WakeupScheduleEntry wakeup_schedule[WAKEUP_SCHEDULE_LEN];
 
-        /** Set after OTA to denote that a new FW was flashed, so the new FW knows its new
-         * Must be cleared on boot. */
+        /** Deprecated, moved to RuntimeFlags (see clean_reboot) */
         bool ota_flashed;
 
         /** Data id of last remote control data applied. Used to check if received config data is new */
@@ -43,11 +52,170 @@ namespace DeviceConfig
 
         /** FO weather enabled */
         bool fo_enabled;
+
+        /** Transport used to talk to TB (Transport) */
+        uint8_t transport;
+    }__attribute__((packed));
+
+    /** Flags changed right before/after a reboot. Stored under own key so setting them
+     * writes a few bytes immediately instead of the whole config */
+    struct RuntimeFlags
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Set before doing a reboot. If not set during boot, reboot was unexpected. */
+        bool clean_reboot;
+
+        /** Set after OTA to denote that a new FW was flashed, so the new FW knows its new
+         * Must be cleared on boot. */
+        bool ota_flashed;
+    }__attribute__((packed));
+
+    /** Registration parameters of last successful attach. Stored under own key so a
+     * lost/corrupted cache never resets the config (see GSM::connect) */
+    struct NetworkCache
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Operator in numeric format (MCC+MNC) */
+        char oper[8];
+
+        /** Attached in NBIoT mode */
+        bool nbiot_mode;
+
+        /** LTE band attached on. 0 if unknown (GSM) */
+        uint8_t band;
+
+        /** Serving cell id */
+        uint32_t cell_id;
+
+        /** APN used on attach. Cache is not used if APN changed */
+        char apn[32];
+
+        /** Attach time moving average and variance (ms) */
+        float attach_ms_mean;
+        float attach_ms_var;
+    }__attribute__((packed));
+
+    /** Progress of an interrupted OTA download, resumed on next call home (see OTA) */
+    struct OtaProgress
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** MD5 of the image being downloaded. Progress is dropped if a different image is requested.
+         * Padded so md5_ctx stays word aligned */
+        char fw_md5[36];
+
+        /** Image size */
+        uint32_t total_size;
+
+        /** Bytes written to the update partition, always at a flash sector boundary */
+        uint32_t offset;
+
+        /** Running MD5 of first offset bytes */
+        struct MD5Context md5_ctx;
+    }__attribute__((packed));
+
+    /** New image waiting to be validated by a full call home (see OTA) */
+    struct OtaValidation
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Timestamp of first call home attempt of new image with valid time,
+         * deadline counts from here. 0 until then */
+        uint32_t first_boot_tstamp;
+
+        /** Unexpected resets since first boot */
+        uint32_t unexpected_resets;
+    }__attribute__((packed));
+
+    /** Drift model of the clock time is kept with between network syncs (see RTC) */
+    struct ClockModel
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Timestamp of last network sync. Correction and predicted error count from here */
+        uint32_t last_sync_tstamp;
+
+        /** Start of current drift measurement interval */
+        uint32_t anchor_tstamp;
+
+        /** Sum of time steps of network syncs since anchor (secs) */
+        int32_t anchor_offset;
+
+        /** Estimated drift, positive when the clock runs slow (ppm) */
+        float drift_ppm;
+
+        /** Moving average of abs drift left after correction (ppm) */
+        float error_ppm;
+
+        /** Drift estimations done */
+        uint16_t samples;
+
+        /** Model is of the ext RTC, else of system time. Dropped when that changes */
+        bool ext_rtc;
+    }__attribute__((packed));
+
+    /** Deadbands of the report by exception filter (see Deadband) */
+    struct Deadbands
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** An entry is stored at least this often */
+        uint32_t heartbeat_secs;
+
+        /** Deadband of each store field in schema order, 0 for none */
+        float thresholds[SENSOR_STORE_COUNT][DEADBAND_MAX_FIELDS];
+    }__attribute__((packed));
+
+    /** Call home offset from the schedule grid (see SleepScheduler) */
+    struct CallHomePhase
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Offset (secs), -1 to derive from the MAC */
+        int32_t phase_secs;
+    }__attribute__((packed));
+
+    /** Stores with backfilled entries not submitted yet (see Backfill) */
+    struct BackfillState
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Bit per StoreId */
+        uint32_t store_mask;
+    }__attribute__((packed));
+
+    /** Hashes of client attributes last published (see CallHome::handle_client_attributes()) */
+    struct ClientAttrState
+    {
+        /** CRC32 of whole structure. Calculated with crc32 = 0 */
+        uint32_t crc32;
+
+        /** Timestamp all attributes were last published */
+        uint32_t last_full_tstamp;
+
+        uint8_t count;
+
+        struct
+        {
+            uint32_t key_crc;
+            uint32_t value_crc;
+        } attrs[CLIENT_ATTR_MAX_KEYS];
     }__attribute__((packed));
 
     RetResult init();
     const Data* get();
     RetResult commit();
+    bool is_dirty();
     void print(const Data *data);
     void print_current();
 
@@ -74,11 +242,43 @@ namespace DeviceConfig
     const bool get_fo_enabled();
     RetResult set_fo_enabled(bool enabled);
 
+    Transport get_transport();
+    RetResult set_transport(Transport transport);
+
     int get_wakeup_schedule_reason_int(SleepScheduler::WakeupReason reason);
     bool get_clean_reboot();
     bool get_ota_flashed();
     const char* get_tb_device_token();
     RetResult get_wakeup_schedule(SleepScheduler::WakeupScheduleEntry *schedule);
+
+    RetResult get_network_cache(NetworkCache *cache);
+    RetResult set_network_cache(NetworkCache *cache);
+    RetResult clear_network_cache();
+    void print_network_cache(const NetworkCache *cache);
+
+    RetResult get_ota_progress(OtaProgress *progress);
+    RetResult set_ota_progress(OtaProgress *progress);
+    RetResult clear_ota_progress();
+
+    RetResult get_ota_validation(OtaValidation *validation);
+    RetResult set_ota_validation(OtaValidation *validation);
+    RetResult clear_ota_validation();
+
+    RetResult get_clock_model(ClockModel *model);
+    RetResult set_clock_model(ClockModel *model);
+
+    RetResult get_deadbands(Deadbands *deadbands);
+    RetResult set_deadbands(Deadbands *deadbands);
+
+    RetResult get_call_home_phase(CallHomePhase *phase);
+    RetResult set_call_home_phase(CallHomePhase *phase);
+
+    RetResult get_backfill_state(BackfillState *state);
+    RetResult set_backfill_state(BackfillState *state);
+    RetResult clear_backfill_state();
+
+    RetResult get_client_attr_state(ClientAttrState *state);
+    RetResult set_client_attr_state(ClientAttrState *state);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef ENERGY_PROFILE_DATA_H
+#define ENERGY_PROFILE_DATA_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "data_store.h"
+
+namespace EnergyProfileData
+{
+    /**
+     * Daily energy summary (see EnergyProfiler)
+     * Time spent in each power state and battery gauge charge drawn while in it.
+     * States overlap (eg. GPRS while GSM on while CPU active), charge of a state
+     * includes the load of everything else on at the same time.
+     * NOTE: MUST be aligned to 4 byte boundary to avoid padding. If not, CRC32 calculations
+     * may fail
+     */
+    struct Entry
+    {
+        // Start of day (UTC)
+        uint32_t timestamp;
+
+        // Time in each state (sec)
+        uint32_t sleep_secs;
+        uint32_t active_secs;
+        uint32_t gsm_secs;
+        uint32_t gprs_secs;
+        uint32_t rf_secs;
+        uint32_t sdi12_secs;
+        uint32_t water_sensors_secs;
+
+        // Net charge drawn from battery in each state (mAh), 0 without gauge
+        float sleep_mah;
+        float active_mah;
+        float gsm_mah;
+        float gprs_mah;
+        float rf_mah;
+        float sdi12_mah;
+        float water_sensors_mah;
+
+        // Charge from solar panel (mAh), 0 without solar monitor
+        float solar_mah;
+
+        // NVS config commits and time spent in them (ms)
+        uint32_t nvs_commits;
+        uint32_t nvs_commit_ms;
+
+        // Time (sec) and charge (mAh) at max CPU frequency (see PowerLock)
+        uint32_t cpu_max_secs;
+        float cpu_max_mah;
+    } __attribute__((packed));
+
+    RetResult add(Entry *data);
+    DataStore<Entry>* get_store();
+
+    void print(const Entry *data);
+} // namespace EnergyProfileData
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ENERGY_PROFILER_H
+#define ENERGY_PROFILER_H
+
+#include <inttypes.h>
+#include <esp_err.h>
+#include "struct.h"
+
+/**
+ * Accounts time and battery charge per power state. Battery gauge and solar
+ * monitor are sampled on every state change, totals are stored as a daily
+ * summary (see EnergyProfileData)
+ */
+namespace EnergyProfiler
+{
+	enum State
+	{
+		STATE_SLEEP,
+		STATE_CPU_ACTIVE,
+		STATE_GSM_ON,
+		STATE_GPRS,
+		STATE_RF_RX,
+		STATE_SDI12_POWER,
+		STATE_WATER_SENSORS_POWER,
+		/** CPU at max frequency (see PowerLock) */
+		STATE_CPU_MAX,
+		STATE_COUNT
+	};
+
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		// Day being accounted (days since epoch), 0 when time not known yet
+		uint32_t day;
+
+		// Totals of current day
+		uint64_t total_ms[STATE_COUNT];
+		float total_mah[STATE_COUNT];
+		float solar_mah;
+
+		// States on, when they turned on and gauge charge at that time
+		uint8_t active_mask;
+		uint64_t start_ms[STATE_COUNT];
+		float start_mah[STATE_COUNT];
+
+		// Last solar current sample
+		uint64_t solar_sample_ms;
+		float solar_ma;
+
+		// NVS commits of current day and time spent in them
+		uint32_t nvs_commits;
+		uint32_t nvs_commit_ms;
+	};
+
+	void init();
+	void begin(State state);
+	void end(State state);
+	esp_err_t light_sleep();
+	void count_nvs_commit(uint32_t duration_ms);
+	void update();
+	void print();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FIELD_OFFLOAD_H
+#define FIELD_OFFLOAD_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Local bulk download of store data over a WiFi SoftAP (FLAGS.FIELD_OFFLOAD),
+ * for sites without cellular coverage. Entered on boot by holding the config
+ * button (or a magnet on a reed switch wired to it) for
+ * FIELD_OFFLOAD_BTN_HOLD_TIME_MS, or with the OFFLOAD config mode command.
+ *
+ * The AP is FIELD_OFFLOAD_AP_SSID_PREFIX followed by the MAC, the device answers
+ * plain HTTP on FIELD_OFFLOAD_PORT of its AP address:
+ * - GET / lists stores (id, name, files, entries, bytes, token) as CSV
+ * - GET /store?id=<id>&format=bin|csv streams a store with chunked transfer.
+ *   Binary is an OffloadHeader followed by the stored DataStore::Entry records
+ *   (CRC32, seq, struct) as they are in flash; CSV is available for sensor
+ *   stores. The X-Offload-Token header identifies the files sent
+ * - POST /confirm?id=<id>&token=<token> marks the files sent as submitted
+ *   (archived or deleted as after a call home) if they did not change since
+ * - GET /exit ends offload mode, boot continues
+ * Offload mode also ends after FIELD_OFFLOAD_IDLE_TIMEOUT_MS without requests.
+ */
+namespace FieldOffload
+{
+	/** Start of a binary download */
+	struct OffloadHeader
+	{
+		/** FIELD_OFFLOAD_BINARY_MAGIC */
+		uint32_t magic;
+
+		/** FIELD_OFFLOAD_BINARY_VERSION */
+		uint16_t version;
+
+		/** DATA_STORE_FORMAT_VERSION of the records */
+		uint16_t store_format;
+
+		/** StoreId */
+		uint8_t store;
+
+		/** Bytes of a record, header included */
+		uint16_t record_size;
+	} __attribute__((packed));
+
+	RetResult run();
+}
+
+#endif
@@ -9,9 +9,17 @@ namespace Flash
 
     RetResult read_file(const char *path, uint8_t *dest, int bytes);
 
+    RetResult remount();
+
     RetResult format();
 
     void ls();
+
+    uint32_t get_generation();
+
+    void hold();
+
+    void release();
 }
 
 #endif
\ No newline at end of file
@@ -3,33 +3,69 @@
 
 #include <inttypes.h>
 #include "app_config.h"
+#include "const.h"
 #include "fo_buffer.h"
 
 /******************************************************************************
 * FO Decoded Packet buffer
-* Stores decoded packets which can then be aggregated and commited into a 
-* single FoData store entry
+* Aggregates decoded packets on the fly (running means, Welford variance,
+* wind vector sums) so they can be commited into a single FoData store entry.
+* Memory use does not depend on the number of packets in the window.
 ******************************************************************************/
 class FoBuffer
 {
 public:
+    /** Running aggregate of the packets added since the last commit */
+    struct Aggregate
+    {
+        int packet_count;
+        uint32_t first_packet_tstamp;
+        uint32_t last_packet_tstamp;
+
+        // Welford running mean and sum of squared differences from the mean
+        float temp_mean;
+        float temp_m2;
+        float wind_speed_mean;
+        float wind_speed_m2;
+
+        // Running means
+        float hum_mean;
+        float wind_gust_mean;
+        float uv_mean;
+        float uv_index_mean;
+        float light_mean;
+        float solar_radiation_mean;
+
+        float wind_gust_max;
+
+        // Sums of wind dir unit vectors, used to calculate mean angle
+        float wind_dir_sin_total;
+        float wind_dir_cos_total;
+
+        // Cumulative rain counter of first/last packet
+        float first_rain;
+        float last_rain;
+    };
+
+    /** Buffer contents kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        Aggregate aggregate;
+        float prev_rain;
+    };
+
     RetResult commit_buffer();
     RetResult add_packet(FoDecodedPacket *packet);
     void clear();
+    int get_packet_count();
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 
     static void print_packet(FoDecodedPacket *packet);
 private:
-    /** Buffer */
-    FoDecodedPacket _buffer[FO_BUFFER_SIZE];
-
-    /** Count of packets in buffer */
-    int _packet_count = 0;
-
-    /** Timestamp of first added packet */
-    uint32_t _first_packet_tstamp = 0;
-
-    /** Timestamp of last added packet */
-    uint32_t _last_packet_tstamp = 0;
+    /** Aggregate of packets in buffer */
+    Aggregate _aggr = {0};
 
     /** Rain count from previously commited packet. Used to calculate hr rate */
     float _prev_rain = -1;
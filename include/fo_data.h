@@ -24,6 +24,7 @@ namespace FoData
 
 		// Temperature, Celsius
 		// Range: -40C - 60C
+		// Res: 0.1C
 		// 0x7FF invalid
 		float temp;    
 
@@ -33,9 +34,11 @@ namespace FoData
 		uint8_t hum;   
 
 		// Cumulative rain counter, mm
+		// Res: 0.254mm (FO_RAIN_MM_PER_CLICK), sent with 0.01
 		float rain; 
 
 		// Hourly rate (mm/h)
+		// Res: 0.01mm/h
 		float rain_hourly;
 
 		// Wind direction, deg
@@ -44,10 +47,12 @@ namespace FoData
 		uint16_t wind_dir;
 
 		// Wind speed, m/s
+		// Res: 0.0644m/s, sent with 0.01
 		// 0x1FF invalid
 		float wind_speed;
 
 		// Wind gust, m/s
+		// Res: 0.51m/s (FO_WIND_GUST_COEFF), sent with 0.1
 		// 0xFF when invalid
 		float wind_gust; 
 
@@ -69,16 +74,32 @@ namespace FoData
 		// Solar radiation - Derived from light, W/M^2
 		// Range: ?
 		uint32_t solar_radiation;
+
+		// Population std dev of temperature samples in this entry, Celsius
+		// Res: 0.01C
+		float temp_std;
+
+		// Population std dev of wind speed samples in this entry, m/s
+		// Res: 0.01m/s
+		float wind_speed_std;
+
+		// Max wind gust of samples in this entry, m/s
+		// Res: 0.1m/s
+		float wind_gust_max;
 	}__attribute__((packed));
 
     RetResult init();
-    RetResult add(StoreEntry *data);
+    StoreEntry* reserve();
+    RetResult publish();
 
     RetResult commit_buffer();
     DataStore<StoreEntry>* get_store();
 
 	void inc_wakeup_count();
     void print(FoData::StoreEntry *packet);
+
+    int get_wakeup_count();
+    void set_wakeup_count(int count);
 };
 
 #endif
\ No newline at end of file
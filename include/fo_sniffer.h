@@ -6,10 +6,39 @@
 #include "app_config.h"
 #include "utils.h"
 #include "data_store.h"
+#include "fo_buffer.h"
 
 namespace FoSniffer
 {
+	/** Measured packet timing of the weather station, used to size the RX window */
+	struct PacketTiming
+	{
+		/** System time (ms) of last packet received in sync */
+		uint64_t last_rx_ms;
+
+		/** Fitted packet interval (ms), tracks the station's clock drift */
+		float interval_ms;
+
+		/** Running variance of packet arrival error (ms^2) */
+		float jitter_var;
+
+		/** Successive packets the fit is based on */
+		uint16_t samples;
+	};
+
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		uint32_t last_packet_tstamp;
+		bool in_sync;
+		uint8_t rx_failures;
+		uint32_t last_sync_tstamp;
+		PacketTiming timing;
+		FoBuffer::RetainedState packet_buff;
+	};
+
 	RetResult init();	
+	RFM95* get_radio();
 
 	RetResult wait_for_packet(uint32_t timeout_ms, bool ignore_address = false);
 	RetResult sleep_to_packet(uint32_t max_sleep_ms);
@@ -18,9 +47,20 @@ namespace FoSniffer
 
 	int calc_secs_to_next_sniff();
 	RetResult handle_sniff_event();
+
+	RetResult start_continuous_rx();
+	bool continuous_rx_active();
+	void arm_rx_wakeup();
+	bool wait_rx_serviced();
+	bool rx_queue_half_full();
+	int process_rx_queue();
 	RetResult commit_buffer();
 	void print_packet(FoDecodedPacket *packet);
+	RetResult decode_packet(const uint8_t *buff, FoDecodedPacket *decoded);
 	FoDecodedPacket* get_last_packet();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
 }
 
 #endif
\ No newline at end of file
@@ -3,9 +3,18 @@
 
 #include "struct.h"
 #include <inttypes.h>
+#include "fo_buffer.h"
 
 namespace FoUart
 {
+    /** State kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        uint32_t last_packet_tstamp;
+        uint8_t rx_failures;
+        FoBuffer::RetainedState packet_buff;
+    };
+
     /**
 	 * A single packet of data parsed from the UART response
 	 */
@@ -27,9 +36,13 @@ namespace FoUart
 
     int calc_secs_to_next_packet();
     RetResult request_packet();
+	bool parse_line(const char *line, int *field, float *value);
 	RetResult handle_scheduled_event();
 	FoDecodedPacket *get_last_packet();
 	RetResult commit_buffer();
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 }
 
 #endif
\ No newline at end of file
@@ -1,14 +1,67 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
+#include <stddef.h>
+#include <ArduinoJson.h>
 #include "app_config.h"
 #include "struct.h"
 #include "const.h"
 
 /**
- * Large global buffer to be used for receiving large responses to http reqs.
- * Global to avoid polluting the stack
+ * Shared scratch arena for large temporary buffers of phases that never run at the
+ * same time (remote control, client attributes, telemetry, IPFS, OTA), instead of
+ * each one keeping its own global, stack or heap buffer.
+ * Bump allocator over one static region: a Scope marks the top on creation and
+ * everything allocated inside it is freed when it ends. Scopes nest (eg. OTA runs
+ * inside remote control handling) and must end in reverse order, which holds for
+ * scopes on the stack. Allocations are made by the main task only.
+ * On boards with PSRAM the arena is moved to a larger region there (see Psram).
  */
-extern char g_resp_buffer[GLOBAL_HTTP_RESPONSE_BUFFER_LEN];
+namespace Scratch
+{
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
 
-#endif
\ No newline at end of file
+    private:
+        size_t _mark;
+    };
+
+    void* alloc(size_t size);
+    RetResult use_region(void *region, size_t size);
+    size_t get_size();
+    size_t get_used();
+    size_t get_peak();
+
+    /** ArduinoJson allocator, memory is freed with the scope the doc was created in */
+    struct JsonAllocator
+    {
+        void* allocate(size_t size) { return alloc(size); }
+        void deallocate(void *ptr) {}
+        void* reallocate(void *ptr, size_t new_size) { return NULL; }
+    };
+}
+
+/** JSON doc allocated from the scratch arena. capacity() is 0 if arena was full */
+typedef BasicJsonDocument<Scratch::JsonAllocator> ScratchJsonDocument;
+
+/**
+ * Char buffer allocated from the scratch arena, freed when it goes out of scope.
+ * get() returns NULL if the arena has no room.
+ */
+class ScratchBuffer : public Scratch::Scope
+{
+public:
+    ScratchBuffer(size_t size);
+
+    char* get();
+    size_t size();
+
+private:
+    char *_buff;
+    size_t _size;
+};
+
+#endif
@@ -8,10 +8,59 @@
 
 namespace GSM
 {
+    /** State kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        bool psm_enabled;
+        bool psm_sleeping;
+        bool clk_sleeping;
+        uint8_t power_state;
+        uint32_t serial_baud;
+        uint32_t cold_start_ms;
+    };
+
+    /** Static modem facts, read once per boot (see get_info()) */
+    struct ModemInfo
+    {
+        char imei[16];
+        char ccid[24];
+        char model[24];
+
+        /** ATI response, firmware revision */
+        char revision[48];
+    };
+
+    /** Radio access technology */
+    enum Rat
+    {
+        RAT_UNKNOWN,
+        RAT_GSM,
+        RAT_CAT_M1,
+        RAT_NB_IOT
+    };
+
+    /** Serving cell from UE system information (see get_serving_cell()) */
+    struct ServingCell
+    {
+        /** MCC and MNC, eg. "24491" */
+        char oper[8];
+
+        /** Rat */
+        uint8_t rat;
+
+        /** RSRP (dBm) and RSRQ (dB), 0 if not LTE */
+        int16_t rsrp;
+        int16_t rsrq;
+    };
+
     void init();
 
     RetResult connect();
     RetResult connect_persist();
+    RetResult start_connect();
+    RetResult wait_connect();
+    bool connect_pending();
+    void set_connect_deadline(uint32_t deadline_ms);
 
     RetResult enable_gprs(bool enable);
 
@@ -25,13 +74,19 @@ namespace GSM
     RetResult get_battery_info(uint16_t *voltage, uint16_t *pct);
 
     TinyGsm* get_modem();
+    const ModemInfo* get_info();
+    void log_at_stats();
 
     int get_rssi();
+    RetResult get_serving_cell(ServingCell *cell);
     bool is_sim_card_present();
     bool is_on(uint32_t timeout = GSM_TEST_AT_TIMEOUT);
     bool is_gprs_connected();
     RetResult print_system_info();
     RetResult factory_reset();
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <Arduino.h>
+#include <functional>
+#include "const.h"
+#include "struct.h"
+#include "rom/miniz.h"
+
+/******************************************************************************
+ * Print that gzips what is written to it into another Print, as it is written,
+ * with the deflate compressor in ROM. Input is fed to the compressor in
+ * GZIP_STREAM_CHUNK_SIZE chunks and compressed output goes out in the
+ * compressor's own buffer sized blocks, so no buffer of the whole body is
+ * needed on either side.
+ *
+ * Compressor state (about 320KB, fixed by the ROM build) is allocated in PSRAM
+ * for the life of the object, internal heap never has a block that large.
+ * One object can compress any number of streams, one after another.
+ *
+ * Compression is deterministic, so measure() gives the exact length of the
+ * same bytes compressed again, eg. for a Content-Length sent ahead of the body.
+ ******************************************************************************/
+class GzipStream : public Print
+{
+public:
+    /** Writes a body to compress */
+    typedef std::function<void(Print &out)> Writer;
+
+    GzipStream();
+    ~GzipStream();
+
+    /** Compressor could be allocated. Needs PSRAM */
+    operator bool();
+
+    RetResult begin(Print *out);
+    RetResult finish();
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buff, size_t size);
+
+    int measure(Writer writer);
+
+    int get_in_len();
+    int get_out_len();
+
+private:
+    RetResult feed(tdefl_flush flush);
+    size_t out_write(const void *buff, size_t size);
+
+    static int put_buf(const void *buff, int len, void *user);
+
+    tdefl_compressor *_compressor = NULL;
+
+    /** Compressed output, NULL when not in a stream */
+    Print *_out = NULL;
+
+    /** Compressor or output failed, rest of the stream is dropped */
+    bool _failed = false;
+
+    /** CRC32 and length of input so far, for the trailer */
+    uint32_t _crc = 0;
+    uint32_t _in_len = 0;
+
+    /** Bytes written to output, header and trailer included */
+    int _out_len = 0;
+
+    /** Input not fed to the compressor yet */
+    uint8_t _chunk[GZIP_STREAM_CHUNK_SIZE];
+    int _chunk_len = 0;
+};
+
+#endif
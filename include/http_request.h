@@ -4,20 +4,32 @@
 #include "app_config.h"
 #include "const.h"
 #include <ArduinoHttpClient.h>
+#include <functional>
 #include "gsm.h"
 
 class HttpRequest
 {
 public:
+	/** Writes a request body of known length directly to the request stream */
+	typedef std::function<void(Print &out)> BodyWriter;
+
+	/** Reads the response body directly from the connection (eg. a JSON parser) */
+	typedef std::function<RetResult(Stream &in, int content_length)> ResponseReader;
+
 	HttpRequest(TinyGsm *modem, const char *server);
 	RetResult get(const char *path, char *resp_buff, int resp_buff_size);
+	RetResult get(const char *path, ResponseReader reader);
 	RetResult post(const char *path, const unsigned char *body, int body_len, char *content_type, 
 		char *resp_buff, int resp_buff_size);
+	RetResult post(const char *path, BodyWriter body_writer, int body_len, char *content_type,
+		char *resp_buff, int resp_buff_size);
 
 	uint16_t get_response_code();
 	int get_response_length();
 
 	RetResult set_port(int port);
+
+	RetResult set_content_encoding(const char *encoding);
 private:
 	enum Method
 	{
@@ -28,7 +40,22 @@ private:
 	RetResult req(Method method, const char *path, char *resp_buff, int resp_buff_size,
 		const unsigned char *body, int body_len, char *content_type);
 
+	RetResult req_with_transport(Method method, const char *path, char *resp_buff, int resp_buff_size,
+		const unsigned char *body, int body_len, char *content_type);
+
+	RetResult req_with_client(HttpClient &http_client, bool keep_alive, Method method, const char *path,
+		char *resp_buff, int resp_buff_size, const unsigned char *body, int body_len, char *content_type);
+
+	RetResult req_with_modem(Method method, const char *path, char *resp_buff, int resp_buff_size,
+		const unsigned char *body, int body_len, char *content_type);
+	RetResult modem_request(Method method, const char *path, char *resp_buff, int resp_buff_size,
+		const unsigned char *body, int body_len, char *content_type);
+	RetResult read_modem_response(char *resp_buff, int resp_buff_size);
+
 	int _port = 80;
+	const char *_content_encoding = NULL;
+	BodyWriter _body_writer = nullptr;
+	ResponseReader _response_reader = nullptr;
 	char *_server = NULL;
 	TinyGsm *_modem;
 	uint16_t _response_code = 0;
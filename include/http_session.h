@@ -0,0 +1,28 @@
+#ifndef HTTP_SESSION_H
+#define HTTP_SESSION_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include <ArduinoHttpClient.h>
+
+/******************************************************************************
+ * Persistent HTTP connection shared by all requests to the same server during
+ * a call home. HttpRequest uses it automatically when server and port match,
+ * so the TCP socket is set up once instead of once per request. Reconnects on
+ * next request if server closes the connection.
+ ******************************************************************************/
+namespace HttpSession
+{
+    RetResult open(const char *server, int port);
+
+    void close();
+
+    bool is_open();
+
+    HttpClient* get_client(const char *server, int port);
+
+    void on_request_complete(bool reusable);
+}
+
+#endif
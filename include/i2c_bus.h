@@ -0,0 +1,21 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <inttypes.h>
+#include "struct.h"
+
+/**
+ * Main I2C bus (Wire). Inits the bus at the board's clock (I2C_BUS_FREQ_HZ) and
+ * provides register access for devices without a library. Multi-register reads
+ * are done as a single burst transaction (register pointer write, repeated
+ * start, sequential read) instead of one transaction per register
+ */
+namespace I2CBus
+{
+	void begin();
+
+	RetResult read_regs(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
+	RetResult write_reg(uint8_t addr, uint8_t reg, uint8_t value);
+}
+
+#endif
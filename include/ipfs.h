@@ -0,0 +1,27 @@
+#ifndef IPFS_H
+#define IPFS_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+
+/**
+ * Content addressing of IPFS objects on the device. The CID (CIDv1, raw codec,
+ * sha2-256 multihash, base32) is computed locally with the SHA accelerator, so
+ * it goes out with the telemetry it describes without waiting for the node.
+ *
+ * Blocks are kept in IPFS_PENDING_PATH as CAR sections and upload_pending()
+ * imports all of them in one request to the node. A failed upload is retried
+ * on the next call home, CIDs don't change since they depend only on content.
+ */
+namespace Ipfs
+{
+	RetResult compute_cid(const uint8_t *data, int len, uint8_t cid[IPFS_CID_LEN]);
+	void cid_to_str(const uint8_t cid[IPFS_CID_LEN], char *buff, int buff_size);
+
+	RetResult add_block(const uint8_t *data, int len, char *cid_str, int cid_str_size);
+	RetResult upload_pending();
+	int get_pending_count();
+}
+
+#endif
@@ -19,8 +19,18 @@ public:
 
     RetResult build(char *buff_out, int buff_size, bool beautify);
 
+    RetResult build(Print &out);
+
     bool is_empty();
 
+    int get_count();
+
+    RetResult truncate(int count);
+
+    RetResult set_seq(uint32_t seq);
+
+    int measure();
+
     RetResult reset();
 
     void print();
@@ -21,7 +21,9 @@ namespace LightningData
         uint32_t energy;
     } __attribute__((packed));
 
+    void init();
     RetResult add(Entry *data);
+    RetResult commit();
     DataStore<Entry>* get_store();
 
     void print(const Entry *data);
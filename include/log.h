@@ -10,27 +10,67 @@ namespace Log
 {
     /**
      * Event log entry
+     * Timestamp: Seconds. TB ms key is rebuilt as timestamp * 1000 + seq, so
+     * entries in the same second don't overwrite each other
+     * Seq: Entries stored before in the same second
      * Code: Error code
-     * Meta1: Metadata field 1
-     * Meta2: Metadata field 2
+     * Meta: 0 - LOG_ENTRY_MAX_METAS metadata values, varint encoded. Two values
+     * that don't fit are stored raw (see get_metas())
      */
     struct Entry
     {
-        unsigned long long timestamp;
-        Code code;
-        int meta1;
-        int meta2;
+        uint32_t timestamp;
+        uint8_t seq;
+        /** Meta value count | LOG_ENTRY_META_RAW */
+        uint8_t meta_info;
+        uint16_t code;
+        uint8_t meta[LOG_ENTRY_META_LEN];
     }__attribute__((packed));
 
+    /** Entries of a rate limited/aggregated code in current window */
+    struct CodeWindow
+    {
+        bool open;
+        uint32_t first_tstamp;
+        uint32_t last_tstamp;
+        uint32_t count;
+        int min;
+        int max;
+    };
+
+    /**
+     * State kept in RTC memory over deep sleep (see DeepSleep). Uncommited
+     * entries are already kept in RTC memory by the log itself
+     */
+    struct RetainedState
+    {
+        uint32_t last_log_tstamp;
+        int last_log_tstamp_counter;
+        CodeWindow windows[LOG_POLICY_MAX];
+    };
+
+    RetResult init();
+
     bool log(Log::Code code, uint32_t meta1 = 0, uint32_t meta2 = 0);
+    bool log_metas(Log::Code code, const uint32_t *metas, int count);
+
+    void set_metas(Entry *entry, const uint32_t *metas, int count);
+    int get_metas(const Entry *entry, uint32_t *metas, int max);
+    uint32_t get_meta(const Entry *entry, int index);
+    uint64_t get_tb_timestamp(const Entry *entry);
+    void convert_legacy_store();
     
     RetResult commit();
+    void flush_windows();
 
     void print(const Log::Entry *entry);
 
     DataStore<Entry>* get_store();
 
     void set_enabled(bool enabled);
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 }
 
 #endif
\ No newline at end of file
@@ -42,7 +42,8 @@ namespace Log
         // Device going to sleep
         // Logged only for the main sleep event
         // Meta1: Time awake (s)
-        // Meta2: Time to sleep (s)
+        // Meta2: Time to sleep (s). Upper 8 bits: Wake ups saved by coalescing
+        // events since last SLEEP log
         SLEEP = 12,
 
         // Device waking up from sleep
@@ -162,6 +163,7 @@ namespace Log
         OTA_SELF_TEST_PASSED = 43,
 
         // OTA: self test failed
+        // Meta1: 0 boot self test, 1 no full call home before deadline, 2 too many unexpected resets
         OTA_SELF_TEST_FAILED = 44,
 
         // OTA: FW is rolled back to old version and device rebooted
@@ -468,6 +470,321 @@ namespace Log
         //
         DATA_STORE_CLEANUP = 108,
 
+        //
+        // Uncommited logs recovered from RTC memory on boot
+        // Meta1: Entries recovered
+        LOG_RECOVERED_FROM_RTC = 109,
+
+        //
+        // Partially written entry found at the end of a store file and removed
+        // Meta1: Bytes removed
+        // Meta2: Entries left in file
+        DATA_STORE_PARTIAL_ENTRY_TRUNCATED = 110,
+
+        //
+        // Ring store full, oldest sector overwritten before its data was submitted
+        // Meta1: Sector
+        // Meta2: Blocks lost
+        RING_STORE_SECTOR_OVERWRITTEN = 111,
+
+        //
+        // Telemetry of a store was submitted compressed, logged after each slice
+        // of it. Only with GZIP_TELEMETRY on a board with PSRAM, requests that did
+        // not compress count as sent uncompressed
+        // Meta1: Uncompressed bytes | Store (StoreId) << 24
+        // Meta2: Compressed bytes
+        TELEMETRY_COMPRESSION_RATIO = 112,
+
+        //
+        // Uplink quality estimate at the end of a call home
+        // Meta1: Quality (0: bad, 1: fair, 2: good)
+        // Meta2: Average request round-trip time (ms)
+        UPLINK_QUALITY = 113,
+
+        //
+        // Telemetry time budget used up, stores left with data for next call home
+        // Meta1: Stores deferred
+        // Meta2: Telemetry elapsed (sec)
+        TELEMETRY_DEFERRED = 114,
+
+        //
+        // Woke up from deep sleep but state in RTC memory is invalid, full boot
+        // Meta1: State version found
+        DEEP_SLEEP_STATE_INVALID = 115,
+
+        //
+        // Time spent in a boot phase
+        // Meta1: Phase (BootPhase)
+        // Meta2: Duration (ms)
+        BOOT_TIMING = 116,
+
+        //
+        // SDI12 bus scanned for sensors
+        // Meta1: Sensors found
+        // Meta2: Models found (1 << Sdi12Registry::Model)
+        SDI12_SENSORS_DISCOVERED = 117,
+
+        //
+        // FO sniffer packet timing, logged when FO buffer is commited
+        // Meta1: Fitted packet interval (us)
+        // Meta2: Arrival error std dev (ms) | RX margin (ms) << 16
+        FO_SNIFFER_TIMING = 118,
+
+        //
+        // GSM woken up from PSM
+        // Meta1: 1 if modem responded, 0 if a cold start followed
+        // Meta2: Time to wake up (ms)
+        GSM_PSM_WAKEUP = 119,
+
+        //
+        // Network attach finished
+        // Meta1: Attach time (ms)
+        // Meta2: Attach time std dev (ms) | 1 << 31 if cached operator/band was used
+        GSM_ATTACH_TIME = 120,
+
+        //
+        // OTA: Resuming interrupted download with a range request
+        // Meta1: Resume offset
+        // Meta2: Image size
+        OTA_RESUMING = 121,
+
+        //
+        // OTA: Delta patch download finished
+        // Meta1: Base FW version of patch
+        // Meta2: 1 if patch applied, 0 if falling back to full image
+        OTA_DELTA = 122,
+
+        //
+        // Log ring was full, entries were dropped
+        // Meta1: Dropped entries
+        LOG_RING_OVERRUN = 123,
+
+        //
+        // Summary of entries of a rate limited/aggregated code in a window (see Log).
+        // Entries of a rate limited code after the first one in a window, all entries of
+        // an aggregated code
+        // Meta1: Code | Entry count << 16
+        // Meta2: Secs since first entry | Secs since last entry << 16
+        LOG_AGGREGATED = 124,
+
+        //
+        // Meta1 range of the summarized entries, right after LOG_AGGREGATED for codes
+        // with meaningful meta1
+        // Meta1: Min
+        // Meta2: Max
+        LOG_AGGREGATED_RANGE = 125,
+
+        //
+        // Clock drift estimated from network syncs (see RTC)
+        // Meta1: Drift (ppb)
+        // Meta2: Time steps of syncs over the estimation interval (secs)
+        RTC_DRIFT_ESTIMATED = 126,
+
+        //
+        // RC slow clock calibrated against ext RTC, sleep durations are scaled
+        // Meta1: Error from boot calibration (ppm)
+        // Meta2: Calibration interval (secs)
+        RTC_SLOW_CLOCK_CALIBRATED = 127,
+
+        //
+        // Span durations since last summary (see Trace)
+        // Meta1: Span id | samples << 4
+        // Meta2: p50 (ms, sec for sleep)
+        // Meta3: p95 (ms, sec for sleep)
+        TRACE_SUMMARY = 128,
+
+        //
+        // AT command latencies of a call home session (see AtStream)
+        // Meta1: Command group | count << 4 | timeouts << 16 | total secs << 24
+        // Meta2: Latency histogram, 4 bit count per AT_LATENCY_BUCKET_MS bucket
+        AT_LATENCY = 129,
+
+        //
+        // Strikes of a minute in lightning aggregation mode (see LightningData)
+        // Meta1: Distance histogram, 8 bit count per LIGHTNING_HIST_DISTANCE_KM bucket
+        // Meta2: Energy histogram, 8 bit count per LIGHTNING_HIST_ENERGY bucket
+        LIGHTNING_HISTOGRAM = 130,
+
+        //
+        // Water presence changed, logged on the wake up it caused (see WaterPresence)
+        // Meta1: New level
+        WATER_PRESENCE_CHANGED = 131,
+
+        //
+        // Alarm sent through the expedited uplink (see CallHome::send_alarm())
+        // Meta1: Alarm | sent << 8 | full call home followed << 9
+        // Meta2: Millis from alarm to response
+        ALARM_UPLINK = 132,
+
+        //
+        // Water sensors interval changed by adaptive sampling (see AdaptiveSampling)
+        // Meta1: New interval (mins)
+        // Meta2: Rate of change relative to fast rate (x100)
+        ADAPTIVE_SAMPLING_INTERVAL = 133,
+
+        //
+        // Entries left out by the deadband filter, logged when the next one is stored (see Deadband)
+        // Meta1: Store (SensorStore)
+        // Meta2: Suppressed entries
+        DEADBAND_SUPPRESSED = 134,
+
+        //
+        // Deadbands set by remote control
+        // Meta1: Heartbeat (secs)
+        // Meta2: Fields with a deadband
+        RC_DEADBANDS_SET = 135,
+
+        //
+        // Partially filled files of a store merged (see DataStore::compact())
+        // Meta1: Files merged
+        // Meta2: Files created
+        DATA_STORE_COMPACTED = 136,
+
+        //
+        // Call home pulled forward on store backlog (see SleepScheduler)
+        // Meta1: Call homes pulled forward today
+        // Meta2: Secs it was pulled forward by
+        BACKLOG_CALL_HOME = 137,
+
+        //
+        // Call home phase set by remote control (see SleepScheduler::set_call_home_phase())
+        // Meta1: Previous phase (secs)
+        // Meta2: New phase (secs), -1 for MAC derived
+        RC_CALL_HOME_PHASE_SET = 138,
+
+        //
+        // Leaf sent its sensor data to the gateway over LoRa (see LoraRelay)
+        // Meta1: Entries relayed
+        // Meta2: 1 if all stores were relayed, 0 if leaf falls back to calling home
+        LORA_RELAY_SENT = 139,
+
+        //
+        // Gateway RX window ended (see LoraRelay)
+        // Meta1: Frames received
+        // Meta2: Entries stored
+        LORA_RELAY_RECEIVED = 140,
+
+        //
+        // Store files were written with another entry format and were migrated
+        // (see StoreRegistry::check_format())
+        // Meta1: Previous format version, 0 if none was written
+        // Meta2: Current format version
+        DATA_STORE_FORMAT_CHANGED = 141,
+
+        //
+        // Server requested resubmission of archived data (see Backfill)
+        // Meta1: Entries copied for resubmission
+        // Meta2: Stores with entries to resubmit (bit per StoreId)
+        BACKFILL_REQUESTED = 142,
+
+        //
+        // All backfilled entries have been submitted (see Backfill)
+        BACKFILL_COMPLETE = 143,
+
+        //
+        // Teros12 DDI string not captured, measured over SDI12 instead
+        // (FLAGS.TEROS12_DDI_CAPTURE)
+        // Meta1: Sdi12Sensor::ErrorCode
+        SOIL_MOISTURE_DDI_FAILED = 144,
+
+        //
+        // Device status on call home, instead of volatile client attributes
+        // (FLAGS.DELTA_CLIENT_ATTRIBUTES)
+        // Meta1: Uptime (secs)
+        // Meta2: Client attributes published, -1 if none changed
+        DEVICE_STATUS = 145,
+
+        //
+        // Call home phase ran out of budget, rest deferred to next call home
+        // (see CallHomeBudget)
+        // Meta1: CallHomeBudget::Phase
+        // Meta2: Secs since call home started
+        CALL_HOME_PHASE_DEFERRED = 146,
+
+        //
+        // Time and charge used by call home (FLAGS.CALL_HOME_BUDGET)
+        // Meta1: Secs
+        // Meta2: mAh x 100, estimated without battery gauge
+        CALL_HOME_BUDGET_USED = 147,
+
+        //
+        // Last call home was stuck past its deadline and restarted by the watchdog
+        // (see CallHomeBudget)
+        // Meta1: CallHomeBudget::Phase it was stuck in
+        // Meta2: Phases carried to this call home (bit per phase)
+        CALL_HOME_WATCHDOG = 148,
+
+        //
+        // TLS handshake done (see TlsClient)
+        // Meta1: Duration (ms)
+        // Meta2: 1 if cached session was resumed, 0 for a full handshake
+        TLS_HANDSHAKE = 149,
+
+        //
+        // Field offload mode started, SoftAP is up (see FieldOffload)
+        FIELD_OFFLOAD_STARTED = 150,
+
+        //
+        // Store downloaded in field offload mode
+        // Meta1: StoreId
+        // Meta2: Bytes sent, -1 if download was cut off
+        FIELD_OFFLOAD_DOWNLOAD = 151,
+
+        //
+        // Field offload download confirmed, its files marked as submitted
+        // Meta1: StoreId
+        // Meta2: Files
+        FIELD_OFFLOAD_CONFIRMED = 152,
+
+        //
+        // Call home connected (see Bearer)
+        // Meta1: Bearer::Type
+        // Meta2: Connect time (ms), retries of the modem included
+        BEARER_CONNECTED = 153,
+
+        //
+        // GSM woken up from slow clock sleep (see GSM::off())
+        // Meta1: 1 if modem responded, 0 if a cold start followed
+        // Meta2: Time to wake up (ms)
+        GSM_SLOW_CLOCK_WAKEUP = 154,
+
+        //
+        // Leaf waits for OTA image from gateway over LoRa (see LoraOta)
+        // Meta1: FW version
+        // Meta2: 1 if resumed, 0 if started
+        LORA_OTA_STARTED = 155,
+
+        //
+        // Leaf LoRa OTA session ended
+        // Meta1: Chunks received in session (incl. recovered with parity)
+        // Meta2: Chunks still missing
+        LORA_OTA_SESSION = 156,
+
+        //
+        // Gateway served a LoRa OTA request
+        // Meta1: Leaf id
+        // Meta2: Chunks (incl. parity) sent
+        LORA_OTA_SERVED = 157,
+
+        //
+        // Heavy work deferred for lack of energy, or run at its deadline anyway
+        // Meta1: Work (SleepScheduler::DeferrableWork)
+        // Meta2: 0 when deferral started, 1 when run at deadline
+        WORK_DEFERRED = 158,
+
+        //
+        // Backlog drain mode started or ended (see BacklogDrain)
+        // Meta1: Telemetry store files left
+        // Meta2: 1 when started, 0 when ended
+        BACKLOG_DRAIN = 159,
+
+        //
+        // Store files matched no entry layout of the store, it was cleared
+        // (see StoreRegistry::check_format())
+        // Meta1: StoreId
+        // Meta2: Previous format version
+        DATA_STORE_FORMAT_MISMATCH = 160,
+
         //
         // Temporary codes only for debugging
         // All 2XX codes
@@ -481,6 +798,7 @@ namespace Log
         //
         // Wake up events missed
         // Meta1: Reasons (WakeupReasons bitfield)
+        // Meta2: Intervals skipped
         //
         WAKEUP_EVENTS_MISSED = 202,
 
@@ -0,0 +1,71 @@
+#ifndef LORA_OTA_H
+#define LORA_OTA_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Firmware distribution over LoRa (FLAGS.LORA_OTA). Only the gateway downloads
+ * an OTA image over cellular. Leaves told to update (see OTA::handle_rc_data())
+ * get it from the gateway in the LoRa relay sessions of their call homes (see
+ * LoraRelay) instead.
+ *
+ * The gateway serves its running image, once it runs the version leaves ask
+ * for. A leaf requests the chunks it is missing in a window of
+ * LORA_OTA_REQUEST_WINDOW. The gateway broadcasts them, with an XOR parity
+ * chunk per LORA_OTA_FEC_GROUP so a single lost chunk of a group is recovered
+ * without asking again. Other leaves listening keep chunks they miss too.
+ *
+ * Chunks are written straight to the inactive OTA partition, erased when the
+ * image size is known. The received bitmap is kept in LORA_OTA_STATE_PATH over
+ * wake ups. A complete image is verified against fw_md5 and set as boot
+ * partition.
+ */
+namespace LoraOta
+{
+	/** Leaf asks for chunks, first = FIRST_INFO for image size */
+	struct Request
+	{
+		uint8_t md5[16];
+		uint16_t first;
+		/** Bit per chunk from first, set if missing */
+		uint8_t missing[LORA_OTA_REQUEST_WINDOW / 8];
+	} __attribute__((packed));
+
+	/** Gateway image, answer to a request for info */
+	struct Info
+	{
+		uint8_t md5[16];
+		uint32_t size;
+	} __attribute__((packed));
+
+	/** Chunk, followed by its data */
+	struct Chunk
+	{
+		/** First bytes of image MD5 */
+		uint8_t md5[4];
+		/** Chunk index, or parity group index if parity */
+		uint16_t index;
+		uint8_t parity;
+	} __attribute__((packed));
+
+	/** Request.first asking for Info */
+	const uint16_t FIRST_INFO = 0xFFFF;
+
+	// Leaf
+	RetResult start(int fw_version, const char *fw_md5);
+	bool is_pending();
+	bool build_request(Request *req);
+	void on_info(const Info *info);
+	void on_chunk(const Chunk *chunk, const uint8_t *data, int len);
+	RetResult end_session(bool *ready);
+
+	// Gateway
+	RetResult get_image(Info *info);
+	int read_chunk(uint16_t index, uint8_t *buff);
+	int read_parity(uint16_t group, uint8_t *buff);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LORA_RELAY_H
+#define LORA_RELAY_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Local LoRa relay (FLAGS.LORA_RELAY). Leaf nodes send their sensor stores
+ * over LoRa to a gateway node on call home instead of powering the modem. The
+ * gateway listens for them at the start of its own call home, keeps what it
+ * receives in RelayData and submits it with the TB gateway API, every leaf as
+ * its own device (see TbGatewayJsonBuilder).
+ * Leaves and gateway call home on the same grid (no call home phase). The radio
+ * is the FO sniffer's, switched to LoRa only while relaying.
+ *
+ * Frames are a FrameHeader followed by count store entries of one store. Every
+ * data frame is acked by the gateway and retried by the leaf, a leaf calls home
+ * itself when a frame is not acked.
+ *
+ * With FLAGS.LORA_OTA a leaf with an image pending (see LoraOta) sends a
+ * firmware request after its data, the gateway answers with image info or the
+ * requested chunks. Request, info and chunk frames are a FrameHeader followed
+ * by a LoraOta::Request, LoraOta::Info or LoraOta::Chunk and its data.
+ */
+namespace LoraRelay
+{
+	/** Types of frames */
+	enum FrameType
+	{
+		FRAME_DATA = 1,
+		FRAME_ACK,
+		FRAME_FW_REQUEST,
+		FRAME_FW_INFO,
+		FRAME_FW_CHUNK
+	};
+
+	/** Header of every frame */
+	struct FrameHeader
+	{
+		/** LORA_RELAY_FRAME_MAGIC */
+		uint8_t magic;
+
+		/** FrameType */
+		uint8_t type;
+
+		/** Leaf the frame is from/to */
+		uint32_t leaf_id;
+
+		/** Sequence number of data frame (echoed by ack) */
+		uint16_t seq;
+
+		/** Store of entries (SensorStore) */
+		uint8_t store;
+
+		/** Entries following the header */
+		uint8_t count;
+	} __attribute__((packed));
+
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		uint32_t last_direct_tstamp;
+		uint16_t seq;
+	};
+
+	bool is_leaf();
+	bool is_gateway();
+
+	uint32_t get_node_id();
+
+	bool relay_call_home();
+	RetResult receive_window();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
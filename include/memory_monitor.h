@@ -0,0 +1,42 @@
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+
+#include <inttypes.h>
+#include <ArduinoJson.h>
+#include "struct.h"
+
+/**
+ * Tracks memory use since boot: stack high water mark of each task and minimum
+ * free heap of each phase of a wake up. Submitted with client attributes
+ */
+namespace MemoryMonitor
+{
+	enum Phase
+	{
+		PHASE_BOOT,
+		PHASE_MEASURE,
+		PHASE_CALL_HOME,
+		PHASE_OTA,
+		PHASE_COUNT
+	};
+
+	enum Task
+	{
+		TASK_MAIN,
+		TASK_UPLOADER,
+		TASK_GSM_CONNECT,
+		TASK_OTA_WRITER,
+		TASK_FO_RX,
+		TASK_WIFI_SERIAL,
+		TASK_ACQUISITION,
+		TASK_COUNT
+	};
+
+	void sample(Phase phase);
+	void sample_task(Task task);
+
+	void add_attributes(JsonDocument &doc);
+	void print();
+}
+
+#endif
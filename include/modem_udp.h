@@ -0,0 +1,66 @@
+#ifndef MODEM_UDP_H
+#define MODEM_UDP_H
+
+#include "app_config.h"
+#include "const.h"
+#include <Udp.h>
+#include "gsm.h"
+
+/******************************************************************************
+ * Arduino UDP interface over a modem socket. TinyGSM only opens TCP sockets,
+ * so the socket is opened in UDP mode with AT commands and a TinyGsmClient on
+ * the same mux is used to send and receive data. No multiplexing of remote
+ * hosts, a single "connected" UDP socket is kept. Everything received since the
+ * last packet was sent is returned as one packet (enough for request/response
+ * protocols like CoAP).
+ ******************************************************************************/
+class ModemUdp : public UDP
+{
+public:
+    ModemUdp(TinyGsm *modem, uint8_t mux);
+    ~ModemUdp();
+
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    int beginPacket(const char *host, uint16_t port);
+    int endPacket();
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char* buffer, size_t len);
+    int read(char* buffer, size_t len);
+    int peek();
+    void flush();
+
+    IPAddress remoteIP();
+    uint16_t remotePort();
+
+private:
+    RetResult open(const char *host, uint16_t port);
+
+    TinyGsm *_modem = NULL;
+
+    /** Client on the same mux, used for data */
+    TinyGsmClient _client;
+
+    uint8_t _mux = 0;
+
+    /** Socket opened in UDP mode */
+    bool _open = false;
+
+    /** Remote host and port socket is open to */
+    char _host[URL_BUFFER_SIZE] = {0};
+    uint16_t _port = 0;
+
+    /** Packet being written */
+    uint8_t _tx_buff[COAP_MAX_MESSAGE_SIZE];
+    int _tx_len = 0;
+};
+
+#endif
@@ -1,32 +1,48 @@
 #ifndef MQTT_H
 #define MQTT_H
 
-#include "gsm.h"
-#include "Adafruit_MQTT.h"
-#include "Adafruit_MQTT_Client.h"
-#include "Adafruit_MQTT_FONA.h"
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include <Client.h>
+#include <PubSubClient.h>
 
+/******************************************************************************
+ * MQTT connection to TB over any Arduino Client (TinyGsmClient or WiFiClient).
+ * One connection is kept for a whole call home, telemetry and attributes are
+ * published on it and shared attributes are requested through it.
+ ******************************************************************************/
 class MQTT
 {
 public:
-    MQTT(Adafruit_FONA *fona, const char *broker_url, uint16_t port, const char *username, const char *pass);
-    ~MQTT();
+    MQTT(Client *client, const char *broker_url, uint16_t port, const char *username, const char *pass);
 
-    uint8_t connect();
-    uint8_t disconnect();
+    RetResult connect();
+    void disconnect();
     bool is_connected();
-    uint8_t publish(char *topic, char *msg);
+
+    RetResult publish(const char *topic, const uint8_t *msg, int msg_len);
+
+    RetResult request(const char *req_topic, const char *msg, const char *resp_topic,
+        char *resp_buff, int resp_buff_size);
 
 private:
-    uint8_t set_credentials(const char *broker_url, uint16_t port, const char *user_id, const char *username, const char *password);
-    Adafruit_MQTT_FONA _mqtt_client;
+    void on_message(char *topic, uint8_t *payload, unsigned int len);
+
+    PubSubClient _mqtt_client;
 
     // Broker credentials
     const char *_broker_url = NULL;
     const char *_username = NULL;
     const char *_password = NULL;
-    const char *_userid = NULL;
     uint16_t _port = 0;
+
+    /** Response of pending request() is written here */
+    char *_resp_buff = NULL;
+    int _resp_buff_size = 0;
+
+    /** Response to pending request() received */
+    bool _resp_received = false;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -10,6 +10,11 @@ namespace OTA
 {
 	RetResult handle_rc_data(JsonObject rc_json);
 	RetResult handle_first_boot();
+
+	bool is_validation_pending();
+	RetResult check_validation();
+	void on_unexpected_reset();
+	RetResult mark_valid();
 }
 
 #endif
\ No newline at end of file
@@ -1,11 +1,79 @@
 #ifndef POWER_CONTROL_H
 #define POWER_CONTROL_H
 
+#include <inttypes.h>
 #include "struct.h"
+#include "const.h"
 
+/**
+ * Power rails of the board, shared by the devices powered from them. Devices
+ * acquire their rail before use and release it when done. A rail is switched on
+ * by the first holder and off when the last one releases it, so code that runs
+ * several measurements in a row keeps it on by holding it for all of them (see
+ * read_sensors() in main). Acquiring waits only what is left of the device's
+ * settle time since the rail came on.
+ * Warm-up waited for a device is learned: devices report their first valid
+ * response after power on (ready()) and a percentile of those times is waited,
+ * with the fixed settle time as upper bound. A device polled before ready, eg.
+ * while probing a shorter warm-up, is retried with retry_warming_up().
+ * A device can be parked instead of released, keeping its rail on (also in
+ * deep sleep) until it is acquired again or the park expires. For sensors read
+ * on a tight schedule that are ready right away when kept powered.
+ */
 namespace PowerControl
 {
-    RetResult switch_12v(bool on);    
+    enum Rail
+    {
+        /** PIN_WATER_SENSORS_PWR: water quality/level sensors, SDI12 sensors */
+        RAIL_SENSORS,
+
+        RAIL_COUNT
+    };
+
+    enum Device
+    {
+        DEVICE_AQUATROLL,
+        DEVICE_WATER_LEVEL,
+        DEVICE_ATMOS41,
+        DEVICE_TEROS12,
+
+        /** Any sensor on the SDI12 bus (eg. discovery) */
+        DEVICE_SDI12_BUS,
+
+        DEVICE_COUNT
+    };
+
+    /** State kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        /** Timestamp park of each device expires, 0 if not parked */
+        uint32_t park_until[DEVICE_COUNT];
+
+        /** Recent times from power on to first valid response, ring per device */
+        uint16_t warmup_ms[DEVICE_COUNT][POWER_WARMUP_HISTORY_LEN];
+        uint8_t warmup_count[DEVICE_COUNT];
+        uint8_t warmup_next[DEVICE_COUNT];
+    };
+
+    RetResult init();
+
+    RetResult acquire(Device device, bool wait = true);
+    void wait_settled(Device device);
+    void release(Device device);
+    bool power_cycle(Device device);
+
+    bool is_on(Rail rail);
+
+    void ready(Device device);
+    bool retry_warming_up(Device device);
+    uint32_t get_warmup_ms(Device device);
+
+    void park(Device device, uint32_t until_tstamp);
+    bool is_parked(Device device);
+    void expire_parks(bool all = false);
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 }
 
-#endif
\ No newline at end of file
+#endif
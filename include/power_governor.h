@@ -0,0 +1,40 @@
+#ifndef POWER_GOVERNOR_H
+#define POWER_GOVERNOR_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "app_config.h"
+
+/**
+ * Scales the wake up schedule with the energy available. Battery level, net
+ * current from the battery gauge and solar current give a factor that stretches
+ * intervals when energy is short and compresses them when there is surplus.
+ */
+namespace PowerGovernor
+{
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		// Smoothed scale factor, 0 when not decided yet
+		float scale;
+
+		// Gauge charge and time of last balance measurement
+		float last_mah;
+		uint32_t last_mah_tstamp;
+
+		// Last measured net battery current, positive when charging
+		float net_ma;
+		bool net_valid;
+	};
+
+	float update();
+	float get_scale();
+	bool has_surplus(float min_ma);
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[]);
+	void print();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
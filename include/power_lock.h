@@ -0,0 +1,54 @@
+#ifndef POWER_LOCK_H
+#define POWER_LOCK_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "app_config.h"
+
+/**
+ * Dynamic frequency scaling (FLAGS.DYNAMIC_FREQ). The CPU runs at
+ * DFS_MIN_CPU_MHZ and work that needs more holds a lock: LOCK_CPU_MAX for CPU
+ * bursts (JSON build, compression, TLS handshake, OTA hashing), LOCK_APB_MAX
+ * around bus transactions (modem UART, I2C, SDI12, RMT) whose peripheral clocks
+ * must not change. Locks are counted, the frequency goes back down when the
+ * last holder releases it.
+ * With power management in the SDK (CONFIG_PM_ENABLE) these are esp_pm locks
+ * and the idle task light sleeps while none is held (needs tickless idle). The
+ * prebuilt Arduino SDK has no power management, there the frequency is switched
+ * with setCpuFrequencyMhz() and there is no automatic light sleep.
+ * Time and charge at max frequency are accounted by EnergyProfiler
+ * (STATE_CPU_MAX).
+ */
+namespace PowerLock
+{
+	enum Lock
+	{
+		/** CPU at DFS_MAX_CPU_MHZ */
+		LOCK_CPU_MAX,
+
+		/** APB at 80MHz, no light sleep */
+		LOCK_APB_MAX,
+
+		LOCK_COUNT
+	};
+
+	/** Holds a lock for the life of the object */
+	class Scoped
+	{
+	public:
+		Scoped(Lock lock);
+		~Scoped();
+
+	private:
+		Lock _lock;
+	};
+
+	RetResult init();
+
+	void acquire(Lock lock);
+	void release(Lock lock);
+
+	uint32_t get_cpu_mhz();
+}
+
+#endif
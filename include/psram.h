@@ -0,0 +1,32 @@
+#ifndef PSRAM_H
+#define PSRAM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+
+/**
+ * Staging buffers in SPI RAM on boards that have it (BOARD_HAS_PSRAM in the board
+ * header, FLAGS.PSRAM_STAGING). On boot the scratch arena is moved to a
+ * SCRATCH_PSRAM_ARENA_SIZE region and store write buffers grow to
+ * DATA_STORE_PSRAM_BUFFER_ELEMENTS, OTA downloads in OTA_PSRAM_CHUNK_LEN chunks
+ * and the gzip compressor is allocated there (it does not fit internal heap,
+ * FLAGS.GZIP_TELEMETRY needs PSRAM).
+ * Without PSRAM (or if it fails its test on boot) nothing is moved and the
+ * internal sizes are used.
+ * PSRAM is powered down in deep sleep, nothing kept there survives it.
+ */
+namespace Psram
+{
+	void init();
+
+	bool available();
+
+	void* alloc(size_t size);
+
+	size_t get_free();
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef RELAY_DATA_H
+#define RELAY_DATA_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include "data_store.h"
+
+namespace RelayData
+{
+    /**
+     * Sensor data entry of another device, submitted by this node with the TB
+     * gateway API (see TbGatewayJsonBuilder), eg. of a leaf node received over
+     * LoRa (see LoraRelay). Data is the device's store entry as is, submitted with
+     * the TbJsonSchema of its store under the device's gateway API name.
+     * NOTE: MUST be aligned to 4 byte boundary to avoid padding. If not, CRC32 calculations
+     * may fail
+     */
+    struct Entry
+    {
+        // Device id, eg. leaf id (see LoraRelay::get_node_id())
+        uint32_t leaf_id;
+
+        // Source store of leaf (SensorStore)
+        uint8_t store;
+
+        // Bytes of data used
+        uint8_t size;
+
+        // RSSI of frame the entry came in (dBm)
+        int16_t rssi;
+
+        uint8_t data[RELAY_DATA_MAX_ENTRY_SIZE];
+    } __attribute__((packed));
+
+    RetResult add(Entry *data);
+    DataStore<Entry>* get_store();
+
+    void get_device_name(uint32_t id, char *buff, int buff_size);
+
+    void print(const Entry *data);
+} // namespace RelayData
+
+#endif
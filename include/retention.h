@@ -0,0 +1,33 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stddef.h>
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "tb_json_schema.h"
+#include "rollup_data.h"
+
+/**
+ * Retention of sensor data deleted by store cleanup (FLAGS.ROLLUP_EVICTED_DATA).
+ * Store cleanup deletes the oldest files when a store is full. Before a file is
+ * deleted its entries are rolled up into ROLLUP_PERIOD_SECS mean/min/max/count
+ * entries (RollupData) by entry timestamp, so the long term trend is kept after
+ * the raw data is gone. Set as the DataStore eviction handler of sensor stores.
+ */
+namespace Retention
+{
+	void rollup_file(SensorStore store, const TbJsonSchema *schema, int entry_size, const char *path);
+
+	/** Eviction handler of a sensor data store with a TbJsonSchema */
+	template <typename TStruct, SensorStore TStore>
+	void on_evict(const char *path)
+	{
+		static_assert(sizeof(TStruct) <= ROLLUP_MAX_ENTRY_SIZE, "Entry too large to roll up");
+		static_assert(offsetof(TStruct, timestamp) == 0, "Entry must start with its timestamp");
+
+		rollup_file(TStore, &TbJsonSchemaOf<TStruct>::SCHEMA, sizeof(TStruct), path);
+	}
+}
+
+#endif
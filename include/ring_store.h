@@ -0,0 +1,133 @@
+#ifndef RING_STORE_H
+#define RING_STORE_H
+
+#include <inttypes.h>
+#include "esp_partition.h"
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include "data_store.h"
+
+template <typename TStruct>
+class RingStoreReader;
+
+template <typename TStruct>
+class RingStore
+{
+public:
+    //
+    // Structs
+    //
+
+    /** A single entry in the store. Same layout as DataStore entries */
+    typedef typename DataStore<TStruct>::Entry Entry;
+
+    /** Reader type used to iterate store (see CallHome::submit_stored_telemetry) */
+    typedef RingStoreReader<TStruct> Reader;
+
+    /** Header written at the start of every sector */
+    struct SectorHeader
+    {
+        /** RING_STORE_SECTOR_MAGIC when sector is in use, erased (0xFF..) otherwise */
+        uint32_t magic;
+
+        /** Sequence number, incremented for every new sector. Highest is the head */
+        uint32_t seq;
+
+        /** CRC32 of magic and seq */
+        uint32_t crc32;
+
+        /** Bit per block, cleared (without erasing) once block has been submitted */
+        uint32_t pending_blocks;
+    }__attribute__((packed));
+
+    RingStore(const char *partition_label, int first_sector, int sector_count, int max_entries_per_file);
+
+    RetResult init();
+
+    RetResult add(TStruct *data);
+
+    RetResult commit();
+
+    RetResult clear_buffer();
+
+    RetResult clear_all();
+
+    unsigned int get_buffer_element_count() const;
+
+    const Entry* get_buffer_element(unsigned int index) const;
+
+    RetResult cleanup(bool force);
+
+    uint32_t get_acked_seq();
+
+    RetResult set_acked_seq(uint32_t seq);
+
+private:
+    friend class RingStoreReader<TStruct>;
+
+	// Default constructor private
+	RingStore();
+
+    //
+    // Methods
+    //
+
+    RetResult read_header(int sector, SectorHeader *header) const;
+
+    bool header_valid(const SectorHeader *header) const;
+
+    RetResult start_new_sector();
+
+    RetResult find_write_slot();
+
+    RetResult pad_to_block_end();
+
+    RetResult mark_block_submitted(int sector, int block);
+
+    uint32_t sector_addr(int sector) const;
+
+    uint32_t slot_addr(int sector, int slot) const;
+
+    int get_block_entries(int block, int written_slots) const;
+
+    //
+    // Vars
+    //
+
+    /** Label of data partition where the store lives */
+    const char *_partition_label = NULL;
+
+    /** Partition handle, found on init */
+    const esp_partition_t *_partition = NULL;
+
+    /** First sector in partition used by this store */
+    int _first_sector = 0;
+
+    /** Number of sectors used by this store (ring size) */
+    int _sector_count = 0;
+
+    /** Entries per block. A block is the equivalent of a DataStore file (one request) */
+    int _entries_per_block = 0;
+
+    /** Blocks that fit in a sector */
+    int _blocks_per_sector = 0;
+
+    /** Index of sector currently written to, -1 when store is empty */
+    int _head_sector = -1;
+
+    /** Sequence number of head sector */
+    uint32_t _head_seq = 0;
+
+    /** Next free entry slot in head sector */
+    int _write_slot = 0;
+
+    /** Data buffer. Data is stored temporarily here until buffer is full or when
+     * commit() is called in which case it is saved into flash memory and emptied */
+    Entry _buffer[DATA_STORE_BUFFER_ELEMENTS];
+
+    /** Count of elements in buffer */
+    uint32_t _buffer_element_count = 0;
+};
+
+#endif
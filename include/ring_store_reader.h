@@ -0,0 +1,101 @@
+/******************************************************************************
+ * RingStoreReader template
+ * Iterates data stored by a RingStore, oldest first. Same interface as
+ * DataStoreReader, a sector block maps to a file so callers written for
+ * DataStoreReader (eg. CallHome::submit_stored_telemetry) work with both.
+ ******************************************************************************/
+
+#ifndef RING_STORE_READER_H
+#define RING_STORE_READER_H
+
+#include "ring_store.h"
+
+template <class TStruct>
+class RingStoreReader
+{
+public:
+	RingStoreReader(RingStore<TStruct> *store);
+
+    bool next_file();
+    TStruct* next_entry();
+
+    RetResult begin();
+    void reset();
+
+    bool entry_crc_valid();
+    uint32_t entry_seq();
+    bool entry_acked();
+    RetResult delete_file();
+
+    RetResult ack_entries(int count);
+
+    RetResult queue_delete_file();
+
+    RetResult commit_deletes(int count);
+
+    void discard_deletes(int count);
+
+    int get_queued_deletes() const;
+
+private:
+	// Default constructor private
+    RingStoreReader();
+
+    RetResult reset_data_state();
+
+    int fill_read_buffer();
+
+    static bool is_padding(const typename RingStore<TStruct>::Entry *entry);
+
+    /** Store to traverse */
+    RingStore<TStruct> *_store = NULL;
+
+    /** Number of sectors visited so far, starting from the oldest one */
+    int _sectors_visited = 0;
+
+    /** Current sector, -1 if none */
+    int _cur_sector = -1;
+
+    /** Current block in sector, -1 if none */
+    int _cur_block = -1;
+
+    /** Pending blocks bitfield of current sector */
+    uint32_t _cur_pending_blocks = 0;
+
+    /** Written entry slots of current sector */
+    int _cur_sector_slots = 0;
+
+    /** Current block has been read into buffer */
+    bool _block_loaded = false;
+
+    /** Entries of current block */
+    typename RingStore<TStruct>::Entry _read_buff[DATA_STORE_READER_BUFF_ENTRIES];
+
+    /** Number of entries in read buffer */
+    int _read_buff_count = 0;
+
+    /** Index of next entry to return from read buffer */
+    int _read_buff_index = 0;
+
+    /** Slot in block of every read buffer entry */
+    uint8_t _read_buff_slot[DATA_STORE_READER_BUFF_ENTRIES];
+
+    /** Entries of read buffer already acknowledged */
+    int _read_buff_acked = 0;
+
+    /** CRC check results of read buffer entries (bit per entry) */
+    uint32_t _read_buff_crc_valid = 0;
+
+    /** Current entry (points into read buffer) */
+    typename RingStore<TStruct>::Entry *_cur_entry = NULL;
+
+    /** Sector and block of blocks to be marked submitted once the request they
+     * were packed into succeeds */
+    int16_t _delete_queue_sectors[TELEMETRY_MAX_FILES_PER_REQ];
+    int8_t _delete_queue_blocks[TELEMETRY_MAX_FILES_PER_REQ];
+
+    /** Number of queued blocks */
+    int _delete_queue_count = 0;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ROLLUP_DATA_H
+#define ROLLUP_DATA_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+#include "data_store.h"
+
+namespace RollupData
+{
+    /**
+     * Summary of a sensor store's entries of a ROLLUP_PERIOD_SECS period, made
+     * from files deleted by store cleanup (see Retention). Fields are in the
+     * order of the source store schema (TbJsonSchemaOf), NAN when no entry of the
+     * period had a value for it.
+     * NOTE: MUST be aligned to 4 byte boundary to avoid padding. If not, CRC32 calculations
+     * may fail
+     */
+    struct Entry
+    {
+        // Start of period (UTC)
+        uint32_t timestamp;
+
+        // Source store (SensorStore)
+        uint8_t store;
+
+        // Schema fields in rollup
+        uint8_t field_count;
+
+        // Entries rolled up
+        uint16_t count;
+
+        float mean[ROLLUP_MAX_FIELDS];
+        float min[ROLLUP_MAX_FIELDS];
+        float max[ROLLUP_MAX_FIELDS];
+    } __attribute__((packed));
+
+    RetResult add(Entry *data);
+    DataStore<Entry>* get_store();
+
+    void print(const Entry *data);
+} // namespace RollupData
+
+#endif
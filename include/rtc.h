@@ -5,6 +5,16 @@
 
 namespace RTC
 {
+    /** State kept in RTC memory over deep sleep (see DeepSleep) */
+    struct RetainedState
+    {
+        bool sync_pending;
+        uint32_t cal_ext_tstamp;
+        uint64_t cal_ticks;
+        float slow_clock_period;
+        bool alarm_set;
+    };
+
     RetResult init();
 
     RetResult sync(bool enable_safety = true);
@@ -15,12 +25,30 @@ namespace RTC
 
     uint32_t get_last_sync_tick();
 
+    void set_sync_pending();
+    bool is_sync_pending();
+
     void print_time();
     void print_temp();
 
     bool tstamp_valid(uint32_t tstamp);
     int detect_drift();
 
+    uint32_t correct_timestamp(uint32_t tstamp);
+    float get_predicted_error(uint32_t tstamp);
+    bool is_sync_needed();
+
+    bool is_slow_clock_calibrated();
+    uint64_t get_sleep_us(uint32_t secs);
+
+    bool wakeup_alarm_available();
+    RetResult set_wakeup_alarm(uint32_t tstamp);
+    void enable_alarm_wakeup();
+    bool clear_wakeup_alarm();
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
+
     // TODO: Temp public
     RetResult sync_gsm_rtc_from_ntp();
     RetResult sync_time_from_gsm_rtc();
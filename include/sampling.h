@@ -0,0 +1,82 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <inttypes.h>
+#include "struct.h"
+#include "const.h"
+
+/**
+ * Shared sampling engine. Reads samples from a source until the running
+ * median/MAD says the value converged or the plan's limits are reached, then
+ * averages the samples within the outlier bounds
+ */
+namespace Sampling
+{
+	/** Reads a single sample, returns false when the sample is invalid */
+	typedef bool (*ReadFunc)(void *ctx, float *out);
+
+	/** How to sample a source */
+	struct Plan
+	{
+		// Max samples to read
+		uint16_t max_samples;
+
+		// Min valid samples within outlier bounds, sampling never stops earlier
+		uint16_t min_valid;
+
+		// Invalid samples (rejected by the source) before aborting, 0 for no limit
+		uint16_t max_invalid;
+
+		// Delay between samples
+		uint16_t delay_ms;
+
+		// Max duration of sampling, 0 for no limit
+		uint32_t timeout_ms;
+
+		// Converged when the std error of the median is below this, in sample units.
+		// 0 never converges early
+		float tolerance;
+	};
+
+	enum Status
+	{
+		STATUS_OK,
+		STATUS_TOO_MANY_INVALID,
+		STATUS_TIMEOUT,
+		STATUS_HIGH_FLUCTUATION
+	};
+
+	/** Value and quality metrics of a sampling run */
+	struct Result
+	{
+		Status status;
+
+		// Mean of samples within outlier bounds
+		float value;
+
+		// Median and median absolute deviation of all valid samples
+		float median;
+		float mad;
+
+		// Valid samples read
+		uint16_t samples;
+
+		// Samples rejected by the source
+		uint16_t invalid;
+
+		// Valid samples outside outlier bounds
+		uint16_t outliers;
+
+		// Stopped before max_samples because value converged
+		bool converged;
+
+		// Duration of sampling
+		uint32_t elapsed_ms;
+	};
+
+	RetResult run(const Plan *plan, ReadFunc read, void *ctx, Result *result);
+
+	void print(const Result *result);
+}
+
+#endif
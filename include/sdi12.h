@@ -2,8 +2,14 @@
 #define SDI12_H
 
 #include <Arduino.h>
-#include <HardwareSerial.h>
+#include <driver/uart.h>
+#include <driver/gpio.h>
 
+/**
+ * SDI12 transceiver on the ESP-IDF UART driver. Driver is installed once on
+ * construct, direction is switched by flipping the data pin in place and
+ * responses are framed by the UART pattern detect interrupt on '\n'
+ */
 class Sdi12
 {
 public:
@@ -13,33 +19,54 @@ public:
         STATE_TX
     };
 
+    // Result of parse_data()
+    enum ParseResult
+    {
+        PARSE_OK,
+        PARSE_INVALID,
+        PARSE_CRC_FAIL
+    };
+
     Sdi12(int uart_num, gpio_num_t data_pin);
+    ~Sdi12();
 
     size_t write_command(char *cmd);
 
     int available(void);
     int read();
-    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+    size_t read_response(char *buffer, size_t length);
+    size_t read_ddi(char *buffer, size_t length, unsigned long timeout_ms);
+    void flush();
 
     static bool check_crc(const char *buff);
+    static ParseResult parse_data(const char *buff, char address, float *values, uint8_t max_vals, uint8_t *count_out);
+    static ParseResult parse_ddi(const char *buff, float *values, uint8_t max_vals, uint8_t *count_out);
+
+    gpio_num_t get_data_pin();
+    void set_timeout(unsigned long timeout_ms);
 private:
     /** Default constructor privade, useΟr must initialize serial on construct */
     Sdi12();
 
     /** UART number to use */
-    int _uart_num = 0;
+    uart_port_t _uart_num = UART_NUM_0;
 
     /** Data pin for TX/RX */
     gpio_num_t _data_pin;
 
-    /** HW serial instance, must be initiated and provided by externally */
-    HardwareSerial _serial;
+    /** UART driver event queue, pattern detect events mark end of responses */
+    QueueHandle_t _events = NULL;
 
     /** Current state */
     State _state;
 
+    /** Response timeout */
+    unsigned long _timeout_ms;
+
     void switch_to_tx();
     void switch_to_rx();
+    void send_break();
+    void set_ddi_framing(bool ddi);
 
     //
     // Constants
@@ -47,7 +74,23 @@ private:
     /** SDI12 standard baud rade */
     const int BAUD_RATE = 1200;
 
-    const int UART_TIMEOUT_MS = 3000;
+    /** Max time to wait for a complete response */
+    const int RESPONSE_TIMEOUT_MS = 1000;
+
+    /** Break (spacing), at least 12ms by the standard */
+    const int BREAK_MS = 13;
+
+    /** Marking after break, at least 8.33ms by the standard */
+    const int MARKING_MS = 9;
+
+    /** Driver RX buffer, must be larger than the UART FIFO */
+    const int RX_BUFF_SIZE = 256;
+
+    /** Driver event queue length */
+    const int EVENT_QUEUE_SIZE = 8;
+
+    /** Silence after received DDI bytes that ends the DDI string */
+    const int DDI_IDLE_MS = 30;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,60 @@
+#ifndef SDI12_BUS_H
+#define SDI12_BUS_H
+#include "sdi12_sensor.h"
+#include "const.h"
+#include "common.h"
+
+/**
+ * Measures sensors with different addresses on the same SDI12 bus concurrently.
+ * All measurements are started with aCC!, then the node sleeps once for the
+ * longest wait and data is collected from each sensor
+ */
+class Sdi12Bus
+{
+public:
+	// A measurement request for one sensor
+	struct Request
+	{
+		// Sensor address
+		char address;
+		// Receives measured values
+		float *values;
+		// Size of values
+		uint8_t max_values;
+		// Number of values the sensor said it will return
+		uint8_t expected_values;
+		// Number of values received
+		uint8_t count;
+		// Millis the measurement is ready
+		uint32_t t_ready_ms;
+		// RET_OK if all expected values were received
+		RetResult result;
+	};
+
+	Sdi12Bus(gpio_num_t data_pin, gpio_num_t power_pin);
+
+	RetResult add(char address, float *values, uint8_t max_values);
+	RetResult measure();
+
+	int get_request_count();
+	const Request* get_request(int index);
+private:
+    /** Default constructor is private, user must provide pins */
+	Sdi12Bus();
+
+	/** Sensor used for comms, its address is switched per request */
+	Sdi12Sensor _sensor;
+
+	/** Sensors power pin, held while sleeping */
+	gpio_num_t _power_pin;
+
+	/** Requests added */
+	Request _requests[SDI12_BUS_MAX_REQUESTS];
+
+	/** Number of requests added */
+	int _request_count = 0;
+
+	RetResult collect(Request *request);
+};
+
+#endif
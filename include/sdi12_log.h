@@ -5,6 +5,12 @@
 #include "struct.h"
 #include "data_store.h"
 
+/**
+ * Raw SDI12 comms with FLAGS.LOG_RAW_SDI12_COMMS. Commands and responses go to a
+ * RAM ring of variable length lines, the transcript of the current measurement.
+ * It is persisted to the store, one entry per line and a single commit, only
+ * when the measurement fails or the server asked for it (see request_persist())
+ */
 namespace SDI12Log
 {
 	struct Entry
@@ -14,11 +20,17 @@ namespace SDI12Log
 		char response[64];
 	};
 
-	RetResult add(char *data);
+	void record(const char *line);
+
+	void begin_measurement();
+	RetResult end_measurement(bool failed);
+
+	void request_persist(int measurements);
+	RetResult persist();
 
     DataStore<Entry>* get_store();
 
 	void print(const Entry *data);
 }
 
-#endif
\ No newline at end of file
+#endif
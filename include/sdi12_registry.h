@@ -0,0 +1,54 @@
+#ifndef SDI12_REGISTRY_H
+#define SDI12_REGISTRY_H
+
+#include "struct.h"
+#include "const.h"
+
+/******************************************************************************
+ * Sensors discovered on the SDI12 bus and their models, persisted in NVS.
+ * Lets several sensors share the bus, each at its own address
+ *****************************************************************************/
+namespace Sdi12Registry
+{
+    // Known sensor models, matched by aI! vendor and model fields
+    enum Model
+    {
+        MODEL_UNKNOWN = 0,
+        MODEL_AQUATROLL400 = 1,
+        MODEL_AQUATROLL500 = 2,
+        MODEL_AQUATROLL600 = 3,
+        MODEL_ATMOS41 = 4,
+        MODEL_TEROS12 = 5
+    };
+
+    // A discovered sensor
+    struct Sensor
+    {
+        // Bus address
+        char address;
+        // Model (Model)
+        uint8_t model;
+        // Identification (aI! response without address)
+        char id[SDI12_ID_MAX_LEN + 1];
+    }__attribute__((packed));
+
+    // Registry stored in NVS
+    struct Data
+    {
+        uint32_t crc32;
+        uint8_t count;
+        Sensor sensors[SDI12_REGISTRY_MAX_SENSORS];
+    }__attribute__((packed));
+
+    RetResult init();
+    RetResult discover();
+
+    int get_count();
+    const Sensor* get(int index);
+    const Sensor* find(Model model);
+    char get_address(Model model);
+
+    void print();
+}
+
+#endif
@@ -21,7 +21,20 @@ public:
     size_t write_command(char *cmd);
 
 	RetResult measure(uint16_t *secs_to_wait, uint8_t *measurement_vals);
+	RetResult measure_concurrent(uint16_t *secs_to_wait, uint8_t *measurement_vals);
 	RetResult read_measurement_data(uint8_t batch, float *o1, float *o2, float *o3);
+	RetResult read_values(uint8_t batch, float *out, uint8_t max_vals, uint8_t *count_out);
+	RetResult read_continuous(uint8_t index, float *out, uint8_t max_vals, uint8_t *count_out);
+	RetResult read_ddi(float *out, uint8_t max_vals, uint8_t *count_out, unsigned long timeout_ms);
+	bool wait_measurement(uint16_t secs_to_wait, gpio_num_t power_pin, bool service_request_wakeup = true);
+
+	RetResult acknowledge();
+	RetResult query_address(char *address_out);
+	RetResult identify(char *id_out, size_t size);
+	void set_timeout(unsigned long timeout_ms);
+
+	void set_address(char address);
+	char get_address();
 
     bool check_crc();
 
@@ -38,6 +51,15 @@ private:
 	void set_last_error(ErrorCode error);
 	ErrorCode _last_error = ERROR_NONE;
 
+	RetResult start_measurement(const char *cmd, const char *parse_format, uint16_t *secs_to_wait, uint8_t *measurement_vals);
+	RetResult request_values(const char *cmd_name, uint8_t index, float *out, uint8_t max_vals, uint8_t *count_out);
+
+    /** Sensor address used in commands */
+	char _address = '0';
+
+    /** Time last command was written, traced until its response (see Trace) */
+    int64_t _cmd_start_us = 0;
+
     /** Received data buffer */
 	char _buff[SDI12_RECV_BUFF_SIZE] = "";
 };
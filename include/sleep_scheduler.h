@@ -1,6 +1,7 @@
 #ifndef SLEEP_H
 #define SLEEP_H
 
+#include <stddef.h>
 #include "struct.h"
 
 namespace SleepScheduler
@@ -30,15 +31,144 @@ namespace SleepScheduler
         int wakeup_int;
     }__attribute__((packed));
 
+    // Handler of an ad-hoc task, run by run_tasks() when fired
+    typedef void (*TaskHandler)();
+
+    // First id for ad-hoc tasks. Lower ids are WakeupReason bits
+    const uint16_t TASK_ID_CUSTOM = 0x100;
+
+    // Max tasks in the deadline queue
+    const int MAX_TASKS = 16;
+
+    // A task in the deadline queue
+    struct Deadline
+    {
+        // WakeupReason bit, or TASK_ID_CUSTOM and up for ad-hoc tasks
+        uint16_t id;
+        // Fired on last wake up
+        bool fired;
+        // Due time (timestamp, sec)
+        uint32_t due;
+        // Repeat interval (sec) counted from due time, 0 for one-shot tasks
+        int interval_secs;
+        // How late (sec) the task may run to share a wake up with other tasks,
+        // 0 for strict tasks. Capped by SLEEP_COALESCE_WINDOW_SEC
+        uint16_t tolerance_secs;
+        // Run by run_tasks() when fired. NULL for wake up reasons (handled in loop())
+        TaskHandler handler;
+    };
+
+    // Work a wake up does before its tasks, each tier adds to the one before
+    // (see get_wake_tier())
+    enum WakeTier
+    {
+        // FO sniff only: timer check, RF RX and buffer append
+        TIER_FO,
+        // Sensors: time synced and checked against the external RTC, self test
+        TIER_SENSOR,
+        // Call home: everything
+        TIER_CALL_HOME
+    };
+
+    // Heavy work run only with energy to spare (see may_run())
+    enum DeferrableWork
+    {
+        WORK_OTA,
+        WORK_BACKLOG,
+        WORK_COMPACTION,
+        WORK_COUNT
+    };
+
+    // State kept in RTC memory over deep sleep (see DeepSleep)
+    struct RetainedState
+    {
+        uint32_t t_last_sleep;
+        int last_wakeup_reasons;
+        int sleep_secs;
+        uint32_t planned_due;
+        int saved_wakeups;
+        int deadline_count;
+        Deadline deadlines[MAX_TASKS];
+        uint32_t pulled_call_home_due;
+        uint32_t pulled_call_home_grid_due;
+        uint16_t pulled_call_home_day;
+        uint8_t pulled_call_homes;
+        uint32_t deferred_since[WORK_COUNT];
+    };
+
+    // Energy model of a simulated device (see simulate)
+    struct SimEnergyModel
+    {
+        // Current while sleeping (uA)
+        float sleep_ua;
+        // Current while awake, modem off (mA)
+        float awake_ma;
+        // Extra current while the modem is on (mA)
+        float modem_ma;
+        // Awake seconds of every wake up (boot, logs, sleep), on top of the tasks
+        int wake_secs;
+        // Awake seconds with the modem on for a call home
+        int call_home_secs;
+        // Awake seconds reading sensors (water, weather, soil moisture)
+        int sensors_secs;
+        // Awake seconds waiting for and receiving an FO packet
+        int fo_secs;
+        // Sniff FO packets
+        bool fo_enabled;
+        // Battery capacity (mAh), starts full
+        float battery_mah;
+        // Average solar charge (mAh/day), spread over the day
+        float solar_mah_per_day;
+        // Slow clock error (ppm) of an uncalibrated RTC, early wake ups are corrected
+        float clock_error_ppm;
+    };
+
+    // Output of a simulation
+    struct SimResult
+    {
+        uint32_t wakeups;
+        uint32_t modem_sessions;
+        uint32_t sensor_reads;
+        uint32_t fo_sniffs;
+        // Wake ups saved by coalescing
+        uint32_t coalesced;
+        // Events handled late, right after the previous wake up
+        uint32_t missed;
+        // Sleeps extended by sleep correction
+        uint32_t corrections;
+        uint32_t awake_secs;
+        uint32_t modem_secs;
+        uint32_t low_mode_secs;
+        uint32_t sleep_charge_secs;
+        float mah;
+        float min_battery_pct;
+    };
+
     RetResult sleep_to_next();
+    RetResult resume();
+
+    RetResult add_task(uint16_t id, uint32_t due, int interval_secs, TaskHandler handler = NULL, uint16_t tolerance_secs = 0);
+    void remove_task(uint16_t id);
+    const Deadline* get_next_deadline();
+    void run_tasks();
+    bool may_run(DeferrableWork work);
 
-    RetResult calc_next_wakeup(uint32_t t_now, const WakeupScheduleEntry schedule[], int *seconds_left, int *event_reasons);
+    bool has_energy_surplus();
+
+    int get_call_home_phase();
+    RetResult set_call_home_phase(int phase_secs);
+
+    void save_state(RetainedState *state);
+    void restore_state(const RetainedState *state);
 
     bool wakeup_reason_is(WakeupReason reason);
+    WakeTier get_wake_tier();
     bool schedule_valid(const SleepScheduler::WakeupScheduleEntry schedule[]);
     void print_schedule(SleepScheduler::WakeupScheduleEntry schedule[]);
     void print_wakeup_reasons(int reasons);
-    int check_missed_reasons(const WakeupScheduleEntry schedule[], uint32_t t_since, uint32_t awake_sec);
+
+    RetResult simulate(const WakeupScheduleEntry schedule[], const SimEnergyModel *model, int days, SimResult *result_out);
+    void print_sim_result(const SimResult *result, int days);
 }
 
 #endif
\ No newline at end of file
@@ -10,6 +10,7 @@ namespace SolarMonitor
 {
     RetResult init();
     RetResult log();
+    RetResult read_current_ma(float *ma);
     RetResult print();
 }
 
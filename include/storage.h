@@ -0,0 +1,33 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+/******************************************************************************
+ * Storage backend
+ * Filesystem used by Flash and the data stores. Selected at build time with
+ * -D STORAGE_BACKEND_LITTLEFS=1 (see platformio.ini), SPIFFS is used otherwise.
+ *****************************************************************************/
+#if STORAGE_BACKEND_LITTLEFS
+	#include <LITTLEFS.h>
+
+	/** FS object all file operations go through */
+	#define STORAGE_FS LITTLEFS
+
+	/** VFS mount point */
+	#define STORAGE_BASE_PATH "/littlefs"
+
+	/** Backend has real directories. Dirs must be created before files are added */
+	#define STORAGE_HAS_DIRS true
+#else
+	#include <SPIFFS.h>
+
+	/** FS object all file operations go through */
+	#define STORAGE_FS SPIFFS
+
+	/** VFS mount point */
+	#define STORAGE_BASE_PATH "/spiffs"
+
+	/** Dirs are emulated with path prefixes */
+	#define STORAGE_HAS_DIRS false
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef STORE_REGISTRY_H
+#define STORE_REGISTRY_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "data_store.h"
+
+/**
+ * Every DataStore of the device, described once. Cleanup, compaction, format
+ * check, space accounting and telemetry upload (see CallHome::handle_telemetry)
+ * iterate it instead of naming each store, so a new store only has to be added
+ * here (and to StoreId).
+ */
+namespace StoreRegistry
+{
+	/** Summary of a store from its index (see print_stats()) */
+	struct StoreStats
+	{
+		int file_count;
+		int entry_count;
+
+		/** Entries all files would hold if full */
+		int capacity;
+
+		/** Timestamp of oldest file, 0 if none */
+		uint32_t oldest_tstamp;
+	};
+
+	/** Type-erased operations of a DataStore */
+	struct StoreOps
+	{
+		const char* (*get_dir_path)();
+		RetResult (*cleanup)(bool force);
+		int (*compact)(int max_sources);
+		RetResult (*clear_all)();
+
+		/** Files and entries in flash, false if store index could not be built */
+		bool (*get_usage)(int *file_count, int *entry_count);
+
+		/** Clean up archive twin (see DataStore::remove_file()) */
+		RetResult (*prune_archive)(bool force);
+
+		/** Copy archived entries of a time range to the backfill twin, -1 on error */
+		int (*stage_backfill)(uint32_t from, uint32_t to);
+
+		/** Backfill twin has entries left to submit */
+		bool (*backfill_pending)();
+
+		/** Move write buffer to PSRAM (see Psram) */
+		RetResult (*use_psram_buffer)();
+
+		/** Remove a file as submitted (see DataStore::remove_file()) */
+		RetResult (*remove_file)(const char *path, int size);
+
+		/** Summary from store index, false if index could not be built */
+		bool (*get_stats)(StoreStats *stats);
+
+		/** Rewrite files of older entry layouts, -1 if a file matches none (see DataStore::migrate()) */
+		int (*migrate)(const int *old_data_sizes, int count, DataStoreUpgrader upgrade);
+	};
+
+	struct StoreDescriptor
+	{
+		StoreId id;
+
+		/** Name to print */
+		const char *name;
+
+		/** Bytes of a stored entry, header included */
+		int entry_size;
+
+		/** Submitted by CallHome::handle_telemetry(). Logs are submitted on their own */
+		bool telemetry;
+
+		/** TELEMETRY_PRIORITY_*, higher priorities are submitted first in every round */
+		uint8_t priority;
+
+		/** Share (%) of TELEMETRY_TIME_BUDGET_MS after which store is deferred to next call home */
+		uint8_t budget_percent;
+
+		/** Max bytes in flash, oldest files are deleted on cleanup when over it. 0 for none */
+		uint32_t quota_bytes;
+
+		const StoreOps *ops;
+	};
+
+	const StoreDescriptor* get(StoreId id);
+
+	uint32_t get_stored_bytes(const StoreDescriptor *store);
+	uint32_t get_total_stored_bytes();
+	int get_telemetry_file_count();
+
+	void check_format();
+	void cleanup_all();
+	void compact_all();
+	void clear_all();
+	bool backlog_high();
+	void prune_archives();
+	void use_psram_buffers();
+	void print_stats();
+	int build_fs_stats_payload(char *buff, int buff_size, uint32_t tstamp);
+}
+
+#endif
@@ -98,6 +98,15 @@ enum FineOffsetSource
     FO_SOURCE_UART
 };
 
+/**
+ * LoRa relay roles (see LoraRelay)
+ */
+enum LoraRelayRole
+{
+    LORA_RELAY_ROLE_LEAF = 1,
+    LORA_RELAY_ROLE_GATEWAY
+};
+
 /**
  * FineOffset UART response field
  */
@@ -173,6 +182,18 @@ struct FoDecodedPacket
     uint8_t checksum; 	// Checksum
 } __attribute__((packed));
 
+/** Boot phases timed in BOOT_TIMING logs */
+enum BootPhase
+{
+    BOOT_PHASE_INIT = 1,            // Peripherals, flash and log init
+    BOOT_PHASE_TIME_SYNC = 2,       // GSM on, SIM check and RTC sync
+    BOOT_PHASE_READ_SENSORS = 3,    // Boot measurements
+    BOOT_PHASE_CALL_HOME = 4,       // Boot call home
+    BOOT_PHASE_COLD_TOTAL = 10,     // Whole setup()
+    BOOT_PHASE_WARM_TOTAL = 11,     // Warm boot after reset (see FLAGS.WARM_BOOT)
+    BOOT_PHASE_FAST_TOTAL = 12      // Fast boot from deep sleep (see FLAGS.DEEP_SLEEP)
+};
+
 enum LightningEnvironment
 {
 	LIGHTNING_ENV_INDOOR = 0x01,
@@ -186,6 +207,39 @@ enum LightningIntReason
     LIGHTNING_INT_REASON_LIGHTNING = 0x08
 };
 
+/**
+ * Sensor measurement stores, filtered by Deadband and rolled up by Retention.
+ * Same order as SENSOR_STORE_KEYS
+ */
+enum SensorStore
+{
+    SENSOR_STORE_WATER_SENSORS,
+    SENSOR_STORE_SOIL_MOISTURE,
+    SENSOR_STORE_ATMOS41,
+    SENSOR_STORE_FO,
+    // Keep last
+    SENSOR_STORE_COUNT
+};
+
+/**
+ * Every DataStore of the device (see StoreRegistry)
+ */
+enum StoreId
+{
+    STORE_LOG,
+    STORE_WATER_SENSORS,
+    STORE_ATMOS41,
+    STORE_SOIL_MOISTURE,
+    STORE_FO,
+    STORE_LIGHTNING,
+    STORE_ENERGY_PROFILE,
+    STORE_RELAY,
+    STORE_ROLLUP,
+    STORE_SDI12_LOG,
+    // Keep last
+    STORE_COUNT
+};
+
 /**
  * Stats of a telemetry data submit operation
  */
@@ -197,6 +251,10 @@ struct DataStoreSubmitStats
     int crc_failed_entries;
     int failed_requests;
     int total_requests;
+
+    /** JSON bytes built and bytes actually sent, differ when compressed */
+    int json_bytes;
+    int sent_bytes;
 };
 
 /**
@@ -233,6 +291,72 @@ struct FLAGS_T
     bool EXTERNAL_RTC_ENABLED : 1;
 
     bool IPFS: 1;
+
+    bool LOG_BATCH_COMMIT: 1;
+
+    bool BINARY_TELEMETRY: 1;
+
+    bool GZIP_TELEMETRY: 1;
+
+    bool PIPELINED_UPLOAD: 1;
+
+    bool STREAMED_TELEMETRY: 1;
+
+    bool DOM_JSON_BUILDERS: 1;
+
+    bool COLUMNAR_TELEMETRY: 1;
+
+    bool DEEP_SLEEP: 1;
+
+    bool WARM_BOOT: 1;
+
+    bool FO_CONTINUOUS_RX: 1;
+
+    bool GSM_PSM: 1;
+
+    bool GSM_SLOW_CLOCK: 1;
+
+    bool ULP_SLEEP_CHARGE: 1;
+
+    bool ADAPTIVE_WATER_SAMPLING: 1;
+
+    bool ROLLUP_EVICTED_DATA: 1;
+
+    bool STORE_COMPACTION: 1;
+
+    bool BACKLOG_CALL_HOME: 1;
+
+    bool LORA_RELAY: 1;
+
+    bool LORA_OTA: 1;
+
+    bool SOLAR_DEFERRAL: 1;
+
+    bool TIERED_WAKE: 1;
+
+    bool BACKLOG_DRAIN: 1;
+
+    bool DYNAMIC_FREQ: 1;
+
+    bool STORE_ARCHIVE: 1;
+
+    bool PARALLEL_ACQUISITION: 1;
+
+    bool TEROS12_DDI_CAPTURE: 1;
+
+    bool DELTA_CLIENT_ATTRIBUTES: 1;
+
+    bool CALL_HOME_BUDGET: 1;
+
+    bool UPLINK_METRICS: 1;
+
+    bool PSRAM_STAGING: 1;
+
+    bool FIELD_OFFLOAD: 1;
+
+    bool RAW_CAPTURE: 1;
+
+    bool FS_STATS: 1;
 };
 
 #endif
\ No newline at end of file
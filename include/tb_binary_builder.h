@@ -0,0 +1,78 @@
+#ifndef TB_BINARY_BUILDER_H
+#define TB_BINARY_BUILDER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "tb_json_schema.h"
+
+/******************************************************************************
+* Builds compact telemetry out of store entries, as an alternative to the
+* Tb*JsonBuilder classes (same interface, see CallHome::submit_stored_telemetry).
+*
+* Entries are written field by field (struct schema, TbJsonSchemaOf) after a
+* 4 byte header, base64 encoded and sent as a single telemetry value:
+*
+*   {"bin":"<base64>"}
+*
+* Header: version (BINARY_TELEMETRY_VERSION), schema id (BINARY_SCHEMA_*),
+* entry size (0, entries are variable length), entry count. A ThingsBoard
+* rule chain converter uses the schema id to decode entries back to their
+* telemetry keys.
+*
+* Entry: timestamp (u32), presence mask (u16, only structs with one, see
+* TbJsonSchema::present_offset), then the fields present in schema order.
+* Floats with fixed decimals are scaled integers (value * 10^decimals) written
+* as zigzag varints, other fields are raw little endian values.
+******************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+class TbBinaryBuilder
+{
+public:
+    /** Payload header */
+    struct Header
+    {
+        uint8_t version;
+        uint8_t schema_id;
+        uint8_t entry_size;
+        uint8_t count;
+    }__attribute__((packed));
+
+    TbBinaryBuilder();
+
+    RetResult add(const TStruct *entry);
+
+    RetResult build(char *buff_out, int buff_size, bool beautify);
+
+    RetResult build(Print &out);
+
+    bool is_empty();
+
+    int get_count();
+
+    RetResult truncate(int count);
+
+    RetResult set_seq(uint32_t seq);
+
+    int measure();
+
+    RetResult reset();
+
+    void print();
+
+private:
+    RetResult append(const void *data, int size);
+
+    RetResult append_scaled(double val, int8_t decimals);
+
+    /** Header followed by raw entries */
+    uint8_t _buff[BINARY_TELEMETRY_BUFF_SIZE];
+
+    /** Bytes used in buffer */
+    int _buff_len = 0;
+
+    /** Payload length after each entry, used to truncate */
+    uint16_t _entry_ends[0xFF];
+};
+
+#endif
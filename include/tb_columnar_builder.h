@@ -0,0 +1,66 @@
+#ifndef TB_COLUMNAR_BUILDER_H
+#define TB_COLUMNAR_BUILDER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "tb_json_schema.h"
+
+/******************************************************************************
+* Builds columnar telemetry out of store entries, as an alternative to the
+* Tb*JsonBuilder classes (same interface, see CallHome::submit_stored_telemetry).
+*
+* Entries of a request are usually consecutive samples of the same sensor, so
+* instead of repeating keys and full values per entry, every field of the
+* struct schema (TbJsonSchemaOf) is sent as an array of delta encoded, scaled
+* integers. A ThingsBoard rule chain converter expands it back to entries:
+*
+*   {"col":{"v":1,"s":<schema id>,"n":<count>,"t0":<first ts (s)>,"dt":<interval (s)>,
+*     "k":["<key>",..],"x":[<decimals>,..],"d":[[<first>,<delta>,..],..]}}
+*
+* Field values are multiplied by 10^decimals and rounded (floats without fixed
+* decimals use COLUMNAR_TELEMETRY_DEFAULT_DECIMALS). If timestamps are not
+* evenly spaced "dt" is replaced by "td", an array of timestamp deltas.
+* Fields not present in any entry (TbJsonSchema::present_offset) have no
+* column. If presence differs between entries, "p" holds the mask of each.
+******************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+class TbColumnarBuilder
+{
+public:
+    TbColumnarBuilder();
+
+    RetResult add(const TStruct *entry);
+
+    RetResult build(char *buff_out, int buff_size, bool beautify);
+
+    RetResult build(Print &out);
+
+    bool is_empty();
+
+    int get_count();
+
+    RetResult truncate(int count);
+
+    RetResult set_seq(uint32_t seq);
+
+    int measure();
+
+    RetResult reset();
+
+    void print();
+
+private:
+    int32_t scaled(const TbJsonField *field, const TStruct *entry);
+
+    int decimals(const TbJsonField *field);
+
+    bool column_present(const TbJsonField *field, uint16_t present_any);
+
+    /** Entries added, encoded when building */
+    TStruct _entries[COLUMNAR_TELEMETRY_MAX_ENTRIES];
+
+    int _count = 0;
+};
+
+#endif
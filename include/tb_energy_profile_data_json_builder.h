@@ -0,0 +1,22 @@
+#ifndef TB_ENERGY_PROFILE_DATA_JSON_BUILDER_H
+#define TB_ENERGY_PROFILE_DATA_JSON_BUILDER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "energy_profile_data.h"
+#include "json_builder_base.h"
+
+#define ARDUINOJSON_USE_LONG_LONG 1
+#include "ArduinoJson.h"
+
+/******************************************************************************
+* Helper class to build Thingsboard telemetry JSON from data store entries
+******************************************************************************/
+class TbEnergyProfileDataJsonBuilder : public JsonBuilderBase<EnergyProfileData::Entry, ENERGY_PROFILE_DATA_JSON_DOC_SIZE>
+{
+public:
+	RetResult add(const EnergyProfileData::Entry *entry);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TB_GATEWAY_JSON_BUILDER_H
+#define TB_GATEWAY_JSON_BUILDER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "relay_data.h"
+
+#define ARDUINOJSON_USE_LONG_LONG 1
+#include "ArduinoJson.h"
+
+/******************************************************************************
+* Helper class to build Thingsboard gateway API telemetry JSON, entries of
+* several devices in one payload grouped by device name:
+* {"<device>": [{"ts": .., "values": {..}}, ..], ..}
+* Same interface as the Tb*JsonBuilder classes. Submitted to the gateway API
+* instead of the device API (see TbGatewayPayload)
+******************************************************************************/
+class TbGatewayJsonBuilder
+{
+public:
+    TbGatewayJsonBuilder();
+
+    RetResult add(const RelayData::Entry *entry);
+
+    RetResult build(char *buff_out, int buff_size, bool beautify);
+
+    RetResult build(Print &out);
+
+    bool is_empty();
+
+    int get_count();
+
+    RetResult truncate(int count);
+
+    RetResult set_seq(uint32_t seq);
+
+    int measure();
+
+    RetResult reset();
+
+    void print();
+
+private:
+    StaticJsonDocument<TB_GATEWAY_JSON_DOC_SIZE> _json_doc;
+    JsonObject _root;
+
+    /** Device of every entry added, in order, to truncate */
+    uint32_t _entry_devices[TB_GATEWAY_JSON_MAX_ENTRIES];
+
+    /** Entries added */
+    int _count = 0;
+};
+
+/******************************************************************************
+* Builders whose payload goes to the TB gateway API (see
+* CallHome::submit_stored_telemetry)
+******************************************************************************/
+template <typename TBuilder>
+struct TbGatewayPayload
+{
+    static const bool value = false;
+};
+
+template <>
+struct TbGatewayPayload<TbGatewayJsonBuilder>
+{
+    static const bool value = true;
+};
+
+#endif
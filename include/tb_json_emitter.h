@@ -0,0 +1,61 @@
+#ifndef TB_JSON_EMITTER_H
+#define TB_JSON_EMITTER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "tb_json_schema.h"
+
+/******************************************************************************
+* Writes Thingsboard telemetry JSON for sensor data structures directly as text,
+* without building an ArduinoJson document first. Same interface as the
+* Tb*JsonBuilder classes (see CallHome::submit_stored_telemetry), which are
+* kept for debugging (FLAGS.DOM_JSON_BUILDERS).
+*
+* Fields of each struct are declared once in its TbJsonSchemaOf specialization.
+******************************************************************************/
+template <typename TStruct>
+class TbJsonEmitter
+{
+public:
+    TbJsonEmitter();
+
+    RetResult add(const TStruct *entry);
+
+    RetResult build(char *buff_out, int buff_size, bool beautify);
+
+    RetResult build(Print &out);
+
+    bool is_empty();
+
+    int get_count();
+
+    RetResult truncate(int count);
+
+    RetResult set_seq(uint32_t seq);
+
+    int measure();
+
+    RetResult reset();
+
+    void print();
+
+private:
+    RetResult append(const char *format, ...);
+
+    RetResult append_field(const TbJsonField *field, const TStruct *entry, bool first);
+
+    /** Output text, without the closing bracket of the array */
+    char _buff[TB_JSON_EMITTER_BUFF_SIZE];
+
+    /** Bytes used in buffer */
+    int _len = 0;
+
+    /** Output length after each entry, used to truncate */
+    uint16_t _entry_ends[TB_JSON_EMITTER_MAX_ENTRIES];
+
+    /** Entries added */
+    int _count = 0;
+};
+
+#endif
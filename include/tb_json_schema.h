@@ -0,0 +1,115 @@
+#ifndef TB_JSON_SCHEMA_H
+#define TB_JSON_SCHEMA_H
+
+#include <stddef.h>
+#include "struct.h"
+#include "const.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "atmos41_data.h"
+#include "lightning_data.h"
+#include "fo_data.h"
+#include "energy_profile_data.h"
+
+/******************************************************************************
+* Type of a struct member written as a JSON value. Deduced from the member
+* type at compile time (see TB_JSON_FIELD)
+******************************************************************************/
+enum TbJsonFieldType
+{
+    TB_JSON_FIELD_BOOL,
+    TB_JSON_FIELD_UINT8,
+    TB_JSON_FIELD_INT16,
+    TB_JSON_FIELD_UINT16,
+    TB_JSON_FIELD_INT32,
+    TB_JSON_FIELD_UINT32,
+    TB_JSON_FIELD_FLOAT
+};
+
+template <typename T> struct TbJsonFieldTypeOf;
+template <> struct TbJsonFieldTypeOf<bool> { static const TbJsonFieldType value = TB_JSON_FIELD_BOOL; };
+template <> struct TbJsonFieldTypeOf<uint8_t> { static const TbJsonFieldType value = TB_JSON_FIELD_UINT8; };
+template <> struct TbJsonFieldTypeOf<int16_t> { static const TbJsonFieldType value = TB_JSON_FIELD_INT16; };
+template <> struct TbJsonFieldTypeOf<uint16_t> { static const TbJsonFieldType value = TB_JSON_FIELD_UINT16; };
+template <> struct TbJsonFieldTypeOf<int32_t> { static const TbJsonFieldType value = TB_JSON_FIELD_INT32; };
+template <> struct TbJsonFieldTypeOf<uint32_t> { static const TbJsonFieldType value = TB_JSON_FIELD_UINT32; };
+template <> struct TbJsonFieldTypeOf<float> { static const TbJsonFieldType value = TB_JSON_FIELD_FLOAT; };
+
+/******************************************************************************
+* Describes a struct member written to the telemetry "values" object
+******************************************************************************/
+struct TbJsonField
+{
+    /** Telemetry key */
+    const char *key;
+
+    /** Member offset in struct */
+    uint16_t offset;
+
+    TbJsonFieldType type;
+
+    /** Floats are rounded to this many decimals, -1 to write as is */
+    int8_t decimals;
+
+    /** Bit of the field in the entry presence mask (TbJsonSchema::present_offset),
+     * 0 if the field is always present */
+    uint16_t present_bit;
+
+    double read(const void *entry) const;
+
+    int size() const;
+};
+
+/******************************************************************************
+* Describes how entries of a struct are written: timestamp and value fields
+******************************************************************************/
+struct TbJsonSchema
+{
+    /** Timestamp key of entry */
+    const char *ts_key;
+
+    /** Stored timestamp (seconds) is multiplied by this, eg. 1000 for ms */
+    uint16_t ts_multiplier;
+
+    const TbJsonField *fields;
+    int field_count;
+
+    /** Offset of the uint16_t presence mask in struct, -1 if all fields are
+     * always present. Fields whose bit is not set were not measured */
+    int16_t present_offset;
+
+    bool is_sparse() const;
+
+    uint16_t present_mask(const void *entry) const;
+
+    bool is_present(const TbJsonField *field, const void *entry) const;
+};
+
+/** Declare a field of TStruct. Type is deduced from the member */
+#define TB_JSON_FIELD(TStruct, member, key, decimals) \
+    { key, offsetof(TStruct, member), TbJsonFieldTypeOf<decltype(((TStruct*)0)->member)>::value, decimals, 0 }
+
+/** Declare a field of TStruct present only if bit is set in the entry presence mask */
+#define TB_JSON_SPARSE_FIELD(TStruct, member, key, decimals, bit) \
+    { key, offsetof(TStruct, member), TbJsonFieldTypeOf<decltype(((TStruct*)0)->member)>::value, decimals, bit }
+
+/******************************************************************************
+* Schema of each sensor data struct, defined in tb_json_schema.cpp. Used by
+* TbJsonEmitter and TbColumnarBuilder
+******************************************************************************/
+template <typename TStruct>
+struct TbJsonSchemaOf
+{
+    static const TbJsonSchema SCHEMA;
+};
+
+template <> const TbJsonSchema TbJsonSchemaOf<WaterSensorData::Entry>::SCHEMA;
+template <> const TbJsonSchema TbJsonSchemaOf<Atmos41Data::Entry>::SCHEMA;
+template <> const TbJsonSchema TbJsonSchemaOf<SoilMoistureData::Entry>::SCHEMA;
+template <> const TbJsonSchema TbJsonSchemaOf<FoData::StoreEntry>::SCHEMA;
+template <> const TbJsonSchema TbJsonSchemaOf<LightningData::Entry>::SCHEMA;
+template <> const TbJsonSchema TbJsonSchemaOf<EnergyProfileData::Entry>::SCHEMA;
+
+const TbJsonSchema* tb_json_sensor_store_schema(SensorStore store);
+
+#endif
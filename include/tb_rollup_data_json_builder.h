@@ -0,0 +1,23 @@
+#ifndef TB_ROLLUP_DATA_JSON_BUILDER_H
+#define TB_ROLLUP_DATA_JSON_BUILDER_H
+
+#include "struct.h"
+#include "const.h"
+#include "app_config.h"
+#include "rollup_data.h"
+#include "json_builder_base.h"
+
+#define ARDUINOJSON_USE_LONG_LONG 1
+#include "ArduinoJson.h"
+
+/******************************************************************************
+* Helper class to build Thingsboard telemetry JSON from rollups. Keys are the
+* source store keys prefixed with the store key and suffixed with the statistic
+******************************************************************************/
+class TbRollupDataJsonBuilder : public JsonBuilderBase<RollupData::Entry, ROLLUP_DATA_JSON_DOC_SIZE>
+{
+public:
+	RetResult add(const RollupData::Entry *entry);
+};
+
+#endif
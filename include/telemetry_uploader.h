@@ -0,0 +1,30 @@
+#ifndef TELEMETRY_UPLOADER_H
+#define TELEMETRY_UPLOADER_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+
+/******************************************************************************
+ * Sends telemetry requests from a task pinned to the other core, so the next
+ * request can be read from flash and built while the previous one is on air.
+ * Only one request is in flight at a time, caller waits for its result before
+ * dispatching the next one (see CallHome::submit_stored_telemetry).
+ ******************************************************************************/
+namespace TelemetryUploader
+{
+    /** Function that sends a request, called from uploader task */
+    typedef RetResult (*SendFunc)(const char *data, int data_size, int *sent_size);
+
+    RetResult start(SendFunc send);
+
+    void stop();
+
+    bool is_running();
+
+    RetResult dispatch(const char *data, int data_size);
+
+    RetResult wait(int *sent_size);
+}
+
+#endif
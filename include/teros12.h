@@ -10,6 +10,7 @@ namespace Teros12
     RetResult measure(SoilMoistureData::Entry *data);
 
     RetResult log();
+    RetResult log_values(const float *values, uint8_t count);
 }
 
 #endif
\ No newline at end of file
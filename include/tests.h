@@ -11,7 +11,22 @@ namespace Tests
 		RTC_FROM_GSM,
 		DATA_STORE,
 		WAKEUP_TIMES,
-		DEVICE_CONFIG
+		DEVICE_CONFIG,
+		DATA_STORE_COMMIT_BENCHMARK,
+		JSON_EMITTER_BENCHMARK,
+		SDI12_PARSE,
+		FO_DECODE_BENCHMARK,
+		DATA_STORE_FILL_BENCHMARK,
+		JSON_BUILD_BENCHMARK,
+		CRC32_BENCHMARK,
+		SDI12_ROUNDTRIP_BENCHMARK,
+		HTTP_POST_BENCHMARK,
+		SLEEP_SIMULATION,
+		DATA_STORE_ADD_BENCHMARK,
+		CAPTURE_REPLAY,
+		IPFS_CID,
+		// Number of tests, keep last
+		TEST_COUNT
 	};
 
 	RetResult rtc_from_gsm();
@@ -24,6 +39,32 @@ namespace Tests
 
 	RetResult device_config();
 
+	RetResult data_store_commit_benchmark();
+
+	RetResult json_emitter_benchmark();
+
+	RetResult sdi12_parse();
+
+	RetResult fo_decode_benchmark();
+
+	RetResult data_store_fill_benchmark();
+
+	RetResult json_build_benchmark();
+
+	RetResult crc32_benchmark();
+
+	RetResult sdi12_roundtrip_benchmark();
+
+	RetResult http_post_benchmark();
+
+	RetResult sleep_simulation();
+
+	RetResult data_store_add_benchmark();
+
+	RetResult capture_replay();
+
+	RetResult ipfs_cid();
+
 	void run(TestId tests[], int count);
 
 	void run_all();
@@ -0,0 +1,77 @@
+#ifndef TLS_CLIENT_H
+#define TLS_CLIENT_H
+
+#include "app_config.h"
+#include "const.h"
+#include <Client.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+/******************************************************************************
+ * Arduino Client doing TLS (mbedTLS) over another client, the modem socket
+ * (TinyGsmClient) or WiFiClient. Used by HttpRequest and HttpSession for
+ * TLS_PORT.
+ *
+ * The session of the last full handshake is kept in RTC memory, so reconnects
+ * in the same call home and later call homes (deep sleep in between) resume it
+ * with an abbreviated handshake (session ticket or session ID) until
+ * TLS_SESSION_MAX_AGE_SECS passes or the server drops it.
+ *
+ * Writes are buffered so small header writes go in one TLS record and one modem
+ * send. Server certificate is not verified, same as the modem's HTTPS client.
+ ******************************************************************************/
+class TlsClient : public Client
+{
+public:
+    TlsClient(Client *transport);
+    ~TlsClient();
+
+    static bool is_tls_port(int port);
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buff, size_t size);
+
+    int available();
+    int read();
+    int read(uint8_t *buff, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+
+private:
+    RetResult setup();
+    RetResult handshake(const char *host, uint16_t port);
+    RetResult flush_write();
+
+    static int bio_send(void *ctx, const unsigned char *buff, size_t len);
+    static int bio_recv(void *ctx, unsigned char *buff, size_t len, uint32_t timeout);
+
+    /** Underlying connection */
+    Client *_transport = NULL;
+
+    mbedtls_ssl_context _ssl;
+    mbedtls_ssl_config _conf;
+    mbedtls_entropy_context _entropy;
+    mbedtls_ctr_drbg_context _drbg;
+
+    /** Contexts set up, done on first connect */
+    bool _setup = false;
+
+    /** Handshake done and connection not closed */
+    bool _connected = false;
+
+    /** Byte read by peek(), -1 if none */
+    int _peeked = -1;
+
+    /** Buffered plaintext not written yet */
+    uint8_t _tx_buff[TLS_CLIENT_WRITE_BUFF_SIZE];
+    int _tx_len = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include "struct.h"
+
+/**
+ * Span tracer of hot paths (modem, HTTP, stores, SDI12, FO RX, sleep). Finished
+ * spans are kept in a RAM ring with microsecond timestamps, printed in config
+ * mode and summarized (p50/p95 per span) in the log on call home
+ *
+ * Detailed tracing is armed remotely for a number of wake cycles or minutes
+ * (see arm()). While armed, AT command latencies are traced too, SDI12
+ * transcripts are persisted (see SDI12Log) and the ring is appended to
+ * TRACE_PATH before every deep sleep. Cycles are uploaded on call home, one
+ * telemetry value each: base64 of TRACE_UPLOAD_VERSION, CycleHeader and its
+ * records
+ */
+namespace Trace
+{
+	enum SpanId
+	{
+		SPAN_GSM_ON,
+		SPAN_GSM_ATTACH,
+		SPAN_GSM_PDP,
+		SPAN_HTTP_REQUEST,
+		SPAN_STORE_COMMIT,
+		SPAN_STORE_READ,
+		SPAN_SDI12,
+		SPAN_FO_RX,
+		SPAN_SLEEP,
+		/** Armed only, one per AT command */
+		SPAN_AT,
+		/** Wake up to next sleep, by SleepScheduler::WakeTier */
+		SPAN_WAKE_FO,
+		SPAN_WAKE_SENSOR,
+		SPAN_WAKE_CALL_HOME,
+		SPAN_COUNT
+	};
+
+	/** A finished span */
+	struct Record
+	{
+		/** Start, low 32 bits of uS since boot */
+		uint32_t start_us;
+		/** Duration (uS), saturated */
+		uint32_t dur_us;
+		uint8_t span;
+	}__attribute__((packed));
+
+	/** Wake cycle in trace file, followed by count records */
+	struct CycleHeader
+	{
+		/** RTC time at end of cycle */
+		uint32_t tstamp;
+		uint16_t count;
+	}__attribute__((packed));
+
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		uint32_t last_summary_tstamp;
+		uint16_t armed_cycles;
+		uint32_t armed_until;
+	};
+
+	/** Records a span from construction to end of scope */
+	class Span
+	{
+	public:
+		Span(SpanId id);
+		~Span();
+
+	private:
+		SpanId _id;
+		int64_t _start_us;
+	};
+
+	int64_t now_us();
+	void record(SpanId id, int64_t start_us);
+
+	void log_summary();
+	void print();
+	void clear();
+
+	void arm(int cycles, int mins);
+	bool is_armed();
+	RetResult end_cycle();
+	int build_upload_payload(int index, char *buff, int buff_size);
+	void clear_upload();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ULP_MONITOR_H
+#define ULP_MONITOR_H
+
+#include <inttypes.h>
+#include "struct.h"
+
+/**
+ * Battery monitor running on the ULP coprocessor (FSM) while the main CPU sleeps.
+ * The ULP samples the battery ADC every ULP_BATTERY_CHECK_INT_SECS and wakes the
+ * CPU only when the reading reaches a threshold. Used by sleep charge mode
+ * (FLAGS.ULP_SLEEP_CHARGE) instead of a CPU wake up per check
+ */
+namespace UlpMonitor
+{
+	RetResult start_battery(uint16_t threshold_mv);
+	void stop();
+
+	bool running();
+	void enable_wakeup();
+	bool woke_up();
+
+	uint16_t get_last_battery_raw();
+	uint16_t get_battery_checks();
+}
+
+#endif
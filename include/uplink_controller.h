@@ -0,0 +1,42 @@
+#ifndef UPLINK_CONTROLLER_H
+#define UPLINK_CONTROLLER_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+
+/******************************************************************************
+ * Picks telemetry request size, HTTP timeouts and retry back-off per call home
+ * from link quality: RSSI at connection time, round-trip times of requests in
+ * this session and success/failure of the latest requests (kept across call
+ * homes). Small requests on bad links, large ones on good links.
+ ******************************************************************************/
+namespace UplinkController
+{
+    enum Quality
+    {
+        QUALITY_BAD = 0,
+        QUALITY_FAIR = 1,
+        QUALITY_GOOD = 2
+    };
+
+    void start(int rssi);
+
+    void end();
+
+    void on_request_complete(bool success, uint32_t rtt_ms);
+
+    Quality get_quality();
+
+    int get_req_byte_budget(int max_budget);
+
+    int get_stream_timeout();
+
+    int get_response_timeout();
+
+    uint32_t get_retry_backoff();
+
+    int get_failed_req_threshold();
+}
+
+#endif
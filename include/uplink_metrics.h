@@ -0,0 +1,30 @@
+#ifndef UPLINK_METRICS_H
+#define UPLINK_METRICS_H
+
+#include "app_config.h"
+#include "struct.h"
+#include "const.h"
+
+/******************************************************************************
+ * Uplink performance of a call home session (FLAGS.UPLINK_METRICS): attach and
+ * PDP time, bytes, request round-trip times, HTTP status classes, timeouts,
+ * retries and the serving cell. Filled in by GSM and HttpRequest, submitted as
+ * a single telemetry entry by CallHome::end() so slow nodes and cells show up on
+ * the server.
+ ******************************************************************************/
+namespace UplinkMetrics
+{
+    void on_attach(uint32_t attach_ms, uint32_t pdp_ms);
+
+    void on_radio(int rssi);
+
+    void on_request(uint32_t rtt_ms, int sent_bytes, int recv_bytes, int status);
+
+    void on_retry();
+
+    int build_payload(char *buff, int buff_size, uint32_t tstamp);
+
+    void reset();
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <inttypes.h>
 #include "struct.h"
+#include "const.h"
 #include "ipfs_client.h"
 
 namespace Utils
@@ -24,11 +25,15 @@ namespace Utils
 
     uint32_t crc32(uint8_t *buff, uint32_t buff_size);
 
+    uint32_t crc32_update(uint32_t crc, const uint8_t *buff, uint32_t buff_size);
+
+    uint32_t crc32_check_entries(const uint8_t *entries, int count, int entry_size, int data_offset, int data_size);
+
     RetResult ip5306_set_power_boost_state(bool enable);
 
     RetResult url_explode(char *in, int *port_out, char *host_out, int host_max_size, char *path_out, int path_max_size);
 
-    RetResult tb_build_attributes_url_path(char *buff, int buff_size);
+    RetResult tb_build_attributes_url_path(char *buff, int buff_size, const char *format = TB_SHARED_ATTRIBUTES_URL_FORMAT);
 
     RetResult tb_build_telemetry_url_path(char *buff, int buff_size);
 
@@ -36,8 +41,6 @@ namespace Utils
 
     void check_credentials();
 
-    int read_adc_mv(uint8_t pin, int samples, int sampling_delay_ms);
-
     void print_flags();
 
     void print_reset_reason();
@@ -52,11 +55,7 @@ namespace Utils
 
     void build_ipfs_file_json(String hash, uint32_t timestamp, char *buff, int buff_size);
 
-    int filter_outliers(int vals[], int count, float *avg_out = nullptr);
-
     void print_vals(const int vals[], int count);
-
-    void cleanup_stores();
 }
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef WATER_LEVEL_H
 #define WATER_LEVEL_H
 #include "water_sensor_data.h"
+#include "sampling.h"
 
 namespace WaterLevel
 {
@@ -21,6 +22,8 @@ namespace WaterLevel
 	RetResult measure_dummy(WaterSensorData::Entry *data);
 
 	ErrorCode get_last_error();
+
+	const Sampling::Result* get_last_result();
 }
 
 #endif
\ No newline at end of file
@@ -4,9 +4,24 @@
 
 namespace WaterPresence
 {
+	/** State kept in RTC memory over deep sleep (see DeepSleep) */
+	struct RetainedState
+	{
+		int8_t level;
+		uint32_t last_uplink_tstamp;
+	};
+
 	RetResult init();
 
 	RetResult measure(WaterSensorData::Entry *data);
+
+	void arm_wakeup(bool deep_sleep);
+	bool level_changed();
+	bool check_edge();
+	bool uplink_due();
+
+	void save_state(RetainedState *state);
+	void restore_state(const RetainedState *state);
 }
 
-#endif
\ No newline at end of file
+#endif 
@@ -7,6 +7,25 @@
 
 namespace WaterSensorData
 {
+    /** Bits of Entry::present, set by the measurement of each field */
+    enum PresentBit : uint16_t
+    {
+        PRESENT_TEMPERATURE = 1 << 0,
+        PRESENT_DISSOLVED_OXYGEN = 1 << 1,
+        PRESENT_CONDUCTIVITY = 1 << 2,
+        PRESENT_PH = 1 << 3,
+        PRESENT_ORP = 1 << 4,
+        PRESENT_PRESSURE = 1 << 5,
+        PRESENT_DEPTH_CM = 1 << 6,
+        PRESENT_DEPTH_FT = 1 << 7,
+        PRESENT_TSS = 1 << 8,
+        PRESENT_PRESENCE = 1 << 9,
+        PRESENT_WATER_LEVEL = 1 << 10,
+
+        /** Fields measured by the water quality sensor (Aquatroll) */
+        PRESENT_QUALITY = 0x1FF
+    };
+
     /**
      * Water sensor data packet
      * All ranges/resolutions are for Aquatroll400,500,600
@@ -35,10 +54,10 @@ namespace WaterSensorData
         // Units: psi - Res: 0.01
         float pressure;
 
-        // Units: cm 
+        // Units: cm - Res: 0.1cm
         float depth_cm;
 
-        // Units: ft
+        // Units: ft - Res: 0.01ft
         float depth_ft;
 
         // Total suspended solids
@@ -47,12 +66,17 @@ namespace WaterSensorData
         // Capacitive water presence sensor
         bool presence;
 
-        // Range: 50 - 999cm
+        // Range: 50 - 999cm - Res: 0.1cm
         float water_level;
+
+        // PresentBit of every field measured, others are 0 and not sent
+        uint16_t present;
     }__attribute__((packed));
 
     RetResult add(Entry *data);
 
+    uint16_t present_bit(int offset);
+
     DataStore<Entry>* get_store();
 
     void print(const Entry *data);
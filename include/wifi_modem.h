@@ -3,18 +3,19 @@
 
 #include "app_config.h"
 
-#if WIFI_DATA_SUBMISSION || WIFI_DEBUG_SERIAL
+#if WIFI_DATA_SUBMISSION || WIFI_DEBUG_SERIAL || WIFI_BEARER
 
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 
 #include "struct.h"
+#include "const.h"
 
 namespace WifiModem
 {
     void init();
 
-    RetResult connect();
+    RetResult connect(uint32_t timeout_ms = WIFI_CONNECT_TIMEOUT_SEC * 1000);
     RetResult disconnect();
 
     bool is_connected();
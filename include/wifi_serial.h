@@ -2,12 +2,15 @@
 #define WIFI_SERIAL_H
 #include <HardwareSerial.h>
 #include "const.h"
+#include "app_config.h"
 
 #include <HTTPClient.h>
 
 /******************************************************************************
 * Subclasses Hardware serial to intercept all printed messages and forward them
 * via WiFi to HTTP logging service
+* Printed chars are queued in a ring buffer and sent in batches by a background
+* task, so printing never waits for the network.
 * Uses ESP32 HTTPClient class.
 * Note: HTTPClient is ESP32 native library while HttpClient (camelcase) is a
 * 3rd party arduino library
@@ -22,16 +25,46 @@ public:
     size_t write(const uint8_t *buffer, size_t size);
 
     void flush();
-    void append_char(char c);
+    uint32_t get_dropped();
 private:
-    /** Buffer for incoming messages. Messages are stored here until buffer is full
-     * or newline is found */
+    static void task(void *arg);
+    void start_task();
+    size_t push(const uint8_t *buffer, size_t size);
+    bool pop(char *c);
+    void append_char(char c);
+    void add_line();
+    void add_message(const char *msg, int len);
+    void send_frame();
+
+    /** Printed chars not sent yet. Filled by write() from any task, emptied by
+     * background task */
+    char _ring[WIFI_SERIAL_RING_SIZE];
+
+    /** Ring write/read positions, guarded by _ring_mux */
+    uint32_t _ring_head = 0;
+    uint32_t _ring_tail = 0;
+    portMUX_TYPE _ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+    /** Chars dropped because ring was full, and count already reported */
+    uint32_t _dropped = 0;
+    uint32_t _dropped_reported = 0;
+
+    /** Background task sending frames */
+    TaskHandle_t _task = NULL;
+    bool _task_started = false;
+
+    /** Message being collected by the task. Messages end at newline or when
+     * buffer is full */
     char _buff[WIFI_SERIAL_BUFFER_SIZE] = "";
 
     /** Current buffer length */
     int _buff_len = 0;
 
-    /** HTTP client object used for all requests */
+    /** Frame being built by the task, a JSON array of messages */
+    char _frame[WIFI_SERIAL_FRAME_SIZE] = "";
+    int _frame_len = 0;
+
+    /** HTTP client object used for all requests. Connection is reused between frames */
     HTTPClient _http_client;
 
     WiFiClientSecure _wifi_secure_client;
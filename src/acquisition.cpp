@@ -0,0 +1,271 @@
+#include "acquisition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "memory_monitor.h"
+#include "power_lock.h"
+#include "common.h"
+
+namespace Acquisition
+{
+	//
+	// Private types
+	//
+	/** Parameters of a job task */
+	struct JobTask
+	{
+		Job *job;
+
+		/** Bit of job, set in done_group when done */
+		uint32_t bit;
+
+		/** Done bits of all jobs of the graph */
+		EventGroupHandle_t done_group;
+	};
+
+	//
+	// Private functions
+	//
+	RetResult init_locks();
+	RetResult order_jobs(const Job *jobs, int count, int *order);
+	void run_job(Job *job, EventGroupHandle_t done_group);
+	void job_task(void *params);
+	void add_active(int count);
+
+	//
+	// Private vars
+	//
+	static_assert(ACQUISITION_MAX_JOBS <= 24, "Event groups have 24 bits");
+
+	/** Lock of each bus, created on first run */
+	SemaphoreHandle_t _bus_locks[BUS_COUNT] = {NULL};
+
+	/** Jobs running, holding their bus. Jobs waiting for jobs of their own don't count */
+	volatile int _active_jobs = 0;
+
+	/** Guards _active_jobs */
+	portMUX_TYPE _active_mux = portMUX_INITIALIZER_UNLOCKED;
+
+	/******************************************************************************
+	 * Run a graph of jobs and wait for all of them. Jobs run one after another
+	 * in the calling task, in dependency order, when FLAGS.PARALLEL_ACQUISITION
+	 * is not set or tasks can't be created
+	 * @param jobs Jobs to run, result and timing of each is set
+	 * @param count Number of jobs, up to ACQUISITION_MAX_JOBS
+	 * @return RET_ERROR if any job failed or the graph has a cycle
+	 *****************************************************************************/
+	RetResult run(Job *jobs, int count)
+	{
+		if(count <= 0 || count > ACQUISITION_MAX_JOBS || init_locks() != RET_OK)
+			return RET_ERROR;
+
+		int order[ACQUISITION_MAX_JOBS];
+
+		if(order_jobs(jobs, count, order) != RET_OK)
+		{
+			debug_println_e(F("Job graph has a cycle or an unknown job, not run."));
+			return RET_ERROR;
+		}
+
+		uint32_t t_start = millis();
+		bool done = false;
+
+		// Called by a job: it only waits from now on, its jobs run instead
+		bool nested = _active_jobs > 0;
+
+		if(nested)
+			add_active(-1);
+
+		if(FLAGS.PARALLEL_ACQUISITION && count > 1)
+		{
+			JobTask tasks[ACQUISITION_MAX_JOBS];
+			EventGroupHandle_t done_group = xEventGroupCreate();
+
+			if(done_group != NULL)
+			{
+				uint32_t started = 0;
+
+				for(int i = 0; i < count; i++)
+				{
+					if(jobs[i].in_place)
+						continue;
+
+					tasks[i] = {&jobs[i], job_bit(i), done_group};
+
+					if(xTaskCreate(job_task, "acq_job", ACQUISITION_TASK_STACK_SIZE, &tasks[i],
+						ACQUISITION_TASK_PRIORITY, NULL) != pdPASS)
+					{
+						debug_println_e(F("Could not start acquisition task, running rest of jobs in place."));
+						break;
+					}
+
+					started |= job_bit(i);
+				}
+
+				// In place jobs and jobs not started run in this task, in
+				// dependency order so none waits for a job after it
+				for(int i = 0; i < count; i++)
+				{
+					int job = order[i];
+
+					if(started & job_bit(job))
+						continue;
+
+					run_job(&jobs[job], done_group);
+					xEventGroupSetBits(done_group, job_bit(job));
+				}
+
+				xEventGroupWaitBits(done_group, job_bit(count) - 1, pdFALSE, pdTRUE, portMAX_DELAY);
+
+				vEventGroupDelete(done_group);
+				done = true;
+			}
+		}
+
+		// Sequential
+		if(!done)
+		{
+			for(int i = 0; i < count; i++)
+				run_job(&jobs[order[i]], NULL);
+		}
+
+		if(nested)
+			add_active(1);
+
+		RetResult ret = RET_OK;
+
+		for(int i = 0; i < count; i++)
+		{
+			debug_printf("Job %s waited (ms): %u, ran (ms): %u\n", jobs[i].name, jobs[i].wait_ms, jobs[i].run_ms);
+
+			if(jobs[i].result != RET_OK)
+				ret = RET_ERROR;
+		}
+
+		debug_printf("%d jobs took (ms): %u\n", count, millis() - t_start);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Check if the calling job may light sleep while waiting. Not while other jobs
+	 * are running, the whole chip would sleep with them
+	 *****************************************************************************/
+	bool can_light_sleep()
+	{
+		return _active_jobs <= 1;
+	}
+
+	/******************************************************************************
+	 * Create bus locks, once
+	 *****************************************************************************/
+	RetResult init_locks()
+	{
+		for(int i = 0; i < BUS_COUNT; i++)
+		{
+			if(_bus_locks[i] == NULL)
+				_bus_locks[i] = xSemaphoreCreateMutex();
+
+			if(_bus_locks[i] == NULL)
+			{
+				debug_println_e(F("Could not create bus lock."));
+				return RET_ERROR;
+			}
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Order jobs so each comes after the jobs in its after mask
+	 * @param order Indexes of jobs in run order
+	 * @return RET_ERROR on a cycle or a job depending on one not in the graph
+	 *****************************************************************************/
+	RetResult order_jobs(const Job *jobs, int count, int *order)
+	{
+		uint32_t placed = 0;
+		int placed_count = 0;
+
+		while(placed_count < count)
+		{
+			bool progress = false;
+
+			for(int i = 0; i < count; i++)
+			{
+				if((placed & job_bit(i)) || (jobs[i].after & ~placed) != 0)
+					continue;
+
+				order[placed_count++] = i;
+				placed |= job_bit(i);
+				progress = true;
+			}
+
+			if(!progress)
+				return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Run a job once the jobs before it are done, holding the lock of its bus.
+	 * Bus transactions need a steady APB clock, LOCK_APB_MAX is held with it
+	 * @param done_group Done bits of the graph, NULL when run in order
+	 *****************************************************************************/
+	void run_job(Job *job, EventGroupHandle_t done_group)
+	{
+		uint32_t t_wait = millis();
+
+		if(done_group != NULL && job->after != 0)
+			xEventGroupWaitBits(done_group, job->after, pdFALSE, pdTRUE, portMAX_DELAY);
+
+		if(job->bus != BUS_NONE)
+		{
+			xSemaphoreTake(_bus_locks[job->bus], portMAX_DELAY);
+			PowerLock::acquire(PowerLock::LOCK_APB_MAX);
+		}
+
+		job->wait_ms = millis() - t_wait;
+
+		add_active(1);
+
+		uint32_t t_start = millis();
+
+		job->result = job->run(job->ctx);
+
+		job->run_ms = millis() - t_start;
+
+		add_active(-1);
+
+		if(job->bus != BUS_NONE)
+		{
+			PowerLock::release(PowerLock::LOCK_APB_MAX);
+			xSemaphoreGive(_bus_locks[job->bus]);
+		}
+	}
+
+	/******************************************************************************
+	 * Task running a single job, exits when done
+	 *****************************************************************************/
+	void job_task(void *params)
+	{
+		JobTask *task = (JobTask*)params;
+
+		run_job(task->job, task->done_group);
+		MemoryMonitor::sample_task(MemoryMonitor::TASK_ACQUISITION);
+
+		xEventGroupSetBits(task->done_group, task->bit);
+		vTaskDelete(NULL);
+	}
+
+	/******************************************************************************
+	 * Add to count of running jobs
+	 *****************************************************************************/
+	void add_active(int count)
+	{
+		portENTER_CRITICAL(&_active_mux);
+		_active_jobs += count;
+		portEXIT_CRITICAL(&_active_mux);
+	}
+}
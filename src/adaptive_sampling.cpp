@@ -0,0 +1,158 @@
+#include "adaptive_sampling.h"
+#include "common.h"
+#include "log.h"
+#include "device_config.h"
+#include <math.h>
+#include <string.h>
+
+namespace AdaptiveSampling
+{
+	//
+	// Private functions
+	//
+	float calc_rate();
+	int snap_down(int interval_mins);
+
+	// Private vars
+	/** Last measurements, oldest first */
+	Sample _history[ADAPTIVE_SAMPLING_HISTORY_LEN];
+	int _count = 0;
+
+	/** Decided interval, 0 until there is enough history */
+	int _interval_mins = 0;
+
+	/******************************************************************************
+	* Add a measurement and decide the next interval
+	* Rate >= 1 (a field changes by its ADAPTIVE_SAMPLING_*_RATE per hour) samples at
+	* the min interval, below ADAPTIVE_SAMPLING_CALM_RATE the interval doubles
+	******************************************************************************/
+	void update(const WaterSensorData::Entry *data)
+	{
+		if(!FLAGS.ADAPTIVE_WATER_SAMPLING)
+			return;
+
+		if(_count == ADAPTIVE_SAMPLING_HISTORY_LEN)
+		{
+			memmove(&_history[0], &_history[1], (ADAPTIVE_SAMPLING_HISTORY_LEN - 1) * sizeof(Sample));
+			_count--;
+		}
+
+		Sample *sample = &_history[_count++];
+		sample->tstamp = data->timestamp;
+		sample->water_level = data->water_level;
+		sample->depth_cm = data->depth_cm;
+		sample->conductivity = data->conductivity;
+
+		if(_count < 2)
+			return;
+
+		float rate = calc_rate();
+		// Starts from the configured interval
+		int interval_mins = _interval_mins > 0 ? _interval_mins :
+			snap_down(DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WATER_SENSORS));
+
+		if(rate >= 1)
+			interval_mins = ADAPTIVE_SAMPLING_MIN_INT_MINS;
+		else if(rate < ADAPTIVE_SAMPLING_CALM_RATE)
+			interval_mins = snap_down(interval_mins * 2);
+
+		debug_printf("Adaptive sampling rate: %.2f, interval: %d mins\n", rate, interval_mins);
+
+		if(interval_mins != _interval_mins)
+		{
+			Log::log(Log::ADAPTIVE_SAMPLING_INTERVAL, interval_mins, (uint32_t)(rate * 100));
+			_interval_mins = interval_mins;
+		}
+	}
+
+	/******************************************************************************
+	* Max rate of change of the tracked fields over the history, relative to each
+	* field's fast rate. Fields of disabled sensors are ignored
+	******************************************************************************/
+	float calc_rate()
+	{
+		const Sample *first = &_history[0];
+		const Sample *last = &_history[_count - 1];
+
+		if(last->tstamp <= first->tstamp)
+			return 0;
+
+		float hours = (last->tstamp - first->tstamp) / 3600.0;
+		float rate = 0;
+
+		if(FLAGS.WATER_LEVEL_SENSOR_ENABLED)
+			rate = fmaxf(rate, fabsf(last->water_level - first->water_level) / hours / ADAPTIVE_SAMPLING_LEVEL_RATE);
+
+		if(FLAGS.WATER_QUALITY_SENSOR_ENABLED)
+		{
+			rate = fmaxf(rate, fabsf(last->depth_cm - first->depth_cm) / hours / ADAPTIVE_SAMPLING_DEPTH_RATE);
+			rate = fmaxf(rate, fabsf(last->conductivity - first->conductivity) / hours / ADAPTIVE_SAMPLING_CONDUCTIVITY_RATE);
+		}
+
+		return rate;
+	}
+
+	/******************************************************************************
+	* Largest valid schedule interval not above interval_mins, within max interval
+	******************************************************************************/
+	int snap_down(int interval_mins)
+	{
+		int best = ADAPTIVE_SAMPLING_MIN_INT_MINS;
+
+		if(interval_mins > ADAPTIVE_SAMPLING_MAX_INT_MINS)
+			interval_mins = ADAPTIVE_SAMPLING_MAX_INT_MINS;
+
+		for(int i = 0; i < sizeof(WAKEUP_SCHEDULE_VALID_VALUES) / sizeof(WAKEUP_SCHEDULE_VALID_VALUES[0]); i++)
+		{
+			int value = WAKEUP_SCHEDULE_VALID_VALUES[i];
+
+			if(value > best && value <= interval_mins)
+				best = value;
+		}
+
+		return best;
+	}
+
+	/******************************************************************************
+	* Set decided interval as the water sensors interval of the schedule
+	******************************************************************************/
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[])
+	{
+		if(!FLAGS.ADAPTIVE_WATER_SAMPLING || _interval_mins == 0)
+			return;
+
+		for(int i = 0; i < WAKEUP_SCHEDULE_LEN; i++)
+		{
+			if(schedule[i].reason == SleepScheduler::REASON_READ_WATER_SENSORS && schedule[i].wakeup_int > 0)
+				schedule[i].wakeup_int = _interval_mins;
+		}
+	}
+
+	/******************************************************************************
+	* Get decided interval (mins), 0 if not decided yet
+	******************************************************************************/
+	int get_interval()
+	{
+		return _interval_mins;
+	}
+
+	/******************************************************************************
+	* Save state before entering deep sleep
+	******************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		memcpy(state->history, _history, sizeof(_history));
+		state->count = _count;
+		state->interval_mins = _interval_mins;
+	}
+
+	/******************************************************************************
+	* Restore state after waking up from deep sleep
+	******************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		memcpy(_history, state->history, sizeof(_history));
+		_count = state->count;
+		_interval_mins = state->interval_mins;
+	}
+}
@@ -0,0 +1,195 @@
+#include "adc_manager.h"
+#include "app_config.h"
+#include "const.h"
+#include "common.h"
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+namespace AdcManager
+{
+	/** Pin and sampling plan of a channel */
+	struct ChannelConfig
+	{
+		uint8_t pin;
+		uint16_t max_samples;
+		uint16_t min_valid;
+		float tolerance;
+	};
+
+	const ChannelConfig CHANNELS[] = {
+		[CHANNEL_BATTERY] = {PIN_ADC_BAT, ADC_BATTERY_LEVEL_SAMPLES, ADC_BATTERY_LEVEL_SAMPLES / 2, ADC_BATTERY_CONVERGED_TOLERANCE_RAW},
+		[CHANNEL_SOLAR] = {PIN_ADC_SOLAR, ADC_SOLAR_SAMPLES, ADC_SOLAR_SAMPLES / 2, ADC_SOLAR_CONVERGED_TOLERANCE_RAW},
+		[CHANNEL_WATER_LEVEL] = {PIN_WATER_LEVEL_ANALOG, WATER_LEVEL_MEASUREMENTS_COUNT, WATER_LEVEL_MIN_VALID_MEASUREMENTS, WATER_LEVEL_CONVERGED_TOLERANCE_RAW}
+	};
+
+	//
+	// Private functions
+	//
+	bool read_raw_sample(void *ctx, float *out);
+	RetResult sample_channel(Channel channel);
+
+	// Private vars
+	/** Characteristics of ADC1 and ADC2, from eFuse calibration when burned */
+	esp_adc_cal_characteristics_t _chars[2];
+
+	/** Latest reading of every channel */
+	Reading _readings[CHANNEL_COUNT] = {};
+
+	/** Channels are configured */
+	bool _initialized = false;
+
+	/******************************************************************************
+	* Configure channels and characterize both ADC units
+	******************************************************************************/
+	RetResult init()
+	{
+		adc1_config_width(ADC_WIDTH_BIT_12);
+
+		for(int i = 0; i < CHANNEL_COUNT; i++)
+		{
+			int8_t adc_channel = digitalPinToAnalogChannel(CHANNELS[i].pin);
+
+			if(adc_channel < 0)
+			{
+				debug_printf("Pin %d is not an ADC pin.\n", CHANNELS[i].pin);
+				return RET_ERROR;
+			}
+
+			// ADC2 channels are numbered from 10
+			if(adc_channel < 10)
+				adc1_config_channel_atten((adc1_channel_t)adc_channel, ADC_ATTEN_DB_11);
+			else
+				adc2_config_channel_atten((adc2_channel_t)(adc_channel - 10), ADC_ATTEN_DB_11);
+		}
+
+		esp_adc_cal_value_t cal = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, ADC_DEFAULT_VREF_MV, &_chars[0]);
+		esp_adc_cal_characterize(ADC_UNIT_2, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, ADC_DEFAULT_VREF_MV, &_chars[1]);
+
+		debug_printf("ADC calibration: %s\n", cal == ESP_ADC_CAL_VAL_EFUSE_TP ? "two point" :
+			cal == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse vref" : "default vref");
+
+		_initialized = true;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Read a raw sample
+	* @param ctx ADC channel (ADC2 from 10)
+	******************************************************************************/
+	bool read_raw_sample(void *ctx, float *out)
+	{
+		int adc_channel = (intptr_t)ctx;
+		int raw = 0;
+
+		if(adc_channel < 10)
+		{
+			raw = adc1_get_raw((adc1_channel_t)adc_channel);
+		}
+		else if(adc2_get_raw((adc2_channel_t)(adc_channel - 10), ADC_WIDTH_BIT_12, &raw) != ESP_OK)
+		{
+			return false;
+		}
+
+		*out = raw;
+		return raw >= 0;
+	}
+
+	/******************************************************************************
+	* Sample a single channel back to back and store its reading
+	******************************************************************************/
+	RetResult sample_channel(Channel channel)
+	{
+		const ChannelConfig *config = &CHANNELS[channel];
+		Reading *reading = &_readings[channel];
+		int adc_channel = digitalPinToAnalogChannel(config->pin);
+
+		Sampling::Plan plan = {0};
+		plan.max_samples = config->max_samples;
+		plan.min_valid = config->min_valid;
+		plan.max_invalid = config->max_samples;
+		plan.tolerance = config->tolerance;
+
+		reading->ret = Sampling::run(&plan, read_raw_sample, (void*)(intptr_t)adc_channel, &reading->stats);
+		reading->tstamp_ms = millis();
+		reading->mv = 0;
+
+		// Best effort value is kept for noisy readings too
+		if(reading->stats.samples > 0)
+			reading->mv = esp_adc_cal_raw_to_voltage(reading->stats.value + 0.5, &_chars[adc_channel < 10 ? 0 : 1]);
+
+		return reading->ret;
+	}
+
+	/******************************************************************************
+	* Sample channels in one burst
+	* @param channel_mask Channels to sample (1 << Channel)
+	* @return RET_ERROR if any channel failed
+	******************************************************************************/
+	RetResult sample(uint32_t channel_mask)
+	{
+		if(!_initialized && init() != RET_OK)
+			return RET_ERROR;
+
+		RetResult ret = RET_OK;
+
+		for(int i = 0; i < CHANNEL_COUNT; i++)
+		{
+			if((channel_mask & (1 << i)) && sample_channel((Channel)i) != RET_OK)
+				ret = RET_ERROR;
+		}
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Get a channel's reading. Reuses the reading of a recent burst, samples the
+	* channel otherwise
+	******************************************************************************/
+	RetResult read(Channel channel, Reading *out)
+	{
+		Reading *reading = &_readings[channel];
+
+		if(reading->tstamp_ms == 0 || millis() - reading->tstamp_ms > ADC_READING_MAX_AGE_MS)
+			sample(1 << channel);
+
+		*out = *reading;
+
+		return reading->ret;
+	}
+
+	/******************************************************************************
+	* Get a channel's calibrated mV
+	* @return mV, -1 on error
+	******************************************************************************/
+	int read_mv(Channel channel)
+	{
+		Reading reading;
+
+		if(read(channel, &reading) != RET_OK)
+			return -1;
+
+		return reading.mv;
+	}
+
+	/******************************************************************************
+	* Get the raw ADC value of a channel for a calibrated mV, inverse of the linear
+	* characteristic (used for thresholds compared against raw readings, eg. ULP)
+	* @return Raw value, -1 on error
+	******************************************************************************/
+	int mv_to_raw(Channel channel, uint32_t mv)
+	{
+		if(!_initialized && init() != RET_OK)
+			return -1;
+
+		int adc_channel = digitalPinToAnalogChannel(CHANNELS[channel].pin);
+		const esp_adc_cal_characteristics_t *chars = &_chars[adc_channel < 10 ? 0 : 1];
+
+		if(mv <= chars->coeff_b)
+			return 0;
+
+		uint32_t raw = ((uint64_t)(mv - chars->coeff_b) << 16) / chars->coeff_a;
+
+		return raw > 4095 ? 4095 : raw;
+	}
+}
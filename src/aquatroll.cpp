@@ -1,12 +1,67 @@
+#include <stddef.h>
 #include "aquatroll.h"
 #include "utils.h"
 #include "rtc.h"
 #include "log.h"
 #include "sdi12_sensor.h"
 #include "common.h"
+#include "power_control.h"
+
+/** Entry field offset, for model descriptors */
+#define FIELD(name) offsetof(WaterSensorData::Entry, name)
 
 namespace Aquatroll
 {
+    //
+    // Private functions
+    //
+    RetResult read_batches(Sdi12Sensor *sensor, float *values, uint8_t expected);
+
+    //
+    // Private vars
+    //
+    /******************************************************************************
+     * Known models. A new model is another entry here and in Sdi12Registry
+     ******************************************************************************/
+    const ModelDescriptor MODELS[] = {
+        // RDO - Dissolved oxygen (concentration) - mg/L
+        // RDO - Dissolved oxygen (%saturation) - %Sat
+        // RDO - Temperature - C
+        // Cond - Specific Conductivity - uS/cm
+        // pH/ORP - pH
+        // pH/ORP - Oxidation Reduction Potential (ORP) - mV
+        // Pres(A) 250ft - Pressure mBar
+        // Pres(A) 250ft - Depth - cm
+        {"Aquatroll 400", Sdi12Registry::MODEL_AQUATROLL400, AQUATROLL_MODEL_400, AQUATROLL400_NUMBER_OF_MEASUREMENTS,
+            {FIELD(dissolved_oxygen), FIELD_NONE, FIELD(temperature), FIELD(conductivity), FIELD(ph), FIELD(orp),
+            FIELD(pressure), FIELD(depth_cm)}},
+
+        // RDO - Dissolved Oxygen (concentration) - mg/L
+        // RDO - Dissolved Oxygen (%saturation) - %Sat
+        // Cond - Temperature - C
+        // Cond - Specific Conductivity - uS/cm
+        // pH/ORP - ph -pH
+        // pH/ORP - Oxidation Reductino Potential (ORP) - mV
+        // Pres 30ft - Pressure - PSI
+        // Pres 30ft - Depth - ft
+        {"Aquatroll 500", Sdi12Registry::MODEL_AQUATROLL500, AQUATROLL_MODEL_500, AQUATROLL500_NUMBER_OF_MEASUREMENTS,
+            {FIELD(dissolved_oxygen), FIELD_NONE, FIELD(temperature), FIELD(conductivity), FIELD(ph), FIELD(orp),
+            FIELD(pressure), FIELD(depth_ft)}},
+
+        // RDO - Dissolved Oxygen (concentration) - mg/L
+        // RDO - Dissolved Oxygen (%saturation) - %Sat
+        // Cond - Temperature - C
+        // Cond - Specific Conductivity - uS/cm
+        // Pres 30ft - Pressure - PSI
+        // Pres 30ft - Depth - ft
+        // Turb - Total suspended solids
+        {"Aquatroll 600", Sdi12Registry::MODEL_AQUATROLL600, AQUATROLL_MODEL_600, AQUATROLL600_NUMBER_OF_MEASUREMENTS,
+            {FIELD(dissolved_oxygen), FIELD_NONE, FIELD(temperature), FIELD(conductivity), FIELD(pressure),
+            FIELD(depth_ft), FIELD(tss)}}
+    };
+
+    const int MODEL_COUNT = sizeof(MODELS) / sizeof(MODELS[0]);
+
     /******************************************************************************
      * Initialization
      ******************************************************************************/
@@ -16,263 +71,64 @@ namespace Aquatroll
     }
 
     /******************************************************************************
-    * Measure correct Aquatroll model depending on config
+    * Measure correct Aquatroll model. Model discovered on the bus is used, config
+    * otherwise
     ******************************************************************************/
     RetResult measure(WaterSensorData::Entry *data)
     {
-        switch (AQUATROLL_MODEL)
+        char address = '0';
+        const ModelDescriptor *model = find_model(&address);
+
+        if(model == NULL)
         {
-        case AQUATROLL_MODEL_400:
-            return measure_aquatroll400(data);
-            break;
-        case AQUATROLL_MODEL_500:
-            return measure_aquatroll500(data);
-            break;
-        case AQUATROLL_MODEL_600:
-            return measure_aquatroll600(data);
-            break;
-        default:
             debug_println_e(F("Invalid Aquatroll model"));
-            break;
+            return RET_ERROR;
         }
 
-        return RET_ERROR;
+        return measure_model(model, data, address);
     }
 
     /******************************************************************************
-     * Send measure command to the sensor and fill data structure
-     * Aquatroll is configured to return the following measurements (in this order):
-     * RDO - Dissolved oxygen (concentration) - mg/L
-     * RDO - Dissolved oxygen (%saturation) - %Sat
-     * RDO - Temperature - C
-     * Cond - Specific Conductivity - uS/cm
-     * pH/ORP - pH
-     * pH/ORP - Oxidation Reduction Potential (ORP) - mV
-     * Pres(A) 250ft - Pressure mBar
-     * Pres(A) 250ft - Depth - cm
-     * @param data Output structure
-     ******************************************************************************/
-    RetResult measure_aquatroll400(WaterSensorData::Entry *data)
+    * Find model to measure: first one discovered on the bus, the configured one
+    * at address 0 otherwise
+    * @param address_out Sensor bus address (output var)
+    * @return NULL if none
+    ******************************************************************************/
+    const ModelDescriptor* find_model(char *address_out)
     {
-        debug_println("Measuring water quality.");
-
-        // Return dummy values switch
-        if(FLAGS.MEASURE_DUMMY_WATER_QUALITY)
+        for(int i = 0; i < MODEL_COUNT; i++)
         {
-            return measure_dummy(data);
-        }
-
-        // Zero structure
-        memset(data, 0, sizeof(WaterSensorData::Entry));
-
-        // I2C slave SDI12 adapter
-        Sdi12Sensor sensor(PIN_SDI12_DATA);
+            const Sdi12Registry::Sensor *sensor = Sdi12Registry::find(MODELS[i].model);
 
-        // Output variables
-        // Seconds to wait
-        uint16_t secs_to_wait = 0;
-        // Vals to be measured
-        uint8_t measured_values = 0;
-
-        if(sensor.measure(&secs_to_wait, &measured_values) != RET_OK)
-        {
-            Sdi12Sensor::ErrorCode error = sensor.get_last_error();
-            if(error == Sdi12Sensor::ERROR_INVALID_RESPONSE)
+            if(sensor != NULL)
             {
-                debug_println(F("Invalid response returned."));
-
-                Log::log(Log::WATER_QUALITY_INVALID_RESPONSE);
-
-                return RET_ERROR;
+                *address_out = sensor->address;
+                return &MODELS[i];
             }
-
-            return RET_ERROR;
         }
 
-        // Check if seconds within range. Range values are chosen empirically.
-        // If values not within range, something is wrong with the response or with the
-        // configuration of Aquatroll
-        if(secs_to_wait > AQUATROLL_MEASURE_WAIT_SEC_MAX)
-        {
-            debug_println(F("Invalid number of seconds to wait for measurements."));
-            Serial.print(F("Seconds to wait: "));
-            Serial.println(secs_to_wait, DEC);
-            return RET_ERROR;
-        }
-        // The exact number of measured values is known and configured into Aquatroll
-        if(measured_values != AQUATROLL400_NUMBER_OF_MEASUREMENTS)
-        {
-            debug_print(F("Invalid number of measured values. Expected: "));
-            debug_println(AQUATROLL400_NUMBER_OF_MEASUREMENTS, DEC);
-            Serial.print(F("Returned: "));
-            Serial.println(measured_values, DEC);
-            return RET_ERROR;
-        }
-
-        // TODO: 
-        // When sleeping, pins go low and sensor is disabled.
-        // Use RTC GPIO so power pin  can stay high and ESP32 can sleep instead of waiting
-        debug_print(F("Waiting (sec): "));
-        debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
-        delay((secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000);
-
-        //
-        // Request measurement data
-        //
-        WaterSensorData::Entry sensor_data = {0};
-
-        // Vars to receive all the measurement data
-        // Data will be copied to output structure only after successfull measurement
-        float d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0, d7 = 0, d8 = 0;
-
-        //
-        // Batch 0
-        //
-        int tries = 3;
-        RetResult ret = RET_ERROR;
-        while(tries--)
+        for(int i = 0; i < MODEL_COUNT; i++)
         {
-            if(sensor.read_measurement_data(0, &d1, &d2, &d3) != RET_OK)
+            if(MODELS[i].config_model == AQUATROLL_MODEL)
             {
-                debug_println(F("Could not get measurement results for batch 0."));
-
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 0);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
+                *address_out = '0';
+                return &MODELS[i];
             }
         }
 
-        if(ret != RET_OK)
-        {
-
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-        //
-        // Batch 1
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(1, &d4, &d5, &d6) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 1."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 1);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-              //
-        // Batch 2
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(2, &d7, &d8, nullptr) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 2."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 2);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-        //
-        // All data received successfully, fill strcture
-        //
-        data->dissolved_oxygen = d1;
-        data->temperature = d3;
-        data->conductivity = d4;
-        data->ph = d5;
-        data->orp = d6;
-        data->pressure = d7;
-        data->depth_cm = d8;
-        data->depth_ft = data->depth_cm * 0.032808399;
-
-        // If all fields 0 return error even if CRC is OK
-        if(data->dissolved_oxygen == 0 && data->temperature == 0 && data->conductivity == 0 && data->ph == 0 && 
-        data->orp == 0 && data->pressure == 0 && data->depth_cm == 0 && data->depth_ft == 0)
-        {
-            debug_println(F("All measured vals are 0, aborting."));
-            Log::log(Log::WATER_QUALITY_ZERO_VALS);
-            return RET_ERROR;
-        }
-
-        Utils::serial_style(STYLE_GREEN);
-        debug_println(F("All water quality data is received successfully."));
-        Utils::serial_style(STYLE_RESET);
-
-        return RET_OK;
+        return NULL;
     }
 
     /******************************************************************************
      * Send measure command to the sensor and fill data structure
-     * Aquatroll is configured to return the following measurements (in this order):
-     * RDO - Dissolved Oxygen (concentration) - mg/L
-     * RDO - Dissolved Oxygen (%saturation) - %Sat
-     * Cond - Temperature - C
-     * Cond - Specific Conductivity - uS/cm
-     * pH/ORP - ph -pH
-     * pH/ORP - Oxidation Reductino Potential (ORP) - mV
-     * Pres 30ft - Pressure - PSI
-     * Pres 30ft - Depth - ft
+     * @param model Model measured
      * @param data Output structure
+     * @param address Sensor bus address
      ******************************************************************************/
-    RetResult measure_aquatroll500(WaterSensorData::Entry *data)
+    RetResult measure_model(const ModelDescriptor *model, WaterSensorData::Entry *data, char address)
     {
-        debug_println("Measuring water quality.");
+        debug_print(F("Measuring water quality: "));
+        debug_println(model->name);
 
         // Return dummy values switch
         if(FLAGS.MEASURE_DUMMY_WATER_QUALITY)
@@ -283,8 +139,8 @@ namespace Aquatroll
         // Zero structure
         memset(data, 0, sizeof(WaterSensorData::Entry));
 
-        // I2C slave SDI12 adapter
         Sdi12Sensor sensor(PIN_SDI12_DATA);
+        sensor.set_address(address);
 
         // Output variables
         // Seconds to wait
@@ -307,167 +163,44 @@ namespace Aquatroll
             return RET_ERROR;
         }
 
+        PowerControl::ready(PowerControl::DEVICE_AQUATROLL);
+
         // Check if seconds within range. Range values are chosen empirically.
         // If values not within range, something is wrong with the response or with the
         // configuration of Aquatroll
         if(secs_to_wait > AQUATROLL_MEASURE_WAIT_SEC_MAX)
         {
             debug_println(F("Invalid number of seconds to wait for measurements."));
-            Serial.print(F("Seconds to wait: "));
-            Serial.println(secs_to_wait, DEC);
+            debug_print(F("Seconds to wait: "));
+            debug_println(secs_to_wait, DEC);
             return RET_ERROR;
         }
         // The exact number of measured values is known and configured into Aquatroll
-        if(measured_values != AQUATROLL500_NUMBER_OF_MEASUREMENTS)
+        if(measured_values != model->value_count)
         {
             debug_print(F("Invalid number of measured values. Expected: "));
-            debug_println(AQUATROLL500_NUMBER_OF_MEASUREMENTS, DEC);
-            Serial.print(F("Returned: "));
-            Serial.println(measured_values, DEC);
+            debug_println(model->value_count, DEC);
+            debug_print(F("Returned: "));
+            debug_println(measured_values, DEC);
             return RET_ERROR;
         }
 
-
-        // TODO: 
-        // When sleeping, pins go low and sensor is disabled.
-        // Use RTC GPIO so power pin  can stay high and ESP32 can sleep instead of waiting
-        debug_print(F("Waiting (sec): "));
-        debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
-        delay((secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000);
+        sensor.wait_measurement(secs_to_wait, PIN_WATER_SENSORS_PWR);
 
         //
         // Request measurement data
-        //
-        WaterSensorData::Entry sensor_data = {0};
-
-        // Vars to receive all the measurement data
         // Data will be copied to output structure only after successfull measurement
-        float d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0, d7 = 0, d8 = 0;
-
-        //
-        // Batch 0
         //
-        int tries = 3;
-        RetResult ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(0, &d1, &d2, &d3) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 0."));
-
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 0);
+        float values[AQUATROLL_MAX_VALUES] = {0};
 
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
+        if(read_batches(&sensor, values, model->value_count) != RET_OK)
         {
-
             debug_println(F("Aborting"));
             return RET_ERROR;
         }
 
-        //
-        // Batch 1
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(1, &d4, &d5, &d6) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 1."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 1);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-        //
-        // Batch 2
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(2, &d7, &d8, nullptr) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 2."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 2);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-        //
-        // All data received successfully, fill strcture
-        //
-        data->dissolved_oxygen = d1;
-        data->temperature = d3;
-        data->conductivity = d4;
-        data->ph = d5;
-        data->orp = d6;
-        data->pressure = d7;
-        data->depth_ft = d8;
-        data->depth_cm = data->depth_ft * 30.48f;
-
-        // If all fields 0 return error even if CRC is OK
-        if(data->dissolved_oxygen == 0 && data->temperature == 0 && data->conductivity == 0 && data->ph == 0 && 
-        data->orp == 0 && data->pressure == 0 && data->depth_cm == 0 && data->depth_ft == 0)
-        {
-            debug_println(F("All measured vals are 0, aborting."));
-            Log::log(Log::WATER_QUALITY_ZERO_VALS);
+        if(fill_entry(model, values, model->value_count, data) != RET_OK)
             return RET_ERROR;
-        }
 
         Utils::serial_style(STYLE_GREEN);
         debug_println(F("All water quality data is received successfully."));
@@ -477,218 +210,89 @@ namespace Aquatroll
     }
 
     /******************************************************************************
-     * Send measure command to the sensor and fill data structure
-     * Aquatroll is configured to return the following measurements (in this order):
-     * RDO - Dissolved Oxygen (concentration) - mg/L
-     * RDO - Dissolved Oxygen (%saturation) - %Sat
-     * Cond - Temperature - C
-     * Cond - Specific Conductivity - uS/cm
-     * Pres 30ft - Pressure - PSI
-     * Pres 30ft - Depth - ft
-     * Turb - Total suspended solids
-     * @param data Output structure
+     * Request data batches (aD0! to aD9!) until all expected values are received.
+     * A failed batch is requested again, up to AQUATROLL_BATCH_TRIES times, the
+     * batches already received are kept
+     * @param values Receives the values
+     * @param expected Number of values the sensor said it will return
      ******************************************************************************/
-    RetResult measure_aquatroll600(WaterSensorData::Entry *data)
+    RetResult read_batches(Sdi12Sensor *sensor, float *values, uint8_t expected)
     {
-        debug_println("Measuring water quality.");
+        uint8_t received = 0;
 
-        // Return dummy values switch
-        if(FLAGS.MEASURE_DUMMY_WATER_QUALITY)
+        for(uint8_t batch = 0; batch < 10 && received < expected; batch++)
         {
-            return measure_dummy(data);
-        }
-
-        // Zero structure
-        memset(data, 0, sizeof(WaterSensorData::Entry));
-
-        // I2C slave SDI12 adapter
-        Sdi12Sensor sensor(PIN_SDI12_DATA);
+            uint8_t count = 0;
+            int tries = AQUATROLL_BATCH_TRIES;
 
-        // Output variables
-        // Seconds to wait
-        uint16_t secs_to_wait = 0;
-        // Vals to be measured
-        uint8_t measured_values = 0;
-
-        if(sensor.measure(&secs_to_wait, &measured_values) != RET_OK)
-        {
-            Sdi12Sensor::ErrorCode error = sensor.get_last_error();
-            if(error == Sdi12Sensor::ERROR_INVALID_RESPONSE)
+            while(tries--)
             {
-                debug_println(F("Invalid response returned."));
-
-                Log::log(Log::WATER_QUALITY_INVALID_RESPONSE);
-
-                return RET_ERROR;
-            }
-
-            return RET_ERROR;
-        }
-
-        // Check if seconds within range. Range values are chosen empirically.
-        // If values not within range, something is wrong with the response or with the
-        // configuration of Aquatroll
-        if(secs_to_wait > AQUATROLL_MEASURE_WAIT_SEC_MAX)
-        {
-            debug_println(F("Invalid number of seconds to wait for measurements."));
-            Serial.print(F("Seconds to wait: "));
-            Serial.println(secs_to_wait, DEC);
-            return RET_ERROR;
-        }
-        // The exact number of measured values is known and configured into Aquatroll
-        if(measured_values != AQUATROLL600_NUMBER_OF_MEASUREMENTS)
-        {
-            debug_print(F("Invalid number of measured values. Expected: "));
-            debug_println(AQUATROLL600_NUMBER_OF_MEASUREMENTS, DEC);
-            Serial.print(F("Returned: "));
-            Serial.println(measured_values, DEC);
-            return RET_ERROR;
-        }
-
+                if(sensor->read_values(batch, &values[received], expected - received, &count) == RET_OK && count > 0)
+                    break;
 
-        // TODO: 
-        // When sleeping, pins go low and sensor is disabled.
-        // Use RTC GPIO so power pin  can stay high and ESP32 can sleep instead of waiting
-        debug_print(F("Waiting (sec): "));
-        debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
-        delay((secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000);
+                debug_print(F("Could not get measurement results for batch: "));
+                debug_println(batch, DEC);
 
-        //
-        // Request measurement data
-        //
-        WaterSensorData::Entry sensor_data = {0};
+                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, batch);
 
-        // Vars to receive all the measurement data
-        // Data will be copied to output structure only after successfull measurement
-        float d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0, d7 = 0;
-
-        //
-        // Batch 0
-        //
-        int tries = 3;
-        RetResult ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(0, &d1, &d2, &d3) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 0."));
-
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 0);
+                count = 0;
 
                 if(tries > 0)
                 {
                     debug_println(F("Retrying"));
                 }
-                else
-                {
-                    ret = RET_ERROR;
-                }
             }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
 
-        if(ret != RET_OK)
-        {
+            if(count == 0)
+                return RET_ERROR;
 
-            debug_println(F("Aborting"));
-            return RET_ERROR;
+            received += count;
         }
 
-        //
-        // Batch 1
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(1, &d4, &d5, &d6) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 1."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 1);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
+        return received == expected ? RET_OK : RET_ERROR;
+    }
 
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
+    /******************************************************************************
+     * Store measured values of a model in the entry fields, eg. values collected
+     * by Sdi12Bus. The depth not measured is derived from the other
+     * @param values Values in sensor order
+     * @param count Number of values, must match the model
+     * @return RET_ERROR if count does not match or all values are 0
+     ******************************************************************************/
+    RetResult fill_entry(const ModelDescriptor *model, const float *values, uint8_t count, WaterSensorData::Entry *data)
+    {
+        if(count != model->value_count)
             return RET_ERROR;
-        }
 
-        //
-        // Batch 2
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        while(tries--)
+        bool all_zero = true;
+
+        for(int i = 0; i < count; i++)
         {
-            if(sensor.read_measurement_data(2, &d7, nullptr, nullptr) != RET_OK)
-            {
-                debug_println(F("Could not get measurement results for batch 2."));
-                Log::log(Log::WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, 2);
+            if(model->fields[i] == FIELD_NONE)
+                continue;
 
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
+            // Entry is packed
+            memcpy((uint8_t*)data + model->fields[i], &values[i], sizeof(float));
+            data->present |= WaterSensorData::present_bit(model->fields[i]);
 
-        if(ret != RET_OK)
-        {
-            debug_println(F("Aborting"));
-            return RET_ERROR;
+            if(values[i] != 0)
+                all_zero = false;
         }
 
-        //
-        // All data received successfully, fill strcture
-        //
-        data->dissolved_oxygen = d1;
-        data->temperature = d3;
-        data->conductivity = d4;
-        data->pressure = d5;
-        data->depth_ft = d6;
-        data->tss = d7;
-        data->depth_cm = data->depth_ft * 30.48f;
-
         // If all fields 0 return error even if CRC is OK
-        if(data->dissolved_oxygen == 0 && data->temperature == 0 && data->conductivity == 0 && data->pressure == 0 && 
-        data->pressure == 0 && data->depth_cm == 0 && data->depth_ft == 0 && data->tss == 0)
+        if(all_zero)
         {
             debug_println(F("All measured vals are 0, aborting."));
             Log::log(Log::WATER_QUALITY_ZERO_VALS);
             return RET_ERROR;
         }
 
-        Utils::serial_style(STYLE_GREEN);
-        debug_println(F("All water quality data is received successfully."));
-        Utils::serial_style(STYLE_RESET);
+        if(data->depth_ft != 0)
+            data->depth_cm = data->depth_ft * 30.48f;
+        else
+            data->depth_ft = data->depth_cm * 0.032808399;
+
+        data->present |= WaterSensorData::PRESENT_DEPTH_CM | WaterSensorData::PRESENT_DEPTH_FT;
 
         return RET_OK;
     }
@@ -712,6 +316,8 @@ namespace Aquatroll
         dummy.temperature += (float)random(-400, 400) / 100;
 
         memcpy(data, &dummy, sizeof(dummy));
+        data->present = WaterSensorData::PRESENT_TEMPERATURE | WaterSensorData::PRESENT_DISSOLVED_OXYGEN |
+            WaterSensorData::PRESENT_CONDUCTIVITY | WaterSensorData::PRESENT_PH | WaterSensorData::PRESENT_ORP;
 
         // Emulate waiting time
         delay(1000);
@@ -0,0 +1,292 @@
+#include "at_stream.h"
+#include "common.h"
+#include "log.h"
+#include "trace.h"
+
+/******************************************************************************
+* Constructor
+* @param stream Modem stream
+* @param echo Stream all traffic is echoed to, NULL for none
+******************************************************************************/
+AtStream::AtStream(Stream &stream, Stream *echo) : _stream(stream), _echo(echo)
+{
+	clear_stats();
+}
+
+/******************************************************************************
+* Bytes waiting from the modem. Polling task sleeps once polls keep coming back
+* empty, the caller is waiting for a response
+******************************************************************************/
+int AtStream::available()
+{
+	int count = _stream.available();
+
+	if(count > 0)
+	{
+		_idle_polls = 0;
+		return count;
+	}
+
+	if(_idle_polls < AT_STREAM_IDLE_POLLS)
+	{
+		_idle_polls++;
+		return 0;
+	}
+
+	vTaskDelay(pdMS_TO_TICKS(AT_STREAM_IDLE_WAIT_MS));
+	_idle_ms += AT_STREAM_IDLE_WAIT_MS;
+
+	return _stream.available();
+}
+
+int AtStream::peek()
+{
+	return _stream.peek();
+}
+
+void AtStream::flush()
+{
+	_stream.flush();
+}
+
+/******************************************************************************
+* Read a byte from the modem, final result codes end the pending command
+******************************************************************************/
+int AtStream::read()
+{
+	int c = _stream.read();
+
+	if(c >= 0)
+	{
+		on_rx(c);
+
+		if(_echo != NULL)
+			_echo->write(c);
+	}
+
+	return c;
+}
+
+/******************************************************************************
+* Write a byte to the modem, command lines start a measurement
+******************************************************************************/
+size_t AtStream::write(uint8_t c)
+{
+	on_tx(c);
+
+	if(_echo != NULL)
+		_echo->write(c);
+
+	return _stream.write(c);
+}
+
+size_t AtStream::write(const uint8_t *buffer, size_t size)
+{
+	for(size_t i = 0; i < size; i++)
+		on_tx(buffer[i]);
+
+	if(_echo != NULL)
+		_echo->write(buffer, size);
+
+	return _stream.write(buffer, size);
+}
+
+/******************************************************************************
+* Get latencies of a command group
+******************************************************************************/
+const AtStream::Stats* AtStream::get_stats(Command cmd)
+{
+	return &_stats[cmd];
+}
+
+/******************************************************************************
+* Log latencies of each command group seen since last clear, then clear
+******************************************************************************/
+void AtStream::log_stats()
+{
+	for(int cmd = 0; cmd < CMD_COUNT; cmd++)
+	{
+		const Stats *stats = &_stats[cmd];
+
+		if(stats->count == 0 && stats->timeouts == 0)
+			continue;
+
+		uint32_t count = stats->count > 0xFFF ? 0xFFF : stats->count;
+		uint32_t timeouts = stats->timeouts > 0xFF ? 0xFF : stats->timeouts;
+		uint32_t total_sec = stats->total_ms / 1000 > 0xFF ? 0xFF : stats->total_ms / 1000;
+
+		// Histogram as 4 bit counts, saturated
+		uint32_t hist = 0;
+		for(int i = 0; i < AT_LATENCY_BUCKETS; i++)
+			hist |= (uint32_t)(stats->hist[i] > 0xF ? 0xF : stats->hist[i]) << (i * 4);
+
+		debug_printf("AT %d: %u cmds, %u timeouts, %u ms, hist %08X\n", cmd, stats->count,
+			stats->timeouts, stats->total_ms, hist);
+
+		Log::log(Log::AT_LATENCY, cmd | (count << 4) | (timeouts << 16) | (total_sec << 24), hist);
+	}
+
+	debug_printf("Slept waiting for modem (ms): %u\n", _idle_ms);
+
+	clear_stats();
+}
+
+/******************************************************************************
+* Clear latencies
+******************************************************************************/
+void AtStream::clear_stats()
+{
+	memset(_stats, 0, sizeof(_stats));
+	_idle_ms = 0;
+}
+
+/******************************************************************************
+* Time slept in available() waiting for modem data since last clear
+******************************************************************************/
+uint32_t AtStream::get_idle_ms() const
+{
+	return _idle_ms;
+}
+
+/******************************************************************************
+* Track outgoing lines, a line starting with AT is a command
+******************************************************************************/
+void AtStream::on_tx(uint8_t c)
+{
+	if(c == '\r' || c == '\n')
+	{
+		if(_tx_line_len >= 2 && _tx_line[0] == 'A' && _tx_line[1] == 'T')
+		{
+			_tx_line[_tx_line_len < AT_STREAM_LINE_LEN ? _tx_line_len : AT_STREAM_LINE_LEN - 1] = '\0';
+
+			// Library moved on without a final result
+			if(_pending)
+				end_command(true);
+
+			_pending = true;
+			_pending_cmd = parse_command(_tx_line);
+			_pending_start_ms = millis();
+		}
+
+		_tx_line_len = 0;
+		return;
+	}
+
+	if(_tx_line_len < AT_STREAM_LINE_LEN - 1)
+		_tx_line[_tx_line_len] = c;
+
+	_tx_line_len++;
+}
+
+/******************************************************************************
+* Track incoming lines, a final result code ends the pending command
+******************************************************************************/
+void AtStream::on_rx(uint8_t c)
+{
+	if(c == '\r' || c == '\n')
+	{
+		if(_rx_line_len > 0 && _pending)
+		{
+			_rx_line[_rx_line_len < AT_STREAM_LINE_LEN ? _rx_line_len : AT_STREAM_LINE_LEN - 1] = '\0';
+
+			if(is_final_result(_rx_line))
+				end_command(false);
+		}
+
+		_rx_line_len = 0;
+		return;
+	}
+
+	if(_rx_line_len < AT_STREAM_LINE_LEN - 1)
+		_rx_line[_rx_line_len] = c;
+
+	_rx_line_len++;
+}
+
+/******************************************************************************
+* End pending command and add its latency
+* @param timeout No final result received
+******************************************************************************/
+void AtStream::end_command(bool timeout)
+{
+	Stats *stats = &_stats[_pending_cmd];
+
+	_pending = false;
+
+	if(timeout)
+	{
+		stats->timeouts++;
+		return;
+	}
+
+	uint32_t elapsed_ms = millis() - _pending_start_ms;
+
+	int bucket = 0;
+	while(bucket < AT_LATENCY_BUCKETS - 1 && elapsed_ms >= AT_LATENCY_BUCKET_MS[bucket])
+		bucket++;
+
+	stats->count++;
+	stats->total_ms += elapsed_ms;
+	stats->hist[bucket]++;
+
+	// Every command only while detailed tracing is armed, too many otherwise
+	if(Trace::is_armed())
+		Trace::record(Trace::SPAN_AT, Trace::now_us() - (int64_t)elapsed_ms * 1000);
+}
+
+/******************************************************************************
+* Command group of a command line
+******************************************************************************/
+AtStream::Command AtStream::parse_command(const char *line)
+{
+	// Skip AT and extended command prefix
+	const char *name = line + 2;
+	if(*name == '+')
+		name++;
+
+	// Registration status polled while attaching (GSM, GPRS, EPS)
+	if(strncmp(name, "CREG", 4) == 0 || strncmp(name, "CGREG", 5) == 0 || strncmp(name, "CEREG", 5) == 0)
+		return CMD_CREG;
+
+	if(strncmp(name, "CGATT", 5) == 0)
+		return CMD_CGATT;
+
+	if(strncmp(name, "CIPSTART", 8) == 0)
+		return CMD_CIPSTART;
+
+	if(strncmp(name, "CIPSEND", 7) == 0)
+		return CMD_CIPSEND;
+
+	// SIM800 HTTP and SIM7000 native HTTP(S) client
+	if(strncmp(name, "HTTP", 4) == 0 || strncmp(name, "SH", 2) == 0)
+		return CMD_HTTP;
+
+	return CMD_OTHER;
+}
+
+/******************************************************************************
+* Check if line is a final result code of the pending command. CIPSTART
+* answers OK right away and its result comes with CONNECT OK/FAIL
+******************************************************************************/
+bool AtStream::is_final_result(const char *line)
+{
+	if(strncmp(line, "ERROR", 5) == 0 || strncmp(line, "+CME ERROR", 10) == 0 ||
+		strncmp(line, "+CMS ERROR", 10) == 0)
+		return true;
+
+	if(_pending_cmd == CMD_CIPSTART)
+	{
+		// Multi connection mode prefixes the mux number (eg. "0, CONNECT OK")
+		return strstr(line, "CONNECT OK") != NULL || strstr(line, "CONNECT FAIL") != NULL ||
+			strstr(line, "ALREADY CONNECT") != NULL;
+	}
+
+	if(_pending_cmd == CMD_CIPSEND)
+	{
+		if(strstr(line, "SEND OK") != NULL || strstr(line, "SEND FAIL") != NULL ||
+			strstr(line, "DATA ACCEPT") != NULL)
+			return true;
+	}
+
+	return strcmp(line, "OK") == 0;
+}
@@ -4,11 +4,34 @@
 #include "rtc.h"
 #include "log.h"
 #include "sdi12_sensor.h"
+#include "sdi12_registry.h"
 #include "atmos41_data.h"
 #include "common.h"
+#include "energy_profiler.h"
+#include "power_control.h"
+#include "device_config.h"
+#include "board_features.h"
+
+#if FEATURE_ATMOS41
 
 namespace Atmos41
 {
+    //
+    // Private functions
+    //
+    RetResult read_values(Sdi12Sensor *sensor, bool continuous, Atmos41Data::Entry *data);
+    RetResult read_batch(Sdi12Sensor *sensor, bool continuous, uint8_t batch, float *d1, float *d2, float *d3);
+    RetResult parse_values(const float *values, Atmos41Data::Entry *data);
+    RetResult finish_log(RetResult ret, Atmos41Data::Entry *data);
+    bool keep_powered();
+
+    //
+    // Private vars
+    //
+    /** Sensor was kept powered since the last reading (parked), so continuous
+     * values are up to date */
+    bool _kept_powered = false;
+
 	/******************************************************************************
      * Initialization
      ******************************************************************************/
@@ -19,46 +42,33 @@ namespace Atmos41
 
     /******************************************************************************
      * Turn weather station ON
-     * TODO: Same power source as the water sensors, so turning on/off affects them
-     * as well. To be moved to own power source and switch.
+     * Shares the sensor rail with the water sensors (see PowerControl)
      ******************************************************************************/
 	RetResult on()
 	{
 		debug_println(F("Atmos41 ON."));
 
-		#ifdef TCALL_H
-			// Turn IP5306 power boost OFF to reduce idle current
-			Utils::ip5306_set_power_boost_state(true);
-		#endif
-
-		digitalWrite(PIN_WATER_SENSORS_PWR, 1);
-		delay(WATER_SENSORS_POWER_ON_DELAY_MS);
+		_kept_powered = PowerControl::is_parked(PowerControl::DEVICE_ATMOS41);
 
-        return RET_OK;
+		return PowerControl::acquire(PowerControl::DEVICE_ATMOS41);
 	}
 
     /******************************************************************************
-     * Turn weather station OFF
-     * TODO: Same power source as the water sensors, so turning on/off affects them
-     * as well. To be moved to own power source and switch.
+     * Turn weather station OFF, rail stays on if other devices hold it
      *****************************************************************************/
 	RetResult off()
 	{
 		debug_println(F("Atmos41 OFF."));
 
-		digitalWrite(PIN_WATER_SENSORS_PWR, 0);
-		delay(100);
-
-		#ifdef TCALL_H
-			// Turn IP5306 power boost OFF to reduce idle current
-			Utils::ip5306_set_power_boost_state(false);
-		#endif
+		PowerControl::release(PowerControl::DEVICE_ATMOS41);
 
         return RET_OK;
 	}
 
     /******************************************************************************
-     * Send measure command to the sensor and fill data structure
+     * Send measure command to the sensor and fill data structure. Reads the
+     * continuous values instead when the sensor was kept powered since the last
+     * reading, falling back to a measure command if that fails
      * @param data Output structure
      ******************************************************************************/
     RetResult measure(Atmos41Data::Entry *data)
@@ -75,6 +85,17 @@ namespace Atmos41
         memset(data, 0, sizeof(Atmos41Data::Entry));
 
         Sdi12Sensor sensor(PIN_SDI12_DATA);
+        sensor.set_address(Sdi12Registry::get_address(Sdi12Registry::MODEL_ATMOS41));
+
+        if(_kept_powered)
+        {
+            debug_println(F("Kept powered, reading continuous values."));
+
+            if(read_values(&sensor, true, data) == RET_OK)
+                return RET_OK;
+
+            debug_println(F("Continuous read failed, measuring."));
+        }
 
         // Output variables
         // Seconds to wait
@@ -95,6 +116,8 @@ namespace Atmos41
             return RET_ERROR;
         }
 
+        PowerControl::ready(PowerControl::DEVICE_ATMOS41);
+
         // Check if seconds within range. Range values are chosen empirically.
         // If values not within range, something is wrong with the response or with the
         // configuration of sensor
@@ -112,158 +135,57 @@ namespace Atmos41
         }
 
 
-        // TODO: 
-        // When sleeping, pins go low and sensor is disabled.
-        // Use RTC GPIO so power pin  can stay high and ESP32 can sleep instead of waiting
-        debug_print(F("Waiting (sec): "));
-        debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
-        delay((secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000);
+        sensor.wait_measurement(secs_to_wait, PIN_WATER_SENSORS_PWR);
 
-        //
-        // Request measurement data
-        // 
-        Atmos41Data::Entry weather_data;
+        return read_values(&sensor, false, data);
+    }
 
+    /******************************************************************************
+     * Request all measurement values, by batch, and fill data structure
+     * @param sensor Sensor to read
+     * @param continuous Read continuous values (aRCx!) instead of the results of
+     *                   the last measure command (aDx!)
+     * @param data Output structure
+     ******************************************************************************/
+    RetResult read_values(Sdi12Sensor *sensor, bool continuous, Atmos41Data::Entry *data)
+    {
         // Vars to receive all the measurement data
         // Data will be copied to output structure only after successfull measurement
-        float d1 = 0, d2 = 0, d3 = 0;
-
-        // Tries requesting data before aborting
-        int tries = 3;
-
-        //
-        // Batch 0
-        //
-        tries = 3;
-        uint8_t batch = 0;
-        RetResult ret = RET_ERROR;
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(batch, &d1, &d2, &d3) != RET_OK)
-            {
-                debug_print(F("Could not get measurement results for batch: "));
-                debug_println(batch, DEC);
-
-                Log::log(Log::WEATHER_STATION_MEASUREMENT_DATA_REQ_FAILED, batch);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-
-                delay(500);
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
-
-        if(ret != RET_OK)
-        {
-
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
-
-		weather_data.solar = d1;
-		weather_data.precipitation = d2;
-		weather_data.strikes = d3;
-
-        //
-        // Batch 1
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        batch = 1;
-
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(batch, &d1, &d2, &d3) != RET_OK)
-            {
-                debug_print(F("Could not get measurement results for batch: "));
-                debug_println(batch, DEC);
-
-                Log::log(Log::WEATHER_STATION_MEASUREMENT_DATA_REQ_FAILED, batch);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
-
-                delay(500);
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
+        float values[WEATHER_STATION_NUMBER_OF_MEASUREMENTS] = {0};
 
-        if(ret != RET_OK)
+        // Batches of 3 values
+        for(uint8_t batch = 0; batch < WEATHER_STATION_NUMBER_OF_MEASUREMENTS / 3; batch++)
         {
+            float *d = &values[batch * 3];
 
-            debug_println(F("Aborting"));
-            return RET_ERROR;
+            if(read_batch(sensor, continuous, batch, &d[0], &d[1], &d[2]) != RET_OK)
+                return RET_ERROR;
         }
 
-    	weather_data.wind_speed = d1;
-		weather_data.wind_dir = d2;
-		weather_data.wind_gust_speed = d3;
-
-		//
-        // Batch 2
-        //
-        tries = 3;
-        ret = RET_ERROR;
-        batch = 2;
-
-        while(tries--)
-        {
-            if(sensor.read_measurement_data(batch, &d1, &d2, &d3) != RET_OK)
-            {
-                debug_print(F("Could not get measurement results for batch: "));
-                debug_println(batch, DEC);
-
-                Log::log(Log::WEATHER_STATION_MEASUREMENT_DATA_REQ_FAILED, batch);
-
-                if(tries > 0)
-                {
-                    debug_println(F("Retrying"));
-                }
-                else
-                {
-                    ret = RET_ERROR;
-                }
+        return parse_values(values, data);
+    }
 
-                delay(500);
-            }
-            else
-            {
-                ret = RET_OK;
-                break;
-            }
-        }
+    /******************************************************************************
+     * Fill data structure from measured values, derived values are calculated
+     * @param values WEATHER_STATION_NUMBER_OF_MEASUREMENTS values in measurement
+     *               order
+     * @param data Output structure
+     ******************************************************************************/
+    RetResult parse_values(const float *values, Atmos41Data::Entry *data)
+    {
+        Atmos41Data::Entry weather_data;
 
-        if(ret != RET_OK)
-        {
+		weather_data.solar = values[0];
+		weather_data.precipitation = values[1];
+		weather_data.strikes = values[2];
 
-            debug_println(F("Aborting"));
-            return RET_ERROR;
-        }
+    	weather_data.wind_speed = values[3];
+		weather_data.wind_dir = values[4];
+		weather_data.wind_gust_speed = values[5];
 
-		weather_data.air_temp = d1;
-		weather_data.vapor_pressure = d2;
-		weather_data.atm_pressure = d3;
+		weather_data.air_temp = values[6];
+		weather_data.vapor_pressure = values[7];
+		weather_data.atm_pressure = values[8];
 
         // Convert pressure to hPa from kPa
         weather_data.atm_pressure *= 10;
@@ -293,6 +215,57 @@ namespace Atmos41
         return RET_OK;
     }
 
+    /******************************************************************************
+     * Request a batch of 3 values, with retries
+     * @param continuous Continuous values (aRCx!) instead of measurement results
+     ******************************************************************************/
+    RetResult read_batch(Sdi12Sensor *sensor, bool continuous, uint8_t batch, float *d1, float *d2, float *d3)
+    {
+        float d[3] = {0};
+        uint8_t count = 0;
+
+        // Tries requesting data before aborting
+        int tries = 3;
+
+        while(tries--)
+        {
+            RetResult ret = RET_ERROR;
+
+            if(continuous)
+                ret = sensor->read_continuous(batch, d, 3, &count) == RET_OK && count == 3 ? RET_OK : RET_ERROR;
+            else
+                ret = sensor->read_measurement_data(batch, d1, d2, d3);
+
+            if(ret == RET_OK)
+            {
+                if(continuous)
+                {
+                    *d1 = d[0];
+                    *d2 = d[1];
+                    *d3 = d[2];
+                }
+
+                return RET_OK;
+            }
+
+            debug_print(F("Could not get measurement results for batch: "));
+            debug_println(batch, DEC);
+
+            Log::log(Log::WEATHER_STATION_MEASUREMENT_DATA_REQ_FAILED, batch);
+
+            if(tries > 0)
+            {
+                debug_println(F("Retrying"));
+            }
+
+            delay(500);
+        }
+
+        debug_println(F("Aborting"));
+
+        return RET_ERROR;
+    }
+
     /******************************************************************************
 	* Read weather station and log data in memory
 	******************************************************************************/
@@ -309,9 +282,49 @@ namespace Atmos41
             return RET_ERROR;
         }
 
-        RetResult ret = Atmos41::measure(&data);
+        RetResult ret = RET_ERROR;
+
+        while((ret = Atmos41::measure(&data)) != RET_OK && PowerControl::retry_warming_up(PowerControl::DEVICE_ATMOS41));
+
+        return finish_log(ret, &data);
+    }
+
+    /******************************************************************************
+	* Log values measured by the caller, eg. together with other sensors on the
+    * bus (see Sdi12Bus). The sensor must have been turned on with on()
+    * @param values Values in measurement order
+    * @param count Number of values received
+	******************************************************************************/
+	RetResult log_values(const float *values, uint8_t count)
+	{
+        Atmos41Data::Entry data;
+
+        Log::log(Log::WEATHER_STATION_MEASUREMENT_LOG);
+
+        RetResult ret = RET_ERROR;
+
+        if(count == WEATHER_STATION_NUMBER_OF_MEASUREMENTS)
+            ret = parse_values(values, &data);
 
-        Atmos41::off();
+        return finish_log(ret, &data);
+    }
+
+    /******************************************************************************
+	* Turn sensor off or keep it powered and save data if measured
+    * @param ret Result of the measurement
+	******************************************************************************/
+	RetResult finish_log(RetResult ret, Atmos41Data::Entry *data)
+	{
+        // Keep powered for the next reading if it is soon. Failed sensor is reset
+        if(ret == RET_OK && keep_powered())
+        {
+            uint32_t interval_secs = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WEATHER_STATION) * 60;
+            PowerControl::park(PowerControl::DEVICE_ATMOS41, RTC::get_timestamp() + interval_secs + ATMOS41_KEEP_POWERED_MARGIN_SECS);
+        }
+        else
+        {
+            Atmos41::off();
+        }
 
         if(ret == RET_ERROR)
         {
@@ -320,17 +333,28 @@ namespace Atmos41
             return RET_ERROR;
         }
 
-        data.timestamp = RTC::get_timestamp();
+        data->timestamp = RTC::get_timestamp();
 
         debug_println(F("Weather data:"));
-		Atmos41Data::print(&data);
+		Atmos41Data::print(data);
 
-		Atmos41Data::add(&data);
+		Atmos41Data::add(data);
 		Atmos41Data::get_store()->commit();
 
         return ret;
     }
 
+    /******************************************************************************
+     * Check if sensor is kept powered between readings, when read interval is
+     * short enough (see ATMOS41_KEEP_POWERED_MAX_INT_MINS)
+     *****************************************************************************/
+    bool keep_powered()
+    {
+        int interval_mins = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WEATHER_STATION);
+
+        return interval_mins > 0 && interval_mins <= ATMOS41_KEEP_POWERED_MAX_INT_MINS;
+    }
+
     /******************************************************************************
      * Fill weather data struct with dummy data
      * Used for debugging only
@@ -384,4 +408,6 @@ namespace Atmos41
 
         return RET_OK;
     }
-}
\ No newline at end of file
+}
+
+#endif
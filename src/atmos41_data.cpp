@@ -2,8 +2,13 @@
 #include "CRC32.h"
 #include "utils.h"
 #include "common.h"
+#include "deadband.h"
+#include "retention.h"
 
 #include "data_store.h"
+#include "board_features.h"
+
+#if FEATURE_ATMOS41
 
 namespace Atmos41Data
 {
@@ -13,7 +18,8 @@ namespace Atmos41Data
 	 * This way if a request succeeds, a whole file can be deleted, if not the file remains
 	 * to be resent at a later time
 	 */
-    DataStore<Atmos41Data::Entry> store(ATMOS41_DATA_PATH, ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ);
+    DataStore<Atmos41Data::Entry> store(ATMOS41_DATA_PATH, ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ,
+		Retention::on_evict<Atmos41Data::Entry, SENSOR_STORE_ATMOS41>);
 
     /******************************************************************************
     * Add water weather data to storage
@@ -21,6 +27,10 @@ namespace Atmos41Data
     ******************************************************************************/
     RetResult add(Atmos41Data::Entry *data)
     {
+		// Unchanged within deadbands, left out
+		if(!Deadband::should_store(SENSOR_STORE_ATMOS41, data))
+			return RET_OK;
+
 		RetResult ret = store.add(data);
 
 		// Commit on every add
@@ -83,4 +93,6 @@ namespace Atmos41Data
 
 		Utils::print_separator(NULL);
 	}
-}
\ No newline at end of file
+}
+
+#endif
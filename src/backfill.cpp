@@ -0,0 +1,138 @@
+#include "backfill.h"
+#include "store_registry.h"
+#include "device_config.h"
+#include "log.h"
+#include "common.h"
+
+namespace Backfill
+{
+	//
+	// Private functions
+	//
+	uint32_t get_pending_mask();
+	RetResult set_pending_mask(uint32_t mask);
+
+	//
+	// Private vars
+	//
+	/** Stores with backfilled entries left, bit per StoreId */
+	uint32_t _pending_mask = 0;
+
+	/** Pending mask has been loaded from DeviceConfig */
+	bool _pending_loaded = false;
+
+	/******************************************************************************
+	 * Copy archived entries of a time range to the backfill twins of stores
+	 * @param from Oldest entry timestamp
+	 * @param to Newest entry timestamp
+	 * @param store_mask Bit per StoreId, 0 for every telemetry store
+	 *****************************************************************************/
+	RetResult request(uint32_t from, uint32_t to, uint32_t store_mask)
+	{
+		if(!FLAGS.STORE_ARCHIVE || from > to)
+			return RET_ERROR;
+
+		uint32_t mask = get_pending_mask();
+		int staged_entries = 0;
+		RetResult ret = RET_OK;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			const StoreRegistry::StoreDescriptor *store = StoreRegistry::get((StoreId)i);
+
+			if(!store->telemetry || (store_mask != 0 && !(store_mask & (1UL << i))))
+				continue;
+
+			int count = store->ops->stage_backfill(from, to);
+
+			debug_print(F("Backfill entries of store "));
+			debug_print(store->name);
+			debug_print(F(": "));
+			debug_println(count);
+
+			if(count < 0)
+			{
+				ret = RET_ERROR;
+				continue;
+			}
+
+			staged_entries += count;
+
+			if(count > 0)
+				mask |= 1UL << i;
+		}
+
+		set_pending_mask(mask);
+
+		Log::log(Log::BACKFILL_REQUESTED, staged_entries, mask);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Check if a store has backfilled entries to submit
+	 *****************************************************************************/
+	bool is_pending(StoreId id)
+	{
+		return get_pending_mask() & (1UL << id);
+	}
+
+	/******************************************************************************
+	 * Drop stores whose backfilled entries have all been submitted. Called after
+	 * telemetry submission
+	 *****************************************************************************/
+	void update()
+	{
+		uint32_t mask = get_pending_mask();
+
+		if(mask == 0)
+			return;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			if((mask & (1UL << i)) && !StoreRegistry::get((StoreId)i)->ops->backfill_pending())
+				mask &= ~(1UL << i);
+		}
+
+		if(mask != _pending_mask)
+		{
+			set_pending_mask(mask);
+
+			if(mask == 0)
+				Log::log(Log::BACKFILL_COMPLETE);
+		}
+	}
+
+	/******************************************************************************
+	 * Get stores with backfilled entries left
+	 *****************************************************************************/
+	uint32_t get_pending_mask()
+	{
+		if(!_pending_loaded)
+		{
+			_pending_loaded = true;
+
+			DeviceConfig::BackfillState state;
+			_pending_mask = DeviceConfig::get_backfill_state(&state) == RET_OK ? state.store_mask : 0;
+		}
+
+		return _pending_mask;
+	}
+
+	/******************************************************************************
+	 * Persist stores with backfilled entries left
+	 *****************************************************************************/
+	RetResult set_pending_mask(uint32_t mask)
+	{
+		_pending_mask = mask;
+		_pending_loaded = true;
+
+		if(mask == 0)
+			return DeviceConfig::clear_backfill_state();
+
+		DeviceConfig::BackfillState state;
+		state.store_mask = mask;
+
+		return DeviceConfig::set_backfill_state(&state);
+	}
+}
@@ -0,0 +1,216 @@
+#include "backlog_drain.h"
+#include "const.h"
+#include "common.h"
+#include "utils.h"
+#include "log.h"
+#include "battery.h"
+#include "store_registry.h"
+#include "sleep_scheduler.h"
+
+namespace BacklogDrain
+{
+	//
+	// Private types
+	//
+	/** Drain progress. RTC_NOINIT memory survives deep sleep and resets (but not
+	 * power loss), so draining goes on over call homes */
+	struct State
+	{
+		uint32_t magic;
+		uint8_t active;
+
+		/** Telemetry store files when drain started */
+		int32_t start_files;
+
+		/** Telemetry store files at last count */
+		int32_t files_left;
+
+		uint32_t crc32;
+	}__attribute__((packed));
+
+	//
+	// Private functions
+	//
+	bool energy_allows();
+	void stop(int files);
+	void load_state();
+	void save_state();
+
+	//
+	// Private vars
+	//
+	RTC_NOINIT_ATTR State _state;
+
+	/** Telemetry sessions run this call home */
+	int _sessions = 0;
+
+	/** Telemetry store files when current session started */
+	int _session_start_files = 0;
+
+	/** Drain ended this call home, final progress is still published */
+	bool _ended = false;
+
+	/******************************************************************************
+	* Start or end drain mode, called when a call home starts
+	******************************************************************************/
+	void update()
+	{
+		load_state();
+
+		_sessions = 0;
+
+		int files = StoreRegistry::get_telemetry_file_count();
+		if(files < 0)
+			return;
+
+		_session_start_files = files;
+		_state.files_left = files;
+
+		if(_state.active)
+		{
+			if(!FLAGS.BACKLOG_DRAIN || files <= BACKLOG_DRAIN_EXIT_FILES ||
+				Battery::get_current_mode() != BATTERY_MODE::BATTERY_MODE_NORMAL)
+			{
+				stop(files);
+			}
+		}
+		else if(FLAGS.BACKLOG_DRAIN && files >= BACKLOG_DRAIN_ENTER_FILES && energy_allows())
+		{
+			debug_printf("Backlog drain started, files: %d\n", files);
+			Log::log(Log::BACKLOG_DRAIN, files, 1);
+
+			_state.active = true;
+			_state.start_files = files;
+		}
+
+		save_state();
+	}
+
+	/******************************************************************************
+	* Telemetry session done, count its progress
+	* @param ok Session was not aborted
+	* @return Run another session on the same attach
+	******************************************************************************/
+	bool next_session(bool ok)
+	{
+		if(!is_active())
+			return false;
+
+		_sessions++;
+
+		int files = StoreRegistry::get_telemetry_file_count();
+		if(files < 0)
+			return false;
+
+		int deleted = _session_start_files - files;
+
+		_session_start_files = files;
+		_state.files_left = files;
+		save_state();
+
+		debug_printf("Drain session %d deleted files: %d, left: %d (%u%%)\n", _sessions, deleted, files, get_percent());
+
+		if(files <= BACKLOG_DRAIN_EXIT_FILES)
+		{
+			stop(files);
+			return false;
+		}
+
+		// Link or server not keeping up, try again next call home
+		if(!ok || deleted < BACKLOG_DRAIN_MIN_SESSION_FILES)
+			return false;
+
+		return _sessions < BACKLOG_DRAIN_MAX_SESSIONS && energy_allows();
+	}
+
+	/******************************************************************************
+	* Drain mode is on
+	******************************************************************************/
+	bool is_active()
+	{
+		return FLAGS.BACKLOG_DRAIN && _state.magic == BACKLOG_DRAIN_MAGIC && _state.active &&
+			Utils::crc32((uint8_t*)&_state, sizeof(_state) - sizeof(_state.crc32)) == _state.crc32;
+	}
+
+	/******************************************************************************
+	* Telemetry store files at last count
+	******************************************************************************/
+	int get_files_left()
+	{
+		return _state.files_left;
+	}
+
+	/******************************************************************************
+	* Share (%) of the backlog submitted since drain started
+	******************************************************************************/
+	uint8_t get_percent()
+	{
+		if(_state.start_files <= 0 || _state.files_left >= _state.start_files)
+			return 0;
+
+		if(_state.files_left <= 0)
+			return 100;
+
+		return (_state.start_files - _state.files_left) * 100 / _state.start_files;
+	}
+
+	/******************************************************************************
+	* Add drain progress to client attributes, while draining and once when done
+	******************************************************************************/
+	void add_attributes(JsonDocument &doc)
+	{
+		if(!is_active() && !_ended)
+			return;
+
+		doc[TB_ATTR_DRAIN_FILES_LEFT] = get_files_left();
+		doc[TB_ATTR_DRAIN_PERCENT] = _ended ? 100 : get_percent();
+	}
+
+	/******************************************************************************
+	* Battery is in normal mode and there is energy to spare
+	******************************************************************************/
+	bool energy_allows()
+	{
+		return Battery::get_current_mode() == BATTERY_MODE::BATTERY_MODE_NORMAL &&
+			SleepScheduler::has_energy_surplus();
+	}
+
+	/******************************************************************************
+	* Leave drain mode
+	******************************************************************************/
+	void stop(int files)
+	{
+		debug_printf("Backlog drain ended, files: %d\n", files);
+		Log::log(Log::BACKLOG_DRAIN, files, 0);
+
+		_state.active = false;
+		_ended = true;
+
+		save_state();
+	}
+
+	/******************************************************************************
+	* Reset state if RTC memory holds garbage (power loss)
+	******************************************************************************/
+	void load_state()
+	{
+		if(_state.magic == BACKLOG_DRAIN_MAGIC &&
+			Utils::crc32((uint8_t*)&_state, sizeof(_state) - sizeof(_state.crc32)) == _state.crc32)
+		{
+			return;
+		}
+
+		memset(&_state, 0, sizeof(_state));
+
+		save_state();
+	}
+
+	/******************************************************************************
+	* Update CRC of state in RTC memory
+	******************************************************************************/
+	void save_state()
+	{
+		_state.magic = BACKLOG_DRAIN_MAGIC;
+		_state.crc32 = Utils::crc32((uint8_t*)&_state, sizeof(_state) - sizeof(_state.crc32));
+	}
+}
@@ -6,6 +6,11 @@
 #include "app_config.h"
 #include "common.h"
 #include "lightning.h"
+#include "deep_sleep.h"
+#include "adc_manager.h"
+#include "energy_profiler.h"
+#include "ulp_monitor.h"
+#include "board_features.h"
 
 namespace Battery
 {
@@ -14,22 +19,28 @@ namespace Battery
     //
     BATTERY_MODE _last_battery_mode = BATTERY_MODE::BATTERY_MODE_NORMAL;
 
+    /** In sleep charge mode. Kept over deep sleep so sleep charge resumes on wake up */
+    bool _sleep_charging = false;
+
+    /** Wake ups since sleep charge mode started */
+    int _sleep_charge_wakeups = 0;
+
     //
     // Private functions
     //
     uint8_t mv_to_pct(uint16_t mv);
+    uint16_t pct_to_mv(uint8_t pct);
 
     /******************************************************************************
      * Init fuel
      ******************************************************************************/
     RetResult init()
     {
-        // Configure ADC
-       int analogSetCycles(ADC_CYCLES);
-
         pinMode(PIN_ADC_BAT, ANALOG);
         pinMode(PIN_ADC_SOLAR, ANALOG);
 
+        AdcManager::init();
+
         return RET_OK;
     }
 
@@ -40,36 +51,20 @@ namespace Battery
     RetResult read_adc(uint16_t *voltage, uint16_t *pct)
     {
         int tries = 3;
-        float avg_level = 0;
+        AdcManager::Reading reading = {};
 
-        while(tries--)
+        RetResult ret = AdcManager::read(AdcManager::CHANNEL_BATTERY, &reading);
+        while(ret != RET_OK && --tries > 0)
         {
-            int battery_vals[ADC_BATTERY_LEVEL_SAMPLES];
-            for (int i = 0; i < ADC_BATTERY_LEVEL_SAMPLES; i++)
-            {
-                battery_vals[i] = (uint32_t)analogRead(PIN_ADC_BAT);
-                delay(5);
-            }
-
-            // Serial.println(F("Values read: "));
-            // print_vals(battery_vals, ADC_BATTERY_LEVEL_SAMPLES);
+            debug_println_e(F("Too much noise, retrying"));
+            Sampling::print(&reading.stats);
 
-            int outliers = Utils::filter_outliers(battery_vals, ADC_BATTERY_LEVEL_SAMPLES, &avg_level);
-            
-            // Data is ok, done
-            if(outliers < ADC_BATTERY_LEVEL_SAMPLES / 2)
-                break;
-
-            // debug_println_e(F("Too much noise, retrying"));
-            // debug_print_e(F("Vals: "));
-            // debug_println(avg_level, DEC);
-
-            // print_vals(battery_vals, ADC_BATTERY_LEVEL_SAMPLES);
-
-            debug_println("\n----------------------------------");
+            AdcManager::sample(1 << AdcManager::CHANNEL_BATTERY);
+            ret = AdcManager::read(AdcManager::CHANNEL_BATTERY, &reading);
         }
 
-        uint16_t bat_mv = ((float)avg_level / 4096) * 3600 * 2;
+        // Compensate for 1/2 divider
+        uint16_t bat_mv = reading.mv * 2;
 
         *voltage = bat_mv;
         *pct = mv_to_pct(bat_mv);
@@ -79,12 +74,15 @@ namespace Battery
 
     /******************************************************************************
     * Measure battery voltage from ADC and log
+    * Solar is sampled in the same burst, for log_solar_adc() that usually follows
     ******************************************************************************/
     RetResult log_adc()
     {
         uint16_t voltage = 0;
         uint16_t pct = 0;
 
+        AdcManager::sample((1 << AdcManager::CHANNEL_BATTERY) | (1 << AdcManager::CHANNEL_SOLAR));
+
         if(read_adc(&voltage, &pct) == RET_ERROR)
         {
             return RET_ERROR;
@@ -169,6 +167,22 @@ namespace Battery
         return pct_out;
     }
 
+    /******************************************************************************
+     * Convert percentage to the lowest mV that reaches it (inverse of mv_to_pct)
+     *****************************************************************************/
+    uint16_t pct_to_mv(uint8_t pct)
+    {
+        const uint8_t array_size = sizeof(BATTERY_PCT_LUT) / sizeof(BATTERY_PCT_LUT[0]);
+
+        for(int i = 0; i < array_size; i++)
+        {
+            if(BATTERY_PCT_LUT[i].pct >= pct)
+                return BATTERY_PCT_LUT[i].mv;
+        }
+
+        return BATTERY_PCT_LUT[array_size - 1].mv;
+    }
+
     /******************************************************************************
      * Get battery mode depending on level
      *****************************************************************************/
@@ -228,24 +242,37 @@ namespace Battery
      * Battery is low, device goes into sleep charge mode where it sleeps and all
      * functions are disabled until battery is over the charged threshold.
      * Device wakes up from sleep every X mins to check.
+     * With deep sleep, boot calls this again on wake up and the mode resumes with
+     * the battery check.
      *****************************************************************************/
     void sleep_charge()
     {
-        if(Battery::get_current_mode() != BATTERY_MODE::BATTERY_MODE_SLEEP_CHARGE)
+        // Resuming after deep sleep, battery is checked right away
+        bool resumed = _sleep_charging;
+
+        if(!resumed && Battery::get_current_mode() != BATTERY_MODE::BATTERY_MODE_SLEEP_CHARGE)
             return;
 
-        debug_println(F("Battery critical, going into sleep charge mode."));
-        Log::log(Log::SLEEP_CHARGE);
+        if(!resumed)
+        {
+            debug_println(F("Battery critical, going into sleep charge mode."));
+            Log::log(Log::SLEEP_CHARGE);
+
+            //
+            // Prepare
+            //
+            // Turn lightning sensor OFF to prevent INTs waking up device
+#if FEATURE_LIGHTNING
+            if(FLAGS.LIGHTNING_SENSOR_ENABLED)
+                Lightning::off();
+#endif
+        
+            Battery::log_adc();
+            Battery::log_solar_adc();
 
-        //
-        // Prepare
-        //
-        // Turn lightning sensor OFF to prevent INTs waking up device
-        if(FLAGS.LIGHTNING_SENSOR_ENABLED)
-            Lightning::off();
-    
-        Battery::log_adc();
-        Battery::log_solar_adc();
+            _sleep_charging = true;
+            _sleep_charge_wakeups = 0;
+        }
 
         // Set sleep time and go to sleep
         uint64_t time_to_sleep_ms = SLEEP_CHARGE_CHECK_INT_MINS * 60000;
@@ -253,19 +280,44 @@ namespace Battery
         if(FLAGS.SLEEP_MINS_AS_SECS)
             time_to_sleep_ms /= 60;
 
+        // ULP checks the level, timer wake up is only a fallback
+        if(FLAGS.ULP_SLEEP_CHARGE)
+            time_to_sleep_ms = (uint64_t)SLEEP_CHARGE_ULP_FALLBACK_MINS * 60000;
+
         esp_sleep_pd_config(esp_sleep_pd_domain_t::ESP_PD_DOMAIN_RTC_PERIPH, esp_sleep_pd_option_t::ESP_PD_OPTION_ON);
         esp_sleep_enable_timer_wakeup((uint64_t)time_to_sleep_ms * 1000);
 
-        int wakeup_count = 0;
-
         while(true)
         {
-            debug_printf("Sleeping for (sec): %llu \n", time_to_sleep_ms / 1000);
-            Serial.flush();
-            esp_light_sleep_start();
+            if(!resumed)
+            {
+                // Restarted on every sleep, program stops its timer when it wakes the CPU up
+                if(FLAGS.ULP_SLEEP_CHARGE && UlpMonitor::start_battery(pct_to_mv(BATTERY_LEVEL_SLEEP_RECHARGED)) != RET_OK)
+                {
+                    time_to_sleep_ms = SLEEP_CHARGE_CHECK_INT_MINS * 60000;
+                    esp_sleep_enable_timer_wakeup((uint64_t)time_to_sleep_ms * 1000);
+                }
+
+                debug_printf("Sleeping for (sec): %llu \n", time_to_sleep_ms / 1000);
+                Serial.flush();
+
+                // Does not return, boot resumes sleep charge
+                if(DeepSleep::allowed(time_to_sleep_ms / 1000))
+                    DeepSleep::start(time_to_sleep_ms * 1000, DeepSleep::SOURCE_SLEEP_CHARGE);
+
+                EnergyProfiler::light_sleep();
+            }
+
+            resumed = false;
             debug_println(F("Wake up"));
 
-            wakeup_count++;
+            _sleep_charge_wakeups++;
+
+            if(FLAGS.ULP_SLEEP_CHARGE)
+            {
+                debug_printf("ULP woke up: %d | checks: %d | raw: %d\n", UlpMonitor::woke_up(),
+                    UlpMonitor::get_battery_checks(), UlpMonitor::get_last_battery_raw());
+            }
 
             uint16_t mv = 0, pct = 0;
             Battery::read_adc(&mv, &pct);		
@@ -273,13 +325,13 @@ namespace Battery
             if(pct < BATTERY_LEVEL_SLEEP_RECHARGED)
             {
                 debug_println(F("Battery level not quite there yet... Going back to sleep."));
-                Log::log(Log::SLEEP_CHARGE_CHECK, wakeup_count, mv);
+                Log::log(Log::SLEEP_CHARGE_CHECK, _sleep_charge_wakeups, mv);
             }
             else
             {
                 debug_println(F("Battery charged up to threshold. Exiting sleep charge mode."));
 
-                Log::log(Log::SLEEP_CHARGE_FINISHED, wakeup_count);
+                Log::log(Log::SLEEP_CHARGE_FINISHED, _sleep_charge_wakeups);
                 
                 Battery::log_adc();
                 
@@ -287,9 +339,16 @@ namespace Battery
             }
         }
 
+        _sleep_charging = false;
+
+        if(FLAGS.ULP_SLEEP_CHARGE)
+            UlpMonitor::stop();
+
         // Turn lightning back ON
+#if FEATURE_LIGHTNING
         if(FLAGS.LIGHTNING_SENSOR_ENABLED)
             Lightning::on();
+#endif
     }
 
     /******************************************************************************
@@ -299,7 +358,7 @@ namespace Battery
 	******************************************************************************/
 	RetResult read_solar_mv(uint16_t *voltage)
 	{
-        int mv = Utils::read_adc_mv(PIN_ADC_SOLAR, 10, 10);
+        int mv = AdcManager::read_mv(AdcManager::CHANNEL_SOLAR);
         
         if(mv < 0)
             return RET_ERROR;
@@ -346,4 +405,22 @@ namespace Battery
             break;
         }
     }
+
+    /******************************************************************************
+     * Save state to RTC memory before deep sleep
+     *****************************************************************************/
+    void save_state(RetainedState *state)
+    {
+        state->sleep_charging = _sleep_charging;
+        state->sleep_charge_wakeups = _sleep_charge_wakeups;
+    }
+
+    /******************************************************************************
+     * Restore state after waking up from deep sleep
+     *****************************************************************************/
+    void restore_state(const RetainedState *state)
+    {
+        _sleep_charging = state->sleep_charging;
+        _sleep_charge_wakeups = state->sleep_charge_wakeups;
+    }
 }
@@ -2,6 +2,9 @@
 
 namespace BatteryGauge
 {
+    /** Gauge inited. Warm boot skips init, done on first use */
+    bool _inited = false;
+
     /******************************************************************************
 	 * Init
 	 *****************************************************************************/
@@ -16,6 +19,10 @@ namespace BatteryGauge
 
         debug_print(F("Setting battery gauge capacity (mAh): "));
         debug_println(BAT_GAUGE_FULL_MAH, DEC);
+
+        _inited = true;
+
+        return RET_OK;
     }
 
     /******************************************************************************
@@ -23,7 +30,7 @@ namespace BatteryGauge
 	 *****************************************************************************/
     RetResult log()
     {
-        if(!FLAGS.BATTERY_GAUGE_ENABLED)
+        if(!FLAGS.BATTERY_GAUGE_ENABLED || (!_inited && init() != RET_OK))
             return RET_ERROR;
 
         debug_println(F("Logging battery gauge"));
@@ -32,12 +39,25 @@ namespace BatteryGauge
         return RET_OK;
     }
 
+    /******************************************************************************
+	 * Read charge left in battery
+	 *****************************************************************************/
+    RetResult read_mah(float *mah)
+    {
+        if(!FLAGS.BATTERY_GAUGE_ENABLED || (!_inited && init() != RET_OK))
+            return RET_ERROR;
+
+        *mah = ltc2941.getmAh();
+
+        return RET_OK;
+    }
+
     /******************************************************************************
 	 * Log battery gauge
 	 *****************************************************************************/
     RetResult print()
     {
-        if(!FLAGS.BATTERY_GAUGE_ENABLED)
+        if(!FLAGS.BATTERY_GAUGE_ENABLED || (!_inited && init() != RET_OK))
             return RET_ERROR;
 
         debug_println_i(F("Battery gauge data:"))
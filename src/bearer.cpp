@@ -0,0 +1,371 @@
+#include "Arduino.h"
+#include "bearer.h"
+#include <new>
+#include "gsm.h"
+#include "wifi_modem.h"
+#include "modem_udp.h"
+#include "log.h"
+#include "utils.h"
+#include "common.h"
+
+#if WIFI_BEARER || WIFI_DATA_SUBMISSION
+	#include <WiFiUdp.h>
+#endif
+
+namespace Bearer
+{
+	//
+	// Private types
+	//
+	/** Stats of all bearers. RTC_NOINIT memory survives deep sleep and resets
+	 * (but not power loss) */
+	struct StatsStore
+	{
+		uint32_t magic;
+		Stats stats[BEARER_COUNT];
+		uint32_t crc32;
+	} __attribute__((packed));
+
+	//
+	// Private functions
+	//
+	void pick_order();
+	uint32_t score(Type type);
+	RetResult connect(Type type, bool last);
+	void update(Type type, bool ok, uint32_t connect_ms);
+	void load_stats();
+	void save_stats();
+
+	//
+	// Private vars
+	//
+	const char *NAMES[] = {
+		[BEARER_CELLULAR] = "cellular",
+		[BEARER_WIFI] = "WiFi"
+	};
+
+	const uint8_t COSTS[] = {
+		[BEARER_CELLULAR] = BEARER_COST_CELLULAR,
+		[BEARER_WIFI] = BEARER_COST_WIFI
+	};
+
+	static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == BEARER_COUNT, "Name every bearer");
+	static_assert(sizeof(COSTS) / sizeof(COSTS[0]) == BEARER_COUNT, "Cost every bearer");
+
+	RTC_NOINIT_ATTR StatsStore _stats;
+
+	/** Bearers to try this call home, in order */
+	Type _order[BEARER_COUNT];
+	int _order_count = 0;
+
+	/** Bearer clients are created for */
+	Type _active = WIFI_DATA_SUBMISSION ? BEARER_WIFI : BEARER_CELLULAR;
+
+	/** Modem connect task was started this call home */
+	bool _cellular_started = false;
+
+	/******************************************************************************
+	* Pick bearer order and start connecting the first one if it is the modem,
+	* registration overlaps with work done until wait_connect(). No-op if
+	* started before this call home
+	******************************************************************************/
+	RetResult start_connect()
+	{
+		if(_order_count > 0)
+			return RET_OK;
+
+		pick_order();
+
+		_cellular_started = false;
+
+		if(_order[0] == BEARER_CELLULAR)
+		{
+			_cellular_started = true;
+			return GSM::start_connect();
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Connect bearers in order until one succeeds. start_connect() must be called
+	* first
+	* @return RET_ERROR if none connected
+	******************************************************************************/
+	RetResult wait_connect()
+	{
+		if(_order_count == 0)
+			return RET_ERROR;
+
+		for(int i = 0; i < _order_count; i++)
+		{
+			Type type = _order[i];
+
+			uint32_t start_ms = millis();
+			RetResult ret = connect(type, i == _order_count - 1);
+			uint32_t ms = millis() - start_ms;
+
+			update(type, ret == RET_OK, ms);
+
+			if(ret == RET_OK)
+			{
+				debug_printf("Connected over %s (ms): %u\n", NAMES[type], ms);
+
+				_active = type;
+				Log::log(Log::BEARER_CONNECTED, type, ms);
+
+				return RET_OK;
+			}
+
+			debug_printf("Could not connect over %s.\n", NAMES[type]);
+		}
+
+		_order_count = 0;
+
+		return RET_ERROR;
+	}
+
+	/******************************************************************************
+	* Disconnect bearer and turn modem off
+	******************************************************************************/
+	void off()
+	{
+		#if WIFI_BEARER && !WIFI_DATA_SUBMISSION
+			if(_active == BEARER_WIFI)
+				WifiModem::disconnect();
+		#endif
+
+		// Also when on for something else (eg. time sync), checks if it is on
+		GSM::off();
+
+		_order_count = 0;
+		_active = WIFI_DATA_SUBMISSION ? BEARER_WIFI : BEARER_CELLULAR;
+	}
+
+	/******************************************************************************
+	* Bearer connected by wait_connect(), cellular before that
+	******************************************************************************/
+	Type get_active()
+	{
+		return _active;
+	}
+
+	/******************************************************************************
+	* Active bearer is connected
+	******************************************************************************/
+	bool is_connected()
+	{
+		#if WIFI_BEARER && !WIFI_DATA_SUBMISSION
+			if(_active == BEARER_WIFI)
+				return WifiModem::is_connected();
+		#endif
+
+		// WiFi with WIFI_DATA_SUBMISSION
+		return GSM::is_gprs_connected();
+	}
+
+	/******************************************************************************
+	* Signal strength of active bearer (dBm)
+	******************************************************************************/
+	int get_rssi()
+	{
+		#if WIFI_BEARER || WIFI_DATA_SUBMISSION
+			if(_active == BEARER_WIFI)
+				return WiFi.RSSI();
+		#endif
+
+		return GSM::get_rssi();
+	}
+
+	/******************************************************************************
+	* Create a TCP client on active bearer, delete when done
+	* @param mux Modem socket, separate for connections open at the same time
+	* @return NULL if out of memory
+	******************************************************************************/
+	Client* new_client(uint8_t mux)
+	{
+		#if WIFI_BEARER || WIFI_DATA_SUBMISSION
+			if(_active == BEARER_WIFI)
+				return new (std::nothrow) WiFiClient();
+		#endif
+
+		return new (std::nothrow) TinyGsmClient(*GSM::get_modem(), mux);
+	}
+
+	/******************************************************************************
+	* Create a UDP socket on active bearer, delete when done
+	* @param mux Modem socket
+	* @return NULL if out of memory
+	******************************************************************************/
+	UDP* new_udp(uint8_t mux)
+	{
+		#if WIFI_BEARER || WIFI_DATA_SUBMISSION
+			if(_active == BEARER_WIFI)
+				return new (std::nothrow) WiFiUDP();
+		#endif
+
+		return new (std::nothrow) ModemUdp(GSM::get_modem(), mux);
+	}
+
+	/******************************************************************************
+	* Count a request in the success rate of the active bearer
+	******************************************************************************/
+	void on_request(uint32_t rtt_ms, bool ok)
+	{
+		if(_order_count == 0)
+			return;
+
+		load_stats();
+
+		Stats *stats = &_stats.stats[_active];
+
+		if(ok)
+			stats->rtt_ms = stats->rtt_ms == 0 ? rtt_ms : (stats->rtt_ms * (BEARER_EWMA_WEIGHT - 1) + rtt_ms) / BEARER_EWMA_WEIGHT;
+
+		stats->success_percent = (stats->success_percent * (BEARER_EWMA_WEIGHT - 1) + (ok ? 100 : 0)) / BEARER_EWMA_WEIGHT;
+
+		save_stats();
+	}
+
+	/******************************************************************************
+	* Stats of a bearer
+	******************************************************************************/
+	const Stats* get_stats(Type type)
+	{
+		load_stats();
+
+		return &_stats.stats[type];
+	}
+
+	/******************************************************************************
+	* Order bearers by score, lowest first. A bearer not tried first for
+	* BEARER_PROBE_INTERVAL call homes goes first once
+	******************************************************************************/
+	void pick_order()
+	{
+		#if WIFI_DATA_SUBMISSION
+			_order[0] = BEARER_WIFI;
+			_order_count = 1;
+		#elif WIFI_BEARER
+			load_stats();
+
+			bool wifi_first = score(BEARER_WIFI) <= score(BEARER_CELLULAR);
+			Type second = wifi_first ? BEARER_CELLULAR : BEARER_WIFI;
+
+			if(_stats.stats[second].since_probe >= BEARER_PROBE_INTERVAL)
+				wifi_first = !wifi_first;
+
+			_order[0] = wifi_first ? BEARER_WIFI : BEARER_CELLULAR;
+			_order[1] = wifi_first ? BEARER_CELLULAR : BEARER_WIFI;
+			_order_count = 2;
+
+			_stats.stats[_order[0]].since_probe = 0;
+			if(_stats.stats[_order[1]].since_probe < UINT8_MAX)
+				_stats.stats[_order[1]].since_probe++;
+
+			save_stats();
+
+			debug_printf("Bearer order: %s (score %u), %s (score %u)\n", NAMES[_order[0]], score(_order[0]),
+				NAMES[_order[1]], score(_order[1]));
+		#else
+			_order[0] = BEARER_CELLULAR;
+			_order_count = 1;
+		#endif
+	}
+
+	/******************************************************************************
+	* Cost of using a bearer, connect and round-trip time weighted by cost over
+	* success rate. 0 for a bearer never tried
+	******************************************************************************/
+	uint32_t score(Type type)
+	{
+		const Stats *stats = &_stats.stats[type];
+
+		if(stats->attempts == 0)
+			return 0;
+
+		uint32_t success = stats->success_percent > 0 ? stats->success_percent : 1;
+
+		return (stats->connect_ms + stats->rtt_ms) * COSTS[type] / success;
+	}
+
+	/******************************************************************************
+	* Connect a bearer
+	* @param last Last one to try, WiFi gets the full timeout
+	******************************************************************************/
+	RetResult connect(Type type, bool last)
+	{
+		#if WIFI_BEARER || WIFI_DATA_SUBMISSION
+			if(type == BEARER_WIFI)
+			{
+				RetResult ret = WifiModem::connect(last ? WIFI_CONNECT_TIMEOUT_SEC * 1000 : BEARER_WIFI_CONNECT_TIMEOUT_MS);
+
+				if(ret != RET_OK)
+					WifiModem::disconnect();
+
+				return ret;
+			}
+		#endif
+
+		if(!_cellular_started)
+		{
+			_cellular_started = true;
+
+			if(GSM::start_connect() != RET_OK)
+				return RET_ERROR;
+		}
+
+		return GSM::wait_connect();
+	}
+
+	/******************************************************************************
+	* Add a connect attempt to bearer stats
+	******************************************************************************/
+	void update(Type type, bool ok, uint32_t connect_ms)
+	{
+		load_stats();
+
+		Stats *stats = &_stats.stats[type];
+
+		if(ok)
+		{
+			stats->connect_ms = stats->attempts == 0 ? connect_ms :
+				(stats->connect_ms * (BEARER_EWMA_WEIGHT - 1) + connect_ms) / BEARER_EWMA_WEIGHT;
+		}
+
+		stats->success_percent = (stats->success_percent * (BEARER_EWMA_WEIGHT - 1) + (ok ? 100 : 0)) / BEARER_EWMA_WEIGHT;
+
+		if(stats->attempts < UINT16_MAX)
+			stats->attempts++;
+
+		save_stats();
+	}
+
+	/******************************************************************************
+	* Reset stats if RTC memory holds garbage (power loss)
+	******************************************************************************/
+	void load_stats()
+	{
+		if(_stats.magic == BEARER_STATS_MAGIC &&
+			Utils::crc32((uint8_t*)&_stats, sizeof(_stats) - sizeof(_stats.crc32)) == _stats.crc32)
+		{
+			return;
+		}
+
+		memset(&_stats, 0, sizeof(_stats));
+
+		for(int i = 0; i < BEARER_COUNT; i++)
+			_stats.stats[i].success_percent = 100;
+
+		save_stats();
+	}
+
+	/******************************************************************************
+	* Update CRC of stats in RTC memory
+	******************************************************************************/
+	void save_stats()
+	{
+		_stats.magic = BEARER_STATS_MAGIC;
+		_stats.crc32 = Utils::crc32((uint8_t*)&_stats, sizeof(_stats) - sizeof(_stats.crc32));
+	}
+}
@@ -1,3 +1,5 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_CALL_HOME
+
 #include "call_home.h"
 #define ARDUINOJSON_USE_LONG_LONG 1
 #include "ArduinoJson.h"
@@ -14,18 +16,37 @@
 #include "tb_sdi12_log_json_builder.h"
 #include "tb_fo_data_json_builder.h"
 #include "tb_lightning_data_json_builder.h"
+#include "tb_energy_profile_data_json_builder.h"
+#include "tb_rollup_data_json_builder.h"
+#include "tb_gateway_json_builder.h"
 #include "tb_log_json_builder.h"
+#include "tb_binary_builder.h"
+#include "tb_json_emitter.h"
+#include "tb_columnar_builder.h"
 #include "test_utils.h"
 #include "utils.h"
+#include "store_registry.h"
 #include "gsm.h"
 #include "flash.h"
 #include "device_config.h"
 #include "remote_control.h"
 #include "battery.h"
+#include "power_governor.h"
+#include "power_lock.h"
+#include "psram.h"
+#include "gzip_stream.h"
 #include "int_env_sensor.h"
 #include "http_request.h"
+#include "http_session.h"
+#include "telemetry_uploader.h"
+#include "uplink_controller.h"
+#include "mqtt.h"
+#include "coap.h"
+#include "modem_udp.h"
+#include "bearer.h"
 #include "log.h"
 #include "globals.h"
+#include "memory_monitor.h"
 #include "atmos41_data.h"
 #include "fo_sniffer.h"
 #include "fo_uart.h"
@@ -35,27 +56,139 @@
 #include "rtc.h"
 #include "credentials.h"
 #include <HTTPClient.h>
-#include "ipfs_client.h"
+#include <new>
+#include "ipfs.h"
+#include "ota.h"
+#include "trace.h"
+#include "lora_relay.h"
+#include "board_features.h"
+#include "relay_data.h"
+#include "backfill.h"
+#include "sleep_scheduler.h"
+#include "call_home_budget.h"
+#include "uplink_metrics.h"
+#include "backlog_drain.h"
 
 namespace CallHome
 {
+	/** Called with every built request before it is sent. Returns new request length */
+	typedef int (*RequestHook)(char *json, int json_len, int buff_size);
+
 	//
 	// Private functions
 	//
 	template <typename TStore, typename TBuilder, typename TEntry>
-	RetResult submit_stored_telemetry(TStore *store, DataStoreSubmitStats *stats);
-	RetResult submit_tb_telemetry(const char *data, int data_size);
-	uint32_t build_flags_bitmask();
+	RetResult submit_stored_telemetry(TStore *store, DataStoreSubmitStats *stats, int max_req_entries = 0,
+		int max_requests = 0, bool *done = NULL, RequestHook on_request = NULL);
+	template <typename TStore, typename TJsonBuilder, typename TEntry, uint8_t TSchemaId>
+	RetResult submit_sensor_telemetry(TStore *store, DataStoreSubmitStats *stats, int max_requests, bool *done,
+		RequestHook on_request = NULL);
+	template <typename TStruct>
+	DataStore<TStruct>* task_store(DataStore<TStruct> *store, bool backfill);
+#if FEATURE_IPFS
+	int ipfs_fan_out(char *json, int json_len, int buff_size);
+#endif
+	RetResult submit_tb_telemetry(const char *data, int data_size, int *sent_size = NULL);
+	RetResult send_tb_telemetry(const char *data, int data_size, int *sent_size);
+	RetResult submit_tb_telemetry_streamed(HttpRequest::BodyWriter body_writer, int data_size, int *sent_size);
+	RetResult post_tb_telemetry_gzip(HttpRequest &http_req, const char *url, HttpRequest::BodyWriter body_writer,
+		int data_size, char *resp, int resp_size, int *sent_size);
+	RetResult submit_tb_gateway_telemetry(const char *data, int data_size, int *sent_size = NULL);
+	void parse_ack_seq(const char *resp);
+	uint32_t take_ack_seq();
+	MQTT* get_gateway_mqtt();
+	bool can_stream_telemetry();
+	bool gzip_telemetry();
+	void log_compression_ratio(StoreId id, int json_bytes, int sent_bytes);
+	uint64_t build_flags_bitmask();
+	void submit_uplink_metrics();
+	void submit_fs_stats();
+	void submit_trace();
+	int drop_unchanged_attributes(JsonDocument &doc, DeviceConfig::ClientAttrState *state);
+	void add_device_attributes(JsonDocument &doc);
 	RetResult end();
+	RetResult open_transport();
+	void close_transport();
+
+	//
+	// Private types
+	//
+	/** Submits up to max_requests requests of a store (its backfill twin with backfill set), done is set
+	 * when there is nothing more to submit */
+	typedef RetResult (*TelemetrySubmitFunc)(bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done);
+
+	/** A store submitted by handle_telemetry() */
+	struct TelemetryTask
+	{
+		StoreId id;
+
+		/** Name to print */
+		const char *name;
+
+		/** TELEMETRY_PRIORITY_*, higher priorities are submitted first in every round */
+		uint8_t priority;
+
+		/** Share (%) of TELEMETRY_TIME_BUDGET_MS after which store is deferred to next call home */
+		uint8_t budget_percent;
+
+		TelemetrySubmitFunc submit;
+
+		/** Submits backfill twin of store (see Backfill) */
+		bool backfill;
+	};
+
+	//
+	// Private vars
+	//
+	/** Network client of MQTT connection */
+	Client *_mqtt_net_client = NULL;
+
+	/** MQTT connection, when MQTT transport is configured and connected */
+	MQTT *_mqtt = NULL;
+
+	/** UDP socket of CoAP transport, when configured and opened */
+	UDP *_coap_udp = NULL;
+
+	/** MQTT connection opened only for gateway API requests when another transport is used */
+	Client *_gateway_mqtt_net_client = NULL;
+	MQTT *_gateway_mqtt = NULL;
+
+	/** Telemetry requests that succeeded during this call home */
+	int _telemetry_sent = 0;
+
+	/** Sequence number acknowledged by response of last telemetry request, 0 if none.
+	 * Set by the uploader task too, taken once that request completes */
+	volatile uint32_t _ack_seq = 0;
+
+	const char *ALARM_NAMES[] = {
+		[ALARM_WATER_PRESENCE] = "water_presence",
+		[ALARM_LIGHTNING_CLOSE] = "lightning_close"
+	};
+
+	static_assert(sizeof(ALARM_NAMES) / sizeof(ALARM_NAMES[0]) == ALARM_COUNT, "Name every alarm");
 
 	/******************************************************************************
 	* Handle waking up from sleep to call home
 	******************************************************************************/
 	RetResult start()
 	{
+		// Deadlines of all phases count from here, including attach retries
+		CallHomeBudget::begin();
+		GSM::set_connect_deadline(CallHomeBudget::get_deadline_ms(CallHomeBudget::PHASE_ATTACH));
+
+		// Registers while the rest is prepared, no-op if started before sensor reads.
+		// Leaves power the modem only if relaying fails
+		if(!LoraRelay::is_leaf())
+			Bearer::start_connect();
+
+		_telemetry_sent = 0;
+
 		RTC::print_time();
 
-		Utils::cleanup_stores();		
+		StoreRegistry::cleanup_all();		
+
+		// Backlog left by an outage is drained over the following call homes
+		BacklogDrain::update();
 
 		BatteryGauge::log();
 		SolarMonitor::log();
@@ -79,31 +212,76 @@ namespace CallHome
 		Battery::log_solar_adc();
 		Log::log(Log::BATTERY_MDDE, Battery::get_last_mode());
 
-		Log::log(Log::Code::FS_SPACE, SPIFFS.usedBytes(), SPIFFS.totalBytes() - SPIFFS.usedBytes());
+		Log::log(Log::Code::FS_SPACE, STORAGE_FS.usedBytes(), STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes());
+
+		//
+		// Commit FO data before submitting telemetry, while GSM connects
+		//
+		if(FO_SOURCE == FO_SOURCE_SNIFFER)
+		{
+			debug_println(F("Commiting FO sniffer data."));
+			FoSniffer::commit_buffer();
+		}
+		else if(FO_SOURCE == FO_SOURCE_UART)
+		{
+			debug_println(F("Commiting FO UART data."));
+			FoUart::commit_buffer();
+		}
+
+		if(LoraRelay::is_leaf())
+		{
+			// Sensor data handed to the gateway, nothing more to do
+			if(LoraRelay::relay_call_home())
+			{
+				Utils::serial_style(STYLE_BLUE);
+				Utils::print_separator(F("Calling Home END (relayed)"));
+				Utils::serial_style(STYLE_RESET);
+
+				// Relaying is the full call home of a leaf
+				OTA::mark_valid();
+
+				return RET_OK;
+			}
+
+			Bearer::start_connect();
+		}
+		else if(LoraRelay::is_gateway())
+		{
+			// Leaves call home at the same time, listen for them while GSM connects
+			LoraRelay::receive_window();
+		}
 
-		GSM::on();
-		if(GSM::connect_persist() != RET_OK)
+		if(Bearer::wait_connect() != RET_OK)
 		{
-			debug_println(F("Could not connect GSM. Aborting."));
+			debug_println(F("Could not connect bearer. Aborting."));
 			end();
 			
 			return RET_ERROR;
 		}
 
 		// Log RSSI
-		Log::log(Log::GSM_RSSI, GSM::get_rssi());
+		int rssi = Bearer::get_rssi();
+		Log::log(Log::GSM_RSSI, rssi);
+		UplinkMetrics::on_radio(rssi);
+
+		// Request sizes and timeouts depend on link quality
+		UplinkController::start(rssi);
 
-		if(FLAGS.RTC_AUTO_SYNC)
+		// All TB requests of this call home share a single connection
+		open_transport();
+
+		if(RTC::is_sync_pending())
 		{
-			uint32_t last_sync_tick = RTC::get_last_sync_tick();
-			uint32_t mins_since_last_tick = ((millis() - last_sync_tick) / 1000 / 60);
-			
-			if(mins_since_last_tick >= RTC_AUTOSYNC_INTERVAL_MIN)
-			{
-				debug_println_i(F("RTC auto sync"));
-				RTC::sync();
-				Log::log(Log::RTC_SYNC, 0, 1);
-			}
+			// Postponed from boot, time came from ext RTC only
+			debug_println_i(F("RTC postponed sync"));
+			RTC::sync(false);
+		}
+		else if(FLAGS.RTC_AUTO_SYNC && RTC::is_sync_needed())
+		{
+			// Modem is already on, sync only when the drift model predicts too much error
+			debug_println_i(F("RTC auto sync"));
+			RTC::sync();
+			Log::log(Log::RTC_SYNC, 0, 1);
 		}
 
 		//
@@ -112,7 +290,7 @@ namespace CallHome
 		Utils::serial_style(STYLE_BLUE);
 		debug_println(F("# Request remote control data"));
 		Utils::serial_style(STYLE_RESET);
-		if(handle_remote_control() != RET_OK)
+		if(CallHomeBudget::enter(CallHomeBudget::PHASE_REMOTE_CONTROL) && handle_remote_control() != RET_OK)
 		{
 			if(RemoteControl::get_last_error() == RemoteControl::ERROR_REQUEST_FAILED)
 			{
@@ -128,7 +306,8 @@ namespace CallHome
 		Utils::serial_style(STYLE_BLUE);
 		debug_println(F("# Publishing TB client attributes"));
 		Utils::serial_style(STYLE_RESET);
-		handle_client_attributes();
+		if(CallHomeBudget::enter(CallHomeBudget::PHASE_ATTRIBUTES))
+			handle_client_attributes();
 
 		//
 		// If reboot requested during remote control, reboot
@@ -144,23 +323,9 @@ namespace CallHome
 			Utils::restart_device();
 		}
 
-		//
-		// Commit FO sniffer data before submitting telemetry
-		//
-		if(FO_SOURCE == FO_SOURCE_SNIFFER)
-		{
-			Serial.println(F("Commiting FO sniffer data."));
-			FoSniffer::commit_buffer();
-		}
-		else if(FO_SOURCE == FO_SOURCE_UART)
-		{
-			Serial.println(F("Commiting FO UART data."));
-			FoUart::commit_buffer();
-		}
-
 		Utils::serial_style(STYLE_BLUE);
-		Utils::print_separator(F("FILES BEFORE SUBMITTING TELEMETRY"));
-		Flash::ls();
+		Utils::print_separator(F("STORES BEFORE SUBMITTING TELEMETRY"));
+		StoreRegistry::print_stats();
 		Utils::serial_style(STYLE_RESET);
 
 		//
@@ -169,11 +334,37 @@ namespace CallHome
 		Utils::serial_style(STYLE_BLUE);
 		debug_println(F("# Submitting telemetry"));
 		Utils::serial_style(STYLE_RESET);
-		handle_telemetry();
+		bool telemetry_ok = handle_telemetry() == RET_OK;
+
+		// Draining, more sessions on the same attach, each with its own budget
+		while(BacklogDrain::next_session(telemetry_ok) && Bearer::is_connected())
+		{
+			Utils::serial_style(STYLE_BLUE);
+			debug_println(F("# Draining backlog, next session"));
+			Utils::serial_style(STYLE_RESET);
+
+			CallHomeBudget::end();
+			CallHomeBudget::begin();
+
+			telemetry_ok = handle_telemetry() == RET_OK;
+		}
+
+		// Content of the CIDs submitted with telemetry, all in one request. Waits
+		// while draining, CIDs are kept until uploaded
+#if FEATURE_IPFS
+		if(FLAGS.IPFS && !BacklogDrain::is_active())
+			Ipfs::upload_pending();
+#endif
+
+		// Attached, got remote control data (call home aborts otherwise) and submitted telemetry
+		if(_telemetry_sent > 0)
+		{
+			OTA::mark_valid();
+		}
 
 		Utils::serial_style(STYLE_BLUE);
-		Utils::print_separator(F("FILES AFTER CALLING HOME"));
-		Flash::ls();
+		Utils::print_separator(F("STORES AFTER CALLING HOME"));
+		StoreRegistry::print_stats();
 		Utils::serial_style(STYLE_RESET);
 
 		// Done
@@ -182,12 +373,70 @@ namespace CallHome
 		return RET_OK;
 	}
 
+	/******************************************************************************
+	 * Expedited uplink of an alarm condition. Payload is serialized before the
+	 * bearer is up and posted on the first socket, skipping time sync, remote
+	 * control, attributes and stores. The full call home follows on the same
+	 * connection when battery is in normal mode, modem is turned off otherwise
+	 * @param alarm Alarm condition
+	 * @param value Value sent with it (eg. presence level, distance)
+	 *****************************************************************************/
+	RetResult send_alarm(Alarm alarm, int32_t value)
+	{
+		uint32_t start_ms = millis();
+		char payload[TB_ALARM_PAYLOAD_SIZE] = "";
+
+		int len = snprintf(payload, sizeof(payload), TB_ALARM_PAYLOAD_FORMAT, RTC::get_timestamp(), ALARM_NAMES[alarm], value);
+
+		debug_printf("Sending alarm: %s\n", ALARM_NAMES[alarm]);
+
+		Bearer::start_connect();
+
+		RetResult ret = Bearer::wait_connect();
+		if(ret == RET_OK)
+			ret = send_tb_telemetry(payload, len, NULL);
+
+		bool full = ret == RET_OK && Battery::get_current_mode() == BATTERY_MODE::BATTERY_MODE_NORMAL;
+
+		Log::log(Log::ALARM_UPLINK, alarm | (ret == RET_OK) << 8 | full << 9, millis() - start_ms);
+
+		if(full)
+			return start() == RET_OK ? ret : RET_ERROR;
+
+		end();
+
+		return ret;
+	}
+
 	/******************************************************************************
 	 * Clean up after finishing
 	 *****************************************************************************/
 	RetResult end()
 	{
-		GSM::off();
+		UplinkController::end();
+
+		// Goes out on the connection it describes, before it is closed
+		if(FLAGS.UPLINK_METRICS && Bearer::is_connected())
+			submit_uplink_metrics();
+
+		if(FLAGS.FS_STATS && Bearer::is_connected() && !BacklogDrain::is_active())
+			submit_fs_stats();
+
+		// Cycles traced since last call home, this one follows on the next
+		if(Bearer::is_connected())
+			submit_trace();
+
+		UplinkMetrics::reset();
+
+		CallHomeBudget::end();
+		GSM::set_connect_deadline(0);
+
+		close_transport();
+
+		Bearer::off();
+
+		// Which AT exchanges took the session time
+		GSM::log_at_stats();
 		
 		Utils::serial_style(STYLE_BLUE);
 		Utils::print_separator(F("Calling Home END"));
@@ -195,136 +444,256 @@ namespace CallHome
 		debug_println();
 
 		Log::log(Log::CALLING_HOME_END);
-		Log::log(Log::Code::FS_SPACE, SPIFFS.usedBytes(), SPIFFS.totalBytes() - SPIFFS.usedBytes());
+		Log::log(Log::Code::FS_SPACE, STORAGE_FS.usedBytes(), STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes());
 
 		BatteryGauge::log();
 
+		// Pending new image that still is not valid after this attempt is rolled
+		// back once past its deadline
+		OTA::check_validation();
+
 		return RET_OK;
 	}
 
 	/******************************************************************************
-	 * Handle sensor data submission
-	 * Read all sensor data, break into requests of X entries and submit
+	 * Submit uplink performance of this call home as a telemetry entry
 	 *****************************************************************************/
-	RetResult handle_telemetry()
+	void submit_uplink_metrics()
 	{
-		DataStoreSubmitStats telemetry_stats = {0};
+		char payload[TB_UPLINK_METRICS_PAYLOAD_SIZE] = "";
 
-		//
-		// Array of lambdas each submitting telemetry for a single sensor/store
-		//
-		RetResult (* tasks[])(DataStoreSubmitStats*) = {
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit water sensor data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting water sensor data."));
-				Utils::serial_style(STYLE_RESET);
+		int len = UplinkMetrics::build_payload(payload, sizeof(payload), RTC::get_timestamp());
 
-				submit_stored_telemetry<DataStore<WaterSensorData::Entry>, TbWaterSensorDataJsonBuilder, WaterSensorData::Entry>(WaterSensorData::get_store(), telemetry_stats);
+		if(len == 0 || send_tb_telemetry(payload, len, NULL) != RET_OK)
+			debug_println_w(F("Could not submit uplink metrics."));
+	}
 
-				Utils::serial_style(STYLE_BLUE);
-				debug_print_i(F("Water sensor data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit weather data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting weather data."));
-				Utils::serial_style(STYLE_RESET);
+	/******************************************************************************
+	 * Submit flash and store health as a telemetry entry
+	 *****************************************************************************/
+	void submit_fs_stats()
+	{
+		char payload[TB_FS_STATS_PAYLOAD_SIZE] = "";
 
-				submit_stored_telemetry<DataStore<Atmos41Data::Entry>, TbAtmos41DataJsonBuilder, Atmos41Data::Entry>(Atmos41Data::get_store(), telemetry_stats);
+		int len = StoreRegistry::build_fs_stats_payload(payload, sizeof(payload), RTC::get_timestamp());
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Atmos41 data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit soil moisture sensor data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting soil moisture data."));
-				Utils::serial_style(STYLE_RESET);
+		if(len == 0 || send_tb_telemetry(payload, len, NULL) != RET_OK)
+			debug_println_w(F("Could not submit FS stats."));
+	}
 
-				submit_stored_telemetry<DataStore<SoilMoistureData::Entry>, TbSoilMoistureDataJsonBuilder, SoilMoistureData::Entry>(SoilMoistureData::get_store(), telemetry_stats);
+	/******************************************************************************
+	 * Submit wake cycles traced while armed (see Trace::arm()), one telemetry
+	 * entry each. Kept for the next call home unless all went out
+	 *****************************************************************************/
+	void submit_trace()
+	{
+		if(!STORAGE_FS.exists(TRACE_PATH))
+			return;
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Soil moisture data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit FO data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting FineOffset weather data."));
-				Utils::serial_style(STYLE_RESET);
+		ScratchBuffer payload_buff(TB_TRACE_PAYLOAD_SIZE);
+		char *payload = payload_buff.get();
 
-				submit_stored_telemetry<DataStore<FoData::StoreEntry>, TbFoDataJsonBuilder, FoData::StoreEntry>(FoData::get_store(), telemetry_stats);
+		if(payload == NULL)
+			return;
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("FineOffset weather data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit Lightning data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting Lightning data."));
-				Utils::serial_style(STYLE_RESET);
+		int cycles = 0;
+		int len = 0;
 
-				submit_stored_telemetry<DataStore<LightningData::Entry>, TbLightningDataJsonBuilder, LightningData::Entry>(LightningData::get_store(), telemetry_stats);
+		while((len = Trace::build_upload_payload(cycles, payload, TB_TRACE_PAYLOAD_SIZE)) > 0)
+		{
+			if(send_tb_telemetry(payload, len, NULL) != RET_OK)
+			{
+				debug_println_w(F("Could not submit trace, retrying next call home."));
+				return;
+			}
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Lightning data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit SDI12 debug data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting SDI12 debug data."));
-				Utils::serial_style(STYLE_RESET);
+			cycles++;
+		}
 
-				submit_stored_telemetry<DataStore<SDI12Log::Entry>, TbSDI12LogJsonBuilder, SDI12Log::Entry>(SDI12Log::get_store(), telemetry_stats);
+		debug_printf("Submitted traced cycles: %d\n", cycles);
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("SDI12 debug data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-            [](DataStoreSubmitStats *telemetry_stats) mutable -> RetResult
-			{ 
-				//
-				// Submit SDI12 debug data
-				//
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("Submitting SDI12 debug data."));
-				Utils::serial_style(STYLE_RESET);
+		Trace::clear_upload();
+	}
+
+	/******************************************************************************
+	 * Open connection to TB shared by all requests of this call home, MQTT, CoAP
+	 * or HTTP depending on DeviceConfig. Falls back to HTTP if MQTT/CoAP fails.
+	 *****************************************************************************/
+	RetResult open_transport()
+	{
+		if(DeviceConfig::get_transport() == DeviceConfig::TRANSPORT_MQTT)
+		{
+			_mqtt_net_client = Bearer::new_client(MQTT_MUX);
 
-				submit_stored_telemetry<DataStore<SDI12Log::Entry>, TbSDI12LogJsonBuilder, SDI12Log::Entry>(SDI12Log::get_store(), telemetry_stats);
+			if(_mqtt_net_client != NULL)
+				_mqtt = new (std::nothrow) MQTT(_mqtt_net_client, TB_SERVER, TB_MQTT_PORT, DeviceConfig::get_tb_device_token(), NULL);
 
-				Utils::serial_style(STYLE_BLUE);
-				Utils::print_separator(F("SDI12 debug data submission complete"));
-				Utils::serial_style(STYLE_RESET);
-			},
-    	};
+			if(_mqtt != NULL && _mqtt->connect() == RET_OK)
+				return RET_OK;
+
+			debug_println_w(F("Could not connect MQTT, falling back to HTTP."));
+			close_transport();
+		}
+		else if(DeviceConfig::get_transport() == DeviceConfig::TRANSPORT_COAP)
+		{
+			_coap_udp = Bearer::new_udp(COAP_MUX);
+
+			if(_coap_udp != NULL && Coap::open(_coap_udp, TB_SERVER, TB_COAP_PORT) == RET_OK)
+				return RET_OK;
+
+			debug_println_w(F("Could not open CoAP socket, falling back to HTTP."));
+			close_transport();
+		}
+
+		return HttpSession::open(TB_SERVER, TB_PORT);
+	}
+
+	/******************************************************************************
+	 * Close connection opened by open_transport()
+	 *****************************************************************************/
+	void close_transport()
+	{
+		if(_mqtt != NULL)
+		{
+			_mqtt->disconnect();
+			delete _mqtt;
+			_mqtt = NULL;
+		}
+
+		if(_mqtt_net_client != NULL)
+		{
+			delete _mqtt_net_client;
+			_mqtt_net_client = NULL;
+		}
+
+		if(_gateway_mqtt != NULL)
+		{
+			_gateway_mqtt->disconnect();
+			delete _gateway_mqtt;
+			_gateway_mqtt = NULL;
+		}
+
+		if(_gateway_mqtt_net_client != NULL)
+		{
+			delete _gateway_mqtt_net_client;
+			_gateway_mqtt_net_client = NULL;
+		}
+
+		if(_coap_udp != NULL)
+		{
+			Coap::close();
+			delete _coap_udp;
+			_coap_udp = NULL;
+		}
+
+		HttpSession::close();
+	}
+
+	/******************************************************************************
+	 * Get MQTT connection of current call home
+	 * @return NULL if HTTP is used
+	 *****************************************************************************/
+	MQTT* get_mqtt()
+	{
+		return _mqtt;
+	}
+
+	/******************************************************************************
+	 * Handle sensor data submission
+	 * Read all sensor data, break into requests of X entries and submit
+	 *****************************************************************************/
+	RetResult handle_telemetry()
+	{
+		DataStoreSubmitStats telemetry_stats = {0};
 
 		//
-		// IPFS
+		// Stores to submit (see StoreRegistry), each through a lambda submitting a slice of its data
 		//
-		submit_ipfs();
+		TelemetrySubmitFunc submit_funcs[] = {
+			[STORE_LOG] = NULL,
+			[STORE_WATER_SENSORS] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_sensor_telemetry<DataStore<WaterSensorData::Entry>, TbWaterSensorDataJsonBuilder, WaterSensorData::Entry, BINARY_SCHEMA_WATER_SENSOR_DATA>(task_store(WaterSensorData::get_store(), backfill), stats, max_requests, done);
+				},
+#if FEATURE_ATMOS41
+			[STORE_ATMOS41] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_sensor_telemetry<DataStore<Atmos41Data::Entry>, TbAtmos41DataJsonBuilder, Atmos41Data::Entry, BINARY_SCHEMA_ATMOS41_DATA>(task_store(Atmos41Data::get_store(), backfill), stats, max_requests, done);
+				},
+#else
+			[STORE_ATMOS41] = NULL,
+#endif
+#if FEATURE_SOIL_MOISTURE
+			[STORE_SOIL_MOISTURE] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_sensor_telemetry<DataStore<SoilMoistureData::Entry>, TbSoilMoistureDataJsonBuilder, SoilMoistureData::Entry, BINARY_SCHEMA_SOIL_MOISTURE_DATA>(task_store(SoilMoistureData::get_store(), backfill), stats, max_requests, done);
+				},
+#else
+			[STORE_SOIL_MOISTURE] = NULL,
+#endif
+			[STORE_FO] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+#if FEATURE_IPFS
+					RequestHook on_request = FLAGS.IPFS ? ipfs_fan_out : NULL;
+#else
+					RequestHook on_request = NULL;
+#endif
+					return submit_sensor_telemetry<DataStore<FoData::StoreEntry>, TbFoDataJsonBuilder, FoData::StoreEntry, BINARY_SCHEMA_FO_DATA>(task_store(FoData::get_store(), backfill), stats, max_requests, done,
+						on_request);
+				},
+#if FEATURE_LIGHTNING
+			[STORE_LIGHTNING] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_sensor_telemetry<DataStore<LightningData::Entry>, TbLightningDataJsonBuilder, LightningData::Entry, BINARY_SCHEMA_LIGHTNING_DATA>(task_store(LightningData::get_store(), backfill), stats, max_requests, done);
+				},
+#else
+			[STORE_LIGHTNING] = NULL,
+#endif
+			[STORE_ENERGY_PROFILE] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_sensor_telemetry<DataStore<EnergyProfileData::Entry>, TbEnergyProfileDataJsonBuilder, EnergyProfileData::Entry, BINARY_SCHEMA_ENERGY_PROFILE_DATA>(task_store(EnergyProfileData::get_store(), backfill), stats, max_requests, done);
+				},
+			[STORE_RELAY] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_stored_telemetry<DataStore<RelayData::Entry>, TbGatewayJsonBuilder, RelayData::Entry>(task_store(RelayData::get_store(), backfill), stats, 0, max_requests, done);
+				},
+			[STORE_ROLLUP] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_stored_telemetry<DataStore<RollupData::Entry>, TbRollupDataJsonBuilder, RollupData::Entry>(task_store(RollupData::get_store(), backfill), stats, 0, max_requests, done);
+				},
+			[STORE_SDI12_LOG] = [](bool backfill, DataStoreSubmitStats *stats, int max_requests, bool *done) -> RetResult
+				{
+					return submit_stored_telemetry<DataStore<SDI12Log::Entry>, TbSDI12LogJsonBuilder, SDI12Log::Entry>(task_store(SDI12Log::get_store(), backfill), stats, 0, max_requests, done);
+				}
+		};
+
+		static_assert(sizeof(submit_funcs) / sizeof(submit_funcs[0]) == STORE_COUNT, "Submit every store");
+
+		// Backfill is a large upload nothing waits for, held back until energy is to spare
+		bool backfill = false;
+
+		for(int i = 0; i < STORE_COUNT && !backfill; i++)
+			backfill = Backfill::is_pending((StoreId)i);
+
+		if(backfill)
+			backfill = SleepScheduler::may_run(SleepScheduler::WORK_BACKLOG);
+
+		// Stores and backfill twins with backfilled entries left, at low priority
+		TelemetryTask tasks[2 * STORE_COUNT];
+		int task_count = 0;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			const StoreRegistry::StoreDescriptor *store = StoreRegistry::get((StoreId)i);
+
+			if(!store->telemetry || submit_funcs[i] == NULL)
+				continue;
+
+			tasks[task_count++] = {store->id, store->name, store->priority, store->budget_percent, submit_funcs[i], false};
+
+			if(backfill && Backfill::is_pending((StoreId)i))
+				tasks[task_count++] = {store->id, store->name, TELEMETRY_PRIORITY_LOW, TELEMETRY_LOW_PRIORITY_BUDGET_PERCENT, submit_funcs[i], true};
+		}
 
 		//
 		// Submit telemetry
@@ -333,24 +702,103 @@ namespace CallHome
 		// Keep track of time elapsed
 		uint32_t telemetry_start_millis = millis();
 
-		for(int i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++)
+		// Store shares are of what is left of the call home budget for telemetry, if less
+		uint32_t telemetry_budget_ms = TELEMETRY_TIME_BUDGET_MS;
+
+		if(!CallHomeBudget::enter(CallHomeBudget::PHASE_TELEMETRY))
+			telemetry_budget_ms = 0;
+		else if(CallHomeBudget::remaining_ms(CallHomeBudget::PHASE_TELEMETRY) < telemetry_budget_ms)
+			telemetry_budget_ms = CallHomeBudget::remaining_ms(CallHomeBudget::PHASE_TELEMETRY);
+
+		// Send requests in the background while next ones are built
+		if(FLAGS.PIPELINED_UPLOAD)
+			TelemetryUploader::start(submit_tb_telemetry);
+
+		//
+		// Round-robin over stores, TELEMETRY_SLICE_REQUESTS requests per store per round,
+		// higher priority stores first in every round. A store gets no more slices once
+		// its share of the time budget is used, the rest is submitted next time.
+		//
+		bool tasks_done[2 * STORE_COUNT] = {false};
+		bool pending = telemetry_budget_ms > 0;
+		bool out_of_charge = false;
+
+		while(pending && !submission_aborted && !out_of_charge)
 		{
-			tasks[i](&telemetry_stats);
+			pending = false;
 
-			if(telemetry_stats.failed_requests >= FAILED_TELEMETRY_REQ_THRESHOLD)
+			for(int priority = TELEMETRY_PRIORITY_HIGH; priority <= TELEMETRY_PRIORITY_LOW && !submission_aborted && !out_of_charge; priority++)
 			{
-				debug_println_e(F("Request error threshold reached, aborting telemetry submission"));
-				submission_aborted = true;
-				break;
+				for(int i = 0; i < task_count; i++)
+				{
+					if(tasks_done[i] || tasks[i].priority != priority)
+						continue;
+
+					// Out of budget, defer
+					if(millis() - telemetry_start_millis >= telemetry_budget_ms / 100 * tasks[i].budget_percent)
+						continue;
+
+					// Call home out of charge, defer all
+					if(CallHomeBudget::expired(CallHomeBudget::PHASE_TELEMETRY))
+					{
+						out_of_charge = true;
+						break;
+					}
+
+					Utils::serial_style(STYLE_BLUE);
+					debug_print(F("Submitting "));
+					debug_print(tasks[i].name);
+					debug_println(tasks[i].backfill ? F(" backfill data.") : F(" data."));
+					Utils::serial_style(STYLE_RESET);
+
+					int json_bytes = telemetry_stats.json_bytes;
+					int sent_bytes = telemetry_stats.sent_bytes;
+
+					tasks[i].submit(tasks[i].backfill, &telemetry_stats, TELEMETRY_SLICE_REQUESTS, &tasks_done[i]);
+
+					log_compression_ratio(tasks[i].id, telemetry_stats.json_bytes - json_bytes,
+						telemetry_stats.sent_bytes - sent_bytes);
+
+					pending = pending || !tasks_done[i];
+
+					if(telemetry_stats.failed_requests >= UplinkController::get_failed_req_threshold())
+					{
+						debug_println_e(F("Request error threshold reached, aborting telemetry submission"));
+						submission_aborted = true;
+						break;
+					}
+				}
 			}
 		}
 
+		// Stores left with data to submit next time
+		int deferred_tasks = 0;
+		for(int i = 0; i < task_count; i++)
+		{
+			if(!tasks_done[i])
+				deferred_tasks++;
+		}
+
+		if(deferred_tasks > 0)
+		{
+			debug_print_w(F("Stores deferred to next call home: "));
+			debug_println(deferred_tasks, DEC);
+
+			Log::log(Log::TELEMETRY_DEFERRED, deferred_tasks, (millis() - telemetry_start_millis) / 1000);
+		}
+
+		TelemetryUploader::stop();
+
+		Backfill::update();
 
 		uint32_t telemetry_elapsed_sec = (millis() - telemetry_start_millis) / 1000;
 
 		//
 		// Submit logs
 		//
+		// Span durations since last summary, submitted with the logs
+		Trace::log_summary();
+
 		uint32_t logs_start_millis = millis();
 		
 		if(handle_logs() != RET_OK)
@@ -403,15 +851,60 @@ namespace CallHome
 	}
 
 	/******************************************************************************
-	 * Read all data from a DataStore, build JSON and submit as telemetry
+	 * Store a telemetry task submits: the store or its backfill twin
 	 *****************************************************************************/
-	template <typename TStore, typename TBuilder, typename TEntry>
-	RetResult submit_stored_telemetry(TStore *store, DataStoreSubmitStats *stats)
+	template <typename TStruct>
+	DataStore<TStruct>* task_store(DataStore<TStruct> *store, bool backfill)
 	{
+		return backfill ? store->get_twin(DATA_STORE_TWIN_BACKFILL) : store;
+	}
 
-		// Entries in current request packet
-		int cur_req_entries = 0;
-		// Keep count of failed CRCs for log
+	/******************************************************************************
+	 * Submit sensor data store as JSON, packed binary (FLAGS.BINARY_TELEMETRY) or
+	 * columns (FLAGS.COLUMNAR_TELEMETRY). JSON is written by TbJsonEmitter, or
+	 * TJsonBuilder with FLAGS.DOM_JSON_BUILDERS
+	 *****************************************************************************/
+	template <typename TStore, typename TJsonBuilder, typename TEntry, uint8_t TSchemaId>
+	RetResult submit_sensor_telemetry(TStore *store, DataStoreSubmitStats *stats, int max_requests, bool *done,
+		RequestHook on_request)
+	{
+		if(FLAGS.BINARY_TELEMETRY)
+			return submit_stored_telemetry<TStore, TbBinaryBuilder<TEntry, TSchemaId>, TEntry>(store, stats, 0, max_requests, done, on_request);
+
+		if(FLAGS.COLUMNAR_TELEMETRY)
+			return submit_stored_telemetry<TStore, TbColumnarBuilder<TEntry, TSchemaId>, TEntry>(store, stats, 0, max_requests, done, on_request);
+
+		if(FLAGS.DOM_JSON_BUILDERS)
+			return submit_stored_telemetry<TStore, TJsonBuilder, TEntry>(store, stats, 0, max_requests, done, on_request);
+
+		return submit_stored_telemetry<TStore, TbJsonEmitter<TEntry>, TEntry>(store, stats, 0, max_requests, done, on_request);
+	}
+
+	/******************************************************************************
+	 * Read all data from a DataStore, build JSON and submit as telemetry
+	 * @param store Store to submit
+	 * @param stats Stats to add results to
+	 * @param max_req_entries Max entries per request, 0 for a whole file per request
+	 * @param max_requests Stop after this many requests (at a file boundary), 0 for no limit
+	 * @param done Set when there is nothing more to submit this time (store empty or failed). Can be NULL
+	 * @param on_request Called with every request before it is sent (see ipfs_fan_out). Can be NULL
+	 *****************************************************************************/
+	template <typename TStore, typename TBuilder, typename TEntry>
+	RetResult submit_stored_telemetry(TStore *store, DataStoreSubmitStats *stats, int max_req_entries,
+		int max_requests, bool *done, RequestHook on_request)
+	{
+		// Eg. backfill twin that could not be created
+		if(store == NULL)
+		{
+			if(done != NULL)
+				*done = true;
+
+			return RET_ERROR;
+		}
+
+		// Entries in current request packet
+		int cur_req_entries = 0;
+		// Keep count of failed CRCs for log
 		int crc_failures = 0;
 		// Total sensor data entries
 		int total_entries = 0;
@@ -423,92 +916,331 @@ namespace CallHome
 		int total_requests = 0;
 		// Number of successfull requests
 		int successfull_requests = 0;
+		// JSON bytes built and bytes actually sent (differ when compressed)
+		int json_bytes = 0;
+		int sent_bytes = 0;
+
+		// Multi-device payload, goes to the gateway API
+		const bool gateway = TbGatewayPayload<TBuilder>::value;
+
+		// Requests are serialized straight into the connection, no output buffers needed.
+		// A request hook or the gateway API needs the built request in a buffer
+		bool stream = !gateway && on_request == NULL && can_stream_telemetry();
+		int max_req_bytes = stream ? TELEMETRY_STREAMED_REQ_BYTE_BUDGET : TELEMETRY_REQ_BYTE_BUDGET;
+
+		// Draining takes the fewest requests, whatever the link quality
+		int req_byte_budget = BacklogDrain::is_active() ? max_req_bytes :
+			UplinkController::get_req_byte_budget(max_req_bytes);
+
+		// Builder and output buffers are large when packing multiple files, keep them off the stack.
+		// Two output buffers so one can be built while the other is being sent, from scratch
+		// arena and freed on return
+		Scratch::Scope scratch;
+		TBuilder *json_builder = new (std::nothrow) TBuilder();
+		char *json_buffs[2] = {
+			stream ? NULL : (char*)Scratch::alloc(TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE),
+			stream ? NULL : (char*)Scratch::alloc(TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE)
+		};
+
+		if(json_builder == NULL || (!stream && (json_buffs[0] == NULL || json_buffs[1] == NULL)))
+		{
+			debug_println_e(F("Could not allocate telemetry buffers."));
+			delete json_builder;
+			return RET_ERROR;
+		}
 
-		TBuilder json_builder;
-
-		// Output buffer for resulting JSON
-		char json_buff[TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE] = {0};
-		
-		DataStoreReader<TEntry> reader(store);
+		typename TStore::Reader reader(store);
 		const TEntry *entry = NULL;
 
-		json_builder.reset();
+		json_builder->reset();
 
 		//
-		// Iterate all data and submit. Each file in flash will fit in a single request.
-		// If request succeeds, file is deleted, if not it is left to be retried next time.
+		// Iterate all data and submit. Entries of multiple files are packed into a single
+		// request up to TELEMETRY_REQ_BYTE_BUDGET bytes (or max_req_entries entries if set).
+		// Files completely included in a successful request are deleted together. A file
+		// split across requests is acknowledged up to the entries submitted, so if a
+		// following request fails it is retried next time after the last acknowledged entry.
 		//
-		
+		// When the uploader is running, requests ending on a file boundary are sent in the
+		// background while the next one is built. Only one request is in flight and it must
+		// succeed before the next one is sent.
+		//
+
+		// Entries read from current file, including failed CRC ones
+		int file_entries_read = 0;
+
+		// Output buffer next request is built into
+		int cur_buff = 0;
+
+		// Request in flight and what it holds
+		bool inflight = false;
+		int inflight_json_len = 0;
+		int inflight_entries = 0;
+		int inflight_files = 0;
+
+		// Account for a completed request. Files it completes are deleted on success.
+		auto finish_request = [&](RetResult ret, int json_len, int sent_len, int entries, int files) -> RetResult
+		{
+			json_bytes += json_len;
+			sent_bytes += sent_len;
+
+			// Acked entries are skipped when files are retried
+			uint32_t ack_seq = take_ack_seq();
+			if(ack_seq > 0)
+				store->set_acked_seq(ack_seq);
+
+			if(ret == RET_OK)
+			{
+				successfull_entries += entries;
+				successfull_requests++;
+
+				if(files > 0)
+				{
+					Utils::serial_style(STYLE_BLUE);
+					debug_print(F("Deleting files, all complete: "));
+					debug_println(files, DEC);
+					Utils::serial_style(STYLE_RESET);
+				}
+
+				reader.commit_deletes(files);
+			}
+			else
+			{
+				Utils::serial_style(STYLE_RED);
+				debug_println(F("Sending telemetry data failed. Files remain to be retried next time."));
+				Utils::serial_style(STYLE_RESET);
+
+				reader.discard_deletes(files);
+			}
+
+			return ret;
+		};
+
+		// Wait for request in flight
+		auto complete_inflight = [&]() -> RetResult
+		{
+			if(!inflight)
+				return RET_OK;
+
+			inflight = false;
+
+			int sent_len = inflight_json_len;
+			RetResult ret = TelemetryUploader::wait(&sent_len);
+
+			return finish_request(ret, inflight_json_len, sent_len, inflight_entries, inflight_files);
+		};
+
+		// Submit current request. If ack_count is set, current file is acknowledged up to
+		// ack_count entries on success, such requests are always sent synchronously.
+		auto send_request = [&](int ack_count) -> RetResult
+		{
+			if(stream)
+			{
+				int json_len = json_builder->measure();
+				int entries = cur_req_entries;
+				int files = reader.get_queued_deletes();
+
+				total_requests++;
+
+				int sent_len = json_len;
+				RetResult ret = submit_tb_telemetry_streamed([&](Print &out) { json_builder->build(out); }, json_len, &sent_len);
+
+				json_builder->reset();
+				cur_req_entries = 0;
+
+				ret = finish_request(ret, json_len, sent_len, entries, files);
+
+				if(ret == RET_OK && ack_count > 0)
+					reader.ack_entries(ack_count);
+
+				return ret;
+			}
+
+			char *json_buff = json_buffs[cur_buff];
+
+			{
+				PowerLock::Scoped cpu_lock(PowerLock::LOCK_CPU_MAX);
+				json_builder->build(json_buff, TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE, false);
+			}
+
+			int json_len = strlen(json_buff);
+			int entries = cur_req_entries;
+
+			if(on_request != NULL)
+				json_len = on_request(json_buff, json_len, TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE);
+
+			// Empty packet and prepare for next
+			json_builder->reset();
+			cur_req_entries = 0;
+
+			// Entries of a file may span the previous request too, it must succeed first
+			if(complete_inflight() != RET_OK)
+			{
+				// Not sent, files of this one remain too
+				reader.discard_deletes(reader.get_queued_deletes());
+				return RET_ERROR;
+			}
+
+			total_requests++;
+
+			int files = reader.get_queued_deletes();
+
+			if(ack_count == 0 && !gateway && TelemetryUploader::is_running() &&
+				TelemetryUploader::dispatch(json_buff, json_len) == RET_OK)
+			{
+				inflight = true;
+				inflight_json_len = json_len;
+				inflight_entries = entries;
+				inflight_files = files;
+
+				cur_buff ^= 1;
+
+				return RET_OK;
+			}
+
+			int sent_len = json_len;
+			RetResult ret = gateway ? submit_tb_gateway_telemetry(json_buff, json_len, &sent_len) :
+				submit_tb_telemetry(json_buff, json_len, &sent_len);
+
+			ret = finish_request(ret, json_len, sent_len, entries, files);
+
+			if(ret == RET_OK && ack_count > 0)
+				reader.ack_entries(ack_count);
+
+			return ret;
+		};
+
 		// Submission errors occurred
 		bool submission_failed = false;
+		// Max requests reached, rest is left for next call
+		bool slice_complete = false;
 
-		while(reader.next_file())
+		while(!submission_failed && !slice_complete && reader.next_file())
 		{
-			cur_req_entries = 0;
+			file_entries_read = 0;
+			// A request including entries of current file failed
+			bool file_failed = false;
 
 			// Iterate all file entries in file, check CRC and add to JSON
 			while((entry = reader.next_entry()))
 			{
 				total_entries++;
+				file_entries_read++;
+
 				if(!reader.entry_crc_valid())
 				{
 					crc_failures++;
 					continue;
 				}
-				
-				cur_req_entries++;
-				submitted_entries++;
 
-				json_builder.add(entry);
-			}
+				// Server has it already, request that sent it failed
+				if(reader.entry_acked())
+					continue;
 
-			// Send only if there are valid entries to be sent
-			if(cur_req_entries > 0)
-			{
-				json_builder.build(json_buff, sizeof(json_buff), false);
+				submitted_entries++;
 
-				total_requests++;
+				// Add entry if request has room for it
+				int count_before = json_builder->get_count();
+				bool req_full = max_req_entries > 0 && cur_req_entries >= max_req_entries;
+
+				uint32_t seq = reader.entry_seq();
 
-				if(submit_tb_telemetry(json_buff, strlen(json_buff)) == RET_OK)
+				if(!req_full &&
+					json_builder->add(entry) == RET_OK &&
+					(seq == 0 || json_builder->set_seq(seq) == RET_OK) &&
+					json_builder->measure() <= req_byte_budget)
 				{
-					// Request success, file can be deleted
-					reader.delete_file();
+					cur_req_entries++;
+					continue;
+				}
 
-					Utils::serial_style(STYLE_BLUE);
-					debug_println(F("Deleting file, all complete"));
-					Utils::serial_style(STYLE_RESET);
+				// Request full, submit it without this entry and start a new one with it
+				json_builder->truncate(count_before);
 
-					successfull_entries += cur_req_entries;
-					successfull_requests++;
+				if(cur_req_entries > 0 && send_request(file_entries_read - 1) != RET_OK)
+				{
+					file_failed = true;
+					break;
 				}
-				else
+
+				if(json_builder->add(entry) != RET_OK ||
+					(seq != 0 && json_builder->set_seq(seq) != RET_OK))
 				{
-					Utils::serial_style(STYLE_RED);
-					debug_println(F("Sending telemetry data failed. File remains to be retried next time."));
+					debug_println_e(F("Entry does not fit an empty request."));
+					json_builder->truncate(0);
+					continue;
+				}
+
+				cur_req_entries++;
+			}
+
+			if(file_failed)
+			{
+				// Entries of current file added after the failed request are not sent
+				json_builder->reset();
+				cur_req_entries = 0;
+			}
+			else
+			{
+				// All entries are in current request (or failed CRC), delete file with it
+				reader.queue_delete_file();
+
+				// Nothing pending to submit, eg. all entries failed CRC, delete now
+				if(cur_req_entries == 0)
+				{
+					Utils::serial_style(STYLE_BLUE);
+					debug_println(F("Deleting file, BAD CRC"));
 					Utils::serial_style(STYLE_RESET);
 
-					// Max error threshold reached, abort
-					if(total_requests - successfull_entries >= FAILED_TELEMETRY_REQ_THRESHOLD)
+					// Queue also holds files of request in flight
+					if(complete_inflight() == RET_OK)
 					{
-						submission_failed = true;
-						break;
+						reader.commit_deletes(reader.get_queued_deletes());
 					}
+					else
+					{
+						reader.discard_deletes(reader.get_queued_deletes());
+						file_failed = true;
+					}
+				}
+				// Can't track more files, submit now
+				else if(reader.get_queued_deletes() >= TELEMETRY_MAX_FILES_PER_REQ &&
+					send_request(0) != RET_OK)
+				{
+					file_failed = true;
 				}
 			}
-			else
+
+			// Max error threshold reached, abort
+			if(file_failed && total_requests - successfull_requests >= UplinkController::get_failed_req_threshold())
 			{
-				// All entries failed CRC in this file so it is useless, delete it
-				reader.delete_file();
+				submission_failed = true;
+			}
 
-				Utils::serial_style(STYLE_BLUE);
-				debug_println(F("Deleting file, BAD CRC"));
-				Utils::serial_style(STYLE_RESET);
+			if(max_requests > 0 && total_requests >= max_requests)
+			{
+				slice_complete = true;
 			}
+		}
 
-			// Empty packet and prepare for next
-			json_builder.reset();
+		// Submit what is left
+		if(!submission_failed && cur_req_entries > 0 && send_request(0) != RET_OK &&
+			total_requests - successfull_requests >= UplinkController::get_failed_req_threshold())
+		{
+			submission_failed = true;
 		}
 
+		if(complete_inflight() != RET_OK &&
+			total_requests - successfull_requests >= UplinkController::get_failed_req_threshold())
+		{
+			submission_failed = true;
+		}
+
+		delete json_builder;
+
+		if(done != NULL)
+			*done = submission_failed || !slice_complete;
+
 		// Print report
 		int failed_requests = total_requests - successfull_requests;
 
@@ -531,6 +1263,8 @@ namespace CallHome
 			stats->crc_failed_entries += crc_failures;
 			stats->total_requests += total_requests;
 			stats->failed_requests += failed_requests;
+			stats->json_bytes += json_bytes;
+			stats->sent_bytes += sent_bytes;
 		}
 
 		return submission_failed ? RET_ERROR : RET_OK;
@@ -549,16 +1283,32 @@ namespace CallHome
 		Utils::print_separator(F("Submitting logs."));
 		Utils::serial_style(STYLE_RESET);
 
+		// Logs stay in store, submitted next time
+		if(!CallHomeBudget::enter(CallHomeBudget::PHASE_LOGS))
+			return RET_OK;
+
 		// Disable logs to avoid getting stuck in loop in case an error occurrs while
 		// accessing the file system to read the logs
 		Log::set_enabled(false);
 
-		DataStoreSubmitStats log_stats;
-		ret = submit_stored_telemetry<DataStore<Log::Entry>, TbLogJsonBuilder, Log::Entry>(Log::get_store(), &log_stats);
+		// Make sure logs buffered so far are submitted too
+		Log::commit();
+
+		// In slices, so budget is checked in between
+		DataStoreSubmitStats log_stats = {0};
+		bool done = false;
+
+		do
+		{
+			ret = submit_stored_telemetry<DataStore<Log::Entry>, TbLogJsonBuilder, Log::Entry>(Log::get_store(), &log_stats,
+				0, TELEMETRY_SLICE_REQUESTS, &done);
+		}while(ret == RET_OK && !done && !CallHomeBudget::expired(CallHomeBudget::PHASE_LOGS));
 
 		// Reenable logging
 		Log::set_enabled(true);
 
+		log_compression_ratio(STORE_LOG, log_stats.json_bytes, log_stats.sent_bytes);
+
 		Utils::serial_style(STYLE_BLUE);
 		Utils::print_separator(F("Log submission complete"));
 		Utils::serial_style(STYLE_RESET);
@@ -568,11 +1318,105 @@ namespace CallHome
 
 
 	/******************************************************************************
-	 * Submit data to the TB telemetry API endpoint
+	 * Submit data to the TB telemetry API endpoint. Result and round-trip time are
+	 * reported to UplinkController
 	 * @param data Buffer with json for TB
 	 * @param data_size Buffer size
+	 * @param sent_size Bytes actually sent, differs when compressed. Can be NULL
+	 *****************************************************************************/
+	RetResult submit_tb_telemetry(const char *data, int data_size, int *sent_size)
+	{
+		// Back off after failed requests
+		uint32_t backoff = UplinkController::get_retry_backoff();
+		if(backoff > 0)
+		{
+			delay(backoff);
+			UplinkMetrics::on_retry();
+		}
+
+		uint32_t start_millis = millis();
+
+		RetResult ret = send_tb_telemetry(data, data_size, sent_size);
+
+		UplinkController::on_request_complete(ret == RET_OK, millis() - start_millis);
+
+		if(ret == RET_OK)
+			_telemetry_sent++;
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Submit multi-device telemetry (see TbGatewayJsonBuilder) to the TB gateway
+	 * API. It is MQTT only, so a separate MQTT connection is opened for it when
+	 * call home uses another transport. TB device must be set as a gateway
+	 *****************************************************************************/
+	RetResult submit_tb_gateway_telemetry(const char *data, int data_size, int *sent_size)
+	{
+		// Back off after failed requests
+		uint32_t backoff = UplinkController::get_retry_backoff();
+		if(backoff > 0)
+		{
+			delay(backoff);
+			UplinkMetrics::on_retry();
+		}
+
+		uint32_t start_millis = millis();
+
+		Utils::print_separator(F("Submitting gateway JSON"));
+		debug_println(data);
+		Utils::print_separator(F("END JSON"));
+
+		MQTT *mqtt = get_gateway_mqtt();
+
+		RetResult ret = mqtt != NULL ? mqtt->publish(TB_MQTT_GATEWAY_TELEMETRY_TOPIC, (const uint8_t*)data, data_size) : RET_ERROR;
+
+		if(sent_size != NULL)
+			*sent_size = data_size;
+
+		UplinkController::on_request_complete(ret == RET_OK, millis() - start_millis);
+
+		if(ret == RET_OK)
+			_telemetry_sent++;
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * MQTT connection for gateway API requests, the call home one if MQTT is the
+	 * transport, else connected on first use and closed with the transport
+	 * @return NULL if it could not connect
+	 *****************************************************************************/
+	MQTT* get_gateway_mqtt()
+	{
+		if(_mqtt != NULL)
+			return _mqtt;
+
+		if(_gateway_mqtt != NULL)
+			return _gateway_mqtt;
+
+		_gateway_mqtt_net_client = Bearer::new_client(MQTT_MUX);
+
+		if(_gateway_mqtt_net_client != NULL)
+			_gateway_mqtt = new (std::nothrow) MQTT(_gateway_mqtt_net_client, TB_SERVER, TB_MQTT_PORT, DeviceConfig::get_tb_device_token(), NULL);
+
+		if(_gateway_mqtt != NULL && _gateway_mqtt->connect() == RET_OK)
+			return _gateway_mqtt;
+
+		debug_println_e(F("Could not connect MQTT for gateway API."));
+
+		delete _gateway_mqtt;
+		_gateway_mqtt = NULL;
+		delete _gateway_mqtt_net_client;
+		_gateway_mqtt_net_client = NULL;
+
+		return NULL;
+	}
+
+	/******************************************************************************
+	 * Send data to the TB telemetry API endpoint over current transport
 	 *****************************************************************************/
-	RetResult submit_tb_telemetry(const char *data, int data_size)
+	RetResult send_tb_telemetry(const char *data, int data_size, int *sent_size)
 	{
 		char url[URL_BUFFER_SIZE] = "";
 
@@ -582,13 +1426,61 @@ namespace CallHome
 		debug_println(data);
 		Utils::print_separator(F("END JSON"));
 
+		if(_mqtt != NULL)
+		{
+			if(sent_size != NULL)
+				*sent_size = data_size;
+
+			uint32_t start_ms = millis();
+			RetResult ret = _mqtt->publish(TB_MQTT_TELEMETRY_TOPIC, (const uint8_t*)data, data_size);
+
+			UplinkMetrics::on_request(millis() - start_ms, data_size, 0, ret == RET_OK ? -1 : 0);
+			Bearer::on_request(millis() - start_ms, ret == RET_OK);
+
+			return ret;
+		}
+
+		if(Coap::is_open())
+		{
+			if(sent_size != NULL)
+				*sent_size = data_size;
+
+			snprintf(url, sizeof(url), TB_COAP_TELEMETRY_PATH_FORMAT, DeviceConfig::get_tb_device_token());
+
+			uint32_t start_ms = millis();
+			RetResult ret = Coap::post(url, (const uint8_t*)data, data_size);
+
+			UplinkMetrics::on_request(millis() - start_ms, data_size, 0, ret == RET_OK ? -1 : 0);
+			Bearer::on_request(millis() - start_ms, ret == RET_OK);
+
+			return ret;
+		}
+
 		// Send REQ
 		HttpRequest http_req(GSM::get_modem(), TB_SERVER);
 		http_req.set_port(TB_PORT);
 
-		RetResult ret = http_req.post(url, (uint8_t*)data, data_size, "application/json", NULL, 0);
+		char resp[TB_TELEMETRY_RESP_BUFF_SIZE] = "";
+		RetResult ret;
+
+		if(gzip_telemetry())
+		{
+			ret = post_tb_telemetry_gzip(http_req, url, [&](Print &out) { out.write((const uint8_t*)data, data_size); },
+				data_size, resp, sizeof(resp), sent_size);
+		}
+		else
+		{
+			if(sent_size != NULL)
+				*sent_size = data_size;
+
+			ret = http_req.post(url, (const uint8_t*)data, data_size, "application/json", resp, sizeof(resp));
+		}
+
 		Serial.flush();
 
+		if(ret == RET_OK)
+			parse_ack_seq(resp);
+
 		if(ret != RET_OK || http_req.get_response_code() != 200)
 		{
 			Utils::serial_style(STYLE_RED);
@@ -601,136 +1493,273 @@ namespace CallHome
 	}
 
 	/******************************************************************************
-	* Submit 
-	******************************************************************************/
-	RetResult submit_ipfs()
+	 * Submit telemetry to the TB telemetry API endpoint, body is written directly
+	 * to the HTTP connection. See can_stream_telemetry()
+	 * @param body_writer Writes the JSON body
+	 * @param data_size Exact body length
+	 * @param sent_size Bytes actually sent, differs when compressed
+	 *****************************************************************************/
+	RetResult submit_tb_telemetry_streamed(HttpRequest::BodyWriter body_writer, int data_size, int *sent_size)
 	{
-		if(!FLAGS.IPFS)
+		char url[URL_BUFFER_SIZE] = "";
+
+		snprintf(url, sizeof(url), TB_TELEMETRY_URL_FORMAT, DeviceConfig::get_tb_device_token());
+
+		#if DEBUG
+			Utils::print_separator(F("Submitting JSON (streamed)"));
+			body_writer(Serial);
+			debug_println();
+			Utils::print_separator(F("END JSON"));
+		#endif
+
+		HttpRequest http_req(GSM::get_modem(), TB_SERVER);
+		http_req.set_port(TB_PORT);
+
+		// Back off after failed requests
+		uint32_t backoff = UplinkController::get_retry_backoff();
+		if(backoff > 0)
 		{
-			return RET_OK;
+			delay(backoff);
+			UplinkMetrics::on_retry();
 		}
 
-		Utils::serial_style(STYLE_BLUE);
-		Utils::print_separator(F("Submitting IPFS."));
-		Utils::serial_style(STYLE_RESET);
+		uint32_t start_millis = millis();
 
-		//
-		// Add dummy data to store
-		//
-		// FoData::StoreEntry dummy_entry = {0};
-		// dummy_entry.hum = 434;
-		// dummy_entry.temp = 22;
-		// dummy_entry.timestamp = RTC::get_timestamp();;
-		// dummy_entry.light = 1000000;
-		// dummy_entry.solar_radiation = 1234;
-		// dummy_entry.wind_dir = 12;
-		// dummy_entry.wind_gust = 12;
-		// dummy_entry.wind_speed = 2;
-		// FoData::add(&dummy_entry);
-
-		// dummy_entry.hum = 99;
-		// dummy_entry.temp = 66;
-		// dummy_entry.timestamp = RTC::get_timestamp()+1;
-		// dummy_entry.light = 663;
-		// dummy_entry.solar_radiation = 667;
-		// dummy_entry.wind_dir = 66;
-		// dummy_entry.wind_gust = 66;
-		// dummy_entry.wind_speed = 6;
-		// FoData::add(&dummy_entry);
-		/////////
-
-		TbFoDataJsonBuilder json_builder;
-		char data_buff[TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE] = {0};
-
-		WiFiClient wifi_client;
-		IPFSClient client(wifi_client);
-		
-		client.set_node_address(IPFS_NODE_ADDR, IPFS_NODE_PORT);
+		char resp[TB_TELEMETRY_RESP_BUFF_SIZE] = "";
+		RetResult ret;
 
-		DataStoreReader<FoData::StoreEntry> reader(FoData::get_store());
-		const FoData::StoreEntry *entry = NULL;
+		if(gzip_telemetry())
+		{
+			ret = post_tb_telemetry_gzip(http_req, url, body_writer, data_size, resp, sizeof(resp), sent_size);
+		}
+		else
+		{
+			*sent_size = data_size;
+			ret = http_req.post(url, body_writer, data_size, "application/json", resp, sizeof(resp));
+		}
 
-		while(reader.next_file())
+		Serial.flush();
+
+		if(ret == RET_OK)
+			parse_ack_seq(resp);
+
+		UplinkController::on_request_complete(ret == RET_OK && http_req.get_response_code() == 200,
+			millis() - start_millis);
+
+		if(ret != RET_OK || http_req.get_response_code() != 200)
 		{
-			while((entry = reader.next_entry()))
+			Utils::serial_style(STYLE_RED);
+			debug_println(F("TB telemetry submission failed."));
+			Utils::serial_style(STYLE_RESET);
+			return RET_ERROR;
+		}
+
+		_telemetry_sent++;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Post telemetry gzipped, or uncompressed if it does not get smaller. The body
+	 * is compressed twice, once to measure it (Content-Length goes ahead of it) and
+	 * once into the connection, so no buffer of the compressed body is needed
+	 * @param body_writer Writes the JSON body
+	 * @param data_size Exact JSON body length
+	 * @param sent_size Bytes actually sent. Can be NULL
+	 *****************************************************************************/
+	RetResult post_tb_telemetry_gzip(HttpRequest &http_req, const char *url, HttpRequest::BodyWriter body_writer,
+		int data_size, char *resp, int resp_size, int *sent_size)
+	{
+		GzipStream gzip;
+		int gzip_len = gzip ? gzip.measure(body_writer) : -1;
+
+		if(gzip_len < 0 || gzip_len >= data_size)
+		{
+			if(sent_size != NULL)
+				*sent_size = data_size;
+
+			return http_req.post(url, body_writer, data_size, "application/json", resp, resp_size);
+		}
+
+		debug_print(F("Compressed to bytes: "));
+		debug_println(gzip_len, DEC);
+
+		if(sent_size != NULL)
+			*sent_size = gzip_len;
+
+		http_req.set_content_encoding("gzip");
+
+		return http_req.post(url, [&](Print &out)
 			{
-				if(!reader.entry_crc_valid())
-				{
-					continue;
-				}
+				gzip.begin(&out);
+				body_writer(gzip);
+				gzip.finish();
+			}, gzip_len, "application/json", resp, resp_size);
+	}
 
-				json_builder.add(entry);
+	/******************************************************************************
+	 * Keep sequence number acknowledged by a telemetry response, if any. Servers
+	 * deduplicating by seq reply {"ack_seq": N} when a request is rejected after
+	 * entries up to N were accepted (eg. by an earlier attempt whose response
+	 * was lost)
+	 *****************************************************************************/
+	void parse_ack_seq(const char *resp)
+	{
+		if(resp[0] != '{')
+			return;
 
-				// Add geohash to JSON
-				JsonDocument *json_doc = json_builder.get_json_doc();
-				
-				json_doc->getElement(0)["values"]["geohash"] = DEVICE_GEOHASH;
+		StaticJsonDocument<TB_TELEMETRY_RESP_BUFF_SIZE> doc;
 
-				// Get timestamp of record
-				uint32_t tstamp = (uint64_t)json_doc->getElement(0)["ts"] / 1000;
-				
-				json_builder.build(data_buff, sizeof(data_buff), true);
+		if(deserializeJson(doc, resp) != DeserializationError::Ok)
+			return;
 
-				// Serial.println(F("Submitting --------------------"));
-				// Serial.println(data_buff);
-				// Serial.println(F("------------------------------------------------------------------------"));
+		uint32_t ack_seq = doc[TB_TELEMETRY_ACK_SEQ_KEY] | 0;
 
-				IPFSClient::IPFSFile ipfs_file = {0};
-				if(client.add(&ipfs_file, "ws", data_buff) == IPFSClient::IPFS_CLIENT_OK)
-				{
-					Serial.println(F("Hash: "));
-					Serial.println(ipfs_file.hash);
+		if(ack_seq > 0)
+		{
+			debug_print(F("Server acknowledged up to seq: "));
+			debug_println(ack_seq, DEC);
 
-					//
-					// Submit hash
-					//
-					const char cid_submit_url_format[] = "/ipfs/%s";
-					data_buff[0] = '\0';
+			_ack_seq = ack_seq;
+		}
+	}
 
-					snprintf(data_buff, sizeof(data_buff), cid_submit_url_format, ipfs_file.hash);
+	/******************************************************************************
+	 * Get and clear sequence number acknowledged by last response, 0 if none
+	 *****************************************************************************/
+	uint32_t take_ack_seq()
+	{
+		uint32_t ack_seq = _ack_seq;
+		_ack_seq = 0;
 
-					HttpRequest http_req(GSM::get_modem(), IPFS_MIDDLEWARE_URL);
-					http_req.set_port(IPFS_MIDDLEWARE_PORT);
+		return ack_seq;
+	}
 
-					debug_print(F("Submitting CID to Middleware: "));
-					debug_println(data_buff);
-					
-					RetResult ret = http_req.post(data_buff, NULL, 0, "application/json", NULL, 0);
-					Serial.flush();
+	/******************************************************************************
+	 * Check if telemetry can be streamed from the builder to the connection.
+	 * Only with plain HTTP (gzipped or not): MQTT/CoAP send a buffer and the
+	 * uploader sends a buffer while the builder is reused for the next request.
+	 *****************************************************************************/
+	bool can_stream_telemetry()
+	{
+		return FLAGS.STREAMED_TELEMETRY && _mqtt == NULL && !Coap::is_open() && !TelemetryUploader::is_running();
+	}
 
-					if(ret != RET_OK || http_req.get_response_code() != 200)
-					{
-						debug_println_e(F("CID submission failed."));
-					}				
-					data_buff[0] = '\0';
-
-					//
-					// Submit hash to thingsboard
-					//
-					Utils::build_ipfs_file_json(ipfs_file.hash, tstamp, data_buff, sizeof(data_buff));
-					Serial.println(F("TB JSON: "));
-					Serial.println(data_buff);
-					submit_tb_telemetry(data_buff, strlen(data_buff));
-
-					data_buff[0] = '\0';
-				}
-				else
-				{
-					debug_println_e(F("Could not submit data to IPFS."));
-				}
-				
-				json_builder.reset();
+	/******************************************************************************
+	 * Telemetry requests are compressed: FLAGS.GZIP_TELEMETRY and the compressor
+	 * state fits, it only does in PSRAM (see GzipStream)
+	 *****************************************************************************/
+	bool gzip_telemetry()
+	{
+		return FLAGS.GZIP_TELEMETRY && Psram::available();
+	}
 
-			}
+	/******************************************************************************
+	 * Log how much telemetry of a store compressed, if it was compressed and any
+	 * was sent
+	 *****************************************************************************/
+	void log_compression_ratio(StoreId id, int json_bytes, int sent_bytes)
+	{
+		if(gzip_telemetry() && json_bytes > 0)
+			Log::log(Log::TELEMETRY_COMPRESSION_RATIO, json_bytes | ((uint32_t)id << 24), sent_bytes);
+	}
+
+	/******************************************************************************
+	 * Fan out a FO telemetry request to IPFS. The whole batch is a single IPFS
+	 * object, its CID is computed locally and posted to the middleware while the
+	 * content waits for the bulk upload after telemetry. When the request is a
+	 * JSON array the hash entry is appended to it so it goes out with the same TB
+	 * request, otherwise it is submitted as a separate request after this one.
+	 * @param json Request built by submit_stored_telemetry, modified in place
+	 * @param json_len Length of request
+	 * @param buff_size Size of request buffer
+	 * @return New length of request
+	 *****************************************************************************/
+#if FEATURE_IPFS
+	int ipfs_fan_out(char *json, int json_len, int buff_size)
+	{
+		const char ipfs_obj_format[] = "{\"geohash\":\"%s\",\"data\":";
+		const char cid_submit_url_format[] = "/ipfs/%s";
+		const char ts_key[] = "[{\"ts\":";
+
+		int obj_size = json_len + sizeof(ipfs_obj_format) + strlen(DEVICE_GEOHASH) + 2;
+		ScratchBuffer ipfs_obj_buff(obj_size);
+		char *ipfs_obj = ipfs_obj_buff.get();
+
+		if(ipfs_obj == NULL)
+		{
+			debug_println_e(F("Could not allocate IPFS object."));
+			return json_len;
 		}
-		//////////////////////
 
-		Utils::serial_style(STYLE_BLUE);
-		Utils::print_separator(F("IPFS submission complete"));
-		Utils::serial_style(STYLE_RESET);
+		int obj_len = snprintf(ipfs_obj, obj_size, ipfs_obj_format, DEVICE_GEOHASH);
+		memcpy(ipfs_obj + obj_len, json, json_len);
+		obj_len += json_len;
+		ipfs_obj[obj_len++] = '}';
+		ipfs_obj[obj_len] = '\0';
 
-		return RET_OK;
+		char cid[IPFS_CID_STR_SIZE] = "";
+
+		if(Ipfs::add_block((const uint8_t*)ipfs_obj, obj_len, cid, sizeof(cid)) != RET_OK)
+		{
+			debug_println_e(F("Could not add data to IPFS."));
+			return json_len;
+		}
+
+		debug_print(F("IPFS hash: "));
+		debug_println(cid);
+
+		//
+		// Submit hash to middleware
+		//
+		char url[sizeof(cid_submit_url_format) + sizeof(cid)] = "";
+		snprintf(url, sizeof(url), cid_submit_url_format, cid);
+
+		HttpRequest http_req(GSM::get_modem(), IPFS_MIDDLEWARE_URL);
+		http_req.set_port(IPFS_MIDDLEWARE_PORT);
+
+		debug_print(F("Submitting CID to Middleware: "));
+		debug_println(url);
+
+		RetResult ret = http_req.post(url, NULL, 0, "application/json", NULL, 0);
+
+		if(ret != RET_OK || http_req.get_response_code() != 200)
+		{
+			debug_println_e(F("CID submission failed."));
+		}
+
+		//
+		// Submit hash to thingsboard, timestamp of first entry in batch
+		//
+		long long tstamp = (long long)RTC::get_timestamp() * 1000;
+
+		if(strncmp(json, ts_key, sizeof(ts_key) - 1) == 0)
+		{
+			tstamp = atoll(json + sizeof(ts_key) - 1);
+		}
+
+		char hash_json[128] = "";
+		int hash_json_len = snprintf(hash_json, sizeof(hash_json), ",{\"ts\":%lld,\"values\":{\"ipfs_hash\":\"%s\"}}",
+			tstamp, cid);
+
+		if(json_len > 1 && json[0] == '[' && json[json_len - 1] == ']' &&
+			json_len + hash_json_len < buff_size)
+		{
+			// Append to array, before closing bracket
+			memcpy(json + json_len - 1, hash_json, hash_json_len);
+			json_len += hash_json_len - 1;
+			json[json_len++] = ']';
+			json[json_len] = '\0';
+
+			return json_len;
+		}
+
+		Utils::build_ipfs_file_json(cid, tstamp / 1000, hash_json, sizeof(hash_json));
+		submit_tb_telemetry(hash_json, strlen(hash_json));
+
+		return json_len;
 	}
+#endif
 
 	/******************************************************************************
 	 * Request remote config and apply if received any
@@ -747,108 +1776,295 @@ namespace CallHome
 	 *****************************************************************************/
 	RetResult handle_client_attributes()
 	{
-		StaticJsonDocument<CLIENT_ATTRIBUTES_JSON_DOC_SIZE> json_doc;
+		// Doc and request buffer from scratch arena, freed on return
+		Scratch::Scope scratch;
+		ScratchJsonDocument json_doc(CLIENT_ATTRIBUTES_JSON_DOC_SIZE);
 		char url[URL_BUFFER_SIZE_LARGE] = "";
 
 		// Device token required for URL
 		snprintf(url, sizeof(url), TB_CLIENT_ATTRIBUTES_URL_FORMAT, DeviceConfig::get_tb_device_token());
 
+		// Only progress while draining, the rest waits for a regular call home
+		bool drain = BacklogDrain::is_active();
+
+		if(!drain)
+			add_device_attributes(json_doc);
+
+		BacklogDrain::add_attributes(json_doc);
+
+		if(json_doc.capacity() == 0)
+		{
+			Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, 0);
+			return RET_ERROR;
+		}
+
 		//
-		// Add main keys
+		// Publish only what changed since last published. Drain progress changes
+		// every time and is published as is
 		//
-		json_doc[TB_ATTR_CUR_FW_V] = FW_VERSION;
-		json_doc[TB_ATTR_CUR_WAS_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WATER_SENSORS);
-		json_doc[TB_ATTR_CUR_WES_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WEATHER_STATION);
-		json_doc[TB_ATTR_CUR_SM_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_SOIL_MOISTURE_SENSOR);
-		json_doc[TB_ATTR_CUR_CH_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_CALL_HOME);
-		json_doc[TB_ATTR_CUR_SYSTEM_TIME] = RTC::get_timestamp();
-		json_doc[TB_ATTR_UPTIME] = millis() / 1000;
-		json_doc[TB_ATTR_FLAGS] = build_flags_bitmask();
+		DeviceConfig::ClientAttrState attr_state = {0};
+
+		if(FLAGS.DELTA_CLIENT_ATTRIBUTES && !drain)
+		{
+			int published = drop_unchanged_attributes(json_doc, &attr_state);
+
+			Log::log(Log::DEVICE_STATUS, millis() / 1000, published);
+
+			if(published < 0)
+			{
+				debug_println(F("Client attributes unchanged."));
+				return RET_OK;
+			}
+		}
+
+		ScratchBuffer buff(GLOBAL_HTTP_RESPONSE_BUFFER_LEN);
+		if(buff.get() == NULL)
+		{
+			Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, 0);
+			return RET_ERROR;
+		}
+
+		serializeJson(json_doc, buff.get(), buff.size());
+
+		// Submit request
+		debug_print(F("Submitting client attribute req: "));
+		debug_println(buff.get());
+
+		RetResult ret = RET_ERROR;
+
+		if(_mqtt != NULL)
+		{
+			ret = _mqtt->publish(TB_MQTT_ATTRIBUTES_TOPIC, (uint8_t*)buff.get(), strlen(buff.get()));
+
+			if(ret != RET_OK)
+			{
+				debug_println(F("Could not publish client attributes."));
+
+				Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, 0);
+			}
+		}
+		else if(Coap::is_open())
+		{
+			char path[URL_BUFFER_SIZE] = "";
+			snprintf(path, sizeof(path), TB_COAP_ATTRIBUTES_PATH_FORMAT, DeviceConfig::get_tb_device_token());
+
+			ret = Coap::post(path, (uint8_t*)buff.get(), strlen(buff.get()));
+
+			if(ret != RET_OK)
+			{
+				debug_println(F("Could not post client attributes."));
+
+				Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, 0);
+			}
+		}
+		else
+		{
+			HttpRequest http_req(GSM::get_modem(), TB_SERVER);
+			http_req.set_port(TB_PORT);
+
+			// Response body is not used
+			ret = http_req.post(url, (uint8_t*)buff.get(), strlen(buff.get()), "application/json", NULL, 0);
+
+			if(ret != RET_OK)
+			{
+				debug_println(F("Could not publish client attributes."));
+
+				Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, http_req.get_response_code());
+			}
+		}
+
+		// Published, next call home compares against these
+		if(ret == RET_OK && FLAGS.DELTA_CLIENT_ATTRIBUTES)
+			DeviceConfig::set_client_attr_state(&attr_state);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Add device info, config and memory use to client attributes
+	 *****************************************************************************/
+	void add_device_attributes(JsonDocument &doc)
+	{
+		doc[TB_ATTR_CUR_FW_V] = FW_VERSION;
+		doc[TB_ATTR_CUR_WAS_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WATER_SENSORS);
+		doc[TB_ATTR_CUR_WES_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_WEATHER_STATION);
+		doc[TB_ATTR_CUR_SM_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_READ_SOIL_MOISTURE_SENSOR);
+		doc[TB_ATTR_CUR_CH_INT] = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_CALL_HOME);
+		doc[TB_ATTR_CUR_POWER_SCALE] = PowerGovernor::get_scale();
+		doc[TB_ATTR_FLAGS] = build_flags_bitmask();
+
+		// Change every call home, would defeat delta publishing. Logged instead,
+		// submitted with telemetry
+		if(!FLAGS.DELTA_CLIENT_ATTRIBUTES)
+		{
+			doc[TB_ATTR_CUR_SYSTEM_TIME] = RTC::get_timestamp();
+			doc[TB_ATTR_UPTIME] = millis() / 1000;
+		}
 
 		// FO Enabled
-		json_doc[TB_ATTR_CUR_FO_EN] = DeviceConfig::get_fo_enabled();
+		doc[TB_ATTR_CUR_FO_EN] = DeviceConfig::get_fo_enabled();
 
 		// FO id
 		char fo_id[5] = "";
 		snprintf(fo_id, sizeof(fo_id), "%02x", DeviceConfig::get_fo_sniffer_id());
-		json_doc[TB_ATTR_CUR_FO_ID] = fo_id;
+		doc[TB_ATTR_CUR_FO_ID] = fo_id;
 
 		// Include aquatroll model if water quality sensor is enabled
 		if(FLAGS.WATER_QUALITY_SENSOR_ENABLED)
 		{
 			if(AQUATROLL_MODEL == AQUATROLL_MODEL_400)
 			{
-				json_doc[TB_ATTR_AQUATROLL_MODEL] = "400";
+				doc[TB_ATTR_AQUATROLL_MODEL] = "400";
 			}
 			else if(AQUATROLL_MODEL == AQUATROLL_MODEL_500)
 			{
-				json_doc[TB_ATTR_AQUATROLL_MODEL] = "500";
+				doc[TB_ATTR_AQUATROLL_MODEL] = "500";
 			}
 			else if(AQUATROLL_MODEL == AQUATROLL_MODEL_600)
 			{
-				json_doc[TB_ATTR_AQUATROLL_MODEL] = "600";
+				doc[TB_ATTR_AQUATROLL_MODEL] = "600";
 			}
 			else
 			{
-				json_doc[TB_ATTR_AQUATROLL_MODEL] = "";
+				doc[TB_ATTR_AQUATROLL_MODEL] = "";
 			}
-			json_doc[TB_ATTR_UPTIME] = millis() / 1000;
 		}
 
 		//
 		// Add flags 
 		//
 		
-		serializeJson(json_doc, g_resp_buffer, sizeof(g_resp_buffer));
+		// Memory use since boot
+		MemoryMonitor::sample(MemoryMonitor::PHASE_CALL_HOME);
+		MemoryMonitor::add_attributes(doc);
+	}
 
-		// Submit request
-		debug_print(F("Submitting client attribute req: "));
-		debug_println(g_resp_buffer);
+	/******************************************************************************
+	 * Remove attributes published with the same value before from doc, all are
+	 * kept when a full refresh is due (CLIENT_ATTR_FULL_REFRESH_SECS). Attributes
+	 * are compared by CRC32 of key and serialized value
+	 * @param doc Attributes to publish
+	 * @param state Receives hashes of all attributes in doc, to store once published
+	 * @return Number of attributes left to publish, -1 if none changed
+	 *****************************************************************************/
+	int drop_unchanged_attributes(JsonDocument &doc, DeviceConfig::ClientAttrState *state)
+	{
+		DeviceConfig::ClientAttrState last = {0};
+		uint32_t now = RTC::get_timestamp();
 
-		HttpRequest http_req(GSM::get_modem(), TB_SERVER);
-		http_req.set_port(TB_PORT);
-		// TODO: Is it problematic to use same buffer for send/receive?
-		RetResult ret = http_req.post(url, (uint8_t*)g_resp_buffer, strlen(g_resp_buffer), "application/json", g_resp_buffer, sizeof(g_resp_buffer));
+		bool full = DeviceConfig::get_client_attr_state(&last) != RET_OK ||
+			now - last.last_full_tstamp >= CLIENT_ATTR_FULL_REFRESH_SECS;
+
+		state->last_full_tstamp = full ? now : last.last_full_tstamp;
 
-		if(ret != RET_OK)
+		// Keys are the static attribute names, so pointers stay valid after remove
+		const char *unchanged[CLIENT_ATTR_MAX_KEYS];
+		int unchanged_count = 0;
+		int total = 0;
+
+		for(JsonPair kv : doc.as<JsonObject>())
 		{
-			debug_println(F("Could not publish client attributes."));
-			
-			Log::log(Log::TB_CLIENT_ATTR_PUBLISH_FAILED, http_req.get_response_code());
+			char value[CLIENT_ATTR_VALUE_BUFF_SIZE] = "";
+			size_t value_len = serializeJson(kv.value(), value, sizeof(value));
+
+			uint32_t key_crc = Utils::crc32((uint8_t*)kv.key().c_str(), strlen(kv.key().c_str()));
+			uint32_t value_crc = Utils::crc32((uint8_t*)value, value_len);
+
+			total++;
+
+			// Not tracked, always published
+			if(state->count >= CLIENT_ATTR_MAX_KEYS)
+				continue;
+
+			state->attrs[state->count].key_crc = key_crc;
+			state->attrs[state->count].value_crc = value_crc;
+			state->count++;
+
+			if(full)
+				continue;
+
+			for(int i = 0; i < last.count && i < CLIENT_ATTR_MAX_KEYS; i++)
+			{
+				if(last.attrs[i].key_crc == key_crc)
+				{
+					if(last.attrs[i].value_crc == value_crc)
+						unchanged[unchanged_count++] = kv.key().c_str();
+					break;
+				}
+			}
 		}
 
-		return ret;
+		for(int i = 0; i < unchanged_count; i++)
+			doc.remove(unchanged[i]);
+
+		int left = total - unchanged_count;
+
+		return left > 0 ? left : -1;
 	}
 
 	
 	/******************************************************************************
 	 * Build a bitmask from FLAGS to submit as attribute to server
-	 * Compiler messes up bit order so it must be done here manually
+	 * Compiler messes up bit order so it must be done here manually. Bits are
+	 * never reused, new flags take the next free one
 	 *****************************************************************************/
-	uint32_t build_flags_bitmask()
+	uint64_t build_flags_bitmask()
 	{
-		uint32_t bits = 0;
+		uint64_t bits = 0;
 
 		bits =
-			FLAGS.DEBUG_MODE |
-			(FLAGS.LOG_RAW_SDI12_COMMS << 1) | 
-			(FLAGS.WIFI_DEBUG_CONSOLE_ENABLED << 2) | 
-			(FLAGS.WIFI_DATA_SUBMISSION_ENABLED << 3) | 
-			(FLAGS.BATTERY_GAUGE_ENABLED << 4) | 
-			(FLAGS.NBIOT_MODE << 5) | 
-			(FLAGS.SLEEP_MINS_AS_SECS << 6) | 
-			(FLAGS.BATTERY_FORCE_NORMAL_MODE << 7) | 
-			(FLAGS.WATER_QUALITY_SENSOR_ENABLED << 8) | 
-			(FLAGS.WATER_LEVEL_SENSOR_ENABLED << 9) | 
-			(FLAGS.ATMOS41_ENABLED << 10) | 
-			(FLAGS.SOIL_MOISTURE_SENSOR_ENABLED << 12) | 
-			(FLAGS.MEASURE_DUMMY_WATER_QUALITY << 13) | 
-			(FLAGS.MEASURE_DUMMY_WATER_LEVEL << 14) | 
-			(FLAGS.MEASURE_DUMMY_WEATHER << 15) | 
-			(FLAGS.EXTERNAL_RTC_ENABLED << 16) | 
-			(FLAGS.SOLAR_CURRENT_MONITOR_ENABLED << 17) | 
-			(FLAGS.RTC_AUTO_SYNC << 18) | 
-			(FLAGS.IPFS << 19)
+			(uint64_t)FLAGS.DEBUG_MODE |
+			((uint64_t)FLAGS.LOG_RAW_SDI12_COMMS << 1) |
+			((uint64_t)FLAGS.WIFI_DEBUG_CONSOLE_ENABLED << 2) |
+			((uint64_t)FLAGS.WIFI_DATA_SUBMISSION_ENABLED << 3) |
+			((uint64_t)FLAGS.BATTERY_GAUGE_ENABLED << 4) |
+			((uint64_t)FLAGS.NBIOT_MODE << 5) |
+			((uint64_t)FLAGS.SLEEP_MINS_AS_SECS << 6) |
+			((uint64_t)FLAGS.BATTERY_FORCE_NORMAL_MODE << 7) |
+			((uint64_t)FLAGS.WATER_QUALITY_SENSOR_ENABLED << 8) |
+			((uint64_t)FLAGS.WATER_LEVEL_SENSOR_ENABLED << 9) |
+			((uint64_t)FLAGS.ATMOS41_ENABLED << 10) |
+			((uint64_t)FLAGS.SOIL_MOISTURE_SENSOR_ENABLED << 12) |
+			((uint64_t)FLAGS.MEASURE_DUMMY_WATER_QUALITY << 13) |
+			((uint64_t)FLAGS.MEASURE_DUMMY_WATER_LEVEL << 14) |
+			((uint64_t)FLAGS.MEASURE_DUMMY_WEATHER << 15) |
+			((uint64_t)FLAGS.EXTERNAL_RTC_ENABLED << 16) |
+			((uint64_t)FLAGS.SOLAR_CURRENT_MONITOR_ENABLED << 17) |
+			((uint64_t)FLAGS.RTC_AUTO_SYNC << 18) |
+			((uint64_t)FLAGS.IPFS << 19) |
+			((uint64_t)FLAGS.LOG_BATCH_COMMIT << 20) |
+			((uint64_t)FLAGS.BINARY_TELEMETRY << 21) |
+			((uint64_t)FLAGS.GZIP_TELEMETRY << 22) |
+			((uint64_t)FLAGS.PIPELINED_UPLOAD << 23) |
+			((uint64_t)FLAGS.STREAMED_TELEMETRY << 24) |
+			((uint64_t)FLAGS.DOM_JSON_BUILDERS << 25) |
+			((uint64_t)FLAGS.COLUMNAR_TELEMETRY << 26) |
+			((uint64_t)FLAGS.DEEP_SLEEP << 27) |
+			((uint64_t)FLAGS.WARM_BOOT << 28) |
+			((uint64_t)FLAGS.FO_CONTINUOUS_RX << 29) |
+			((uint64_t)FLAGS.GSM_PSM << 30) |
+			((uint64_t)FLAGS.ULP_SLEEP_CHARGE << 31) |
+			((uint64_t)FLAGS.ADAPTIVE_WATER_SAMPLING << 32) |
+			((uint64_t)FLAGS.ROLLUP_EVICTED_DATA << 33) |
+			((uint64_t)FLAGS.STORE_COMPACTION << 34) |
+			((uint64_t)FLAGS.BACKLOG_CALL_HOME << 35) |
+			((uint64_t)FLAGS.LORA_RELAY << 36) |
+			((uint64_t)FLAGS.STORE_ARCHIVE << 37) |
+			((uint64_t)FLAGS.PARALLEL_ACQUISITION << 38) |
+			((uint64_t)FLAGS.TEROS12_DDI_CAPTURE << 39) |
+			((uint64_t)FLAGS.DELTA_CLIENT_ATTRIBUTES << 40) |
+			((uint64_t)FLAGS.CALL_HOME_BUDGET << 41) |
+			((uint64_t)FLAGS.UPLINK_METRICS << 42) |
+			((uint64_t)FLAGS.PSRAM_STAGING << 43) |
+			((uint64_t)FLAGS.FIELD_OFFLOAD << 44) |
+			((uint64_t)FLAGS.RAW_CAPTURE << 45) |
+			((uint64_t)FLAGS.FS_STATS << 46) |
+			((uint64_t)FLAGS.GSM_SLOW_CLOCK << 47) |
+			((uint64_t)FLAGS.LORA_OTA << 48) |
+			((uint64_t)FLAGS.SOLAR_DEFERRAL << 49) |
+			((uint64_t)FLAGS.TIERED_WAKE << 50) |
+			((uint64_t)FLAGS.BACKLOG_DRAIN << 51) |
+			((uint64_t)FLAGS.DYNAMIC_FREQ << 52)
 		;
 
 		return bits;
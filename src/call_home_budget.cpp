@@ -0,0 +1,331 @@
+#include "Arduino.h"
+#include "call_home_budget.h"
+#include <esp_timer.h>
+#include <esp_system.h>
+#include "battery.h"
+#include "battery_gauge.h"
+#include "log.h"
+#include "utils.h"
+#include "common.h"
+
+/******************************************************************************
+* Deadlines and energy limit of call home phases
+******************************************************************************/
+namespace CallHomeBudget
+{
+	//
+	// Private types
+	//
+	struct PhaseInfo
+	{
+		/** Name to print */
+		const char *name;
+
+		/** Share (%) of the session budget */
+		uint8_t budget_percent;
+	};
+
+	/**
+	 * Phases left unfinished by the last session. RTC_NOINIT memory survives deep
+	 * sleep and the watchdog restart (but not power loss)
+	 */
+	struct CarriedState
+	{
+		uint32_t magic;
+
+		/** Bit per Phase */
+		uint8_t deferred_mask;
+
+		/** Phase the watchdog fired in + 1, 0 if it did not */
+		uint8_t watchdog_phase;
+
+		uint32_t crc32;
+	}__attribute__((packed));
+
+	//
+	// Private functions
+	//
+	uint8_t share_percent(Phase phase);
+	void defer(Phase phase);
+	float used_mah();
+	float read_gauge();
+	void store_carried(uint8_t deferred_mask, uint8_t watchdog_phase);
+	bool carried_valid();
+	void watchdog_cb(void *arg);
+
+	//
+	// Private vars
+	//
+	const PhaseInfo PHASES[] = {
+		[PHASE_ATTACH] = {"attach", CALL_HOME_BUDGET_ATTACH_PERCENT},
+		[PHASE_REMOTE_CONTROL] = {"remote control", CALL_HOME_BUDGET_REMOTE_CONTROL_PERCENT},
+		[PHASE_OTA] = {"OTA", CALL_HOME_BUDGET_OTA_PERCENT},
+		[PHASE_ATTRIBUTES] = {"attributes", CALL_HOME_BUDGET_ATTRIBUTES_PERCENT},
+		[PHASE_TELEMETRY] = {"telemetry", CALL_HOME_BUDGET_TELEMETRY_PERCENT},
+		[PHASE_LOGS] = {"logs", CALL_HOME_BUDGET_LOGS_PERCENT}
+	};
+
+	static_assert(sizeof(PHASES) / sizeof(PHASES[0]) == PHASE_COUNT, "Describe every phase");
+	static_assert(PHASE_COUNT <= 8, "Phase masks are 8 bits");
+
+	RTC_NOINIT_ATTR CarriedState _carried;
+
+	/** Session running, between begin() and end() */
+	bool _active = false;
+
+	/** Millis session began */
+	uint32_t _start_ms = 0;
+
+	/** Budget of current session */
+	uint32_t _budget_ms = 0;
+	float _budget_mah = 0;
+
+	/** Gauge charge at session start, NAN without gauge */
+	float _start_mah = NAN;
+
+	/** Phases deferred by last session, may use the whole budget in this one */
+	uint8_t _carried_mask = 0;
+
+	/** Phases deferred in this session, read by the watchdog */
+	volatile uint8_t _deferred_mask = 0;
+
+	/** Phase last entered, read by the watchdog */
+	volatile uint8_t _current = PHASE_ATTACH;
+
+	esp_timer_handle_t _watchdog = NULL;
+
+	/******************************************************************************
+	* Start budget of a call home session and arm the watchdog
+	******************************************************************************/
+	void begin()
+	{
+		if(!FLAGS.CALL_HOME_BUDGET || _active)
+			return;
+
+		_active = true;
+		_start_ms = millis();
+
+		// Winter battery gets less
+		uint8_t percent = Battery::get_current_mode() == BATTERY_MODE::BATTERY_MODE_NORMAL ? 100 :
+			CALL_HOME_BUDGET_LOW_BATTERY_PERCENT;
+
+		_budget_ms = CALL_HOME_BUDGET_SECS * 1000UL / 100 * percent;
+		_budget_mah = CALL_HOME_BUDGET_MAH * percent / 100;
+		_start_mah = read_gauge();
+
+		_deferred_mask = 0;
+		_current = PHASE_ATTACH;
+		_carried_mask = 0;
+
+		if(carried_valid())
+		{
+			_carried_mask = _carried.deferred_mask;
+
+			if(_carried.watchdog_phase > 0)
+				Log::log(Log::CALL_HOME_WATCHDOG, _carried.watchdog_phase - 1, _carried.deferred_mask);
+		}
+
+		_carried.magic = 0;
+
+		if(_watchdog == NULL)
+		{
+			esp_timer_create_args_t args = {};
+			args.callback = watchdog_cb;
+			args.name = "ch_watchdog";
+
+			if(esp_timer_create(&args, &_watchdog) != ESP_OK)
+				_watchdog = NULL;
+		}
+
+		if(_watchdog != NULL)
+			esp_timer_start_once(_watchdog, ((uint64_t)_budget_ms + CALL_HOME_WATCHDOG_GRACE_SECS * 1000ULL) * 1000);
+
+		debug_printf("Call home budget: %us, %.1fmAh, carried phases: %02x\n", _budget_ms / 1000,
+			_budget_mah, _carried_mask);
+	}
+
+	/******************************************************************************
+	* End session, phases deferred are carried to the next one
+	******************************************************************************/
+	void end()
+	{
+		if(!_active)
+			return;
+
+		_active = false;
+
+		if(_watchdog != NULL)
+			esp_timer_stop(_watchdog);
+
+		float mah = used_mah();
+
+		debug_printf("Call home used: %us, %.1fmAh\n", (millis() - _start_ms) / 1000, mah);
+
+		Log::log(Log::CALL_HOME_BUDGET_USED, (millis() - _start_ms) / 1000, (uint32_t)(mah * 100));
+
+		store_carried(_deferred_mask, 0);
+	}
+
+	/******************************************************************************
+	* Start a phase
+	* @return False if its deadline passed already, phase is deferred
+	******************************************************************************/
+	bool enter(Phase phase)
+	{
+		if(!_active)
+			return true;
+
+		_current = phase;
+
+		if(expired(phase))
+			return false;
+
+		debug_printf("Budget of %s left (ms): %u\n", PHASES[phase].name, remaining_ms(phase));
+
+		return true;
+	}
+
+	/******************************************************************************
+	* Check phase deadline and energy limit, called before every request. Phase
+	* is deferred to next session once expired
+	* @return True if phase must stop
+	******************************************************************************/
+	bool expired(Phase phase)
+	{
+		if(!_active)
+			return false;
+
+		uint8_t share = share_percent(phase);
+
+		bool over = millis() - _start_ms >= _budget_ms / 100 * share ||
+			used_mah() >= _budget_mah * share / 100;
+
+		if(over)
+			defer(phase);
+
+		return over;
+	}
+
+	/******************************************************************************
+	* Get millis phase must end by
+	* @return 0 if no session running
+	******************************************************************************/
+	uint32_t get_deadline_ms(Phase phase)
+	{
+		if(!_active)
+			return 0;
+
+		return _start_ms + _budget_ms / 100 * share_percent(phase);
+	}
+
+	/******************************************************************************
+	* Get time left until phase deadline, energy not considered
+	* @return UINT32_MAX if no session running
+	******************************************************************************/
+	uint32_t remaining_ms(Phase phase)
+	{
+		if(!_active)
+			return UINT32_MAX;
+
+		uint32_t limit = _budget_ms / 100 * share_percent(phase);
+		uint32_t elapsed = millis() - _start_ms;
+
+		return elapsed >= limit ? 0 : limit - elapsed;
+	}
+
+	/******************************************************************************
+	* Share of session budget usable until the end of phase: its own and earlier
+	* phases' shares, all of it for a phase carried from last session
+	******************************************************************************/
+	uint8_t share_percent(Phase phase)
+	{
+		if(_carried_mask & (1 << phase))
+			return 100;
+
+		uint8_t share = 0;
+
+		for(int i = 0; i <= phase; i++)
+			share += PHASES[i].budget_percent;
+
+		return share;
+	}
+
+	/******************************************************************************
+	* Mark phase unfinished, logged once per session
+	******************************************************************************/
+	void defer(Phase phase)
+	{
+		if(_deferred_mask & (1 << phase))
+			return;
+
+		_deferred_mask |= 1 << phase;
+
+		debug_printf("Budget of %s used up, deferred to next call home.\n", PHASES[phase].name);
+
+		Log::log(Log::CALL_HOME_PHASE_DEFERRED, phase, (millis() - _start_ms) / 1000);
+	}
+
+	/******************************************************************************
+	* Charge used since session start, measured by gauge or estimated from time
+	******************************************************************************/
+	float used_mah()
+	{
+		float mah = read_gauge();
+
+		if(!isnan(mah) && !isnan(_start_mah))
+			return _start_mah - mah;
+
+		return (float)(millis() - _start_ms) * CALL_HOME_EST_CURRENT_MA / 3600000;
+	}
+
+	/******************************************************************************
+	* Read charge left in battery
+	* @return NAN without battery gauge
+	******************************************************************************/
+	float read_gauge()
+	{
+		float mah = 0;
+
+		if(!FLAGS.BATTERY_GAUGE_ENABLED || BatteryGauge::read_mah(&mah) != RET_OK)
+			return NAN;
+
+		return mah;
+	}
+
+	/******************************************************************************
+	* Keep phases to carry to the next session in RTC memory
+	******************************************************************************/
+	void store_carried(uint8_t deferred_mask, uint8_t watchdog_phase)
+	{
+		_carried.magic = CALL_HOME_BUDGET_MAGIC;
+		_carried.deferred_mask = deferred_mask;
+		_carried.watchdog_phase = watchdog_phase;
+		_carried.crc32 = Utils::crc32((uint8_t*)&_carried, sizeof(_carried) - sizeof(_carried.crc32));
+	}
+
+	/******************************************************************************
+	* RTC memory holds phases carried from last session, garbage after power loss
+	******************************************************************************/
+	bool carried_valid()
+	{
+		return _carried.magic == CALL_HOME_BUDGET_MAGIC &&
+			Utils::crc32((uint8_t*)&_carried, sizeof(_carried) - sizeof(_carried.crc32)) == _carried.crc32;
+	}
+
+	/******************************************************************************
+	* Session ran CALL_HOME_WATCHDOG_GRACE_SECS past its deadline, stuck in a
+	* blocking call. Current phase and all after it are carried, logged next session.
+	* Runs in the esp_timer task, nothing else is safe to do here
+	******************************************************************************/
+	void watchdog_cb(void *arg)
+	{
+		uint8_t mask = _deferred_mask;
+
+		for(int i = _current; i < PHASE_COUNT; i++)
+			mask |= 1 << i;
+
+		store_carried(mask, _current + 1);
+
+		esp_restart();
+	}
+}
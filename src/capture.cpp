@@ -0,0 +1,298 @@
+#include "Arduino.h"
+#include "capture.h"
+#include "storage.h"
+#include "const.h"
+#include "app_config.h"
+#include "fo_sniffer.h"
+#include "fo_uart.h"
+#include "sdi12.h"
+#include "trace.h"
+#include "rtc.h"
+#include "utils.h"
+#include "common.h"
+
+namespace Capture
+{
+	//
+	// Private functions
+	//
+	bool replay_record(const RecordHeader *header, const uint8_t *data, char *last_cmd, ReplayStats *stats);
+	void print_record(const RecordHeader *header, const uint8_t *data);
+
+	//
+	// Private vars
+	//
+	const char *KIND_NAMES[] = {
+		[KIND_FO_FRAME] = "fo_frame",
+		[KIND_FO_UART_LINE] = "fo_uart",
+		[KIND_SDI12_CMD] = "sdi12_cmd",
+		[KIND_SDI12_RESP] = "sdi12_resp"
+	};
+
+	static_assert(sizeof(KIND_NAMES) / sizeof(KIND_NAMES[0]) == KIND_COUNT, "Name every kind");
+
+	/** Records not appended to the file yet */
+	uint8_t _buff[CAPTURE_BUFF_SIZE];
+	int _buff_len = 0;
+
+	/** File reached CAPTURE_MAX_FILE_SIZE, nothing more is recorded until cleared */
+	bool _full = false;
+
+	/** Longest SDI12 data response parsed on replay */
+	const int REPLAY_MAX_SDI12_VALS = 20;
+
+	/******************************************************************************
+	* Record a decoder input. Longer inputs are cut to 255 bytes
+	* @param ok Live decode of data succeeded
+	******************************************************************************/
+	void record(Kind kind, const void *data, int len, bool ok)
+	{
+		if(!FLAGS.RAW_CAPTURE || _full)
+			return;
+
+		if(len > UINT8_MAX)
+			len = UINT8_MAX;
+
+		RecordHeader header = {0};
+		header.kind = kind;
+		header.ok = ok;
+		header.len = len;
+		header.tstamp = RTC::get_timestamp();
+		header.us = (uint32_t)Trace::now_us();
+
+		#if CAPTURE_TO_SERIAL
+			print_record(&header, (const uint8_t*)data);
+		#endif
+
+		if(_buff_len + sizeof(header) + len > sizeof(_buff))
+			flush();
+
+		memcpy(_buff + _buff_len, &header, sizeof(header));
+		memcpy(_buff + _buff_len + sizeof(header), data, len);
+		_buff_len += sizeof(header) + len;
+	}
+
+	/******************************************************************************
+	* Append buffered records to the capture file. Called before deep sleep
+	******************************************************************************/
+	RetResult flush()
+	{
+		if(_buff_len == 0)
+			return RET_OK;
+
+		bool exists = STORAGE_FS.exists(CAPTURE_PATH);
+
+		File f = STORAGE_FS.open(CAPTURE_PATH, "a");
+		if(!f)
+		{
+			debug_println_e(F("Could not open capture file."));
+			return RET_ERROR;
+		}
+
+		if(f.size() + _buff_len > CAPTURE_MAX_FILE_SIZE)
+		{
+			debug_println_w(F("Capture file full, capture stopped."));
+
+			f.close();
+			_full = true;
+			_buff_len = 0;
+
+			return RET_ERROR;
+		}
+
+		RetResult ret = RET_OK;
+
+		if(!exists)
+		{
+			FileHeader header = {CAPTURE_FILE_MAGIC, CAPTURE_FILE_VERSION};
+			if(f.write((uint8_t*)&header, sizeof(header)) != sizeof(header))
+				ret = RET_ERROR;
+		}
+
+		if(ret == RET_OK && f.write(_buff, _buff_len) != (size_t)_buff_len)
+			ret = RET_ERROR;
+
+		f.close();
+		_buff_len = 0;
+
+		if(ret != RET_OK)
+			debug_println_e(F("Could not write capture file."));
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Feed all captured records through the decoders, back to back
+	******************************************************************************/
+	RetResult replay(ReplayStats *stats)
+	{
+		memset(stats, 0, sizeof(ReplayStats));
+
+		flush();
+
+		File f = STORAGE_FS.open(CAPTURE_PATH, FILE_READ);
+		if(!f)
+		{
+			debug_println_e(F("No capture file."));
+			return RET_ERROR;
+		}
+
+		FileHeader file_header = {0};
+		if(f.read((uint8_t*)&file_header, sizeof(file_header)) != sizeof(file_header) ||
+			file_header.magic != CAPTURE_FILE_MAGIC || file_header.version != CAPTURE_FILE_VERSION)
+		{
+			debug_println_e(F("Invalid capture file."));
+			f.close();
+			return RET_ERROR;
+		}
+
+		RecordHeader header;
+		uint8_t data[UINT8_MAX + 1];
+
+		// Command a response answers, to tell data responses apart
+		char last_cmd[UINT8_MAX + 1] = "";
+
+		RetResult ret = RET_OK;
+
+		while(f.read((uint8_t*)&header, sizeof(header)) == sizeof(header))
+		{
+			if(header.kind >= KIND_COUNT || f.read(data, header.len) != header.len)
+			{
+				debug_println_e(F("Truncated or corrupted capture record."));
+				ret = RET_ERROR;
+				break;
+			}
+
+			// Text decoders expect a terminated string
+			data[header.len] = '\0';
+
+			uint32_t start_us = micros();
+			bool ok = replay_record(&header, data, last_cmd, stats);
+			stats->decode_us += micros() - start_us;
+
+			stats->records[header.kind]++;
+			if(ok)
+				stats->ok[header.kind]++;
+		}
+
+		f.close();
+
+		for(int i = 0; i < KIND_COUNT; i++)
+			debug_printf("Replayed %s: %u, ok: %u\n", KIND_NAMES[i], stats->records[i], stats->ok[i]);
+
+		debug_printf("Mismatches: %u, SDI12 CRC failures: %u, decode time (us): %u\n", stats->mismatches,
+			stats->sdi12_crc_fails, stats->decode_us);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Print all captured records as CSV, same format as CAPTURE_TO_SERIAL
+	******************************************************************************/
+	void print()
+	{
+		flush();
+
+		File f = STORAGE_FS.open(CAPTURE_PATH, FILE_READ);
+		if(!f)
+			return;
+
+		RecordHeader header;
+		uint8_t data[UINT8_MAX];
+
+		f.seek(sizeof(FileHeader));
+
+		while(f.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.kind < KIND_COUNT &&
+			f.read(data, header.len) == header.len)
+		{
+			print_record(&header, data);
+		}
+
+		f.close();
+	}
+
+	/******************************************************************************
+	* Delete capture, recording starts over
+	******************************************************************************/
+	RetResult clear()
+	{
+		_buff_len = 0;
+		_full = false;
+
+		if(STORAGE_FS.exists(CAPTURE_PATH) && !STORAGE_FS.remove(CAPTURE_PATH))
+			return RET_ERROR;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Decode a record the way it was decoded live
+	* @param last_cmd Last SDI12 command replayed, updated by commands
+	* @return Decode succeeded
+	******************************************************************************/
+	bool replay_record(const RecordHeader *header, const uint8_t *data, char *last_cmd, ReplayStats *stats)
+	{
+		bool ok = true;
+
+		switch(header->kind)
+		{
+			case KIND_FO_FRAME:
+			{
+				FoDecodedPacket decoded;
+				ok = header->len == FO_SNIFFER_FRAME_LEN && FoSniffer::decode_packet(data, &decoded) == RET_OK;
+				break;
+			}
+			case KIND_FO_UART_LINE:
+			{
+				int field = -1;
+				float value = 0;
+				ok = FoUart::parse_line((const char*)data, &field, &value) && field >= 0;
+				break;
+			}
+			case KIND_SDI12_CMD:
+				memcpy(last_cmd, data, header->len + 1);
+				return true;
+			case KIND_SDI12_RESP:
+			{
+				ok = header->len > 0;
+
+				// aD<n>! and aR<n>! return values, checked and parsed like Sdi12Sensor does
+				if(ok && last_cmd[0] != '\0' && (last_cmd[1] == 'D' || last_cmd[1] == 'R'))
+				{
+					float values[REPLAY_MAX_SDI12_VALS];
+					uint8_t count = 0;
+
+					Sdi12::ParseResult result = Sdi12::parse_data((const char*)data, last_cmd[0], values,
+						REPLAY_MAX_SDI12_VALS, &count);
+
+					if(result == Sdi12::PARSE_CRC_FAIL)
+						stats->sdi12_crc_fails++;
+				}
+
+				last_cmd[0] = '\0';
+				break;
+			}
+		}
+
+		if(ok != (bool)header->ok)
+		{
+			debug_printf("Replay of %s differs from capture, at (us): %u\n", KIND_NAMES[header->kind], header->us);
+			stats->mismatches++;
+		}
+
+		return ok;
+	}
+
+	/******************************************************************************
+	* Print a record: kind,ok,tstamp,us,hex data
+	******************************************************************************/
+	void print_record(const RecordHeader *header, const uint8_t *data)
+	{
+		debug_printf("%s,%d,%u,%u,", KIND_NAMES[header->kind], header->ok, header->tstamp, header->us);
+
+		for(int i = 0; i < header->len; i++)
+			debug_printf("%02X", data[i]);
+
+		debug_println();
+	}
+}
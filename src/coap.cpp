@@ -0,0 +1,485 @@
+#include "coap.h"
+#include "common.h"
+
+namespace Coap
+{
+	//
+	// Private functions
+	//
+	RetResult exchange(uint8_t code, const char *path, const char *query, const uint8_t *payload,
+		int payload_len, int block_num, bool more, uint8_t *resp_code, char *resp_buff, int resp_buff_size);
+	int build_message(uint8_t *buff, int buff_size, uint8_t type, uint8_t code, uint16_t message_id,
+		const uint8_t *token, const char *path, const char *query, int block_num, bool more,
+		const uint8_t *payload, int payload_len);
+	int write_option(uint8_t *buff, int buff_size, uint16_t *last_number, uint16_t number,
+		const uint8_t *value, int value_len);
+	RetResult wait_response(uint16_t message_id, const uint8_t *token, uint32_t timeout,
+		bool *acked, uint8_t *resp_code, char *resp_buff, int resp_buff_size);
+	void send_ack(uint16_t message_id);
+
+	//
+	// Private vars
+	//
+	/** UDP socket */
+	UDP *_udp = NULL;
+
+	/** Server host and port */
+	const char *_server = NULL;
+	uint16_t _port = 0;
+
+	/** Last message id used */
+	uint16_t _message_id = 0;
+
+	/** Message buffer, used for both requests and responses */
+	uint8_t _buff[COAP_MAX_MESSAGE_SIZE];
+
+	/******************************************************************************
+	 * Prepare client
+	 * @param udp UDP socket to use
+	 * @param server Server host
+	 * @param port Server port
+	 *****************************************************************************/
+	RetResult open(UDP *udp, const char *server, uint16_t port)
+	{
+		_udp = udp;
+		_server = server;
+		_port = port;
+		_message_id = esp_random();
+
+		_udp->begin(0);
+
+		// Nothing to connect with UDP, check socket can be used
+		if(!_udp->beginPacket(_server, _port))
+		{
+			debug_println(F("Could not open CoAP socket."));
+			close();
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Release socket
+	 *****************************************************************************/
+	void close()
+	{
+		if(_udp != NULL)
+			_udp->stop();
+
+		_udp = NULL;
+		_server = NULL;
+		_port = 0;
+	}
+
+	/******************************************************************************
+	 * Check if client is open
+	 *****************************************************************************/
+	bool is_open()
+	{
+		return _udp != NULL;
+	}
+
+	/******************************************************************************
+	 * Confirmable POST. Payloads larger than COAP_BLOCK_SIZE are sent in blocks.
+	 * @param path Uri path without leading slash, eg. api/v1/TOKEN/telemetry
+	 * @param payload JSON payload
+	 * @param payload_len Payload length
+	 *****************************************************************************/
+	RetResult post(const char *path, const uint8_t *payload, int payload_len)
+	{
+		if(!is_open())
+			return RET_ERROR;
+
+		int blocks = payload_len > COAP_BLOCK_SIZE ? (payload_len + COAP_BLOCK_SIZE - 1) / COAP_BLOCK_SIZE : 0;
+
+		// Single message
+		if(blocks == 0)
+		{
+			uint8_t resp_code = 0;
+
+			if(exchange(COAP_CODE_POST, path, NULL, payload, payload_len, -1, false, &resp_code, NULL, 0) != RET_OK)
+				return RET_ERROR;
+
+			return COAP_CODE_CLASS(resp_code) == 2 ? RET_OK : RET_ERROR;
+		}
+
+		// Block-wise
+		for(int block = 0; block < blocks; block++)
+		{
+			int offset = block * COAP_BLOCK_SIZE;
+			int len = payload_len - offset < COAP_BLOCK_SIZE ? payload_len - offset : COAP_BLOCK_SIZE;
+			bool more = block < blocks - 1;
+			uint8_t resp_code = 0;
+
+			if(exchange(COAP_CODE_POST, path, NULL, payload + offset, len, block, more, &resp_code, NULL, 0) != RET_OK)
+				return RET_ERROR;
+
+			// Server must ask for the next block with 2.31 Continue
+			if(more && resp_code != COAP_CODE_CONTINUE)
+			{
+				debug_print(F("CoAP block not continued. Code: "));
+				debug_println(resp_code, HEX);
+				return RET_ERROR;
+			}
+
+			if(!more && COAP_CODE_CLASS(resp_code) != 2)
+				return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Confirmable GET
+	 * @param path Uri path without leading slash
+	 * @param query Uri query, eg. sharedKeys=a,b. NULL for none
+	 * @param resp_buff Response payload, null terminated
+	 * @param resp_buff_size Response buffer size
+	 *****************************************************************************/
+	RetResult get(const char *path, const char *query, char *resp_buff, int resp_buff_size)
+	{
+		if(!is_open())
+			return RET_ERROR;
+
+		uint8_t resp_code = 0;
+
+		if(exchange(COAP_CODE_GET, path, query, NULL, 0, -1, false, &resp_code, resp_buff, resp_buff_size) != RET_OK)
+			return RET_ERROR;
+
+		return COAP_CODE_CLASS(resp_code) == 2 ? RET_OK : RET_ERROR;
+	}
+
+	/******************************************************************************
+	 * Send confirmable request and wait for response, retransmitting with
+	 * exponential back-off until acknowledged.
+	 *****************************************************************************/
+	RetResult exchange(uint8_t code, const char *path, const char *query, const uint8_t *payload,
+		int payload_len, int block_num, bool more, uint8_t *resp_code, char *resp_buff, int resp_buff_size)
+	{
+		uint16_t message_id = ++_message_id;
+		uint8_t token[COAP_TOKEN_LEN];
+		esp_fill_random(token, sizeof(token));
+
+		int len = build_message(_buff, sizeof(_buff), COAP_TYPE_CON, code, message_id, token, path, query,
+			block_num, more, payload, payload_len);
+
+		if(len <= 0)
+		{
+			debug_println_e(F("CoAP message does not fit buffer."));
+			return RET_ERROR;
+		}
+
+		// Keep a copy, buffer is reused when receiving
+		uint8_t *message = (uint8_t*)malloc(len);
+		if(message == NULL)
+			return RET_ERROR;
+
+		memcpy(message, _buff, len);
+
+		uint32_t timeout = COAP_ACK_TIMEOUT;
+		bool acked = false;
+		RetResult ret = RET_ERROR;
+
+		for(int attempt = 0; attempt <= COAP_MAX_RETRANSMIT && !acked; attempt++)
+		{
+			if(!_udp->beginPacket(_server, _port))
+				break;
+
+			_udp->write(message, len);
+
+			if(!_udp->endPacket())
+				break;
+
+			ret = wait_response(message_id, token, timeout, &acked, resp_code, resp_buff, resp_buff_size);
+
+			timeout *= 2;
+		}
+
+		// Empty ACK received, response follows separately
+		if(acked && ret != RET_OK)
+		{
+			ret = wait_response(0, token, COAP_SEPARATE_RESPONSE_TIMEOUT, &acked, resp_code, resp_buff, resp_buff_size);
+		}
+
+		free(message);
+
+		if(ret != RET_OK)
+			debug_println(F("CoAP request failed."));
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Build a message
+	 * @param block_num Block1 number, -1 for no Block1 option
+	 * @return Message length, -1 if it doesn't fit buffer
+	 *****************************************************************************/
+	int build_message(uint8_t *buff, int buff_size, uint8_t type, uint8_t code, uint16_t message_id,
+		const uint8_t *token, const char *path, const char *query, int block_num, bool more,
+		const uint8_t *payload, int payload_len)
+	{
+		if(buff_size < 4 + COAP_TOKEN_LEN)
+			return -1;
+
+		// Header: version, type, token length, code, message id
+		buff[0] = (COAP_VERSION << 6) | (type << 4) | COAP_TOKEN_LEN;
+		buff[1] = code;
+		buff[2] = message_id >> 8;
+		buff[3] = message_id & 0xFF;
+		memcpy(buff + 4, token, COAP_TOKEN_LEN);
+
+		int len = 4 + COAP_TOKEN_LEN;
+		uint16_t last_number = 0;
+		int n = 0;
+
+		// Options must be written in ascending order
+		// Uri-Path, one option per segment
+		const char *segment = path;
+		while(segment != NULL && *segment != '\0')
+		{
+			const char *end = strchr(segment, '/');
+			int segment_len = end != NULL ? end - segment : strlen(segment);
+
+			if((n = write_option(buff + len, buff_size - len, &last_number, COAP_OPTION_URI_PATH,
+				(const uint8_t*)segment, segment_len)) < 0)
+				return -1;
+
+			len += n;
+			segment = end != NULL ? end + 1 : NULL;
+		}
+
+		// Content-Format
+		if(payload_len > 0)
+		{
+			uint8_t format = COAP_CONTENT_FORMAT_JSON;
+
+			if((n = write_option(buff + len, buff_size - len, &last_number, COAP_OPTION_CONTENT_FORMAT, &format, 1)) < 0)
+				return -1;
+
+			len += n;
+		}
+
+		// Uri-Query
+		if(query != NULL)
+		{
+			if((n = write_option(buff + len, buff_size - len, &last_number, COAP_OPTION_URI_QUERY,
+				(const uint8_t*)query, strlen(query))) < 0)
+				return -1;
+
+			len += n;
+		}
+
+		// Block1: NUM | M | SZX
+		if(block_num >= 0)
+		{
+			uint32_t block = (block_num << 4) | (more ? 0x08 : 0) | COAP_BLOCK_SZX;
+			uint8_t value[3];
+			int value_len = 0;
+
+			if(block > 0xFFFF)
+			{
+				value[value_len++] = block >> 16;
+			}
+			if(block > 0xFF)
+			{
+				value[value_len++] = (block >> 8) & 0xFF;
+			}
+			value[value_len++] = block & 0xFF;
+
+			if((n = write_option(buff + len, buff_size - len, &last_number, COAP_OPTION_BLOCK1, value, value_len)) < 0)
+				return -1;
+
+			len += n;
+		}
+
+		// Payload
+		if(payload_len > 0)
+		{
+			if(len + 1 + payload_len > buff_size)
+				return -1;
+
+			buff[len++] = COAP_PAYLOAD_MARKER;
+			memcpy(buff + len, payload, payload_len);
+			len += payload_len;
+		}
+
+		return len;
+	}
+
+	/******************************************************************************
+	 * Write an option, delta encoded against the previous one
+	 * @return Bytes written, -1 if it doesn't fit
+	 *****************************************************************************/
+	int write_option(uint8_t *buff, int buff_size, uint16_t *last_number, uint16_t number,
+		const uint8_t *value, int value_len)
+	{
+		uint16_t delta = number - *last_number;
+		uint8_t ext[4];
+		int ext_len = 0;
+		uint8_t delta_nibble, len_nibble;
+
+		if(delta < 13)
+		{
+			delta_nibble = delta;
+		}
+		else if(delta < 269)
+		{
+			delta_nibble = 13;
+			ext[ext_len++] = delta - 13;
+		}
+		else
+		{
+			delta_nibble = 14;
+			ext[ext_len++] = (delta - 269) >> 8;
+			ext[ext_len++] = (delta - 269) & 0xFF;
+		}
+
+		if(value_len < 13)
+		{
+			len_nibble = value_len;
+		}
+		else if(value_len < 269)
+		{
+			len_nibble = 13;
+			ext[ext_len++] = value_len - 13;
+		}
+		else
+		{
+			len_nibble = 14;
+			ext[ext_len++] = (value_len - 269) >> 8;
+			ext[ext_len++] = (value_len - 269) & 0xFF;
+		}
+
+		int len = 1 + ext_len + value_len;
+		if(len > buff_size)
+			return -1;
+
+		buff[0] = (delta_nibble << 4) | len_nibble;
+		memcpy(buff + 1, ext, ext_len);
+		memcpy(buff + 1 + ext_len, value, value_len);
+
+		*last_number = number;
+
+		return len;
+	}
+
+	/******************************************************************************
+	 * Wait for response to request
+	 * @param message_id Message id of request, 0 when waiting for a separate response
+	 * @param acked Set when request has been acknowledged (even if by an empty ACK)
+	 * @return RET_OK when a response has been received
+	 *****************************************************************************/
+	RetResult wait_response(uint16_t message_id, const uint8_t *token, uint32_t timeout,
+		bool *acked, uint8_t *resp_code, char *resp_buff, int resp_buff_size)
+	{
+		uint32_t start = millis();
+
+		while(millis() - start < timeout)
+		{
+			int len = _udp->parsePacket();
+			if(len <= 0)
+			{
+				delay(10);
+				continue;
+			}
+
+			len = _udp->read(_buff, sizeof(_buff));
+			if(len < 4 || (_buff[0] >> 6) != COAP_VERSION)
+				continue;
+
+			uint8_t type = (_buff[0] >> 4) & 0x03;
+			uint8_t token_len = _buff[0] & 0x0F;
+			uint8_t code = _buff[1];
+			uint16_t resp_message_id = (_buff[2] << 8) | _buff[3];
+
+			// ACK to our request
+			if(type == COAP_TYPE_ACK && resp_message_id == message_id)
+			{
+				*acked = true;
+
+				// Empty ACK, response will follow separately
+				if(code == COAP_CODE_EMPTY)
+					return RET_ERROR;
+			}
+			// Separate response
+			else if(type == COAP_TYPE_CON || type == COAP_TYPE_NON)
+			{
+				if(type == COAP_TYPE_CON)
+					send_ack(resp_message_id);
+			}
+			else
+			{
+				continue;
+			}
+
+			if(token_len != COAP_TOKEN_LEN || len < 4 + token_len || memcmp(_buff + 4, token, COAP_TOKEN_LEN) != 0)
+				continue;
+
+			*resp_code = code;
+
+			//
+			// Skip options to find payload
+			//
+			if(resp_buff != NULL && resp_buff_size > 0)
+			{
+				resp_buff[0] = '\0';
+
+				int pos = 4 + token_len;
+				while(pos < len && _buff[pos] != COAP_PAYLOAD_MARKER)
+				{
+					uint8_t delta_nibble = _buff[pos] >> 4;
+					uint16_t opt_len = _buff[pos] & 0x0F;
+					pos++;
+
+					pos += delta_nibble == 13 ? 1 : delta_nibble == 14 ? 2 : 0;
+
+					if(opt_len == 13)
+					{
+						opt_len = _buff[pos] + 13;
+						pos++;
+					}
+					else if(opt_len == 14)
+					{
+						opt_len = ((_buff[pos] << 8) | _buff[pos + 1]) + 269;
+						pos += 2;
+					}
+
+					pos += opt_len;
+				}
+
+				// Payload after marker
+				if(pos < len)
+				{
+					pos++;
+					int payload_len = len - pos < resp_buff_size - 1 ? len - pos : resp_buff_size - 1;
+					memcpy(resp_buff, _buff + pos, payload_len);
+					resp_buff[payload_len] = '\0';
+				}
+			}
+
+			return RET_OK;
+		}
+
+		return RET_ERROR;
+	}
+
+	/******************************************************************************
+	 * Acknowledge a confirmable message from server
+	 *****************************************************************************/
+	void send_ack(uint16_t message_id)
+	{
+		uint8_t ack[4] = {
+			(COAP_VERSION << 6) | (COAP_TYPE_ACK << 4),
+			COAP_CODE_EMPTY,
+			(uint8_t)(message_id >> 8),
+			(uint8_t)(message_id & 0xFF)
+		};
+
+		if(_udp->beginPacket(_server, _port))
+		{
+			_udp->write(ack, sizeof(ack));
+			_udp->endPacket();
+		}
+	}
+}
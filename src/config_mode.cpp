@@ -4,14 +4,30 @@
 #include "config_mode.h"
 #include "app_config.h"
 #include "device_config.h"
-#include <SPIFFS.h>
+#include "storage.h"
+#include "flash.h"
+#include "tests.h"
+#include "trace.h"
+#include "field_offload.h"
+#include "capture.h"
 
 namespace ConfigMode
 {
+//
+// Private types
+//
+/** Mode selected by holding the button on boot */
+enum ButtonHold
+{
+	HOLD_NONE,
+	HOLD_CONFIG,
+	HOLD_OFFLOAD
+};
+
 //
 // Private functions
 //
-bool check_button();
+ButtonHold check_button();
 RetResult parse_response(char *resp);
 void print_error(const __FlashStringHelper *error);
 void print_read_value(const char *cmd, const char *val);
@@ -21,8 +37,13 @@ RetResult cmd_tb_device_token(char *val, bool read);
 RetResult cmd_apn(char *val, bool read);
 RetResult cmd_fo_sniffer_id(char *val, bool read);
 RetResult cmd_fo_enabled(char *val, bool read);
+RetResult cmd_transport(char *val, bool read);
 RetResult cmd_test(char *val, bool read);
+RetResult cmd_trace(char *val, bool read);
 RetResult cmd_spiffs_format(char *val, bool read);
+RetResult cmd_offload(char *val, bool read);
+RetResult cmd_capture(char *val, bool read);
+RetResult cmd_ls(char *val, bool read);
 
 //
 // Available commands
@@ -32,8 +53,13 @@ const char *CMD_TB_DEVICE_TOKEN PROGMEM = "TB_DEVICE_TOKEN";
 const char *CMD_APN PROGMEM = "APN";
 const char *CMD_FO_SNIFFER_ID PROGMEM = "FO_SNIFFER_ID";
 const char *CMD_FO_ENABLED PROGMEM = "FO_ENABLED";
+const char *CMD_TRANSPORT PROGMEM = "TRANSPORT";
 const char *CMD_TEST PROGMEM = "TEST";
+const char *CMD_TRACE PROGMEM = "TRACE";
 const char *CMD_SPIFFS_FORMAT PROGMEM = "SPIFFS_FORMAT";
+const char *CMD_OFFLOAD PROGMEM = "OFFLOAD";
+const char *CMD_CAPTURE PROGMEM = "CAPTURE";
+const char *CMD_LS PROGMEM = "LS";
 
 /******************************************************************************
 * Check if device needs to enter config mode. This is decided upon a user 
@@ -42,7 +68,17 @@ void handle()
 {
 	// Check if needs to enter config mode
 	// Comment whole if/else to force
-	if(check_button())
+	ButtonHold hold = check_button();
+
+	if(hold == HOLD_OFFLOAD)
+	{
+	    debug_println_i(F("Entering field offload mode"));
+
+	    // Boot continues when done
+	    FieldOffload::run();
+	    return;
+	}
+	else if(hold == HOLD_CONFIG)
 	{
 	    debug_println_i(F("Entering config mode"));
 	}
@@ -102,14 +138,34 @@ RetResult parse_response(char *resp)
 	{
 		ret = cmd_fo_enabled(val, read);
 	}
+	else if (strcmp(cmd, CMD_TRANSPORT) == 0)
+	{
+		ret = cmd_transport(val, read);
+	}
 	else if (strcmp(cmd, CMD_TEST) == 0)
 	{
 		ret = cmd_test(val, read);
 	}
+	else if (strcmp(cmd, CMD_TRACE) == 0)
+	{
+		ret = cmd_trace(val, read);
+	}
 	else if (strcmp(cmd, CMD_SPIFFS_FORMAT) == 0)
 	{
 		ret = cmd_spiffs_format(val, read);
 	}
+	else if (strcmp(cmd, CMD_OFFLOAD) == 0)
+	{
+		ret = cmd_offload(val, read);
+	}
+	else if (strcmp(cmd, CMD_CAPTURE) == 0)
+	{
+		ret = cmd_capture(val, read);
+	}
+	else if (strcmp(cmd, CMD_LS) == 0)
+	{
+		ret = cmd_ls(val, read);
+	}
 	else
 	{
 		print_error(F("Unkown command"));
@@ -154,14 +210,15 @@ void print_read_value(const char *cmd, int val)
 
 /******************************************************************************
 * Check whether device should enter config mode
-* Config mode is enabled when user holds external button for X msec
+* Config mode is enabled when user holds external button for X msec, field
+* offload mode when it is held for FIELD_OFFLOAD_BTN_HOLD_TIME_MS
 ******************************************************************************/
-bool check_button()
+ButtonHold check_button()
 {
 	pinMode(PIN_CONFIG_MODE_BTN, INPUT_PULLUP);
 	pinMode(PIN_LED, OUTPUT);
 
-	bool enter_config_mode = false;
+	ButtonHold hold = HOLD_NONE;
 
 	// Button start hold time
 	uint32_t start_hold_ms = 0;
@@ -178,7 +235,19 @@ bool check_button()
 
 			if (millis() - start_hold_ms >= CONFIG_MODE_BTN_HOLD_TIME_MS)
 			{
-				enter_config_mode = true;
+				hold = HOLD_CONFIG;
+			}
+
+			// Held on, offload instead
+			if (FLAGS.FIELD_OFFLOAD && millis() - start_hold_ms >= FIELD_OFFLOAD_BTN_HOLD_TIME_MS)
+			{
+				hold = HOLD_OFFLOAD;
+				break;
+			}
+
+			// Without offload, don't wait for release
+			if (!FLAGS.FIELD_OFFLOAD && hold == HOLD_CONFIG)
+			{
 				break;
 			}
 		}
@@ -195,21 +264,19 @@ bool check_button()
 	digitalWrite(PIN_LED, 0);
 
 	// Enter config mode
-	if (enter_config_mode)
+	if (hold != HOLD_NONE)
 	{
-		// Blink fast to indicate mode entry
-		for (uint8_t i = 0; i < 3; i++)
+		// Blink fast to indicate mode entry, twice as long for offload
+		for (uint8_t i = 0; i < (hold == HOLD_OFFLOAD ? 6 : 3); i++)
 		{
 			digitalWrite(PIN_LED, 0);
 			delay(200);
 			digitalWrite(PIN_LED, 1);
 			delay(200);
 		}
-
-		return true;
 	}
 
-	return false;
+	return hold;
 }
 
 /******************************************************************************
@@ -378,6 +445,46 @@ RetResult cmd_fo_enabled(char *val, bool read)
 	}
 }
 
+/******************************************************************************
+* Handle command: Set transport, 0 for HTTP, 1 for MQTT
+******************************************************************************/
+RetResult cmd_transport(char *val, bool read)
+{
+	if(read)
+	{
+		DeviceConfig::init();
+
+		print_read_value(CMD_TRANSPORT, DeviceConfig::get_transport());
+
+		return RET_OK;
+	}
+	else
+	{
+		if (val == NULL)
+		{
+			print_error(F("Value is required"));
+			return RET_ERROR;
+		}
+
+		int transport = -1;
+		if(sscanf(val, "%d", &transport) != 1 ||
+			(transport != DeviceConfig::TRANSPORT_HTTP && transport != DeviceConfig::TRANSPORT_MQTT &&
+			transport != DeviceConfig::TRANSPORT_COAP))
+		{
+			print_error(F("Invalid value provided, must be 0 (HTTP), 1 (MQTT) or 2 (CoAP)."));
+			return RET_ERROR;
+		}
+
+		DeviceConfig::init();
+		DeviceConfig::set_transport((DeviceConfig::Transport)transport);
+		DeviceConfig::commit();
+
+		Serial.println("OK");
+	}
+
+	return RET_OK;
+}
+
 /******************************************************************************
 * Handle command: Format SPIFFS partition
 ******************************************************************************/
@@ -385,7 +492,7 @@ RetResult cmd_spiffs_format(char *val, bool read)
 {
 	Serial.println(F("Formatting..."));
 	
-	if(SPIFFS.format())
+	if(Flash::format() == RET_OK)
 	{
 		print_ok();
 	}
@@ -396,11 +503,111 @@ RetResult cmd_spiffs_format(char *val, bool read)
 }
 
 /******************************************************************************
-* Handle command: Check if device is connected and listening to serial comms
+* Handle command: Start field offload, returns to config mode when it ends
+******************************************************************************/
+RetResult cmd_offload(char *val, bool read)
+{
+	if(FieldOffload::run() != RET_OK)
+	{
+		print_error(F("Could not start field offload."));
+		return RET_ERROR;
+	}
+
+	print_ok();
+	return RET_OK;
+}
+
+/******************************************************************************
+* Handle command: Check if device is connected and listening to serial comms.
+* With a value, run tests/benchmarks: TEST=all or TEST=<id>[,<id>...]
 ******************************************************************************/
 RetResult cmd_test(char *val, bool read)
 {
+	if(val == NULL || read)
+	{
+		print_ok();
+		return RET_OK;
+	}
+
+	if(strcmp(val, "all") == 0)
+	{
+		Tests::run_all();
+		print_ok();
+		return RET_OK;
+	}
+
+	// Max one id per char pair
+	Tests::TestId tests[strlen(val) / 2 + 1];
+	int count = 0;
+
+	for(char *id = strtok(val, ","); id != NULL; id = strtok(NULL, ","))
+	{
+		int test_id = -1;
+		if(sscanf(id, "%d", &test_id) != 1 || test_id < 0 || test_id >= Tests::TEST_COUNT)
+		{
+			print_error(F("Invalid test id."));
+			return RET_ERROR;
+		}
+
+		tests[count++] = (Tests::TestId)test_id;
+	}
+
+	Tests::run(tests, count);
+	print_ok();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Handle command: Print raw capture records as CSV, CAPTURE=clear deletes them.
+* Replayed with the CAPTURE_REPLAY test
+******************************************************************************/
+RetResult cmd_capture(char *val, bool read)
+{
+	if(read || val == NULL)
+	{
+		Capture::print();
+		print_ok();
+		return RET_OK;
+	}
+
+	if(strcmp(val, "clear") != 0 || Capture::clear() != RET_OK)
+	{
+		print_error(F("Could not clear capture."));
+		return RET_ERROR;
+	}
+
 	print_ok();
+	return RET_OK;
+}
+
+/******************************************************************************
+* Handle command: List every file in flash. Boot and call home print only the
+* store summary (see StoreRegistry::print_stats())
+******************************************************************************/
+RetResult cmd_ls(char *val, bool read)
+{
+	if(Flash::mount() != RET_OK)
+	{
+		print_error(F("Could not mount flash."));
+		return RET_ERROR;
+	}
+
+	Flash::ls();
+	print_ok();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Handle command: Print recorded trace spans as CSV
+******************************************************************************/
+RetResult cmd_trace(char *val, bool read)
+{
+	Trace::print();
+	print_ok();
+
+	return RET_OK;
 }
 
 } // namespace ConfigMode
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include "water_sensor_data.h"
 #include "soil_moisture_data.h"
 #include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "rollup_data.h"
+#include "relay_data.h"
 #include "atmos41_data.h"
 #include "fo_data.h"
 #include "sdi12_log.h"
@@ -9,38 +12,83 @@
 #include "utils.h"
 #include "flash.h"
 #include "common.h"
+#include "trace.h"
+#include "board_features.h"
 
 /******************************************************************************
  * DataStore
- * Represents a store of data structures in SPIFFS.
+ * Represents a store of data structures in flash (SPIFFS or LittleFS).
  * Data can be add()ed which is then stored in a buffer until the buffer is full
- * or commit() is called, in which cases it is appended to a file in SPIFFS.
+ * or commit() is called, in which cases it is appended to a file in flash.
  * A file has a max size. When max size is reached, a new file is created and 
  * subsequent structures are written there.
  * Data in a DataStore can be traversed with a DataStoreReader class.
  ******************************************************************************/
 
+/**
+ * Next sequence number of every store, in RTC memory. RTC_NOINIT memory survives
+ * deep sleep and resets (but not power loss), so waking up doesn't skip the rest
+ * of the reserved block and reserve a new one (see DataStore::next_seq())
+ */
+struct DataStoreSeqSlot
+{
+	/** CRC32 of store dir path */
+	uint32_t dir_crc32;
+
+	uint32_t next_seq;
+
+	/** CRC32 of above fields */
+	uint32_t crc32;
+}__attribute__((packed));
+
+RTC_NOINIT_ATTR DataStoreSeqSlot _seq_slots[DATA_STORE_SEQ_RTC_SLOTS];
+
 /******************************************************************************
  * Constructor
- * @param dir Dir in SPIFFS Where data will be stored
+ * @param dir Dir in flash where data will be stored
  * @param elements_per_file Max entries to store in a file before creating a new one
+ * @param on_evict Called with path of each file cleanup() is about to delete
  ******************************************************************************/
 template <class TStruct>
-DataStore<TStruct>::DataStore(const char *dir_path, int max_entries_per_file)
+DataStore<TStruct>::DataStore(const char *dir_path, int max_entries_per_file, EvictHandler on_evict)
 {
 	_dir_path = dir_path;
 	_max_entries_per_file = max_entries_per_file;
+	_on_evict = on_evict;
 }
 
 /******************************************************************************
  * Add data structure to buffer. If buffer is full, data is automatically commited
  * to make space in buffer.
+ * @param seq Sequence number of entry, 0 to number it (see publish())
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStore<TStruct>::add(TStruct *data, uint32_t seq)
+{
+	TStruct *slot = reserve();
+
+	if(slot == NULL)
+		return RET_ERROR;
+
+	memcpy(slot, data, sizeof(TStruct));
+
+	return publish(seq);
+}
+
+/******************************************************************************
+ * Get next buffer slot to fill in place, zeroed. Entry is added by publish()
+ * (or dropped by cancel()), nothing else may be added in between. If buffer is
+ * full, it is commited to make space first.
+ * @return Slot, NULL if buffer has no space
  ******************************************************************************/
 template <class TStruct>
-RetResult DataStore<TStruct>::add(TStruct *data)
+TStruct* DataStore<TStruct>::reserve()
 {
+	// Held until publish() or cancel(), so the slot is not committed half filled
+	lock();
+
     // Buffer full? Commit it to flash and clear
-    if (_buffer_element_count >= DATA_STORE_BUFFER_ELEMENTS)
+    if (_buffer_element_count >= _buffer_capacity)
     {
         // Commit to flash
         if(commit() != RET_OK)
@@ -57,35 +105,65 @@ RetResult DataStore<TStruct>::add(TStruct *data)
         debug_println(F("Data store full, commiting and erasing."));
     }
 
-	// Prepare metadata of new entry (crc32)
-	Entry new_entry = {0};
-	new_entry.crc32 = Utils::crc32((uint8_t*)data, sizeof(TStruct));
+	if(_buffer_element_count >= _buffer_capacity)
+	{
+		unlock();
+		return NULL;
+	}
+
+	Entry *entry = &_buffer[_buffer_element_count];
+	memset(entry, 0, sizeof(Entry));
 
-	// Copy struct to body
-	memcpy(&new_entry.data, data, sizeof(TStruct));
+	_slot_reserved = true;
 
-	// Copy new entry to buffer
-	// debug_print_i(F("Buffer size: "));
-	// debug_println(sizeof(_buffer), DEC);
-	// debug_print_i(F("Element: "));
-	// debug_println(_buffer_element_count, DEC);
-	// debug_print_i(F("Element size: "));
-	// debug_println(sizeof(new_entry), DEC);
+	return &entry->data;
+}
+
+/******************************************************************************
+ * Add entry filled in the slot returned by reserve() to buffer
+ * @param seq Sequence number of entry, 0 for the next one of the store. Twins
+ * keep the number of the copied entry as given
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStore<TStruct>::publish(uint32_t seq)
+{
+	if(!_slot_reserved)
+		return RET_ERROR;
 
-	Serial.flush();
+	_slot_reserved = false;
 
-	if(_buffer_element_count >= DATA_STORE_BUFFER_ELEMENTS)
+	if(_buffer_element_count >= _buffer_capacity)
 	{
+		unlock();
 		return RET_ERROR;
 	}
 
-    memcpy((void *)&_buffer[_buffer_element_count], &new_entry, sizeof(new_entry));
+	// Metadata of new entry
+	Entry *entry = &_buffer[_buffer_element_count];
+	entry->crc32 = Utils::crc32((uint8_t*)&entry->data, sizeof(TStruct));
+	entry->seq = seq != 0 || _is_twin ? seq : next_seq();
+
+    _buffer_element_count++;
 
-    _buffer_element_count++;	
+	unlock();
 
     return RET_OK;
 }
 
+/******************************************************************************
+ * Drop slot returned by reserve(), eg. filled entry should not be stored
+ ******************************************************************************/
+template <class TStruct>
+void DataStore<TStruct>::cancel()
+{
+	if(!_slot_reserved)
+		return;
+
+	_slot_reserved = false;
+
+	unlock();
+}
+
 /******************************************************************************
  * Save all data to flash and erase buffer
  * Data is appended to a file until max file size is reached. In that case a new
@@ -95,11 +173,19 @@ RetResult DataStore<TStruct>::add(TStruct *data)
 template <class TStruct>
 RetResult DataStore<TStruct>::commit()
 {
+	Trace::Span span(Trace::SPAN_STORE_COMMIT);
+
+	ScopedLock lock(this);
+
 	if (Flash::mount() != RET_OK)
 		return RET_ERROR;
 
-	// If current data file not set yet, get one
-	if(strlen(_current_data_file_path) < 1)
+	// Build file index on first commit (also finds current data file)
+	if(!index_valid())
+		build_index();
+
+	// If current data file not set yet (or readers have it), get one
+	if(strlen(_current_data_file_path) < 1 || is_sealed(_current_data_file_path))
 	{
 		if(update_current_data_file_path() != RET_OK)
 		{
@@ -120,7 +206,7 @@ RetResult DataStore<TStruct>::commit()
 	{
 		// Try to open current data file.
 		f.close();
-		f = SPIFFS.open(_current_data_file_path, "a");
+		f = STORAGE_FS.open(_current_data_file_path, "a");
 
 		if(!f)
 		{
@@ -128,6 +214,9 @@ RetResult DataStore<TStruct>::commit()
 			return RET_ERROR;
 		}
 
+		// Keep index in sync with actual file size
+		_index.current_file_size = f.size();
+
 		// Entries to write is how many space we have left in this file / size of an entry
 		int entries_for_current_file = (_max_entries_per_file * sizeof(Entry) - f.size()) / sizeof(Entry);
 
@@ -139,44 +228,90 @@ RetResult DataStore<TStruct>::commit()
 			// If writing fails this will be false
 			bool write_success = true;
 
-			// Write entries one by one from end of buffer. If correct number of bytes is written,
-			// last buffer element is removed. In the case of full disk, data corruption is minimized
-			for(int i = 0; i < entries_for_current_file; i++)
+			if(_block_commit)
 			{
-				// Get buffer entry to write
-				const Entry *buff_entry = NULL;
-				buff_entry = get_buffer_element(entries_left - i - 1);
-
-				// Reading out of bounds check (redundant)
-				if(buff_entry == NULL)
-				{
-					debug_print(F("Element index doesn't exist in buffer: "));
-					debug_println(entries_left - i - 1, DEC);
+				// Write all entries that fit into this file with a single write, taken from the end
+				// of buffer. Only fully written entries are removed from buffer so in the case of
+				// full disk, data corruption is minimized. A partially written entry is truncated
+				// from the file when the index is rebuilt.
+				int first_index = entries_left - entries_for_current_file;
+				const Entry *block = get_buffer_element(first_index);
+
+				int block_size = entries_for_current_file * sizeof(Entry);
+				int written_bytes = f.write((uint8_t*)block, block_size);
+				f.flush();
 
-					write_success = false;
-					break;
-				}
+				int written_entries = written_bytes / sizeof(Entry);
 
-				// Write a single netry
-				int written_bytes = f.write((uint8_t*)buff_entry, sizeof(Entry));
-				f.flush();
-				if(written_bytes != sizeof(Entry))
+				if(written_bytes != block_size)
 				{
-					debug_println(F("Could not write entry."));
-					debug_print(F("Entry size: "));
-					debug_println(sizeof(Entry), DEC);
+					debug_println(F("Could not write block."));
+					debug_print(F("Block size: "));
+					debug_println(block_size, DEC);
 					debug_print(F("Written: "));
 					debug_println(written_bytes, DEC);
 
+					// Move entries that were not written to the place of those that were
+					memmove(&_buffer[first_index], &_buffer[first_index + written_entries],
+						(entries_for_current_file - written_entries) * sizeof(Entry));
+
 					write_success = false;
-					break;
 				}
 
-				// Remove last element from buffer
-				_buffer_element_count--;
+				_buffer_element_count -= written_entries;
+				entries_left -= written_entries;
+
+				_index.entry_count += written_entries;
+				_index.current_file_size += written_bytes;
 
-				// TODO: Check for entries left out of loop by subtracting every time the expected to be written number of entries
-				entries_left--;
+				// File ends with a partial entry, rebuild index (and fix file) on next commit
+				if(written_bytes % sizeof(Entry) != 0)
+					invalidate_index();
+			}
+			else
+			{
+				// Write entries one by one from end of buffer. If correct number of bytes is written,
+				// last buffer element is removed. In the case of full disk, data corruption is minimized
+				for(int i = 0; i < entries_for_current_file; i++)
+				{
+					// Get buffer entry to write
+					const Entry *buff_entry = NULL;
+					buff_entry = get_buffer_element(entries_left - 1);
+
+					// Reading out of bounds check (redundant)
+					if(buff_entry == NULL)
+					{
+						debug_print(F("Element index doesn't exist in buffer: "));
+						debug_println(entries_left - 1, DEC);
+
+						write_success = false;
+						break;
+					}
+
+					// Write a single netry
+					int written_bytes = f.write((uint8_t*)buff_entry, sizeof(Entry));
+					f.flush();
+					if(written_bytes != sizeof(Entry))
+					{
+						debug_println(F("Could not write entry."));
+						debug_print(F("Entry size: "));
+						debug_println(sizeof(Entry), DEC);
+						debug_print(F("Written: "));
+						debug_println(written_bytes, DEC);
+
+						write_success = false;
+						break;
+					}
+
+					// Remove last element from buffer
+					_buffer_element_count--;
+
+					_index.entry_count++;
+					_index.current_file_size += written_bytes;
+
+					// TODO: Check for entries left out of loop by subtracting every time the expected to be written number of entries
+					entries_left--;
+				}
 			}
 
 			// Writing failed, abort
@@ -215,8 +350,38 @@ RetResult DataStore<TStruct>::commit()
 template <class TStruct>
 RetResult DataStore<TStruct>::clear_buffer()
 {
+	ScopedLock lock(this);
+
 	_buffer_element_count = 0;
 
+	// Reserved slot is gone, so is the lock reserve() holds for it
+	if(_slot_reserved)
+	{
+		_slot_reserved = false;
+		unlock();
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Hold buffered entries in another buffer (see Psram)
+ * @param buffer Room for capacity entries, kept for the life of the store
+ * @return RET_ERROR if a slot is reserved or buffered entries don't fit
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStore<TStruct>::move_buffer(void *buffer, int capacity)
+{
+	ScopedLock lock(this);
+
+	if(_slot_reserved || capacity < (int)_buffer_element_count)
+		return RET_ERROR;
+
+	memcpy(buffer, _buffer, _buffer_element_count * sizeof(Entry));
+
+	_buffer = (Entry*)buffer;
+	_buffer_capacity = capacity;
+
 	return RET_OK;
 }
 
@@ -226,18 +391,24 @@ RetResult DataStore<TStruct>::clear_buffer()
 template <class TStruct>
 RetResult DataStore<TStruct>::clear_all()
 {
+	ScopedLock lock(this);
+
 	// Clear buffer
 	clear_buffer();
 
+	invalidate_index();
+
+	clear_cursor();
+
 	// Clear flash
 	// Rmdir doesnt't work since SPIFFS is flat and dirs are only somewhat
 	// emulated, so delete one by one
-	File dir = SPIFFS.open(get_dir_path());
+	File dir = STORAGE_FS.open(get_dir_path());
 	File file;
 
 	while(file = dir.openNextFile())
 	{
-		SPIFFS.remove(file.name());
+		STORAGE_FS.remove(file.name());
 
 		file.close();
 	}
@@ -246,6 +417,210 @@ RetResult DataStore<TStruct>::clear_all()
 	return RET_OK;
 }
 
+/******************************************************************************
+ * Rewrite files of an older entry layout in the current one (see
+ * StoreRegistry::check_format()). Layout of a file is the one its first entries
+ * pass the CRC check with, so files already migrated are left alone: entries
+ * without a seq (DATA_STORE_LEGACY_ENTRY_HEADER_SIZE) and data sizes TStruct had
+ * before fields were appended to it. Migrated entries without a seq get 0 (not
+ * tracked, never skipped as acknowledged), entries failing their CRC are dropped.
+ * Fields are only ever appended to entry structs, so old data is the head of
+ * the current struct, the rest is zero filled and set by upgrade.
+ * @param old_data_sizes Sizes of older TStruct layouts, oldest first
+ * @param count Number of old layouts
+ * @param upgrade Sets appended fields of migrated data, NULL leaves them 0
+ * @return Files migrated, -1 if a file matches no layout
+ ******************************************************************************/
+template <class TStruct>
+int DataStore<TStruct>::migrate(const int *old_data_sizes, int count, DataStoreUpgrader upgrade)
+{
+	ScopedLock lock(this);
+
+	if(Flash::mount() != RET_OK)
+		return 0;
+
+	// Leftover of an interrupted migration, its source is still in place
+	if(STORAGE_FS.exists(DATA_STORE_MIGRATE_TMP_PATH))
+		STORAGE_FS.remove(DATA_STORE_MIGRATE_TMP_PATH);
+
+	File dir = STORAGE_FS.open(_dir_path);
+	if(!dir)
+		return 0;
+
+	const int header_size = sizeof(Entry) - sizeof(TStruct);
+	const int data_size = sizeof(TStruct);
+
+	// Smallest entry of any layout, files smaller have no whole entry to tell it by
+	int min_entry_size = DATA_STORE_LEGACY_ENTRY_HEADER_SIZE + (count > 0 ? old_data_sizes[0] : data_size);
+
+	int migrated = 0;
+	bool mismatch = false;
+	File cur_file;
+
+	while(cur_file = dir.openNextFile())
+	{
+		char path[FILE_PATH_BUFFER_SIZE] = {0};
+		strncpy(path, cur_file.name(), sizeof(path) - 1);
+
+		if((int)cur_file.size() < min_entry_size || layout_matches(cur_file, header_size, data_size))
+		{
+			cur_file.close();
+			continue;
+		}
+
+		// Newest layout first
+		int old_header_size = DATA_STORE_LEGACY_ENTRY_HEADER_SIZE;
+		int old_data_size = data_size;
+		bool found = layout_matches(cur_file, old_header_size, old_data_size);
+
+		for(int i = count - 1; i >= 0 && !found; i--)
+		{
+			old_data_size = old_data_sizes[i];
+
+			for(int j = 0; j < 2 && !found; j++)
+			{
+				old_header_size = j == 0 ? header_size : DATA_STORE_LEGACY_ENTRY_HEADER_SIZE;
+				found = layout_matches(cur_file, old_header_size, old_data_size);
+			}
+		}
+
+		cur_file.close();
+
+		if(!found || migrate_file(path, old_header_size, old_data_size, upgrade) != RET_OK)
+		{
+			debug_print_w(F("Could not migrate store file: "));
+			debug_println(path);
+
+			mismatch = true;
+			continue;
+		}
+
+		migrated++;
+	}
+	dir.close();
+
+	if(migrated > 0)
+	{
+		// Entry counts and sizes changed, a cursor would point into another entry
+		invalidate_index();
+		clear_cursor();
+
+		debug_print_i(F("Migrated store: "));
+		debug_print(_dir_path);
+		debug_printf(", %d files\n", migrated);
+	}
+
+	return mismatch ? -1 : migrated;
+}
+
+/******************************************************************************
+ * Check if a file was written with an entry layout: one of its first
+ * DATA_STORE_MIGRATE_CHECK_ENTRIES entries passes the CRC check when read with it
+ * @param file Open store file, read from the start
+ * @param header_size Bytes before data in an entry, CRC32 first
+ * @param data_size Bytes of data in an entry
+ ******************************************************************************/
+template <class TStruct>
+bool DataStore<TStruct>::layout_matches(File &file, int header_size, int data_size)
+{
+	int entry_size = header_size + data_size;
+	int entries = min((int)file.size() / entry_size, DATA_STORE_MIGRATE_CHECK_ENTRIES);
+	uint8_t buff[sizeof(Entry)];
+
+	if(entry_size > (int)sizeof(buff) || !file.seek(0))
+		return false;
+
+	for(int i = 0; i < entries; i++)
+	{
+		if((int)file.read(buff, entry_size) != entry_size)
+			return false;
+
+		uint32_t crc32;
+		memcpy(&crc32, buff, sizeof(crc32));
+
+		if(crc32 == Utils::crc32(buff + header_size, data_size))
+			return true;
+	}
+
+	return false;
+}
+
+/******************************************************************************
+ * Rewrite a file of an older entry layout in the current one (see migrate()).
+ * Entries are converted into a temp file which then replaces the original.
+ * @param path File path
+ * @param header_size Bytes before data in an old entry, seq is kept when it has one
+ * @param data_size Bytes of data in an old entry
+ * @param upgrade Sets appended fields of converted data, can be NULL
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStore<TStruct>::migrate_file(const char *path, int header_size, int data_size, DataStoreUpgrader upgrade)
+{
+	File src = STORAGE_FS.open(path, FILE_READ);
+	File dst = STORAGE_FS.open(DATA_STORE_MIGRATE_TMP_PATH, FILE_WRITE);
+
+	if(!src || !dst)
+	{
+		debug_println_e(F("Could not open files for migration."));
+		src.close();
+		dst.close();
+		return RET_ERROR;
+	}
+
+	int old_entry_size = header_size + data_size;
+	int entries = src.size() / old_entry_size;
+	bool has_seq = header_size == (int)(sizeof(Entry) - sizeof(TStruct));
+
+	uint8_t buff[sizeof(Entry)];
+	Entry entry;
+	bool success = true;
+
+	for(int i = 0; i < entries; i++)
+	{
+		if((int)src.read(buff, old_entry_size) != old_entry_size)
+		{
+			success = false;
+			break;
+		}
+
+		uint32_t crc32;
+		memcpy(&crc32, buff, sizeof(crc32));
+
+		if(crc32 != Utils::crc32(buff + header_size, data_size))
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+
+		if(has_seq)
+			memcpy(&entry.seq, buff + sizeof(entry.crc32), sizeof(entry.seq));
+
+		memcpy(&entry.data, buff + header_size, data_size);
+
+		if(upgrade != NULL && data_size < (int)sizeof(TStruct))
+			upgrade(&entry.data, data_size);
+
+		entry.crc32 = Utils::crc32((uint8_t*)&entry.data, sizeof(TStruct));
+
+		if(dst.write((uint8_t*)&entry, sizeof(Entry)) != sizeof(Entry))
+		{
+			success = false;
+			break;
+		}
+	}
+
+	src.close();
+	dst.close();
+
+	if(!success || !STORAGE_FS.remove(path) || !STORAGE_FS.rename(DATA_STORE_MIGRATE_TMP_PATH, path))
+	{
+		debug_println_e(F("Could not migrate file."));
+		STORAGE_FS.remove(DATA_STORE_MIGRATE_TMP_PATH);
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
 /******************************************************************************
  * Get number of items in buffer
  ******************************************************************************/
@@ -285,38 +660,21 @@ const char* DataStore<TStruct>::get_dir_path() const
 template <class TStruct>
 RetResult DataStore<TStruct>::update_current_data_file_path()
 {
-	File dir = SPIFFS.open(_dir_path);
-	if(!dir)
-	{
-		debug_print(F("Could not open store dir: "));
-		debug_println(_dir_path);
+	// Index keeps track of current file, scan dir only if index not built yet
+	if(!index_valid() && build_index() != RET_OK)
 		return RET_ERROR;
-	}
 
-	// Find smallest file
-	int smallest_size = -1;
+	int smallest_size = strlen(_current_data_file_path) > 0 ? _index.current_file_size : -1;
 	char smallest_file_path[FILE_PATH_BUFFER_SIZE] = {0};
-	File cur_file;
-
-	while(cur_file = dir.openNextFile())
-	{
-		if(cur_file.size() < smallest_size || smallest_size < 0)
-		{
-			smallest_size = cur_file.size();
-			strncpy(smallest_file_path, cur_file.name(), sizeof(smallest_file_path));
-		}
-
-		cur_file.close();
-	}
-	cur_file.close();
-	dir.close();
+	strncpy(smallest_file_path, _current_data_file_path, sizeof(smallest_file_path));
 
 	// debug_print(F("Smallest size: ")); // del
 	// debug_println(smallest_size, DEC);
 
 	// Smallest file found, check if there is space in it for at least one entry
 	// else create a new file
-	if(smallest_size >= 0 && smallest_size + sizeof(Entry) <= _max_entries_per_file * sizeof(Entry))
+	if(smallest_size >= 0 && smallest_size + sizeof(Entry) <= _max_entries_per_file * sizeof(Entry) &&
+		!is_sealed(smallest_file_path))
 	{
 		// debug_print(F("Use existing: "));
 		// debug_println(smallest_file_path);
@@ -339,11 +697,16 @@ RetResult DataStore<TStruct>::update_current_data_file_path()
 		int tries = 100;
 		bool success = false;
 
+		// Named after the reader snapshot, so readers skip it
+		uint32_t tstamp = time(NULL);
+		if(_readers > 0 && tstamp <= _snapshot_tstamp)
+			tstamp = _snapshot_tstamp + 1;
+
 		do
 		{
-			snprintf(new_file_path, sizeof(new_file_path), "%s/%d_%d", _dir_path, (int)time(NULL), FILENAME_POSTFIX_MAX - tries);
+			snprintf(new_file_path, sizeof(new_file_path), "%s/%d_%d", _dir_path, (int)tstamp, FILENAME_POSTFIX_MAX - tries);
 			
-			if (!SPIFFS.exists(new_file_path))
+			if (!STORAGE_FS.exists(new_file_path))
 			{
 				success = true;
 				break;
@@ -361,7 +724,7 @@ RetResult DataStore<TStruct>::update_current_data_file_path()
 		debug_print(F("Creating new file: "));
 		debug_println(new_file_path);
 
-		File f = SPIFFS.open(new_file_path, FILE_WRITE);
+		File f = STORAGE_FS.open(new_file_path, FILE_WRITE);
 		if(!f)
 		{
 			debug_print(F("Could not create new data file: "));
@@ -374,6 +737,14 @@ RetResult DataStore<TStruct>::update_current_data_file_path()
 		// Update current file path
 		strncpy(_current_data_file_path, new_file_path, sizeof(_current_data_file_path));
 
+		if(_index.file_count == 0 || tstamp < _index.oldest_file_tstamp)
+			_index.oldest_file_tstamp = tstamp;
+		if(tstamp > _index.newest_file_tstamp)
+			_index.newest_file_tstamp = tstamp;
+
+		_index.file_count++;
+		_index.current_file_size = 0;
+
 		return RET_OK;
 	}
 }
@@ -387,23 +758,11 @@ File DataStore<TStruct>::open_file()
 template <typename TStruct>
 RetResult DataStore<TStruct>::cleanup(bool force)
 {
+	ScopedLock lock(this);
+
 	if(!force)
 	{
-		File dir = SPIFFS.open(_dir_path);
-		int file_count = 0;
-		File f;
-
-		if(!dir)
-		{
-			debug_println_e(F("Could not open store dir."));
-			return RET_ERROR;
-		}
-
-		while(f = dir.openNextFile())
-		{
-			file_count++;
-		}
-		dir.close();
+		int file_count = get_file_count();
 
 		debug_print(F("Store "));
 		debug_print(_dir_path);
@@ -424,50 +783,74 @@ RetResult DataStore<TStruct>::cleanup(bool force)
 	}
 
 
+	#if !STORAGE_HAS_DIRS
 	// When max number of files is reached, SPIFFS has panic attacks and among other things, sometimes
 	// fails to SPIFFS.remove(). This is a workaround.
-	SPIFFS.end();
-	SPIFFS.begin();
+	Flash::remount();
+	#endif
 
 	debug_print_i(F("Free space before cleanup: "));
-	debug_println(SPIFFS.totalBytes() - SPIFFS.usedBytes(), DEC);
+	debug_println(STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes(), DEC);
 	debug_print_i(F("Cleaning up store: "));
 	debug_println(_dir_path);
 
-	File dir = SPIFFS.open(_dir_path);
+	File dir = STORAGE_FS.open(_dir_path);
 	if(!dir)
 	{
 		debug_println_e(F("Could not open store dir."));
 		return RET_ERROR;
 	}
 
+	// Dir order is not creation order. Oldest files are found by the timestamp in
+	// their names, all files up to the STORE_CLEANUP_FILE_COUNT-th oldest are deleted
+	uint32_t cutoff_tstamp = cleanup_cutoff_tstamp(dir);
+	dir.rewindDirectory();
+
 	// Delete files until threshold reached
 	File cur_file;
 	int bytes_freed = 0;
 	int files_deleted = 0;
 
-	while(cur_file = dir.openNextFile())
+	while(files_deleted < STORE_CLEANUP_FILE_COUNT && (cur_file = dir.openNextFile()))
 	{
+		char path[FILE_PATH_BUFFER_SIZE];
+		strncpy(path, cur_file.name(), sizeof(path) - 1);
+		path[sizeof(path) - 1] = '\0';
+
+		int size = cur_file.size();
+		cur_file.close();
+
+		if(file_name_tstamp(path) > cutoff_tstamp)
+			continue;
+
+		// Being read, deleted once the reader is done with it
+		if(defer_delete(path, size))
+		{
+			files_deleted++;
+			continue;
+		}
+
 		debug_print(F("Removing: "));
-		debug_println(cur_file.name());
-		debug_print(F("Used bytes before: "));
-		debug_println(SPIFFS.usedBytes(), DEC);
+		debug_println(path);
 
-		if(SPIFFS.remove(cur_file.name()))
+		// Entries are rolled up before they are gone
+		if(_on_evict != NULL)
+			_on_evict(path);
+
+		if(STORAGE_FS.remove(path))
 		{
-			bytes_freed += cur_file.size();
+			bytes_freed += size;
 
 			debug_println_i(F("Remove SUCCESS"));
 		}
 
-		// Temp move inside if above
-		if(++files_deleted >= STORE_CLEANUP_FILE_COUNT)
-				break;
-
-		debug_print(F("Bytes after: "));
-		debug_println(SPIFFS.usedBytes(), DEC);
+		files_deleted++;
 	}
 
+	// Last file done
+	if(_on_evict != NULL && files_deleted > 0)
+		_on_evict(NULL);
+
 	debug_print_i(F("Deleted files: "));
 	debug_println(files_deleted, DEC);
 	debug_print(F("Bytes freed: "));
@@ -482,17 +865,1087 @@ RetResult DataStore<TStruct>::cleanup(bool force)
 	cur_file.close();
 	dir.close();
 
+	// Files removed, rebuild index on next use
+	invalidate_index();
+
 	debug_print_i(F("Free space after cleanup: "));
-	debug_println(SPIFFS.totalBytes() - SPIFFS.usedBytes(), DEC);
+	debug_println(STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes(), DEC);
 
 	return RET_ERROR;
 }
 
+/******************************************************************************
+ * Name timestamp of the STORE_CLEANUP_FILE_COUNT-th oldest file of store dir
+ * @return UINT32_MAX when all files are to be deleted
+ ******************************************************************************/
+template <typename TStruct>
+uint32_t DataStore<TStruct>::cleanup_cutoff_tstamp(File &dir)
+{
+	int count = 0;
+	File cur_file;
+
+	while(cur_file = dir.openNextFile())
+	{
+		count++;
+		cur_file.close();
+	}
+
+	if(count <= STORE_CLEANUP_FILE_COUNT)
+		return UINT32_MAX;
+
+	uint32_t *tstamps = (uint32_t*)malloc(count * sizeof(uint32_t));
+
+	// No memory to sort, fall back to dir order
+	if(tstamps == NULL)
+		return UINT32_MAX;
+
+	dir.rewindDirectory();
+
+	int i = 0;
+	while(i < count && (cur_file = dir.openNextFile()))
+	{
+		tstamps[i++] = file_name_tstamp(cur_file.name());
+		cur_file.close();
+	}
+
+	if(i == 0)
+	{
+		free(tstamps);
+		return UINT32_MAX;
+	}
+
+	qsort(tstamps, i, sizeof(uint32_t), [](const void *a, const void *b) -> int
+	{
+		uint32_t ta = *(const uint32_t*)a;
+		uint32_t tb = *(const uint32_t*)b;
+		return ta < tb ? -1 : (ta > tb ? 1 : 0);
+	});
+
+	uint32_t cutoff = tstamps[(i < STORE_CLEANUP_FILE_COUNT ? i : STORE_CLEANUP_FILE_COUNT) - 1];
+
+	free(tstamps);
+
+	return cutoff;
+}
+
+/******************************************************************************
+ * Scan store dir once and build file index. Smallest file that still has space
+ * becomes the current data file.
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::build_index()
+{
+	_index = {0};
+	_current_data_file_path[0] = '\0';
+
+	File dir = STORAGE_FS.open(_dir_path);
+	if(!dir)
+	{
+		#if STORAGE_HAS_DIRS
+		// Dir not created yet, store is empty
+		if(STORAGE_FS.mkdir(_dir_path))
+		{
+			_index.flash_generation = Flash::get_generation();
+			_index.valid = true;
+			return RET_OK;
+		}
+		#endif
+
+		debug_print(F("Could not open store dir: "));
+		debug_println(_dir_path);
+		return RET_ERROR;
+	}
+
+	// Find smallest file
+	int smallest_size = -1;
+	File cur_file;
+
+	// File found ending with a partially written entry
+	char partial_file_path[FILE_PATH_BUFFER_SIZE] = {0};
+	int partial_file_size = 0;
+
+	while(cur_file = dir.openNextFile())
+	{
+		int size = cur_file.size();
+		uint32_t tstamp = file_name_tstamp(cur_file.name());
+
+		if(size % sizeof(Entry) != 0)
+		{
+			strncpy(partial_file_path, cur_file.name(), sizeof(partial_file_path));
+			partial_file_size = size;
+
+			// Size after truncation
+			size -= size % sizeof(Entry);
+		}
+
+		if(_index.file_count == 0 || tstamp < _index.oldest_file_tstamp)
+			_index.oldest_file_tstamp = tstamp;
+		if(tstamp > _index.newest_file_tstamp)
+			_index.newest_file_tstamp = tstamp;
+
+		_index.file_count++;
+		_index.entry_count += size / sizeof(Entry);
+
+		if(size < smallest_size || smallest_size < 0)
+		{
+			smallest_size = size;
+			strncpy(_current_data_file_path, cur_file.name(), sizeof(_current_data_file_path));
+		}
+
+		cur_file.close();
+	}
+	dir.close();
+
+	// Appending to a file with a partial entry would misalign all entries that follow
+	if(strlen(partial_file_path) > 0)
+		truncate_partial_entry(partial_file_path, partial_file_size);
+
+	// No space left in smallest file, a new one will be created on commit
+	if(smallest_size < 0 || smallest_size + sizeof(Entry) > _max_entries_per_file * sizeof(Entry))
+	{
+		_current_data_file_path[0] = '\0';
+		smallest_size = 0;
+	}
+
+	_index.current_file_size = smallest_size;
+	_index.flash_generation = Flash::get_generation();
+	_index.valid = true;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Remove a partially written entry from the end of a file (eg. power loss
+ * during commit). Whole entries are copied to a temp file which then replaces
+ * the original.
+ * @param path File path
+ * @param size Current file size
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::truncate_partial_entry(const char *path, int size)
+{
+	int entries = size / sizeof(Entry);
+
+	debug_print_w(F("Truncating partial entry from file: "));
+	debug_println(path);
+
+	File src = STORAGE_FS.open(path, FILE_READ);
+	File dst = STORAGE_FS.open(DATA_STORE_TRUNCATE_TMP_PATH, FILE_WRITE);
+
+	if(!src || !dst)
+	{
+		debug_println_e(F("Could not open files for truncation."));
+		src.close();
+		dst.close();
+		return RET_ERROR;
+	}
+
+	Entry entry;
+	bool success = true;
+
+	for(int i = 0; i < entries; i++)
+	{
+		if(src.read((uint8_t*)&entry, sizeof(Entry)) != sizeof(Entry) ||
+			dst.write((uint8_t*)&entry, sizeof(Entry)) != sizeof(Entry))
+		{
+			success = false;
+			break;
+		}
+	}
+
+	src.close();
+	dst.close();
+
+	if(!success || !STORAGE_FS.remove(path) || !STORAGE_FS.rename(DATA_STORE_TRUNCATE_TMP_PATH, path))
+	{
+		debug_println_e(F("Could not truncate file."));
+		STORAGE_FS.remove(DATA_STORE_TRUNCATE_TMP_PATH);
+		return RET_ERROR;
+	}
+
+	Log::log(Log::DATA_STORE_PARTIAL_ENTRY_TRUNCATED, size % sizeof(Entry), entries);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Merge partially filled files into full ones (see StoreRegistry::compact_all()).
+ * Oldest small files are grouped in name order up to max_entries_per_file
+ * entries, each group is copied to a temp file which is renamed into the store
+ * before the sources are deleted. An interruption leaves either the sources or
+ * the merged file plus some sources, entries are never lost (duplicates are
+ * resent with the same timestamp). Current data file and a partially submitted
+ * file are left alone.
+ * @param max_sources Max files to merge
+ * @return Number of files merged
+ ******************************************************************************/
+template <typename TStruct>
+int DataStore<TStruct>::compact(int max_sources)
+{
+	ScopedLock lock(this);
+
+	if(Flash::mount() != RET_OK)
+		return 0;
+
+	if(!index_valid())
+		build_index();
+
+	// Leftover of an interrupted compaction, its sources are still in place
+	if(STORAGE_FS.exists(DATA_STORE_COMPACT_TMP_PATH))
+		STORAGE_FS.remove(DATA_STORE_COMPACT_TMP_PATH);
+
+	// Merged files would hold entries readers already have
+	if(!index_valid() || _index.file_count < 2 || max_sources < 2 || _readers > 0)
+		return 0;
+
+	CompactSource *sources = (CompactSource*)malloc(max_sources * sizeof(CompactSource));
+	if(sources == NULL)
+		return 0;
+
+	int count = find_compact_sources(sources, max_sources);
+	int merged = 0;
+	int created = 0;
+	int full_entries = _max_entries_per_file;
+
+	// Group sources in order until a group is full
+	for(int first = 0; first < count; )
+	{
+		int last = first;
+		int entries = sources[first].entries;
+
+		while(last + 1 < count && entries + sources[last + 1].entries <= full_entries)
+		{
+			last++;
+			entries += sources[last].entries;
+		}
+
+		if(last > first && merge_files(&sources[first], last - first + 1) == RET_OK)
+		{
+			merged += last - first + 1;
+			created++;
+		}
+
+		first = last + 1;
+	}
+
+	free(sources);
+
+	if(merged > 0)
+	{
+		// Files replaced, rebuild index on next use
+		invalidate_index();
+
+		debug_print_i(F("Compacted store: "));
+		debug_print(_dir_path);
+		debug_printf(", %d files into %d\n", merged, created);
+
+		log(Log::DATA_STORE_COMPACTED, merged, created);
+	}
+
+	return merged;
+}
+
+/******************************************************************************
+ * Find oldest partially filled files that can be merged
+ * @param sources_out Found files, oldest first
+ * @param max_sources Max files to find
+ * @return Number of files found
+ ******************************************************************************/
+template <typename TStruct>
+int DataStore<TStruct>::find_compact_sources(CompactSource *sources_out, int max_sources)
+{
+	File dir = STORAGE_FS.open(_dir_path);
+	if(!dir)
+		return 0;
+
+	int count = 0;
+	File cur_file;
+
+	while(cur_file = dir.openNextFile())
+	{
+		CompactSource source;
+		strncpy(source.path, cur_file.name(), sizeof(source.path) - 1);
+		source.path[sizeof(source.path) - 1] = '\0';
+		size_t size = cur_file.size();
+		source.entries = size / sizeof(Entry);
+		source.tstamp = file_name_tstamp(source.path);
+
+		cur_file.close();
+
+		// Full, being written to, partially submitted or with a partial entry
+		if(source.entries >= _max_entries_per_file ||
+			strncmp(source.path, _current_data_file_path, sizeof(source.path)) == 0 ||
+			get_cursor(source.path) > 0 ||
+			source.entries * sizeof(Entry) != size)
+			continue;
+
+		// Keep the oldest ones, sorted by insertion
+		int pos = count;
+		while(pos > 0 && sources_out[pos - 1].tstamp > source.tstamp)
+			pos--;
+
+		if(pos >= max_sources)
+			continue;
+
+		if(count == max_sources)
+			count--;
+
+		memmove(&sources_out[pos + 1], &sources_out[pos], (count - pos) * sizeof(CompactSource));
+		sources_out[pos] = source;
+		count++;
+	}
+
+	dir.close();
+
+	return count;
+}
+
+/******************************************************************************
+ * Copy files into a new one and delete them
+ * Merged file is named after the first one so it keeps its place in time
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::merge_files(const CompactSource *sources, int count)
+{
+	File dst = STORAGE_FS.open(DATA_STORE_COMPACT_TMP_PATH, FILE_WRITE);
+	if(!dst)
+		return RET_ERROR;
+
+	Entry entry;
+	bool success = true;
+
+	for(int i = 0; i < count && success; i++)
+	{
+		File src = STORAGE_FS.open(sources[i].path, FILE_READ);
+		if(!src)
+		{
+			success = false;
+			break;
+		}
+
+		for(int j = 0; j < sources[i].entries; j++)
+		{
+			if(src.read((uint8_t*)&entry, sizeof(Entry)) != sizeof(Entry) ||
+				dst.write((uint8_t*)&entry, sizeof(Entry)) != sizeof(Entry))
+			{
+				success = false;
+				break;
+			}
+		}
+
+		src.close();
+	}
+
+	dst.close();
+
+	// Unused name in store dir, next to the first source
+	char path[FILE_PATH_BUFFER_SIZE] = {0};
+	bool name_found = false;
+
+	for(int i = 0; success && i < FILENAME_POSTFIX_MAX && !name_found; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%u_%d", _dir_path, sources[0].tstamp, FILENAME_POSTFIX_MAX + i);
+		name_found = !STORAGE_FS.exists(path);
+	}
+
+	if(!success || !name_found || !STORAGE_FS.rename(DATA_STORE_COMPACT_TMP_PATH, path))
+	{
+		debug_println_e(F("Could not merge store files."));
+		STORAGE_FS.remove(DATA_STORE_COMPACT_TMP_PATH);
+		return RET_ERROR;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		STORAGE_FS.remove(sources[i].path);
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Enable/disable writing all entries that fit a file with a single write on
+ * commit. When disabled, entries are written and flushed one by one.
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::set_block_commit(bool enabled)
+{
+	_block_commit = enabled;
+}
+
+/******************************************************************************
+ * Check if index can be used
+ ******************************************************************************/
+template <typename TStruct>
+bool DataStore<TStruct>::index_valid() const
+{
+	return _index.valid && _index.flash_generation == Flash::get_generation();
+}
+
+/******************************************************************************
+ * Mark index as invalid so it is rebuilt on next use
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::invalidate_index()
+{
+	_index.valid = false;
+	_current_data_file_path[0] = '\0';
+}
+
+/******************************************************************************
+ * Get file index. Built if not built already.
+ ******************************************************************************/
+template <typename TStruct>
+const typename DataStore<TStruct>::Index* DataStore<TStruct>::get_index()
+{
+	ScopedLock lock(this);
+
+	if(!index_valid())
+	{
+		if(Flash::mount() != RET_OK || build_index() != RET_OK)
+			return NULL;
+	}
+
+	return &_index;
+}
+
+/******************************************************************************
+ * Get number of files in store
+ * @return File count, -1 if index could not be built
+ ******************************************************************************/
+template <typename TStruct>
+int DataStore<TStruct>::get_file_count()
+{
+	ScopedLock lock(this);
+
+	const Index *index = get_index();
+
+	return index != NULL ? index->file_count : -1;
+}
+
+/******************************************************************************
+ * Get number of entries a file is filled with before a new one is started
+ ******************************************************************************/
+template <typename TStruct>
+int DataStore<TStruct>::get_max_entries_per_file() const
+{
+	return _max_entries_per_file;
+}
+
+/******************************************************************************
+ * Update index when a file of the store is deleted (eg. by a reader)
+ * @param path Path of deleted file
+ * @param size Size of deleted file
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::on_file_deleted(const char *path, int size)
+{
+	ScopedLock lock(this);
+
+	// Submission cursor no longer needed
+	if(get_cursor(path) > 0)
+		clear_cursor();
+
+	if(!index_valid())
+		return;
+
+	_index.file_count--;
+	_index.entry_count -= size / sizeof(Entry);
+
+	if(_index.file_count <= 0)
+	{
+		_index.file_count = 0;
+		_index.entry_count = 0;
+		_index.oldest_file_tstamp = 0;
+		_index.newest_file_tstamp = 0;
+	}
+
+	// Current data file gone, a new one will be created on next commit
+	if(strncmp(path, _current_data_file_path, sizeof(_current_data_file_path)) == 0)
+	{
+		_current_data_file_path[0] = '\0';
+		_index.current_file_size = 0;
+	}
+}
+
+/******************************************************************************
+ * Remove a submitted file of the store. With FLAGS.STORE_ARCHIVE it is moved to
+ * the archive twin instead, where it is kept until flash space is needed
+ * (see StoreRegistry::cleanup_all()). Twins delete their files.
+ * @param path Path of file
+ * @param size Size of file
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::remove_file(const char *path, int size)
+{
+	ScopedLock lock(this);
+
+	// Open by another reader, removed when it is done
+	if(defer_delete(path, size))
+		return RET_OK;
+
+	bool removed = false;
+
+	if(FLAGS.STORE_ARCHIVE && !_is_twin)
+	{
+		DataStore<TStruct> *archive = get_twin(DATA_STORE_TWIN_ARCHIVE);
+
+		// Index built first, it creates the archive dir
+		if(archive != NULL && archive->get_index() != NULL)
+		{
+			char archive_path[FILE_PATH_BUFFER_SIZE] = {0};
+			snprintf(archive_path, sizeof(archive_path), "%s%s", DATA_STORE_ARCHIVE_DIR, path);
+
+			removed = STORAGE_FS.rename(path, archive_path);
+
+			if(removed)
+				archive->invalidate_index();
+			else
+				debug_println_w(F("Could not archive file, deleting it."));
+		}
+	}
+
+	if(!removed)
+		removed = STORAGE_FS.remove(path);
+
+	if(!removed)
+		return RET_ERROR;
+
+	on_file_deleted(path, size);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Get twin store: same entry type, dir path prefixed with the twin's dir
+ * Created on first use and kept.
+ * @return Twin, NULL if it could not be created or store is a twin itself
+ ******************************************************************************/
+template <typename TStruct>
+DataStore<TStruct>* DataStore<TStruct>::get_twin(DataStoreTwin twin)
+{
+	ScopedLock lock(this);
+
+	if(_is_twin || twin < 0 || twin >= DATA_STORE_TWIN_COUNT)
+		return NULL;
+
+	if(_twins[twin] != NULL)
+		return _twins[twin];
+
+	const char *prefix = twin == DATA_STORE_TWIN_ARCHIVE ? DATA_STORE_ARCHIVE_DIR : DATA_STORE_BACKFILL_DIR;
+
+	snprintf(_twin_dir_paths[twin], FILE_PATH_BUFFER_SIZE, "%s%s", prefix, _dir_path);
+
+	#if STORAGE_HAS_DIRS
+	STORAGE_FS.mkdir(prefix);
+	#endif
+
+	_twins[twin] = new DataStore<TStruct>(_twin_dir_paths[twin], _max_entries_per_file);
+
+	if(_twins[twin] == NULL)
+	{
+		debug_println_e(F("Could not create twin store."));
+		return NULL;
+	}
+
+	_twins[twin]->_is_twin = true;
+
+	return _twins[twin];
+}
+
+/******************************************************************************
+ * Get timestamp part of a data file name (<dir>/<tstamp>_<postfix>)
+ ******************************************************************************/
+template <typename TStruct>
+uint32_t DataStore<TStruct>::file_name_tstamp(const char *path)
+{
+	const char *name = strrchr(path, '/');
+	name = name == NULL ? path : name + 1;
+
+	return strtoul(name, NULL, 10);
+}
+
+/******************************************************************************
+ * Get number of entries of a file already submitted (partial submission)
+ * @param file_path File path
+ * @return Entries to skip when reading file, 0 if file not partially submitted
+ ******************************************************************************/
+template <typename TStruct>
+int DataStore<TStruct>::get_cursor(const char *file_path)
+{
+	ScopedLock lock(this);
+
+	if(!_cursor_loaded)
+	{
+		_cursor_loaded = true;
+
+		char cursor_path[FILE_PATH_BUFFER_SIZE] = {0};
+		get_cursor_path(cursor_path, sizeof(cursor_path));
+
+		File f = STORAGE_FS.open(cursor_path, FILE_READ);
+
+		if(!f || f.read((uint8_t*)&_cursor, sizeof(_cursor)) != sizeof(_cursor) ||
+			_cursor.crc32 != Utils::crc32((uint8_t*)&_cursor, sizeof(_cursor) - sizeof(_cursor.crc32)))
+		{
+			memset(&_cursor, 0, sizeof(_cursor));
+		}
+
+		f.close();
+	}
+
+	if(strncmp(_cursor.file_path, file_path, sizeof(_cursor.file_path)) != 0)
+		return 0;
+
+	return _cursor.entries;
+}
+
+/******************************************************************************
+ * Persist number of entries of a file submitted so far
+ * @param file_path File path
+ * @param entries Entries from start of file that have been submitted
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::set_cursor(const char *file_path, int entries)
+{
+	ScopedLock lock(this);
+
+	char cursor_path[FILE_PATH_BUFFER_SIZE] = {0};
+	get_cursor_path(cursor_path, sizeof(cursor_path));
+
+	#if STORAGE_HAS_DIRS
+	STORAGE_FS.mkdir(DATA_STORE_CURSOR_DIR);
+	#endif
+
+	memset(&_cursor, 0, sizeof(_cursor));
+	strncpy(_cursor.file_path, file_path, sizeof(_cursor.file_path) - 1);
+	_cursor.entries = entries;
+	_cursor.crc32 = Utils::crc32((uint8_t*)&_cursor, sizeof(_cursor) - sizeof(_cursor.crc32));
+	_cursor_loaded = true;
+
+	File f = STORAGE_FS.open(cursor_path, FILE_WRITE);
+	if(!f)
+	{
+		debug_println_e(F("Could not open cursor file."));
+		return RET_ERROR;
+	}
+
+	int written_bytes = f.write((uint8_t*)&_cursor, sizeof(_cursor));
+	f.close();
+
+	return written_bytes == sizeof(_cursor) ? RET_OK : RET_ERROR;
+}
+
+/******************************************************************************
+ * Remove submission cursor
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::clear_cursor()
+{
+	ScopedLock lock(this);
+
+	char cursor_path[FILE_PATH_BUFFER_SIZE] = {0};
+	get_cursor_path(cursor_path, sizeof(cursor_path));
+
+	memset(&_cursor, 0, sizeof(_cursor));
+	_cursor_loaded = true;
+
+	if(STORAGE_FS.exists(cursor_path))
+		STORAGE_FS.remove(cursor_path);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Get sequence number of next entry. Numbers are reserved in flash in blocks,
+ * after a reset the rest of the block is skipped so numbers never repeat
+ ******************************************************************************/
+template <typename TStruct>
+uint32_t DataStore<TStruct>::next_seq()
+{
+	load_seq_state();
+
+	if(_next_seq >= _seq_state.reserved)
+	{
+		_seq_state.reserved = _next_seq + DATA_STORE_SEQ_RESERVE;
+
+		if(save_seq_state() != RET_OK)
+			debug_println_e(F("Could not reserve sequence numbers."));
+	}
+
+	uint32_t seq = _next_seq++;
+
+	if(_seq_slot >= 0)
+	{
+		DataStoreSeqSlot *slot = &_seq_slots[_seq_slot];
+		slot->next_seq = _next_seq;
+		slot->crc32 = Utils::crc32((uint8_t*)slot, sizeof(*slot) - sizeof(slot->crc32));
+	}
+
+	return seq;
+}
+
+/******************************************************************************
+ * Load sequence number state from flash, once. Numbering continues from the
+ * store's RTC memory slot, or after the last reserved block if it was lost
+ * (starts at 1, 0 is not tracked)
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::load_seq_state()
+{
+	if(_seq_loaded)
+		return;
+
+	// Twins keep the numbers of the entries copied into them
+	if(_is_twin)
+	{
+		_seq_loaded = true;
+		return;
+	}
+
+	// Retried on next call, numbering starts at 1 until state can be read
+	if(Flash::mount() != RET_OK)
+	{
+		if(_next_seq == 0)
+			_next_seq = 1;
+
+		return;
+	}
+
+	_seq_loaded = true;
+
+	char path[FILE_PATH_BUFFER_SIZE] = {0};
+	snprintf(path, sizeof(path), "%s%s", DATA_STORE_SEQ_DIR, _dir_path);
+
+	File f = STORAGE_FS.open(path, FILE_READ);
+
+	if(!f || f.read((uint8_t*)&_seq_state, sizeof(_seq_state)) != sizeof(_seq_state) ||
+		_seq_state.crc32 != Utils::crc32((uint8_t*)&_seq_state, sizeof(_seq_state) - sizeof(_seq_state.crc32)))
+	{
+		memset(&_seq_state, 0, sizeof(_seq_state));
+	}
+
+	f.close();
+
+	_next_seq = _seq_state.reserved > 0 ? _seq_state.reserved : 1;
+
+	// Find slot of store, or claim a free (invalid) one
+	uint32_t dir_crc32 = Utils::crc32((uint8_t*)_dir_path, strlen(_dir_path));
+	int free_slot = -1;
+
+	for(int i = 0; i < DATA_STORE_SEQ_RTC_SLOTS; i++)
+	{
+		DataStoreSeqSlot *slot = &_seq_slots[i];
+		bool valid = slot->crc32 == Utils::crc32((uint8_t*)slot, sizeof(*slot) - sizeof(slot->crc32));
+
+		if(valid && slot->dir_crc32 == dir_crc32)
+		{
+			_seq_slot = i;
+
+			// Still in the reserved block, it was not lost
+			if(slot->next_seq > 0 && slot->next_seq <= _seq_state.reserved)
+				_next_seq = slot->next_seq;
+
+			return;
+		}
+
+		if(!valid && free_slot < 0)
+			free_slot = i;
+	}
+
+	_seq_slot = free_slot;
+
+	if(_seq_slot >= 0)
+	{
+		DataStoreSeqSlot *slot = &_seq_slots[_seq_slot];
+		slot->dir_crc32 = dir_crc32;
+		slot->next_seq = _next_seq;
+		slot->crc32 = Utils::crc32((uint8_t*)slot, sizeof(*slot) - sizeof(slot->crc32));
+	}
+}
+
+/******************************************************************************
+ * Persist sequence number state
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::save_seq_state()
+{
+	char path[FILE_PATH_BUFFER_SIZE] = {0};
+	snprintf(path, sizeof(path), "%s%s", DATA_STORE_SEQ_DIR, _dir_path);
+
+	#if STORAGE_HAS_DIRS
+	STORAGE_FS.mkdir(DATA_STORE_SEQ_DIR);
+	#endif
+
+	_seq_state.crc32 = Utils::crc32((uint8_t*)&_seq_state, sizeof(_seq_state) - sizeof(_seq_state.crc32));
+
+	File f = STORAGE_FS.open(path, FILE_WRITE);
+	if(!f)
+		return RET_ERROR;
+
+	int written_bytes = f.write((uint8_t*)&_seq_state, sizeof(_seq_state));
+	f.close();
+
+	return written_bytes == sizeof(_seq_state) ? RET_OK : RET_ERROR;
+}
+
+/******************************************************************************
+ * Entries up to this seq were acknowledged by the server, they are skipped
+ * when a request holding them is resent
+ ******************************************************************************/
+template <typename TStruct>
+uint32_t DataStore<TStruct>::get_acked_seq()
+{
+	ScopedLock lock(this);
+
+	load_seq_state();
+
+	return _seq_state.acked;
+}
+
+/******************************************************************************
+ * Set sequence number the server acknowledged entries up to
+ ******************************************************************************/
+template <typename TStruct>
+RetResult DataStore<TStruct>::set_acked_seq(uint32_t seq)
+{
+	ScopedLock lock(this);
+
+	load_seq_state();
+
+	// Server acks the live stream of the store, resubmitted entries are older
+	if(_is_twin || seq <= _seq_state.acked)
+		return RET_OK;
+
+	_seq_state.acked = seq;
+
+	return save_seq_state();
+}
+
+/******************************************************************************
+ * Take store mutex. Recursive, store functions take it themselves; hold it to
+ * make several calls atomic. Created by the main task, before other tasks use
+ * stores
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::lock()
+{
+	if(_mutex == NULL)
+		_mutex = xSemaphoreCreateRecursiveMutex();
+
+	xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+}
+
+/******************************************************************************
+ * Give store mutex
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::unlock()
+{
+	xSemaphoreGiveRecursive(_mutex);
+}
+
+/******************************************************************************
+ * Start iterating files (see DataStoreReader). Files named up to the returned
+ * timestamp are the reader's view: they are not appended to or merged until
+ * close_snapshot(), entries committed meanwhile go to newer files
+ * @return Snapshot timestamp, files named after it must be skipped
+ ******************************************************************************/
+template <typename TStruct>
+uint32_t DataStore<TStruct>::open_snapshot()
+{
+	ScopedLock lock(this);
+
+	if(_readers == 0)
+	{
+		uint32_t tstamp = time(NULL);
+
+		// Files named in the future (clock went back) are in the view too
+		if(index_valid() && _index.newest_file_tstamp > tstamp)
+			tstamp = _index.newest_file_tstamp;
+
+		_snapshot_tstamp = tstamp;
+	}
+
+	_readers++;
+
+	Flash::hold();
+
+	return _snapshot_tstamp;
+}
+
+/******************************************************************************
+ * Reader done, see open_snapshot()
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::close_snapshot()
+{
+	ScopedLock lock(this);
+
+	if(_readers == 0)
+		return;
+
+	_readers--;
+
+	Flash::release();
+}
+
+/******************************************************************************
+ * Reader opened a file, it is not deleted until unpinned
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::pin_file(const char *path)
+{
+	ScopedLock lock(this);
+
+	for(int i = 0; i < DATA_STORE_MAX_READERS; i++)
+	{
+		if(_pinned[i][0] == '\0')
+		{
+			strncpy(_pinned[i], path, FILE_PATH_BUFFER_SIZE - 1);
+			return;
+		}
+	}
+
+	debug_println_w(F("Too many readers, file not pinned."));
+}
+
+/******************************************************************************
+ * Reader closed a file, deletes deferred meanwhile are done
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::unpin_file(const char *path)
+{
+	ScopedLock lock(this);
+
+	for(int i = 0; i < DATA_STORE_MAX_READERS; i++)
+	{
+		if(strncmp(_pinned[i], path, FILE_PATH_BUFFER_SIZE) == 0)
+		{
+			_pinned[i][0] = '\0';
+			break;
+		}
+	}
+
+	run_deferred_deletes();
+}
+
+/******************************************************************************
+ * Readers are open and file is part of their view, it must not change
+ ******************************************************************************/
+template <typename TStruct>
+bool DataStore<TStruct>::is_sealed(const char *path) const
+{
+	return _readers > 0 && file_name_tstamp(path) <= _snapshot_tstamp;
+}
+
+/******************************************************************************
+ * File is open by a reader
+ ******************************************************************************/
+template <typename TStruct>
+bool DataStore<TStruct>::is_pinned(const char *path) const
+{
+	for(int i = 0; i < DATA_STORE_MAX_READERS; i++)
+	{
+		if(_pinned[i][0] != '\0' && strncmp(_pinned[i], path, FILE_PATH_BUFFER_SIZE) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/******************************************************************************
+ * Queue delete of a pinned file
+ * @return False if file is not pinned (or queue is full), delete it now
+ ******************************************************************************/
+template <typename TStruct>
+bool DataStore<TStruct>::defer_delete(const char *path, int size)
+{
+	if(!is_pinned(path) || _deferred_count >= DATA_STORE_MAX_READERS)
+		return false;
+
+	for(int i = 0; i < _deferred_count; i++)
+	{
+		if(strncmp(_deferred[i].path, path, FILE_PATH_BUFFER_SIZE) == 0)
+			return true;
+	}
+
+	strncpy(_deferred[_deferred_count].path, path, FILE_PATH_BUFFER_SIZE - 1);
+	_deferred[_deferred_count].path[FILE_PATH_BUFFER_SIZE - 1] = '\0';
+	_deferred[_deferred_count].size = size;
+	_deferred_count++;
+
+	debug_print(F("File being read, delete deferred: "));
+	debug_println(path);
+
+	return true;
+}
+
+/******************************************************************************
+ * Delete deferred files no longer pinned. Rolled up first like on cleanup, the
+ * reader may not have submitted them
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::run_deferred_deletes()
+{
+	for(int i = 0; i < _deferred_count; )
+	{
+		if(is_pinned(_deferred[i].path))
+		{
+			i++;
+			continue;
+		}
+
+		DeferredDelete del = _deferred[i];
+
+		_deferred_count--;
+		memmove(&_deferred[i], &_deferred[i + 1], (_deferred_count - i) * sizeof(DeferredDelete));
+
+		// Reader deleted it itself
+		if(!STORAGE_FS.exists(del.path))
+			continue;
+
+		if(_on_evict != NULL)
+		{
+			_on_evict(del.path);
+			_on_evict(NULL);
+		}
+
+		if(STORAGE_FS.remove(del.path))
+			on_file_deleted(del.path, del.size);
+	}
+}
+
+/******************************************************************************
+ * Get path of file where submission cursor of this store is kept. Kept out of
+ * store dir so it is not iterated as a data file.
+ ******************************************************************************/
+template <typename TStruct>
+void DataStore<TStruct>::get_cursor_path(char *buff, int buff_size) const
+{
+	snprintf(buff, buff_size, "%s%s", DATA_STORE_CURSOR_DIR, _dir_path);
+
+	// Twin dir paths are nested, kept flat so no dir has to be created for them
+	for(char *c = buff + strlen(DATA_STORE_CURSOR_DIR) + 1; *c != '\0'; c++)
+	{
+		if(*c == '/')
+			*c = '_';
+	}
+}
+
 // Forward declarations
 template class DataStore<WaterSensorData::Entry>;
+#if FEATURE_ATMOS41
 template class DataStore<Atmos41Data::Entry>;
+#endif
+#if FEATURE_SOIL_MOISTURE
 template class DataStore<SoilMoistureData::Entry>;
+#endif
 template class DataStore<Log::Entry>;
 template class DataStore<SDI12Log::Entry>;
 template class DataStore<FoData::StoreEntry>;
-template class DataStore<LightningData::Entry>;
\ No newline at end of file
+#if FEATURE_LIGHTNING
+template class DataStore<LightningData::Entry>;
+#endif
+template class DataStore<EnergyProfileData::Entry>;
+template class DataStore<RollupData::Entry>;
+template class DataStore<RelayData::Entry>;
\ No newline at end of file
@@ -8,15 +8,39 @@
 #include "utils.h"
 #include "water_sensor_data.h"
 #include "flash.h"
+#include <stddef.h>
 #include "common.h"
 #include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "rollup_data.h"
+#include "relay_data.h"
+#include "trace.h"
+#include "board_features.h"
+
+/** SDI12 log timestamps are in ms */
+template <>
+uint32_t StoreEntryTstamp<SDI12Log::Entry>::get(const SDI12Log::Entry *entry)
+{
+	return entry->timestamp / 1000;
+}
+
+/** Relayed entries are ordered by timestamp of the device's own entry, which all
+ * sensor data structs start with */
+template <>
+uint32_t StoreEntryTstamp<RelayData::Entry>::get(const RelayData::Entry *entry)
+{
+	uint32_t tstamp = 0;
+	memcpy(&tstamp, entry->data, sizeof(tstamp));
+
+	return tstamp;
+}
 
 /******************************************************************************
 * Constructor
 * @param store Store object to read from
 ******************************************************************************/
 template <class TStruct>
-DataStoreReader<TStruct>::DataStoreReader(const DataStore<TStruct> *store)
+DataStoreReader<TStruct>::DataStoreReader(DataStore<TStruct> *store)
 {
 	_store = store;
 }
@@ -36,7 +60,8 @@ template <class TStruct>
 DataStoreReader<TStruct>::~DataStoreReader()
 {
 	_dir.close();
-	_cur_file.close();
+	close_file();
+	close_snapshot();
 }
 
 /******************************************************************************
@@ -71,7 +96,17 @@ bool DataStoreReader<TStruct>::next_file()
 	//
 	if(_state_files == STATE_PREPARE)
 	{
-		_dir = SPIFFS.open(_store->get_dir_path());
+		// Store index says there are no files, skip scanning SPIFFS
+		if(_store->get_file_count() == 0)
+		{
+			_state_files = STATE_READING_FINISHED;
+			return false;
+		}
+
+		_snapshot_tstamp = _store->open_snapshot();
+		_snapshot_open = true;
+
+		_dir = STORAGE_FS.open(_store->get_dir_path());
 
 		// Can't open dir means there are no files (dirs in SPIFFS are virtual)
 		if(!_dir)
@@ -89,20 +124,47 @@ bool DataStoreReader<TStruct>::next_file()
 	//
 	if(_state_files == STATE_READING)
 	{
-		_cur_file = _dir.openNextFile();
+		close_file();
+
+		while((_cur_file = _dir.openNextFile()))
+		{
+			// Created after reading started, left for the next reader
+			if(DataStore<TStruct>::file_name_tstamp(_cur_file.name()) > _snapshot_tstamp)
+			{
+				_cur_file.close();
+				continue;
+			}
+
+			// Skip entries already submitted by a previous partial submission
+			_cur_file_skipped = _store->get_cursor(_cur_file.name());
+
+			if(_seek_tstamp == 0 || seek_in_file())
+				break;
+
+			// Nothing after seek timestamp in this file
+			_cur_file.close();
+		}
 
 		// No more files, finish
 		if(!_cur_file)
 		{
 			debug_println(F("No more files to open. Finish."));
 			_state_files = STATE_READING_FINISHED;
+
+			close_snapshot();
 		}
 		else
 		{
 			success = true;
 
+			strncpy(_cur_path, _cur_file.name(), FILE_PATH_BUFFER_SIZE - 1);
+			_store->pin_file(_cur_path);
+
 			// New file to read, let entry reader know
 			reset_data_state();
+
+			if(_cur_file_skipped > 0)
+				_cur_file.seek(_cur_file_skipped * sizeof(_read_buff[0]));
 		}
 	}
 
@@ -138,16 +200,20 @@ TStruct* DataStoreReader<TStruct>::next_entry()
 
 	if(_state_data == STATE_READING)
 	{
-		int bytes_read = _cur_file.readBytes((char*)&_cur_entry, sizeof(_cur_entry));
+		// All buffered entries returned, read next chunk of file
+		if(_read_buff_index >= _read_buff_count)
+			fill_read_buffer();
 
 		// No more data, reading of data finished
-		if(bytes_read != sizeof(_cur_entry))
+		if(_read_buff_index >= _read_buff_count)
 		{
+			_cur_entry = NULL;
 			_state_data = STATE_READING_FINISHED;
 		}
 		else
 		{
 			// Successfully read
+			_cur_entry = &_read_buff[_read_buff_index++];
 			success = true;
 		}
 	}
@@ -161,7 +227,7 @@ TStruct* DataStoreReader<TStruct>::next_entry()
 		return NULL;
 	else
 	{
-		return &_cur_entry.data;
+		return &_cur_entry->data;
 	}
 }
 
@@ -171,14 +237,39 @@ TStruct* DataStoreReader<TStruct>::next_entry()
 template <class TStruct>
 bool DataStoreReader<TStruct>::entry_crc_valid()
 {
-	if(_state_data != STATE_READING)
+	if(_state_data != STATE_READING || _cur_entry == NULL)
 		return false;
 
-	return Utils::crc32( (uint8_t*)&_cur_entry.data, sizeof(_cur_entry.data) ) == _cur_entry.crc32;
+	// Checked when entry was read into buffer
+	return _read_buff_crc_valid & (1UL << (_read_buff_index - 1));
+}
+
+/******************************************************************************
+ * Sequence number of current entry, 0 if none
+ ******************************************************************************/
+template <class TStruct>
+uint32_t DataStoreReader<TStruct>::entry_seq()
+{
+	if(_state_data != STATE_READING || _cur_entry == NULL)
+		return 0;
+
+	return _cur_entry->seq;
 }
 
 /******************************************************************************
- * Delete current file
+ * Check if current entry was acknowledged by the server already (ack_seq in
+ * response of a request that failed), it must not be submitted again
+ ******************************************************************************/
+template <class TStruct>
+bool DataStoreReader<TStruct>::entry_acked()
+{
+	uint32_t seq = entry_seq();
+
+	return seq != 0 && seq <= _store->get_acked_seq();
+}
+
+/******************************************************************************
+ * Delete current file (archived with FLAGS.STORE_ARCHIVE, see DataStore::remove_file())
  ******************************************************************************/
 template <class TStruct>
 RetResult DataStoreReader<TStruct>::delete_file()
@@ -189,10 +280,11 @@ RetResult DataStoreReader<TStruct>::delete_file()
 	// Keep name before closing file so we can delete it
 	char path[FILE_PATH_BUFFER_SIZE] = {0};
 	strncpy(path, _cur_file.name(), FILE_PATH_BUFFER_SIZE);
+	int size = _cur_file.size();
 
-	_cur_file.close();
+	close_file();
 
-	if(SPIFFS.remove(path))
+	if(_store->remove_file(path, size) == RET_OK)
 	{
 		reset_data_state();
 
@@ -204,6 +296,157 @@ RetResult DataStoreReader<TStruct>::delete_file()
 	}
 }
 
+/******************************************************************************
+ * Queue current file to be deleted by commit_deletes(). Used when entries of
+ * multiple files are packed into a single request.
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStoreReader<TStruct>::queue_delete_file()
+{
+	if(!_cur_file || _delete_queue_count >= TELEMETRY_MAX_FILES_PER_REQ)
+		return RET_ERROR;
+
+	strncpy(_delete_queue[_delete_queue_count], _cur_file.name(), FILE_PATH_BUFFER_SIZE);
+	_delete_queue[_delete_queue_count][FILE_PATH_BUFFER_SIZE - 1] = '\0';
+	_delete_queue_sizes[_delete_queue_count] = _cur_file.size();
+	_delete_queue_count++;
+
+	close_file();
+	reset_data_state();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Delete the first count queued files
+ * @param count Files to delete, oldest queued first
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStoreReader<TStruct>::commit_deletes(int count)
+{
+	RetResult ret = RET_OK;
+
+	if(count > _delete_queue_count)
+		count = _delete_queue_count;
+
+	for(int i = 0; i < count; i++)
+	{
+		if(_store->remove_file(_delete_queue[i], _delete_queue_sizes[i]) != RET_OK)
+			ret = RET_ERROR;
+	}
+
+	discard_deletes(count);
+
+	return ret;
+}
+
+/******************************************************************************
+ * Drop the first count queued files without deleting them (request failed,
+ * retry next time)
+ ******************************************************************************/
+template <class TStruct>
+void DataStoreReader<TStruct>::discard_deletes(int count)
+{
+	if(count > _delete_queue_count)
+		count = _delete_queue_count;
+
+	for(int i = count; i < _delete_queue_count; i++)
+	{
+		memcpy(_delete_queue[i - count], _delete_queue[i], FILE_PATH_BUFFER_SIZE);
+		_delete_queue_sizes[i - count] = _delete_queue_sizes[i];
+	}
+
+	_delete_queue_count -= count;
+}
+
+/******************************************************************************
+ * Number of files queued for deletion
+ ******************************************************************************/
+template <class TStruct>
+int DataStoreReader<TStruct>::get_queued_deletes() const
+{
+	return _delete_queue_count;
+}
+
+/******************************************************************************
+ * Mark entries of current file as submitted, so if the rest of the file fails
+ * to be submitted, next time reading resumes after them.
+ * @param count Entries read from current file so far that were submitted
+ ******************************************************************************/
+template <class TStruct>
+RetResult DataStoreReader<TStruct>::ack_entries(int count)
+{
+	if(!_cur_file)
+		return RET_ERROR;
+
+	return _store->set_cursor(_cur_file.name(), _cur_file_skipped + count);
+}
+
+/******************************************************************************
+ * Skip entries older than a timestamp in files opened from now on. Files whose
+ * newest (last) entry is older are skipped without being read, in others the
+ * first entry to read is found by binary search, since entries are fixed-size
+ * and appended in time order. Skipped entries count as read for ack_entries(),
+ * don't ack after seeking.
+ * @param tstamp Timestamp (sec), 0 to read all entries again
+ ******************************************************************************/
+template <class TStruct>
+void DataStoreReader<TStruct>::seek(uint32_t tstamp)
+{
+	_seek_tstamp = tstamp;
+}
+
+/******************************************************************************
+ * Move skipped entries of current file up to the first entry not older than
+ * seek timestamp
+ * @return False if all entries of the file are older
+ ******************************************************************************/
+template <class TStruct>
+bool DataStoreReader<TStruct>::seek_in_file()
+{
+	typename DataStore<TStruct>::Entry entry;
+
+	int lo = _cur_file_skipped;
+	int hi = _cur_file.size() / sizeof(entry);
+
+	// Newest entry is last
+	if(lo >= hi || !read_entry_at(hi - 1, &entry) ||
+		StoreEntryTstamp<TStruct>::get(&entry.data) < _seek_tstamp)
+	{
+		return false;
+	}
+
+	// First entry not older than seek timestamp, in [lo, hi)
+	while(lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if(!read_entry_at(mid, &entry))
+			break;
+
+		if(StoreEntryTstamp<TStruct>::get(&entry.data) < _seek_tstamp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	_cur_file_skipped = lo;
+
+	return true;
+}
+
+/******************************************************************************
+ * Read a single entry of current file
+ ******************************************************************************/
+template <class TStruct>
+bool DataStoreReader<TStruct>::read_entry_at(int index, typename DataStore<TStruct>::Entry *entry)
+{
+	if(!_cur_file.seek(index * sizeof(*entry)))
+		return false;
+
+	return _cur_file.read((uint8_t*)entry, sizeof(*entry)) == sizeof(*entry);
+}
+
 /******************************************************************************
  * Reset reader to enable re-iteration
  ******************************************************************************/
@@ -211,10 +454,40 @@ template <class TStruct>
 void DataStoreReader<TStruct>::reset()
 {
 	// Close open files if any
-	_cur_file.close();
+	close_file();
 
 	// Close dir handle
 	_dir.close();
+
+	close_snapshot();
+}
+
+/******************************************************************************
+ * Close current file and unpin it, deletes deferred while open are done
+ ******************************************************************************/
+template <class TStruct>
+void DataStoreReader<TStruct>::close_file()
+{
+	_cur_file.close();
+
+	if(_cur_path[0] != '\0')
+	{
+		_store->unpin_file(_cur_path);
+		_cur_path[0] = '\0';
+	}
+}
+
+/******************************************************************************
+ * Done with store snapshot, writers may append to files it holds again
+ ******************************************************************************/
+template <class TStruct>
+void DataStoreReader<TStruct>::close_snapshot()
+{
+	if(!_snapshot_open)
+		return;
+
+	_snapshot_open = false;
+	_store->close_snapshot();
 }
 
 /******************************************************************************
@@ -226,15 +499,50 @@ RetResult DataStoreReader<TStruct>::reset_data_state()
 {
 	_state_data = STATE_PREPARE;
 
+	_read_buff_count = 0;
+	_read_buff_index = 0;
+	_read_buff_crc_valid = 0;
+	_cur_entry = NULL;
+
 	return RET_OK;
 }
+
+/******************************************************************************
+ * Read next chunk of current file into the read buffer with a single read and
+ * check CRCs of all entries read
+ * @return Number of entries read
+ ******************************************************************************/
+template <class TStruct>
+int DataStoreReader<TStruct>::fill_read_buffer()
+{
+	Trace::Span span(Trace::SPAN_STORE_READ);
+
+	int bytes_read = _cur_file.read((uint8_t*)_read_buff, sizeof(_read_buff));
+
+	// Partially read entry at end of file is ignored
+	_read_buff_count = bytes_read > 0 ? bytes_read / sizeof(_read_buff[0]) : 0;
+	_read_buff_index = 0;
+	_read_buff_crc_valid = Utils::crc32_check_entries((uint8_t*)_read_buff, _read_buff_count, sizeof(_read_buff[0]),
+		offsetof(typename DataStore<TStruct>::Entry, data), sizeof(_read_buff[0].data));
+
+	return _read_buff_count;
+}
 		
 
 // Define uses
 template class DataStoreReader<WaterSensorData::Entry>;
+#if FEATURE_ATMOS41
 template class DataStoreReader<Atmos41Data::Entry>;
+#endif
+#if FEATURE_SOIL_MOISTURE
 template class DataStoreReader<SoilMoistureData::Entry>;
+#endif
 template class DataStoreReader<Log::Entry>;
 template class DataStoreReader<FoData::StoreEntry>;
+#if FEATURE_LIGHTNING
 template class DataStoreReader<LightningData::Entry>;
+#endif
+template class DataStoreReader<EnergyProfileData::Entry>;
+template class DataStoreReader<RollupData::Entry>;
+template class DataStoreReader<RelayData::Entry>;
 template class DataStoreReader<SDI12Log::Entry>;
\ No newline at end of file
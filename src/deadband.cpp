@@ -0,0 +1,234 @@
+#include "deadband.h"
+#include "common.h"
+#include "log.h"
+#include "device_config.h"
+#include <math.h>
+#include <string.h>
+
+namespace Deadband
+{
+	//
+	// Private functions
+	//
+	void load_config();
+	bool store_enabled(SensorStore store);
+	void flush_suppressed(SensorStore store);
+
+	// Private vars
+	/** Deadbands and heartbeat, loaded on first use */
+	DeviceConfig::Deadbands _config;
+	bool _config_loaded = false;
+
+	/** Field values of last stored entry of each store */
+	float _last[SENSOR_STORE_COUNT][DEADBAND_MAX_FIELDS];
+	uint32_t _last_tstamp[SENSOR_STORE_COUNT] = {0};
+
+	/** Presence mask of last stored entry (see TbJsonSchema::present_offset) */
+	uint16_t _last_present[SENSOR_STORE_COUNT] = {0};
+
+	bool _valid[SENSOR_STORE_COUNT] = {false};
+
+	/** Entries left out since last stored one */
+	uint16_t _suppressed[SENSOR_STORE_COUNT] = {0};
+
+	/******************************************************************************
+	* Decide if entry is stored. Stored when the store has no deadbands set, a
+	* field moved by its deadband since the last stored entry or the heartbeat
+	* interval passed since it. Fields without a deadband are not compared.
+	******************************************************************************/
+	bool should_store(SensorStore store, const TbJsonSchema *schema, const void *entry, uint32_t tstamp)
+	{
+		load_config();
+
+		if(!store_enabled(store))
+		{
+			flush_suppressed(store);
+			_valid[store] = false;
+			return true;
+		}
+
+		const float *thresholds = _config.thresholds[store];
+		int count = schema->field_count < DEADBAND_MAX_FIELDS ? schema->field_count : DEADBAND_MAX_FIELDS;
+		// Field appearing or going away is a change
+		bool moved = !_valid[store] || schema->present_mask(entry) != _last_present[store];
+
+		for(int i = 0; i < count && !moved; i++)
+		{
+			if(thresholds[i] <= 0)
+				continue;
+
+			float val = schema->fields[i].read(entry);
+			float last = _last[store][i];
+
+			if(isnan(val) != isnan(last) || fabs(val - last) >= thresholds[i])
+				moved = true;
+		}
+
+		// Clock stepped back counts as the heartbeat
+		bool heartbeat = tstamp < _last_tstamp[store] || tstamp - _last_tstamp[store] >= _config.heartbeat_secs;
+
+		if(!moved && !heartbeat)
+		{
+			if(_suppressed[store] < UINT16_MAX)
+				_suppressed[store]++;
+
+			debug_printf("Deadband: entry of store %d suppressed (%d)\n", store, _suppressed[store]);
+
+			return false;
+		}
+
+		flush_suppressed(store);
+
+		for(int i = 0; i < count; i++)
+		{
+			_last[store][i] = schema->fields[i].read(entry);
+		}
+
+		_last_present[store] = schema->present_mask(entry);
+		_last_tstamp[store] = tstamp;
+		_valid[store] = true;
+
+		return true;
+	}
+
+	/******************************************************************************
+	* Apply remote control config
+	* @param json Object with a SENSOR_STORE_KEYS member per store to be set,
+	*             each an object of telemetry key to deadband. Fields not listed
+	*             are stored on any change. NULL to keep current deadbands
+	* @param heartbeat_secs Heartbeat interval, -1 to keep current one
+	******************************************************************************/
+	RetResult set_config(JsonObject json, int32_t heartbeat_secs)
+	{
+		load_config();
+
+		DeviceConfig::Deadbands config = _config;
+
+		if(heartbeat_secs != -1)
+		{
+			if(heartbeat_secs < DEADBAND_MIN_HEARTBEAT_SECS)
+			{
+				debug_println(F("Invalid heartbeat, ignoring."));
+				return RET_ERROR;
+			}
+
+			config.heartbeat_secs = heartbeat_secs;
+		}
+
+		int field_count = 0;
+
+		for(int store = 0; store < SENSOR_STORE_COUNT; store++)
+		{
+			if(!json.isNull() && json.containsKey(SENSOR_STORE_KEYS[store]))
+			{
+				JsonObject fields = json[SENSOR_STORE_KEYS[store]];
+				const TbJsonSchema *schema = tb_json_sensor_store_schema((SensorStore)store);
+
+				memset(config.thresholds[store], 0, sizeof(config.thresholds[store]));
+
+				for(int i = 0; i < schema->field_count && i < DEADBAND_MAX_FIELDS; i++)
+				{
+					float val = fields[schema->fields[i].key] | 0.0f;
+					config.thresholds[store][i] = val > 0 ? val : 0;
+				}
+			}
+
+			for(int i = 0; i < DEADBAND_MAX_FIELDS; i++)
+			{
+				if(config.thresholds[store][i] > 0)
+					field_count++;
+			}
+		}
+
+		debug_printf("Deadband heartbeat: %u secs, fields with deadband: %d\n", config.heartbeat_secs, field_count);
+
+		// Same as stored, nothing to apply. CRC is the same when contents are
+		if(memcmp(&config.heartbeat_secs, &_config.heartbeat_secs, sizeof(config) - sizeof(config.crc32)) == 0)
+		{
+			debug_println(F("Unchanged."));
+			return RET_OK;
+		}
+
+		_config = config;
+
+		Log::log(Log::RC_DEADBANDS_SET, config.heartbeat_secs, field_count);
+
+		return DeviceConfig::set_deadbands(&_config);
+	}
+
+	/******************************************************************************
+	* Heartbeat interval, an entry is stored at least this often
+	******************************************************************************/
+	uint32_t get_heartbeat_secs()
+	{
+		load_config();
+
+		return _config.heartbeat_secs;
+	}
+
+	/******************************************************************************
+	* Load deadbands, defaults to none set
+	******************************************************************************/
+	void load_config()
+	{
+		if(_config_loaded)
+			return;
+
+		_config_loaded = true;
+
+		if(DeviceConfig::get_deadbands(&_config) == RET_OK)
+			return;
+
+		memset(&_config, 0, sizeof(_config));
+		_config.heartbeat_secs = DEADBAND_HEARTBEAT_SECS;
+	}
+
+	/******************************************************************************
+	* Store has at least one deadband set
+	******************************************************************************/
+	bool store_enabled(SensorStore store)
+	{
+		for(int i = 0; i < DEADBAND_MAX_FIELDS; i++)
+		{
+			if(_config.thresholds[store][i] > 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	/******************************************************************************
+	* Log entries left out since the last stored one
+	******************************************************************************/
+	void flush_suppressed(SensorStore store)
+	{
+		if(_suppressed[store] == 0)
+			return;
+
+		Log::log(Log::DEADBAND_SUPPRESSED, store, _suppressed[store]);
+
+		_suppressed[store] = 0;
+	}
+
+	/******************************************************************************
+	* Save state before going to deep sleep
+	******************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		memcpy(state->last, _last, sizeof(_last));
+		memcpy(state->last_tstamp, _last_tstamp, sizeof(_last_tstamp));
+		memcpy(state->suppressed, _suppressed, sizeof(_suppressed));
+		memcpy(state->valid, _valid, sizeof(_valid));
+	}
+
+	/******************************************************************************
+	* Restore state after waking up from deep sleep
+	******************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		memcpy(_last, state->last, sizeof(_last));
+		memcpy(_last_tstamp, state->last_tstamp, sizeof(_last_tstamp));
+		memcpy(_suppressed, state->suppressed, sizeof(_suppressed));
+		memcpy(_valid, state->valid, sizeof(_valid));
+	}
+}
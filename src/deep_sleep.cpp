@@ -0,0 +1,183 @@
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include "rom/rtc.h"
+#include "deep_sleep.h"
+#include "common.h"
+#include "utils.h"
+#include "fo_data.h"
+#include "device_config.h"
+#include "ulp_monitor.h"
+#include "capture.h"
+
+namespace DeepSleep
+{
+	//
+	// Private vars
+	//
+
+	/** State saved before deep sleep. RTC slow memory stays powered in deep sleep */
+	RTC_DATA_ATTR State _state;
+
+	/** Boot is a wake up from deep sleep with valid state, set on init() */
+	bool _woke_up = false;
+
+	//
+	// Private functions
+	//
+	bool state_valid();
+
+	/******************************************************************************
+	 * Check if a sleep of sleep_secs should be a deep sleep.
+	 * Wake up from the lightning sensor IRQ and FO continuous RX are handled with
+	 * light sleep only.
+	 *****************************************************************************/
+	bool allowed(int sleep_secs)
+	{
+		return FLAGS.DEEP_SLEEP && !FLAGS.LIGHTNING_SENSOR_ENABLED && !FoSniffer::continuous_rx_active() &&
+			sleep_secs >= DEEP_SLEEP_MIN_SEC;
+	}
+
+	/******************************************************************************
+	 * Save module state to RTC memory and go to deep sleep. Does not return,
+	 * device boots on wake up
+	 * @param sleep_us Time to sleep
+	 * @param source What is sleeping, to continue there on wake up
+	 *****************************************************************************/
+	void start(uint64_t sleep_us, Source source)
+	{
+		_state.magic = DEEP_SLEEP_STATE_MAGIC;
+		_state.version = DEEP_SLEEP_STATE_VERSION;
+		_state.size = sizeof(State);
+		_state.source = source;
+
+		SleepScheduler::save_state(&_state.sleep_scheduler);
+		Battery::save_state(&_state.battery);
+		PowerGovernor::save_state(&_state.power_governor);
+
+		// Deep sleep starts now, wake up ends it (see restore())
+		EnergyProfiler::begin(EnergyProfiler::STATE_SLEEP);
+		EnergyProfiler::save_state(&_state.energy_profiler);
+		GSM::save_state(&_state.gsm);
+		RTC::save_state(&_state.rtc);
+		Trace::save_state(&_state.trace);
+		WaterPresence::save_state(&_state.water_presence);
+		AdaptiveSampling::save_state(&_state.adaptive_sampling);
+		Deadband::save_state(&_state.deadband);
+		LoraRelay::save_state(&_state.lora_relay);
+		PowerControl::save_state(&_state.power_control);
+
+		if(FO_SOURCE == FO_SOURCE_SNIFFER)
+			FoSniffer::save_state(&_state.fo_sniffer);
+		else if(FO_SOURCE == FO_SOURCE_UART)
+			FoUart::save_state(&_state.fo_uart);
+
+		_state.fo_wakeup_count = FoData::get_wakeup_count();
+
+		// Saving state may commit FO buffer which logs
+		DeviceConfig::commit();
+		Log::commit();
+		Log::save_state(&_state.log);
+		Capture::flush();
+		Trace::end_cycle();
+
+		_state.crc32 = Utils::crc32((uint8_t*)&_state, sizeof(_state) - sizeof(_state.crc32));
+
+		debug_printf("Deep sleep, state: %d bytes\n", sizeof(State));
+		Serial.flush();
+
+		// Only timer wakes up from deep sleep (FO sniffer may have left ext0 enabled)
+		esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+		esp_sleep_enable_timer_wakeup(sleep_us);
+		RTC::enable_alarm_wakeup();
+		UlpMonitor::enable_wakeup();
+		WaterPresence::arm_wakeup(true);
+
+		// Keep output pins (power control) at their level while sleeping
+		gpio_deep_sleep_hold_en();
+
+		esp_deep_sleep_start();
+	}
+
+	/******************************************************************************
+	 * Init on boot, before anything else. Releases pins held in deep sleep and
+	 * checks for valid state in RTC memory
+	 *****************************************************************************/
+	void init()
+	{
+		gpio_deep_sleep_hold_dis();
+
+		_woke_up = rtc_get_reset_reason(0) == RESET_REASON::DEEPSLEEP_RESET && FLAGS.DEEP_SLEEP &&
+			state_valid();
+	}
+
+	/******************************************************************************
+	 * Check if boot is a wake up from deep sleep with valid state in RTC memory
+	 *****************************************************************************/
+	bool woke_up()
+	{
+		return _woke_up;
+	}
+
+	/******************************************************************************
+	 * Get version of state found in RTC memory (for log)
+	 *****************************************************************************/
+	uint16_t get_state_version()
+	{
+		return _state.version;
+	}
+
+	/******************************************************************************
+	 * Get what put the device in deep sleep
+	 *****************************************************************************/
+	Source get_source()
+	{
+		return (Source)_state.source;
+	}
+
+	/******************************************************************************
+	 * Restore module state from RTC memory. Modules must have been inited
+	 *****************************************************************************/
+	RetResult restore()
+	{
+		if(!_woke_up)
+			return RET_ERROR;
+
+		SleepScheduler::restore_state(&_state.sleep_scheduler);
+		Battery::restore_state(&_state.battery);
+		PowerGovernor::restore_state(&_state.power_governor);
+		EnergyProfiler::restore_state(&_state.energy_profiler);
+		GSM::restore_state(&_state.gsm);
+		RTC::restore_state(&_state.rtc);
+		Trace::restore_state(&_state.trace);
+		WaterPresence::restore_state(&_state.water_presence);
+		AdaptiveSampling::restore_state(&_state.adaptive_sampling);
+		Deadband::restore_state(&_state.deadband);
+		LoraRelay::restore_state(&_state.lora_relay);
+		PowerControl::restore_state(&_state.power_control);
+
+		if(FO_SOURCE == FO_SOURCE_SNIFFER)
+			FoSniffer::restore_state(&_state.fo_sniffer);
+		else if(FO_SOURCE == FO_SOURCE_UART)
+			FoUart::restore_state(&_state.fo_uart);
+
+		FoData::set_wakeup_count(_state.fo_wakeup_count);
+		Log::restore_state(&_state.log);
+
+		// Used once, a later deep sleep saves again
+		_state.magic = 0;
+		_woke_up = false;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Check state magic, version, size and CRC
+	 *****************************************************************************/
+	bool state_valid()
+	{
+		return _state.magic == DEEP_SLEEP_STATE_MAGIC &&
+			_state.version == DEEP_SLEEP_STATE_VERSION &&
+			_state.size == sizeof(State) &&
+			_state.crc32 == Utils::crc32((uint8_t*)&_state, sizeof(_state) - sizeof(_state.crc32));
+	}
+}
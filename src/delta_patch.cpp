@@ -0,0 +1,313 @@
+#include "delta_patch.h"
+#include "const.h"
+#include "common.h"
+
+/******************************************************************************
+ * Patch format (detools, sequential, compression none):
+ * Header byte: patch type << 4 | compression, then size of new image.
+ * Then repeated until new image is complete:
+ *   Diff size, diff bytes: added to the source bytes at source position
+ *   Extra size, extra bytes: copied as is
+ *   Adjustment: added to source position
+ * Sizes are varints: first byte has continuation bit 7, sign bit 6 and 6 value
+ * bits, next bytes have continuation bit 7 and 7 value bits.
+ *****************************************************************************/
+namespace DeltaPatch
+{
+	//
+	// Private vars
+	//
+	enum State
+	{
+		STATE_HEADER,
+		STATE_TO_SIZE,
+		STATE_DIFF_SIZE,
+		STATE_DIFF_DATA,
+		STATE_EXTRA_SIZE,
+		STATE_EXTRA_DATA,
+		STATE_ADJUSTMENT,
+		STATE_DONE,
+		STATE_ERROR
+	};
+
+	State _state = STATE_ERROR;
+
+	/** Partition patch is applied against */
+	const esp_partition_t *_source = NULL;
+
+	Writer _writer = nullptr;
+
+	/** Size of new image */
+	uint32_t _to_size = 0;
+	/** Bytes of new image produced */
+	uint32_t _to_pos = 0;
+
+	/** Position in source partition */
+	int32_t _from_pos = 0;
+
+	/** Bytes left of current diff/extra block */
+	int32_t _block_left = 0;
+
+	/** Varint being parsed */
+	int32_t _size_value = 0;
+	int _size_shift = 0;
+	bool _size_negative = false;
+
+	/** Source bytes read ahead, diff data is added to them */
+	uint8_t _from_buff[DELTA_PATCH_BUFF_LEN];
+	int32_t _from_buff_pos = -1;
+
+	/** New image bytes waiting to be handed to writer */
+	uint8_t _out_buff[DELTA_PATCH_BUFF_LEN];
+	int _out_len = 0;
+
+	//
+	// Private functions
+	//
+	bool parse_size(uint8_t byte, int32_t *size);
+	RetResult read_from(uint8_t *byte);
+	RetResult output(uint8_t byte);
+	RetResult flush();
+	void next_block(State state, int32_t size);
+
+	/******************************************************************************
+	* Start applying a new patch
+	* @param source Partition with the image the patch was made against
+	* @param writer Receives new image
+	******************************************************************************/
+	RetResult begin(const esp_partition_t *source, Writer writer)
+	{
+		if(source == NULL)
+			return RET_ERROR;
+
+		_source = source;
+		_writer = writer;
+		_state = STATE_HEADER;
+		_to_size = 0;
+		_to_pos = 0;
+		_from_pos = 0;
+		_block_left = 0;
+		_size_value = 0;
+		_size_shift = 0;
+		_from_buff_pos = -1;
+		_out_len = 0;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Feed next patch bytes
+	******************************************************************************/
+	RetResult process(const uint8_t *data, int len)
+	{
+		for(int i = 0; i < len && _state != STATE_ERROR; i++)
+		{
+			uint8_t byte = data[i];
+			int32_t size = 0;
+
+			switch(_state)
+			{
+				case STATE_HEADER:
+					// Type 0: sequential, compression 0: none
+					if(byte != 0)
+					{
+						debug_print_e(F("Unsupported patch type/compression: "));
+						debug_println(byte, HEX);
+						_state = STATE_ERROR;
+					}
+					else
+					{
+						_state = STATE_TO_SIZE;
+					}
+					break;
+
+				case STATE_TO_SIZE:
+					if(parse_size(byte, &size))
+					{
+						_to_size = size;
+						_state = _to_size > 0 ? STATE_DIFF_SIZE : STATE_DONE;
+					}
+					break;
+
+				case STATE_DIFF_SIZE:
+					if(parse_size(byte, &size))
+						next_block(STATE_DIFF_DATA, size);
+					break;
+
+				case STATE_DIFF_DATA:
+				{
+					uint8_t from = 0;
+					if(read_from(&from) != RET_OK || output(from + byte) != RET_OK)
+					{
+						_state = STATE_ERROR;
+						break;
+					}
+
+					_from_pos++;
+
+					if(--_block_left == 0)
+						_state = _to_pos < _to_size ? STATE_EXTRA_SIZE : STATE_DONE;
+					break;
+				}
+
+				case STATE_EXTRA_SIZE:
+					if(parse_size(byte, &size))
+						next_block(STATE_EXTRA_DATA, size);
+					break;
+
+				case STATE_EXTRA_DATA:
+					if(output(byte) != RET_OK)
+					{
+						_state = STATE_ERROR;
+						break;
+					}
+
+					if(--_block_left == 0)
+						_state = _to_pos < _to_size ? STATE_ADJUSTMENT : STATE_DONE;
+					break;
+
+				case STATE_ADJUSTMENT:
+					if(parse_size(byte, &size))
+					{
+						_from_pos += size;
+						_state = STATE_DIFF_SIZE;
+					}
+					break;
+
+				case STATE_DONE:
+					// Trailing bytes are ignored
+					break;
+
+				default:
+					break;
+			}
+
+			if(_to_pos > _to_size)
+				_state = STATE_ERROR;
+		}
+
+		if(_state == STATE_ERROR)
+			return RET_ERROR;
+
+		if(_state == STATE_DONE)
+			return flush();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Whole new image produced
+	******************************************************************************/
+	bool is_finished()
+	{
+		return _state == STATE_DONE && _to_pos == _to_size && _out_len == 0;
+	}
+
+	/******************************************************************************
+	* Size of new image, known after patch header is processed
+	******************************************************************************/
+	uint32_t get_to_size()
+	{
+		return _to_size;
+	}
+
+	/******************************************************************************
+	* Enter next diff/extra block. Empty blocks are skipped.
+	******************************************************************************/
+	void next_block(State state, int32_t size)
+	{
+		if(size < 0 || _to_pos + size > _to_size)
+		{
+			_state = STATE_ERROR;
+			return;
+		}
+
+		_block_left = size;
+
+		if(size > 0)
+			_state = state;
+		else if(_to_pos >= _to_size)
+			_state = STATE_DONE;
+		else
+			_state = state == STATE_DIFF_DATA ? STATE_EXTRA_SIZE : STATE_ADJUSTMENT;
+	}
+
+	/******************************************************************************
+	* Parse next byte of a size varint
+	* @return True when size complete
+	******************************************************************************/
+	bool parse_size(uint8_t byte, int32_t *size)
+	{
+		if(_size_shift == 0)
+		{
+			_size_negative = byte & 0x40;
+			_size_value = byte & 0x3F;
+			_size_shift = 6;
+		}
+		else
+		{
+			_size_value |= (int32_t)(byte & 0x7F) << _size_shift;
+			_size_shift += 7;
+		}
+
+		if(byte & 0x80)
+			return false;
+
+		*size = _size_negative ? -_size_value : _size_value;
+		_size_shift = 0;
+
+		return true;
+	}
+
+	/******************************************************************************
+	* Read source byte at current source position
+	******************************************************************************/
+	RetResult read_from(uint8_t *byte)
+	{
+		if(_from_pos < 0 || _from_pos >= (int32_t)_source->size)
+			return RET_ERROR;
+
+		if(_from_buff_pos < 0 || _from_pos < _from_buff_pos ||
+			_from_pos >= _from_buff_pos + DELTA_PATCH_BUFF_LEN)
+		{
+			int32_t len = _source->size - _from_pos < DELTA_PATCH_BUFF_LEN ? _source->size - _from_pos : DELTA_PATCH_BUFF_LEN;
+
+			if(esp_partition_read(_source, _from_pos, _from_buff, len) != ESP_OK)
+				return RET_ERROR;
+
+			_from_buff_pos = _from_pos;
+		}
+
+		*byte = _from_buff[_from_pos - _from_buff_pos];
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Append a byte of the new image
+	******************************************************************************/
+	RetResult output(uint8_t byte)
+	{
+		_out_buff[_out_len++] = byte;
+		_to_pos++;
+
+		if(_out_len >= DELTA_PATCH_BUFF_LEN)
+			return flush();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Hand buffered new image bytes to writer
+	******************************************************************************/
+	RetResult flush()
+	{
+		if(_out_len == 0)
+			return RET_OK;
+
+		RetResult ret = _writer(_out_buff, _out_len);
+		_out_len = 0;
+
+		return ret;
+	}
+}
@@ -1,6 +1,7 @@
 #include "device_config.h"
 #include "common.h"
 #include "app_config.h"
+#include "energy_profiler.h"
 
 /******************************************************************************
 * Config uses the "Preferences" API (which has own partition in flash)
@@ -10,6 +11,11 @@
 * All configurable device data is stored in Config.
 * Default data is used when no config set yet (first run) and when loading 
 * data from Preferences api fails.
+*
+* Setters only mark changed fields dirty, commit() writes the struct once if
+* anything changed. Modules change config during the wake cycle, it is
+* committed before sleeping (see SleepScheduler) and before restarting.
+* Flags that change around reboots are in RuntimeFlags and written on set.
 ******************************************************************************/
 namespace DeviceConfig
 {
@@ -35,6 +41,8 @@ namespace DeviceConfig
 
 		fo_enabled: false,
 
+		transport: TRANSPORT_HTTP,
+
 		/** Last received/
 		last_remote_control_data: RemoteControl::Data(0, 0, 0, 0) */
 	};
@@ -45,6 +53,25 @@ namespace DeviceConfig
 	/** Preferences api store */
 	Preferences _prefs;
 
+	/** Fields of the config struct, for dirty tracking */
+	enum Field
+	{
+		FIELD_WAKEUP_SCHEDULE = 1 << 0,
+		FIELD_LAST_RC_DATA_ID = 1 << 1,
+		FIELD_TB_DEVICE_TOKEN = 1 << 2,
+		FIELD_CELLULAR_APN = 1 << 3,
+		FIELD_FO_SNIFFER_ID = 1 << 4,
+		FIELD_FO_ENABLED = 1 << 5,
+		FIELD_TRANSPORT = 1 << 6,
+		FIELD_ALL = 0xFFFFFFFF
+	};
+
+	/** Fields changed since last commit */
+	uint32_t _dirty = 0;
+
+	/** Currently loaded runtime flags */
+	RuntimeFlags _flags = {};
+
 	//
 	// Private functions
 	//
@@ -52,6 +79,12 @@ namespace DeviceConfig
 	RetResult end();
 	RetResult load();
 	RetResult write_defaults();
+	void load_flags();
+	RetResult store_flags();
+	void set_dirty(Field field, bool changed);
+	RetResult load_blob(const char *key, void *blob, size_t size);
+	RetResult store_blob(const char *key, void *blob, size_t size);
+	RetResult remove_blob(const char *key);
 
 	/******************************************************************************
 	* Initialization
@@ -75,10 +108,13 @@ namespace DeviceConfig
 				// current config struct and will be used.
 				debug_println_e(F("Could not load config. Init failed. Defaults will be used."));
 				Log::log(Log::USING_DEFAULT_DEVICE_CONFIG);
+				load_flags();
 				return RET_ERROR;
 			}
 		}
 
+		load_flags();
+
 		return RET_OK;
 	}
 
@@ -117,13 +153,18 @@ namespace DeviceConfig
 	}
 
 	/******************************************************************************
-	* Write config to memory. Must be run every time config is changed to make it
-	* persistent.
+	* Write config to memory if any field changed since last commit. Must be run
+	* after config is changed to make it persistent.
 	******************************************************************************/
 	RetResult commit()
 	{
 		RetResult ret = RET_ERROR;
 
+		if(!_dirty)
+			return RET_OK;
+
+		uint32_t start_ms = millis();
+
 		if(begin() == RET_ERROR)
 		{
 			return RET_ERROR;
@@ -147,14 +188,25 @@ namespace DeviceConfig
 		}
 		else
 		{
+			_dirty = 0;
 			ret = RET_OK;
 		}
 
 		end();
 
+		EnergyProfiler::count_nvs_commit(millis() - start_ms);
+
 		return ret;
 	}
 
+	/******************************************************************************
+	* Check if config changed since last commit
+	******************************************************************************/
+	bool is_dirty()
+	{
+		return _dirty != 0;
+	}
+
 	/******************************************************************************
 	* Load from flash
 	******************************************************************************/
@@ -193,6 +245,7 @@ namespace DeviceConfig
 
 				memcpy(&_current_config, &loaded_config, sizeof(_current_config));
 
+				_dirty = 0;
 				ret = RET_OK;
 			}
 		}
@@ -225,6 +278,7 @@ namespace DeviceConfig
 		// Copy default wake up schedule to current
 		set_wakeup_schedule((SleepScheduler::WakeupScheduleEntry*) &WAKEUP_SCHEDULE_DEFAULT);
 
+		_dirty = FIELD_ALL;
 		commit();
 
 		return RET_OK;
@@ -241,10 +295,10 @@ namespace DeviceConfig
 		debug_println(data->crc32, DEC);
 
 		debug_print(F("Clean reboot: "));
-		debug_println(data->clean_reboot, DEC);
+		debug_println(_flags.clean_reboot, DEC);
 
 		debug_print(F("OTA flashed: "));
-		debug_println(data->ota_flashed, DEC);
+		debug_println(_flags.ota_flashed, DEC);
 
 		debug_print(F("Last remote config data id: "));
 		debug_println(data->last_rc_data_id);
@@ -274,6 +328,9 @@ namespace DeviceConfig
 		debug_print(F("FO Sniffer ID: "));
 		debug_println(data->fo_sniffer_id, HEX);
 
+		debug_print(F("Transport: "));
+		debug_println(data->transport == TRANSPORT_MQTT ? "MQTT" : data->transport == TRANSPORT_COAP ? "CoAP" : "HTTP");
+
 
 		Utils::print_separator(NULL);
 	}
@@ -286,34 +343,83 @@ namespace DeviceConfig
 		print(&_current_config);
 	}
 
+	/******************************************************************************
+	* Load runtime flags. Flags were part of the config struct in older FW, take
+	* them from there when not stored yet
+	******************************************************************************/
+	void load_flags()
+	{
+		if(load_blob(DEVICE_CONFIG_RUNTIME_FLAGS_KEY, &_flags, sizeof(_flags)) == RET_OK)
+			return;
+
+		_flags.clean_reboot = _current_config.clean_reboot;
+		_flags.ota_flashed = _current_config.ota_flashed;
+
+		store_flags();
+	}
+
+	/******************************************************************************
+	* Write runtime flags
+	******************************************************************************/
+	RetResult store_flags()
+	{
+		uint32_t start_ms = millis();
+
+		RetResult ret = store_blob(DEVICE_CONFIG_RUNTIME_FLAGS_KEY, &_flags, sizeof(_flags));
+
+		EnergyProfiler::count_nvs_commit(millis() - start_ms);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Mark field dirty if its value changed
+	******************************************************************************/
+	void set_dirty(Field field, bool changed)
+	{
+		if(changed)
+			_dirty |= field;
+	}
+
 	/******************************************************************************
 	* Basic accessors
+	* Runtime flags are written immediately, they are set right before a reboot
+	* or handled once on boot
 	******************************************************************************/
 	RetResult set_clean_reboot(bool val)
 	{
-		_current_config.clean_reboot = val;
+		if(_flags.clean_reboot == val)
+			return RET_OK;
 
-		return RET_OK;
+		_flags.clean_reboot = val;
+
+		return store_flags();
 	}
 	bool get_clean_reboot()
 	{
-		return _current_config.clean_reboot;
+		return _flags.clean_reboot;
 	}
 
 	RetResult set_ota_flashed(bool val)
 	{
-		_current_config.ota_flashed = val;
+		if(_flags.ota_flashed == val)
+			return RET_OK;
+
+		_flags.ota_flashed = val;
 		
-		return RET_OK;
+		return store_flags();
 	}
 	bool get_ota_flashed()
 	{
-		return _current_config.ota_flashed;
+		return _flags.ota_flashed;
 	}
 
 	RetResult set_wakeup_schedule(const SleepScheduler::WakeupScheduleEntry *schedule)
 	{
+		set_dirty(FIELD_WAKEUP_SCHEDULE, memcmp(_current_config.wakeup_schedule, schedule, sizeof(_current_config.wakeup_schedule)) != 0);
 		memcpy(_current_config.wakeup_schedule, schedule, sizeof(_current_config.wakeup_schedule));
+
+		return RET_OK;
 	}
 
 	/******************************************************************************
@@ -326,6 +432,7 @@ namespace DeviceConfig
 		{
 			if(_current_config.wakeup_schedule[i].reason == reason)
 			{
+				set_dirty(FIELD_WAKEUP_SCHEDULE, _current_config.wakeup_schedule[i].wakeup_int != wakeup_int);
 				_current_config.wakeup_schedule[i].wakeup_int = wakeup_int;
 				return RET_OK;
 			}
@@ -371,6 +478,7 @@ namespace DeviceConfig
 
 	RetResult set_last_rc_data_id(int id)
 	{
+		set_dirty(FIELD_LAST_RC_DATA_ID, _current_config.last_rc_data_id != id);
 		_current_config.last_rc_data_id = id;
 
 		return RET_OK;
@@ -389,7 +497,10 @@ namespace DeviceConfig
 	******************************************************************************/
 	RetResult set_tb_device_token(char *token)
 	{
+		set_dirty(FIELD_TB_DEVICE_TOKEN, strncmp(_current_config.tb_device_token, token, sizeof(_current_config.tb_device_token)) != 0);
 		strncpy(_current_config.tb_device_token, token, sizeof(_current_config.tb_device_token));
+
+		return RET_OK;
 	}
 
 	/******************************************************************************
@@ -405,7 +516,10 @@ namespace DeviceConfig
 	******************************************************************************/
 	RetResult set_cellular_apn(char *apn)
 	{
+		set_dirty(FIELD_CELLULAR_APN, strncmp(_current_config.cellular_apn, apn, sizeof(_current_config.cellular_apn)) != 0);
 		strncpy(_current_config.cellular_apn, apn, sizeof(_current_config.cellular_apn));
+
+		return RET_OK;
 	}
 
 	/******************************************************************************
@@ -421,7 +535,10 @@ namespace DeviceConfig
 	******************************************************************************/
 	RetResult set_fo_sniffer_id(uint8_t id)
 	{
+		set_dirty(FIELD_FO_SNIFFER_ID, _current_config.fo_sniffer_id != id);
 		_current_config.fo_sniffer_id = id;
+
+		return RET_OK;
 	}
 
 	/******************************************************************************
@@ -437,6 +554,271 @@ namespace DeviceConfig
 	******************************************************************************/
 	RetResult set_fo_enabled(bool enabled)
 	{
+		set_dirty(FIELD_FO_ENABLED, _current_config.fo_enabled != enabled);
 		_current_config.fo_enabled = enabled;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Get transport used to talk to TB
+	******************************************************************************/
+	Transport get_transport()
+	{
+		switch(_current_config.transport)
+		{
+			case TRANSPORT_MQTT:
+				return TRANSPORT_MQTT;
+			case TRANSPORT_COAP:
+				return TRANSPORT_COAP;
+			default:
+				return TRANSPORT_HTTP;
+		}
+	}
+
+	/******************************************************************************
+	* Set transport used to talk to TB
+	******************************************************************************/
+	RetResult set_transport(Transport transport)
+	{
+		set_dirty(FIELD_TRANSPORT, _current_config.transport != transport);
+		_current_config.transport = transport;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Load a struct stored under its own key. First field of the struct must be
+	* its CRC32, calculated with crc32 = 0
+	* @return RET_ERROR if not set yet or corrupted
+	******************************************************************************/
+	RetResult load_blob(const char *key, void *blob, size_t size)
+	{
+		if(begin() != RET_OK)
+			return RET_ERROR;
+
+		RetResult ret = RET_ERROR;
+
+		int read_bytes = _prefs.getBytes(key, blob, size);
+
+		if(read_bytes == size)
+		{
+			uint32_t *crc32 = (uint32_t*)blob;
+			uint32_t crc32_bkp = *crc32;
+			*crc32 = 0;
+
+			if(crc32_bkp != Utils::crc32((uint8_t*)blob, size))
+			{
+				debug_print(F("Failed CRC32 check: "));
+				debug_println(key);
+			}
+			else
+			{
+				*crc32 = crc32_bkp;
+				ret = RET_OK;
+			}
+		}
+
+		end();
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Write a struct under its own key, updating its CRC32 first
+	******************************************************************************/
+	RetResult store_blob(const char *key, void *blob, size_t size)
+	{
+		if(begin() != RET_OK)
+			return RET_ERROR;
+
+		uint32_t *crc32 = (uint32_t*)blob;
+		*crc32 = 0;
+		*crc32 = Utils::crc32((uint8_t*)blob, size);
+
+		RetResult ret = RET_OK;
+
+		if(_prefs.putBytes(key, blob, size) != size)
+		{
+			debug_print_e(F("Could not write to NVS: "));
+			debug_println(key);
+			ret = RET_ERROR;
+		}
+
+		end();
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Remove a struct stored under its own key
+	******************************************************************************/
+	RetResult remove_blob(const char *key)
+	{
+		if(begin() != RET_OK)
+			return RET_ERROR;
+
+		_prefs.remove(key);
+
+		end();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Network registration cache accessors
+	******************************************************************************/
+	RetResult get_network_cache(NetworkCache *cache)
+	{
+		return load_blob(DEVICE_CONFIG_NETWORK_CACHE_KEY, cache, sizeof(NetworkCache));
+	}
+
+	RetResult set_network_cache(NetworkCache *cache)
+	{
+		return store_blob(DEVICE_CONFIG_NETWORK_CACHE_KEY, cache, sizeof(NetworkCache));
+	}
+
+	/******************************************************************************
+	* Remove network registration cache, next attach does a full scan
+	******************************************************************************/
+	RetResult clear_network_cache()
+	{
+		return remove_blob(DEVICE_CONFIG_NETWORK_CACHE_KEY);
+	}
+
+	/******************************************************************************
+	* OTA download progress accessors
+	******************************************************************************/
+	RetResult get_ota_progress(OtaProgress *progress)
+	{
+		return load_blob(DEVICE_CONFIG_OTA_PROGRESS_KEY, progress, sizeof(OtaProgress));
+	}
+
+	RetResult set_ota_progress(OtaProgress *progress)
+	{
+		return store_blob(DEVICE_CONFIG_OTA_PROGRESS_KEY, progress, sizeof(OtaProgress));
+	}
+
+	RetResult clear_ota_progress()
+	{
+		return remove_blob(DEVICE_CONFIG_OTA_PROGRESS_KEY);
+	}
+
+	/******************************************************************************
+	* Pending OTA validation accessors
+	******************************************************************************/
+	RetResult get_ota_validation(OtaValidation *validation)
+	{
+		return load_blob(DEVICE_CONFIG_OTA_VALIDATION_KEY, validation, sizeof(OtaValidation));
+	}
+
+	RetResult set_ota_validation(OtaValidation *validation)
+	{
+		return store_blob(DEVICE_CONFIG_OTA_VALIDATION_KEY, validation, sizeof(OtaValidation));
+	}
+
+	RetResult clear_ota_validation()
+	{
+		return remove_blob(DEVICE_CONFIG_OTA_VALIDATION_KEY);
+	}
+
+	/******************************************************************************
+	* Clock drift model accessors
+	******************************************************************************/
+	RetResult get_clock_model(ClockModel *model)
+	{
+		return load_blob(DEVICE_CONFIG_CLOCK_MODEL_KEY, model, sizeof(ClockModel));
+	}
+
+	RetResult set_clock_model(ClockModel *model)
+	{
+		return store_blob(DEVICE_CONFIG_CLOCK_MODEL_KEY, model, sizeof(ClockModel));
+	}
+
+	/******************************************************************************
+	* Deadband filter config accessors
+	******************************************************************************/
+	RetResult get_deadbands(Deadbands *deadbands)
+	{
+		return load_blob(DEVICE_CONFIG_DEADBANDS_KEY, deadbands, sizeof(Deadbands));
+	}
+
+	RetResult set_deadbands(Deadbands *deadbands)
+	{
+		return store_blob(DEVICE_CONFIG_DEADBANDS_KEY, deadbands, sizeof(Deadbands));
+	}
+
+	/******************************************************************************
+	* Call home phase accessors
+	******************************************************************************/
+	RetResult get_call_home_phase(CallHomePhase *phase)
+	{
+		return load_blob(DEVICE_CONFIG_CALL_HOME_PHASE_KEY, phase, sizeof(CallHomePhase));
+	}
+
+	RetResult set_call_home_phase(CallHomePhase *phase)
+	{
+		return store_blob(DEVICE_CONFIG_CALL_HOME_PHASE_KEY, phase, sizeof(CallHomePhase));
+	}
+
+	/******************************************************************************
+	* Backfill state accessors
+	******************************************************************************/
+	RetResult get_backfill_state(BackfillState *state)
+	{
+		return load_blob(DEVICE_CONFIG_BACKFILL_KEY, state, sizeof(BackfillState));
+	}
+
+	RetResult set_backfill_state(BackfillState *state)
+	{
+		return store_blob(DEVICE_CONFIG_BACKFILL_KEY, state, sizeof(BackfillState));
+	}
+
+	RetResult clear_backfill_state()
+	{
+		return remove_blob(DEVICE_CONFIG_BACKFILL_KEY);
+	}
+
+	/******************************************************************************
+	* Client attribute state accessors
+	******************************************************************************/
+	RetResult get_client_attr_state(ClientAttrState *state)
+	{
+		return load_blob(DEVICE_CONFIG_CLIENT_ATTR_KEY, state, sizeof(ClientAttrState));
+	}
+
+	RetResult set_client_attr_state(ClientAttrState *state)
+	{
+		return store_blob(DEVICE_CONFIG_CLIENT_ATTR_KEY, state, sizeof(ClientAttrState));
+	}
+
+	/******************************************************************************
+	* Print network cache to serial output
+	******************************************************************************/
+	void print_network_cache(const NetworkCache *cache)
+	{
+		Utils::print_separator(F("NETWORK CACHE"));
+
+		debug_print(F("Operator: "));
+		debug_println(cache->oper);
+
+		debug_print(F("Mode: "));
+		debug_println(cache->nbiot_mode ? "NBIoT" : "GSM");
+
+		debug_print(F("Band: "));
+		debug_println(cache->band, DEC);
+
+		debug_print(F("Cell ID: "));
+		debug_println(cache->cell_id, DEC);
+
+		debug_print(F("APN: "));
+		debug_println(cache->apn);
+
+		debug_print(F("Attach time mean/std dev (ms): "));
+		debug_print(cache->attach_ms_mean, 0);
+		debug_print(F(" / "));
+		debug_println(sqrt(cache->attach_ms_var), 0);
+
+		Utils::print_separator(NULL);
 	}
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "dfrobot_liquid.h"
+#include "adc_manager.h"
 
 namespace DFRobotLiquid
 {
@@ -24,22 +25,15 @@ namespace DFRobotLiquid
             return measure_dummy(data);
         }
 
-		// X measurements, calc average
-		int level_raw = 0;
-		for(int i = 0; i < WATER_LEVEL_MEASUREMENTS_COUNT; i++)
-		{
-			level_raw += analogRead(PIN_WATER_LEVEL_ANALOG);
-			delay(WATER_LEVEL_DELAY_BETWEEN_MEAS_MS);
-		}
-		level_raw /= WATER_LEVEL_MEASUREMENTS_COUNT;
-
-		// Convert to mV
-		int mv = ((float)3600 / 4096) * level_raw;
+		int mv = AdcManager::read_mv(AdcManager::CHANNEL_WATER_LEVEL);
+		if(mv < 0)
+			return RET_ERROR;
 
 		// Convert to CM
 		int cm = (mv / WATER_LEVEL_MV_PER_MM) * 10;
 
 		data->water_level = cm;
+		data->present |= WaterSensorData::PRESENT_WATER_LEVEL;
 
 		return RET_OK;	
 	}
@@ -55,6 +49,7 @@ namespace DFRobotLiquid
 
 		data->water_level = 64;
         data->water_level += (float)random(-400, 400) / 100;
+		data->present |= WaterSensorData::PRESENT_WATER_LEVEL;
 
 		// Emulate waiting time
         delay(1000);
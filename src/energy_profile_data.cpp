@@ -0,0 +1,51 @@
+#include "energy_profile_data.h"
+
+namespace EnergyProfileData
+{
+	/** 
+	 * Store for daily energy summaries
+	 */
+    DataStore<EnergyProfileData::Entry> store(ENERGY_PROFILE_DATA_PATH, ENERGY_PROFILE_DATA_ENTRIES_PER_SUBMIT_REQ);
+
+    /******************************************************************************
+    * Add energy summary to store
+    ******************************************************************************/
+    RetResult add(EnergyProfileData::Entry *data)
+    {
+		RetResult ret = store.add(data);
+
+		// Commit on every add
+		store.commit();
+
+        return ret;
+    }   
+
+    /******************************************************************************
+    * Get pointer to store (for use with reader)
+    ******************************************************************************/
+    DataStore<EnergyProfileData::Entry>* get_store()
+    {
+        return &store;
+    }
+
+    /********************************************************************************
+	 * Print all data from an energy summary struct
+	 * @param data Energy summary structure
+	 *******************************************************************************/
+	void print(const EnergyProfileData::Entry *data)
+	{
+		debug_print(F("Timestamp: "));
+		debug_println(data->timestamp);
+
+		debug_printf("Sleep: %us - %.2fmAh\n", data->sleep_secs, data->sleep_mah);
+		debug_printf("CPU active: %us - %.2fmAh\n", data->active_secs, data->active_mah);
+		debug_printf("GSM on: %us - %.2fmAh\n", data->gsm_secs, data->gsm_mah);
+		debug_printf("GPRS attached: %us - %.2fmAh\n", data->gprs_secs, data->gprs_mah);
+		debug_printf("RF sniffing: %us - %.2fmAh\n", data->rf_secs, data->rf_mah);
+		debug_printf("SDI12 powered: %us - %.2fmAh\n", data->sdi12_secs, data->sdi12_mah);
+		debug_printf("Water sensors powered: %us - %.2fmAh\n", data->water_sensors_secs, data->water_sensors_mah);
+		debug_printf("Solar: %.2fmAh\n", data->solar_mah);
+		debug_printf("NVS commits: %u - %ums\n", data->nvs_commits, data->nvs_commit_ms);
+		debug_printf("CPU at max freq: %us - %.2fmAh\n", data->cpu_max_secs, data->cpu_max_mah);
+	}
+} // namespace EnergyProfileData
@@ -0,0 +1,299 @@
+#include "energy_profiler.h"
+#include "energy_profile_data.h"
+#include "const.h"
+#include "common.h"
+#include "rtc.h"
+#include "utils.h"
+#include "battery_gauge.h"
+#include "solar_monitor.h"
+#include <esp_sleep.h>
+#include <sys/time.h>
+#include <math.h>
+
+namespace EnergyProfiler
+{
+	//
+	// Private functions
+	//
+	uint64_t now_ms();
+	float sample_gauge();
+	void sample_solar(uint64_t t_ms);
+	void set_state(State state, bool on, uint64_t t_ms, float mah);
+	void accumulate(State state, uint64_t t_ms, float mah);
+	void commit_day();
+
+	/** Names of states, for print */
+	const char *STATE_NAMES[] = {
+		[STATE_SLEEP] = "Sleep",
+		[STATE_CPU_ACTIVE] = "CPU active",
+		[STATE_GSM_ON] = "GSM on",
+		[STATE_GPRS] = "GPRS attached",
+		[STATE_RF_RX] = "RF sniffing",
+		[STATE_SDI12_POWER] = "SDI12 powered",
+		[STATE_WATER_SENSORS_POWER] = "Water sensors powered",
+		[STATE_CPU_MAX] = "CPU at max freq"
+	};
+
+	// Private vars
+	/** Totals of current day and states on */
+	RetainedState _profile = {};
+
+	/******************************************************************************
+	* Start accounting after boot, CPU is active
+	******************************************************************************/
+	void init()
+	{
+		begin(STATE_CPU_ACTIVE);
+	}
+
+	/******************************************************************************
+	* State turned on. Sleep ends CPU active
+	******************************************************************************/
+	void begin(State state)
+	{
+		if(_profile.active_mask & (1 << state))
+			return;
+
+		uint64_t t_ms = now_ms();
+		float mah = sample_gauge();
+		sample_solar(t_ms);
+
+		if(state == STATE_SLEEP)
+			set_state(STATE_CPU_ACTIVE, false, t_ms, mah);
+
+		set_state(state, true, t_ms, mah);
+	}
+
+	/******************************************************************************
+	* State turned off. End of sleep starts CPU active
+	******************************************************************************/
+	void end(State state)
+	{
+		if(!(_profile.active_mask & (1 << state)))
+			return;
+
+		uint64_t t_ms = now_ms();
+		float mah = sample_gauge();
+		sample_solar(t_ms);
+
+		set_state(state, false, t_ms, mah);
+
+		if(state == STATE_SLEEP)
+			set_state(STATE_CPU_ACTIVE, true, t_ms, mah);
+	}
+
+	/******************************************************************************
+	* Light sleep, accounted as sleep. Wake up sources must be set by caller
+	******************************************************************************/
+	esp_err_t light_sleep()
+	{
+		begin(STATE_SLEEP);
+		esp_err_t ret = esp_light_sleep_start();
+		end(STATE_SLEEP);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Account an NVS write (see DeviceConfig)
+	******************************************************************************/
+	void count_nvs_commit(uint32_t duration_ms)
+	{
+		_profile.nvs_commits++;
+		_profile.nvs_commit_ms += duration_ms;
+	}
+
+	/******************************************************************************
+	* Store summary of previous day when day changed. Called on every wake up
+	******************************************************************************/
+	void update()
+	{
+		uint32_t tstamp = RTC::get_timestamp();
+
+		if(!RTC::tstamp_valid(tstamp))
+			return;
+
+		uint32_t day = tstamp / ENERGY_PROFILER_DAY_SECS;
+
+		// Time just became known, account to this day
+		if(_profile.day == 0)
+			_profile.day = day;
+
+		if(day == _profile.day)
+			return;
+
+		commit_day();
+
+		_profile.day = day;
+	}
+
+	/******************************************************************************
+	* Print totals of current day
+	******************************************************************************/
+	void print()
+	{
+		Utils::print_separator(F("Energy profile"));
+
+		for(int i = 0; i < STATE_COUNT; i++)
+		{
+			debug_printf("%s: %us - %.2fmAh%s\n", STATE_NAMES[i], (uint32_t)(_profile.total_ms[i] / 1000),
+				_profile.total_mah[i], _profile.active_mask & (1 << i) ? " (on)" : "");
+		}
+
+		debug_printf("Solar: %.2fmAh\n", _profile.solar_mah);
+		debug_printf("NVS commits: %u - %ums\n", _profile.nvs_commits, _profile.nvs_commit_ms);
+	}
+
+	/******************************************************************************
+	* Time in ms. System time keeps running in light and deep sleep
+	******************************************************************************/
+	uint64_t now_ms()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+
+		return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	/******************************************************************************
+	* Read charge left in battery
+	* @return NAN without battery gauge
+	******************************************************************************/
+	float sample_gauge()
+	{
+		float mah = 0;
+
+		if(BatteryGauge::read_mah(&mah) != RET_OK)
+			return NAN;
+
+		return mah;
+	}
+
+	/******************************************************************************
+	* Sample solar current and integrate charge since last sample
+	******************************************************************************/
+	void sample_solar(uint64_t t_ms)
+	{
+		float ma = 0;
+
+		if(SolarMonitor::read_current_ma(&ma) != RET_OK)
+			return;
+
+		if(_profile.solar_sample_ms > 0 && t_ms > _profile.solar_sample_ms && t_ms - _profile.solar_sample_ms <= ENERGY_PROFILER_MAX_PHASE_MS)
+		{
+			_profile.solar_mah += (_profile.solar_ma + ma) / 2 * (t_ms - _profile.solar_sample_ms) / 3600000;
+		}
+
+		_profile.solar_sample_ms = t_ms;
+		_profile.solar_ma = ma;
+	}
+
+	/******************************************************************************
+	* Turn state on/off, accounting time and charge since it turned on
+	******************************************************************************/
+	void set_state(State state, bool on, uint64_t t_ms, float mah)
+	{
+		if(on)
+		{
+			_profile.active_mask |= 1 << state;
+			_profile.start_ms[state] = t_ms;
+			_profile.start_mah[state] = mah;
+			return;
+		}
+
+		accumulate(state, t_ms, mah);
+		_profile.active_mask &= ~(1 << state);
+	}
+
+	/******************************************************************************
+	* Add time and charge since state turned on (or last accumulated) to totals
+	* Phases longer than any sleep or going back mean system time was set, those
+	* are dropped.
+	******************************************************************************/
+	void accumulate(State state, uint64_t t_ms, float mah)
+	{
+		uint64_t start_ms = _profile.start_ms[state];
+
+		if(t_ms >= start_ms && t_ms - start_ms <= ENERGY_PROFILER_MAX_PHASE_MS)
+		{
+			_profile.total_ms[state] += t_ms - start_ms;
+
+			if(!isnan(mah) && !isnan(_profile.start_mah[state]))
+				_profile.total_mah[state] += _profile.start_mah[state] - mah;
+		}
+
+		_profile.start_ms[state] = t_ms;
+		_profile.start_mah[state] = mah;
+	}
+
+	/******************************************************************************
+	* Store totals of day being accounted and start over. States still on are
+	* accounted up to now.
+	******************************************************************************/
+	void commit_day()
+	{
+		uint64_t t_ms = now_ms();
+		float mah = sample_gauge();
+		sample_solar(t_ms);
+
+		for(int i = 0; i < STATE_COUNT; i++)
+		{
+			if(_profile.active_mask & (1 << i))
+				accumulate((State)i, t_ms, mah);
+		}
+
+		EnergyProfileData::Entry entry = {0};
+
+		entry.timestamp = _profile.day * ENERGY_PROFILER_DAY_SECS;
+
+		entry.sleep_secs = _profile.total_ms[STATE_SLEEP] / 1000;
+		entry.active_secs = _profile.total_ms[STATE_CPU_ACTIVE] / 1000;
+		entry.gsm_secs = _profile.total_ms[STATE_GSM_ON] / 1000;
+		entry.gprs_secs = _profile.total_ms[STATE_GPRS] / 1000;
+		entry.rf_secs = _profile.total_ms[STATE_RF_RX] / 1000;
+		entry.sdi12_secs = _profile.total_ms[STATE_SDI12_POWER] / 1000;
+		entry.water_sensors_secs = _profile.total_ms[STATE_WATER_SENSORS_POWER] / 1000;
+		entry.cpu_max_secs = _profile.total_ms[STATE_CPU_MAX] / 1000;
+
+		entry.sleep_mah = _profile.total_mah[STATE_SLEEP];
+		entry.active_mah = _profile.total_mah[STATE_CPU_ACTIVE];
+		entry.gsm_mah = _profile.total_mah[STATE_GSM_ON];
+		entry.gprs_mah = _profile.total_mah[STATE_GPRS];
+		entry.rf_mah = _profile.total_mah[STATE_RF_RX];
+		entry.sdi12_mah = _profile.total_mah[STATE_SDI12_POWER];
+		entry.water_sensors_mah = _profile.total_mah[STATE_WATER_SENSORS_POWER];
+		entry.cpu_max_mah = _profile.total_mah[STATE_CPU_MAX];
+
+		entry.solar_mah = _profile.solar_mah;
+
+		entry.nvs_commits = _profile.nvs_commits;
+		entry.nvs_commit_ms = _profile.nvs_commit_ms;
+
+		EnergyProfileData::add(&entry);
+		EnergyProfileData::print(&entry);
+
+		memset(_profile.total_ms, 0, sizeof(_profile.total_ms));
+		memset(_profile.total_mah, 0, sizeof(_profile.total_mah));
+		_profile.solar_mah = 0;
+		_profile.nvs_commits = 0;
+		_profile.nvs_commit_ms = 0;
+	}
+
+	/******************************************************************************
+	* Save state before entering deep sleep
+	******************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		*state = _profile;
+	}
+
+	/******************************************************************************
+	* Restore state after waking up from deep sleep, which ends the sleep phase
+	******************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_profile = *state;
+
+		end(STATE_SLEEP);
+	}
+}
@@ -0,0 +1,561 @@
+#include "Arduino.h"
+#include "field_offload.h"
+#include <WiFi.h>
+#include <esp_system.h>
+#include "store_registry.h"
+#include "data_store.h"
+#include "tb_json_schema.h"
+#include "storage.h"
+#include "flash.h"
+#include "globals.h"
+#include "credentials.h"
+#include "log.h"
+#include "utils.h"
+#include "common.h"
+
+namespace FieldOffload
+{
+	//
+	// Private functions
+	//
+	bool handle_client(WiFiClient &client);
+	char* get_param(char *query, const char *name);
+	void send_status(WiFiClient &client, int status, const char *body);
+	void send_list(WiFiClient &client);
+	void send_store(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, bool csv);
+	int send_binary(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, uint8_t *buff);
+	int send_csv(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, const TbJsonSchema *schema,
+		uint8_t *buff, char *out);
+	int format_csv_row(const TbJsonSchema *schema, const uint8_t *record, char *line, int size);
+	bool send_chunk(WiFiClient &client, const void *data, int len);
+	void confirm(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, uint32_t token);
+	uint32_t get_token(const StoreRegistry::StoreDescriptor *store, int *files);
+	const TbJsonSchema* get_schema(StoreId id);
+
+	/******************************************************************************
+	* Open SoftAP and serve store downloads until /exit or idle timeout
+	******************************************************************************/
+	RetResult run()
+	{
+		if(!FLAGS.FIELD_OFFLOAD)
+			return RET_ERROR;
+
+		if(Flash::mount() != RET_OK)
+			return RET_ERROR;
+
+		StoreRegistry::check_format();
+
+		uint8_t mac[6];
+		esp_read_mac(mac, ESP_MAC_WIFI_SOFTAP);
+
+		char ssid[32] = "";
+		snprintf(ssid, sizeof(ssid), "%s%02X%02X%02X", FIELD_OFFLOAD_AP_SSID_PREFIX, mac[3], mac[4], mac[5]);
+
+		WiFi.mode(WIFI_AP);
+
+		// Open AP without a password (WPA2 needs 8 chars)
+		if(!WiFi.softAP(ssid, strlen(FIELD_OFFLOAD_AP_PASSWORD) >= 8 ? FIELD_OFFLOAD_AP_PASSWORD : NULL))
+		{
+			debug_println_e(F("Could not start SoftAP."));
+			WiFi.mode(WIFI_OFF);
+			return RET_ERROR;
+		}
+
+		// Power save adds latency to every packet
+		WiFi.setSleep(false);
+
+		WiFiServer server(FIELD_OFFLOAD_PORT);
+		server.begin();
+
+		debug_printf("Field offload AP: %s, http://%s/\n", ssid, WiFi.softAPIP().toString().c_str());
+
+		Log::log(Log::FIELD_OFFLOAD_STARTED);
+
+		// Keep LED on while in offload mode
+		pinMode(PIN_LED, OUTPUT);
+		digitalWrite(PIN_LED, 1);
+
+		uint32_t last_request_ms = millis();
+		bool exit = false;
+
+		while(!exit && millis() - last_request_ms < FIELD_OFFLOAD_IDLE_TIMEOUT_MS)
+		{
+			WiFiClient client = server.available();
+
+			if(!client)
+			{
+				delay(FIELD_OFFLOAD_POLL_MS);
+				continue;
+			}
+
+			exit = handle_client(client);
+
+			client.stop();
+			last_request_ms = millis();
+		}
+
+		debug_println(F("Field offload done."));
+
+		server.end();
+		WiFi.softAPdisconnect(true);
+		WiFi.mode(WIFI_OFF);
+
+		digitalWrite(PIN_LED, 0);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Read a request and answer it
+	* @return True if offload mode must end
+	******************************************************************************/
+	bool handle_client(WiFiClient &client)
+	{
+		client.setTimeout(FIELD_OFFLOAD_REQ_TIMEOUT_SECS);
+
+		char line[FIELD_OFFLOAD_REQ_LINE_SIZE] = "";
+		int len = client.readBytesUntil('\n', line, sizeof(line) - 1);
+
+		if(len <= 0)
+			return false;
+
+		line[len] = '\0';
+
+		// Headers are not needed, read until the blank line ending them
+		char header[FIELD_OFFLOAD_REQ_LINE_SIZE];
+		while(client.readBytesUntil('\n', header, sizeof(header)) > 1);
+
+		char *method = strtok(line, " ");
+		char *target = strtok(NULL, " \r");
+
+		if(method == NULL || target == NULL)
+		{
+			send_status(client, 400, "Bad request");
+			return false;
+		}
+
+		char *query = strchr(target, '?');
+		if(query != NULL)
+			*query++ = '\0';
+
+		debug_printf("Field offload request: %s %s\n", method, target);
+
+		if(strcmp(target, "/") == 0)
+		{
+			send_list(client);
+			return false;
+		}
+
+		if(strcmp(target, "/exit") == 0)
+		{
+			send_status(client, 200, "Bye");
+			return true;
+		}
+
+		char *id = query != NULL ? get_param(query, "id") : NULL;
+		const StoreRegistry::StoreDescriptor *store = id != NULL ? StoreRegistry::get((StoreId)atoi(id)) : NULL;
+
+		if(strcmp(target, "/store") == 0 && strcmp(method, "GET") == 0 && store != NULL)
+		{
+			char *format = get_param(query, "format");
+			send_store(client, store, format != NULL && strcmp(format, "csv") == 0);
+		}
+		else if(strcmp(target, "/confirm") == 0 && strcmp(method, "POST") == 0 && store != NULL)
+		{
+			char *token = get_param(query, "token");
+
+			if(token == NULL)
+				send_status(client, 400, "Token is required");
+			else
+				confirm(client, store, strtoul(token, NULL, 16));
+		}
+		else
+		{
+			send_status(client, 404, "Not found");
+		}
+
+		return false;
+	}
+
+	/******************************************************************************
+	* Find a query param. Query is split in place, look params up in the order
+	* they are given in the request
+	* @return Value, NULL if not in query
+	******************************************************************************/
+	char* get_param(char *query, const char *name)
+	{
+		int name_len = strlen(name);
+		char *param = strstr(query, name);
+
+		while(param != NULL)
+		{
+			if((param == query || param[-1] == '&' || param[-1] == '\0') && param[name_len] == '=')
+			{
+				char *val = param + name_len + 1;
+				char *end = strchr(val, '&');
+
+				if(end != NULL)
+					*end = '\0';
+
+				return val;
+			}
+
+			param = strstr(param + name_len, name);
+		}
+
+		return NULL;
+	}
+
+	/******************************************************************************
+	* Send a response with a short text body
+	******************************************************************************/
+	void send_status(WiFiClient &client, int status, const char *body)
+	{
+		client.printf("HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n"
+			"Connection: close\r\n\r\n%s", status, status == 200 ? "OK" : "Error", (int)strlen(body), body);
+	}
+
+	/******************************************************************************
+	* Send stores with their files, entries and download token
+	******************************************************************************/
+	void send_list(WiFiClient &client)
+	{
+		client.print(F("HTTP/1.1 200 OK\r\nContent-Type: text/csv\r\nTransfer-Encoding: chunked\r\n"
+			"Connection: close\r\n\r\n"));
+
+		char line[FIELD_OFFLOAD_REQ_LINE_SIZE] = "id,name,files,entries,bytes,token,csv\n";
+		send_chunk(client, line, strlen(line));
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			const StoreRegistry::StoreDescriptor *store = StoreRegistry::get((StoreId)i);
+
+			int file_count = 0, entry_count = 0;
+			store->ops->get_usage(&file_count, &entry_count);
+
+			int files = 0;
+			uint32_t token = get_token(store, &files);
+
+			int len = snprintf(line, sizeof(line), "%d,%s,%d,%d,%u,%08x,%d\n", store->id, store->name,
+				files, entry_count, StoreRegistry::get_stored_bytes(store), token, get_schema(store->id) != NULL);
+
+			send_chunk(client, line, len);
+		}
+
+		send_chunk(client, NULL, 0);
+	}
+
+	/******************************************************************************
+	* Stream files of a store, as stored or as CSV
+	******************************************************************************/
+	void send_store(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, bool csv)
+	{
+		const TbJsonSchema *schema = get_schema(store->id);
+
+		if(csv && schema == NULL)
+		{
+			send_status(client, 400, "No CSV for this store, use format=bin");
+			return;
+		}
+
+		// Read buffer and, for CSV, output buffer
+		ScratchBuffer scratch(2 * FIELD_OFFLOAD_CHUNK_SIZE);
+		if(scratch.get() == NULL)
+		{
+			send_status(client, 500, "Out of memory");
+			return;
+		}
+
+		int files = 0;
+		uint32_t token = get_token(store, &files);
+
+		client.printf("HTTP/1.1 200 OK\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n"
+			"Content-Disposition: attachment; filename=\"store_%d.%s\"\r\nX-Offload-Token: %08x\r\n"
+			"Connection: close\r\n\r\n", csv ? "text/csv" : "application/octet-stream", store->id,
+			csv ? "csv" : "bin", token);
+
+		uint32_t start_ms = millis();
+		uint8_t *buff = (uint8_t*)scratch.get();
+
+		int bytes = csv ? send_csv(client, store, schema, buff, scratch.get() + FIELD_OFFLOAD_CHUNK_SIZE) :
+			send_binary(client, store, buff);
+
+		send_chunk(client, NULL, 0);
+
+		uint32_t ms = millis() - start_ms;
+
+		debug_printf("Field offload of %s: %d bytes in %ums\n", store->name, bytes, ms);
+
+		Log::log(Log::FIELD_OFFLOAD_DOWNLOAD, store->id, bytes);
+	}
+
+	/******************************************************************************
+	* Stream whole records of store files as they are in flash
+	* @param buff FIELD_OFFLOAD_CHUNK_SIZE bytes
+	* @return Bytes sent, -1 if client went away
+	******************************************************************************/
+	int send_binary(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, uint8_t *buff)
+	{
+		OffloadHeader header = {FIELD_OFFLOAD_BINARY_MAGIC, FIELD_OFFLOAD_BINARY_VERSION,
+			DATA_STORE_FORMAT_VERSION, (uint8_t)store->id, (uint16_t)store->entry_size};
+
+		if(!send_chunk(client, &header, sizeof(header)))
+			return -1;
+
+		int bytes = sizeof(header);
+		int chunk_size = FIELD_OFFLOAD_CHUNK_SIZE / store->entry_size * store->entry_size;
+
+		File dir = STORAGE_FS.open(store->ops->get_dir_path());
+		if(!dir)
+			return bytes;
+
+		File file;
+		while((file = dir.openNextFile()))
+		{
+			int len;
+
+			// A partial record at the end of a file (write cut off) is left out
+			while((len = file.read(buff, chunk_size) / store->entry_size * store->entry_size) > 0)
+			{
+				if(!send_chunk(client, buff, len))
+				{
+					file.close();
+					dir.close();
+					return -1;
+				}
+
+				bytes += len;
+			}
+
+			file.close();
+		}
+
+		dir.close();
+
+		return bytes;
+	}
+
+	/******************************************************************************
+	* Stream valid records of store files as CSV rows
+	* @param buff FIELD_OFFLOAD_CHUNK_SIZE read buffer
+	* @param out FIELD_OFFLOAD_CHUNK_SIZE output buffer
+	* @return Bytes sent, -1 if client went away
+	******************************************************************************/
+	int send_csv(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, const TbJsonSchema *schema,
+		uint8_t *buff, char *out)
+	{
+		int out_len = snprintf(out, FIELD_OFFLOAD_CHUNK_SIZE, "ts,seq");
+
+		for(int i = 0; i < schema->field_count; i++)
+			out_len += snprintf(out + out_len, FIELD_OFFLOAD_CHUNK_SIZE - out_len, ",%s", schema->fields[i].key);
+
+		out[out_len++] = '\n';
+
+		int bytes = 0;
+		int chunk_size = FIELD_OFFLOAD_CHUNK_SIZE / store->entry_size * store->entry_size;
+		int data_size = store->entry_size - DATA_STORE_ENTRY_HEADER_SIZE;
+
+		File dir = STORAGE_FS.open(store->ops->get_dir_path());
+		File file;
+
+		while(dir && (file = dir.openNextFile()))
+		{
+			int len;
+
+			while((len = file.read(buff, chunk_size)) >= store->entry_size)
+			{
+				for(const uint8_t *record = buff; record + store->entry_size <= buff + len; record += store->entry_size)
+				{
+					uint32_t crc32;
+					memcpy(&crc32, record, sizeof(crc32));
+
+					if(crc32 != Utils::crc32((uint8_t*)record + DATA_STORE_ENTRY_HEADER_SIZE, data_size))
+						continue;
+
+					// Room for the longest row, send what is buffered otherwise
+					if(FIELD_OFFLOAD_CHUNK_SIZE - out_len < FIELD_OFFLOAD_CSV_ROW_MAX_LEN)
+					{
+						if(!send_chunk(client, out, out_len))
+						{
+							file.close();
+							dir.close();
+							return -1;
+						}
+
+						bytes += out_len;
+						out_len = 0;
+					}
+
+					out_len += format_csv_row(schema, record, out + out_len, FIELD_OFFLOAD_CHUNK_SIZE - out_len);
+				}
+			}
+
+			file.close();
+		}
+
+		if(dir)
+			dir.close();
+
+		if(out_len > 0)
+		{
+			if(!send_chunk(client, out, out_len))
+				return -1;
+
+			bytes += out_len;
+		}
+
+		return bytes;
+	}
+
+	/******************************************************************************
+	* Format a stored record as a CSV row: timestamp, seq and schema fields. Fields
+	* not measured (presence mask) or NAN are left empty
+	* @param record DataStore::Entry, header included
+	* @return Length of row
+	******************************************************************************/
+	int format_csv_row(const TbJsonSchema *schema, const uint8_t *record, char *line, int size)
+	{
+		uint32_t seq, tstamp;
+		const uint8_t *entry = record + DATA_STORE_ENTRY_HEADER_SIZE;
+
+		memcpy(&seq, record + sizeof(uint32_t), sizeof(seq));
+
+		// Sensor data structs start with the timestamp
+		memcpy(&tstamp, entry, sizeof(tstamp));
+
+		int len = snprintf(line, size, "%u,%u", tstamp, seq);
+
+		for(int i = 0; i < schema->field_count && len < size; i++)
+		{
+			const TbJsonField *field = &schema->fields[i];
+			double val = field->read(entry);
+
+			if(!schema->is_present(field, entry) || isnan(val))
+				len += snprintf(line + len, size - len, ",");
+			else if(field->type == TB_JSON_FIELD_FLOAT)
+				len += snprintf(line + len, size - len, ",%.*f", field->decimals >= 0 ? field->decimals : 6, val);
+			else
+				len += snprintf(line + len, size - len, ",%.0f", val);
+		}
+
+		if(len < size)
+			line[len++] = '\n';
+
+		return len < size ? len : size;
+	}
+
+	/******************************************************************************
+	* Send a chunk of a chunked transfer, len 0 ends the body
+	* @return False if client went away
+	******************************************************************************/
+	bool send_chunk(WiFiClient &client, const void *data, int len)
+	{
+		char size_line[12];
+		int size_len = snprintf(size_line, sizeof(size_line), "%x\r\n", len);
+
+		if(client.write((const uint8_t*)size_line, size_len) != (size_t)size_len)
+			return false;
+
+		if(len > 0 && client.write((const uint8_t*)data, len) != (size_t)len)
+			return false;
+
+		return client.write((const uint8_t*)"\r\n", 2) == 2;
+	}
+
+	/******************************************************************************
+	* Mark files of a download as submitted, if they did not change since
+	* @param token X-Offload-Token of the download
+	******************************************************************************/
+	void confirm(WiFiClient &client, const StoreRegistry::StoreDescriptor *store, uint32_t token)
+	{
+		int files = 0;
+
+		if(get_token(store, &files) != token)
+		{
+			send_status(client, 409, "Store changed since download, download again");
+			return;
+		}
+
+		int removed = 0;
+		File dir = STORAGE_FS.open(store->ops->get_dir_path());
+		File file;
+
+		while(dir && (file = dir.openNextFile()))
+		{
+			char path[FILE_PATH_BUFFER_SIZE] = {0};
+			strncpy(path, file.name(), FILE_PATH_BUFFER_SIZE - 1);
+			int size = file.size();
+
+			file.close();
+
+			if(store->ops->remove_file(path, size) == RET_OK)
+				removed++;
+		}
+
+		if(dir)
+			dir.close();
+
+		debug_printf("Field offload of %s confirmed, files submitted: %d/%d\n", store->name, removed, files);
+
+		Log::log(Log::FIELD_OFFLOAD_CONFIRMED, store->id, removed);
+
+		char body[FIELD_OFFLOAD_REQ_LINE_SIZE];
+		snprintf(body, sizeof(body), "Submitted files: %d/%d", removed, files);
+
+		send_status(client, removed == files ? 200 : 500, body);
+	}
+
+	/******************************************************************************
+	* Token of store files: CRC32 chained over their names and sizes, changes when
+	* a file is added, appended to or removed
+	* @param files Files in store
+	******************************************************************************/
+	uint32_t get_token(const StoreRegistry::StoreDescriptor *store, int *files)
+	{
+		uint32_t token = 0;
+		*files = 0;
+
+		File dir = STORAGE_FS.open(store->ops->get_dir_path());
+		File file;
+
+		while(dir && (file = dir.openNextFile()))
+		{
+			uint32_t item[] = {token, (uint32_t)file.size(), Utils::crc32((uint8_t*)file.name(), strlen(file.name()))};
+			token = Utils::crc32((uint8_t*)item, sizeof(item));
+
+			(*files)++;
+
+			file.close();
+		}
+
+		if(dir)
+			dir.close();
+
+		return token;
+	}
+
+	/******************************************************************************
+	* Schema of entries of a store, entries start with the timestamp
+	* @return NULL if store has no schema, CSV is not available
+	******************************************************************************/
+	const TbJsonSchema* get_schema(StoreId id)
+	{
+		switch(id)
+		{
+			case STORE_WATER_SENSORS:
+				return &TbJsonSchemaOf<WaterSensorData::Entry>::SCHEMA;
+			case STORE_ATMOS41:
+				return &TbJsonSchemaOf<Atmos41Data::Entry>::SCHEMA;
+			case STORE_SOIL_MOISTURE:
+				return &TbJsonSchemaOf<SoilMoistureData::Entry>::SCHEMA;
+			case STORE_FO:
+				return &TbJsonSchemaOf<FoData::StoreEntry>::SCHEMA;
+			case STORE_LIGHTNING:
+				return &TbJsonSchemaOf<LightningData::Entry>::SCHEMA;
+			case STORE_ENERGY_PROFILE:
+				return &TbJsonSchemaOf<EnergyProfileData::Entry>::SCHEMA;
+			default:
+				return NULL;
+		}
+	}
+}
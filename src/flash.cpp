@@ -1,5 +1,7 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_FLASH
+
 #include "flash.h"
-#include "SPIFFS.h"
+#include "storage.h"
 #include "utils.h"
 #include "const.h"
 #include "struct.h"
@@ -8,8 +10,18 @@
 
 namespace Flash
 {
+	/**
+	 * Incremented every time the partition is formatted. Used by stores to detect
+	 * that their cached file index is no longer valid.
+	 */
+	uint32_t _generation = 0;
+
+	/** Holders of open files, see hold() */
+	int _holds = 0;
+	portMUX_TYPE _holds_mux = portMUX_INITIALIZER_UNLOCKED;
+
 	/********************************************************************************
-	* Mount SPIFFS partition
+	* Mount storage partition
 	*******************************************************************************/
 	RetResult mount()
 	{
@@ -18,7 +30,7 @@ namespace Flash
 
 		while(tries--)
 		{
-			if(SPIFFS.begin(false, "/spiffs", 25))
+			if(STORAGE_FS.begin(false, STORAGE_BASE_PATH, 25))
 			{
 				success = true;
 				break;
@@ -35,9 +47,10 @@ namespace Flash
 		if(!success)
 		{
 			debug_println(F("Could not mount SPIFFS, formatting partition..."));
-			SPIFFS.format();
+			STORAGE_FS.format();
+			_generation++;
 
-			if(SPIFFS.begin(false, "/spiffs", 50))
+			if(STORAGE_FS.begin(false, STORAGE_BASE_PATH, 50))
 			{
 				debug_println(F("Partition mount successful."));
 				return RET_OK;
@@ -65,7 +78,7 @@ namespace Flash
 			return RET_ERROR;
 		}
 
-		File f = SPIFFS.open(path, FILE_READ);
+		File f = STORAGE_FS.open(path, FILE_READ);
 
 		// File doesn't exist
 		if(!f)
@@ -89,14 +102,18 @@ namespace Flash
 	*******************************************************************************/
 	void ls()
 	{
+		// Listing reads every file, not worth it when nothing is printed
+		if(!debug_level_enabled(LOG_LEVEL_DEBUG))
+			return;
+
 		Utils::print_separator(F("Flash memory contents"));
 
 		debug_print(F("Size: "));
-		debug_print(SPIFFS.totalBytes());
+		debug_print(STORAGE_FS.totalBytes());
 		debug_println("bytes");
 
 		debug_print(F("Free: "));
-		debug_print(SPIFFS.totalBytes() - SPIFFS.usedBytes());
+		debug_print(STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes());
 		debug_println("bytes");
 
 		if(Flash::mount() != RET_OK)
@@ -104,7 +121,7 @@ namespace Flash
 		    return;
 		}
 
-		File root = SPIFFS.open("/");
+		File root = STORAGE_FS.open("/");
 		if(!root)
 		{
 			debug_println(F("Could not open root."));
@@ -134,14 +151,35 @@ namespace Flash
 		Utils::print_separator(F("End flash memory contents"));
 	}
 
+	/********************************************************************************
+	* Unmount and mount partition again
+	*******************************************************************************/
+	RetResult remount()
+	{
+		// Handles of readers would be left dangling
+		if(_holds > 0)
+		{
+			debug_println_w(F("Files held open, not remounting."));
+			return mount();
+		}
+
+		STORAGE_FS.end();
+
+		return mount();
+	}
+
 	/******************************************************************************
-	 * Format SPIFFS and log
+	 * Format partition and log
 	 *****************************************************************************/
 	RetResult format()
 	{
-		if(SPIFFS.format())
+		int bytes_before_format = STORAGE_FS.usedBytes();
+
+		_generation++;
+
+		if(STORAGE_FS.format())
 		{
-			Log::log(Log::SPIFFS_FORMATTED);
+			Log::log(Log::SPIFFS_FORMATTED, bytes_before_format);
 			return RET_OK;
 		}
 		else
@@ -150,4 +188,34 @@ namespace Flash
 			return RET_ERROR;
 		}
 	}
+
+	/******************************************************************************
+	 * Get flash generation (number of times partition has been formatted since boot)
+	 *****************************************************************************/
+	uint32_t get_generation()
+	{
+		return _generation;
+	}
+
+	/******************************************************************************
+	 * Files are kept open (eg. by a DataStoreReader), remount() is skipped until
+	 * released
+	 *****************************************************************************/
+	void hold()
+	{
+		portENTER_CRITICAL(&_holds_mux);
+		_holds++;
+		portEXIT_CRITICAL(&_holds_mux);
+	}
+
+	/******************************************************************************
+	 * Release a hold()
+	 *****************************************************************************/
+	void release()
+	{
+		portENTER_CRITICAL(&_holds_mux);
+		if(_holds > 0)
+			_holds--;
+		portEXIT_CRITICAL(&_holds_mux);
+	}
 }
\ No newline at end of file
@@ -4,32 +4,60 @@
 #include "fo_data.h"
 
 /******************************************************************************
-* Add packet to buffer
+* Update running mean and sum of squared differences (Welford)
 ******************************************************************************/
-RetResult FoBuffer::add_packet(FoDecodedPacket *packet)
+static void welford_update(float *mean, float *m2, int count, float value)
 {
-    // Buffer full, ignore
-    if(_packet_count >= FO_BUFFER_SIZE)
-        return RET_ERROR;
+    float delta = value - *mean;
+    *mean += delta / count;
+    *m2 += delta * (value - *mean);
+}
 
+/******************************************************************************
+* Add packet to the running aggregate
+******************************************************************************/
+RetResult FoBuffer::add_packet(FoDecodedPacket *packet)
+{
     // If first packet, store current time. Aggregate packet timestamp is tstamp
     // of the first packet
-    if(_packet_count == 0)
-        _first_packet_tstamp = RTC::get_timestamp();
-    _last_packet_tstamp = RTC::get_timestamp();
+    if(_aggr.packet_count == 0)
+    {
+        _aggr.first_packet_tstamp = RTC::get_timestamp();
+        _aggr.first_rain = packet->rain;
+        _aggr.wind_gust_max = packet->wind_gust;
+    }
+    _aggr.last_packet_tstamp = RTC::get_timestamp();
+
+    int count = ++_aggr.packet_count;
+
+    welford_update(&_aggr.temp_mean, &_aggr.temp_m2, count, packet->temp);
+    welford_update(&_aggr.wind_speed_mean, &_aggr.wind_speed_m2, count, packet->wind_speed);
+
+    _aggr.hum_mean += (packet->hum - _aggr.hum_mean) / count;
+    _aggr.wind_gust_mean += (packet->wind_gust - _aggr.wind_gust_mean) / count;
+    _aggr.uv_mean += (packet->uv - _aggr.uv_mean) / count;
+    _aggr.uv_index_mean += (packet->uv_index - _aggr.uv_index_mean) / count;
+    _aggr.light_mean += (packet->light - _aggr.light_mean) / count;
+    _aggr.solar_radiation_mean += (packet->solar_radiation - _aggr.solar_radiation_mean) / count;
 
-    memcpy(&_buffer[_packet_count], packet, sizeof(FoDecodedPacket));
+    if(packet->wind_gust > _aggr.wind_gust_max)
+        _aggr.wind_gust_max = packet->wind_gust;
 
-    _packet_count++;
+    _aggr.wind_dir_sin_total += sin(Utils::deg_to_rad(packet->wind_dir));
+    _aggr.wind_dir_cos_total += cos(Utils::deg_to_rad(packet->wind_dir));
+
+    _aggr.last_rain = packet->rain;
 
     // Commit automatically if X seconds passed from last packet
-    int sec_since_last_commit = RTC::get_timestamp() - _first_packet_tstamp;
+    int sec_since_last_commit = RTC::get_timestamp() - _aggr.first_packet_tstamp;
     if(sec_since_last_commit >= FO_AGGREGATE_INTERVAL_SEC)
     {
         debug_print(sec_since_last_commit, DEC);
         debug_println(" seconds passed since last commit, commiting FoSniffer buffer.");
         commit_buffer();
     }
+
+    return RET_OK;
 }
 
 /******************************************************************************
@@ -37,101 +65,86 @@ RetResult FoBuffer::add_packet(FoDecodedPacket *packet)
 ******************************************************************************/
 void FoBuffer::clear()
 {
-    _first_packet_tstamp = 0;
-    _packet_count = 0;
+    memset(&_aggr, 0, sizeof(_aggr));
+}
+
+/******************************************************************************
+* Get count of packets aggregated since last commit
+******************************************************************************/
+int FoBuffer::get_packet_count()
+{
+    return _aggr.packet_count;
 }
 
 /******************************************************************************
 * Save buffer to the file system
-* After aggregate calcs whole buffer results in a single entry in the filesystem
+* The aggregate results in a single entry in the filesystem
 ******************************************************************************/
 RetResult FoBuffer::commit_buffer()
 {
     // Nothing to commit
-    if(_packet_count < 1)
+    if(_aggr.packet_count < 1)
         return RET_OK;
 
-    //
-    // Aggregate data
-    //
-
-    // Totals of params to calc averages
-    float hum_total = 0, temp_total = 0;
-    float wind_speed_total = 0, wind_gust_total = 0;
-    float solar_radiation_total = 0;
-    uint32_t uv_total = 0, uv_index_total = 0, light_total = 0;
-
-    // Total of sin/cos of wind dir, used to calculate mean angle
-    float wind_dir_sin_total = 0, wind_dir_cos_total = 0;
-
-    for(int i = 0; i < _packet_count; i++)
-    {
-        FoDecodedPacket *cur_packet = &_buffer[i];
-
-        temp_total += cur_packet->temp;
-        hum_total += cur_packet->hum;
-        wind_speed_total += cur_packet->wind_speed;
-        wind_gust_total += cur_packet->wind_gust;
-        uv_total += cur_packet->uv;
-        uv_index_total += cur_packet->uv_index;
-        light_total += cur_packet->light;
-        solar_radiation_total += cur_packet->solar_radiation;
-
-        wind_dir_sin_total += sin(Utils::deg_to_rad(cur_packet->wind_dir));
-        wind_dir_cos_total += cos(Utils::deg_to_rad(cur_packet->wind_dir));
-    }
-
     // Calc wind dir avg
-    float wind_dir_avg = atan2(wind_dir_sin_total / _packet_count, wind_dir_cos_total / _packet_count);
+    float wind_dir_avg = atan2(_aggr.wind_dir_sin_total / _aggr.packet_count,
+        _aggr.wind_dir_cos_total / _aggr.packet_count);
 
     wind_dir_avg = Utils::rad_to_deg(wind_dir_avg);
     if(wind_dir_avg < 0)
         wind_dir_avg += 360;
 
     //
-    // Calc hourly rate from previous commit
+    // Build data store entry, in place in the store buffer
     //
+    FoData::StoreEntry *entry = FoData::reserve();
+    if(entry == NULL)
+    {
+        debug_println_e(F("No space for FO entry."));
+        clear();
+        return RET_ERROR;
+    }
 
-    //
-    // Build data store entry
-    //
-    FoData::StoreEntry entry = {0};
-    
-    entry.timestamp = _first_packet_tstamp;
-    entry.packets = _packet_count;
-
-    entry.temp = (float)temp_total / _packet_count;
-    entry.hum = (float)hum_total / _packet_count;
-    entry.wind_dir = (uint16_t)wind_dir_avg;
-    entry.wind_speed = (float)wind_speed_total / _packet_count;
-    entry.wind_gust = (float)wind_gust_total / _packet_count;
-    entry.uv = uv_total / _packet_count;
-    entry.uv_index = uv_index_total / _packet_count;
-    entry.light = light_total / _packet_count;
-    entry.solar_radiation = solar_radiation_total / _packet_count;
-    entry.rain = _buffer[_packet_count - 1].rain;
+    entry->timestamp = _aggr.first_packet_tstamp;
+    entry->packets = _aggr.packet_count;
+
+    entry->temp = _aggr.temp_mean;
+    entry->hum = (uint8_t)(_aggr.hum_mean + 0.5);
+    entry->wind_dir = (uint16_t)wind_dir_avg;
+    entry->wind_speed = _aggr.wind_speed_mean;
+    entry->wind_gust = _aggr.wind_gust_mean;
+    entry->uv = (uint32_t)_aggr.uv_mean;
+    entry->uv_index = (uint32_t)_aggr.uv_index_mean;
+    entry->light = (uint32_t)_aggr.light_mean;
+    entry->solar_radiation = (uint32_t)_aggr.solar_radiation_mean;
+    entry->rain = _aggr.last_rain;
+
+    // Population std dev of the window
+    entry->temp_std = sqrt(_aggr.temp_m2 / _aggr.packet_count);
+    entry->wind_speed_std = sqrt(_aggr.wind_speed_m2 / _aggr.packet_count);
+    entry->wind_gust_max = _aggr.wind_gust_max;
 
     // Calc hourly rate from previous commit
-    if(_last_packet_tstamp > _first_packet_tstamp)
+    if(_aggr.last_packet_tstamp > _aggr.first_packet_tstamp)
     {
-        uint32_t time_diff_sec = _last_packet_tstamp - _first_packet_tstamp;
-        float rain_diff = entry.rain - _buffer[0].rain;
-        float rate_hr = (60 * 60 / time_diff_sec) * rain_diff;
+        uint32_t time_diff_sec = _aggr.last_packet_tstamp - _aggr.first_packet_tstamp;
+        float rain_diff = entry->rain - _aggr.first_rain;
+        float rate_hr = (60.0 * 60 / time_diff_sec) * rain_diff;
         rate_hr = (int)(rate_hr * 100 + 0.5) / 100.0;
 
-        entry.rain_hourly = rate_hr;
+        entry->rain_hourly = rate_hr;
     }
 
     // Update previous rain count
-    _prev_rain = entry.rain;
+    _prev_rain = entry->rain;
 
     debug_println_i(F("Commiting FO Buffer,"));
     debug_print(F("Total time (sec): "));
-    debug_println(_last_packet_tstamp - _first_packet_tstamp, DEC);
+    debug_println(_aggr.last_packet_tstamp - _aggr.first_packet_tstamp, DEC);
     debug_print(F("Rain rate (hr): "));
-    debug_println(entry.rain_hourly, DEC);
+    debug_println(entry->rain_hourly, DEC);
 
-    FoData::add(&entry);
+    FoData::publish();
 
     clear();
     return RET_OK;
@@ -164,4 +177,25 @@ void FoBuffer::print_packet(FoDecodedPacket *packet)
     debug_printf("CRC: %02x\n", packet->checksum);
 
     debug_printf("\n######################################################################\n");
+}
+
+/******************************************************************************
+* Save buffer to RTC memory before deep sleep
+******************************************************************************/
+void FoBuffer::save_state(RetainedState *state)
+{
+    memcpy(&state->aggregate, &_aggr, sizeof(Aggregate));
+    state->prev_rain = _prev_rain;
+}
+
+/******************************************************************************
+* Restore buffer after waking up from deep sleep
+******************************************************************************/
+void FoBuffer::restore_state(const RetainedState *state)
+{
+    memcpy(&_aggr, &state->aggregate, sizeof(Aggregate));
+    if(_aggr.packet_count < 0)
+        clear();
+
+    _prev_rain = state->prev_rain;
 }
\ No newline at end of file
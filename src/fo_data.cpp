@@ -1,24 +1,53 @@
 #include "fo_data.h"
 #include "log.h"
+#include "deadband.h"
+#include "retention.h"
 
 namespace FoData
 {
 	/**
 	 * Private vars
 	 */
-	DataStore<StoreEntry> store(FO_DATA_STORE_PATH, FO_DATA_STORE_ENTRIES_PER_SUBMIT_REQ);
+	DataStore<StoreEntry> store(FO_DATA_STORE_PATH, FO_DATA_STORE_ENTRIES_PER_SUBMIT_REQ,
+		Retention::on_evict<StoreEntry, SENSOR_STORE_FO>);
 
     /** FO wakeup count */
     int _wakeup_count = 0;
 
+    /** Entry handed out by reserve(), NULL if none */
+    StoreEntry *_reserved = NULL;
+
+    /******************************************************************************
+    * Get entry to fill in place in the store buffer, added by publish()
+    ******************************************************************************/
+    FoData::StoreEntry* reserve()
+    {
+        _reserved = store.reserve();
+
+        return _reserved;
+    }
+
     /******************************************************************************
-    * Add entry to store
+    * Add entry filled in the one returned by reserve() to store
     ******************************************************************************/
-    RetResult add(FoData::StoreEntry *data)
+    RetResult publish()
     {
+        StoreEntry *data = _reserved;
+        _reserved = NULL;
+
+        if(data == NULL)
+            return RET_ERROR;
+
         data->wakeups = _wakeup_count;
 
-		RetResult ret = store.add(data);
+		// Unchanged within deadbands, left out. Wake ups keep counting to the next stored entry
+		if(!Deadband::should_store(SENSOR_STORE_FO, data))
+		{
+			store.cancel();
+			return RET_OK;
+		}
+
+		RetResult ret = store.publish();
 
 		// Commit on every add
 		store.commit();
@@ -58,4 +87,20 @@ namespace FoData
 
 		Utils::print_separator(NULL);
 	}
+
+    /******************************************************************************
+    * Get wake up count (FO wake ups since last entry)
+    ******************************************************************************/
+    int get_wakeup_count()
+    {
+        return _wakeup_count;
+    }
+
+    /******************************************************************************
+    * Set wake up count, used to restore it after deep sleep
+    ******************************************************************************/
+    void set_wakeup_count(int count)
+    {
+        _wakeup_count = count;
+    }
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_FO_SNIFFER
+
 #include "fo_sniffer.h"
 #include <SPI.h>
 #include "rtc.h"
@@ -9,16 +11,29 @@
 #include "fo_data.h"
 #include "log.h"
 #include "fo_buffer.h"
+#include "energy_profiler.h"
+#include "memory_monitor.h"
+#include "trace.h"
+#include "capture.h"
+#include <sys/time.h>
 
 namespace FoSniffer
 {
 	/**
 	 * Private functions
 	 */
-	RetResult decode_packet(uint8_t *buff, FoDecodedPacket *decoded);
-	uint8_t calc_crc(uint8_t const buff[], int len, uint8_t polynomial, uint8_t init);
-	uint8_t calc_checksum(uint8_t const buff[]);	
 	uint8_t uv_to_index(int uv);
+	void track_rx_result(RetResult ret);
+	void IRAM_ATTR on_rx_isr();
+	void rx_task(void *param);
+	void read_rx_frame();
+	uint64_t now_ms();
+	void update_timing(uint64_t rx_ms);
+	bool timing_valid();
+	uint32_t calc_rx_margin_ms();
+	uint64_t calc_next_rx_ms(uint64_t now);
+	void buffer_packet();
+	void log_timing();
 
 	/** Time of last valid packet */
 	uint32_t _last_packet_tstamp = 0;
@@ -57,6 +72,34 @@ namespace FoSniffer
 	/** Holds last X decoded packets */
 	FoBuffer _packet_buff;
 
+	/** A raw frame received in continuous RX mode */
+	struct RawFrame
+	{
+		uint32_t tstamp;
+		uint8_t data[FO_SNIFFER_FRAME_LEN];
+	};
+
+	/** Continuous RX mode active */
+	bool _continuous_rx = false;
+
+	/** Raw frames received in continuous RX mode, decoded in batches */
+	RawFrame _rx_queue[FO_SNIFFER_RX_QUEUE_LEN];
+
+	/** Index of oldest frame in queue */
+	volatile int _rx_queue_head = 0;
+
+	/** Frames in queue */
+	volatile int _rx_queue_count = 0;
+
+	/** Guards the queue, frames are added from the RX task */
+	portMUX_TYPE _rx_queue_mux = portMUX_INITIALIZER_UNLOCKED;
+
+	/** Reads frames from the RF module, notified by the DI0 ISR */
+	TaskHandle_t _rx_task = NULL;
+
+	/** Measured packet timing */
+	PacketTiming _timing = {0, FO_SNIFFER_PACKET_INTERVAL_SEC * 1000, 0, 0};
+
 	/******************************************************************************
 	 * Init
 	 *****************************************************************************/
@@ -71,8 +114,8 @@ namespace FoSniffer
 
 		if (state != ERR_NONE)
 		{
-			Serial.print(F("Could not init FSK mode, code: "));
-			Serial.println(state);
+			debug_print_e(F("Could not init FSK mode, code: "));
+			debug_println_e(state);
 
 			return RET_ERROR;
 		}
@@ -90,8 +133,8 @@ namespace FoSniffer
 
 		if (state != ERR_NONE)
 		{
-			Serial.print(F("Unable to set configuration, code "));
-			Serial.println(state);
+			debug_print_e(F("Unable to set configuration, code "));
+			debug_println_e(state);
 			return RET_ERROR;
 		}
 
@@ -109,18 +152,31 @@ namespace FoSniffer
 
 		if (_rf.setCRC(false) != ERR_NONE)
 		{
-			Serial.println(F("Could not disable crc"));
+			debug_println_e(F("Could not disable crc"));
 			return RET_ERROR;
 		}
 
 		if (_rf.setPreambleLength(5) != ERR_NONE)
 		{
-			Serial.println(F("Could not set preamble"));
+			debug_println_e(F("Could not set preamble"));
 			return RET_ERROR;
 		}
 
 		return RET_OK;
 	}
+
+	/******************************************************************************
+	 * Radio shared with LoraRelay, which switches it to LoRa mode. Sniffing needs
+	 * init() after that
+	 *****************************************************************************/
+	RFM95* get_radio()
+	{
+		pinMode(PIN_RF_DI0, INPUT);
+
+		_spi.begin(PIN_RF_SCK, PIN_RF_MISO, PIN_RF_MOSI, PIN_RF_SS);
+
+		return &_rf;
+	}
 	
 	/******************************************************************************
 	 * Calculate time left to when sniffer needs to start sniffing
@@ -140,8 +196,17 @@ namespace FoSniffer
 
 		uint32_t secs_since_last_packet = now - _last_packet_tstamp;
 
-		Serial.print(F("Seconds since last packet: "));
-		Serial.println(secs_since_last_packet, DEC);
+		debug_print(F("Seconds since last packet: "));
+		debug_println(secs_since_last_packet, DEC);
+
+		// Wake up just before the RX window of the next expected packet
+		if(timing_valid())
+		{
+			uint64_t cur_ms = now_ms();
+			int64_t ms_to_window = calc_next_rx_ms(cur_ms) - calc_rx_margin_ms() - FO_SNIFFER_TIMING_WAKE_LEAD_MS - cur_ms;
+
+			return ms_to_window > 0 ? ms_to_window / 1000 : 0;
+		}
 
 		// Divide by packet interval and count from there
 		int secs_to_next = secs_since_last_packet - ( (secs_since_last_packet / FO_SNIFFER_PACKET_INTERVAL_SEC) * FO_SNIFFER_PACKET_INTERVAL_SEC);
@@ -161,15 +226,52 @@ namespace FoSniffer
 
 	/******************************************************************************
 	 * Handle sniff event
+	 * In continuous RX mode, decode queued frames instead of sniffing
 	 *****************************************************************************/
 	RetResult handle_sniff_event()
 	{
 		RetResult ret = RET_ERROR;
 
+		if(_continuous_rx)
+		{
+			int packets = process_rx_queue();
+
+			// No packet for longer than it takes to sync
+			if(packets == 0 && RTC::get_timestamp() - _last_packet_tstamp > FO_SNIFFER_SYNC_WAIT_TIME_MS / 1000)
+			{
+				Log::log(Log::FO_SNIFFER_SNIFF_FAILED);
+				track_rx_result(RET_ERROR);
+				return RET_ERROR;
+			}
+
+			if(packets > 0)
+				track_rx_result(RET_OK);
+
+			return RET_OK;
+		}
+
 		if(_in_sync)
 		{
-			Serial.println("In sync, waiting for packet");
-			ret = sleep_to_packet(FO_SNIFFER_PACKET_WAIT_TIME_MS);
+			debug_println("In sync, waiting for packet");
+
+			uint32_t wait_ms = FO_SNIFFER_PACKET_WAIT_TIME_MS;
+			if(timing_valid())
+			{
+				// Light sleep until RX window opens and listen only for the window
+				uint64_t cur_ms = now_ms();
+				uint32_t margin_ms = calc_rx_margin_ms();
+				int64_t ms_to_window = calc_next_rx_ms(cur_ms) - margin_ms - cur_ms;
+
+				if(ms_to_window > 0)
+				{
+					esp_sleep_enable_timer_wakeup((uint64_t)ms_to_window * 1000);
+					EnergyProfiler::light_sleep();
+				}
+
+				wait_ms = margin_ms * 2;
+			}
+
+			ret = sleep_to_packet(wait_ms);
 
 			if(ret == RET_ERROR)
 			{
@@ -179,7 +281,7 @@ namespace FoSniffer
 			else
 			{
 				// Success, store packet
-				_packet_buff.add_packet(&_last_decoded_packet);
+				buffer_packet();
 				_in_sync = true;
 			}
 		}
@@ -199,7 +301,7 @@ namespace FoSniffer
 			}
 			else
 			{
-				_packet_buff.add_packet(&_last_decoded_packet);
+				buffer_packet();
 				_in_sync = true;
 				
 				Log::log(Log::FO_SNIFFER_SCAN_RESULT, _last_decoded_packet.node_address);
@@ -207,6 +309,16 @@ namespace FoSniffer
 			}
 		}
 
+		track_rx_result(ret);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Count successive RX failures, disable FO after too many
+	 *****************************************************************************/
+	void track_rx_result(RetResult ret)
+	{
 		if(ret == RET_ERROR)
 		{
 			_rx_failures++;
@@ -221,7 +333,6 @@ namespace FoSniffer
 				debug_println_e(F("FineOffset RX failures reached threshold, disabling FO weather station."));
 
 				DeviceConfig::set_fo_enabled(false);
-				DeviceConfig::commit();
 
 				Log::log(Log::FO_DISABLED_RX_FAILED, _rx_failures);
 
@@ -233,92 +344,301 @@ namespace FoSniffer
 			// Reset failure counter
 			_rx_failures = 0;
 		}
+	}
 
-		return ret;
+	/******************************************************************************
+	 * Keep RF module in continuous receive. DI0 (packet ready) wakes the RX task
+	 * which queues the raw frame, decoding is left for process_rx_queue()
+	 * Needs light sleep, pending frames are lost in deep sleep
+	 *****************************************************************************/
+	RetResult start_continuous_rx()
+	{
+		if(!DeviceConfig::get_fo_enabled() || DeviceConfig::get_fo_sniffer_id() == 0)
+		{
+			debug_println(F("FO id unknown, continuous RX not started."));
+			return RET_ERROR;
+		}
+
+		_rf.setNodeAddress(DeviceConfig::get_fo_sniffer_id());
+
+		if(_rf.startReceive(5, SX127X_RX) != ERR_NONE)
+		{
+			debug_println_e(F("Could not start RX."));
+			return RET_ERROR;
+		}
+
+		if(_rx_task == NULL)
+			xTaskCreate(rx_task, "fo_rx", 4096, NULL, 5, &_rx_task);
+
+		// Radio stays in RX from now on
+		EnergyProfiler::begin(EnergyProfiler::STATE_RF_RX);
+
+		// Level interrupt so a packet ready while asleep is still caught on wake up
+		attachInterrupt(PIN_RF_DI0, on_rx_isr, ONHIGH);
+
+		_continuous_rx = true;
+
+		debug_println(F("FO continuous RX started."));
+
+		return RET_OK;
 	}
 
 	/******************************************************************************
-	 * Decode a buffer into a FoDecodedPacket struct
+	 * Continuous RX mode active
 	 *****************************************************************************/
-	RetResult decode_packet(uint8_t *buff, FoDecodedPacket *decoded)
+	bool continuous_rx_active()
 	{
-		decoded->node_address = buff[1];
+		return _continuous_rx;
+	}
 
-		// Wind direction
-		decoded->wind_dir = ((buff[3] & 0x80) << 1) | buff[2];
+	/******************************************************************************
+	 * Enable wake up from light sleep on DI0. Must be called before each sleep,
+	 * other users of GPIO wake up disable it
+	 *****************************************************************************/
+	void arm_rx_wakeup()
+	{
+		gpio_wakeup_enable(PIN_RF_DI0, GPIO_INTR_HIGH_LEVEL);
+		esp_sleep_enable_gpio_wakeup();
+	}
 
-		// Temperature
-		uint16_t temp_raw = ((buff[3] & 0b111) << 8) | buff[4];
+	/******************************************************************************
+	 * Wait for the RX task to read the frame that woke us up
+	 * @return True if DI0 was cleared
+	 *****************************************************************************/
+	bool wait_rx_serviced()
+	{
+		uint32_t start_ms = millis();
 
-		// 10.5C = 0x1F9, -10.5C = 0x127 (val has an offset of 400 added)
-		decoded->temp = (float)(temp_raw - 400) / 10;
+		while(digitalRead(PIN_RF_DI0) && millis() - start_ms < FO_SNIFFER_RX_SERVICE_WAIT_MS)
+			delay(1);
 
-		// Humidity
-		decoded->hum = buff[5];
+		return !digitalRead(PIN_RF_DI0);
+	}
+
+	/******************************************************************************
+	 * Queue half full, frames should be decoded before it overflows
+	 *****************************************************************************/
+	bool rx_queue_half_full()
+	{
+		return _rx_queue_count >= FO_SNIFFER_RX_QUEUE_LEN / 2;
+	}
+
+	/******************************************************************************
+	 * Decode queued frames and add valid packets to buffer
+	 * @return Number of valid packets
+	 *****************************************************************************/
+	int process_rx_queue()
+	{
+		int packets = 0;
 
-		// Wind speed
-		// If wsp flag is set
-		uint8_t extra_wind_speed_bits = 0;
-		if(buff[3] & 0b1000000)
+		while(_rx_queue_count > 0)
 		{
-			// Wind speed is 9bit
-			Serial.println(F("WSP flag SET!!"));
-			extra_wind_speed_bits =  (buff[3] & 0b10000) >> 4;
+			RawFrame frame;
+
+			portENTER_CRITICAL(&_rx_queue_mux);
+			frame = _rx_queue[_rx_queue_head];
+			_rx_queue_head = (_rx_queue_head + 1) % FO_SNIFFER_RX_QUEUE_LEN;
+			_rx_queue_count--;
+			portEXIT_CRITICAL(&_rx_queue_mux);
+
+			RetResult decode_ret = decode_packet(frame.data, &_last_decoded_packet);
+
+			Capture::record(Capture::KIND_FO_FRAME, frame.data, FO_SNIFFER_FRAME_LEN, decode_ret == RET_OK);
+
+			if(decode_ret != RET_OK)
+				continue;
+
+			_last_packet_tstamp = frame.tstamp;
+			buffer_packet();
+			packets++;
 		}
-		else
+
+		debug_printf("FO frames decoded: %d\n", packets);
+
+		return packets;
+	}
+
+	/******************************************************************************
+	 * DI0 ISR. SPI can't be used here, notify RX task and mask the level
+	 * interrupt until the frame is read
+	 *****************************************************************************/
+	void IRAM_ATTR on_rx_isr()
+	{
+		BaseType_t woken = pdFALSE;
+
+		gpio_intr_disable(PIN_RF_DI0);
+		vTaskNotifyGiveFromISR(_rx_task, &woken);
+
+		if(woken)
+			portYIELD_FROM_ISR();
+	}
+
+	/******************************************************************************
+	 * RX task, reads a frame on every DI0 notification
+	 *****************************************************************************/
+	void rx_task(void *param)
+	{
+		while(true)
 		{
-			// Wind speed is 10bit
-			Serial.println(F("WSP flag NOT SET!!"));
-			extra_wind_speed_bits =  (buff[3] & 0b110000) >> 4;
-		}
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-		// decoded->wind_speed = buff[6] * FO_WIND_SPEED_COEFF;
-		decoded->wind_speed = ((extra_wind_speed_bits << 8) | buff[6]) * 0.0644;
+			read_rx_frame();
+			MemoryMonitor::sample_task(MemoryMonitor::TASK_FO_RX);
 
-		// Gust speed
-		decoded->wind_gust = buff[7] * FO_WIND_GUST_COEFF;
+			gpio_intr_enable(PIN_RF_DI0);
+		}
+	}
 
-		// Rainfaill
-		decoded->rain = ((buff[8] << 8) | buff[9]) * FO_RAIN_MM_PER_CLICK; // Convert rain counter clicks to mm
+	/******************************************************************************
+	 * Read frame from RF module into queue and restart receive. Oldest frame is
+	 * dropped if queue is full
+	 *****************************************************************************/
+	void read_rx_frame()
+	{
+		// Large enough buffer, readData ignores len (see wait_for_packet)
+		static uint8_t buff[256] = "";
 
-		// UV
-		decoded->uv = (buff[10] << 8) | buff[11];
+		buff[0] = FO_SNIFFER_FAMILY_CODE;
+		buff[1] = DeviceConfig::get_fo_sniffer_id();
 
-		// UV Index
-		decoded->uv_index = uv_to_index(decoded->uv);
+		int16_t state = _rf.readData(&buff[2], sizeof(buff) - 2);
 
-		// Illuminance (lux)
-		decoded->light = (buff[12] << 16) | (buff[13] << 8) | buff[10];
-		// Convert to lux
-		decoded->light /= 10;
+		_rf.startReceive(5, SX127X_RX);
 
-		// Solar radiation (W/m^2)
-		decoded->solar_radiation = decoded->light * FO_SNIFFER_LUX_TO_SOLAR_RADIATION_COEFF;
+		if(state != ERR_NONE)
+			return;
 
-		// CRC
-		decoded->crc = buff[15];
-		decoded->checksum = buff[16];
+		portENTER_CRITICAL(&_rx_queue_mux);
 
-		uint8_t calced_crc = calc_crc((uint8_t*)decoded, 15, 0x31, 0),
-		calced_checksum = calc_checksum((uint8_t*)decoded);
+		int tail = (_rx_queue_head + _rx_queue_count) % FO_SNIFFER_RX_QUEUE_LEN;
 
-		// Return false if integrity tests failed
-		if(decoded->crc != calc_crc(buff, 15, 0x31, 0) && decoded->checksum != calc_checksum(buff))
+		if(_rx_queue_count == FO_SNIFFER_RX_QUEUE_LEN)
 		{
-			Serial.println(F("Packet integrity check failed."));
+			_rx_queue_head = (_rx_queue_head + 1) % FO_SNIFFER_RX_QUEUE_LEN;
+			_rx_queue_count--;
+		}
 
-			Serial.printf("Packet CRC is %02x, should be %02x\n", decoded->crc, calced_crc);
-			Serial.printf("Packet checksum is %02x, should be %02x\n", decoded->checksum, calced_checksum);
+		_rx_queue[tail].tstamp = RTC::get_timestamp();
+		memcpy(_rx_queue[tail].data, buff, FO_SNIFFER_FRAME_LEN);
+		_rx_queue_count++;
 
-			return RET_ERROR;
+		portEXIT_CRITICAL(&_rx_queue_mux);
+	}
+
+	/******************************************************************************
+	 * CRC-8 (poly 0x31, init 0) lookup table, one entry per byte value
+	 *****************************************************************************/
+	static const uint8_t CRC8_TABLE[256] =
+	{
+		0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E,
+		0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D,
+		0x86, 0xB7, 0xE4, 0xD5, 0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+		0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA, 0xEB,
+		0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA, 0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13,
+		0x7E, 0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+		0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51, 0xC6, 0xF7, 0xA4, 0x95,
+		0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6,
+		0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+		0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17,
+		0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B, 0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2,
+		0xBF, 0x8E, 0xDD, 0xEC, 0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+		0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0x0B, 0x58, 0x69,
+		0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93, 0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A,
+		0xC1, 0xF0, 0xA3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+		0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68, 0xFF, 0xCE, 0x9D, 0xAC
+	};
+
+	/** Over the air frame layout, FO_SNIFFER_FRAME_LEN bytes */
+	struct FrameView
+	{
+		uint8_t family;
+		uint8_t node_address;
+		uint8_t wind_dir_lo;
+
+		// Bit 7: wind dir bit 8, Bit 6: WSP flag, Bits 5-4: wind speed bits 9-8
+		// (only bit 4 when WSP is set), Bits 2-0: temperature bits 10-8
+		uint8_t flags;
+
+		uint8_t temp_lo;
+		uint8_t hum;
+		uint8_t wind_speed_lo;
+		uint8_t wind_gust;
+		uint8_t rain[2];
+		uint8_t uv[2];
+		uint8_t light[3];
+
+		// CRC of the first 15 bytes, checksum of the first 16
+		uint8_t crc;
+		uint8_t checksum;
+	}__attribute__((packed));
+
+	static_assert(sizeof(FrameView) == FO_SNIFFER_FRAME_LEN, "FrameView does not match frame length");
+
+	/******************************************************************************
+	 * Decode a buffer into a FoDecodedPacket struct
+	 * CRC and checksum are calculated in a single pass before decoding
+	 *****************************************************************************/
+	RetResult decode_packet(const uint8_t *buff, FoDecodedPacket *decoded)
+	{
+		const FrameView *frame = (const FrameView*)buff;
+
+		uint8_t crc = 0, checksum = 0;
+		for(int i = 0; i < (int)offsetof(FrameView, crc); i++)
+		{
+			crc = CRC8_TABLE[crc ^ buff[i]];
+			checksum += buff[i];
 		}
-		else
+		checksum += frame->crc;
+
+		// Packet is accepted when either integrity test passes
+		if(frame->crc != crc && frame->checksum != checksum)
 		{
-			Serial.println(F("Packet integrity OK"));
-			return RET_OK;
+			debug_println_e(F("Packet integrity check failed."));
+			debug_printf("Packet CRC is %02x, should be %02x\n", frame->crc, crc);
+			debug_printf("Packet checksum is %02x, should be %02x\n", frame->checksum, checksum);
+
+			return RET_ERROR;
 		}
 
-		// Success
+		decoded->node_address = frame->node_address;
+
+		// Wind direction
+		decoded->wind_dir = ((frame->flags & 0x80) << 1) | frame->wind_dir_lo;
+
+		// Temperature
+		// 10.5C = 0x1F9, -10.5C = 0x127 (val has an offset of 400 added)
+		uint16_t temp_raw = ((frame->flags & 0b111) << 8) | frame->temp_lo;
+		decoded->temp = (float)(temp_raw - 400) / 10;
+
+		// Humidity
+		decoded->hum = frame->hum;
+
+		// Wind speed is 9bit when WSP flag is set, 10bit otherwise
+		uint8_t wind_speed_hi_mask = 0b11 >> ((frame->flags >> 6) & 1);
+		uint8_t extra_wind_speed_bits = (frame->flags >> 4) & wind_speed_hi_mask;
+		decoded->wind_speed = ((extra_wind_speed_bits << 8) | frame->wind_speed_lo) * 0.0644;
+
+		// Gust speed
+		decoded->wind_gust = frame->wind_gust * FO_WIND_GUST_COEFF;
+
+		// Rainfaill
+		decoded->rain = ((frame->rain[0] << 8) | frame->rain[1]) * FO_RAIN_MM_PER_CLICK; // Convert rain counter clicks to mm
+
+		// UV
+		decoded->uv = (frame->uv[0] << 8) | frame->uv[1];
+
+		// UV Index
+		decoded->uv_index = uv_to_index(decoded->uv);
+
+		// Illuminance, converted to lux
+		decoded->light = ((frame->light[0] << 16) | (frame->light[1] << 8) | frame->light[2]) / 10;
+
+		// Solar radiation (W/m^2)
+		decoded->solar_radiation = decoded->light * FO_SNIFFER_LUX_TO_SOLAR_RADIATION_COEFF;
+
+		decoded->crc = frame->crc;
+		decoded->checksum = frame->checksum;
+
 		return RET_OK;
 	}
 
@@ -338,11 +658,11 @@ namespace FoSniffer
 		state = _rf.startReceive(5, SX127X_RX);
 		if(state != ERR_NONE)
 		{
-			Serial.println(F("Could not start RX."));
+			debug_println_e(F("Could not start RX."));
 			return RET_ERROR;
 		}
 
-		Serial.println(F("Going to sleep until packet receive INT fires..."));
+		debug_println(F("Going to sleep until packet receive INT fires..."));
 		Serial.flush();
 		
 		// Set up external INT on DI0 pin and a timer at the same time
@@ -350,19 +670,23 @@ namespace FoSniffer
 		Serial.flush();
 		esp_sleep_enable_timer_wakeup((uint64_t)max_sleep_ms * 1000);
 		esp_sleep_enable_ext0_wakeup(PIN_RF_DI0, 1);
-		esp_light_sleep_start();
+
+		EnergyProfiler::begin(EnergyProfiler::STATE_RF_RX);
+		EnergyProfiler::light_sleep();
+		EnergyProfiler::end(EnergyProfiler::STATE_RF_RX);
 		
+		uint64_t rx_ms = now_ms();
 		esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
 
 		if(wakeup_cause == esp_sleep_wakeup_cause_t::ESP_SLEEP_WAKEUP_TIMER)
 		{
-			Serial.println(F("Timeout wakeup."));
+			debug_println(F("Timeout wakeup."));
 
 			return RET_ERROR;
 		}
 		else if(wakeup_cause == esp_sleep_wakeup_cause_t::ESP_SLEEP_WAKEUP_EXT0)
 		{
-			Serial.println(F("INT wakeup."));
+			debug_println(F("INT wakeup."));
 
 			_rf.setNodeAddress(DeviceConfig::get_fo_sniffer_id());
 			state = _rf.readData((uint8_t*)&buff[2], sizeof(buff)-2);
@@ -370,26 +694,32 @@ namespace FoSniffer
 			buff[0] = FO_SNIFFER_FAMILY_CODE;
 			buff[1] = DeviceConfig::get_fo_sniffer_id();
 
-			Serial.printf("\n\n########################## RAW PACKET ###############################\n");
-			Utils::print_buff_hex(buff, 30);
-			Serial.printf("\n\n#####################################################################\n");
-			Serial.println();
+			if(debug_level_enabled(LOG_LEVEL_TRACE))
+			{
+				debug_printf_t("\n\n########################## RAW PACKET ###############################\n");
+				Utils::print_buff_hex(buff, 30);
+				debug_printf_t("\n\n#####################################################################\n");
+				debug_println_t();
+			}
 
 			RetResult decode_ret = decode_packet(buff, &_last_decoded_packet);
 
+			Capture::record(Capture::KIND_FO_FRAME, buff, FO_SNIFFER_FRAME_LEN, decode_ret == RET_OK);
+
 			if(decode_ret != RET_ERROR)
 			{
 				FoBuffer::print_packet(&_last_decoded_packet);
 
 				// Update time of last received packet
 				_last_packet_tstamp = RTC::get_timestamp();
+				update_timing(rx_ms);
 			}
 
 			return decode_ret;
 		}
 		else
 		{
-			Serial.println(F("Invalid wakeup"));
+			debug_println_e(F("Invalid wakeup"));
 			return RET_ERROR;
 		}
 
@@ -403,6 +733,8 @@ namespace FoSniffer
 	 *****************************************************************************/
 	RetResult wait_for_packet(uint32_t timeout_ms, bool ignore_address)
 	{
+		Trace::Span span(Trace::SPAN_FO_RX);
+
 		uint32_t wait_start_millis = millis();
 
 		while(millis() - wait_start_millis < timeout_ms)
@@ -436,16 +768,18 @@ namespace FoSniffer
 			
 			if (state == ERR_NONE)
 			{
-				Serial.println(F("Packet received!"));
+				debug_println(F("Packet received!"));
 				Serial.flush();
 
 				// If valid packet received print and return
 				// In case of invalid packets, nothing is done. Waiting to receive more data
 				RetResult decode_ret = decode_packet(buff, &_last_decoded_packet);
+
+				Capture::record(Capture::KIND_FO_FRAME, buff, FO_SNIFFER_FRAME_LEN, decode_ret == RET_OK);
 				
 				if(decode_ret != RET_ERROR)
 				{
-					Serial.println(F("Received OK"));
+					debug_println(F("Received OK"));
 
 					debug_print(F("Node: "))
 					debug_println_i(_last_decoded_packet.node_address, HEX);
@@ -455,10 +789,13 @@ namespace FoSniffer
 					_last_packet_tstamp = RTC::get_timestamp();
 				}
 
-				Serial.printf("\n\n########################## RAW PACKET ###############################\n");
-				Utils::print_buff_hex(buff, 30);
-				Serial.printf("\n\n#####################################################################\n");
-				Serial.println();
+				if(debug_level_enabled(LOG_LEVEL_TRACE))
+				{
+					debug_printf_t("\n\n########################## RAW PACKET ###############################\n");
+					Utils::print_buff_hex(buff, 30);
+					debug_printf_t("\n\n#####################################################################\n");
+					debug_println_t();
+				}
 
 				return decode_ret;
 			}
@@ -471,14 +808,14 @@ namespace FoSniffer
 			{
 				// Internan CRC check works only in packet mode - not used
 				// CRC is instead calculated manually
-				Serial.println(F("CRC error!"));
+				debug_println_e(F("CRC error!"));
 
 				return RET_ERROR;
 			}
 			else
 			{
-				Serial.print(F("Failed, code "));
-				Serial.println(state);
+				debug_print_e(F("Failed, code "));
+				debug_println_e(state);
 
 				return RET_ERROR;
 			}
@@ -536,14 +873,13 @@ namespace FoSniffer
 				{
 					debug_println(F("Saving new FO address"));
 					DeviceConfig::set_fo_sniffer_id(ret);
-					DeviceConfig::commit();
 				}
 
 				break;
 			}
 			else
 			{
-				Serial.println(F("No FO weather station found."));
+				debug_println_w(F("No FO weather station found."));
 
 				ret = 0;
 			}
@@ -567,42 +903,127 @@ namespace FoSniffer
 	******************************************************************************/
 	RetResult commit_buffer()
 	{
+		if(_continuous_rx)
+			process_rx_queue();
+
+		if(_packet_buff.get_packet_count() > 0)
+			log_timing();
+
 		return _packet_buff.commit_buffer();
 	}
 
 	/******************************************************************************
-	 * Calculate CRC
-	 *****************************************************************************/
-	uint8_t calc_crc(uint8_t const buff[], int len, uint8_t polynomial, uint8_t init)
+	* Add last decoded packet to buffer. Buffer commits itself when aggregate
+	* interval has passed, timing stats are logged along
+	******************************************************************************/
+	void buffer_packet()
+	{
+		_packet_buff.add_packet(&_last_decoded_packet);
+
+		if(_packet_buff.get_packet_count() == 0)
+			log_timing();
+	}
+
+	/******************************************************************************
+	* Log packet timing stats
+	******************************************************************************/
+	void log_timing()
 	{
-		uint8_t remainder = init;
+		uint32_t jitter_ms = sqrt(_timing.jitter_var);
+		uint32_t margin_ms = calc_rx_margin_ms();
+
+		debug_printf("FO timing: interval %.1f ms, jitter %u ms, RX margin %u ms, samples %u\n",
+			_timing.interval_ms, jitter_ms, margin_ms, _timing.samples);
 
-		for (int i = 0; i < len; ++i)
+		Log::log(Log::FO_SNIFFER_TIMING, _timing.interval_ms * 1000, (jitter_ms & 0xFFFF) | (margin_ms << 16));
+	}
+
+	/******************************************************************************
+	* System time in ms. Kept by the RTC timer over light and deep sleep
+	******************************************************************************/
+	uint64_t now_ms()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+
+		return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	/******************************************************************************
+	* Update fitted interval and arrival jitter with a received packet
+	* Arrival error is the difference from the time predicted by the fit, the
+	* interval is nudged by its share per elapsed packet period
+	* @param rx_ms Time the packet was received
+	******************************************************************************/
+	void update_timing(uint64_t rx_ms)
+	{
+		const float nominal_ms = FO_SNIFFER_PACKET_INTERVAL_SEC * 1000;
+
+		if(_timing.last_rx_ms != 0 && rx_ms > _timing.last_rx_ms)
 		{
-			remainder ^= buff[i];
-			for (int j = 0; j < 8; ++j)
+			float gap_ms = rx_ms - _timing.last_rx_ms;
+			int periods = (int)(gap_ms / _timing.interval_ms + 0.5);
+			float error_ms = gap_ms - periods * _timing.interval_ms;
+
+			// Too many missed packets or error too large (eg. clock updated), start over
+			if(periods < 1 || periods > FO_SNIFFER_TIMING_MAX_GAP_PACKETS || fabs(error_ms) > _timing.interval_ms / 4)
+			{
+				_timing.interval_ms = nominal_ms;
+				_timing.jitter_var = 0;
+				_timing.samples = 0;
+			}
+			else
 			{
-				if (remainder & 0x80)
-					remainder = (remainder << 1) ^ polynomial;
+				_timing.interval_ms += FO_SNIFFER_TIMING_ALPHA * error_ms / periods;
+				_timing.interval_ms = constrain(_timing.interval_ms, nominal_ms - FO_SNIFFER_TIMING_MAX_DRIFT_MS,
+					nominal_ms + FO_SNIFFER_TIMING_MAX_DRIFT_MS);
+
+				// First error seeds the variance
+				if(_timing.samples == 0)
+					_timing.jitter_var = error_ms * error_ms;
 				else
-					remainder = (remainder << 1);
+					_timing.jitter_var += FO_SNIFFER_TIMING_ALPHA * (error_ms * error_ms - _timing.jitter_var);
+
+				if(_timing.samples < UINT16_MAX)
+					_timing.samples++;
 			}
 		}
-		return remainder;
+
+		_timing.last_rx_ms = rx_ms;
 	}
 
 	/******************************************************************************
-	 * Calculate checksum
-	 *****************************************************************************/
-	uint8_t calc_checksum(uint8_t const buff[])
+	* Enough packets received for the RX window to be sized from measured timing
+	******************************************************************************/
+	bool timing_valid()
 	{
-		uint8_t checksum = 0;
-		for (int i = 0; i < 16; i++)
-		{
-			checksum += buff[i];
-		}
-		
-		return checksum;
+		return _in_sync && _timing.samples >= FO_SNIFFER_TIMING_MIN_SAMPLES;
+	}
+
+	/******************************************************************************
+	* RX margin on each side of expected arrival. A few std devs of arrival error,
+	* never more than the fixed early wake up
+	******************************************************************************/
+	uint32_t calc_rx_margin_ms()
+	{
+		if(_timing.samples < FO_SNIFFER_TIMING_MIN_SAMPLES)
+			return FO_SNIFFER_WAIT_PACKET_EARLY_WAKEUP_SEC * 1000;
+
+		uint32_t margin_ms = FO_SNIFFER_RX_MARGIN_SIGMAS * sqrt(_timing.jitter_var) + FO_SNIFFER_RX_MARGIN_MIN_MS;
+
+		return min(margin_ms, (uint32_t)FO_SNIFFER_WAIT_PACKET_EARLY_WAKEUP_SEC * 1000);
+	}
+
+	/******************************************************************************
+	* Expected arrival time of the first packet whose RX window has not closed yet
+	******************************************************************************/
+	uint64_t calc_next_rx_ms(uint64_t now)
+	{
+		uint32_t margin_ms = calc_rx_margin_ms();
+		uint64_t since_last_ms = now > _timing.last_rx_ms ? now - _timing.last_rx_ms : 0;
+		uint32_t periods = (since_last_ms + margin_ms) / _timing.interval_ms + 1;
+
+		return _timing.last_rx_ms + (uint64_t)(periods * _timing.interval_ms);
 	}
 
 	/******************************************************************************
@@ -651,24 +1072,52 @@ namespace FoSniffer
 	 *****************************************************************************/
 	void print_packet(FoDecodedPacket *packet)
 	{
-		Serial.printf("\n\n########################## DECODED PACKET ###########################\n");
+		debug_printf_t("\n\n########################## DECODED PACKET ###########################\n");
 
 		FoDecodedPacket decoded = {0};
 
-		Serial.printf("Temperature: %2.1fC\n", packet->temp);
-		Serial.printf("Humidity: %d\n%", packet->hum);
-		Serial.printf("Rain: %4.2fmm\n", packet->rain);
+		debug_printf_t("Temperature: %2.1fC\n", packet->temp);
+		debug_printf_t("Humidity: %d\n%", packet->hum);
+		debug_printf_t("Rain: %4.2fmm\n", packet->rain);
+
+		debug_printf_t("Wind speed: %2.2f\n", packet->wind_speed);
+		debug_printf_t("Wind Dir: %d\n", packet->wind_dir);
+		debug_printf_t("Wind Gust: %2.2f\n", packet->wind_gust);
 
-		Serial.printf("Wind speed: %2.2f\n", packet->wind_speed);
-		Serial.printf("Wind Dir: %d\n", packet->wind_dir);
-		Serial.printf("Wind Gust: %2.2f\n", packet->wind_gust);
+		debug_printf_t("UV: %d\n", packet->uv);
+		debug_printf_t("Light: %d\n", packet->light);
 
-		Serial.printf("UV: %d\n", packet->uv);
-		Serial.printf("Light: %d\n", packet->light);
+		debug_printf_t("CRC: %02x\n", packet->crc);
+		debug_printf_t("CRC: %02x\n", packet->checksum);
 
-		Serial.printf("CRC: %02x\n", packet->crc);
-		Serial.printf("CRC: %02x\n", packet->checksum);
+		debug_printf_t("\n######################################################################\n");
+	}
+
+	/******************************************************************************
+	 * Save state to RTC memory before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->last_packet_tstamp = _last_packet_tstamp;
+		state->in_sync = _in_sync;
+		state->rx_failures = _rx_failures;
+		state->last_sync_tstamp = _last_sync_tstamp;
+		state->timing = _timing;
+
+		_packet_buff.save_state(&state->packet_buff);
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_last_packet_tstamp = state->last_packet_tstamp;
+		_in_sync = state->in_sync;
+		_rx_failures = state->rx_failures;
+		_last_sync_tstamp = state->last_sync_tstamp;
+		_timing = state->timing;
 
-		Serial.printf("\n######################################################################\n");
+		_packet_buff.restore_state(&state->packet_buff);
 	}
 }
\ No newline at end of file
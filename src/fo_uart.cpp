@@ -1,9 +1,14 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_FO_UART
+
 #include "fo_uart.h"
 #include "common.h"
 #include "rtc.h"
 #include "fo_data.h"
 #include "fo_buffer.h"
 #include "device_config.h"
+#include "log.h"
+#include "capture.h"
+#include <driver/uart.h>
 
 namespace FoUart
 {
@@ -22,6 +27,17 @@ namespace FoUart
 	 */ 
 	uint8_t _rx_failures = 0;
 
+	/** UART driver event queue, valid while a packet is requested */
+	QueueHandle_t _events = NULL;
+
+	/**
+	 * Private functions
+	 */
+	int match_field(const char *name, size_t len);
+	void set_field(int field, float value);
+	RetResult begin_uart();
+	int read_line(char *buff, size_t size, uint32_t timeout_ms);
+
     /******************************************************************************
 	 * Init
 	 *****************************************************************************/
@@ -47,8 +63,8 @@ namespace FoUart
 
 		uint32_t secs_since_last_packet = now - _last_packet_tstamp;
 
-		Serial.print(F("Seconds since last packet: "));
-		Serial.println(secs_since_last_packet, DEC);
+		debug_print(F("Seconds since last packet: "));
+		debug_println(secs_since_last_packet, DEC);
 
 		// Divide by packet interval and count from there
 		int secs_to_next = secs_since_last_packet - ( (secs_since_last_packet / FO_SNIFFER_PACKET_INTERVAL_SEC) * FO_SNIFFER_PACKET_INTERVAL_SEC);
@@ -64,6 +80,186 @@ namespace FoUart
 		}
     }
 
+    /******************************************************************************
+    * Match a response param name to its field. Names are told apart by their first
+    * chars and only the candidate is compared in full
+	* @return Field, -1 if name is unknown
+    ******************************************************************************/
+	int match_field(const char *name, size_t len)
+	{
+		int field = -1;
+
+		switch(name[0])
+		{
+			case 'W':
+				// WindDir, WindSpeed, WindGust
+				if(len > 4)
+				{
+					switch(name[4])
+					{
+						case 'D': field = FO_UART_FIELD_WIND_DIR; break;
+						case 'S': field = FO_UART_FIELD_WIND_SPEED; break;
+						case 'G': field = FO_UART_FIELD_WIND_GUST; break;
+					}
+				}
+				break;
+			case 'T': field = FO_UART_FIELD_TEMP; break;
+			case 'H': field = FO_UART_FIELD_HUMIDITY; break;
+			case 'L': field = FO_UART_FIELD_LIGHT; break;
+			case 'U': field = FO_UART_FIELD_UV_INDEX; break;
+			case 'R': field = FO_UART_FIELD_RAIN_COUNTER; break;
+		}
+
+		if(field < 0 || strlen(FO_UART_RESPONSE_PARAM_NAMES[field]) != len ||
+			strncmp(name, FO_UART_RESPONSE_PARAM_NAMES[field], len) != 0)
+		{
+			return -1;
+		}
+
+		return field;
+	}
+
+    /******************************************************************************
+    * Parse a "<name> = <value>" response line
+	* @param field Receives the matched field, -1 if name is unknown
+	* @return False if line is not in the expected format
+    ******************************************************************************/
+	bool parse_line(const char *line, int *field, float *value)
+	{
+		const char *name = line;
+		while(isspace(*name))
+			name++;
+
+		const char *name_end = name;
+		while(*name_end && !isspace(*name_end) && *name_end != '=')
+			name_end++;
+
+		const char *p = name_end;
+		while(isspace(*p))
+			p++;
+
+		if(name_end == name || *p != '=')
+			return false;
+
+		char *value_end = NULL;
+		*value = strtof(p + 1, &value_end);
+		if(value_end == p + 1)
+			return false;
+
+		*field = match_field(name, name_end - name);
+		return true;
+	}
+
+    /******************************************************************************
+    * Set a field of the last decoded packet from its response value
+    ******************************************************************************/
+	void set_field(int field, float value)
+	{
+		switch(field)
+		{
+			case FO_UART_FIELD_WIND_DIR:
+				_last_decoded_packet.wind_dir = value;
+				break;
+			case FO_UART_FIELD_WIND_SPEED:
+				_last_decoded_packet.wind_speed = value * FO_WIND_SPEED_COEFF;
+				break;
+			case FO_UART_FIELD_WIND_GUST:
+				_last_decoded_packet.wind_gust = value * FO_WIND_GUST_COEFF;
+				break;
+			case FO_UART_FIELD_TEMP:
+				_last_decoded_packet.temp = value / 10;
+				break;
+			case FO_UART_FIELD_HUMIDITY:
+				_last_decoded_packet.hum = value;
+				break;
+			case FO_UART_FIELD_LIGHT:
+				_last_decoded_packet.light = value * 10;
+				break;
+			case FO_UART_FIELD_UV_INDEX:
+				_last_decoded_packet.uv_index = value;
+				break;
+			case FO_UART_FIELD_RAIN_COUNTER:
+				_last_decoded_packet.rain = value * FO_RAIN_MM_PER_CLICK;
+				break;
+		}
+	}
+
+    /******************************************************************************
+    * Install UART driver with an event queue, <LF> detection raises an event for
+	* every response line
+    ******************************************************************************/
+	RetResult begin_uart()
+	{
+		uart_config_t config = {};
+		config.baud_rate = FO_UART_BAUD_RATE;
+		config.data_bits = UART_DATA_8_BITS;
+		config.parity = UART_PARITY_DISABLE;
+		config.stop_bits = UART_STOP_BITS_1;
+		config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+
+		uart_port_t port = (uart_port_t)FO_UART_PORT;
+		uart_param_config(port, &config);
+		uart_set_pin(port, UART_PIN_NO_CHANGE, PIN_FO_UART_RX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+
+		if(uart_driver_install(port, FO_UART_RX_BUFF_SIZE, 0, FO_UART_EVENT_QUEUE_SIZE, &_events, 0) != ESP_OK)
+		{
+			debug_println_e(F("Could not install FO UART driver."));
+			return RET_ERROR;
+		}
+
+		uart_enable_pattern_det_intr(port, '\n', 1, 9, 0, 0);
+		uart_pattern_queue_reset(port, FO_UART_EVENT_QUEUE_SIZE);
+
+		return RET_OK;
+	}
+
+    /******************************************************************************
+    * Read next response line. Task blocks on the UART event queue until a line
+	* is received, the CPU is free in the meantime
+	* @param buff Receives the line, null terminated
+	* @param timeout_ms Max time to wait
+	* @return Line length, -1 on timeout
+    ******************************************************************************/
+	int read_line(char *buff, size_t size, uint32_t timeout_ms)
+	{
+		uart_port_t port = (uart_port_t)FO_UART_PORT;
+		uart_event_t event;
+
+		if(xQueueReceive(_events, &event, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+			return -1;
+
+		if(event.type != UART_PATTERN_DET)
+		{
+			// Overflow, drop what was received so far
+			if(event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+			{
+				uart_flush_input(port);
+				xQueueReset(_events);
+			}
+			return 0;
+		}
+
+		int pos = uart_pattern_pop_pos(port);
+		if(pos < 0)
+		{
+			uart_flush_input(port);
+			uart_pattern_queue_reset(port, FO_UART_EVENT_QUEUE_SIZE);
+			return 0;
+		}
+
+		size_t line_len = pos + 1;
+		size_t len = line_len < size ? line_len : size - 1;
+		len = uart_read_bytes(port, (uint8_t*)buff, len, 0);
+
+		// Discard what did not fit
+		uint8_t c;
+		for(size_t i = len; i < line_len; i++)
+			uart_read_bytes(port, &c, 1, 0);
+
+		buff[len] = '\0';
+		return len;
+	}
+
     /******************************************************************************
     * Request Weather Station to output data via UART by toggling pin
 	* @return True when packet fully received, false when packet not received or
@@ -71,7 +267,10 @@ namespace FoUart
     ******************************************************************************/
 	RetResult request_packet()
 	{
-		Serial.println(F("Requesting data from FO weather station (UART)."));
+		debug_println(F("Requesting data from FO weather station (UART)."));
+
+		if(begin_uart() != RET_OK)
+			return RET_ERROR;
 
 		// Setting request pin to HIGH makes the weather station output data via UART
 		// Data can be requested only once every 16sec
@@ -81,137 +280,57 @@ namespace FoUart
 		delay(10);
 		digitalWrite(PIN_FO_UART_REQ_DATA, 1);
 
-		HardwareSerial uart(FO_UART_PORT);
-		uart.begin(9600, SERIAL_8N1, PIN_FO_UART_RX, 999, false, FO_UART_RX_TIMEOUT_MS);
-
 		// Rx buffer, must fit 1 line of response
 		char buff[128] = "";
 
-		// Index of current parsed field in param array
-		// int cur_field_index = 0;
-
 		// Number of recognized params found so far
 		int found_param_count = 0;
 
-		// Return result
-		RetResult ret = RET_ERROR;
-
-		// Break reading loops
-		bool break_read = false;
-
 		// Receive data until done or timeout
 		uint32_t start_ms = millis();
-		while(millis() - start_ms < FO_UART_RX_TIMEOUT_MS)
+		uint32_t elapsed_ms = 0;
+		while(found_param_count < FO_UART_PARAM_COUNT && (elapsed_ms = millis() - start_ms) < FO_UART_RX_TIMEOUT_MS)
 		{
-			if(break_read)
-			{
+			int len = read_line(buff, sizeof(buff), FO_UART_RX_TIMEOUT_MS - elapsed_ms);
+			if(len < 0)
 				break;
-			}
-
-			if(!uart.available())
+			if(len == 0)
 				continue;
-			int len = 0;
-			
-			// while(len = uart.readBytes(buff, sizeof(buff)-1))
-			uart.setTimeout(FO_UART_RX_TIMEOUT_MS);
-			while((len = uart.readBytesUntil('\n', buff, sizeof(buff)-1)))
-			{
-				buff[len] = '\0';
-
-				// Print received line
-				// debug_println(buff);
 
-				// Skip until first field is found
-				char param_name[25] = "";
-				// const char *param_name = FO_UART_RESPONSE_PARAM_NAMES[cur_field_index];
-				float param_val = 0;
+			// At first, skip lines until first field found. After that every line is
+			// expected to hold a param, otherwise fail
+			int field = -1;
+			float value = 0;
+			bool parsed = parse_line(buff, &field, &value);
 
-				// Build format string eg. "WindDir = %f"
-				// snprintf(format, sizeof(format), "%s = %%f", param_name);
+			Capture::record(Capture::KIND_FO_UART_LINE, buff, len, parsed && field >= 0);
 
-				// Parse from current response line
-				// At first, skip lines until first field found. After that fields are expected
-				// to be returned one by one in the order specified by param array, otherwise fail
-				int found = sscanf(buff, "%s = %f", param_name, &param_val);
-
-				if(found == 0)
-				{
-					if(found_param_count == 0)
-					{
-						// Still looking for start, keep looking
-						memset(buff, 0, sizeof(buff));
-						continue;
-					}
-					else
-					{
-						// Next value is not what was expected, fail
-						ret = RET_ERROR;
-						break_read = true;
+			if(!parsed)
+			{
+				if(found_param_count == 0)
+					continue;
 
-						debug_println_e(F("No param returned or invalid format."));
-						Log::log(Log::FO_ERROR_UNEXPECTED_VALUE, found_param_count);
+				debug_println_e(F("No param returned or invalid format."));
+				Log::log(Log::FO_ERROR_UNEXPECTED_VALUE, found_param_count);
 
-						debug_println(F("Found params: "));
-						debug_println(found_param_count, DEC);
+				debug_println(F("Found params: "));
+				debug_println(found_param_count, DEC);
+				break;
+			}
 
-						memset(buff, 0, sizeof(buff));
+			// Unknown param, ignore
+			if(field < 0)
+				continue;
 
-						break;
-					}
-				}
-				// Parsed both param & value
-				else if(found == 2)
-				{
-					found_param_count++;
+			set_field(field, value);
+			found_param_count++;
+		}
 
-					if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_WIND_DIR]) == 0)
-					{
-						_last_decoded_packet.wind_dir = param_val;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_WIND_SPEED]) == 0)
-					{
-						_last_decoded_packet.wind_speed = param_val * FO_WIND_SPEED_COEFF;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_WIND_GUST]) == 0)
-					{
-						_last_decoded_packet.wind_gust = param_val * FO_WIND_GUST_COEFF;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_TEMP]) == 0)
-					{
-						_last_decoded_packet.temp = (float)param_val/10;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_HUMIDITY]) == 0)
-					{
-						_last_decoded_packet.hum = param_val;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_LIGHT]) == 0)
-					{
-						_last_decoded_packet.light = param_val * 10;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_UV_INDEX]) == 0)
-					{
-						_last_decoded_packet.uv_index = param_val;
-					}
-					else if(strcmp(param_name, FO_UART_RESPONSE_PARAM_NAMES[FO_UART_FIELD_RAIN_COUNTER]) == 0)
-					{
-						_last_decoded_packet.rain = param_val * FO_RAIN_MM_PER_CLICK;
-					}
-					else
-					{
-						// Unknown param, decrease count
-						found_param_count--;
-					}
+		uart_driver_delete((uart_port_t)FO_UART_PORT);
 
-					if(found_param_count == FO_UART_PARAM_COUNT)
-					{
-						// All params read, break
-						Serial.println(F("All FO params read, stopping."));
-						break_read = true;
-						break;
-					}
-				}
-			}
-		}
+		// Reset request pin back to 0 otherwise weather station will output data immediately when
+		// available
+		digitalWrite(PIN_FO_UART_REQ_DATA, 0);
 
 		// Calculate derived values
 		_last_decoded_packet.solar_radiation = _last_decoded_packet.light * FO_SNIFFER_LUX_TO_SOLAR_RADIATION_COEFF;
@@ -223,21 +342,15 @@ namespace FoUart
 			debug_println_e(found_param_count, DEC);
 			Log::log(Log::FO_ERROR_INVALID_PARAM_COUNT, found_param_count);
 
-			ret = RET_ERROR;
+			return RET_ERROR;
 		}
-		else
-		{
-			ret = RET_OK;
 
-			// Update time of last received packet
-			_last_packet_tstamp = RTC::get_timestamp();
-		}
+		debug_println(F("All FO params read."));
 
-		// Reset request pin back to 0 otherwise weather station will output data immediately when
-		// available
-		digitalWrite(PIN_FO_UART_REQ_DATA, 0);
+		// Update time of last received packet
+		_last_packet_tstamp = RTC::get_timestamp();
 
-		return ret;
+		return RET_OK;
 	}
 
 	/******************************************************************************
@@ -248,7 +361,7 @@ namespace FoUart
 	{
 		if(RET_OK == FoUart::request_packet())
 		{
-			Serial.println(F("Packet received!"));
+			debug_println(F("Packet received!"));
 			FoBuffer::print_packet(FoUart::get_last_packet());
 
 			_packet_buff.add_packet(&_last_decoded_packet);
@@ -272,7 +385,6 @@ namespace FoUart
 				debug_println_e(F("FineOffset RX failures reached threshold, disabling FO weather station."));
 
 				DeviceConfig::set_fo_enabled(false);
-				DeviceConfig::commit();
 
 				Log::log(Log::FO_DISABLED_RX_FAILED, _rx_failures);
 
@@ -298,4 +410,26 @@ namespace FoUart
 	{
 		return _packet_buff.commit_buffer();
 	}
+
+	/******************************************************************************
+	 * Save state to RTC memory before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->last_packet_tstamp = _last_packet_tstamp;
+		state->rx_failures = _rx_failures;
+
+		_packet_buff.save_state(&state->packet_buff);
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_last_packet_tstamp = state->last_packet_tstamp;
+		_rx_failures = state->rx_failures;
+
+		_packet_buff.restore_state(&state->packet_buff);
+	}
 }
\ No newline at end of file
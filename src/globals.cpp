@@ -1,3 +1,144 @@
 #include "globals.h"
+#include "freertos/FreeRTOS.h"
+#include "common.h"
 
-char g_resp_buffer[GLOBAL_HTTP_RESPONSE_BUFFER_LEN] = "";
\ No newline at end of file
+namespace Scratch
+{
+    //
+    // Private vars
+    //
+    uint8_t _arena[SCRATCH_ARENA_SIZE] __attribute__((aligned(8)));
+
+    /** Region allocations are made from, _arena unless moved by use_region() */
+    uint8_t *_region = _arena;
+    size_t _size = SCRATCH_ARENA_SIZE;
+
+    /** Bytes in use, next allocation starts here */
+    size_t _top = 0;
+
+    /** Max bytes in use since boot */
+    size_t _peak = 0;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    /******************************************************************************
+     * Start a scope, marks current top of arena
+     *****************************************************************************/
+    Scope::Scope()
+    {
+        _mark = _top;
+    }
+
+    /******************************************************************************
+     * End a scope, everything allocated since it started is freed
+     *****************************************************************************/
+    Scope::~Scope()
+    {
+        portENTER_CRITICAL(&_mux);
+        _top = _mark;
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    /******************************************************************************
+     * Allocate from arena, 8 byte aligned
+     * @return NULL if arena has no room
+     *****************************************************************************/
+    void* alloc(size_t size)
+    {
+        size = (size + 7) & ~7;
+
+        void *ptr = NULL;
+
+        portENTER_CRITICAL(&_mux);
+        if(size <= _size - _top)
+        {
+            ptr = _region + _top;
+            _top += size;
+
+            if(_top > _peak)
+                _peak = _top;
+        }
+        portEXIT_CRITICAL(&_mux);
+
+        if(ptr == NULL)
+        {
+            debug_printf_e("Scratch arena full, requested: %u, used: %u\n", size, _top);
+        }
+
+        return ptr;
+    }
+
+    /******************************************************************************
+     * Allocate from another region (see Psram), only while nothing is allocated
+     * @param region 8 byte aligned, kept until reboot
+     * @return RET_ERROR if arena is in use
+     *****************************************************************************/
+    RetResult use_region(void *region, size_t size)
+    {
+        RetResult ret = RET_ERROR;
+
+        portENTER_CRITICAL(&_mux);
+        if(_top == 0)
+        {
+            _region = (uint8_t*)region;
+            _size = size;
+            ret = RET_OK;
+        }
+        portEXIT_CRITICAL(&_mux);
+
+        return ret;
+    }
+
+    /******************************************************************************
+     * Bytes of the region allocations are made from
+     *****************************************************************************/
+    size_t get_size()
+    {
+        return _size;
+    }
+
+    /******************************************************************************
+     * Bytes in use
+     *****************************************************************************/
+    size_t get_used()
+    {
+        return _top;
+    }
+
+    /******************************************************************************
+     * Max bytes in use since boot
+     *****************************************************************************/
+    size_t get_peak()
+    {
+        return _peak;
+    }
+}
+
+/******************************************************************************
+ * Allocate buffer in a scope of its own
+ * @param size Bytes needed
+ *****************************************************************************/
+ScratchBuffer::ScratchBuffer(size_t size)
+{
+    _buff = (char*)Scratch::alloc(size);
+    _size = _buff == NULL ? 0 : size;
+
+    if(_buff != NULL)
+        _buff[0] = 0;
+}
+
+/******************************************************************************
+ * Allocated buffer, NULL if arena had no room
+ *****************************************************************************/
+char* ScratchBuffer::get()
+{
+    return _buff;
+}
+
+/******************************************************************************
+ * Size of allocated buffer
+ *****************************************************************************/
+size_t ScratchBuffer::size()
+{
+    return _size;
+}
@@ -12,32 +12,110 @@
 #include "common.h"
 #include "wifi_modem.h"
 #include "device_config.h"
+#include "energy_profiler.h"
+#include "power_lock.h"
+#include "memory_monitor.h"
+#include "deep_sleep.h"
+#include "trace.h"
+#include "at_stream.h"
+#include "uplink_metrics.h"
 
 #define LOGGING 1
 #include <ArduinoHttpClient.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "soc/uart_struct.h"
 
 #define _gsm_serial Serial1
 
 namespace GSM
 {
+//
+// Private types
+//
+/** Power state tracked on power toggles, probed with AT only when unknown */
+enum PowerState
+{
+	POWER_UNKNOWN,
+	POWER_OFF,
+	POWER_ON
+};
+
+/** Modem info cache. RTC_NOINIT memory survives deep sleep and resets (but
+ * not power loss) */
+struct InfoStore
+{
+	uint32_t magic;
+	ModemInfo info;
+	uint32_t crc32;
+}__attribute__((packed));
+
 //
 // Private vars
 //
 /** Hardware serial port to be used by the GSM lib */
 // HardwareSerial _gsm_serial(GSM_SERIAL_PORT);
 
-/** Tick of power off */
+/** Tick of last power key toggle or power down */
 uint32_t _power_toggle_ms = 0;
 
+/** Time after _power_toggle_ms before power key may be toggled again. Cleared
+ * once the modem is known to be ready or off */
+uint32_t _power_guard_ms = 0;
+
+/** Given by background connect task when done (see start_connect) */
+SemaphoreHandle_t _connect_done_sem = NULL;
+
+/** Result of background connect */
+RetResult _connect_ret = RET_ERROR;
+
+/** Millis connect_persist() stops retrying at, 0 for none. Read by connect task */
+volatile uint32_t _connect_deadline_ms = 0;
+
+/** PSM timers accepted on last attach, off() leaves the modem registered */
+bool _psm_enabled = false;
+
+/** Modem left registered in PSM by off(), on() wakes it up */
+bool _psm_sleeping = false;
+
+/** Woken up from PSM or slow clock, connect() checks if still attached before a full attach */
+bool _psm_resumed = false;
+
+/** Modem left registered in slow clock sleep by off(), on() wakes it up */
+bool _clk_sleeping = false;
+
+/** Measured time from power key to AT ready, moving average */
+uint32_t _cold_start_ms = GSM_COLD_START_DEFAULT_MS;
+
+/** Baud rate modem link currently runs at */
+uint32_t _serial_baud = GSM_SERIAL_BAUD;
+
+/** Cached registration failed, skip it until next successful full scan */
+bool _network_cache_failed = false;
+
+/** Modem power as left by the last power toggle */
+PowerState _power_state = POWER_UNKNOWN;
+
+/** Data connected by enable_gprs(), not probed with AT on every check */
+bool _gprs_connected = false;
+
+/** LOCK_APB_MAX held from on() to off(), modem UART may receive any time */
+bool _apb_locked = false;
+
+RTC_NOINIT_ATTR InfoStore _info_store;
+
+/** Info loaded or read this boot */
+bool _info_checked = false;
+
+/** Times AT commands, also outputs communication between GSM module and MCU to serial console
+ * when enabled */
+AtStream _at_stream(_gsm_serial, PRINT_GSM_AT_COMMS ? &Serial : NULL);
+
 /** TinyGSM instance */
-#if PRINT_GSM_AT_COMMS
-#include <StreamDebugger.h>
-/** StreamDebugger object to ouput communication between GSM module and MCU to serial console */
-StreamDebugger debugger(_gsm_serial, Serial);
-TinyGsm _modem(debugger);
-#else
-TinyGsm _modem(_gsm_serial);
-#endif
+TinyGsm _modem(_at_stream);
 
 //
 // Private functions
@@ -47,7 +125,24 @@ void pwr_key_toggle();
 void pwr_reset();
 bool is_fona_serial_open();
 int pwr_toggle_in_progress();
+void wait_pwr_toggle();
+RetResult wait_ready(uint32_t timeout_ms);
+void wait_status(bool on, uint32_t timeout_ms);
 void init_uart();
+RetResult negotiate_baud();
+void connect_task(void *params);
+RetResult power_off();
+RetResult enable_psm();
+RetResult wake_from_psm();
+bool slow_clock_cheaper();
+RetResult enter_slow_clock();
+RetResult wake_from_slow_clock();
+RetResult set_network_mode(uint8_t band);
+RetResult read_network_params(DeviceConfig::NetworkCache *cache);
+void update_network_cache(DeviceConfig::NetworkCache *cache, bool cache_valid, uint32_t attach_ms, bool cached);
+void load_info();
+void lock_apb(bool lock);
+bool info_valid();
 
 /******************************************************************************
  * Init GSM functions 
@@ -61,14 +156,25 @@ void init()
 
 	pinMode(PIN_GSM_PWR_KEY, OUTPUT);
 	pinMode(PIN_GSM_RESET, OUTPUT);
+
+	#ifdef PIN_GSM_STATUS
+		pinMode(PIN_GSM_STATUS, INPUT);
+	#endif
 	// pinMode(PIN_GSM_POWER_ON, OUTPUT);
 
+	// Modem may be registered in PSM or slow clock sleep, state is restored after init
+	if((FLAGS.GSM_PSM || FLAGS.GSM_SLOW_CLOCK) && DeepSleep::woke_up())
+		return;
+
 	// If GSM is ON on init, turn it off
 	if(is_on(500))
 	{
 		debug_println_w(F("GSM is ON on init, turning OFF."));
+		_power_state = POWER_ON;
 		off();
 	}
+
+	_power_state = POWER_OFF;
 }
 
 /*****************************************************************************
@@ -83,29 +189,52 @@ RetResult on()
 
 	debug_println(F("GSM ON"));
 
+	Trace::Span span(Trace::SPAN_GSM_ON);
+
 	Log::log(Log::GSM_ON);
 
-	// If power OFF in progress, wait until enough time passed before proceeding
-	uint32_t pwr_toggle_left_ms = pwr_toggle_in_progress();
-	if(pwr_toggle_left_ms > 0)
+	EnergyProfiler::begin(EnergyProfiler::STATE_GSM_ON);
+	lock_apb(true);
+
+	// If power OFF in progress, wait until it's finished before proceeding
+	wait_pwr_toggle();
+
+	if(_power_state == POWER_ON && !_psm_sleeping && !_clk_sleeping)
 	{
-		debug_println_i(F("Power toggle in progress from previous request, waiting until it's finished."));
-		delay(pwr_toggle_left_ms);
+		debug_println_i(F("GSM already on"));
+		return RET_OK;
 	}
 
-	if(is_on(500))
+	// Modem may have woken up from PSM on its own
+	if((_psm_sleeping || _power_state == POWER_UNKNOWN) && is_on(500))
 	{
 		debug_println_i(F("GSM already on"));
+
+		// Still in PSM active time
+		_psm_resumed = _psm_sleeping;
+		_psm_sleeping = false;
+		_power_state = POWER_ON;
+
+		return RET_OK;
+	}
+
+	if(_psm_sleeping && wake_from_psm() == RET_OK)
+	{
+		return RET_OK;
+	}
+
+	if(_clk_sleeping && wake_from_slow_clock() == RET_OK)
+	{
 		return RET_OK;
 	}
 
+	uint32_t cold_start_ms = millis();
+
 	// Reset before toggling power pin. In case it was already ON (which means power ON was not detected properly),
 	// this will prevent module from powering OFF.
 	pwr_reset();
 	pwr_key_toggle();
 	debug_println(F("Turning ON"));
-	
-	delay(GSM_WAIT_AFTER_PWR_ON_MS);
 
 	#ifdef TCALL_H
 		// Turn IP5306 power boost OFF to reduce idle current
@@ -115,21 +244,37 @@ RetResult on()
 	// If end not called before calling begin again, it results in a guru meditation error sometimes
 	// (needs confirmation)
 	init_uart();
-	delay(8000);
+
+	// Modem boot time varies, init as soon as it answers. init() retries a while itself
+	if(wait_ready(GSM_READY_TIMEOUT_MS) != RET_OK)
+		debug_println_w(F("Modem not ready in time."));
 
 	//_modem.restart();
 	debug_println("Modem init...");
 
 	if (!_modem.init())
 	{
+		// Did not respond, may or may not have turned on
+		_power_state = POWER_UNKNOWN;
+
 		Log::log(Log::GSM_INIT_FAILED);
 		debug_println(F("Could not init."));
 		return RET_ERROR;
 	}
 
-	String modem_info = _modem.getModemInfo();
+	_power_state = POWER_ON;
+	_gprs_connected = false;
+
+	// Exponentially weighted, like attach time
+	float diff = (float)(millis() - cold_start_ms) - _cold_start_ms;
+	_cold_start_ms += GSM_ATTACH_STATS_ALPHA * diff;
+
+	negotiate_baud();
+
+	load_info();
+
 	debug_print(F("GSM module: "));
-	debug_println(modem_info.c_str());
+	debug_println(_info_store.info.revision);
 
 	return RET_OK;
 }
@@ -147,25 +292,83 @@ RetResult off()
 	debug_println(F("GSM OFF"));
 
 	Log::log(Log::GSM_OFF);
-	
-	// If power toggle in progress, wait until enough time passed before re-toggling
-	uint32_t pwr_toggle_left_ms = pwr_toggle_in_progress();
-	if(pwr_toggle_left_ms > 0)
+
+	// Modem enters PSM on its own once active time (T3324) expires and keeps
+	// its registration and PDP context
+	if(FLAGS.GSM_PSM && _psm_enabled)
 	{
-		debug_println_i(F("Power toggle in progress from previous request, waiting until it's finished."));
-		delay(pwr_toggle_left_ms);
+		debug_println_i(F("Leaving GSM registered in PSM."));
+
+		_psm_sleeping = true;
+
+		EnergyProfiler::end(EnergyProfiler::STATE_GPRS);
+		EnergyProfiler::end(EnergyProfiler::STATE_GSM_ON);
+		lock_apb(false);
+
+		return RET_OK;
 	}
 
-	if(!is_on())
+	if(FLAGS.GSM_SLOW_CLOCK && _gprs_connected && slow_clock_cheaper() && enter_slow_clock() == RET_OK)
+		return RET_OK;
+
+	return power_off();
+}
+
+/*****************************************************************************
+* Power OFF, also when left in PSM
+*****************************************************************************/
+RetResult power_off()
+{
+	_psm_enabled = false;
+	_psm_sleeping = false;
+	_psm_resumed = false;
+
+	// Power key works in slow clock sleep too, UART is woken up for the next on()
+	#ifdef PIN_GSM_DTR
+		if(_clk_sleeping)
+		{
+			gpio_hold_dis((gpio_num_t)PIN_GSM_DTR);
+			digitalWrite(PIN_GSM_DTR, 0);
+		}
+	#endif
+
+	_clk_sleeping = false;
+
+	// If power toggle in progress, wait until it's finished before re-toggling
+	wait_pwr_toggle();
+
+	_gprs_connected = false;
+
+	if(_power_state == POWER_OFF || (_power_state == POWER_UNKNOWN && !is_on()))
 	{
 		debug_println_i(F("GSM Already OFF."));
+		_power_state = POWER_OFF;
 		return RET_OK;
 	}
 
-	Serial.println(F("Turning OFF"));
-	pwr_key_toggle();
+	debug_println_i(F("Turning OFF"));
 
-	_power_toggle_ms = millis();
+	// Graceful power down (AT+CPOWD) deregisters and needs no power key toggle,
+	// so the next power on doesn't wait for one. Power key if modem doesn't answer
+	if(_modem.poweroff())
+	{
+		_power_toggle_ms = millis();
+		_power_guard_ms = GSM_WAIT_AFTER_POWER_DOWN_MS;
+	}
+	else
+	{
+		debug_println_w(F("Power down not confirmed, using power key."));
+		pwr_key_toggle();
+	}
+
+	_power_state = POWER_OFF;
+
+	// Baud rate is not saved on the modem, back to default on next power on
+	_serial_baud = GSM_SERIAL_BAUD;
+
+	EnergyProfiler::end(EnergyProfiler::STATE_GPRS);
+	EnergyProfiler::end(EnergyProfiler::STATE_GSM_ON);
+	lock_apb(false);
 
 	#ifdef TCALL_H
 		// Turn IP5306 power boost OFF to reduce idle current
@@ -182,6 +385,7 @@ RetResult off()
 void pwr_key_toggle()
 {
 	_power_toggle_ms = millis();
+	_power_guard_ms = GSM_WAIT_AFTER_PWR_TOGGLE_MS;
 
 	// TSIM
 	digitalWrite(PIN_GSM_PWR_KEY, 0);
@@ -202,55 +406,415 @@ RetResult connect()
 		return WifiModem::connect();
 	#endif
 
+	// PSM and slow clock keep registration and PDP context, nothing to set up if still attached
+	if(_psm_resumed)
+	{
+		_psm_resumed = false;
+
+		_gprs_connected = _modem.isNetworkConnected() && _modem.isGprsConnected();
+
+		if(_gprs_connected)
+		{
+			debug_println_i(F("GSM resumed from PSM, still connected."));
+			EnergyProfiler::begin(EnergyProfiler::STATE_GPRS);
+			return RET_OK;
+		}
+
+		debug_println_w(F("GSM registration lost in PSM, attaching."));
+	}
+
 	debug_println(F("Initializing GSM"));
 
-	// Configure NBIOT
+	uint32_t t_start = millis();
+	int64_t attach_start_us = Trace::now_us();
+
+	// Try operator and band of last attach first, full scan if not found
+	DeviceConfig::NetworkCache cache;
+	bool cache_valid = DeviceConfig::get_network_cache(&cache) == RET_OK;
+	bool cached = cache_valid && !_network_cache_failed &&
+		cache.nbiot_mode == FLAGS.NBIOT_MODE &&
+		strcmp(cache.apn, DeviceConfig::get_cellular_apn()) == 0;
+
+	bool attached = false;
+
+	if(cached)
+	{
+		debug_print(F("Attaching to cached operator: "));
+		debug_println(cache.oper);
+
+		set_network_mode(cache.band);
+
+		_modem.sendAT(GF("+COPS=1,2,\""), cache.oper, GF("\""));
+		_modem.waitResponse(GSM_CACHED_DISCOVERY_TIMEOUT_MS);
+
+		attached = _modem.waitForNetwork(GSM_CACHED_DISCOVERY_TIMEOUT_MS);
+
+		if(!attached)
+		{
+			debug_println_w(F("Cached operator not found, full scan."));
+			_network_cache_failed = true;
+			cached = false;
+		}
+	}
+
+	if(!attached)
+	{
+		set_network_mode(GSM_NBIOT_DEFAULT_BAND);
+
+		// Automatic operator selection
+		_modem.sendAT(GF("+COPS=0"));
+		_modem.waitResponse(GSM_DISCOVERY_TIMEOUT_MS);
+
+		debug_println(F("Waiting for network connection..."));
+		attached = _modem.waitForNetwork(GSM_DISCOVERY_TIMEOUT_MS);
+	}
+
+	Trace::record(Trace::SPAN_GSM_ATTACH, attach_start_us);
+
+	if (!attached)
+	{
+		debug_println_e(F("Network discovery failed."));
+		Log::log(Log::GSM_NETWORK_DISCOVERY_FAILED);
+		return RET_ERROR;
+	}
+
+	debug_println_i(F("GSM connected"));
+
+	uint32_t attach_ms = millis() - t_start;
+
+	update_network_cache(&cache, cache_valid, attach_ms, cached);
+
+	// Queried only to be printed, RSSI is logged by call home (see UplinkMetrics)
+	if(debug_level_enabled(LOG_LEVEL_DEBUG))
+	{
+		int8_t rssi = get_rssi();
+		Utils::serial_style(STYLE_BLUE);
+		debug_print(F("RSSI: "));
+		debug_println(rssi, DEC);
+
+		debug_print(F("Operator: "));
+		debug_println(_modem.getOperator());
+		Utils::serial_style(STYLE_RESET);
+	}
+
+	uint32_t pdp_start_ms = millis();
+
+	if (enable_gprs(true) != RET_OK)
+	{
+		Log::log(Log::GSM_GPRS_CONNECTION_FAILED);
+		return RET_ERROR;
+	}
+
+	UplinkMetrics::on_attach(attach_ms, millis() - pdp_start_ms);
+
+	if(debug_level_enabled(LOG_LEVEL_DEBUG))
+		GSM::print_system_info();
+
+	if(FLAGS.GSM_PSM)
+		enable_psm();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Set preferred network mode from flags
+ * @param band LTE band to lock to in NBIoT mode
+ ******************************************************************************/
+RetResult set_network_mode(uint8_t band)
+{
 	#ifdef TINY_GSM_MODEM_SIM7000
 		if(FLAGS.NBIOT_MODE)
 		{
 			debug_println(F("NBIoT mode"));
 			_modem.setPreferredMode(38);
 			_modem.setPreferredLTEMode(2);
-			_modem.setOperatingBand(20); 		
+			_modem.setOperatingBand(band > 0 ? band : GSM_NBIOT_DEFAULT_BAND);
 		}
 		else
 		{
 			debug_println(F("GSM mode"));
 			_modem.setPreferredMode(13); //2 Auto // 13 GSM only // 38 LTE only
-
 		}
 	#endif
 
-	debug_println(F("Waiting for network connection..."));
-	if (!_modem.waitForNetwork(GSM_DISCOVERY_TIMEOUT_MS))
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Read operator, band and serving cell from UE system information
+ * LTE: +CPSI: <mode>,<op mode>,<MCC>-<MNC>,<TAC>,<SCellID>,<PCellID>,<band>,...
+ * GSM: +CPSI: <mode>,<op mode>,<MCC>-<MNC>,<LAC>,<CellID>,...
+ ******************************************************************************/
+RetResult read_network_params(DeviceConfig::NetworkCache *cache)
+{
+	_modem.sendAT(GF("+CPSI?"));
+
+	if(_modem.waitResponse(GF("+CPSI:")) != 1)
 	{
-		debug_println_e(F("Network discovery failed."));
-		Log::log(Log::GSM_NETWORK_DISCOVERY_FAILED);
 		return RET_ERROR;
 	}
 
-	debug_println_i(F("GSM connected"));
+	String res = _modem.stream.readStringUntil('\n');
+	_modem.waitResponse();
 
-	int8_t rssi = get_rssi();
-	Utils::serial_style(STYLE_BLUE);
-	debug_print(F("RSSI: "));
-	debug_println(rssi, DEC);
+	String fields[7];
+	int count = 0, start = 0;
+	res.trim();
 
-	debug_print(F("Operator: "));
-	debug_println(_modem.getOperator());
-	Utils::serial_style(STYLE_RESET);
+	while(count < 7)
+	{
+		int end = res.indexOf(',', start);
+		fields[count++] = end < 0 ? res.substring(start) : res.substring(start, end);
+		if(end < 0)
+			break;
+		start = end + 1;
+	}
 
-	if (enable_gprs(true) != RET_OK)
+	if(count < 5)
 	{
-		Log::log(Log::GSM_GPRS_CONNECTION_FAILED);
 		return RET_ERROR;
 	}
 
-	GSM::print_system_info();
+	// MCC-MNC to numeric operator format
+	fields[2].replace("-", "");
+	strncpy(cache->oper, fields[2].c_str(), sizeof(cache->oper) - 1);
+	cache->oper[sizeof(cache->oper) - 1] = '\0';
+
+	cache->cell_id = fields[4].toInt();
+
+	// EUTRAN-BANDXX
+	cache->band = 0;
+	int band_idx = count > 6 ? fields[6].indexOf("BAND") : -1;
+	if(band_idx >= 0)
+	{
+		cache->band = fields[6].substring(band_idx + 4).toInt();
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Store parameters of successful attach and update attach time statistics
+ * @param cache			Cache loaded before attach
+ * @param cache_valid	Cache was loaded, statistics are continued
+ * @param attach_ms		Time taken to attach
+ * @param cached		Attached with cached operator/band
+ ******************************************************************************/
+void update_network_cache(DeviceConfig::NetworkCache *cache, bool cache_valid, uint32_t attach_ms, bool cached)
+{
+	uint32_t last_cell_id = cache->cell_id;
+
+	if(!cache_valid)
+	{
+		memset(cache, 0, sizeof(DeviceConfig::NetworkCache));
+		cache->attach_ms_mean = attach_ms;
+	}
+
+	// Exponentially weighted mean and variance
+	float diff = attach_ms - cache->attach_ms_mean;
+	cache->attach_ms_mean += GSM_ATTACH_STATS_ALPHA * diff;
+	cache->attach_ms_var = (1 - GSM_ATTACH_STATS_ALPHA) * (cache->attach_ms_var + GSM_ATTACH_STATS_ALPHA * diff * diff);
+
+	uint32_t std_dev_ms = sqrt(cache->attach_ms_var);
+
+	Log::log(Log::GSM_ATTACH_TIME, attach_ms, (std_dev_ms & 0x7FFFFFFF) | ((uint32_t)cached << 31));
+
+	if(read_network_params(cache) != RET_OK)
+	{
+		debug_println_w(F("Could not read network parameters."));
+		return;
+	}
+
+	if(cache_valid && last_cell_id != cache->cell_id)
+	{
+		debug_println_i(F("Serving cell changed."));
+	}
+
+	cache->nbiot_mode = FLAGS.NBIOT_MODE;
+	strncpy(cache->apn, DeviceConfig::get_cellular_apn(), sizeof(cache->apn) - 1);
+	cache->apn[sizeof(cache->apn) - 1] = '\0';
+
+	DeviceConfig::set_network_cache(cache);
+	DeviceConfig::print_network_cache(cache);
+
+	_network_cache_failed = false;
+}
+
+/******************************************************************************
+ * Request PSM timers and eDRX so off() can leave the modem registered.
+ * PSM is an LTE feature, used only in NBIoT mode
+ ******************************************************************************/
+RetResult enable_psm()
+{
+	_psm_enabled = false;
+
+	#ifdef TINY_GSM_MODEM_SIM7000
+		if(!FLAGS.NBIOT_MODE)
+		{
+			debug_println_w(F("PSM needs NBIoT mode."));
+			return RET_ERROR;
+		}
+
+		_modem.sendAT(GF("+CPSMS=1,,,\""), GSM_PSM_T3412, GF("\",\""), GSM_PSM_T3324, GF("\""));
+		if(_modem.waitResponse() != 1)
+		{
+			debug_println_e(F("Could not enable PSM."));
+			return RET_ERROR;
+		}
+
+		if(GSM_EDRX_ENABLED)
+		{
+			// Access technology 5: NB-IoT
+			_modem.sendAT(GF("+CEDRXS=1,5,\""), GSM_EDRX_VALUE, GF("\""));
+			if(_modem.waitResponse() != 1)
+			{
+				debug_println_w(F("Could not enable eDRX."));
+			}
+		}
+
+		debug_println_i(F("PSM enabled."));
+		_psm_enabled = true;
+
+		return RET_OK;
+	#else
+		debug_println_w(F("PSM not supported by modem."));
+		return RET_ERROR;
+	#endif
+}
+
+/******************************************************************************
+ * Wake modem up from PSM with a short PWRKEY pulse
+ * @return RET_ERROR if it doesn't respond, a cold start is needed
+ ******************************************************************************/
+RetResult wake_from_psm()
+{
+	uint32_t t_start = millis();
+
+	_psm_sleeping = false;
+
+	debug_println(F("Waking GSM up from PSM"));
+
+	digitalWrite(PIN_GSM_PWR_KEY, 1);
+	delay(GSM_PSM_WAKE_PULSE_MS);
+	digitalWrite(PIN_GSM_PWR_KEY, 0);
+
+	bool woke_up = is_on(GSM_PSM_WAKE_TIMEOUT_MS);
+
+	Log::log(Log::GSM_PSM_WAKEUP, woke_up, millis() - t_start);
+
+	if(!woke_up)
+	{
+		debug_println_w(F("GSM did not wake up from PSM, cold start."));
+		_psm_enabled = false;
+		return RET_ERROR;
+	}
+
+	_psm_resumed = true;
 
 	return RET_OK;
 }
 
+/******************************************************************************
+ * Staying registered in slow clock sleep until the next call home costs less
+ * than powering off, then a cold start and attach
+ ******************************************************************************/
+bool slow_clock_cheaper()
+{
+	#ifdef PIN_GSM_DTR
+		int secs = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_CALL_HOME);
+
+		if(secs <= 0)
+			return false;
+
+		DeviceConfig::NetworkCache cache;
+		float attach_ms = DeviceConfig::get_network_cache(&cache) == RET_OK ? cache.attach_ms_mean : GSM_ATTACH_DEFAULT_MS;
+
+		// mA * s
+		float sleep_cost = GSM_SLOW_CLOCK_MA * secs;
+		float cold_cost = GSM_ATTACH_MA * (_cold_start_ms + attach_ms) / 1000;
+
+		debug_printf("GSM slow clock until next call home: %.0f mAs, cold start and attach: %.0f mAs\n",
+			sleep_cost, cold_cost);
+
+		return sleep_cost < cold_cost;
+	#else
+		return false;
+	#endif
+}
+
+/******************************************************************************
+ * Put modem in slow clock sleep, registered with its PDP context. UART sleeps
+ * while DTR is high, pin is held through deep sleep
+ ******************************************************************************/
+RetResult enter_slow_clock()
+{
+	#ifdef PIN_GSM_DTR
+		_modem.sendAT(GF("+CSCLK=1"));
+
+		if(_modem.waitResponse() != 1)
+		{
+			debug_println_w(F("Modem rejected slow clock."));
+			return RET_ERROR;
+		}
+
+		debug_println_i(F("Leaving GSM registered in slow clock sleep."));
+
+		pinMode(PIN_GSM_DTR, OUTPUT);
+		digitalWrite(PIN_GSM_DTR, 1);
+		gpio_hold_en((gpio_num_t)PIN_GSM_DTR);
+
+		_clk_sleeping = true;
+
+		EnergyProfiler::end(EnergyProfiler::STATE_GPRS);
+		EnergyProfiler::end(EnergyProfiler::STATE_GSM_ON);
+		lock_apb(false);
+
+		return RET_OK;
+	#else
+		return RET_ERROR;
+	#endif
+}
+
+/******************************************************************************
+ * Wake modem up from slow clock sleep with DTR low
+ * @return RET_ERROR if it doesn't respond, a cold start is needed
+ ******************************************************************************/
+RetResult wake_from_slow_clock()
+{
+	#ifdef PIN_GSM_DTR
+		uint32_t t_start = millis();
+
+		_clk_sleeping = false;
+
+		debug_println(F("Waking GSM up from slow clock"));
+
+		gpio_hold_dis((gpio_num_t)PIN_GSM_DTR);
+		pinMode(PIN_GSM_DTR, OUTPUT);
+		digitalWrite(PIN_GSM_DTR, 0);
+		delay(GSM_SLOW_CLOCK_WAKE_MS);
+
+		bool woke_up = is_on(GSM_PSM_WAKE_TIMEOUT_MS);
+
+		Log::log(Log::GSM_SLOW_CLOCK_WAKEUP, woke_up, millis() - t_start);
+
+		if(!woke_up)
+		{
+			debug_println_w(F("GSM did not wake up from slow clock, cold start."));
+			_power_state = POWER_UNKNOWN;
+			return RET_ERROR;
+		}
+
+		_modem.sendAT(GF("+CSCLK=0"));
+		_modem.waitResponse();
+
+		_psm_resumed = true;
+
+		return RET_OK;
+	#else
+		return RET_ERROR;
+	#endif
+}
+
 /******************************************************************************
  * Calls connect() X times until it succeeds and power cycles GSM module
  * inbetween failures
@@ -267,18 +831,27 @@ RetResult connect_persist()
 		{
 			debug_print(F("Connection failed. "));
 
+			// Out of call home budget, power cycles and resets would only drain the battery
+			if (tries && _connect_deadline_ms != 0 && (int32_t)(millis() - _connect_deadline_ms) >= 0)
+			{
+				debug_println(F("Connect deadline passed."));
+				break;
+			}
+
 			if (tries)
 			{
 				debug_println(F("Cycling power and retrying."));
 			}
 
-			// Before last try, reset module to defaults because
+			// Last resort before last try, after both cached and full scan attach failed,
+			// reset module to defaults because
 			// sometimes if the device started in NBIoT mode, when it is reverted back to GSM mode it has
 			// trouble connecting to network. So far the only thing that remedies this is an ATZ command
-			// (reset to defaults)
+			// (reset to defaults). Cached parameters are dropped too.
 			if(tries == 1)
 			{
 				GSM::factory_reset();
+				DeviceConfig::clear_network_cache();
 			}
 
 			power_cycle();
@@ -300,6 +873,87 @@ RetResult connect_persist()
 		return RET_OK;
 }
 
+/******************************************************************************
+ * Power on and connect in a background task, so registration overlaps with
+ * work done until the connection is needed. wait_connect() must be called
+ * before using the modem.
+ ******************************************************************************/
+RetResult start_connect()
+{
+	if(_connect_done_sem != NULL)
+		return RET_OK;
+
+	_connect_ret = RET_ERROR;
+	_connect_done_sem = xSemaphoreCreateBinary();
+
+	if(_connect_done_sem == NULL ||
+		xTaskCreatePinnedToCore(connect_task, "gsm_connect", GSM_CONNECT_TASK_STACK_SIZE, NULL,
+			GSM_CONNECT_TASK_PRIORITY, NULL, GSM_CONNECT_TASK_CORE) != pdPASS)
+	{
+		debug_println_e(F("Could not start GSM connect task."));
+
+		if(_connect_done_sem != NULL)
+		{
+			vSemaphoreDelete(_connect_done_sem);
+			_connect_done_sem = NULL;
+		}
+
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Wait for background connect started by start_connect()
+ * @return Connect result, RET_ERROR if not started
+ ******************************************************************************/
+RetResult wait_connect()
+{
+	if(_connect_done_sem == NULL)
+		return RET_ERROR;
+
+	uint32_t t_start = millis();
+
+	xSemaphoreTake(_connect_done_sem, portMAX_DELAY);
+	vSemaphoreDelete(_connect_done_sem);
+	_connect_done_sem = NULL;
+
+	debug_printf("Waited for GSM connection (ms): %u\n", millis() - t_start);
+
+	return _connect_ret;
+}
+
+/******************************************************************************
+ * Background connect started and not waited for
+ ******************************************************************************/
+bool connect_pending()
+{
+	return _connect_done_sem != NULL;
+}
+
+/******************************************************************************
+ * Set time connect_persist() gives up retrying at (see CallHomeBudget)
+ * @param deadline_ms Millis, 0 for no deadline
+ ******************************************************************************/
+void set_connect_deadline(uint32_t deadline_ms)
+{
+	_connect_deadline_ms = deadline_ms;
+}
+
+/******************************************************************************
+ * Background connect task, powers on and connects then exits
+ ******************************************************************************/
+void connect_task(void *params)
+{
+	on();
+	_connect_ret = connect_persist();
+	MemoryMonitor::sample_task(MemoryMonitor::TASK_GSM_CONNECT);
+
+	xSemaphoreGive(_connect_done_sem);
+	vTaskDelete(NULL);
+}
+
 /*****************************************************************************
 * Power cycle
 *****************************************************************************/
@@ -310,8 +964,9 @@ void power_cycle()
 		return;
 	#endif
 
-	off();
-	delay(500);
+	// Full power cycle, PSM registration is dropped too. on() waits until the
+	// modem is off
+	power_off();
 	on();
 }
 
@@ -479,6 +1134,8 @@ RetResult enable_gprs(bool enable)
 		debug_print(F("Connecting to APN: "));
 		debug_println(apn);
 
+		Trace::Span span(Trace::SPAN_GSM_PDP);
+
 		if (!_modem.gprsConnect(apn, "", ""))
 		{
 			debug_println(F("Could not connect data."));
@@ -486,6 +1143,10 @@ RetResult enable_gprs(bool enable)
 		}
 
 		debug_println(F("Data connected."));
+
+		_gprs_connected = true;
+
+		EnergyProfiler::begin(EnergyProfiler::STATE_GPRS);
 	}
 	else
 	{
@@ -496,6 +1157,10 @@ RetResult enable_gprs(bool enable)
 		}
 
 		debug_println(F("Data disconnected."));
+
+		_gprs_connected = false;
+
+		EnergyProfiler::end(EnergyProfiler::STATE_GPRS);
 	}
 
 	return RET_OK;
@@ -527,6 +1192,65 @@ int get_rssi()
 	return rssi;
 }
 
+/******************************************************************************
+ * Read serving cell from UE system information
+ * LTE: +CPSI: <mode>,<op mode>,<MCC>-<MNC>,<TAC>,<SCellID>,<PCellID>,<band>,
+ * 	<EARFCN>,<dlbw>,<ulbw>,<RSRQ>,<RSRP>,<RSSI>,<RSSNR>
+ * GSM: +CPSI: <mode>,<op mode>,<MCC>-<MNC>,<LAC>,<CellID>,...
+ ******************************************************************************/
+RetResult get_serving_cell(ServingCell *cell)
+{
+	memset(cell, 0, sizeof(ServingCell));
+
+	#if WIFI_DATA_SUBMISSION
+		return RET_ERROR;
+	#endif
+
+	_modem.sendAT(GF("+CPSI?"));
+
+	if(_modem.waitResponse(GF("+CPSI:")) != 1)
+	{
+		return RET_ERROR;
+	}
+
+	String res = _modem.stream.readStringUntil('\n');
+	_modem.waitResponse();
+
+	String fields[12];
+	int count = 0, start = 0;
+	res.trim();
+
+	while(count < 12)
+	{
+		int end = res.indexOf(',', start);
+		fields[count++] = end < 0 ? res.substring(start) : res.substring(start, end);
+		if(end < 0)
+			break;
+		start = end + 1;
+	}
+
+	if(count < 3)
+	{
+		return RET_ERROR;
+	}
+
+	if(fields[0].startsWith("LTE"))
+		cell->rat = fields[0].indexOf("NB") >= 0 ? RAT_NB_IOT : RAT_CAT_M1;
+	else if(fields[0].startsWith("GSM"))
+		cell->rat = RAT_GSM;
+
+	fields[2].replace("-", "");
+	strncpy(cell->oper, fields[2].c_str(), sizeof(cell->oper) - 1);
+
+	if(cell->rat != RAT_GSM && count >= 12)
+	{
+		cell->rsrq = fields[10].toInt();
+		cell->rsrp = fields[11].toInt();
+	}
+
+	return RET_OK;
+}
+
 /******************************************************************************
 * Get network system mode
 ******************************************************************************/
@@ -595,7 +1319,8 @@ RetResult factory_reset()
 }
 
 /******************************************************************************
- * Check if SIM card present by checking if its ready
+ * Check if SIM card present by checking if its ready. A CCID read this boot
+ * answers without an AT round-trip
  *****************************************************************************/
 bool is_sim_card_present()
 {
@@ -604,6 +1329,9 @@ bool is_sim_card_present()
 		return RET_OK;
 	#endif
 
+	if(_info_checked && info_valid() && _info_store.info.ccid[0] != '\0')
+		return true;
+
 	return _modem.getSimStatus() == SIM_READY;
 }
 
@@ -619,10 +1347,26 @@ bool is_on(uint32_t timeout)
 		return RET_OK;
 	#endif
 
+	// UART answers only after wake_from_slow_clock() pulls DTR low
+	if(_clk_sleeping)
+		return true;
+
 	init_uart();
 
 	// modem.init() must have been already run for this to work??
-	return _modem.testAT(timeout);
+	if(_modem.testAT(timeout))
+		return true;
+
+	// Modem reset while link was at fast baud rate
+	if(_serial_baud != GSM_SERIAL_BAUD)
+	{
+		_serial_baud = GSM_SERIAL_BAUD;
+		init_uart();
+
+		return _modem.testAT(timeout);
+	}
+
+	return false;
 }
 
 /******************************************************************************
@@ -635,7 +1379,13 @@ bool is_gprs_connected()
 		return WifiModem::is_connected();
 	#endif
 
-	return _modem.isGprsConnected();
+	// Asleep in PSM, bearer is usable only after on() wakes the modem
+	if(_psm_sleeping)
+		return false;
+
+	// Tracked by enable_gprs() and power off. A link dropped by the network fails
+	// the next request instead
+	return _gprs_connected;
 }
 
 /******************************************************************************
@@ -649,14 +1399,81 @@ bool is_gprs_connected()
 int pwr_toggle_in_progress()
 {
 	uint32_t time_since_pwr_toggle = millis() - _power_toggle_ms;
-	if(_power_toggle_ms > 0 && time_since_pwr_toggle <= GSM_WAIT_AFTER_PWR_TOGGLE_MS)
+	if(_power_toggle_ms > 0 && time_since_pwr_toggle <= _power_guard_ms)
 	{
-		return GSM_WAIT_AFTER_PWR_TOGGLE_MS - time_since_pwr_toggle;
+		return _power_guard_ms - time_since_pwr_toggle;
 	}
 	else
 		return 0;
 }
 
+/******************************************************************************
+ * Wait until a power toggle in progress is finished. With PIN_GSM_STATUS only
+ * until status follows the power state
+ ******************************************************************************/
+void wait_pwr_toggle()
+{
+	uint32_t pwr_toggle_left_ms = pwr_toggle_in_progress();
+	if(pwr_toggle_left_ms == 0)
+		return;
+
+	debug_println_i(F("Power toggle in progress from previous request, waiting until it's finished."));
+
+	#ifdef PIN_GSM_STATUS
+		wait_status(_power_state == POWER_ON, pwr_toggle_left_ms);
+	#else
+		delay(pwr_toggle_left_ms);
+	#endif
+
+	_power_guard_ms = 0;
+}
+
+/******************************************************************************
+ * Wait for the modem to boot after power key. Polled with AT (autobauding
+ * modems send no URC before the first AT), after PIN_GSM_STATUS goes high where
+ * routed. The task sleeps between polls, other tasks run meanwhile
+ * @return RET_ERROR if modem did not answer in time
+ ******************************************************************************/
+RetResult wait_ready(uint32_t timeout_ms)
+{
+	uint32_t start_ms = millis();
+
+	#ifdef PIN_GSM_STATUS
+		wait_status(true, timeout_ms);
+	#endif
+
+	while(millis() - start_ms < timeout_ms)
+	{
+		_modem.sendAT();
+		if(_modem.waitResponse(GSM_READY_AT_TIMEOUT_MS) == 1)
+		{
+			debug_printf("Modem ready (ms): %u\n", millis() - _power_toggle_ms);
+
+			// Booted, power key may be used right away
+			_power_guard_ms = 0;
+
+			return RET_OK;
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(GSM_READY_POLL_MS));
+	}
+
+	return RET_ERROR;
+}
+
+/******************************************************************************
+ * Wait for PIN_GSM_STATUS to show modem on or off
+ ******************************************************************************/
+void wait_status(bool on, uint32_t timeout_ms)
+{
+	#ifdef PIN_GSM_STATUS
+		uint32_t start_ms = millis();
+
+		while((bool)digitalRead(PIN_GSM_STATUS) != on && millis() - start_ms < timeout_ms)
+			vTaskDelay(pdMS_TO_TICKS(GSM_READY_POLL_MS));
+	#endif
+}
+
 /******************************************************************************
  * Toggle reset pin
  *****************************************************************************/
@@ -679,10 +1496,78 @@ void init_uart()
 	_gsm_serial.end(); 
 	delay(200);
 
-	_gsm_serial.begin(GSM_SERIAL_BAUD, SERIAL_8N1, PIN_GSM_RX, PIN_GSM_TX);
+	// Must be set before begin()
+	_gsm_serial.setRxBufferSize(GSM_SERIAL_RX_BUFFER_SIZE);
+	_gsm_serial.begin(_serial_baud, SERIAL_8N1, PIN_GSM_RX, PIN_GSM_TX);
+
+	// Core sets it near full (112), too close to overrun while the CPU idles at a
+	// low clock between polls (see AtStream)
+	uart_dev_t *uart = GSM_SERIAL_PORT == 2 ? &UART2 : &UART1;
+	uart->conf1.rxfifo_full_thrhd = GSM_SERIAL_RX_FIFO_THRESHOLD;
+
+	#if defined(PIN_GSM_RTS) && defined(PIN_GSM_CTS)
+		uart_set_pin((uart_port_t)GSM_SERIAL_PORT, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, PIN_GSM_RTS, PIN_GSM_CTS);
+		uart_set_hw_flow_ctrl((uart_port_t)GSM_SERIAL_PORT, UART_HW_FLOWCTRL_CTS_RTS, GSM_SERIAL_RTS_THRESHOLD);
+	#endif
+
 	delay(50);
 }
 
+/******************************************************************************
+ * Switch modem link to the board's fast baud rate (and RTS/CTS flow control
+ * where routed). Falls back to GSM_SERIAL_BAUD if the modem does not respond
+ * at the new rate.
+ ******************************************************************************/
+RetResult negotiate_baud()
+{
+	#ifdef GSM_SERIAL_FAST_BAUD
+		if(_serial_baud == GSM_SERIAL_FAST_BAUD)
+			return RET_OK;
+
+		#if defined(PIN_GSM_RTS) && defined(PIN_GSM_CTS)
+			_modem.sendAT(GF("+IFC=2,2"));
+			if(_modem.waitResponse() != 1)
+			{
+				debug_println_w(F("Could not enable modem flow control."));
+			}
+		#endif
+
+		_modem.sendAT(GF("+IPR="), GSM_SERIAL_FAST_BAUD);
+		if(_modem.waitResponse() != 1)
+		{
+			debug_println_w(F("Modem rejected baud rate change."));
+			return RET_ERROR;
+		}
+
+		_serial_baud = GSM_SERIAL_FAST_BAUD;
+		init_uart();
+
+		if(_modem.testAT(GSM_TEST_AT_TIMEOUT))
+		{
+			debug_print_i(F("Modem link baud rate: "));
+			debug_println(_serial_baud, DEC);
+			return RET_OK;
+		}
+
+		// Link unreliable at fast baud rate, try to revert modem and fall back
+		debug_println_w(F("No response at fast baud rate, falling back."));
+
+		for(int i = 0; i < GSM_TRIES; i++)
+		{
+			_modem.sendAT(GF("+IPR="), GSM_SERIAL_BAUD);
+			if(_modem.waitResponse(GSM_RETRY_DELAY_MS) == 1)
+				break;
+		}
+
+		_serial_baud = GSM_SERIAL_BAUD;
+		init_uart();
+
+		return RET_ERROR;
+	#else
+		return RET_OK;
+	#endif
+}
+
 /******************************************************************************
  * Get TinyGsm object
  *****************************************************************************/
@@ -691,4 +1576,104 @@ TinyGsm *get_modem()
 	return &_modem;
 }
 
+/******************************************************************************
+ * Get IMEI, CCID, model and firmware revision, read once per boot by on()
+ * (kept over deep sleep). Fields are empty before the modem was on
+ *****************************************************************************/
+const ModemInfo* get_info()
+{
+	static const ModemInfo empty = {0};
+
+	return info_valid() ? &_info_store.info : &empty;
+}
+
+/******************************************************************************
+ * Read modem info unless cached before deep sleep. Cold boots re-read it, the
+ * SIM may have been swapped. Not cached without a CCID (SIM not ready yet)
+ *****************************************************************************/
+void load_info()
+{
+	if(_info_checked)
+		return;
+
+	_info_checked = true;
+
+	if(DeepSleep::woke_up() && info_valid())
+		return;
+
+	ModemInfo *info = &_info_store.info;
+	memset(info, 0, sizeof(ModemInfo));
+
+	strncpy(info->imei, _modem.getIMEI().c_str(), sizeof(info->imei) - 1);
+	strncpy(info->ccid, _modem.getSimCCID().c_str(), sizeof(info->ccid) - 1);
+	strncpy(info->model, _modem.getModemName().c_str(), sizeof(info->model) - 1);
+	strncpy(info->revision, _modem.getModemInfo().c_str(), sizeof(info->revision) - 1);
+
+	_info_store.magic = info->ccid[0] != '\0' ? GSM_INFO_MAGIC : 0;
+	_info_store.crc32 = Utils::crc32((uint8_t*)&_info_store, sizeof(_info_store) - sizeof(_info_store.crc32));
+
+	// Read again on next on()
+	if(_info_store.magic == 0)
+		_info_checked = false;
+}
+
+/******************************************************************************
+ * Take or give back LOCK_APB_MAX, once per power on (see PowerLock)
+ *****************************************************************************/
+void lock_apb(bool lock)
+{
+	if(lock == _apb_locked)
+		return;
+
+	_apb_locked = lock;
+
+	if(lock)
+		PowerLock::acquire(PowerLock::LOCK_APB_MAX);
+	else
+		PowerLock::release(PowerLock::LOCK_APB_MAX);
+}
+
+/******************************************************************************
+ * RTC memory holds modem info, garbage after power loss
+ *****************************************************************************/
+bool info_valid()
+{
+	return _info_store.magic == GSM_INFO_MAGIC &&
+		Utils::crc32((uint8_t*)&_info_store, sizeof(_info_store) - sizeof(_info_store.crc32)) == _info_store.crc32;
+}
+
+/******************************************************************************
+ * Log AT command latencies since last call and clear them
+ *****************************************************************************/
+void log_at_stats()
+{
+	_at_stream.log_stats();
+}
+
+/******************************************************************************
+ * Save state before entering deep sleep
+ *****************************************************************************/
+void save_state(RetainedState *state)
+{
+	state->psm_enabled = _psm_enabled;
+	state->psm_sleeping = _psm_sleeping;
+	state->clk_sleeping = _clk_sleeping;
+	state->power_state = _power_state;
+	state->serial_baud = _serial_baud;
+	state->cold_start_ms = _cold_start_ms;
+}
+
+/******************************************************************************
+ * Restore state after waking up from deep sleep
+ *****************************************************************************/
+void restore_state(const RetainedState *state)
+{
+	_psm_enabled = state->psm_enabled;
+	_psm_sleeping = state->psm_sleeping;
+	_clk_sleeping = state->clk_sleeping;
+	_power_state = (PowerState)state->power_state;
+	_serial_baud = state->serial_baud;
+	_cold_start_ms = state->cold_start_ms;
+}
+
 } // namespace GSM
\ No newline at end of file
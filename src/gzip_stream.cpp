@@ -0,0 +1,210 @@
+#include "gzip_stream.h"
+#include "common.h"
+#include "utils.h"
+#include "psram.h"
+#include "power_lock.h"
+
+// Header: magic, deflate, no flags, no mtime, no extra flags, unknown OS
+static const uint8_t GZIP_HEADER[] = {0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF};
+
+/******************************************************************************
+ * Discards what is written to it, counts bytes (see GzipStream::measure())
+ ******************************************************************************/
+class GzipCountPrint : public Print
+{
+public:
+	size_t write(uint8_t byte)
+	{
+		count++;
+		return 1;
+	}
+
+	size_t write(const uint8_t *buff, size_t size)
+	{
+		count += size;
+		return size;
+	}
+
+	int count = 0;
+};
+
+/******************************************************************************
+ * Allocate compressor state, check with operator bool
+ ******************************************************************************/
+GzipStream::GzipStream()
+{
+	_compressor = (tdefl_compressor*)Psram::alloc(sizeof(tdefl_compressor));
+
+	if(_compressor == NULL)
+		debug_println_e(F("Could not allocate compressor."));
+}
+
+GzipStream::~GzipStream()
+{
+	free(_compressor);
+}
+
+GzipStream::operator bool()
+{
+	return _compressor != NULL;
+}
+
+/******************************************************************************
+ * Start a stream, header is written to out
+ * @param out Where compressed data is written
+ * @return RET_ERROR if compressor is not allocated or header not written
+ ******************************************************************************/
+RetResult GzipStream::begin(Print *out)
+{
+	if(_compressor == NULL)
+		return RET_ERROR;
+
+	_out = out;
+	_failed = false;
+	_crc = 0;
+	_in_len = 0;
+	_out_len = 0;
+	_chunk_len = 0;
+
+	if(tdefl_init(_compressor, put_buf, this, GZIP_DEFLATE_PROBES) != TDEFL_STATUS_OKAY ||
+		out_write(GZIP_HEADER, sizeof(GZIP_HEADER)) != sizeof(GZIP_HEADER))
+	{
+		_failed = true;
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Compress what is left and write trailer, ends the stream
+ * @return RET_ERROR if any part of the stream could not be compressed or written
+ ******************************************************************************/
+RetResult GzipStream::finish()
+{
+	if(_out == NULL)
+		return RET_ERROR;
+
+	if(!_failed && feed(TDEFL_FINISH) == RET_OK)
+	{
+		// Trailer: CRC32 and input size, little endian as required by format
+		if(out_write(&_crc, sizeof(_crc)) != sizeof(_crc) || out_write(&_in_len, sizeof(_in_len)) != sizeof(_in_len))
+			_failed = true;
+	}
+
+	_out = NULL;
+
+	return _failed ? RET_ERROR : RET_OK;
+}
+
+size_t GzipStream::write(uint8_t byte)
+{
+	return write(&byte, 1);
+}
+
+/******************************************************************************
+ * Buffer input, a full chunk is fed to the compressor
+ * @return Bytes taken, 0 once the stream failed
+ ******************************************************************************/
+size_t GzipStream::write(const uint8_t *buff, size_t size)
+{
+	if(_out == NULL || _failed)
+		return 0;
+
+	_crc = Utils::crc32_update(_crc, buff, size);
+	_in_len += size;
+
+	size_t left = size;
+
+	while(left > 0)
+	{
+		int count = min((int)left, GZIP_STREAM_CHUNK_SIZE - _chunk_len);
+
+		memcpy(_chunk + _chunk_len, buff, count);
+		_chunk_len += count;
+		buff += count;
+		left -= count;
+
+		if(_chunk_len == GZIP_STREAM_CHUNK_SIZE && feed(TDEFL_NO_FLUSH) != RET_OK)
+			return 0;
+	}
+
+	return size;
+}
+
+/******************************************************************************
+ * Compressed length of what writer writes, same bytes are compressed to the
+ * same length. Output is discarded
+ * @return Length, header and trailer included. -1 on error
+ ******************************************************************************/
+int GzipStream::measure(Writer writer)
+{
+	GzipCountPrint count;
+
+	if(begin(&count) != RET_OK)
+		return -1;
+
+	writer(*this);
+
+	if(finish() != RET_OK)
+		return -1;
+
+	return count.count;
+}
+
+/******************************************************************************
+ * Uncompressed bytes of the current (or last) stream
+ ******************************************************************************/
+int GzipStream::get_in_len()
+{
+	return _in_len;
+}
+
+/******************************************************************************
+ * Compressed bytes of the current (or last) stream, header and trailer included
+ ******************************************************************************/
+int GzipStream::get_out_len()
+{
+	return _out_len;
+}
+
+/******************************************************************************
+ * Compress the buffered chunk
+ ******************************************************************************/
+RetResult GzipStream::feed(tdefl_flush flush)
+{
+	PowerLock::Scoped cpu_lock(PowerLock::LOCK_CPU_MAX);
+
+	tdefl_status status = tdefl_compress_buffer(_compressor, _chunk, _chunk_len, flush);
+	_chunk_len = 0;
+
+	if(status != (flush == TDEFL_FINISH ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY))
+	{
+		debug_println_e(F("Compression failed."));
+		_failed = true;
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write to output and count
+ ******************************************************************************/
+size_t GzipStream::out_write(const void *buff, size_t size)
+{
+	size_t written = _out->write((const uint8_t*)buff, size);
+	_out_len += written;
+
+	return written;
+}
+
+/******************************************************************************
+ * Compressor output callback, false stops the compressor
+ ******************************************************************************/
+int GzipStream::put_buf(const void *buff, int len, void *user)
+{
+	GzipStream *stream = (GzipStream*)user;
+
+	return stream->out_write(buff, len) == (size_t)len;
+}
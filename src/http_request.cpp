@@ -1,9 +1,62 @@
 #include "http_request.h"
 #include "common.h"
 #include "wifi_modem.h"
+#include "http_session.h"
+#include "uplink_controller.h"
+#include "trace.h"
+#include "uplink_metrics.h"
+#include "tls_client.h"
+#include "bearer.h"
+#include <new>
 
 // TODO: Comment everything
 
+/******************************************************************************
+* Print adapter buffering writes to a client. Serializers write a few bytes at
+* a time, which would otherwise end up in a modem send command each.
+******************************************************************************/
+class BufferedClientWriter : public Print
+{
+public:
+	BufferedClientWriter(Print &client) : _client(client) {}
+
+	~BufferedClientWriter()
+	{
+		flush();
+	}
+
+	size_t write(uint8_t c)
+	{
+		if(_len >= (int)sizeof(_buff))
+			flush();
+
+		_buff[_len++] = c;
+
+		return 1;
+	}
+
+	size_t write(const uint8_t *data, size_t size)
+	{
+		for(size_t i = 0; i < size; i++)
+			write(data[i]);
+
+		return size;
+	}
+
+	void flush()
+	{
+		if(_len > 0)
+			_client.write(_buff, _len);
+
+		_len = 0;
+	}
+
+private:
+	Print &_client;
+	uint8_t _buff[HTTP_STREAM_WRITE_BUFF_SIZE];
+	int _len = 0;
+};
+
 /******************************************************************************
 * Constructor
 * @param modem TinyGsm object
@@ -26,6 +79,23 @@ RetResult HttpRequest::get(const char *path, char *resp_buff, int resp_buff_size
 	return req(METHOD_GET, path, resp_buff, resp_buff_size, NULL, 0, NULL);
 }
 
+/******************************************************************************
+* Execute GET request with response body read directly from the connection,
+* no response buffer needed
+* @param path URL path
+* @param reader Reads response body
+******************************************************************************/
+RetResult HttpRequest::get(const char *path, ResponseReader reader)
+{
+	_response_reader = reader;
+
+	RetResult ret = req(METHOD_GET, path, NULL, 0, NULL, 0, NULL);
+
+	_response_reader = nullptr;
+
+	return ret;
+}
+
 /******************************************************************************
 * Execute POST request
 * @param path URL path
@@ -41,35 +111,138 @@ RetResult HttpRequest::post(const char *path, const unsigned char *body, int bod
 	return req(METHOD_POST, path, resp_buff, resp_buff_size, body, body_len, content_type);
 }
 
+/******************************************************************************
+* Execute POST request with body written directly to the connection, no body
+* buffer needed
+* @param path URL path
+* @param body_writer Writes exactly body_len bytes
+* @param body_len Body length
+* @param content_type Content-type header
+* @param resp_buff Buffer for response. Can be NULL
+* @param resp_buff_size Response buffer size. 0 if no buffer
+******************************************************************************/
+RetResult HttpRequest::post(const char *path, BodyWriter body_writer, int body_len, char *content_type,
+	char *resp_buff, int resp_buff_size)
+{
+	_body_writer = body_writer;
+
+	RetResult ret = req(METHOD_POST, path, resp_buff, resp_buff_size, NULL, body_len, content_type);
+
+	_body_writer = nullptr;
+
+	return ret;
+}
+
 /******************************************************************************
 * Execute a request
 ******************************************************************************/
 RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int resp_buff_size,
 	const unsigned char *body, int body_len, char *content_type)
 {
-	// Use WiFi client in WiFi mode
-	#if WIFI_DATA_SUBMISSION
-		WiFiClient client;
-	#else
-		TinyGsmClient client(*_modem);
+	Trace::Span span(Trace::SPAN_HTTP_REQUEST);
+
+	uint32_t start_ms = millis();
+	_response_code = 0;
+	_response_length = 0;
+
+	RetResult ret = req_with_transport(method, path, resp_buff, resp_buff_size, body, body_len, content_type);
+
+	UplinkMetrics::on_request(millis() - start_ms, body_len, _response_length, _response_code);
+	Bearer::on_request(millis() - start_ms, ret == RET_OK);
+
+	return ret;
+}
+
+/******************************************************************************
+* Execute a request on modem HTTP client, session connection or a new one
+******************************************************************************/
+RetResult HttpRequest::req_with_transport(Method method, const char *path, char *resp_buff, int resp_buff_size,
+	const unsigned char *body, int body_len, char *content_type)
+{
+	// Whole request on the modem's HTTP client if it fits
+	// Not over TLS, modem does a full handshake on every request
+	#if GSM_NATIVE_HTTP && defined(TINY_GSM_MODEM_SIM7000) && !WIFI_DATA_SUBMISSION
+		if(body_len <= HTTP_MODEM_MAX_BODY_LEN && !TlsClient::is_tls_port(_port) &&
+			Bearer::get_active() == Bearer::BEARER_CELLULAR)
+		{
+			return req_with_modem(method, path, resp_buff, resp_buff_size, body, body_len, content_type);
+		}
 	#endif
 
-    HttpClient http_client(client, _server, _port);
+	// Reuse connection of open session to this server
+	HttpClient *session_client = HttpSession::get_client(_server, _port);
+
+	if(session_client != NULL)
+	{
+		return req_with_client(*session_client, true, method, path, resp_buff, resp_buff_size,
+			body, body_len, content_type);
+	}
+
+	// Client of the bearer call home connected over
+	Client *client = Bearer::new_client(0);
+
+	if(client == NULL)
+	{
+		debug_println_e(F("Could not allocate client."));
+		return RET_ERROR;
+	}
+
+	// TLS contexts are large, off the stack
+	Client *net_client = client;
+	TlsClient *tls_client = NULL;
+
+	if(TlsClient::is_tls_port(_port))
+	{
+		tls_client = new (std::nothrow) TlsClient(client);
+
+		if(tls_client == NULL)
+		{
+			debug_println_e(F("Could not allocate TLS client."));
+			delete client;
+			return RET_ERROR;
+		}
+
+		net_client = tls_client;
+	}
+
+	RetResult ret = RET_ERROR;
+
+	{
+		HttpClient http_client(*net_client, _server, _port);
+
+		ret = req_with_client(http_client, false, method, path, resp_buff, resp_buff_size,
+			body, body_len, content_type);
+	}
+
+	delete tls_client;
+	delete client;
+
+	return ret;
+}
 
+/******************************************************************************
+* Execute a request with given client
+* @param keep_alive Client belongs to HttpSession, connection is left open
+******************************************************************************/
+RetResult HttpRequest::req_with_client(HttpClient &http_client, bool keep_alive, Method method,
+	const char *path, char *resp_buff, int resp_buff_size, const unsigned char *body, int body_len,
+	char *content_type)
+{
 	debug_print(F("Request to: "));
 	debug_print(_server);
 	debug_println(path);
 	debug_print(F("Port: "));
 	debug_println(_port, DEC);
 
-	if(!GSM::is_gprs_connected())
+	if(!Bearer::is_connected())
     {
-        debug_println(F("GPRS is not connected, request aborted."));
+        debug_println(F("Bearer is not connected, request aborted."));
         return RET_ERROR;
     }
 
-	http_client.setTimeout(HTTP_CLIENT_STREAM_TIMEOUT);
-	http_client.setHttpResponseTimeout(HTTL_CLIENT_REPONSE_TIMEOUT);
+	// Longer timeouts on bad links
+	http_client.setTimeout(UplinkController::get_stream_timeout());
+	http_client.setHttpResponseTimeout(UplinkController::get_response_timeout());
 
 	int ret = 0;
 
@@ -77,6 +250,35 @@ RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int
 	{
 		ret = http_client.get(path);
 	}
+	else if(method == METHOD_POST && (_content_encoding != NULL || _body_writer))
+	{
+		// Extra header or streamed body, send request in parts
+		http_client.beginRequest();
+		ret = http_client.post(path);
+
+		if(ret == 0)
+		{
+			http_client.sendHeader(HTTP_HEADER_CONTENT_TYPE, content_type);
+			http_client.sendHeader(HTTP_HEADER_CONTENT_LENGTH, body_len);
+
+			if(_content_encoding != NULL)
+				http_client.sendHeader("Content-Encoding", _content_encoding);
+
+			http_client.beginBody();
+
+			if(_body_writer)
+			{
+				BufferedClientWriter writer(http_client);
+				_body_writer(writer);
+			}
+			else
+			{
+				http_client.write(body, body_len);
+			}
+
+			http_client.endRequest();
+		}
+	}
 	else if(method == METHOD_POST)
 	{
 		ret = http_client.post(path, content_type, body_len, body);
@@ -86,6 +288,10 @@ RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int
     {
         debug_print(F("Could not execute request. Error: "));
         debug_println(ret, DEC);
+
+		if(keep_alive)
+			HttpSession::on_request_complete(false);
+
         return RET_ERROR;
     }
 
@@ -95,6 +301,10 @@ RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int
     if(!_response_code)
     {
         debug_println(F("Could not get response code."));
+
+		if(keep_alive)
+			HttpSession::on_request_complete(false);
+
         return RET_ERROR;
     }
 
@@ -104,7 +314,16 @@ RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int
     debug_println(content_length, DEC);
 
 	int bytes_read = 0;
-	if(resp_buff != NULL && resp_buff_size > 1)
+	RetResult read_ret = RET_OK;
+
+	if(_response_reader)
+	{
+		read_ret = _response_reader(http_client, content_length);
+
+		// Reader may stop before end of body, rest is discarded below
+		bytes_read = content_length > 0 ? content_length : 0;
+	}
+	else if(resp_buff != NULL && resp_buff_size > 1)
 	{   
 		// If content length header set, read up to this amount of bytes or until buffer is full
 		// If header not set, read until stream has no more bytes or buffer is full
@@ -130,11 +349,228 @@ RetResult HttpRequest::req(Method method, const char *path, char *resp_buff, int
 		}
 	}
 
-    http_client.stop();
+	if(keep_alive)
+	{
+		// Connection can only be reused if the whole response body has been consumed
+		char discard[32];
+		int bytes_left = _response_reader ? (http_client.endOfBodyReached() ? 0 : content_length) : content_length - bytes_read;
+
+		while(bytes_left > 0 && !http_client.endOfBodyReached())
+		{
+			int n = http_client.readBytes(discard, bytes_left < (int)sizeof(discard) ? bytes_left : sizeof(discard));
+			if(n <= 0)
+				break;
+
+			bytes_left -= n;
+		}
+
+		HttpSession::on_request_complete(content_length >= 0 && http_client.endOfBodyReached());
+	}
+	else
+	{
+		http_client.stop();
+	}
 
     _response_length = bytes_read;
     
-    return RET_OK;
+    return read_ret;
+}
+
+/******************************************************************************
+* Execute a request with the modem's HTTP(S) client (SIM7000 AT+SH* commands).
+* Body is sent in a single AT transfer and TLS (port 443) is handled by the
+* modem, so no socket reads/writes go through the MCU.
+******************************************************************************/
+RetResult HttpRequest::req_with_modem(Method method, const char *path, char *resp_buff, int resp_buff_size,
+	const unsigned char *body, int body_len, char *content_type)
+{
+#if defined(TINY_GSM_MODEM_SIM7000)
+	debug_print(F("Modem HTTP request to: "));
+	debug_print(_server);
+	debug_println(path);
+
+	if(!GSM::is_gprs_connected())
+	{
+		debug_println(F("GPRS is not connected, request aborted."));
+		return RET_ERROR;
+	}
+
+	_response_code = 0;
+	_response_length = 0;
+
+	bool tls = _port == 443;
+
+	_modem->sendAT(GF("+SHCONF=\"URL\",\""), tls ? "https://" : "http://", _server, ':', _port, '"');
+	if(_modem->waitResponse() != 1)
+		return RET_ERROR;
+
+	_modem->sendAT(GF("+SHCONF=\"BODYLEN\","), HTTP_MODEM_MAX_BODY_LEN);
+	_modem->waitResponse();
+	_modem->sendAT(GF("+SHCONF=\"HEADERLEN\","), HTTP_MODEM_MAX_HEADER_LEN);
+	_modem->waitResponse();
+
+	if(tls)
+	{
+		// TLS 1.2, server certificate not verified
+		_modem->sendAT(GF("+CSSLCFG=\"sslversion\",1,3"));
+		_modem->waitResponse();
+		_modem->sendAT(GF("+SHSSL=1,\"\""));
+		_modem->waitResponse();
+	}
+
+	_modem->sendAT(GF("+SHCONN"));
+	if(_modem->waitResponse(HTTP_MODEM_CONNECT_TIMEOUT_MS) != 1)
+	{
+		debug_println(F("Modem HTTP could not connect."));
+		return RET_ERROR;
+	}
+
+	RetResult ret = modem_request(method, path, resp_buff, resp_buff_size, body, body_len, content_type);
+
+	_modem->sendAT(GF("+SHDISC"));
+	_modem->waitResponse();
+
+	return ret;
+#else
+	return RET_ERROR;
+#endif
+}
+
+/******************************************************************************
+* Send headers, body and request on connected modem HTTP client, then read
+* the response
+******************************************************************************/
+RetResult HttpRequest::modem_request(Method method, const char *path, char *resp_buff, int resp_buff_size,
+	const unsigned char *body, int body_len, char *content_type)
+{
+	_modem->sendAT(GF("+SHCHEAD"));
+	_modem->waitResponse();
+
+	if(method == METHOD_POST)
+	{
+		_modem->sendAT(GF("+SHAHEAD=\"Content-Type\",\""), content_type, '"');
+		_modem->waitResponse();
+
+		if(_content_encoding != NULL)
+		{
+			_modem->sendAT(GF("+SHAHEAD=\"Content-Encoding\",\""), _content_encoding, '"');
+			_modem->waitResponse();
+		}
+
+		// Body in one transfer after the prompt
+		_modem->sendAT(GF("+SHBOD="), body_len, ',', UplinkController::get_stream_timeout());
+		if(_modem->waitResponse(GF(">")) != 1)
+		{
+			debug_println(F("Modem HTTP body not accepted."));
+			return RET_ERROR;
+		}
+
+		if(_body_writer)
+		{
+			BufferedClientWriter writer(_modem->stream);
+			_body_writer(writer);
+		}
+		else
+		{
+			_modem->stream.write(body, body_len);
+		}
+
+		if(_modem->waitResponse(UplinkController::get_stream_timeout()) != 1)
+			return RET_ERROR;
+	}
+
+	// 1: GET, 3: POST
+	_modem->sendAT(GF("+SHREQ=\""), path, GF("\","), method == METHOD_GET ? 1 : 3);
+	if(_modem->waitResponse() != 1)
+		return RET_ERROR;
+
+	// +SHREQ: "<method>",<status>,<data len>
+	if(_modem->waitResponse(UplinkController::get_response_timeout(), GF("+SHREQ:")) != 1)
+	{
+		debug_println(F("Could not get response code."));
+		return RET_ERROR;
+	}
+
+	_modem->stream.readStringUntil(',');
+	_response_code = _modem->stream.readStringUntil(',').toInt();
+	_response_length = _modem->stream.readStringUntil('\n').toInt();
+
+	debug_print(F("Response code: "));
+	debug_println(_response_code, DEC);
+	debug_print(F("Content length: "));
+	debug_println(_response_length, DEC);
+
+	if(!_response_code)
+		return RET_ERROR;
+
+	// Whole body in one read, handed to reader as it arrives
+	if(_response_reader)
+	{
+		_modem->sendAT(GF("+SHREAD=0,"), _response_length);
+		if(_modem->waitResponse() != 1 ||
+			_modem->waitResponse(UplinkController::get_stream_timeout(), GF("+SHREAD:")) != 1)
+		{
+			return RET_ERROR;
+		}
+
+		int len = _modem->stream.readStringUntil('\n').toInt();
+		RetResult ret = _response_reader(_modem->stream, len);
+
+		// Rest of body and final response
+		_modem->waitResponse();
+
+		return ret;
+	}
+
+	return read_modem_response(resp_buff, resp_buff_size);
+}
+
+/******************************************************************************
+* Read response body of a modem HTTP request into buffer, in chunks
+* +SHREAD: <len>\r\n<data>
+******************************************************************************/
+RetResult HttpRequest::read_modem_response(char *resp_buff, int resp_buff_size)
+{
+	int bytes_read = 0;
+
+	if(resp_buff != NULL && resp_buff_size > 1)
+	{
+		int bytes_to_read = _response_length < resp_buff_size - 1 ? _response_length : resp_buff_size - 1;
+
+		while(bytes_read < bytes_to_read)
+		{
+			int chunk = bytes_to_read - bytes_read < HTTP_MODEM_READ_CHUNK ? bytes_to_read - bytes_read : HTTP_MODEM_READ_CHUNK;
+
+			_modem->sendAT(GF("+SHREAD="), bytes_read, ',', chunk);
+			if(_modem->waitResponse() != 1 ||
+				_modem->waitResponse(UplinkController::get_stream_timeout(), GF("+SHREAD:")) != 1)
+			{
+				debug_println(F("Could not read modem HTTP response."));
+				break;
+			}
+
+			int len = _modem->stream.readStringUntil('\n').toInt();
+			int n = _modem->stream.readBytes(resp_buff + bytes_read, len < chunk ? len : chunk);
+			if(n <= 0)
+				break;
+
+			bytes_read += n;
+		}
+
+		resp_buff[bytes_read] = '\0';
+
+		if(bytes_read != bytes_to_read)
+		{
+			debug_print(F("Partial response read. Should be: "));
+			debug_print(bytes_to_read, DEC);
+			debug_print(F(" - Read: "));
+			debug_println(bytes_read);
+		}
+	}
+
+	_response_length = bytes_read;
+
+	return RET_OK;
 }
 
 /******************************************************************************
@@ -153,6 +589,16 @@ int HttpRequest::get_response_length()
 	return _response_length;
 }
 
+/******************************************************************************
+* Content-Encoding header of POST body (eg. "gzip"). NULL for none
+******************************************************************************/
+RetResult HttpRequest::set_content_encoding(const char *encoding)
+{
+	_content_encoding = encoding;
+
+	return RET_OK;
+}
+
 /******************************************************************************
 * Port to use for request
 ******************************************************************************/
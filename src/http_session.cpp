@@ -0,0 +1,148 @@
+#include "http_session.h"
+#include "gsm.h"
+#include "wifi_modem.h"
+#include "common.h"
+#include "tls_client.h"
+#include "bearer.h"
+#include <new>
+
+namespace HttpSession
+{
+	//
+	// Private vars
+	//
+	/** Network client, on its own mux so it is not affected by one-off requests */
+	Client *_net_client = NULL;
+
+	/** TLS over network client, for TLS_PORT only */
+	TlsClient *_tls_client = NULL;
+
+	/** HTTP client on top of network client */
+	HttpClient *_http_client = NULL;
+
+	/** Server session is open to */
+	const char *_server = NULL;
+
+	/** Server port */
+	int _port = 0;
+
+	/** Requests done through session, for debugging */
+	int _requests = 0;
+
+	/******************************************************************************
+	 * Open session. Connection itself is established on first request
+	 * @param server Host address
+	 * @param port Host port
+	 *****************************************************************************/
+	RetResult open(const char *server, int port)
+	{
+		close();
+
+		_net_client = Bearer::new_client(HTTP_SESSION_MUX);
+
+		if(_net_client == NULL)
+		{
+			debug_println_e(F("Could not allocate HTTP session."));
+			return RET_ERROR;
+		}
+
+		if(TlsClient::is_tls_port(port))
+		{
+			_tls_client = new (std::nothrow) TlsClient(_net_client);
+
+			if(_tls_client == NULL)
+			{
+				debug_println_e(F("Could not allocate HTTP session."));
+				close();
+				return RET_ERROR;
+			}
+		}
+
+		// Reconnects of the session resume the TLS session
+		Client *client = _tls_client != NULL ? (Client*)_tls_client : (Client*)_net_client;
+
+		_http_client = new (std::nothrow) HttpClient(*client, server, port);
+
+		if(_http_client == NULL)
+		{
+			debug_println_e(F("Could not allocate HTTP session."));
+			close();
+			return RET_ERROR;
+		}
+
+		_http_client->connectionKeepAlive();
+
+		_server = server;
+		_port = port;
+		_requests = 0;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Close connection and free session
+	 *****************************************************************************/
+	void close()
+	{
+		if(_http_client != NULL)
+		{
+			debug_print(F("Closing HTTP session. Requests: "));
+			debug_println(_requests, DEC);
+
+			_http_client->stop();
+			delete _http_client;
+			_http_client = NULL;
+		}
+
+		if(_tls_client != NULL)
+		{
+			delete _tls_client;
+			_tls_client = NULL;
+		}
+
+		if(_net_client != NULL)
+		{
+			delete _net_client;
+			_net_client = NULL;
+		}
+
+		_server = NULL;
+		_port = 0;
+	}
+
+	/******************************************************************************
+	 * Check if a session is open
+	 *****************************************************************************/
+	bool is_open()
+	{
+		return _http_client != NULL;
+	}
+
+	/******************************************************************************
+	 * Get client of session if it is open for given server
+	 * @return Client, NULL if no session is open for this server
+	 *****************************************************************************/
+	HttpClient* get_client(const char *server, int port)
+	{
+		if(_http_client == NULL || port != _port || strcmp(server, _server) != 0)
+			return NULL;
+
+		return _http_client;
+	}
+
+	/******************************************************************************
+	 * Called by HttpRequest when a request through session completes
+	 * @param reusable Response was read completely so connection can be reused.
+	 * 		If not, connection is closed and reopened on next request.
+	 *****************************************************************************/
+	void on_request_complete(bool reusable)
+	{
+		if(_http_client == NULL)
+			return;
+
+		_requests++;
+
+		if(!reusable)
+			_http_client->stop();
+	}
+}
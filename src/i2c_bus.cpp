@@ -0,0 +1,58 @@
+#include "i2c_bus.h"
+#include <Wire.h>
+#include "const.h"
+#include "power_lock.h"
+#include "common.h"
+
+namespace I2CBus
+{
+	/******************************************************************************
+	 * Init main I2C bus
+	 *****************************************************************************/
+	void begin()
+	{
+		Wire.begin(PIN_I2C1_SDA, PIN_I2C1_SCL, I2C_BUS_FREQ_HZ);
+	}
+
+	/******************************************************************************
+	 * Read len consecutive registers starting from reg in one transaction. Device
+	 * must auto-increment its register pointer on sequential reads
+	 * @param addr	Device address
+	 * @param reg	First register
+	 * @param buf	Output buffer, at least len bytes
+	 * @param len	Number of registers to read
+	 *****************************************************************************/
+	RetResult read_regs(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+	{
+		PowerLock::Scoped apb_lock(PowerLock::LOCK_APB_MAX);
+
+		Wire.beginTransmission(addr);
+		Wire.write(reg);
+
+		// Repeated start, bus is not released between pointer write and read
+		if(Wire.endTransmission(false) != 0)
+			return RET_ERROR;
+
+		if(Wire.requestFrom(addr, len) != len)
+			return RET_ERROR;
+
+		for(uint8_t i = 0; i < len; i++)
+			buf[i] = Wire.read();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Write single register
+	 *****************************************************************************/
+	RetResult write_reg(uint8_t addr, uint8_t reg, uint8_t value)
+	{
+		PowerLock::Scoped apb_lock(PowerLock::LOCK_APB_MAX);
+
+		Wire.beginTransmission(addr);
+		Wire.write(reg);
+		Wire.write(value);
+
+		return Wire.endTransmission() == 0 ? RET_OK : RET_ERROR;
+	}
+}
@@ -6,6 +6,8 @@
 #include "log.h"
 #include "rtc.h"
 #include "common.h"
+#include "app_config.h"
+#include <math.h>
 
 namespace IntEnvSensor
 {
@@ -15,11 +17,24 @@ namespace IntEnvSensor
 /** Sensor object */
 BME280 sensor;
 
+/** Sensor found and inited. Warm boot skips init, done on first read */
+bool _inited = false;
+
+/** Mode readback probe has succeeded once since boot, skipped after that */
+bool _alive = false;
+
 /******************************************************************************
 * Init fuel gauge
 ******************************************************************************/
 RetResult init()
 {
+	// Measurement profile, applied by begin
+	sensor.settings.tStandby = 0;
+	sensor.settings.filter = INT_ENV_FILTER;
+	sensor.settings.tempOverSample = INT_ENV_TEMP_OVERSAMPLE;
+	sensor.settings.pressOverSample = INT_ENV_PRESS_OVERSAMPLE;
+	sensor.settings.humidOverSample = INT_ENV_HUM_OVERSAMPLE;
+
 	sensor.setI2CAddress(BME280_I2C_ADDR1);
 
 	if (sensor.beginI2C(Wire) == false)
@@ -38,11 +53,17 @@ RetResult init()
 		}
 	}
 
+	// Lib starts the sensor in normal mode, reads trigger forced conversions instead
+	sensor.setMode(MODE_SLEEP);
+
+	_inited = true;
+
 	return RET_OK;
 }
 
 /******************************************************************************
-* Wake up, measure and go back to sleep
+* Trigger a forced conversion and read all measurements with one burst read.
+* Sensor returns to sleep when the conversion is done.
 * Pass NULL to ignore a measurement
 * @param temp Temperature output
 * @param hum Humidity output
@@ -51,41 +72,64 @@ RetResult init()
 ******************************************************************************/
 RetResult read(float *temp = NULL, float *hum = NULL, int *press = NULL, int *alt = NULL)
 {
-	// Wake up
-	sensor.setMode(1);
+	if(!_inited && init() != RET_OK)
+	{
+		return RET_ERROR;
+	}
+
+	sensor.setMode(MODE_FORCED);
 
-	// Try to read mode back to see if the device is alive
+	// Try to read mode back to see if the device is alive, once per boot
 	// There is no other way to check if the sensor actually is there with this lib
-	if (sensor.getMode() != 1)
+	if (!_alive)
 	{
-		return RET_ERROR;
+		if (sensor.getMode() != MODE_FORCED)
+		{
+			return RET_ERROR;
+		}
+
+		_alive = true;
 	}
 
+	uint32_t start = millis();
+	while (sensor.isMeasuring())
+	{
+		if (millis() - start > BME280_CONVERSION_TIMEOUT_MS)
+		{
+			debug_println_e(F("BME280 conversion timed out."));
+			return RET_ERROR;
+		}
+
+		delay(1);
+	}
+
+	// Burst read of all data registers, compensated with the calibration read on init
+	BME280_SensorMeasurements data;
+	sensor.readAllMeasurements(&data, 0);
+
 	if (temp != NULL)
 	{
-		*temp = sensor.readTempC();
+		*temp = data.temperature;
 	}
 
 	if (hum != NULL)
 	{
-		*hum = sensor.readFloatHumidity();
+		*hum = data.humidity;
 	}
 
 	if (press != NULL)
 	{
-		*press = (int)(sensor.readFloatPressure() / 100);
+		*press = (int)(data.pressure / 100);
 	}
 
 	if (alt != NULL)
 	{
-		*alt = (int)sensor.readFloatAltitudeMeters();
+		// Same as lib's readFloatAltitudeMeters() without reading pressure again
+		*alt = (int)(-44330.77 * (powf(data.pressure / BME280_SEA_LEVEL_PRESSURE_PA, 0.190263) - 1));
 		//I (manolis) think this requires prior calibration for pressure at sea level or smt
 		//TODO confirm its working else remove
 	}
 
-	// Go back to sleep
-	sensor.setMode(00);
-
 	return RET_OK;
 }
 
@@ -118,8 +162,9 @@ RetResult log()
 	// Log RTC tmp
 	if(FLAGS.EXTERNAL_RTC_ENABLED)
 	{
-		Log::log(Log::RTC_TEMPERATURE, RTC::get_external_rtc_temp());
-		debug_printf("RTC Temp: %4.2f\n", RTC::get_external_rtc_temp());
+		float rtc_temp = RTC::get_external_rtc_temp();
+		Log::log(Log::RTC_TEMPERATURE, rtc_temp);
+		debug_printf("RTC Temp: %4.2f\n", rtc_temp);
 	}
 
 	return ret;
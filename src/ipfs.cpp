@@ -0,0 +1,411 @@
+#include "Arduino.h"
+#include "ipfs.h"
+#include <new>
+#include <limits.h>
+#include "mbedtls/sha256.h"
+#include "storage.h"
+#include "http_request.h"
+#include "gsm.h"
+#include "utils.h"
+#include "common.h"
+#include "board_features.h"
+
+#if FEATURE_IPFS
+
+namespace Ipfs
+{
+	//
+	// Private functions
+	//
+	int write_varint(uint32_t val, uint8_t *buff);
+	RetResult read_varint(File &f, uint32_t *val);
+	int read_roots(File &f, uint8_t *roots, int max_count, uint32_t *car_len);
+	int build_car_header(const uint8_t *roots, int count, uint8_t *buff, int buff_size);
+
+	//
+	// Private vars
+	//
+	/** CIDv1 prefix: version, raw codec, sha2-256, digest length */
+	const uint8_t CID_PREFIX[] = {0x01, 0x55, 0x12, 0x20};
+
+	static_assert(sizeof(CID_PREFIX) + 32 == IPFS_CID_LEN, "CID is prefix and sha2-256 digest");
+
+	/** RFC 4648 lowercase, the multibase 'b' alphabet */
+	const char BASE32_ALPHABET[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+	/** DAG-CBOR header of a CAR: {"roots": [tag 42 CIDs], "version": 1}, keys in canonical order */
+	const uint8_t CBOR_ROOTS_KEY[] = {0xA2, 0x65, 'r', 'o', 'o', 't', 's'};
+	const uint8_t CBOR_VERSION_KEY[] = {0x67, 'v', 'e', 'r', 's', 'i', 'o', 'n', 0x01};
+	/** Tag 42, 37 byte string, identity multibase prefix */
+	const uint8_t CBOR_CID_PREFIX[] = {0xD8, 0x2A, 0x58, IPFS_CID_LEN + 1, 0x00};
+
+	/** Largest CAR header, IPFS_MAX_BLOCKS_PER_UPLOAD roots */
+	const int CAR_HEADER_MAX_SIZE = 5 + sizeof(CBOR_ROOTS_KEY) + 3 + sizeof(CBOR_VERSION_KEY) +
+		IPFS_MAX_BLOCKS_PER_UPLOAD * (sizeof(CBOR_CID_PREFIX) + IPFS_CID_LEN);
+
+	/******************************************************************************
+	* CID of a raw block, sha2-256 on the SHA accelerator (mbedtls hardware SHA)
+	******************************************************************************/
+	RetResult compute_cid(const uint8_t *data, int len, uint8_t cid[IPFS_CID_LEN])
+	{
+		memcpy(cid, CID_PREFIX, sizeof(CID_PREFIX));
+
+		if(mbedtls_sha256_ret(data, len, cid + sizeof(CID_PREFIX), 0) != 0)
+		{
+			debug_println_e(F("Could not hash IPFS block."));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* CID as a string, multibase base32 as printed by IPFS for CIDv1
+	******************************************************************************/
+	void cid_to_str(const uint8_t cid[IPFS_CID_LEN], char *buff, int buff_size)
+	{
+		int out = 0;
+		uint32_t bits = 0;
+		int bit_count = 0;
+
+		if(buff_size < IPFS_CID_STR_SIZE)
+		{
+			if(buff_size > 0)
+				buff[0] = '\0';
+
+			return;
+		}
+
+		buff[out++] = 'b';
+
+		for(int i = 0; i < IPFS_CID_LEN; i++)
+		{
+			bits = (bits << 8) | cid[i];
+			bit_count += 8;
+
+			while(bit_count >= 5)
+			{
+				buff[out++] = BASE32_ALPHABET[(bits >> (bit_count - 5)) & 0x1F];
+				bit_count -= 5;
+			}
+		}
+
+		// Unpadded, last bits shifted to the top of a char
+		if(bit_count > 0)
+			buff[out++] = BASE32_ALPHABET[(bits << (5 - bit_count)) & 0x1F];
+
+		buff[out] = '\0';
+	}
+
+	/******************************************************************************
+	* Compute CID of a block and add it to the pending upload
+	* @param cid_str CID string, IPFS_CID_STR_SIZE
+	* @return RET_ERROR if pending blocks are full or could not be written, CID
+	* must not be submitted
+	******************************************************************************/
+	RetResult add_block(const uint8_t *data, int len, char *cid_str, int cid_str_size)
+	{
+		uint8_t cid[IPFS_CID_LEN];
+
+		if(compute_cid(data, len, cid) != RET_OK)
+			return RET_ERROR;
+
+		if(get_pending_count() >= IPFS_MAX_BLOCKS_PER_UPLOAD)
+		{
+			debug_println_w(F("Too many pending IPFS blocks."));
+			return RET_ERROR;
+		}
+
+		File f = STORAGE_FS.open(IPFS_PENDING_PATH, "a");
+		if(!f)
+		{
+			debug_println_e(F("Could not open pending IPFS blocks."));
+			return RET_ERROR;
+		}
+
+		if(f.size() + len + IPFS_CID_LEN + 5 > IPFS_PENDING_MAX_SIZE)
+		{
+			debug_println_w(F("Pending IPFS blocks full."));
+			f.close();
+			return RET_ERROR;
+		}
+
+		// CAR section: varint length of CID and data, CID, data
+		uint8_t len_buff[5];
+		int len_size = write_varint(IPFS_CID_LEN + len, len_buff);
+
+		bool ok = f.write(len_buff, len_size) == (size_t)len_size &&
+			f.write(cid, IPFS_CID_LEN) == IPFS_CID_LEN &&
+			f.write(data, len) == (size_t)len;
+
+		f.close();
+
+		if(!ok)
+		{
+			// Partial section would corrupt the CAR, drop all pending blocks
+			debug_println_e(F("Could not write pending IPFS block."));
+			STORAGE_FS.remove(IPFS_PENDING_PATH);
+			return RET_ERROR;
+		}
+
+		cid_to_str(cid, cid_str, cid_str_size);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Import all pending blocks to the IPFS node as one CAR over the modem.
+	* Pending blocks are deleted only once the node accepted them
+	******************************************************************************/
+	RetResult upload_pending()
+	{
+		if(!STORAGE_FS.exists(IPFS_PENDING_PATH))
+			return RET_OK;
+
+		File f = STORAGE_FS.open(IPFS_PENDING_PATH, FILE_READ);
+		if(!f)
+			return RET_ERROR;
+
+		uint8_t *roots = new (std::nothrow) uint8_t[IPFS_MAX_BLOCKS_PER_UPLOAD * IPFS_CID_LEN];
+		uint8_t *header = new (std::nothrow) uint8_t[CAR_HEADER_MAX_SIZE];
+
+		if(roots == NULL || header == NULL)
+		{
+			debug_println_e(F("Could not allocate CAR header."));
+			delete[] roots;
+			delete[] header;
+			f.close();
+			return RET_ERROR;
+		}
+
+		uint32_t sections_len = 0;
+		int count = read_roots(f, roots, IPFS_MAX_BLOCKS_PER_UPLOAD, &sections_len);
+		int header_len = count > 0 ? build_car_header(roots, count, header, CAR_HEADER_MAX_SIZE) : 0;
+
+		delete[] roots;
+
+		if(count <= 0 || header_len <= 0)
+		{
+			debug_println_e(F("Invalid pending IPFS blocks, dropped."));
+			delete[] header;
+			f.close();
+			STORAGE_FS.remove(IPFS_PENDING_PATH);
+			return RET_ERROR;
+		}
+
+		char preamble[128] = "";
+		int preamble_len = snprintf(preamble, sizeof(preamble), "--%s\r\nContent-Disposition: form-data; "
+			"name=\"file\"; filename=\"data.car\"\r\nContent-Type: application/vnd.ipld.car\r\n\r\n", IPFS_MULTIPART_BOUNDARY);
+
+		char epilogue[32] = "";
+		int epilogue_len = snprintf(epilogue, sizeof(epilogue), "\r\n--%s--\r\n", IPFS_MULTIPART_BOUNDARY);
+
+		char content_type[64] = "";
+		snprintf(content_type, sizeof(content_type), "multipart/form-data; boundary=%s", IPFS_MULTIPART_BOUNDARY);
+
+		int body_len = preamble_len + header_len + sections_len + epilogue_len;
+
+		debug_printf("Uploading %d IPFS blocks, bytes: %d\n", count, body_len);
+
+		HttpRequest http_req(GSM::get_modem(), IPFS_NODE_ADDR);
+		http_req.set_port(IPFS_NODE_PORT);
+
+		RetResult ret = http_req.post(IPFS_DAG_IMPORT_PATH, [&](Print &out)
+			{
+				out.write((const uint8_t*)preamble, preamble_len);
+				out.write(header, header_len);
+
+				uint8_t buff[256];
+				uint32_t left = sections_len;
+
+				f.seek(0);
+
+				while(left > 0)
+				{
+					int read = f.read(buff, left < sizeof(buff) ? left : sizeof(buff));
+					if(read <= 0)
+						break;
+
+					out.write(buff, read);
+					left -= read;
+				}
+
+				out.write((const uint8_t*)epilogue, epilogue_len);
+			}, body_len, content_type, NULL, 0);
+
+		delete[] header;
+		f.close();
+
+		if(ret != RET_OK || http_req.get_response_code() != 200)
+		{
+			debug_printf_e("IPFS upload failed, response code: %u. Retrying next call home.\n", http_req.get_response_code());
+			return RET_ERROR;
+		}
+
+		STORAGE_FS.remove(IPFS_PENDING_PATH);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Blocks waiting for upload
+	******************************************************************************/
+	int get_pending_count()
+	{
+		if(!STORAGE_FS.exists(IPFS_PENDING_PATH))
+			return 0;
+
+		File f = STORAGE_FS.open(IPFS_PENDING_PATH, FILE_READ);
+		if(!f)
+			return 0;
+
+		uint32_t sections_len = 0;
+		int count = read_roots(f, NULL, INT_MAX, &sections_len);
+
+		f.close();
+
+		return count > 0 ? count : 0;
+	}
+
+	/******************************************************************************
+	* Walk CAR sections and copy their CIDs
+	* @param roots IPFS_CID_LEN per section, can be NULL to count only
+	* @param car_len Length of sections up to max_count
+	* @return Section count, -1 on a corrupted section
+	******************************************************************************/
+	int read_roots(File &f, uint8_t *roots, int max_count, uint32_t *car_len)
+	{
+		int count = 0;
+		uint32_t pos = 0;
+		uint32_t size = f.size();
+
+		while(pos < size && count < max_count)
+		{
+			uint32_t len = 0;
+
+			f.seek(pos);
+
+			if(read_varint(f, &len) != RET_OK || len <= IPFS_CID_LEN)
+				return -1;
+
+			uint32_t next = f.position() + len;
+			if(next > size)
+				return -1;
+
+			if(roots != NULL && f.read(roots + count * IPFS_CID_LEN, IPFS_CID_LEN) != IPFS_CID_LEN)
+				return -1;
+
+			pos = next;
+			count++;
+		}
+
+		*car_len = pos;
+
+		return count;
+	}
+
+	/******************************************************************************
+	* CAR v1 header, varint length and DAG-CBOR map, with all blocks as roots so
+	* the node pins every one of them
+	* @return Header length, 0 if buffer too small
+	******************************************************************************/
+	int build_car_header(const uint8_t *roots, int count, uint8_t *buff, int buff_size)
+	{
+		// Array header of count, always < 65536
+		uint8_t array_head[3];
+		int array_head_len = 1;
+
+		if(count < 24)
+		{
+			array_head[0] = 0x80 | count;
+		}
+		else if(count < 256)
+		{
+			array_head[0] = 0x98;
+			array_head[1] = count;
+			array_head_len = 2;
+		}
+		else
+		{
+			array_head[0] = 0x99;
+			array_head[1] = count >> 8;
+			array_head[2] = count & 0xFF;
+			array_head_len = 3;
+		}
+
+		uint32_t cbor_len = sizeof(CBOR_ROOTS_KEY) + array_head_len +
+			count * (sizeof(CBOR_CID_PREFIX) + IPFS_CID_LEN) + sizeof(CBOR_VERSION_KEY);
+
+		uint8_t len_buff[5];
+		int len_size = write_varint(cbor_len, len_buff);
+
+		if(len_size + cbor_len > (uint32_t)buff_size)
+			return 0;
+
+		int pos = 0;
+
+		memcpy(buff + pos, len_buff, len_size);
+		pos += len_size;
+		memcpy(buff + pos, CBOR_ROOTS_KEY, sizeof(CBOR_ROOTS_KEY));
+		pos += sizeof(CBOR_ROOTS_KEY);
+		memcpy(buff + pos, array_head, array_head_len);
+		pos += array_head_len;
+
+		for(int i = 0; i < count; i++)
+		{
+			memcpy(buff + pos, CBOR_CID_PREFIX, sizeof(CBOR_CID_PREFIX));
+			pos += sizeof(CBOR_CID_PREFIX);
+			memcpy(buff + pos, roots + i * IPFS_CID_LEN, IPFS_CID_LEN);
+			pos += IPFS_CID_LEN;
+		}
+
+		memcpy(buff + pos, CBOR_VERSION_KEY, sizeof(CBOR_VERSION_KEY));
+		pos += sizeof(CBOR_VERSION_KEY);
+
+		return pos;
+	}
+
+	/******************************************************************************
+	* Unsigned LEB128 varint, as used by CAR
+	* @param buff At least 5 bytes
+	* @return Bytes written
+	******************************************************************************/
+	int write_varint(uint32_t val, uint8_t *buff)
+	{
+		int len = 0;
+
+		do
+		{
+			uint8_t byte = val & 0x7F;
+			val >>= 7;
+
+			buff[len++] = byte | (val > 0 ? 0x80 : 0);
+		} while(val > 0);
+
+		return len;
+	}
+
+	/******************************************************************************
+	* Read an unsigned LEB128 varint
+	******************************************************************************/
+	RetResult read_varint(File &f, uint32_t *val)
+	{
+		*val = 0;
+
+		for(int shift = 0; shift < 35; shift += 7)
+		{
+			int byte = f.read();
+			if(byte < 0)
+				return RET_ERROR;
+
+			*val |= (uint32_t)(byte & 0x7F) << shift;
+
+			if((byte & 0x80) == 0)
+				return RET_OK;
+		}
+
+		return RET_ERROR;
+	}
+}
+
+#endif
@@ -1,13 +1,17 @@
 #include "json_builder_base.h"
+#include "globals.h"
 #include "log.h"
 #include "water_sensor_data.h"
 #include "soil_moisture_data.h"
 #include "sdi12_log.h"
 #include "atmos41_data.h"
 #include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "rollup_data.h"
 #include "fo_data.h"
 #include "common.h"
 #include "common.h"
+#include "board_features.h"
 
 /******************************************************************************
  * Default constructor
@@ -37,6 +41,17 @@ RetResult JsonBuilderBase<TStruct, TDocSize>::build(char *buff_out, int buff_siz
 	return RET_OK;
 }
 
+/******************************************************************************
+ * Serialize output json directly to a stream, measure() bytes are written
+ *****************************************************************************/
+template <typename TStruct, int TDocSize>
+RetResult JsonBuilderBase<TStruct, TDocSize>::build(Print &out)
+{
+	serializeJson(_json_doc, out);
+
+	return RET_OK;
+}
+
 /******************************************************************************
  * Reset object for reuse
  *****************************************************************************/
@@ -56,15 +71,15 @@ RetResult JsonBuilderBase<TStruct, TDocSize>::reset()
 template <typename TStruct, int TDocSize>
 void JsonBuilderBase<TStruct, TDocSize>::print()
 {
-    // Buff size should cover all cases
-	// TODO: Decide buff size
-    char buff[2048] = {0};
+    ScratchBuffer buff(JSON_BUILDER_PRINT_BUFF_SIZE);
+    if(buff.get() == NULL)
+        return;
 
-    build(buff, sizeof(buff), true);
+    build(buff.get(), buff.size(), true);
 
-    debug_println(buff);
+    debug_println(buff.get());
     debug_print(F("Length: "));
-    debug_println(strlen(buff), DEC);
+    debug_println(strlen(buff.get()), DEC);
 }
 
 template <typename TStruct, int TDocSize>
@@ -73,6 +88,55 @@ bool JsonBuilderBase<TStruct, TDocSize>::is_empty()
 	return _json_doc.size() < 1;
 }
 
+/******************************************************************************
+ * Number of entries added
+ *****************************************************************************/
+template <typename TStruct, int TDocSize>
+int JsonBuilderBase<TStruct, TDocSize>::get_count()
+{
+	return _root_array.size();
+}
+
+/******************************************************************************
+ * Remove entries added after the first count ones, eg. an entry that was only
+ * partially added because doc got full
+ *****************************************************************************/
+template <typename TStruct, int TDocSize>
+RetResult JsonBuilderBase<TStruct, TDocSize>::truncate(int count)
+{
+	while((int)_root_array.size() > count)
+		_root_array.remove(_root_array.size() - 1);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Set sequence number (see DataStore::Entry) of last entry added, sent as
+ * the "seq" value so the server can drop resent entries
+ *****************************************************************************/
+template <typename TStruct, int TDocSize>
+RetResult JsonBuilderBase<TStruct, TDocSize>::set_seq(uint32_t seq)
+{
+	if(_root_array.size() < 1)
+		return RET_ERROR;
+
+	JsonObject values = _root_array[_root_array.size() - 1]["values"];
+
+	if(values.isNull() || !values[TB_TELEMETRY_SEQ_KEY].set(seq))
+		return RET_ERROR;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Length of JSON build() would output, without null termination
+ *****************************************************************************/
+template <typename TStruct, int TDocSize>
+int JsonBuilderBase<TStruct, TDocSize>::measure()
+{
+	return measureJson(_json_doc);
+}
+
 /******************************************************************************
  * JsonDoc accessor
  *****************************************************************************/
@@ -86,8 +150,16 @@ StaticJsonDocument<TDocSize>* JsonBuilderBase<TStruct, TDocSize>::get_json_doc()
 // Forward declarations
 template class JsonBuilderBase<Log::Entry, LOG_JSON_DOC_SIZE>;
 template class JsonBuilderBase<WaterSensorData::Entry, WATER_SENSOR_DATA_JSON_DOC_SIZE>;
+#if FEATURE_ATMOS41
 template class JsonBuilderBase<Atmos41Data::Entry, ATMOS41_DATA_JSON_DOC_SIZE>;
+#endif
+#if FEATURE_SOIL_MOISTURE
 template class JsonBuilderBase<SoilMoistureData::Entry, ATMOS41_DATA_JSON_DOC_SIZE>;
+#endif
 template class JsonBuilderBase<FoData::StoreEntry, FO_DATA_JSON_DOC_SIZE>;
 template class JsonBuilderBase<SDI12Log::Entry, ATMOS41_DATA_JSON_DOC_SIZE>;
-template class JsonBuilderBase<LightningData::Entry, LIGHTNING_DATA_JSON_DOC_SIZE>;
\ No newline at end of file
+#if FEATURE_LIGHTNING
+template class JsonBuilderBase<LightningData::Entry, LIGHTNING_DATA_JSON_DOC_SIZE>;
+#endif
+template class JsonBuilderBase<EnergyProfileData::Entry, ENERGY_PROFILE_DATA_JSON_DOC_SIZE>;
+template class JsonBuilderBase<RollupData::Entry, ROLLUP_DATA_JSON_DOC_SIZE>;
\ No newline at end of file
@@ -6,6 +6,10 @@
 #include "SparkFun_AS3935.h"
 #include "log.h"
 #include "rtc.h"
+#include "call_home.h"
+#include "board_features.h"
+
+#if FEATURE_LIGHTNING
 
 namespace Lightning
 {
@@ -27,6 +31,9 @@ namespace Lightning
     /** Count of disturber events since last log (same as noise) */
     uint32_t _distruber_events = 0;
 
+    /** Tick of last close strike alarm, 0 if none */
+    uint32_t _last_alarm_millis = 0;
+
     /******************************************************************************
 	 * Initialize lightning sensor and set up interrupts
 	 *****************************************************************************/	
@@ -34,6 +41,9 @@ namespace Lightning
 	{
         Utils::print_separator(F("Lightning Sensor"));
 
+        // Commit strikes buffered before a reset
+        LightningData::init();
+
         debug_print_i(F("Lightning module: "));
         if(LIGHTNING_SENSOR_MODULE == LIGHTNING_SENSOR_CJMCU)
         {
@@ -186,6 +196,13 @@ namespace Lightning
 
             debug_println_i(F("Lightning detected!"));
             LightningData::print(&entry);
+
+            if(entry.distance <= LIGHTNING_ALARM_DISTANCE_KM &&
+                (_last_alarm_millis == 0 || millis() - _last_alarm_millis >= LIGHTNING_ALARM_MIN_INTERVAL_SECS * 1000))
+            {
+                _last_alarm_millis = millis();
+                CallHome::send_alarm(CallHome::ALARM_LIGHTNING_CLOSE, entry.distance);
+            }
         }
         else
         {
@@ -254,3 +271,5 @@ namespace Lightning
         debug_println(_sensor.readTuneCap(), DEC);
     }
 } // namespace Lightning
+
+#endif
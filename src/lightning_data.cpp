@@ -1,4 +1,9 @@
 #include "lightning_data.h"
+#include "log.h"
+#include "utils.h"
+#include "board_features.h"
+
+#if FEATURE_LIGHTNING
 
 namespace LightningData
 {
@@ -7,18 +12,195 @@ namespace LightningData
 	 */
     DataStore<LightningData::Entry> store(LIGHTNING_DATA_PATH, LIGHTNING_DATA_ENTRIES_PER_SUBMIT_REQ);
 
+    /**
+     * Strikes not yet commited to flash. A storm would otherwise mean a flash append per
+     * strike. RTC_NOINIT memory survives software resets, panics and brown-outs, so
+     * strikes are recovered on next boot (see init())
+     */
+    struct RtcBuffer
+    {
+        uint32_t magic;
+        uint32_t count;
+        Entry entries[LIGHTNING_BUFFER_LEN];
+
+        /** Histograms of the strikes merged into the last entry (aggregation mode) */
+        uint8_t distance_hist[LIGHTNING_HIST_BUCKETS];
+        uint8_t energy_hist[LIGHTNING_HIST_BUCKETS];
+
+        uint32_t crc32;
+    } __attribute__((packed));
+
+    RTC_NOINIT_ATTR RtcBuffer _buffer;
+
+    static_assert(LIGHTNING_HIST_BUCKETS <= 4, "Histograms are logged as 8 bit counts in a 32 bit meta");
+    static_assert(sizeof(LIGHTNING_HIST_ENERGY) / sizeof(LIGHTNING_HIST_ENERGY[0]) == LIGHTNING_HIST_BUCKETS - 1,
+        "Distance and energy histograms must have the same buckets");
+
+    /** Buffer checked for strikes from before a reset */
+    bool _buffer_checked = false;
+
+    //
+    // Private functions
+    //
+    void update_buffer_crc();
+    void add_to_hist(const Entry *data);
+    void log_hist();
+
     /******************************************************************************
-    * Add Lightning data to tore
+    * Check RTC buffer on boot. Strikes buffered before a reset are commited, an
+    * invalid buffer (power on) is cleared
+    ******************************************************************************/
+    void init()
+    {
+        if(_buffer_checked)
+            return;
+
+        _buffer_checked = true;
+
+        if(_buffer.magic == LIGHTNING_BUFFER_MAGIC && _buffer.count <= LIGHTNING_BUFFER_LEN &&
+            _buffer.crc32 == Utils::crc32((uint8_t*)&_buffer, sizeof(_buffer) - sizeof(_buffer.crc32)))
+        {
+            if(_buffer.count > 0)
+            {
+                debug_printf("Recovering %d lightning strikes from RTC memory\n", _buffer.count);
+                commit();
+            }
+
+            return;
+        }
+
+        memset(&_buffer, 0, sizeof(_buffer));
+        _buffer.magic = LIGHTNING_BUFFER_MAGIC;
+        update_buffer_crc();
+    }
+
+    /******************************************************************************
+    * Add Lightning data to buffer. Buffer is commited when full
+    * In aggregation mode a strike in the same minute as the last one is merged
+    * into its entry (closest distance, max energy)
     ******************************************************************************/
     RetResult add(LightningData::Entry *data)
     {
-		RetResult ret = store.add(data);
+        init();
+
+        RetResult ret = RET_OK;
+
+        if(LIGHTNING_AGGREGATE_MINUTES)
+        {
+            Entry *last = _buffer.count > 0 ? &_buffer.entries[_buffer.count - 1] : NULL;
+            uint32_t minute = data->timestamp - data->timestamp % 60;
+
+            if(last != NULL && last->timestamp == minute)
+            {
+                if(data->distance < last->distance)
+                    last->distance = data->distance;
+
+                if(data->energy > last->energy)
+                    last->energy = data->energy;
+
+                add_to_hist(data);
+                update_buffer_crc();
+
+                return RET_OK;
+            }
+
+            // New minute, previous one is complete
+            log_hist();
+            data->timestamp = minute;
+        }
+
+        if(_buffer.count >= LIGHTNING_BUFFER_LEN)
+            ret = commit();
+
+        _buffer.entries[_buffer.count++] = *data;
+
+        if(LIGHTNING_AGGREGATE_MINUTES)
+            add_to_hist(data);
+
+        update_buffer_crc();
+
+        return ret;
+    }
+
+    /******************************************************************************
+    * Commit buffered strikes to flash. Called on scheduled wake ups and when the
+    * buffer fills up
+    ******************************************************************************/
+    RetResult commit()
+    {
+        if(_buffer.count == 0)
+            return RET_OK;
+
+        RetResult ret = RET_OK;
+
+        log_hist();
 
-		// Commit on every add
-		store.commit();
+        for(int i = 0; i < _buffer.count; i++)
+        {
+            if(store.add(&_buffer.entries[i]) != RET_OK)
+                ret = RET_ERROR;
+        }
+
+        if(store.commit() != RET_OK)
+            ret = RET_ERROR;
+
+        debug_printf("Commited %d lightning strikes\n", _buffer.count);
+
+        _buffer.count = 0;
+        update_buffer_crc();
 
         return ret;
-    }   
+    }
+
+    /******************************************************************************
+    * Add strike to histograms, counts saturate
+    ******************************************************************************/
+    void add_to_hist(const Entry *data)
+    {
+        int d = 0, e = 0;
+
+        while(d < LIGHTNING_HIST_BUCKETS - 1 && data->distance > LIGHTNING_HIST_DISTANCE_KM[d])
+            d++;
+
+        while(e < LIGHTNING_HIST_BUCKETS - 1 && data->energy > LIGHTNING_HIST_ENERGY[e])
+            e++;
+
+        if(_buffer.distance_hist[d] < 0xFF)
+            _buffer.distance_hist[d]++;
+
+        if(_buffer.energy_hist[e] < 0xFF)
+            _buffer.energy_hist[e]++;
+    }
+
+    /******************************************************************************
+    * Log histograms of current minute and clear them
+    ******************************************************************************/
+    void log_hist()
+    {
+        uint32_t distance_hist = 0, energy_hist = 0;
+
+        for(int i = 0; i < LIGHTNING_HIST_BUCKETS; i++)
+        {
+            distance_hist |= (uint32_t)_buffer.distance_hist[i] << (i * 8);
+            energy_hist |= (uint32_t)_buffer.energy_hist[i] << (i * 8);
+        }
+
+        if(distance_hist == 0)
+            return;
+
+        Log::log(Log::LIGHTNING_HISTOGRAM, distance_hist, energy_hist);
+
+        memset(_buffer.distance_hist, 0, sizeof(_buffer.distance_hist));
+        memset(_buffer.energy_hist, 0, sizeof(_buffer.energy_hist));
+    }
+
+    /******************************************************************************
+    * Update RTC buffer CRC after a change
+    ******************************************************************************/
+    void update_buffer_crc()
+    {
+        _buffer.crc32 = Utils::crc32((uint8_t*)&_buffer, sizeof(_buffer) - sizeof(_buffer.crc32));
+    }
 
     /******************************************************************************
     * Get pointer to store (for use with reader)
@@ -44,3 +226,5 @@ namespace LightningData
 		debug_println(data->energy);
 	}
 } // namespace LightningData
+
+#endif
@@ -1,21 +1,114 @@
-#include "SPIFFS.h"
+#include "storage.h"
 #include "log.h"
 #include "const.h"
 #include "rtc.h"
 #include "utils.h"
 #include "common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <esp_timer.h>
 
 namespace Log
 {
+	//
+	// Private functions
+	//
+	void update_rtc_shadow();
+	void lock();
+	bool try_lock();
+	void unlock();
+	bool push(const Entry *entry, bool from_isr);
+	void drain(bool until_empty);
+	void add(Entry *entry, bool from_isr, int64_t logged_us);
+	bool apply_policy(const Entry *entry, uint32_t tstamp);
+	void close_window(int i, uint32_t tstamp);
+	void close_expired_windows(uint32_t tstamp, bool all);
+	void store_entry(Entry *entry, uint32_t tstamp);
+
+	/** How entries of a code are stored */
+	enum Policy
+	{
+		/** Every entry stored (codes not in CODE_POLICIES) */
+		POLICY_ALWAYS,
+		/** First entry of a window stored, rest summarized when window ends */
+		POLICY_RATE_LIMITED,
+		/** All entries of a window summarized when window ends */
+		POLICY_AGGREGATED
+	};
+
+	struct CodePolicy
+	{
+		Code code;
+		Policy policy;
+		uint32_t window_secs;
+		/** Meta1 is a value, its range is stored with the summary */
+		bool track_range;
+	};
+
+	/**
+	 * Codes that fire often and carry little information individually (FO outages,
+	 * every wake up, SDI12 retries). Windows start with the first entry of the code
+	 * and are summarized with a LOG_AGGREGATED entry when the next entry comes after
+	 * the window, on commit after the window and before restarting.
+	 */
+	const CodePolicy CODE_POLICIES[] = {
+		{FO_SNIFFER_SNIFF_FAILED, POLICY_AGGREGATED, LOG_AGGREGATE_WINDOW_SECS, false},
+		{FO_SNIFFER_NOT_IN_SYNC, POLICY_AGGREGATED, LOG_AGGREGATE_WINDOW_SECS, false},
+		{WAKEUP, POLICY_AGGREGATED, LOG_AGGREGATE_WINDOW_SECS, false},
+		{SLEEP, POLICY_AGGREGATED, LOG_AGGREGATE_WINDOW_SECS, true},
+		{RTC_SLOW_CLOCK_CALIBRATED, POLICY_AGGREGATED, 24 * 60 * 60, true},
+		{WATER_QUALITY_MEASUREMENT_DATA_REQ_FAILED, POLICY_RATE_LIMITED, LOG_RATE_LIMIT_WINDOW_SECS, false},
+		{WEATHER_STATION_MEASUREMENT_DATA_REQ_FAILED, POLICY_RATE_LIMITED, LOG_RATE_LIMIT_WINDOW_SECS, false},
+		{SOIL_MOISTURE_MEASUREMENT_DATA_REQ_FAILED, POLICY_RATE_LIMITED, LOG_RATE_LIMIT_WINDOW_SECS, false}
+	};
+
+	const int CODE_POLICY_COUNT = sizeof(CODE_POLICIES) / sizeof(CODE_POLICIES[0]);
+
+	static_assert(CODE_POLICY_COUNT <= LOG_POLICY_MAX, "Increase LOG_POLICY_MAX");
+
+	/**
+	 * Copy of log entries not yet commited to flash, kept in RTC slow memory.
+	 * RTC_NOINIT memory survives software resets, panics and brown-outs (but not power loss)
+	 * so logs buffered in batch commit mode can be recovered and commited on next boot.
+	 */
+	struct RtcShadow
+	{
+		uint32_t magic;
+		uint32_t count;
+		Entry entries[DATA_STORE_BUFFER_ELEMENTS];
+		uint32_t crc32;
+	}__attribute__((packed));
+
+	RTC_NOINIT_ATTR RtcShadow _rtc_shadow;
+
+	/**
+	 * Shadow is not updated until init() has checked it for entries left from before the reset,
+	 * otherwise logs created before init() would overwrite them.
+	 */
+	bool _rtc_shadow_checked = false;
+
 	/** Log data store */
 	DataStore<Log::Entry> store(LOG_DATA_PATH, LOG_ENTRIES_PER_SUBMIT_REQ);
 
+	/** Stored entry of older FW (see convert_legacy_store()) */
+	struct LegacyEntry
+	{
+		/** CRC32 of the rest of the entry */
+		uint32_t crc32;
+		/** Milliseconds, seconds * 1000 + entries logged before in the same second */
+		uint64_t timestamp;
+		int32_t code;
+		int32_t meta1;
+		int32_t meta2;
+	}__attribute__((packed));
+
 	/**
 	 * Timestamp of the last time a log has been recorded (log() called)
 	 * Logs are submitted to TB and TB uses the timestamp as a key, so if multiple values
 	 * have the same mS timestamp, only the last one is stored. RTC tracks time in seconds so
 	 * if log() is called more than once a second, the result is multiple logs with the same key for TB.
-	 * A quick workaround is to add 1mS every time log() is called within the same second.
+	 * A quick workaround is to add 1mS every time log() is called within the same second
+	 * (stored as the entry seq, see get_tb_timestamp()).
 	 * This works only if RTC works and tracks time correctly and there are no logs stored
 	 * with a future timestamp because RTC was reset.
 	 */
@@ -27,38 +120,387 @@ namespace Log
 	 */
 	bool _enabled = true;
 
+	/** Logs are also created by background tasks (eg. GSM connect) */
+	SemaphoreHandle_t _mutex = NULL;
+
+	/**
+	 * Slot of the log ring. Sequence is stored relative to the slot index so
+	 * the zero initialized ring is valid before anything runs: slot is free for
+	 * producer position pos when seq == pos - index, holds the entry of pos when
+	 * seq == pos + 1 - index.
+	 */
+	struct RingSlot
+	{
+		uint32_t seq;
+		bool from_isr;
+		int64_t logged_us;
+		Entry entry;
+	};
+
+	/**
+	 * Lock-free multi-producer ring of entries not yet added to the store.
+	 * log() only reserves a slot, so it can be called from ISRs and any task.
+	 * The ring is drained into the store under the mutex (see drain())
+	 */
+	RingSlot _ring[LOG_RING_LEN];
+
+	/** Next position to reserve, shared by producers */
+	uint32_t _ring_head = 0;
+
+	/** Next position to drain, only used with mutex taken */
+	uint32_t _ring_tail = 0;
+
+	/** Entries dropped because the ring was full */
+	uint32_t _ring_dropped = 0;
+
+	/** Current window of each code in CODE_POLICIES, only used with mutex taken */
+	CodeWindow _windows[LOG_POLICY_MAX] = {};
+
+	/******************************************************************************
+	* Init
+	* Recover entries left uncommited in RTC memory (eg. crash or brown-out while
+	* in batch commit mode) and commit them to flash.
+	******************************************************************************/
+	RetResult init()
+	{
+		RetResult ret = RET_OK;
+
+		bool shadow_valid = _rtc_shadow.magic == LOG_RTC_SHADOW_MAGIC &&
+			_rtc_shadow.count <= DATA_STORE_BUFFER_ELEMENTS &&
+			_rtc_shadow.crc32 == Utils::crc32((uint8_t*)&_rtc_shadow, sizeof(_rtc_shadow) - sizeof(_rtc_shadow.crc32));
+
+		int recovered = shadow_valid ? _rtc_shadow.count : 0;
+
+		if(recovered > 0)
+		{
+			debug_print_i(F("Recovering uncommited logs from RTC memory: "));
+			debug_println(recovered, DEC);
+
+			// Copy out, shadow is updated when entries are commited
+			Entry entries[DATA_STORE_BUFFER_ELEMENTS];
+			memcpy(entries, _rtc_shadow.entries, recovered * sizeof(Entry));
+
+			for(int i = 0; i < recovered; i++)
+				store.add(&entries[i]);
+		}
+
+		_rtc_shadow_checked = true;
+
+		// Also writes any logs created before init() and resets the shadow
+		ret = commit();
+
+		if(recovered > 0)
+			log(Log::LOG_RECOVERED_FROM_RTC, recovered);
+
+		return ret;
+	}
+
 	/******************************************************************************
-	* Create log entry with current timestamp.
+	* Create log entry with current timestamp. Safe to call from ISRs and any task,
+	* never waits for flash.
+	* Entry is queued in the log ring. From a task, the ring is also moved to the
+	* store buffer if the log is not busy and the buffer has room, otherwise it is
+	* moved on next log or commit.
 	* @param code Error code
 	* @param meta1 Metadata field 1
 	* @param meta2 Metadata field 2
 	******************************************************************************/
 	bool log(Log::Code code, uint32_t meta1, uint32_t meta2)
 	{
-		Entry entry;
+		uint32_t metas[] = {meta1, meta2};
+
+		// Trailing zero metas are not stored
+		return log_metas(code, metas, meta2 != 0 ? 2 : meta1 != 0 ? 1 : 0);
+	}
+
+	/******************************************************************************
+	* Create log entry with up to LOG_ENTRY_MAX_METAS metadata values (see log())
+	******************************************************************************/
+	bool log_metas(Log::Code code, const uint32_t *metas, int count)
+	{
+		bool from_isr = xPortInIsrContext();
+
+		Entry entry = {0};
 
 		entry.code = code;
-		entry.meta1 = meta1;
-		entry.meta2 = meta2;
+		set_metas(&entry, metas, count);
+
+		// System time cannot be read from an ISR, set when drained
+		entry.timestamp = from_isr ? 0 : RTC::get_timestamp();
+
+		if(!_enabled)
+		{
+			if(!from_isr)
+			{
+				Utils::serial_style(STYLE_RED);
+				debug_print(F("Logging disabled, ignoring log: "));
+				print(&entry);
+				Utils::serial_style(STYLE_RESET);
+			}
+			return RET_ERROR;
+		}
+
+		if(!push(&entry, from_isr))
+			return RET_ERROR;
+
+		if(from_isr)
+			return RET_OK;
+
+		if(!FLAGS.LOG_BATCH_COMMIT)
+		{
+			commit();
+		}
+		else if(try_lock())
+		{
+			// Entries stay in buffer until commit() is called (before sleep/restart/submission)
+			// Keep a copy in RTC memory in case of a crash until then.
+			drain(false);
+			unlock();
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Reserve a ring slot and copy entry to it
+	* @return False if ring is full, entry is dropped and counted
+	******************************************************************************/
+	bool IRAM_ATTR push(const Entry *entry, bool from_isr)
+	{
+		uint32_t pos = __atomic_load_n(&_ring_head, __ATOMIC_RELAXED);
+
+		while(true)
+		{
+			uint32_t index = pos & (LOG_RING_LEN - 1);
+			RingSlot *slot = &_ring[index];
+
+			int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos - index));
+
+			if(diff == 0)
+			{
+				// Slot free, try to reserve it. On failure pos is updated to the current head
+				if(__atomic_compare_exchange_n(&_ring_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				{
+					slot->entry = *entry;
+					slot->from_isr = from_isr;
+					slot->logged_us = esp_timer_get_time();
+
+					__atomic_store_n(&slot->seq, pos + 1 - index, __ATOMIC_RELEASE);
+					return true;
+				}
+			}
+			// Slot of previous lap not drained yet, ring is full
+			else if(diff < 0)
+			{
+				__atomic_fetch_add(&_ring_dropped, 1, __ATOMIC_RELAXED);
+				return false;
+			}
+			// Another producer took it
+			else
+			{
+				pos = __atomic_load_n(&_ring_head, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	/******************************************************************************
+	* Move entries from the ring to the store buffer, in the order reserved.
+	* Mutex must be taken.
+	* @param until_empty Drain whole ring, committing store when its buffer is full.
+	* 					 Otherwise stops when buffer is full so flash is not accessed.
+	******************************************************************************/
+	void drain(bool until_empty)
+	{
+		int drained = 0;
+
+		// Keep room for an entry and the summary of the window it may close
+		while(until_empty || store.get_buffer_element_count() + 3 <= DATA_STORE_BUFFER_ELEMENTS)
+		{
+			uint32_t index = _ring_tail & (LOG_RING_LEN - 1);
+			RingSlot *slot = &_ring[index];
+
+			// Next entry not published yet
+			if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != _ring_tail + 1 - index)
+				break;
+
+			Entry entry = slot->entry;
+			bool from_isr = slot->from_isr;
+			int64_t logged_us = slot->logged_us;
+
+			// Free slot for next lap
+			__atomic_store_n(&slot->seq, _ring_tail + LOG_RING_LEN - index, __ATOMIC_RELEASE);
+			_ring_tail++;
+
+			add(&entry, from_isr, logged_us);
+			drained++;
+		}
+
+		uint32_t dropped = __atomic_exchange_n(&_ring_dropped, 0, __ATOMIC_RELAXED);	
+
+		if(dropped > 0)
+		{
+			Entry entry = {0};
+			entry.code = LOG_RING_OVERRUN;
+			set_metas(&entry, &dropped, 1);
+			store_entry(&entry, RTC::get_timestamp());
+			drained++;
+		}
+
+		if(drained > 0)
+			update_rtc_shadow();
+	}
+
+	/******************************************************************************
+	* Set final timestamp of a drained entry and add it to the store, unless its
+	* code policy summarizes it
+	* @param entry Entry with timestamp in seconds (0 if logged from ISR)
+	* @param from_isr Logged from ISR, timestamp is derived from time logged
+	* @param logged_us Time since boot when logged (only for ISR entries)
+	******************************************************************************/
+	void add(Entry *entry, bool from_isr, int64_t logged_us)
+	{
+		uint32_t cur_tstamp = entry->timestamp;
+
+		if(from_isr)
+			cur_tstamp = RTC::get_timestamp() - (uint32_t)((esp_timer_get_time() - logged_us) / 1000000);
+
+		if(apply_policy(entry, cur_tstamp))
+			store_entry(entry, cur_tstamp);
+	}
+
+	/******************************************************************************
+	* Account entry in the window of its code
+	* @return True if entry must be stored
+	******************************************************************************/
+	bool apply_policy(const Entry *entry, uint32_t tstamp)
+	{
+		for(int i = 0; i < CODE_POLICY_COUNT; i++)
+		{
+			const CodePolicy *policy = &CODE_POLICIES[i];
 
-		// debug_print_i(F("Log: "));
-		// debug_print(entry.code, DEC);
-		// debug_print(F(" ( "));
-		// debug_print(meta1);
-		// debug_print(F(" , "));
-		// debug_print(meta2);
-		// debug_println(F(" )"));
+			if(policy->code != entry->code)
+				continue;
 
-		uint32_t cur_tstamp = RTC::get_timestamp();
+			CodeWindow *window = &_windows[i];
+			int value = get_meta(entry, 0);
 
-		entry.timestamp = cur_tstamp * 1000LL;
+			if(window->open && (tstamp < window->first_tstamp || tstamp - window->first_tstamp >= policy->window_secs))
+				close_window(i, tstamp);
+
+			// First entry of a rate limited code starts the window and is stored
+			if(!window->open)
+			{
+				window->open = true;
+				window->first_tstamp = tstamp;
+				window->count = 0;
+				window->min = value;
+				window->max = value;
+
+				if(policy->policy == POLICY_RATE_LIMITED)
+				{
+					window->last_tstamp = tstamp;
+					return true;
+				}
+			}
+
+			window->count++;
+			window->last_tstamp = tstamp;
+			window->min = value < window->min ? value : window->min;
+			window->max = value > window->max ? value : window->max;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	/******************************************************************************
+	* Store summary of a window, if it has summarized entries, and close it
+	******************************************************************************/
+	void close_window(int i, uint32_t tstamp)
+	{
+		CodeWindow *window = &_windows[i];
+
+		window->open = false;
+
+		if(window->count == 0)
+			return;
+
+		uint32_t since_first = tstamp - window->first_tstamp;
+		uint32_t since_last = tstamp - window->last_tstamp;
+
+		uint32_t metas[] = {
+			CODE_POLICIES[i].code | (window->count > 0xFFFF ? 0xFFFF : window->count) << 16,
+			(since_first > 0xFFFF ? 0xFFFF : since_first) | (since_last > 0xFFFF ? 0xFFFF : since_last) << 16
+		};
+
+		Entry entry = {0};
+		entry.code = LOG_AGGREGATED;
+		set_metas(&entry, metas, 2);
+
+		store_entry(&entry, tstamp);
+
+		if(CODE_POLICIES[i].track_range)
+		{
+			metas[0] = window->min;
+			metas[1] = window->max;
+
+			entry = {0};
+			entry.code = LOG_AGGREGATED_RANGE;
+			set_metas(&entry, metas, 2);
+
+			store_entry(&entry, tstamp);
+		}
+	}
+
+	/******************************************************************************
+	* Close windows that ended
+	* @param all Close all open windows
+	******************************************************************************/
+	void close_expired_windows(uint32_t tstamp, bool all)
+	{
+		for(int i = 0; i < CODE_POLICY_COUNT; i++)
+		{
+			CodeWindow *window = &_windows[i];
+
+			if(!window->open)
+				continue;
+
+			if(all || tstamp < window->first_tstamp || tstamp - window->first_tstamp >= CODE_POLICIES[i].window_secs)
+				close_window(i, tstamp);
+		}
+	}
+
+	/******************************************************************************
+	* Store summaries of all open windows. Must be called before restarting,
+	* windows are only kept over deep sleep
+	******************************************************************************/
+	void flush_windows()
+	{
+		lock();
+
+		drain(true);
+		close_expired_windows(RTC::get_timestamp(), true);
+		update_rtc_shadow();
+
+		unlock();
+	}
+
+	/******************************************************************************
+	* Add entry to store with unique ms timestamp
+	* @param tstamp Timestamp in seconds
+	******************************************************************************/
+	void store_entry(Entry *entry, uint32_t cur_tstamp)
+	{
+		entry->timestamp = cur_tstamp;
+		entry->seq = 0;
 
 		// If its not the first log within this second, add +1 mS to make sure TB doesn't overwrite
 		// its value (since TB uses the timestamp as the primary key for each record.)
 		if(cur_tstamp == _last_log_tstamp)
 		{
 			_last_log_tstamp_counter++;
-			entry.timestamp += _last_log_tstamp_counter;
+			entry->seq = _last_log_tstamp_counter > 0xFF ? 0xFF : _last_log_tstamp_counter;
 		}
 		else
 		{
@@ -67,20 +509,7 @@ namespace Log
 
 		_last_log_tstamp = cur_tstamp;
 
-
-		if(!_enabled)
-		{
-			Utils::serial_style(STYLE_RED);
-			debug_print(F("Logging disabled, ignoring log: "));
-			print(&entry);
-			Utils::serial_style(STYLE_RESET);
-			return RET_ERROR;
-		}
-
-		store.add(&entry);
-		store.commit();
-
-		return RET_OK;
+		store.add(entry);
 	}
 
 	/******************************************************************************
@@ -96,7 +525,70 @@ namespace Log
 	******************************************************************************/
 	RetResult commit()
 	{
-		return store.commit();
+		lock();
+
+		drain(true);
+		close_expired_windows(RTC::get_timestamp(), false);
+
+		RetResult ret = store.commit();
+
+		// Entries that failed to commit remain in buffer
+		update_rtc_shadow();
+
+		unlock();
+
+		return ret;
+	}
+
+	/******************************************************************************
+	* Take log mutex. Recursive, log() commits while holding it
+	* First log is created by the main task before any other task runs
+	******************************************************************************/
+	void lock()
+	{
+		if(_mutex == NULL)
+			_mutex = xSemaphoreCreateRecursiveMutex();
+
+		xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+	}
+
+	/******************************************************************************
+	* Take log mutex if free
+	******************************************************************************/
+	bool try_lock()
+	{
+		if(_mutex == NULL)
+			_mutex = xSemaphoreCreateRecursiveMutex();
+
+		return xSemaphoreTakeRecursive(_mutex, 0) == pdTRUE;
+	}
+
+	/******************************************************************************
+	* Give log mutex
+	******************************************************************************/
+	void unlock()
+	{
+		xSemaphoreGiveRecursive(_mutex);
+	}
+
+	/******************************************************************************
+	* Copy uncommited entries from store buffer to RTC memory
+	******************************************************************************/
+	void update_rtc_shadow()
+	{
+		if(!_rtc_shadow_checked)
+			return;
+
+		int count = store.get_buffer_element_count();
+
+		for(int i = 0; i < count; i++)
+		{
+			memcpy(&_rtc_shadow.entries[i], &store.get_buffer_element(i)->data, sizeof(Entry));
+		}
+
+		_rtc_shadow.magic = LOG_RTC_SHADOW_MAGIC;
+		_rtc_shadow.count = count;
+		_rtc_shadow.crc32 = Utils::crc32((uint8_t*)&_rtc_shadow, sizeof(_rtc_shadow) - sizeof(_rtc_shadow.crc32));
 	}
 
 	/********************************************************************************
@@ -105,23 +597,199 @@ namespace Log
 	 *******************************************************************************/
 	void print(const Log::Entry *entry)
 	{
+		uint32_t metas[LOG_ENTRY_MAX_METAS] = {0};
+		int count = get_metas(entry, metas, LOG_ENTRY_MAX_METAS);
+
 		debug_print(F("Code: "));
 		debug_print(entry->code);
 
-		debug_print(F(" -- Meta 1: "));
-		debug_print(entry->meta1);
-
-		debug_print(F(" -- Meta 2: "));
-		debug_println(entry->meta2);
+		for(int i = 0; i < count; i++)
+		{
+			debug_printf(" -- Meta %d: %d", i + 1, metas[i]);
+		}
+		debug_println();
 
-		debug_printf("Timestamp: %lld\n", entry->timestamp);
+		debug_printf("Timestamp: %lld\n", get_tb_timestamp(entry));
 		debug_print(" (");
 
-		time_t tstamp_sec = entry->timestamp / 1000;
+		time_t tstamp_sec = entry->timestamp;
 		debug_print(ctime(&tstamp_sec));
 		debug_println(" )");
 	}
 
+	/******************************************************************************
+	 * Encode meta values to entry. Values are varint encoded, 7 bits per byte, so
+	 * small values take one or two bytes. Values that don't fit are dropped,
+	 * except for two values which are stored raw
+	 *****************************************************************************/
+	void set_metas(Entry *entry, const uint32_t *metas, int count)
+	{
+		int len = 0;
+		int stored = 0;
+
+		memset(entry->meta, 0, sizeof(entry->meta));
+
+		for(; stored < count && stored < LOG_ENTRY_MAX_METAS; stored++)
+		{
+			uint8_t buff[5];
+			int buff_len = 0;
+			uint32_t val = metas[stored];
+
+			do
+			{
+				buff[buff_len] = val & 0x7F;
+				val >>= 7;
+
+				if(val != 0)
+					buff[buff_len] |= 0x80;
+
+				buff_len++;
+			} while(val != 0);
+
+			if(len + buff_len > LOG_ENTRY_META_LEN)
+				break;
+
+			memcpy(&entry->meta[len], buff, buff_len);
+			len += buff_len;
+		}
+
+		if(stored < count && count <= 2)
+		{
+			memcpy(entry->meta, metas, count * sizeof(uint32_t));
+			entry->meta_info = LOG_ENTRY_META_RAW | count;
+			return;
+		}
+
+		entry->meta_info = stored;
+	}
+
+	/******************************************************************************
+	 * Decode meta values of entry
+	 * @param metas Receives values
+	 * @param max Size of metas
+	 * @return Value count
+	 *****************************************************************************/
+	int get_metas(const Entry *entry, uint32_t *metas, int max)
+	{
+		int count = entry->meta_info & ~LOG_ENTRY_META_RAW;
+
+		if(count > max)
+			count = max;
+
+		if(entry->meta_info & LOG_ENTRY_META_RAW)
+		{
+			memcpy(metas, entry->meta, count * sizeof(uint32_t));
+			return count;
+		}
+
+		int pos = 0;
+
+		for(int i = 0; i < count; i++)
+		{
+			uint32_t val = 0;
+			int shift = 0;
+
+			while(pos < LOG_ENTRY_META_LEN)
+			{
+				uint8_t byte = entry->meta[pos++];
+				val |= (uint32_t)(byte & 0x7F) << shift;
+				shift += 7;
+
+				if(!(byte & 0x80))
+					break;
+			}
+
+			metas[i] = val;
+		}
+
+		return count;
+	}
+
+	/******************************************************************************
+	 * Get a meta value of entry, 0 if not set
+	 *****************************************************************************/
+	uint32_t get_meta(const Entry *entry, int index)
+	{
+		uint32_t metas[LOG_ENTRY_MAX_METAS] = {0};
+
+		get_metas(entry, metas, LOG_ENTRY_MAX_METAS);
+
+		return index < LOG_ENTRY_MAX_METAS ? metas[index] : 0;
+	}
+
+	/******************************************************************************
+	 * Get the unique ms timestamp TB stores entry with
+	 *****************************************************************************/
+	uint64_t get_tb_timestamp(const Entry *entry)
+	{
+		return (uint64_t)entry->timestamp * 1000 + entry->seq;
+	}
+
+	/******************************************************************************
+	 * Move entries stored in the layout used by older FW to the store, they are
+	 * submitted as any other. Older FW removed files once submitted, so all
+	 * entries left were not. Called once after update (see
+	 * OTA::handle_first_boot())
+	 *****************************************************************************/
+	void convert_legacy_store()
+	{
+		File dir = STORAGE_FS.open(LOG_LEGACY_DATA_PATH);
+		File file;
+
+		int converted = 0;
+		int invalid = 0;
+
+		lock();
+
+		// SPIFFS dirs are emulated, files are converted and deleted one by one
+		while(file = dir.openNextFile())
+		{
+			LegacyEntry legacy;
+
+			while(file.read((uint8_t*)&legacy, sizeof(legacy)) == sizeof(legacy))
+			{
+				if(Utils::crc32((uint8_t*)&legacy.timestamp, sizeof(legacy) - sizeof(legacy.crc32)) != legacy.crc32)
+				{
+					invalid++;
+					continue;
+				}
+
+				Entry entry;
+				memset(&entry, 0, sizeof(entry));
+
+				// Trailing zero metas are not stored, as in log()
+				uint32_t metas[] = {(uint32_t)legacy.meta1, (uint32_t)legacy.meta2};
+				set_metas(&entry, metas, legacy.meta2 != 0 ? 2 : legacy.meta1 != 0 ? 1 : 0);
+
+				// Same TB key as before (see get_tb_timestamp())
+				uint32_t ms = legacy.timestamp % 1000;
+				entry.timestamp = legacy.timestamp / 1000;
+				entry.seq = ms > 0xFF ? 0xFF : ms;
+				entry.code = legacy.code;
+
+				store.add(&entry);
+				converted++;
+			}
+
+			// Entries of the file are in flash before it is deleted
+			store.commit();
+
+			char path[FILE_PATH_BUFFER_SIZE] = "";
+			strncpy(path, file.name(), sizeof(path) - 1);
+			file.close();
+
+			STORAGE_FS.remove(path);
+		}
+		dir.close();
+
+		update_rtc_shadow();
+
+		unlock();
+
+		if(converted > 0 || invalid > 0)
+			debug_printf_i("Converted %d log entries of older FW, %d invalid.\n", converted, invalid);
+	}
+
 	/******************************************************************************
 	 * Enable/disable logging
 	 *****************************************************************************/
@@ -129,4 +797,24 @@ namespace Log
 	{
 		_enabled = enabled;
 	}
+
+	/******************************************************************************
+	 * Save state to RTC memory before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->last_log_tstamp = _last_log_tstamp;
+		state->last_log_tstamp_counter = _last_log_tstamp_counter;
+		memcpy(state->windows, _windows, sizeof(state->windows));
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_last_log_tstamp = state->last_log_tstamp;
+		_last_log_tstamp_counter = state->last_log_tstamp_counter;
+		memcpy(_windows, state->windows, sizeof(_windows));
+	}
 }
\ No newline at end of file
@@ -0,0 +1,580 @@
+#include "lora_ota.h"
+#include "common.h"
+#include "log.h"
+#include "rtc.h"
+#include "utils.h"
+#include "storage.h"
+#include "device_config.h"
+#include "rom/md5_hash.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_spi_flash.h"
+
+namespace LoraOta
+{
+	//
+	// Private types
+	//
+	/** Leaf download, kept in LORA_OTA_STATE_PATH */
+	struct State
+	{
+		uint32_t magic;
+		int32_t fw_version;
+		uint8_t md5[16];
+		/** Image size, 0 until the gateway sent Info */
+		uint32_t size;
+		/** RTC time download was requested */
+		uint32_t start_tstamp;
+		/** Not complete in LORA_OTA_TIMEOUT_SECS, image is downloaded over cellular */
+		uint8_t expired;
+		/** Bit per chunk, set if written */
+		uint8_t received[(LORA_OTA_MAX_CHUNKS + 7) / 8];
+	} __attribute__((packed));
+
+	/** Gateway running image, hashed once per image. RTC_NOINIT memory survives
+	 * deep sleep and resets (but not power loss) */
+	struct ImageCache
+	{
+		uint32_t magic;
+		/** Partition the image is in, changes with every OTA */
+		uint32_t address;
+		Info info;
+		uint32_t crc32;
+	} __attribute__((packed));
+
+	//
+	// Private functions
+	//
+	RetResult load_state();
+	RetResult save_state();
+	int get_chunk_count();
+	int get_chunk_len(int index);
+	bool is_received(int index);
+	void set_received(int index);
+	int recover_group(uint16_t group, const uint8_t *parity);
+	RetResult verify_md5(const esp_partition_t *partition, uint32_t size, uint8_t digest[16]);
+	RetResult finalize();
+	RetResult parse_md5(const char *str, uint8_t md5[16]);
+
+	//
+	// Private vars
+	//
+	State _state;
+	bool _state_loaded = false;
+
+	/** Parity chunks received this session, applied in end_session() */
+	uint8_t _parity[LORA_OTA_REQUEST_WINDOW / LORA_OTA_FEC_GROUP][LORA_OTA_CHUNK_SIZE];
+	uint16_t _parity_groups[LORA_OTA_REQUEST_WINDOW / LORA_OTA_FEC_GROUP];
+	int _parity_count = 0;
+
+	/** Chunks written this session */
+	int _session_received = 0;
+
+	RTC_NOINIT_ATTR ImageCache _image;
+
+	/******************************************************************************
+	 * Leaf: get image fw_md5 from the gateway instead of downloading it. A
+	 * download of the same image continues
+	 * @return RET_ERROR if image must be downloaded over cellular
+	 *****************************************************************************/
+	RetResult start(int fw_version, const char *fw_md5)
+	{
+		uint8_t md5[16];
+
+		if(parse_md5(fw_md5, md5) != RET_OK)
+			return RET_ERROR;
+
+		uint32_t now = RTC::get_timestamp();
+		bool resumed = load_state() == RET_OK && memcmp(_state.md5, md5, sizeof(md5)) == 0;
+
+		if(resumed && (_state.expired || now - _state.start_tstamp > LORA_OTA_TIMEOUT_SECS))
+		{
+			debug_println_w(F("LoRa OTA timed out, downloading over cellular."));
+
+			_state.expired = true;
+			save_state();
+
+			return RET_ERROR;
+		}
+
+		if(!resumed)
+		{
+			memset(&_state, 0, sizeof(_state));
+			_state.magic = LORA_OTA_STATE_MAGIC;
+			_state.fw_version = fw_version;
+			memcpy(_state.md5, md5, sizeof(md5));
+			_state.start_tstamp = now;
+
+			if(save_state() != RET_OK)
+				return RET_ERROR;
+		}
+
+		debug_printf_i("Getting OTA image %d from gateway over LoRa.\n", fw_version);
+		Log::log(Log::LORA_OTA_STARTED, fw_version, resumed);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Leaf: image download from gateway in progress
+	 *****************************************************************************/
+	bool is_pending()
+	{
+		return FLAGS.LORA_OTA && load_state() == RET_OK && !_state.expired;
+	}
+
+	/******************************************************************************
+	 * Leaf: request for next missing chunks, or for image info if size is not
+	 * known yet
+	 * @return False if nothing is missing
+	 *****************************************************************************/
+	bool build_request(Request *req)
+	{
+		memset(req, 0, sizeof(Request));
+		memcpy(req->md5, _state.md5, sizeof(req->md5));
+
+		if(_state.size == 0)
+		{
+			req->first = FIRST_INFO;
+			return true;
+		}
+
+		int count = get_chunk_count();
+		int first = 0;
+
+		while(first < count && is_received(first))
+			first++;
+
+		if(first >= count)
+			return false;
+
+		// Whole parity groups, so the gateway sends their parity
+		first -= first % LORA_OTA_FEC_GROUP;
+		req->first = first;
+
+		for(int i = 0; i < LORA_OTA_REQUEST_WINDOW && first + i < count; i++)
+		{
+			if(!is_received(first + i))
+				req->missing[i / 8] |= 1 << (i % 8);
+		}
+
+		_parity_count = 0;
+		_session_received = 0;
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * Leaf: image size received, erase partition for chunks
+	 *****************************************************************************/
+	void on_info(const Info *info)
+	{
+		if(_state.size != 0 || memcmp(info->md5, _state.md5, sizeof(info->md5)) != 0)
+			return;
+
+		const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+		if(partition == NULL || info->size == 0 || info->size > partition->size || info->size > LORA_OTA_MAX_IMAGE_SIZE)
+		{
+			debug_println_e(F("LoRa OTA image does not fit partition."));
+			return;
+		}
+
+		uint32_t erase_size = (info->size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+
+		debug_printf("Erasing OTA partition for LoRa image (bytes): %u\n", info->size);
+
+		if(esp_partition_erase_range(partition, 0, erase_size) != ESP_OK)
+		{
+			debug_println_e(F("Could not erase OTA partition."));
+			return;
+		}
+
+		_state.size = info->size;
+		memset(_state.received, 0, sizeof(_state.received));
+	}
+
+	/******************************************************************************
+	 * Leaf: chunk or parity received, written if it is missing
+	 *****************************************************************************/
+	void on_chunk(const Chunk *chunk, const uint8_t *data, int len)
+	{
+		if(_state.size == 0 || memcmp(chunk->md5, _state.md5, sizeof(chunk->md5)) != 0)
+			return;
+
+		int count = get_chunk_count();
+
+		if(chunk->parity)
+		{
+			if(len != LORA_OTA_CHUNK_SIZE || chunk->index * LORA_OTA_FEC_GROUP >= count ||
+				_parity_count >= LORA_OTA_REQUEST_WINDOW / LORA_OTA_FEC_GROUP)
+				return;
+
+			memcpy(_parity[_parity_count], data, len);
+			_parity_groups[_parity_count] = chunk->index;
+			_parity_count++;
+
+			return;
+		}
+
+		if(chunk->index >= count || is_received(chunk->index) || len != get_chunk_len(chunk->index))
+			return;
+
+		const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+		if(esp_partition_write(partition, chunk->index * LORA_OTA_CHUNK_SIZE, data, len) != ESP_OK)
+		{
+			debug_println_e(F("Could not write LoRa OTA chunk."));
+			return;
+		}
+
+		set_received(chunk->index);
+		_session_received++;
+	}
+
+	/******************************************************************************
+	 * Leaf: recover chunks with parity and save progress. A complete image is
+	 * verified and set as boot partition
+	 * @param ready Set if device must restart into the new image
+	 *****************************************************************************/
+	RetResult end_session(bool *ready)
+	{
+		*ready = false;
+
+		for(int i = 0; i < _parity_count; i++)
+			_session_received += recover_group(_parity_groups[i], _parity[i]);
+
+		_parity_count = 0;
+
+		int count = get_chunk_count();
+		int missing = 0;
+
+		for(int i = 0; i < count; i++)
+		{
+			if(!is_received(i))
+				missing++;
+		}
+
+		debug_printf_i("LoRa OTA chunks received: %d, missing: %d\n", _session_received, _state.size == 0 ? -1 : missing);
+		Log::log(Log::LORA_OTA_SESSION, _session_received, missing);
+
+		_session_received = 0;
+
+		if(_state.size == 0 || missing > 0)
+			return save_state();
+
+		if(finalize() != RET_OK)
+		{
+			// Start over, partition is erased again with next info
+			_state.size = 0;
+			memset(_state.received, 0, sizeof(_state.received));
+
+			save_state();
+
+			return RET_ERROR;
+		}
+
+		STORAGE_FS.remove(LORA_OTA_STATE_PATH);
+		_state_loaded = false;
+
+		*ready = true;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Gateway: running image, size from its header and MD5 as in fw_md5
+	 *****************************************************************************/
+	RetResult get_image(Info *info)
+	{
+		const esp_partition_t *running = esp_ota_get_running_partition();
+
+		if(running == NULL)
+			return RET_ERROR;
+
+		if(_image.magic == LORA_OTA_IMAGE_MAGIC && _image.address == running->address &&
+			Utils::crc32((uint8_t*)&_image, sizeof(_image) - sizeof(_image.crc32)) == _image.crc32)
+		{
+			*info = _image.info;
+			return RET_OK;
+		}
+
+		esp_partition_pos_t pos = {running->address, running->size};
+		esp_image_metadata_t metadata;
+
+		if(esp_image_verify(ESP_IMAGE_VERIFY, &pos, &metadata) != ESP_OK)
+		{
+			debug_println_e(F("Could not verify running image."));
+			return RET_ERROR;
+		}
+
+		_image.info.size = metadata.image_len;
+
+		if(verify_md5(running, _image.info.size, _image.info.md5) != RET_OK)
+			return RET_ERROR;
+
+		_image.magic = LORA_OTA_IMAGE_MAGIC;
+		_image.address = running->address;
+		_image.crc32 = Utils::crc32((uint8_t*)&_image, sizeof(_image) - sizeof(_image.crc32));
+
+		*info = _image.info;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Gateway: read a chunk of running image
+	 * @param buff LORA_OTA_CHUNK_SIZE
+	 * @return Chunk length, 0 past the end
+	 *****************************************************************************/
+	int read_chunk(uint16_t index, uint8_t *buff)
+	{
+		Info info;
+
+		if(get_image(&info) != RET_OK)
+			return 0;
+
+		uint32_t offset = (uint32_t)index * LORA_OTA_CHUNK_SIZE;
+
+		if(offset >= info.size)
+			return 0;
+
+		int len = info.size - offset < (uint32_t)LORA_OTA_CHUNK_SIZE ? info.size - offset : LORA_OTA_CHUNK_SIZE;
+
+		if(esp_partition_read(esp_ota_get_running_partition(), offset, buff, len) != ESP_OK)
+			return 0;
+
+		return len;
+	}
+
+	/******************************************************************************
+	 * Gateway: XOR of chunks of a parity group, shorter last chunk zero padded
+	 * @param buff LORA_OTA_CHUNK_SIZE
+	 * @return LORA_OTA_CHUNK_SIZE, 0 past the end
+	 *****************************************************************************/
+	int read_parity(uint16_t group, uint8_t *buff)
+	{
+		uint8_t chunk[LORA_OTA_CHUNK_SIZE];
+		int chunks = 0;
+
+		memset(buff, 0, LORA_OTA_CHUNK_SIZE);
+
+		for(int i = 0; i < LORA_OTA_FEC_GROUP; i++)
+		{
+			int len = read_chunk(group * LORA_OTA_FEC_GROUP + i, chunk);
+
+			for(int j = 0; j < len; j++)
+				buff[j] ^= chunk[j];
+
+			if(len > 0)
+				chunks++;
+		}
+
+		return chunks > 0 ? LORA_OTA_CHUNK_SIZE : 0;
+	}
+
+	/******************************************************************************
+	 * Load leaf state from file, once
+	 * @return RET_ERROR if no download is in progress
+	 *****************************************************************************/
+	RetResult load_state()
+	{
+		if(_state_loaded)
+			return _state.magic == LORA_OTA_STATE_MAGIC ? RET_OK : RET_ERROR;
+
+		_state_loaded = true;
+		memset(&_state, 0, sizeof(_state));
+
+		if(!STORAGE_FS.exists(LORA_OTA_STATE_PATH))
+			return RET_ERROR;
+
+		File f = STORAGE_FS.open(LORA_OTA_STATE_PATH, FILE_READ);
+		if(!f)
+			return RET_ERROR;
+
+		bool ok = f.read((uint8_t*)&_state, sizeof(_state)) == sizeof(_state) && _state.magic == LORA_OTA_STATE_MAGIC;
+		f.close();
+
+		if(!ok)
+		{
+			memset(&_state, 0, sizeof(_state));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Save leaf state to file
+	 *****************************************************************************/
+	RetResult save_state()
+	{
+		File f = STORAGE_FS.open(LORA_OTA_STATE_PATH, FILE_WRITE);
+		if(!f)
+		{
+			debug_println_e(F("Could not save LoRa OTA state."));
+			return RET_ERROR;
+		}
+
+		bool ok = f.write((uint8_t*)&_state, sizeof(_state)) == sizeof(_state);
+		f.close();
+
+		return ok ? RET_OK : RET_ERROR;
+	}
+
+	int get_chunk_count()
+	{
+		return (_state.size + LORA_OTA_CHUNK_SIZE - 1) / LORA_OTA_CHUNK_SIZE;
+	}
+
+	int get_chunk_len(int index)
+	{
+		uint32_t offset = (uint32_t)index * LORA_OTA_CHUNK_SIZE;
+
+		return _state.size - offset < (uint32_t)LORA_OTA_CHUNK_SIZE ? _state.size - offset : LORA_OTA_CHUNK_SIZE;
+	}
+
+	bool is_received(int index)
+	{
+		return _state.received[index / 8] & (1 << (index % 8));
+	}
+
+	void set_received(int index)
+	{
+		_state.received[index / 8] |= 1 << (index % 8);
+	}
+
+	/******************************************************************************
+	 * Recover the only missing chunk of a parity group from the others
+	 * @return 1 if a chunk was recovered
+	 *****************************************************************************/
+	int recover_group(uint16_t group, const uint8_t *parity)
+	{
+		int count = get_chunk_count();
+		int first = group * LORA_OTA_FEC_GROUP;
+		int missing = -1;
+
+		for(int i = first; i < first + LORA_OTA_FEC_GROUP && i < count; i++)
+		{
+			if(is_received(i))
+				continue;
+
+			// None missing is fine, more than one can't be recovered
+			if(missing >= 0)
+				return 0;
+
+			missing = i;
+		}
+
+		if(missing < 0)
+			return 0;
+
+		const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+		uint8_t data[LORA_OTA_CHUNK_SIZE];
+		uint8_t chunk[LORA_OTA_CHUNK_SIZE];
+
+		memcpy(data, parity, sizeof(data));
+
+		for(int i = first; i < first + LORA_OTA_FEC_GROUP && i < count; i++)
+		{
+			if(i == missing)
+				continue;
+
+			int len = get_chunk_len(i);
+
+			if(esp_partition_read(partition, i * LORA_OTA_CHUNK_SIZE, chunk, len) != ESP_OK)
+				return 0;
+
+			for(int j = 0; j < len; j++)
+				data[j] ^= chunk[j];
+		}
+
+		if(esp_partition_write(partition, missing * LORA_OTA_CHUNK_SIZE, data, get_chunk_len(missing)) != ESP_OK)
+			return 0;
+
+		set_received(missing);
+
+		return 1;
+	}
+
+	/******************************************************************************
+	 * MD5 of first size bytes of a partition
+	 *****************************************************************************/
+	RetResult verify_md5(const esp_partition_t *partition, uint32_t size, uint8_t digest[16])
+	{
+		struct MD5Context ctx;
+		uint8_t buff[1024];
+
+		MD5Init(&ctx);
+
+		for(uint32_t offset = 0; offset < size; offset += sizeof(buff))
+		{
+			uint32_t len = size - offset < sizeof(buff) ? size - offset : sizeof(buff);
+
+			if(esp_partition_read(partition, offset, buff, len) != ESP_OK)
+				return RET_ERROR;
+
+			MD5Update(&ctx, buff, len);
+		}
+
+		MD5Final(digest, &ctx);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Check complete image against fw_md5 and set it as boot partition
+	 *****************************************************************************/
+	RetResult finalize()
+	{
+		const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+		uint8_t digest[16];
+
+		if(verify_md5(partition, _state.size, digest) != RET_OK || memcmp(digest, _state.md5, sizeof(digest)) != 0)
+		{
+			debug_println_e(F("LoRa OTA image MD5 check failed."));
+			Log::log(Log::OTA_COULD_NOT_FINALIZE_UPDATE, ESP_ERR_INVALID_CRC);
+			return RET_ERROR;
+		}
+
+		esp_err_t err = esp_ota_set_boot_partition(partition);
+		if(err != ESP_OK)
+		{
+			debug_print(F("Could not set boot partition. Error: "));
+			debug_println(err, DEC);
+
+			Log::log(Log::OTA_COULD_NOT_FINALIZE_UPDATE, err);
+			return RET_ERROR;
+		}
+
+		debug_println(F("LoRa OTA image applied."));
+		Log::log(Log::OTA_FINISHED);
+
+		DeviceConfig::set_ota_flashed(true);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Hex MD5 string to bytes
+	 *****************************************************************************/
+	RetResult parse_md5(const char *str, uint8_t md5[16])
+	{
+		if(strlen(str) != 32)
+			return RET_ERROR;
+
+		for(int i = 0; i < 16; i++)
+		{
+			char byte[3] = {str[i * 2], str[i * 2 + 1], '\0'};
+			char *end = NULL;
+
+			md5[i] = strtoul(byte, &end, 16);
+
+			if(end != byte + 2)
+				return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+}
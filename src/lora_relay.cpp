@@ -0,0 +1,708 @@
+#include "lora_relay.h"
+#include "common.h"
+#include "log.h"
+#include "rtc.h"
+#include "utils.h"
+#include "device_config.h"
+#include "fo_sniffer.h"
+#include "energy_profiler.h"
+#include "data_store_reader.h"
+#include "relay_data.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "atmos41_data.h"
+#include "fo_data.h"
+#include "lora_ota.h"
+#include "board_features.h"
+#include <esp_system.h>
+
+namespace LoraRelay
+{
+	//
+	// Private functions
+	//
+	RetResult begin();
+	void end();
+	RetResult send_frame(uint8_t *frame, int len);
+	RetResult receive_frame(uint8_t *buff, int buff_size, uint32_t timeout_ms, int *len);
+	int handle_data_frame(const uint8_t *frame, int len);
+	bool is_duplicate(uint32_t leaf_id, uint16_t seq);
+	int get_entry_size(SensorStore store);
+	bool request_firmware();
+	int receive_firmware();
+	bool serve_firmware(const uint8_t *frame, int len);
+
+	template <typename TStruct>
+	RetResult relay_store(SensorStore store, DataStore<TStruct> *data_store, int *relayed);
+
+	// Private vars
+	/** Radio, owned by FoSniffer and in LoRa mode between begin() and end() */
+	RFM95 *_radio = NULL;
+
+	/** Time of last call home made by this leaf itself, 0 after a cold boot */
+	uint32_t _last_direct_tstamp = 0;
+
+	/** Sequence number of next data frame */
+	uint16_t _seq = 0;
+
+	/** Last sequence number received from each leaf in current RX window, to ack retries without storing them twice */
+	uint32_t _seen_leaf_ids[LORA_RELAY_MAX_LEAVES];
+	uint16_t _seen_seqs[LORA_RELAY_MAX_LEAVES];
+	int _seen_count = 0;
+
+	/******************************************************************************
+	 * Node relays its data through a gateway
+	 *****************************************************************************/
+	bool is_leaf()
+	{
+		return FLAGS.LORA_RELAY && LORA_RELAY_ROLE == LORA_RELAY_ROLE_LEAF;
+	}
+
+	/******************************************************************************
+	 * Node relays data of leaves
+	 *****************************************************************************/
+	bool is_gateway()
+	{
+		return FLAGS.LORA_RELAY && LORA_RELAY_ROLE == LORA_RELAY_ROLE_GATEWAY;
+	}
+
+	/******************************************************************************
+	 * Id of this node in frames, derived from the MAC
+	 *****************************************************************************/
+	uint32_t get_node_id()
+	{
+		uint8_t mac[6];
+		esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+		return Utils::crc32(mac, sizeof(mac));
+	}
+
+	/******************************************************************************
+	 * Leaf call home: send sensor stores to the gateway. Every store is sent
+	 * whole or up to the first frame not acked, sent entries are deleted.
+	 * @return True if all data was relayed and a direct call home is not due,
+	 * false when the node must call home itself
+	 *****************************************************************************/
+	bool relay_call_home()
+	{
+		uint32_t now = RTC::get_timestamp();
+
+		// First call home after boot and every LORA_RELAY_DIRECT_CALL_HOME_SECS is direct
+		if(_last_direct_tstamp == 0 || now < _last_direct_tstamp ||
+			now - _last_direct_tstamp >= LORA_RELAY_DIRECT_CALL_HOME_SECS)
+		{
+			debug_println_i(F("Direct call home due, not relaying."));
+			_last_direct_tstamp = now;
+			return false;
+		}
+
+		if(begin() != RET_OK)
+		{
+			_last_direct_tstamp = now;
+			return false;
+		}
+
+		int relayed = 0;
+
+		RetResult ret = relay_store(SENSOR_STORE_WATER_SENSORS, WaterSensorData::get_store(), &relayed);
+
+#if FEATURE_SOIL_MOISTURE
+		if(ret == RET_OK)
+			ret = relay_store(SENSOR_STORE_SOIL_MOISTURE, SoilMoistureData::get_store(), &relayed);
+#endif
+
+#if FEATURE_ATMOS41
+		if(ret == RET_OK)
+			ret = relay_store(SENSOR_STORE_ATMOS41, Atmos41Data::get_store(), &relayed);
+#endif
+
+		if(ret == RET_OK)
+			ret = relay_store(SENSOR_STORE_FO, FoData::get_store(), &relayed);
+
+		bool fw_ready = false;
+
+		if(ret == RET_OK && FLAGS.LORA_OTA && LoraOta::is_pending())
+			fw_ready = request_firmware();
+
+		end();
+
+		debug_printf_i("Relayed entries: %d\n", relayed);
+		Log::log(Log::LORA_RELAY_SENT, relayed, ret == RET_OK);
+
+		if(ret != RET_OK)
+		{
+			debug_println_w(F("Gateway not reachable, calling home directly."));
+			_last_direct_tstamp = now;
+			return false;
+		}
+
+		if(fw_ready)
+			Utils::restart_device();
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * Gateway: listen for leaves for LORA_RELAY_RX_WINDOW_MS, extended while
+	 * frames keep coming. Received entries are added to RelayData
+	 *****************************************************************************/
+	RetResult receive_window()
+	{
+		if(begin() != RET_OK)
+			return RET_ERROR;
+
+		uint8_t frame[LORA_RELAY_MAX_FRAME_SIZE];
+		int frames = 0;
+		int stored = 0;
+
+		_seen_count = 0;
+
+		uint32_t start_ms = millis();
+		uint32_t window_ms = LORA_RELAY_RX_WINDOW_MS;
+
+		debug_println_i(F("Listening for relay leaves..."));
+
+		EnergyProfiler::begin(EnergyProfiler::STATE_RF_RX);
+
+		while(millis() - start_ms < window_ms)
+		{
+			int len = 0;
+
+			if(receive_frame(frame, sizeof(frame), window_ms - (millis() - start_ms), &len) != RET_OK)
+				continue;
+
+			const FrameHeader *header = (const FrameHeader*)frame;
+
+			if(len >= (int)sizeof(FrameHeader) && header->type == FRAME_FW_REQUEST)
+			{
+				if(!serve_firmware(frame, len))
+					continue;
+			}
+			else
+			{
+				int ret = handle_data_frame(frame, len);
+
+				if(ret < 0)
+					continue;
+
+				stored += ret;
+			}
+
+			frames++;
+
+			// Leaves still sending, keep listening
+			uint32_t elapsed_ms = millis() - start_ms;
+			if(elapsed_ms + LORA_RELAY_RX_IDLE_MS > window_ms)
+				window_ms = elapsed_ms + LORA_RELAY_RX_IDLE_MS < LORA_RELAY_RX_MAX_MS ? elapsed_ms + LORA_RELAY_RX_IDLE_MS : LORA_RELAY_RX_MAX_MS;
+		}
+
+		EnergyProfiler::end(EnergyProfiler::STATE_RF_RX);
+
+		end();
+
+		debug_printf_i("Relay frames received: %d, entries stored: %d\n", frames, stored);
+		Log::log(Log::LORA_RELAY_RECEIVED, frames, stored);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Switch radio to LoRa mode
+	 *****************************************************************************/
+	RetResult begin()
+	{
+		// Radio is busy sniffing
+		if(FoSniffer::continuous_rx_active())
+		{
+			debug_println_w(F("Radio in continuous FO RX, can't relay."));
+			return RET_ERROR;
+		}
+
+		_radio = FoSniffer::get_radio();
+
+		int state = _radio->begin(LORA_RELAY_FREQ, LORA_RELAY_BW, LORA_RELAY_SF, LORA_RELAY_CR,
+			LORA_RELAY_SYNC_WORD, LORA_RELAY_TX_POWER);
+
+		if(state != ERR_NONE)
+		{
+			debug_print_e(F("Could not init LoRa mode, code: "));
+			debug_println_e(state);
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Give radio back to FO sniffer, or sleep it
+	 *****************************************************************************/
+	void end()
+	{
+		if(_radio == NULL)
+			return;
+
+		if(FO_SOURCE == FO_SOURCE_SNIFFER && DeviceConfig::get_fo_enabled())
+			FoSniffer::init();
+		else
+			_radio->sleep();
+
+		_radio = NULL;
+	}
+
+	/******************************************************************************
+	 * Send data frame until acked, up to LORA_RELAY_TX_RETRIES times
+	 * @param frame Frame, header filled in up to count and store
+	 * @param len Frame length
+	 *****************************************************************************/
+	RetResult send_frame(uint8_t *frame, int len)
+	{
+		FrameHeader *header = (FrameHeader*)frame;
+		header->magic = LORA_RELAY_FRAME_MAGIC;
+		header->type = FRAME_DATA;
+		header->leaf_id = get_node_id();
+		header->seq = _seq++;
+
+		uint8_t ack[LORA_RELAY_MAX_FRAME_SIZE];
+
+		for(int i = 0; i < LORA_RELAY_TX_RETRIES; i++)
+		{
+			// Leaves wake up together, spread them
+			delay(esp_random() % LORA_RELAY_TX_JITTER_MS);
+
+			if(_radio->transmit(frame, len) != ERR_NONE)
+			{
+				debug_println_e(F("Could not transmit relay frame."));
+				continue;
+			}
+
+			uint32_t start_ms = millis();
+			int ack_len = 0;
+
+			// Skip frames of other leaves until ours is acked
+			while(millis() - start_ms < LORA_RELAY_ACK_TIMEOUT_MS &&
+				receive_frame(ack, sizeof(ack), LORA_RELAY_ACK_TIMEOUT_MS - (millis() - start_ms), &ack_len) == RET_OK)
+			{
+				const FrameHeader *ack_header = (const FrameHeader*)ack;
+
+				if(ack_len >= (int)sizeof(FrameHeader) && ack_header->magic == LORA_RELAY_FRAME_MAGIC &&
+					ack_header->type == FRAME_ACK && ack_header->leaf_id == header->leaf_id &&
+					ack_header->seq == header->seq)
+				{
+					return RET_OK;
+				}
+			}
+
+			debug_printf_w("Relay frame %u not acked (%d)\n", header->seq, i + 1);
+		}
+
+		return RET_ERROR;
+	}
+
+	/******************************************************************************
+	 * Wait for a frame
+	 * @param buff Buffer to read frame into
+	 * @param buff_size Buffer size
+	 * @param timeout_ms Max time to wait
+	 * @param len Length of frame received
+	 *****************************************************************************/
+	RetResult receive_frame(uint8_t *buff, int buff_size, uint32_t timeout_ms, int *len)
+	{
+		// DIO1 is not connected so RX timeout of single receive mode can't be used.
+		// Continuous receive with DIO0 (RxDone) polled instead
+		if(_radio->startReceive(0, SX127X_RXCONTINUOUS) != ERR_NONE)
+			return RET_ERROR;
+
+		uint32_t start_ms = millis();
+
+		while(!digitalRead(PIN_RF_DI0))
+		{
+			if(millis() - start_ms >= timeout_ms)
+			{
+				_radio->standby();
+				return RET_ERROR;
+			}
+
+			delay(1);
+		}
+
+		int packet_len = _radio->getPacketLength();
+
+		if(packet_len > buff_size)
+			packet_len = buff_size;
+
+		if(_radio->readData(buff, packet_len) != ERR_NONE)
+		{
+			debug_println_w(F("Relay frame CRC error."));
+			return RET_ERROR;
+		}
+
+		*len = packet_len;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Gateway: store entries of a data frame and ack it
+	 * @return Entries stored, -1 if frame is not a valid data frame
+	 *****************************************************************************/
+	int handle_data_frame(const uint8_t *frame, int len)
+	{
+		if(len < (int)sizeof(FrameHeader))
+			return -1;
+
+		const FrameHeader *header = (const FrameHeader*)frame;
+
+		if(header->magic != LORA_RELAY_FRAME_MAGIC || header->type != FRAME_DATA || header->store >= SENSOR_STORE_COUNT)
+			return -1;
+
+		int entry_size = get_entry_size((SensorStore)header->store);
+
+		if(header->count * entry_size != len - (int)sizeof(FrameHeader))
+		{
+			debug_println_w(F("Relay frame size mismatch, ignored."));
+			return -1;
+		}
+
+		int stored = 0;
+
+		// Retry of a frame whose ack was lost, only ack again
+		if(!is_duplicate(header->leaf_id, header->seq))
+		{
+			RelayData::Entry entry = {0};
+			entry.leaf_id = header->leaf_id;
+			entry.store = header->store;
+			entry.size = entry_size;
+			entry.rssi = _radio->getRSSI();
+
+			for(int i = 0; i < header->count; i++)
+			{
+				memcpy(entry.data, frame + sizeof(FrameHeader) + i * entry_size, entry_size);
+
+				// Not acked, leaf calls home itself
+				if(RelayData::add(&entry) != RET_OK)
+					return -1;
+
+				stored++;
+			}
+		}
+
+		FrameHeader ack = *header;
+		ack.type = FRAME_ACK;
+		ack.count = 0;
+
+		_radio->transmit((uint8_t*)&ack, sizeof(ack));
+
+		return stored;
+	}
+
+	/******************************************************************************
+	 * Frame was received before in this RX window, remember it otherwise
+	 *****************************************************************************/
+	bool is_duplicate(uint32_t leaf_id, uint16_t seq)
+	{
+		for(int i = 0; i < _seen_count; i++)
+		{
+			if(_seen_leaf_ids[i] != leaf_id)
+				continue;
+
+			if(_seen_seqs[i] == seq)
+				return true;
+
+			_seen_seqs[i] = seq;
+			return false;
+		}
+
+		if(_seen_count < LORA_RELAY_MAX_LEAVES)
+		{
+			_seen_leaf_ids[_seen_count] = leaf_id;
+			_seen_seqs[_seen_count] = seq;
+			_seen_count++;
+		}
+
+		return false;
+	}
+
+	/******************************************************************************
+	 * Size of entries of a relayed store
+	 *****************************************************************************/
+	int get_entry_size(SensorStore store)
+	{
+		switch(store)
+		{
+			case SENSOR_STORE_WATER_SENSORS:
+				return sizeof(WaterSensorData::Entry);
+			case SENSOR_STORE_SOIL_MOISTURE:
+				return sizeof(SoilMoistureData::Entry);
+			case SENSOR_STORE_ATMOS41:
+				return sizeof(Atmos41Data::Entry);
+			case SENSOR_STORE_FO:
+				return sizeof(FoData::StoreEntry);
+			default:
+				return 0;
+		}
+	}
+
+	/******************************************************************************
+	 * Leaf: get missing firmware chunks from the gateway, requested until a
+	 * request gets nothing new
+	 * @return True if the image is complete and set as boot partition
+	 *****************************************************************************/
+	bool request_firmware()
+	{
+		LoraOta::Request req;
+		bool ready = false;
+
+		while(LoraOta::build_request(&req))
+		{
+			uint8_t frame[sizeof(FrameHeader) + sizeof(LoraOta::Request)];
+			FrameHeader *header = (FrameHeader*)frame;
+
+			memset(header, 0, sizeof(FrameHeader));
+			header->magic = LORA_RELAY_FRAME_MAGIC;
+			header->type = FRAME_FW_REQUEST;
+			header->leaf_id = get_node_id();
+			header->seq = _seq++;
+			memcpy(frame + sizeof(FrameHeader), &req, sizeof(req));
+
+			int received = 0;
+
+			// Answer is the ack, request is retried until the gateway answers
+			for(int i = 0; i < LORA_RELAY_TX_RETRIES && received == 0; i++)
+			{
+				delay(esp_random() % LORA_RELAY_TX_JITTER_MS);
+
+				if(_radio->transmit(frame, sizeof(frame)) != ERR_NONE)
+				{
+					debug_println_e(F("Could not transmit firmware request."));
+					continue;
+				}
+
+				received = receive_firmware();
+			}
+
+			LoraOta::end_session(&ready);
+
+			if(ready || received == 0)
+				break;
+		}
+
+		return ready;
+	}
+
+	/******************************************************************************
+	 * Leaf: receive firmware frames until none comes for LORA_OTA_RX_IDLE_MS
+	 * @return Frames received
+	 *****************************************************************************/
+	int receive_firmware()
+	{
+		uint8_t frame[LORA_RELAY_MAX_FRAME_SIZE];
+		int frames = 0;
+		int len = 0;
+
+		EnergyProfiler::begin(EnergyProfiler::STATE_RF_RX);
+
+		while(receive_frame(frame, sizeof(frame), LORA_OTA_RX_IDLE_MS, &len) == RET_OK)
+		{
+			const FrameHeader *header = (const FrameHeader*)frame;
+
+			if(len < (int)sizeof(FrameHeader) || header->magic != LORA_RELAY_FRAME_MAGIC)
+				continue;
+
+			const uint8_t *payload = frame + sizeof(FrameHeader);
+			int payload_len = len - sizeof(FrameHeader);
+
+			if(header->type == FRAME_FW_INFO && payload_len == sizeof(LoraOta::Info))
+			{
+				LoraOta::on_info((const LoraOta::Info*)payload);
+				frames++;
+			}
+			else if(header->type == FRAME_FW_CHUNK && payload_len > (int)sizeof(LoraOta::Chunk))
+			{
+				// Chunks requested by other leaves are kept too
+				LoraOta::on_chunk((const LoraOta::Chunk*)payload, payload + sizeof(LoraOta::Chunk),
+					payload_len - sizeof(LoraOta::Chunk));
+				frames++;
+			}
+		}
+
+		EnergyProfiler::end(EnergyProfiler::STATE_RF_RX);
+
+		return frames;
+	}
+
+	/******************************************************************************
+	 * Gateway: answer a firmware request with image info, or the missing chunks
+	 * and parity of their groups
+	 * @return False if not a valid request for the running image
+	 *****************************************************************************/
+	bool serve_firmware(const uint8_t *frame, int len)
+	{
+		const FrameHeader *header = (const FrameHeader*)frame;
+
+		if(!FLAGS.LORA_OTA || header->magic != LORA_RELAY_FRAME_MAGIC ||
+			len != sizeof(FrameHeader) + sizeof(LoraOta::Request))
+		{
+			return false;
+		}
+
+		const LoraOta::Request *req = (const LoraOta::Request*)(frame + sizeof(FrameHeader));
+		LoraOta::Info info;
+
+		// Gateway not updated yet, leaf asks again next time
+		if(LoraOta::get_image(&info) != RET_OK || memcmp(info.md5, req->md5, sizeof(info.md5)) != 0)
+		{
+			debug_println_w(F("Leaf asked for firmware not running here."));
+			return false;
+		}
+
+		uint8_t out[LORA_RELAY_MAX_FRAME_SIZE];
+		FrameHeader *out_header = (FrameHeader*)out;
+
+		*out_header = *header;
+		out_header->count = 0;
+
+		if(req->first == LoraOta::FIRST_INFO)
+		{
+			out_header->type = FRAME_FW_INFO;
+			memcpy(out + sizeof(FrameHeader), &info, sizeof(info));
+
+			_radio->transmit(out, sizeof(FrameHeader) + sizeof(info));
+
+			return true;
+		}
+
+		out_header->type = FRAME_FW_CHUNK;
+
+		LoraOta::Chunk *chunk = (LoraOta::Chunk*)(out + sizeof(FrameHeader));
+		uint8_t *data = out + sizeof(FrameHeader) + sizeof(LoraOta::Chunk);
+
+		memcpy(chunk->md5, info.md5, sizeof(chunk->md5));
+
+		int sent = 0;
+
+		for(int group = 0; group < LORA_OTA_REQUEST_WINDOW / LORA_OTA_FEC_GROUP; group++)
+		{
+			bool touched = false;
+
+			for(int i = group * LORA_OTA_FEC_GROUP; i < (group + 1) * LORA_OTA_FEC_GROUP; i++)
+			{
+				if(!(req->missing[i / 8] & (1 << (i % 8))))
+					continue;
+
+				chunk->index = req->first + i;
+				chunk->parity = false;
+
+				int chunk_len = LoraOta::read_chunk(chunk->index, data);
+
+				if(chunk_len == 0)
+					continue;
+
+				_radio->transmit(out, sizeof(FrameHeader) + sizeof(LoraOta::Chunk) + chunk_len);
+
+				touched = true;
+				sent++;
+			}
+
+			if(!touched)
+				continue;
+
+			chunk->index = (req->first + group * LORA_OTA_FEC_GROUP) / LORA_OTA_FEC_GROUP;
+			chunk->parity = true;
+
+			if(LoraOta::read_parity(chunk->index, data) > 0)
+			{
+				_radio->transmit(out, sizeof(FrameHeader) + sizeof(LoraOta::Chunk) + LORA_OTA_CHUNK_SIZE);
+				sent++;
+			}
+		}
+
+		debug_printf_i("Firmware chunks sent to leaf %08X: %d\n", header->leaf_id, sent);
+		Log::log(Log::LORA_OTA_SERVED, header->leaf_id, sent);
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * Leaf: send all files of a store, frame by frame. Sent entries are acked in
+	 * the store so a failed frame is resent first next time
+	 * @param store Store id sent in frames
+	 * @param data_store Store to send
+	 * @param relayed Incremented by entries sent
+	 *****************************************************************************/
+	template <typename TStruct>
+	RetResult relay_store(SensorStore store, DataStore<TStruct> *data_store, int *relayed)
+	{
+		static_assert(sizeof(TStruct) <= RELAY_DATA_MAX_ENTRY_SIZE, "Store entry too large to relay");
+
+		const int max_frame_entries = (LORA_RELAY_MAX_FRAME_SIZE - sizeof(FrameHeader)) / sizeof(TStruct);
+
+		uint8_t frame[LORA_RELAY_MAX_FRAME_SIZE];
+		FrameHeader *header = (FrameHeader*)frame;
+		header->store = store;
+
+		DataStoreReader<TStruct> reader(data_store);
+		TStruct *entry = NULL;
+
+		while(reader.next_file())
+		{
+			int file_entries_read = 0;
+			int count = 0;
+
+			while((entry = reader.next_entry()))
+			{
+				file_entries_read++;
+
+				if(!reader.entry_crc_valid())
+					continue;
+
+				memcpy(frame + sizeof(FrameHeader) + count * sizeof(TStruct), entry, sizeof(TStruct));
+				count++;
+
+				if(count < max_frame_entries)
+					continue;
+
+				header->count = count;
+
+				if(send_frame(frame, sizeof(FrameHeader) + count * sizeof(TStruct)) != RET_OK)
+					return RET_ERROR;
+
+				reader.ack_entries(file_entries_read);
+				*relayed += count;
+				count = 0;
+			}
+
+			if(count > 0)
+			{
+				header->count = count;
+
+				if(send_frame(frame, sizeof(FrameHeader) + count * sizeof(TStruct)) != RET_OK)
+					return RET_ERROR;
+
+				*relayed += count;
+			}
+
+			reader.queue_delete_file();
+			reader.commit_deletes(1);
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Save state before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->last_direct_tstamp = _last_direct_tstamp;
+		state->seq = _seq;
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_last_direct_tstamp = state->last_direct_tstamp;
+		_seq = state->seq;
+	}
+}
@@ -9,6 +9,7 @@
 #include "globals.h"
 #include "water_sensor_data.h"
 #include "utils.h"
+#include "store_registry.h"
 #include "gsm.h"
 #include "rtc.h"
 #include "log.h"
@@ -16,12 +17,13 @@
 #include "test_utils.h"
 #include "sleep_scheduler.h"
 #include "water_sensors.h"
+#include "power_control.h"
 #include <Wire.h>
 #include <RtcDS3231.h>
 #include "device_config.h"
 #include "battery.h"
 #include "int_env_sensor.h"
-#include <SPIFFS.h>
+#include "storage.h"
 #include "ota.h"
 #include "atmos41.h"
 #include "rom/rtc.h"
@@ -32,9 +34,17 @@
 #include "driver/rtc_io.h"
 #include "esp_sleep.h"
 #include "lightning.h"
+#include "lightning_data.h"
 #include "battery_gauge.h"
 #include "solar_monitor.h"
 #include "ipfs_client.h"
+#include "deep_sleep.h"
+#include "energy_profiler.h"
+#include "memory_monitor.h"
+
+/** Successive warm boots, kept in RTC memory over resets (see warm_boot_allowed) */
+RTC_NOINIT_ATTR uint32_t _warm_boot_magic;
+RTC_NOINIT_ATTR uint32_t _warm_boot_count;
 
 // For testing
 #include "http_request.h"
@@ -43,14 +53,482 @@
 #include "sdi12_log.h"
 #include "tb_sdi12_log_json_builder.h"
 #include "wifi_modem.h"
+#include "bearer.h"
 #include "sdi12.h"
 #include "sdi12_sensor.h"
 #include "dfrobot_liquid.h"
 #include "teros12.h"
+#include "sdi12_registry.h"
+#include "sdi12_bus.h"
 #include "soil_moisture_data.h"
 #include "water_level.h"
 #include "water_presence.h"
 #include "aquatroll.h"
+#include "i2c_bus.h"
+#include "lora_relay.h"
+#include "acquisition.h"
+#include "psram.h"
+#include "power_lock.h"
+#include "board_features.h"
+
+/******************************************************************************
+ * Fast boot on wake up from deep sleep
+ * Only peripherals are inited. Boot info, config mode, boot tests, time sync and
+ * boot measurements are skipped. Module state is restored from RTC memory and
+ * execution continues where the device went to sleep.
+ *****************************************************************************/
+void fast_boot()
+{
+	DeviceConfig::init();
+
+	I2CBus::begin();
+
+	// System time is kept in deep sleep, synced from ext RTC on wake up
+	RTC::init();
+
+	// IntEnvSensor, BatteryGauge and SolarMonitor init on first use
+	Battery::init();
+	Psram::init();
+	Flash::mount();
+	StoreRegistry::check_format();
+	Log::init();
+	GSM::init();
+	WaterSensors::init();
+	WaterLevel::init();
+	WaterPresence::init();
+#if FEATURE_ATMOS41
+	Atmos41::init();
+#endif
+	Sdi12Registry::init();
+
+	if(FO_SOURCE == FO_SOURCE_SNIFFER)
+		FoSniffer::init();
+	else if(FO_SOURCE == FO_SOURCE_UART)
+		FoUart::init();
+
+	DeepSleep::Source source = DeepSleep::get_source();
+
+	DeepSleep::restore();
+
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_FAST_TOTAL, millis());
+	MemoryMonitor::sample(MemoryMonitor::PHASE_BOOT);
+
+	if(source == DeepSleep::SOURCE_SLEEP_CHARGE)
+	{
+		// Returns when charged, next wake up is scheduled by loop()
+		Battery::sleep_charge();
+	}
+	else
+	{
+		// loop() handles wake up reasons
+		SleepScheduler::resume();
+	}
+}
+
+/******************************************************************************
+ * Check if boot can be a warm boot
+ * Only after an unexpected reset (watchdog, panic, brown-out). Intentional
+ * reboots, first boot after OTA, missing FO id and reset loops take a full boot
+ *****************************************************************************/
+bool warm_boot_allowed()
+{
+	if(!FLAGS.WARM_BOOT)
+		return false;
+
+	switch(rtc_get_reset_reason(0))
+	{
+		case RESET_REASON::TG0WDT_SYS_RESET:
+		case RESET_REASON::TG1WDT_SYS_RESET:
+		case RESET_REASON::RTCWDT_SYS_RESET:
+		case RESET_REASON::TGWDT_CPU_RESET:
+		case RESET_REASON::SW_CPU_RESET:
+		case RESET_REASON::RTCWDT_CPU_RESET:
+		case RESET_REASON::RTCWDT_BROWN_OUT_RESET:
+			break;
+		default:
+			return false;
+	}
+
+	// Set before intentional reboots (eg. remote control, OTA)
+	if(DeviceConfig::get_clean_reboot() || DeviceConfig::get_ota_flashed())
+		return false;
+
+	// Needs scan
+	if(FO_SOURCE == FO_SOURCE_SNIFFER && DeviceConfig::get_fo_enabled() && DeviceConfig::get_fo_sniffer_id() == 0)
+		return false;
+
+	if(_warm_boot_magic != WARM_BOOT_MAGIC)
+	{
+		_warm_boot_magic = WARM_BOOT_MAGIC;
+		_warm_boot_count = 0;
+	}
+
+	return _warm_boot_count < WARM_BOOT_MAX_SUCCESSIVE;
+}
+
+/******************************************************************************
+ * Warm boot after an unexpected reset
+ * Time is taken from the ext RTC and the schedule continues from there. GSM
+ * time sync is postponed to next call home, boot measurements and call home are
+ * skipped and I2C sensors are inited on first use.
+ * @return RET_ERROR if time is not valid, full boot is needed
+ *****************************************************************************/
+RetResult warm_boot()
+{
+	I2CBus::begin();
+
+	RTC::init();
+	RTC::enable_timechange_safety(false);
+	RTC::sync_time_from_ext_rtc();
+	RTC::enable_timechange_safety(true);
+
+	if(!RTC::tstamp_valid(RTC::get_timestamp()))
+	{
+		debug_println_e(F("Warm boot: no valid time, full boot."));
+		return RET_ERROR;
+	}
+
+	Utils::serial_style(STYLE_BLUE);
+	Utils::print_separator(F("WARM BOOT"));
+	Utils::serial_style(STYLE_RESET);
+
+	EnergyProfiler::init();
+
+	// IntEnvSensor, BatteryGauge and SolarMonitor init on first use
+	Battery::init();
+	Psram::init();
+	Flash::mount();
+	StoreRegistry::check_format();
+	Log::init();
+	GSM::init();
+	WaterSensors::init();
+	WaterLevel::init();
+	WaterPresence::init();
+#if FEATURE_ATMOS41
+	Atmos41::init();
+#endif
+	Sdi12Registry::init();
+
+	if(FO_SOURCE == FO_SOURCE_SNIFFER)
+	{
+		FoSniffer::init();
+
+		if(FLAGS.FO_CONTINUOUS_RX)
+			FoSniffer::start_continuous_rx();
+	}
+	else if(FO_SOURCE == FO_SOURCE_UART)
+		FoUart::init();
+
+	_warm_boot_count++;
+
+	Log::log(Log::Code::BOOT, FW_VERSION, (int)rtc_get_reset_reason(0));
+
+	// New image resetting
+	OTA::on_unexpected_reset();
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_WARM_TOTAL, millis());
+	MemoryMonitor::sample(MemoryMonitor::PHASE_BOOT);
+
+	RTC::set_sync_pending();
+
+	Battery::sleep_charge();
+
+#if FEATURE_LIGHTNING
+	if(FLAGS.LIGHTNING_SENSOR_ENABLED)
+	{
+		if(Lightning::on() != RET_OK)
+		{
+			Log::log(Log::LIGHTNING_FAILED_TO_START, LIGHTNING_SENSOR_MODULE, LIGHTNING_I2C_ADDR);
+		}
+	}
+#endif
+
+	return RET_OK;
+}
+
+/** Sensors due on this wake up, read by the sensors job */
+struct SensorsDue
+{
+	bool water;
+	bool soil_moisture;
+	bool weather;
+};
+
+#if FEATURE_SOIL_MOISTURE && FEATURE_ATMOS41
+/******************************************************************************
+ * Check if soil moisture and weather station can be measured together on the
+ * SDI12 bus: both discovered, each at its own address. Not when the weather
+ * station was kept powered, its continuous values are read without waiting
+ *****************************************************************************/
+bool sdi12_concurrent()
+{
+	const Sdi12Registry::Sensor *teros12 = Sdi12Registry::find(Sdi12Registry::MODEL_TEROS12);
+	const Sdi12Registry::Sensor *atmos41 = Sdi12Registry::find(Sdi12Registry::MODEL_ATMOS41);
+
+	if(teros12 == NULL || atmos41 == NULL || teros12->address == atmos41->address)
+		return false;
+
+	return !FLAGS.MEASURE_DUMMY_WEATHER && !PowerControl::is_parked(PowerControl::DEVICE_ATMOS41);
+}
+
+/******************************************************************************
+ * Measure soil moisture and weather station concurrently (see Sdi12Bus), awake
+ * for the longer of the two measurements instead of both of them
+ *****************************************************************************/
+RetResult log_sdi12_concurrent()
+{
+	float teros12[TEROS12_NUMBER_OF_MEASUREMENTS] = {0};
+	float atmos41[WEATHER_STATION_NUMBER_OF_MEASUREMENTS] = {0};
+
+	Sdi12Bus bus(PIN_SDI12_DATA, PIN_WATER_SENSORS_PWR);
+	bus.add(Sdi12Registry::get_address(Sdi12Registry::MODEL_TEROS12), teros12, TEROS12_NUMBER_OF_MEASUREMENTS);
+	bus.add(Sdi12Registry::get_address(Sdi12Registry::MODEL_ATMOS41), atmos41, WEATHER_STATION_NUMBER_OF_MEASUREMENTS);
+
+	PowerControl::acquire(PowerControl::DEVICE_TEROS12);
+	Atmos41::on();
+
+	bus.measure();
+
+	PowerControl::release(PowerControl::DEVICE_TEROS12);
+
+	// Values only if all of them were received
+	const Sdi12Bus::Request *teros12_req = bus.get_request(0);
+	const Sdi12Bus::Request *atmos41_req = bus.get_request(1);
+
+	RetResult ret = RET_OK;
+
+	if(Teros12::log_values(teros12, teros12_req->result == RET_OK ? teros12_req->count : 0) != RET_OK)
+		ret = RET_ERROR;
+
+	// Turns the weather station off or keeps it powered
+	if(Atmos41::log_values(atmos41, atmos41_req->result == RET_OK ? atmos41_req->count : 0) != RET_OK)
+		ret = RET_ERROR;
+
+	return ret;
+}
+#endif
+
+/******************************************************************************
+ * Read sensors due, concurrently when on independent buses (see Acquisition).
+ * Soil moisture and weather station share the SDI12 bus, they are one job
+ * measuring both when they can (see sdi12_concurrent()).
+ * Rail devices are held for the whole batch, so the rail is switched on and
+ * waited for once
+ *****************************************************************************/
+void read_sensors(bool water, bool soil_moisture, bool weather)
+{
+	Acquisition::Job jobs[3];
+	int count = 0;
+
+	// Water quality and level are jobs of their own (see WaterSensors::log())
+	if(water)
+		jobs[count++] = {"water sensors", Acquisition::BUS_NONE, [](void *ctx) -> RetResult { return WaterSensors::log(); }, NULL, RET_ERROR};
+
+#if FEATURE_SOIL_MOISTURE && FEATURE_ATMOS41
+	if(soil_moisture && weather && sdi12_concurrent())
+	{
+		jobs[count++] = {"sdi12 sensors", Acquisition::BUS_SDI12, [](void *ctx) -> RetResult { return log_sdi12_concurrent(); }, NULL, RET_ERROR};
+	}
+	else
+#endif
+	{
+#if FEATURE_SOIL_MOISTURE
+		if(soil_moisture)
+			jobs[count++] = {"soil moisture", Acquisition::BUS_SDI12, [](void *ctx) -> RetResult { return Teros12::log(); }, NULL, RET_ERROR};
+#endif
+
+#if FEATURE_ATMOS41
+		if(weather)
+			jobs[count++] = {"weather station", Acquisition::BUS_SDI12, [](void *ctx) -> RetResult { return Atmos41::measure_log(); }, NULL, RET_ERROR};
+#endif
+	}
+
+	if(count == 0)
+		return;
+
+	PowerControl::Device devices[PowerControl::DEVICE_COUNT];
+	int device_count = 0;
+
+	if(water)
+	{
+		if(FLAGS.WATER_QUALITY_SENSOR_ENABLED)
+			devices[device_count++] = PowerControl::DEVICE_AQUATROLL;
+
+		if(FLAGS.WATER_LEVEL_SENSOR_ENABLED)
+			devices[device_count++] = PowerControl::DEVICE_WATER_LEVEL;
+	}
+
+	if(soil_moisture)
+		devices[device_count++] = PowerControl::DEVICE_TEROS12;
+
+	if(weather)
+		devices[device_count++] = PowerControl::DEVICE_ATMOS41;
+
+	// Nothing to share with a single device, which may rely on powering up
+	// itself (eg. Teros12 DDI capture)
+	if(device_count < 2)
+		device_count = 0;
+
+	for(int i = 0; i < device_count; i++)
+		PowerControl::acquire(devices[i]);
+
+	// Transcript kept only if a job failed or the server asked for it
+	SDI12Log::begin_measurement();
+
+	RetResult ret = Acquisition::run(jobs, count);
+
+	SDI12Log::end_measurement(ret != RET_OK);
+
+	for(int i = 0; i < device_count; i++)
+		PowerControl::release(devices[i]);
+}
+
+/******************************************************************************
+ * Run tasks of this wake up as a job graph (see Acquisition). FO sniff goes
+ * first for its exact wake up timing, connecting, sensors and ad-hoc tasks
+ * follow it and call home goes last, so it submits what they measured
+ * @param measure Wake up self test passed, measure and run ad-hoc tasks
+ *****************************************************************************/
+void run_wakeup_jobs(bool measure)
+{
+	Acquisition::Job jobs[5];
+	int count = 0;
+	int fo = -1, connect = -1, sensors = -1, tasks = -1;
+
+	// Sensors due are read together (see read_sensors())
+	SensorsDue due = {false, false, false};
+
+	if(measure)
+	{
+		//
+		// Sniff FO weather station
+		//
+		// Continuous RX frames are decoded on every wake up
+		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_FO) || FoSniffer::continuous_rx_active())
+		{
+			debug_println_i(F("Reason: Sniff FO weather station."));
+
+			if(!DeviceConfig::get_fo_enabled())
+			{
+				debug_println_e(F("FO sniffer disabled, sniffing aborted."));
+			}
+			else
+			{
+				fo = count;
+				jobs[count++] = {"FO", Acquisition::BUS_NONE, [](void *ctx) -> RetResult
+					{
+						if(FO_SOURCE == FO_SOURCE_SNIFFER)
+							return FoSniffer::handle_sniff_event();
+						else if(FO_SOURCE == FO_SOURCE_UART)
+							return FoUart::handle_scheduled_event();
+
+						return RET_OK;
+					}, NULL, RET_ERROR, 0, true};
+			}
+		}
+
+		// Connect while sensors are read, call home waits for it
+		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_CALL_HOME) && !LoraRelay::is_leaf())
+		{
+			connect = count;
+			jobs[count++] = {"connect", Acquisition::BUS_MODEM, [](void *ctx) -> RetResult { return Bearer::start_connect(); },
+				NULL, RET_ERROR, Acquisition::job_bit(fo), true};
+		}
+
+		//
+		// Measure water quality
+		//
+		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_WATER_SENSORS))
+		{
+			debug_println_i(F("Reason: Read water sensors"));
+
+			if(!FLAGS.WATER_QUALITY_SENSOR_ENABLED &&  !FLAGS.WATER_LEVEL_SENSOR_ENABLED)
+			{
+				debug_println_e(F("Water sensors disabled, measurement aborted."));
+			}
+			else
+			{
+				due.water = true;
+			}
+		}
+
+		//
+		// Measure soil moisture
+		//
+		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_SOIL_MOISTURE_SENSOR))
+		{
+			debug_println_i(F("Reason: Read soil moisture"));
+
+			if(!FLAGS.SOIL_MOISTURE_SENSOR_ENABLED)
+			{
+				debug_println_e(F("Soil moisture sensor disabled, measurement aborted."));
+			}
+			else
+			{
+				due.soil_moisture = true;
+			}
+		}
+
+		//
+		// Measure weather data
+		//
+		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_WEATHER_STATION))
+		{
+			debug_println_i(F("Reason: Read weather station"));
+
+			if(!FLAGS.ATMOS41_ENABLED)
+			{
+				debug_println_e(F("Weather station disabled, measurement aborted."));
+			}
+			else
+			{
+				due.weather = true;
+			}
+		}
+
+		if(due.water || due.soil_moisture || due.weather)
+		{
+			sensors = count;
+			jobs[count++] = {"sensors", Acquisition::BUS_NONE, [](void *ctx) -> RetResult
+				{
+					SensorsDue *due = (SensorsDue*)ctx;
+					read_sensors(due->water, due->soil_moisture, due->weather);
+
+					return RET_OK;
+				}, &due, RET_ERROR, Acquisition::job_bit(fo), false};
+		}
+
+		// Ad-hoc scheduled tasks
+		tasks = count;
+		jobs[count++] = {"tasks", Acquisition::BUS_NONE, [](void *ctx) -> RetResult
+			{
+				SleepScheduler::run_tasks();
+				MemoryMonitor::sample(MemoryMonitor::PHASE_MEASURE);
+
+				return RET_OK;
+			}, NULL, RET_ERROR, Acquisition::job_bit(fo) | Acquisition::job_bit(sensors), true};
+	}
+
+	if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_CALL_HOME))
+	{
+		debug_println_i(F("Reason: Call home"));
+
+		// Needs the stack of the loop task, runs in place
+		jobs[count++] = {"call home", Acquisition::BUS_MODEM, [](void *ctx) -> RetResult
+			{
+				RetResult ret = CallHome::start();
+				MemoryMonitor::sample(MemoryMonitor::PHASE_CALL_HOME);
+
+				// Device got through a call home, warm boots count from here
+				_warm_boot_count = 0;
+
+				return ret;
+			}, NULL, RET_ERROR, Acquisition::job_bit(fo) | Acquisition::job_bit(connect) |
+				Acquisition::job_bit(sensors) | Acquisition::job_bit(tasks), true};
+	}
+
+	if(count > 0)
+		Acquisition::run(jobs, count);
+}
 
 /******************************************************************************
  * Setup
@@ -58,16 +536,39 @@
 void setup() 
 {
 	Serial.begin(115200);
+
+	DeepSleep::init();
+
+	// CPU runs slow from here on, on every boot path
+	PowerLock::init();
+
+	if(DeepSleep::woke_up())
+	{
+		fast_boot();
+		return;
+	}
+
+	DeviceConfig::init();
+
+	if(warm_boot_allowed() && warm_boot() == RET_OK)
+	{
+		return;
+	}
+
+	// Full boot, see warm_boot_allowed()
+	_warm_boot_magic = WARM_BOOT_MAGIC;
+	_warm_boot_count = 0;
 		
 	Utils::serial_style(STYLE_BLUE);
 	Utils::print_separator(F("BOOTING"));
 	Utils::serial_style(STYLE_RESET);
+
+	EnergyProfiler::init();
 	debug_print(F("\n\n"));
 
 	//
 	// Print on-boot info
 	// 
-	DeviceConfig::init();
 
 	Utils::serial_style(STYLE_GREEN);
 	debug_print(F("Reset reason: "));
@@ -169,9 +670,10 @@ void setup()
 	//
 	// Init 
 	// Order important
+	uint32_t t_phase_start = millis();
 
 	// Init main I2C1 bus
-	Wire.begin(PIN_I2C1_SDA, PIN_I2C1_SCL, 100000);
+	I2CBus::begin();
 
 	// Init ext RTC first and sync system time
 	RTC::init();
@@ -190,13 +692,23 @@ void setup()
 	BatteryGauge::init();
 	SolarMonitor::init();
 	delay(100);
+	Psram::init();
 	Flash::mount();
-	Flash::ls();
+	StoreRegistry::check_format();
+	Log::init();
+	StoreRegistry::print_stats();
 	GSM::init();
 	WaterSensors::init();
 	WaterLevel::init();
 	WaterPresence::init();
+#if FEATURE_ATMOS41
 	Atmos41::init();
+#endif
+	Sdi12Registry::init();
+
+	// Find sensors on the SDI12 bus and their addresses
+	if(FLAGS.WATER_QUALITY_SENSOR_ENABLED || FLAGS.ATMOS41_ENABLED || FLAGS.SOIL_MOISTURE_SENSOR_ENABLED)
+		Sdi12Registry::discover();
 
 	if(FO_SOURCE == FO_SOURCE_SNIFFER)
 	{
@@ -209,6 +721,9 @@ void setup()
 			debug_println_e(F("No FO weather station id is set, scanning."));
 			FoSniffer::scan_fo_id(true);
 		}
+
+		if(FLAGS.FO_CONTINUOUS_RX)
+			FoSniffer::start_continuous_rx();
 	}
 	else if(FO_SOURCE == FO_SOURCE_UART)
 	{
@@ -218,6 +733,13 @@ void setup()
 	
 	// Log boot now that memory has been inited
 	Log::log(Log::Code::BOOT, FW_VERSION, (int)rtc_get_reset_reason(0));
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_INIT, millis() - t_phase_start);
+
+	// Fast boot is taken on valid state, so state was invalid (eg. different fw version)
+	if(FLAGS.DEEP_SLEEP && rtc_get_reset_reason(0) == RESET_REASON::DEEPSLEEP_RESET)
+	{
+		Log::log(Log::DEEP_SLEEP_STATE_INVALID, DeepSleep::get_state_version());
+	}
 
 	// Log mac address
 	Utils::log_mac();
@@ -255,6 +777,7 @@ void setup()
 	Serial.println(F("Checking sleep charge"));
 	Battery::sleep_charge();
 
+#if FEATURE_LIGHTNING
 	if(FLAGS.LIGHTNING_SENSOR_ENABLED)
 	{
 		if(Lightning::on() != RET_OK)
@@ -262,6 +785,7 @@ void setup()
 			Log::log(Log::LIGHTNING_FAILED_TO_START, LIGHTNING_SENSOR_MODULE, LIGHTNING_I2C_ADDR);
 		}
 	}
+#endif
 
 	//
 	// Check if reboot clean
@@ -276,18 +800,22 @@ void setup()
 
 		// Reset flag
 		DeviceConfig::set_clean_reboot(false);
-		DeviceConfig::commit();
 	}
 	else
 	{
 		Utils::serial_style(STYLE_RED);
 		debug_println(F("Boot is not clean (not intentional)"));
 		Utils::serial_style(STYLE_RESET);
+
+		// New image resetting
+		OTA::on_unexpected_reset();
 	}
 
 	//
 	// Turn on GSM to check if SIM card present and sync time
 	// In debug mode sync time from external RTC
+	t_phase_start = millis();
+
 	if(FLAGS.DEBUG_MODE && RTC::tstamp_valid(RTC::get_timestamp()))
 	{
 		debug_println(F("Debug mode, using ext RTC time."));
@@ -326,35 +854,34 @@ void setup()
 		}
 	}
 
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_TIME_SYNC, millis() - t_phase_start);
+
 	//////////////////////////////////////////////////////////////////////////////////////////
 
+	t_phase_start = millis();
+
+	// Call home follows, connect while sensors are read
+	Bearer::start_connect();
+
 	// TODO: Make all tasks run on boot and remove this
-	if(FLAGS.WATER_QUALITY_SENSOR_ENABLED || FLAGS.WATER_LEVEL_SENSOR_ENABLED)
-	{
-		Utils::serial_style(STYLE_MAGENTA);
-		debug_println(F("Reading: Read water sensors"));
-		Utils::serial_style(STYLE_RESET);
-		WaterSensors::log();
-	}
-	if(FLAGS.ATMOS41_ENABLED)
-	{
-		Utils::serial_style(STYLE_CYAN);
-		debug_println(F("Reading: Read weather station"));
-		Utils::serial_style(STYLE_RESET);
-		Atmos41::measure_log();
-	}
-	if(FLAGS.SOIL_MOISTURE_SENSOR_ENABLED)
-	{
-		Utils::serial_style(STYLE_CYAN);
-		debug_println(F("Reading: Read soil moisture sensor"));
-		Utils::serial_style(STYLE_RESET);
-		Teros12::log();
-	}
+	Utils::serial_style(STYLE_MAGENTA);
+	debug_println(F("Reading: Read sensors"));
+	Utils::serial_style(STYLE_RESET);
+	read_sensors(FLAGS.WATER_QUALITY_SENSOR_ENABLED || FLAGS.WATER_LEVEL_SENSOR_ENABLED,
+		FLAGS.SOIL_MOISTURE_SENSOR_ENABLED, FLAGS.ATMOS41_ENABLED);
+
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_READ_SENSORS, millis() - t_phase_start);
 
 	Utils::serial_style(STYLE_BLUE);
 	debug_println(F("Reason: Call home"));
 	Utils::serial_style(STYLE_RESET);
+
+	t_phase_start = millis();
 	CallHome::start();
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_CALL_HOME, millis() - t_phase_start);
+
+	Log::log(Log::BOOT_TIMING, BOOT_PHASE_COLD_TOTAL, millis());
+	MemoryMonitor::sample(MemoryMonitor::PHASE_BOOT);
 
 	Utils::print_separator(F("SETUP COMPLETE"));
 }
@@ -370,27 +897,28 @@ RetResult wakeup_self_test()
 {
 	RetResult ret = RET_OK;
 
-	// Check if RTC returns invalid value
+	// Time is still usable on drift, sync on next call home instead of powering
+	// the modem just for that
 	int drift = RTC::detect_drift();
-	if(!RTC::tstamp_valid(RTC::get_timestamp()) || drift > 0)
+	if(drift > 0)
+	{
+		debug_print(F("RTC drift detected: "));
+		debug_println(drift, DEC);
+		Log::log(Log::RTC_DRIFT_DETECTED, drift, RTC::get_external_rtc_timestamp());
+		RTC::set_sync_pending();
+	}
+
+	// Check if RTC returns invalid value
+	if(!RTC::tstamp_valid(RTC::get_timestamp()))
 	{
+		debug_println_e(F("RTC returns invalid timestamp, syncing..."));
+
 		if(GSM::on() != RET_OK)
 		{
 			debug_println(F("Could not turn on GSM"));
 			ret = RET_ERROR;
 		}
 
-		if(drift > 0)
-		{
-			debug_print(F("RTC drift detected: "));
-			debug_println(drift, DEC);
-			Log::log(Log::RTC_DRIFT_DETECTED, drift, RTC::get_external_rtc_timestamp());
-		}
-		else
-		{
-			debug_println_e(F("RTC returns invalid timestamp, syncing..."));
-		}
-
 		//
 		// Sync RTC
 		//	
@@ -419,15 +947,22 @@ RetResult wakeup_self_test()
 ******************************************************************************/
 void loop()
 {
-	// Handle battery sleep charge if needed
-	if(Battery::get_current_mode() == BATTERY_MODE::BATTERY_MODE_SLEEP_CHARGE)
+	// Handle battery sleep charge if needed. Battery is measured again on wake
+	// ups other than FO ones
+	BATTERY_MODE battery_mode = SleepScheduler::get_wake_tier() == SleepScheduler::TIER_FO ?
+		Battery::get_last_mode() : Battery::get_current_mode();
+
+	if(battery_mode == BATTERY_MODE::BATTERY_MODE_SLEEP_CHARGE)
 	{
+		// Nothing to keep powered for while charging
+		PowerControl::expire_parks(true);
 		Battery::sleep_charge();
 	}
 
 	//
 	// Go to sleep
 	//
+	PowerControl::expire_parks();
 	SleepScheduler::sleep_to_next();
 
 	//
@@ -436,105 +971,62 @@ void loop()
 
 	// Woke up on IRQ from lightning sensor?
 	// Handle otherwise go back to sleep
+#if FEATURE_LIGHTNING
 	if(FLAGS.LIGHTNING_SENSOR_ENABLED && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0)
 	{
 		Lightning::handle_irq();
 		return;
 	}
+#endif
 
-	// Do not log when waking up for FO Sniff
-	if(!SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_FO))
+	// Woke up on water presence change? Log it right away (and uplink if
+	// expedited), regular schedule continues
+	if(FLAGS.WATER_PRESENCE_SENSOR_ENABLED && WaterPresence::check_edge())
 	{
-		IntEnvSensor::log();
+		if(WaterPresence::uplink_due())
+			CallHome::send_alarm(CallHome::ALARM_WATER_PRESENCE, digitalRead(PIN_WATER_PRESENCE));
+
+		return;
 	}
 
-	// Do wake up self test
-	if(wakeup_self_test() != RET_OK)
+	// Strikes are buffered between scheduled wake ups
+#if FEATURE_LIGHTNING
+	if(FLAGS.LIGHTNING_SENSOR_ENABLED)
 	{
-		debug_println_e(F("Wake up self test failed, going back to sleep."));
+		LightningData::commit();
 	}
-	else
-	{
-		//
-		// Tasks executed only when wakeup self test passed
-		//
+#endif
 
-		//
-		// Sniff FO weather station
-		//
-		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_FO))
-		{
-			debug_println_i(F("Reason: Sniff FO weather station."));
-			
-			if(!DeviceConfig::get_fo_enabled())
-			{
-				debug_println_e(F("FO sniffer disabled, sniffing aborted."));
-			}
-			else
-			{
-				if(FO_SOURCE == FO_SOURCE_SNIFFER)
-					FoSniffer::handle_sniff_event();
-				else if(FO_SOURCE == FO_SOURCE_UART)
-					FoUart::handle_scheduled_event();
-			}
-		}
-
-		//
-		// Measure water quality
-		//
-		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_WATER_SENSORS))
-		{
-			debug_println_i(F("Reason: Read water sensors"));
+	// Do not log when waking up for FO Sniff
+	if(!SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_FO))
+	{
+		IntEnvSensor::log();
+	}
 
-			if(!FLAGS.WATER_QUALITY_SENSOR_ENABLED &&  !FLAGS.WATER_LEVEL_SENSOR_ENABLED)
-			{
-				debug_println_e(F("Water sensors disabled, measurement aborted."));
-			}
-			else
-			{
-				WaterSensors::log();
-			}
-		}
+	// Do wake up self test, tasks other than call home need it to pass. FO wake
+	// ups only need valid time, drift is checked on the next sensor wake up
+	bool self_test_ok = SleepScheduler::get_wake_tier() == SleepScheduler::TIER_FO &&
+		RTC::tstamp_valid(RTC::get_timestamp());
 
-		//
-		// Measure soil moisture
-		//
-		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_SOIL_MOISTURE_SENSOR))
-		{
-			debug_println_i(F("Reason: Read soil moisture"));
+	if(!self_test_ok)
+		self_test_ok = wakeup_self_test() == RET_OK;
 
-			if(!FLAGS.SOIL_MOISTURE_SENSOR_ENABLED)
-			{
-				debug_println_e(F("Soil moisture sensor disabled, measurement aborted."));
-			}
-			else
-			{
-				Teros12::log();
-			}
-		}
+	if(!self_test_ok)
+	{
+		debug_println_e(F("Wake up self test failed, going back to sleep."));
+	}
 
-		//
-		// Measure weather data
-		//
-		if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_READ_WEATHER_STATION))
-		{
-			debug_println_i(F("Reason: Read weather station"));
+	run_wakeup_jobs(self_test_ok);
 
-			if(!FLAGS.ATMOS41_ENABLED)
-			{
-				debug_println_e(F("Weather station disabled, measurement aborted."));
-			}
-			else
-			{
-				Atmos41::measure_log();
-			}
-		}
-	}
-	
-	if(SleepScheduler::wakeup_reason_is(SleepScheduler::REASON_CALL_HOME))
+	// Nothing due for a while, merge partially filled store files. Not while FO
+	// frames are received, they need exact wake up timing
+	const SleepScheduler::Deadline *next = SleepScheduler::get_next_deadline();
+	if(FLAGS.STORE_COMPACTION && !FoSniffer::continuous_rx_active() &&
+		Battery::get_current_mode() == BATTERY_MODE::BATTERY_MODE_NORMAL &&
+		(next == NULL || next->due >= RTC::get_timestamp() + STORE_COMPACT_MIN_IDLE_SECS) &&
+		SleepScheduler::may_run(SleepScheduler::WORK_COMPACTION))
 	{
-		debug_println_i(F("Reason: Call home"));
-		CallHome::start();
+		StoreRegistry::compact_all();
 	}
 
 	debug_println(F("------------------------------------------------"));
@@ -0,0 +1,111 @@
+#include "memory_monitor.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "const.h"
+#include "common.h"
+#include "globals.h"
+#include "psram.h"
+
+namespace MemoryMonitor
+{
+	//
+	// Private vars
+	//
+
+	/** Min free heap of each phase (bytes). 0 if not sampled yet */
+	uint32_t _phase_heap_min[PHASE_COUNT] = {0};
+
+	/** Stack high water mark of each task, unused stack bytes. 0 if not sampled yet */
+	uint32_t _task_stack_hwm[TASK_COUNT] = {0};
+
+	/** Min free heap since boot on last sample */
+	uint32_t _last_heap_min = 0;
+
+	/** Attribute names */
+	const char *PHASE_ATTR_NAMES[] = {
+		[PHASE_BOOT] = "mem_heap_boot",
+		[PHASE_MEASURE] = "mem_heap_meas",
+		[PHASE_CALL_HOME] = "mem_heap_ch",
+		[PHASE_OTA] = "mem_heap_ota"
+	};
+
+	const char *TASK_ATTR_NAMES[] = {
+		[TASK_MAIN] = "mem_stk_main",
+		[TASK_UPLOADER] = "mem_stk_upl",
+		[TASK_GSM_CONNECT] = "mem_stk_gsm",
+		[TASK_OTA_WRITER] = "mem_stk_ota",
+		[TASK_FO_RX] = "mem_stk_fo_rx",
+		[TASK_WIFI_SERIAL] = "mem_stk_ws",
+		[TASK_ACQUISITION] = "mem_stk_acq"
+	};
+
+	/******************************************************************************
+	* Sample heap at the end (or peak) of a phase, also main task stack.
+	* Heap only keeps a min since boot, so a drop of it since last sample is
+	* accounted to this phase, otherwise current free heap is
+	******************************************************************************/
+	void sample(Phase phase)
+	{
+		uint32_t heap_min = esp_get_minimum_free_heap_size();
+		uint32_t heap_free = esp_get_free_heap_size();
+
+		uint32_t phase_min = (_last_heap_min == 0 || heap_min < _last_heap_min) ? heap_min : heap_free;
+		_last_heap_min = heap_min;
+
+		if(_phase_heap_min[phase] == 0 || phase_min < _phase_heap_min[phase])
+			_phase_heap_min[phase] = phase_min;
+
+		sample_task(TASK_MAIN);
+	}
+
+	/******************************************************************************
+	* Sample stack high water mark. Called from the task itself
+	******************************************************************************/
+	void sample_task(Task task)
+	{
+		uint32_t hwm = uxTaskGetStackHighWaterMark(NULL);
+
+		if(_task_stack_hwm[task] == 0 || hwm < _task_stack_hwm[task])
+			_task_stack_hwm[task] = hwm;
+	}
+
+	/******************************************************************************
+	* Add sampled values to client attributes
+	******************************************************************************/
+	void add_attributes(JsonDocument &doc)
+	{
+		doc[TB_ATTR_MEM_HEAP_MIN] = esp_get_minimum_free_heap_size();
+		doc[TB_ATTR_MEM_SCRATCH_PEAK] = Scratch::get_peak();
+
+		if(Psram::available())
+			doc[TB_ATTR_MEM_PSRAM_FREE] = Psram::get_free();
+
+		for(int i = 0; i < PHASE_COUNT; i++)
+		{
+			if(_phase_heap_min[i] != 0)
+				doc[PHASE_ATTR_NAMES[i]] = _phase_heap_min[i];
+		}
+
+		for(int i = 0; i < TASK_COUNT; i++)
+		{
+			if(_task_stack_hwm[i] != 0)
+				doc[TASK_ATTR_NAMES[i]] = _task_stack_hwm[i];
+		}
+	}
+
+	/******************************************************************************
+	* Print sampled values
+	******************************************************************************/
+	void print()
+	{
+		debug_printf("Min free heap: %u\n", esp_get_minimum_free_heap_size());
+		debug_printf("Scratch arena peak: %u / %u\n", Scratch::get_peak(), Scratch::get_size());
+
+		for(int i = 0; i < PHASE_COUNT; i++)
+			debug_printf("%s: %u\n", PHASE_ATTR_NAMES[i], _phase_heap_min[i]);
+
+		for(int i = 0; i < TASK_COUNT; i++)
+			debug_printf("%s: %u\n", TASK_ATTR_NAMES[i], _task_stack_hwm[i]);
+	}
+}
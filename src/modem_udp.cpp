@@ -0,0 +1,187 @@
+#include "modem_udp.h"
+#include "common.h"
+
+/******************************************************************************
+* Constructor
+* @param modem Modem
+* @param mux Modem socket to use, must not be used by other clients
+******************************************************************************/
+ModemUdp::ModemUdp(TinyGsm *modem, uint8_t mux)
+	: _client(*modem, mux)
+{
+	_modem = modem;
+	_mux = mux;
+}
+
+/******************************************************************************
+* Destructor, closes socket
+******************************************************************************/
+ModemUdp::~ModemUdp()
+{
+	stop();
+}
+
+/******************************************************************************
+* Local port is assigned by the modem, nothing to do
+******************************************************************************/
+uint8_t ModemUdp::begin(uint16_t port)
+{
+	return 1;
+}
+
+/******************************************************************************
+* Close socket
+******************************************************************************/
+void ModemUdp::stop()
+{
+	if(!_open)
+		return;
+
+	_modem->sendAT(GF("+CIPCLOSE="), _mux);
+	_modem->waitResponse(MODEM_UDP_AT_TIMEOUT);
+
+	_open = false;
+	_host[0] = '\0';
+	_port = 0;
+}
+
+/******************************************************************************
+* Open socket in UDP mode to remote host
+******************************************************************************/
+RetResult ModemUdp::open(const char *host, uint16_t port)
+{
+	if(_open && port == _port && strcmp(host, _host) == 0)
+		return RET_OK;
+
+	stop();
+
+	_modem->sendAT(GF("+CIPSTART="), _mux, GF(",\"UDP\",\""), host, GF("\","), port);
+
+	int ret = _modem->waitResponse(MODEM_UDP_OPEN_TIMEOUT, GF("CONNECT OK"), GF("CONNECT FAIL"), GF("ALREADY CONNECT"));
+	if(ret != 1 && ret != 3)
+	{
+		debug_println(F("Could not open UDP socket."));
+		return RET_ERROR;
+	}
+
+	strncpy(_host, host, sizeof(_host) - 1);
+	_port = port;
+	_open = true;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Start packet to remote host by IP
+******************************************************************************/
+int ModemUdp::beginPacket(IPAddress ip, uint16_t port)
+{
+	char host[16] = "";
+	snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+	return beginPacket(host, port);
+}
+
+/******************************************************************************
+* Start packet to remote host
+******************************************************************************/
+int ModemUdp::beginPacket(const char *host, uint16_t port)
+{
+	if(open(host, port) != RET_OK)
+		return 0;
+
+	_tx_len = 0;
+
+	return 1;
+}
+
+/******************************************************************************
+* Send packet
+******************************************************************************/
+int ModemUdp::endPacket()
+{
+	if(!_open || _tx_len == 0)
+		return 0;
+
+	int written = _client.write(_tx_buff, _tx_len);
+	_tx_len = 0;
+
+	return written > 0 ? 1 : 0;
+}
+
+/******************************************************************************
+* Write byte to packet
+******************************************************************************/
+size_t ModemUdp::write(uint8_t byte)
+{
+	return write(&byte, 1);
+}
+
+/******************************************************************************
+* Write bytes to packet
+******************************************************************************/
+size_t ModemUdp::write(const uint8_t *buffer, size_t size)
+{
+	if(_tx_len + size > sizeof(_tx_buff))
+		size = sizeof(_tx_buff) - _tx_len;
+
+	memcpy(_tx_buff + _tx_len, buffer, size);
+	_tx_len += size;
+
+	return size;
+}
+
+/******************************************************************************
+* Check for received data
+* @return Size of data received
+******************************************************************************/
+int ModemUdp::parsePacket()
+{
+	if(!_open)
+		return 0;
+
+	return _client.available();
+}
+
+int ModemUdp::available()
+{
+	return _client.available();
+}
+
+int ModemUdp::read()
+{
+	return _client.read();
+}
+
+int ModemUdp::read(unsigned char* buffer, size_t len)
+{
+	return _client.read(buffer, len);
+}
+
+int ModemUdp::read(char* buffer, size_t len)
+{
+	return _client.read((uint8_t*)buffer, len);
+}
+
+int ModemUdp::peek()
+{
+	return _client.peek();
+}
+
+void ModemUdp::flush()
+{
+	_client.flush();
+}
+
+/******************************************************************************
+* Remote address is not known by IP, socket is connected by host name
+******************************************************************************/
+IPAddress ModemUdp::remoteIP()
+{
+	return IPAddress();
+}
+
+uint16_t ModemUdp::remotePort()
+{
+	return _port;
+}
@@ -0,0 +1,150 @@
+#include "mqtt.h"
+#include "utils.h"
+#include "common.h"
+
+/******************************************************************************
+* Constructor
+* @param client Network client to connect through
+* @param broker_url Broker host
+* @param port Broker port
+* @param username Username (TB device token)
+* @param pass Password, NULL if none
+******************************************************************************/
+MQTT::MQTT(Client *client, const char *broker_url, uint16_t port, const char *username, const char *pass)
+	: _mqtt_client(*client)
+{
+	_broker_url = broker_url;
+	_port = port;
+	_username = username;
+	_password = pass;
+
+	_mqtt_client.setServer(_broker_url, _port);
+	_mqtt_client.setBufferSize(MQTT_BUFFER_SIZE);
+	_mqtt_client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_SEC);
+	_mqtt_client.setCallback([this](char *topic, uint8_t *payload, unsigned int len)
+	{
+		on_message(topic, payload, len);
+	});
+}
+
+/******************************************************************************
+* Connect to broker. Client id is the device mac address.
+******************************************************************************/
+RetResult MQTT::connect()
+{
+	if(_mqtt_client.connected())
+		return RET_OK;
+
+	char client_id[18] = "";
+	Utils::get_mac(client_id, sizeof(client_id));
+
+	debug_print(F("Connecting to MQTT broker: "));
+	debug_println(_broker_url);
+
+	if(!_mqtt_client.connect(client_id, _username, _password))
+	{
+		debug_print(F("MQTT connection failed. State: "));
+		debug_println(_mqtt_client.state(), DEC);
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Disconnect from broker
+******************************************************************************/
+void MQTT::disconnect()
+{
+	_mqtt_client.disconnect();
+}
+
+/******************************************************************************
+* Check if connected to broker
+******************************************************************************/
+bool MQTT::is_connected()
+{
+	return _mqtt_client.connected();
+}
+
+/******************************************************************************
+* Publish message. Reconnects if connection was lost.
+******************************************************************************/
+RetResult MQTT::publish(const char *topic, const uint8_t *msg, int msg_len)
+{
+	if(connect() != RET_OK)
+		return RET_ERROR;
+
+	if(!_mqtt_client.publish(topic, msg, msg_len))
+	{
+		debug_println(F("MQTT publish failed."));
+		return RET_ERROR;
+	}
+
+	// Process incoming packets (keep alive)
+	_mqtt_client.loop();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Publish a request and wait for the response on another topic
+* @param req_topic Topic to publish request to
+* @param msg Request message
+* @param resp_topic Topic (filter) response is published to
+* @param resp_buff Buffer for response, null terminated
+* @param resp_buff_size Buffer size
+******************************************************************************/
+RetResult MQTT::request(const char *req_topic, const char *msg, const char *resp_topic,
+	char *resp_buff, int resp_buff_size)
+{
+	if(connect() != RET_OK)
+		return RET_ERROR;
+
+	if(!_mqtt_client.subscribe(resp_topic))
+	{
+		debug_println(F("MQTT subscribe failed."));
+		return RET_ERROR;
+	}
+
+	_resp_buff = resp_buff;
+	_resp_buff_size = resp_buff_size;
+	_resp_received = false;
+
+	RetResult ret = RET_ERROR;
+
+	if(_mqtt_client.publish(req_topic, msg))
+	{
+		uint32_t start = millis();
+
+		while(!_resp_received && millis() - start < MQTT_RESPONSE_TIMEOUT && _mqtt_client.loop())
+			delay(10);
+
+		ret = _resp_received ? RET_OK : RET_ERROR;
+	}
+
+	if(ret != RET_OK)
+		debug_println(F("No MQTT response received."));
+
+	_mqtt_client.unsubscribe(resp_topic);
+	_resp_buff = NULL;
+	_resp_buff_size = 0;
+
+	return ret;
+}
+
+/******************************************************************************
+* Incoming message handler. Only responses to request() are expected.
+******************************************************************************/
+void MQTT::on_message(char *topic, uint8_t *payload, unsigned int len)
+{
+	if(_resp_buff == NULL || _resp_received)
+		return;
+
+	int copy_len = len < (unsigned int)_resp_buff_size ? len : _resp_buff_size - 1;
+
+	memcpy(_resp_buff, payload, copy_len);
+	_resp_buff[copy_len] = '\0';
+
+	_resp_received = true;
+}
@@ -7,14 +7,72 @@
 #include "ArduinoHttpClient.h"
 #include "Update.h"
 #include "globals.h"
+#include "memory_monitor.h"
 #include "remote_control.h"
 #include "http_request.h"
 #include "device_config.h"
 #include "flash.h"
 #include "common.h"
+#include "rtc.h"
+#include "delta_patch.h"
+#include "call_home_budget.h"
+#include "psram.h"
+#include "power_lock.h"
+#include "esp_ota_ops.h"
+#include "lora_relay.h"
+#include "lora_ota.h"
+#include "sleep_scheduler.h"
+#include "power_governor.h"
+#include "esp_spi_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 namespace OTA
 {
+	//
+	// Private vars
+	//
+	/** Downloaded chunk handed to the writer task. len = 0 ends the task */
+	struct Chunk
+	{
+		uint8_t *data;
+		int len;
+	};
+
+	/** Chunks received, waiting to be written */
+	QueueHandle_t _write_queue = NULL;
+
+	/** Buffers written, free to receive into */
+	QueueHandle_t _free_queue = NULL;
+
+	/** Given by writer task when it exits */
+	SemaphoreHandle_t _writer_done_sem = NULL;
+
+	/** Written data state, owned by writer task while downloading. Aligned for md5_ctx */
+	DeviceConfig::OtaProgress _progress __attribute__((aligned(4)));
+
+	/** Partition image is written to */
+	const esp_partition_t *_partition = NULL;
+
+	/** Set by writer task on flash errors */
+	bool _write_failed = false;
+
+	/** Downloading a delta patch, writer task applies it against running image */
+	bool _delta = false;
+
+	//
+	// Private functions
+	//
+	RetResult download_url(const char *url, const char *fw_md5, bool delta);
+	RetResult download(const char *host, int port, const char *path, const char *fw_md5, bool delta);
+	RetResult write_chunk(const uint8_t *data, int len);
+	RetResult finalize();
+	bool resumable(const char *fw_md5);
+	void writer_task(void *params);
+	RetResult rollback(int reason);
+	uint32_t get_validation_deadline_secs();
 	/******************************************************************************
 	 * Handle request for OTA
 	 * @param json JSON data received from remote control request
@@ -92,16 +150,90 @@ namespace OTA
 			return RET_ERROR;
 		}
 
+		// Leaf gets the image from its gateway, over cellular only once that timed out
+		if(FLAGS.LORA_OTA && LoraRelay::is_leaf() && LoraOta::start((int)rc_json[RC_TB_KEY_FW_VERSION], fw_md5) == RET_OK)
+			return RET_OK;
+
+		// Asked again next call home, until energy is to spare or the deadline
+		if(!SleepScheduler::may_run(SleepScheduler::WORK_OTA))
+		{
+			debug_println(F("OTA deferred until energy surplus."));
+			return RET_ERROR;
+		}
+
+		// Download is resumed next call home
+		if(!CallHomeBudget::enter(CallHomeBudget::PHASE_OTA))
+		{
+			debug_println(F("No call home budget left for OTA."));
+			return RET_ERROR;
+		}
+
 		//
 		// Do request
 		//
-		debug_println(F("Getting OTA file."));
+		TestUtils::print_stack_size();
+
+		// Patch against running version if available, full image if it fails
+		RetResult ret = RET_ERROR;
+
+		// Patch would overwrite what is downloaded of the full image, resume that instead
+		if(rc_json.containsKey(RC_TB_KEY_FW_DELTA_URL) && strlen(rc_json[RC_TB_KEY_FW_DELTA_URL]) > 0 &&
+			(int)rc_json[RC_TB_KEY_FW_DELTA_BASE] == FW_VERSION && !resumable(fw_md5))
+		{
+			debug_println(F("Getting OTA delta patch."));
 
+			char delta_url[URL_BUFFER_SIZE] = "";
+			strncpy(delta_url, rc_json[RC_TB_KEY_FW_DELTA_URL], sizeof(delta_url) - 1);
+
+			ret = download_url(delta_url, fw_md5, true);
+
+			if(ret == RET_OK)
+				ret = finalize();
+
+			Log::log(Log::OTA_DELTA, FW_VERSION, ret == RET_OK);
+		}
+
+		// Full image is resumable, but not worth starting out of budget
+		if(ret != RET_OK && CallHomeBudget::expired(CallHomeBudget::PHASE_OTA))
+			return RET_ERROR;
+
+		if(ret != RET_OK)
+		{
+			debug_println(F("Getting OTA file."));
+
+			if(download_url(fw_url, fw_md5, false) != RET_OK)
+			{
+				return RET_ERROR;
+			}
+
+			if(finalize() != RET_OK)
+			{
+				return RET_ERROR;
+			}
+		}
+
+		debug_println(F("Update applied. Device will be restarted when ready."));
+
+		Log::log(Log::OTA_FINISHED);
+
+		// Set device to reboot when all handling is done
+		RemoteControl::set_reboot_pending(true);
+
+		DeviceConfig::set_ota_flashed(true);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Split URL and download image or patch from it
+	 *****************************************************************************/
+	RetResult download_url(const char *url, const char *fw_md5, bool delta)
+	{
 		// Break URL into parts
 		int port = 0;
 		char fw_url_host[URL_HOST_BUFFER_SIZE] = "";
 		char fw_url_path[URL_BUFFER_SIZE] = "";
-		if(Utils::url_explode(fw_url, &port, fw_url_host, sizeof(fw_url_host), fw_url_path, sizeof(fw_url_path)) == RET_ERROR)
+		if(Utils::url_explode((char*)url, &port, fw_url_host, sizeof(fw_url_host), fw_url_path, sizeof(fw_url_path)) == RET_ERROR)
 		{
 			debug_println(F("Invalid FW URL."));
 
@@ -122,12 +254,44 @@ namespace OTA
 		debug_print(F("Path: "));
 		debug_println(fw_url_path);
 
-		TestUtils::print_stack_size();
-		
-		TinyGsmClient client(*GSM::get_modem());		
-		HttpClient http_client(client, (char*)fw_url_host, port);
-		
-		int req_ret = http_client.get(fw_url_path);
+		return download(fw_url_host, port, fw_url_path, fw_md5, delta);
+	}
+
+	/******************************************************************************
+	 * Download image to the update partition. Continues a previously interrupted
+	 * download of the same image with a range request. Chunks are received into
+	 * one buffer while the writer task writes the other to flash.
+	 * @param delta Download is a patch against the running image, applied while
+	 * 				downloading. Not resumable.
+	 *****************************************************************************/
+	RetResult download(const char *host, int port, const char *path, const char *fw_md5, bool delta)
+	{
+		_partition = esp_ota_get_next_update_partition(NULL);
+		if(_partition == NULL)
+		{
+			debug_println(F("No OTA partition. Aborting."));
+
+			Log::log(Log::OTA_UPDATE_BEGIN_FAILED, ESP_ERR_NOT_FOUND);
+			return RET_ERROR;
+		}
+
+		_delta = delta;
+
+		bool resume = !delta && resumable(fw_md5);
+
+		TinyGsmClient client(*GSM::get_modem());
+		HttpClient http_client(client, (char*)host, port);
+
+		http_client.beginRequest();
+		int req_ret = http_client.get(path);
+		if(req_ret == 0 && resume)
+		{
+			char range[32] = "";
+			snprintf(range, sizeof(range), "bytes=%u-", _progress.offset);
+			http_client.sendHeader("Range", range);
+		}
+		http_client.endRequest();
+
 		if(req_ret != 0)
 		{
 			debug_println(F("Could not GET fw."));
@@ -140,213 +304,452 @@ namespace OTA
 		int content_length = http_client.contentLength();
 		debug_print(F("Response code: "));
 		debug_println(response_code, DEC);
-		debug_print(F("Update size: "));
-		debug_println(http_client.contentLength(), DEC);
-		
-		if(response_code != 200)
+		debug_print(F("Content length: "));
+		debug_println(content_length, DEC);
+
+		if(content_length < 1)
+		{
+			debug_println(F("Response empty. Aborting."));
+
+			Log::log(Log::OTA_FILE_GET_REQ_RESP_EMPTY, response_code);
+			return RET_ERROR;
+		}
+
+		if(resume && response_code == 206 && content_length == (int)(_progress.total_size - _progress.offset))
+		{
+			debug_print(F("Resuming download from: "));
+			debug_println(_progress.offset, DEC);
+
+			Log::log(Log::OTA_RESUMING, _progress.offset, _progress.total_size);
+		}
+		else if(response_code == 200)
+		{
+			// New download, or server ignored range
+			memset(&_progress, 0, sizeof(_progress));
+			strncpy(_progress.fw_md5, fw_md5, sizeof(_progress.fw_md5) - 1);
+			_progress.total_size = content_length;
+			MD5Init(&_progress.md5_ctx);
+
+			// Image size known from patch header, bounded by partition until then.
+			// Patch overwrites the partition, saved progress no longer matches it
+			if(delta)
+			{
+				_progress.total_size = _partition->size;
+
+				DeviceConfig::clear_ota_progress();
+
+				if(DeltaPatch::begin(esp_ota_get_running_partition(), write_chunk) != RET_OK)
+					return RET_ERROR;
+			}
+		}
+		else
 		{
 			debug_println(F("Request did not return OK."));
 
+			// Range not matching saved progress, start over next time
+			if(response_code == 206)
+				DeviceConfig::clear_ota_progress();
+
 			Log::log(Log::OTA_FILE_GET_REQ_BAD_RESPONSE, response_code);
 			return RET_ERROR;
 		}
 
-		if(http_client.contentLength() < 1)
+		if(_progress.total_size > _partition->size)
 		{
-			debug_println(F("Response empty. Aborting."));
+			debug_println(F("Image larger than partition. Aborting."));
 
-			Log::log(Log::OTA_FILE_GET_REQ_RESP_EMPTY, response_code);
+			Log::log(Log::OTA_UPDATE_BEGIN_FAILED, ESP_ERR_INVALID_SIZE);
 			return RET_ERROR;
 		}
 
+		debug_println(F("Downloading and writing flash...\n"));
+
+		Log::log(Log::OTA_DOWNLOADING_AND_WRITING_FW, _progress.total_size);
+
 		//
-		// Read response and write to update memory
+		// Receive data from GSM module and hand it to writer task
 		//
-		// Abort need to be run to reset internal Update counters. Otherwise if update fails,
-		// it won't run again until reboot
-		Update.abort();
-		if(Update.begin(content_length) == false)
+		if(_write_queue == NULL)
 		{
-			debug_println(F("Could not begin update. Aborting."));
+			_write_queue = xQueueCreate(2, sizeof(Chunk));
+			_free_queue = xQueueCreate(2, sizeof(uint8_t*));
+			_writer_done_sem = xSemaphoreCreateBinary();
+		}
+
+		xQueueReset(_write_queue);
+		xQueueReset(_free_queue);
+
+		// Two download buffers from scratch arena, held until the writer task is done with them.
+		// Arena in PSRAM has room for larger ones
+		int chunk_len = Psram::available() ? OTA_PSRAM_CHUNK_LEN : OTA_CHUNK_LEN;
 
-			Log::log(Log::OTA_UPDATE_BEGIN_FAILED, Update.getError());
+		ScratchBuffer scratch(2 * chunk_len);
+		if(scratch.get() == NULL)
 			return RET_ERROR;
-		}
 
-		// Set received MD5 for validation
-		Update.setMD5(fw_md5);
+		uint8_t *buffs[2] = {(uint8_t*)scratch.get(), (uint8_t*)scratch.get() + chunk_len};
+		xQueueSend(_free_queue, &buffs[0], 0);
+		xQueueSend(_free_queue, &buffs[1], 0);
 
-		debug_println(F("Downloading and writing flash...\n"));
+		// MD5 of every chunk and delta patching keep the CPU busy for the whole download
+		PowerLock::Scoped cpu_lock(PowerLock::LOCK_CPU_MAX);
 
-		Log::log(Log::OTA_DOWNLOADING_AND_WRITING_FW, content_length);
+		_write_failed = false;
+		xTaskCreatePinnedToCore(writer_task, "ota_writer", OTA_WRITER_TASK_STACK_SIZE, NULL,
+			OTA_WRITER_TASK_PRIORITY, NULL, OTA_WRITER_TASK_CORE);
 
-		//
-		// Receive data from GSM module and write partition
-		// 
 		int bytes_read = 0, bytes_remaining = content_length;
 
-		http_client.setTimeout(10000);
+		http_client.setTimeout(OTA_STREAM_TIMEOUT_MS);
 		Utils::serial_style(STYLE_BLUE);
 		do
 		{
-			int bytes_to_read = bytes_remaining > GLOBAL_HTTP_RESPONSE_BUFFER_LEN ? GLOBAL_HTTP_RESPONSE_BUFFER_LEN : bytes_remaining;
+			Chunk chunk;
+			xQueueReceive(_free_queue, &chunk.data, portMAX_DELAY);
 
-			// Read into global response buffer
+			int bytes_to_read = bytes_remaining > chunk_len ? chunk_len : bytes_remaining;
 
-			bytes_read = http_client.readBytes(g_resp_buffer, bytes_to_read);
-
-			Update.write((uint8_t*)g_resp_buffer, bytes_read);
+			bytes_read = http_client.readBytes(chunk.data, bytes_to_read);
+			chunk.len = bytes_read;
 
+			if(bytes_read > 0)
+				xQueueSend(_write_queue, &chunk, portMAX_DELAY);
+			else
+				xQueueSend(_free_queue, &chunk.data, 0);
 
 			bytes_remaining -= bytes_read;
 
 			// Move cursor to start of line and print progress
-
 			debug_print("\e[0A");
-			debug_printf("Progress: %5d%% - Remaining: %5dKB\n", (content_length - bytes_remaining) / (content_length / 100), bytes_remaining / 1024);			
-		}while(bytes_remaining > 0 && bytes_read != 0);
+			debug_printf("Progress: %5d%% - Remaining: %5dKB\n", (content_length - bytes_remaining) / (content_length / 100 + 1), bytes_remaining / 1024);
+		}while(bytes_remaining > 0 && bytes_read != 0 && !_write_failed &&
+			!CallHomeBudget::expired(CallHomeBudget::PHASE_OTA));
+
+		// End writer and wait until all chunks are written
+		Chunk end_chunk = {NULL, 0};
+		xQueueSend(_write_queue, &end_chunk, portMAX_DELAY);
+		xSemaphoreTake(_writer_done_sem, portMAX_DELAY);
+
+		http_client.stop();
+
+		// Largest buffers of the whole run are in use now
+		MemoryMonitor::sample(MemoryMonitor::PHASE_OTA);
 
 		debug_println(F("Done writing new fw."));
 
 		Utils::serial_style(STYLE_RESET);
 
-		Log::log(Log::OTA_WRITING_FW_COMPLETE, content_length, content_length - bytes_remaining);
+		if(delta)
+		{
+			if(!DeltaPatch::is_finished())
+			{
+				debug_println(F("Delta patch incomplete or invalid."));
+				_write_failed = true;
+			}
+
+			_progress.total_size = DeltaPatch::get_to_size();
+		}
 
-		// Do checks
-		if(!Update.isFinished())
+		Log::log(Log::OTA_WRITING_FW_COMPLETE, _progress.total_size, _progress.offset);
+
+		if(_write_failed || _progress.offset != _progress.total_size)
 		{
-			debug_println(F("Update not finished. Error: "));
-			Update.printError(Serial);
+			// Progress up to last saved point is kept, next call home continues from there
+			debug_println(F("Update not finished."));
 
-			Log::log(Log::OTA_UPDATE_NOT_FINISHED, Update.getError());
+			Log::log(Log::OTA_UPDATE_NOT_FINISHED, _progress.offset);
 			return RET_ERROR;
 		}
-		else
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Write data at current offset, erasing sectors as they are reached and
+	 * saving progress at every OTA_PROGRESS_SAVE_INTERVAL
+	 *****************************************************************************/
+	RetResult write_chunk(const uint8_t *data, int len)
+	{
+		while(len > 0)
 		{
-			if(!Update.end())
-			{
-				debug_println(F("Could not end update. Error:"));		
-				Update.printError(Serial);
+			uint32_t sector_left = SPI_FLASH_SEC_SIZE - (_progress.offset % SPI_FLASH_SEC_SIZE);
+			int n = len < (int)sector_left ? len : sector_left;
 
-				Log::log(Log::OTA_COULD_NOT_FINALIZE_UPDATE, Update.getError());
+			if(_progress.offset % SPI_FLASH_SEC_SIZE == 0 &&
+				esp_partition_erase_range(_partition, _progress.offset, SPI_FLASH_SEC_SIZE) != ESP_OK)
+			{
 				return RET_ERROR;
 			}
-			else
+
+			if(esp_partition_write(_partition, _progress.offset, data, n) != ESP_OK)
 			{
-				debug_println(F("Update applied. Device will be restarted when ready."));
+				return RET_ERROR;
+			}
 
-				Log::log(Log::OTA_FINISHED);
-				
-				// Set device to reboot when all handling is done
-				RemoteControl::set_reboot_pending(true);
+			MD5Update(&_progress.md5_ctx, data, n);
+			_progress.offset += n;
+			data += n;
+			len -= n;
 
-				DeviceConfig::set_ota_flashed(true);
-				DeviceConfig::commit();
+			// Saved offsets are at sector boundaries, resume erases the sector it continues from
+			if(!_delta && (_progress.offset % OTA_PROGRESS_SAVE_INTERVAL == 0 || _progress.offset == _progress.total_size))
+			{
+				DeviceConfig::set_ota_progress(&_progress);
 			}
-		}		
+		}
 
 		return RET_OK;
 	}
 
 	/******************************************************************************
-	 * Run self-test routines to decide whether OTA was successful. 
-	 * To pass a self test, a GET request is sent to the TB server.
-	 * If the request fails it most likely means connectivity is lost after the FW
-	 * update so the test fails.
+	 * Check if a download of the full image was interrupted and can be resumed.
+	 * Saved progress is loaded
+	 * @param fw_md5 MD5 of the image, only the same image is resumed
 	 *****************************************************************************/
-	RetResult self_test()
+	bool resumable(const char *fw_md5)
 	{
-		if(GSM::on() != RET_OK)
-			return RET_ERROR;
+		return DeviceConfig::get_ota_progress(&_progress) == RET_OK &&
+			strcmp(_progress.fw_md5, fw_md5) == 0 &&
+			_progress.offset > 0 && _progress.offset < _progress.total_size;
+	}
 
-		if(GSM::connect_persist() != RET_OK)
-			return RET_ERROR;
+	/******************************************************************************
+	 * Writes received chunks to flash and returns their buffers, until an
+	 * empty chunk is received
+	 *****************************************************************************/
+	void writer_task(void *params)
+	{
+		Chunk chunk;
 
-		// Make a GET request to the attributes API for this device
-		HttpRequest http_req(GSM::get_modem(), TB_SERVER);
-		http_req.set_port(TB_PORT);
+		while(xQueueReceive(_write_queue, &chunk, portMAX_DELAY) == pdTRUE && chunk.len > 0)
+		{
+			RetResult ret = _write_failed ? RET_ERROR :
+				_delta ? DeltaPatch::process(chunk.data, chunk.len) : write_chunk(chunk.data, chunk.len);
+
+			if(!_write_failed && ret != RET_OK)
+			{
+				debug_println_e(F("OTA flash write failed."));
+				_write_failed = true;
+			}
+
+			xQueueSend(_free_queue, &chunk.data, portMAX_DELAY);
+		}
+
+		MemoryMonitor::sample_task(MemoryMonitor::TASK_OTA_WRITER);
+
+		xSemaphoreGive(_writer_done_sem);
+
+		vTaskDelete(NULL);
+	}
+
+	/******************************************************************************
+	 * Validate MD5 of downloaded image and set it as boot partition
+	 *****************************************************************************/
+	RetResult finalize()
+	{
+		// Download is complete, a failed image must be downloaded from start
+		if(!_delta)
+			DeviceConfig::clear_ota_progress();
 
-		char url[URL_BUFFER_SIZE_LARGE] = "";
-		Utils::tb_build_attributes_url_path(url, sizeof(url));
+		uint8_t digest[16];
+		MD5Final(digest, &_progress.md5_ctx);
 
-		if(http_req.get(url, g_resp_buffer, GLOBAL_HTTP_RESPONSE_BUFFER_LEN) != RET_OK)
+		char md5[33] = "";
+		for(int i = 0; i < 16; i++)
 		{
-			debug_println(F("Request to TB attribute API failed."));
-			return RET_ERROR;
+			sprintf(md5 + i * 2, "%02x", digest[i]);
 		}
-		else if(http_req.get_response_code() != 200)
+
+		if(strcasecmp(md5, _progress.fw_md5) != 0)
 		{
-			debug_print(F("Request to TB attribute API returned code: : "));
-			debug_println(http_req.get_response_code(), DEC);
+			debug_print(F("MD5 check failed. Image MD5: "));
+			debug_println(md5);
 
+			Log::log(Log::OTA_COULD_NOT_FINALIZE_UPDATE, ESP_ERR_INVALID_CRC);
 			return RET_ERROR;
 		}
 
-		debug_println(F("Running boot self test"));
-		if(Utils::boot_self_test() != RET_OK)
+		// Image is verified before being set
+		esp_err_t err = esp_ota_set_boot_partition(_partition);
+		if(err != ESP_OK)
+		{
+			debug_print(F("Could not set boot partition. Error: "));
+			debug_println(err, DEC);
+
+			Log::log(Log::OTA_COULD_NOT_FINALIZE_UPDATE, err);
 			return RET_ERROR;
+		}
 
-		debug_println(F("OTA self test passed."));
 		return RET_OK;
 	}
 
 	/******************************************************************************
-	 * Ran on first boot after new OTA is flashed
+	 * Ran on first boot after new OTA is flashed. Image is only marked valid
+	 * after a full call home (see mark_valid()), it is rolled back if that does
+	 * not happen before the deadline or after OTA_VALIDATION_MAX_RESETS
+	 * unexpected resets (see check_validation()). Time is not synced yet, the
+	 * deadline starts on the first check with valid time
 	 *****************************************************************************/
 	RetResult handle_first_boot()
 	{
 		// Mark as handled
 		DeviceConfig::set_ota_flashed(false);
-		DeviceConfig::commit();
 
 		Utils::print_block(F("New FW - First boot"));
 
-		debug_println(F("Running self test"));
+		debug_println(F("Running boot self test"));
 
-		// Run self test
-		if(self_test() == RET_OK)
+		if(Utils::boot_self_test() != RET_OK)
 		{
-			Utils::serial_style(STYLE_GREEN);
-			debug_println(F("Self test passed. OTA was successful."));
-			Utils::serial_style(STYLE_RESET);
+			return rollback(0);
+		}
 
-			// In case format was requested as well, format again to make sure it is formatted with
-			// the latest version
-			if(DeviceConfig::get_ota_flashed())
-			{
-				Flash::format();
-			}
+		// Log entries of older FW are in a different layout
+		Log::convert_legacy_store();
+
+		DeviceConfig::OtaValidation validation;
+		validation.first_boot_tstamp = 0;
+		validation.unexpected_resets = 0;
+		DeviceConfig::set_ota_validation(&validation);
+
+		debug_println(F("New FW is valid after next full call home."));
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Check if new image is still waiting for a full call home
+	 *****************************************************************************/
+	bool is_validation_pending()
+	{
+		DeviceConfig::OtaValidation validation;
+
+		return DeviceConfig::get_ota_validation(&validation) == RET_OK;
+	}
+
+	/******************************************************************************
+	 * Roll back a pending image that missed the deadline or keeps resetting.
+	 * Called after each call home attempt, once it had its chance to mark_valid()
+	 * @return RET_OK if no rollback needed
+	 *****************************************************************************/
+	RetResult check_validation()
+	{
+		DeviceConfig::OtaValidation validation;
+
+		if(DeviceConfig::get_ota_validation(&validation) != RET_OK)
+			return RET_OK;
 
-			Log::log(Log::OTA_SELF_TEST_PASSED);
+		if(validation.unexpected_resets >= OTA_VALIDATION_MAX_RESETS)
+		{
+			debug_println_e(F("New FW keeps resetting."));
+			return rollback(2);
 		}
-		else
+
+		// Deadline is meaningless until time is known
+		uint32_t now = RTC::get_timestamp();
+		if(!RTC::tstamp_valid(now))
+			return RET_OK;
+
+		if(!RTC::tstamp_valid(validation.first_boot_tstamp) || now < validation.first_boot_tstamp)
 		{
-			Utils::serial_style(STYLE_RED);
-			debug_println(F("Self test failed."));
-			Utils::serial_style(STYLE_RESET);
+			validation.first_boot_tstamp = now;
+			DeviceConfig::set_ota_validation(&validation);
+			return RET_OK;
+		}
 
-			Log::log(Log::OTA_SELF_TEST_FAILED);
+		if(now - validation.first_boot_tstamp > get_validation_deadline_secs())
+		{
+			debug_println_e(F("New FW did not call home before deadline."));
+			return rollback(1);
+		}
 
-			if(Update.canRollBack())
-			{
-				debug_println(F("FW will be rolled back to older version and device will restart."));
-				Log::log(Log::OTA_ROLLING_BACK);
-				delay(2000);
+		return RET_OK;
+	}
 
-				Update.rollBack();
+	/******************************************************************************
+	 * Time a pending image has to call home, several call home intervals on slow
+	 * schedules
+	 *****************************************************************************/
+	uint32_t get_validation_deadline_secs()
+	{
+		int interval = DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::REASON_CALL_HOME);
+		uint32_t interval_secs = interval * (FLAGS.SLEEP_MINS_AS_SECS ? 1 : 60) * PowerGovernor::get_scale();
 
-				Utils::restart_device();
-			}
-			else
-			{
-				debug_println(F("FW cannot be rolled back to the old version."));
+		return max(OTA_VALIDATION_DEADLINE_SECS, OTA_VALIDATION_DEADLINE_CALL_HOMES * interval_secs);
+	}
 
-				Log::log(Log::OTA_ROLLBACK_NOT_POSSIBLE);
+	/******************************************************************************
+	 * Count an unexpected reset (panic, watchdog, brown out) of a pending image
+	 *****************************************************************************/
+	void on_unexpected_reset()
+	{
+		DeviceConfig::OtaValidation validation;
 
-				return RET_ERROR;
-			}
-		}
+		if(DeviceConfig::get_ota_validation(&validation) != RET_OK)
+			return;
+
+		validation.unexpected_resets++;
+		DeviceConfig::set_ota_validation(&validation);
+
+		check_validation();
+	}
+
+	/******************************************************************************
+	 * Full call home succeeded (attach, remote control and a telemetry request),
+	 * keep new image
+	 *****************************************************************************/
+	RetResult mark_valid()
+	{
+		if(!is_validation_pending())
+			return RET_OK;
+
+		// Only has effect if bootloader rollback is enabled
+		esp_ota_mark_app_valid_cancel_rollback();
+
+		DeviceConfig::clear_ota_validation();
+
+		Utils::serial_style(STYLE_GREEN);
+		debug_println(F("Full call home passed. OTA was successful."));
+		Utils::serial_style(STYLE_RESET);
+
+		Log::log(Log::OTA_SELF_TEST_PASSED);
 
 		return RET_OK;
 	}
+
+	/******************************************************************************
+	 * Roll back to previous image and restart
+	 * @param reason Logged as meta of OTA_SELF_TEST_FAILED
+	 *****************************************************************************/
+	RetResult rollback(int reason)
+	{
+		Utils::serial_style(STYLE_RED);
+		debug_println(F("Self test failed."));
+		Utils::serial_style(STYLE_RESET);
+
+		Log::log(Log::OTA_SELF_TEST_FAILED, reason);
+
+		DeviceConfig::clear_ota_validation();
+
+		if(Update.canRollBack())
+		{
+			debug_println(F("FW will be rolled back to older version and device will restart."));
+			Log::log(Log::OTA_ROLLING_BACK, reason);
+			Log::commit();
+			delay(2000);
+
+			// Bootloader rollback if enabled, returns if not
+			esp_ota_mark_app_invalid_rollback_and_reboot();
+
+			Update.rollBack();
+
+			Utils::restart_device();
+		}
+
+		debug_println(F("FW cannot be rolled back to the old version."));
+
+		Log::log(Log::OTA_ROLLBACK_NOT_POSSIBLE);
+
+		return RET_ERROR;
+	}
 }
\ No newline at end of file
@@ -1,20 +1,479 @@
 #include "Arduino.h"
 #include "power_control.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/rtc_io.h"
+#include "energy_profiler.h"
+#include "deep_sleep.h"
+#include "rtc.h"
+#include "utils.h"
+#include "common.h"
 
 /******************************************************************************
-* Controls various power sources
+* Controls power rails, reference counted by the devices on them
 ******************************************************************************/
 namespace PowerControl
 {
-    RetResult switch_12v(bool on)
+    //
+    // Private types
+    //
+    struct DeviceInfo
     {
+        /** Name to print */
+        const char *name;
+
+        Rail rail;
+
+        /** Time from rail on until the device responds */
+        uint16_t settle_ms;
+
+        /** EnergyProfiler::State accounted while device is held, -1 for none */
+        int8_t energy_state;
+    };
+
+    struct RailState
+    {
+        /** Holders, rail is on while > 0 */
+        int refs;
+
+        /** Millis rail was switched on */
+        uint32_t on_ms;
+    };
+
+    //
+    // Private functions
+    //
+    void switch_rail(Rail rail, bool on);
+    void rail_powered_up(Rail rail);
+    bool lock();
+    void unlock();
+
+    //
+    // Private vars
+    //
+    const DeviceInfo DEVICES[] = {
+        [DEVICE_AQUATROLL] = {"Aquatroll", RAIL_SENSORS, AQUATROLL_SETTLE_MS, -1},
+        [DEVICE_WATER_LEVEL] = {"water level", RAIL_SENSORS, WATER_LEVEL_SETTLE_MS, -1},
+        [DEVICE_ATMOS41] = {"Atmos41", RAIL_SENSORS, ATMOS41_SETTLE_MS, EnergyProfiler::STATE_SDI12_POWER},
+        [DEVICE_TEROS12] = {"Teros12", RAIL_SENSORS, TEROS12_SETTLE_MS, -1},
+        [DEVICE_SDI12_BUS] = {"SDI12 bus", RAIL_SENSORS, SDI12_BUS_SETTLE_MS, -1}
+    };
+
+    static_assert(sizeof(DEVICES) / sizeof(DEVICES[0]) == DEVICE_COUNT, "Describe every device");
+
+    /** Pin switching each rail */
+    const gpio_num_t RAIL_PINS[] = {
+        [RAIL_SENSORS] = (gpio_num_t)PIN_WATER_SENSORS_PWR
+    };
+
+    static_assert(sizeof(RAIL_PINS) / sizeof(RAIL_PINS[0]) == RAIL_COUNT, "Pin of every rail");
+
+    RailState _rails[RAIL_COUNT] = {0};
+
+    /** Holders of each device */
+    int _device_refs[DEVICE_COUNT] = {0};
+
+    /** Timestamp park of each device expires, 0 if not parked. A parked device
+     * keeps its hold until acquired again */
+    uint32_t _park_until[DEVICE_COUNT] = {0};
+
+    /** Recent warm-up times of each device (see ready()) */
+    uint16_t _warmup_ms[DEVICE_COUNT][POWER_WARMUP_HISTORY_LEN] = {0};
+    uint8_t _warmup_count[DEVICE_COUNT] = {0};
+    uint8_t _warmup_next[DEVICE_COUNT] = {0};
+
+    /** Device has not responded since its rail was powered up */
+    bool _ready_pending[DEVICE_COUNT] = {false};
+
+    /** Guards rail state, devices are used from concurrent measurement jobs */
+    SemaphoreHandle_t _mutex = NULL;
+
+    /******************************************************************************
+    * Init rails, switched off. Rail pins are RTC GPIOs keeping their level in deep
+    * sleep. On wake up from deep sleep rails are left as they are, parked devices
+    * are restored with restore_state()
+    ******************************************************************************/
+    RetResult init()
+    {
+        if(_mutex == NULL)
+            _mutex = xSemaphoreCreateMutex();
+
+        esp_sleep_pd_config(esp_sleep_pd_domain_t::ESP_PD_DOMAIN_RTC_PERIPH, esp_sleep_pd_option_t::ESP_PD_OPTION_ON);
+
+        for(int i = 0; i < RAIL_COUNT; i++)
+        {
+            _rails[i].refs = 0;
+
+            if(!DeepSleep::woke_up())
+                switch_rail((Rail)i, false);
+
+            rtc_gpio_pulldown_en(RAIL_PINS[i]);
+            rtc_gpio_set_direction(RAIL_PINS[i], rtc_gpio_mode_t::RTC_GPIO_MODE_OUTPUT_ONLY);
+        }
+
+        return _mutex != NULL ? RET_OK : RET_ERROR;
+    }
+
+    /******************************************************************************
+    * Hold rail of a device, switching it on if off, and wait until the device has
+    * settled
+    * @param wait False to return right away, eg. to listen to power up output.
+    *             Caller then waits with wait_settled() before using the device
+    ******************************************************************************/
+    RetResult acquire(Device device, bool wait)
+    {
+        RailState *rail = &_rails[DEVICES[device].rail];
+
+        if(!lock())
+            return RET_ERROR;
+
+        // Kept on for it, the park hold becomes the caller's
+        if(_park_until[device] != 0)
+        {
+            _park_until[device] = 0;
+            unlock();
+
+            if(wait)
+                wait_settled(device);
+
+            return RET_OK;
+        }
+
+        if(rail->refs++ == 0)
+        {
+            switch_rail(DEVICES[device].rail, true);
+            rail_powered_up(DEVICES[device].rail);
+        }
+
+        if(_device_refs[device]++ == 0 && DEVICES[device].energy_state >= 0)
+            EnergyProfiler::begin((EnergyProfiler::State)DEVICES[device].energy_state);
+
+        unlock();
+
+        if(wait)
+            wait_settled(device);
+
+        return RET_OK;
+    }
+
+    /******************************************************************************
+    * Drop hold of acquire(), rail is switched off when no one else holds it
+    ******************************************************************************/
+    void release(Device device)
+    {
+        RailState *rail = &_rails[DEVICES[device].rail];
+
+        if(!lock())
+            return;
+
+        if(_device_refs[device] > 0 && --_device_refs[device] == 0 && DEVICES[device].energy_state >= 0)
+            EnergyProfiler::end((EnergyProfiler::State)DEVICES[device].energy_state);
+
+        if(rail->refs > 0 && --rail->refs == 0)
+            switch_rail(DEVICES[device].rail, false);
+
+        unlock();
+    }
+
+    /******************************************************************************
+    * Power cycle rail of a device held by the caller, to reset it after a failure.
+    * Not when other devices hold the rail too, they would be reset as well
+    * @return True if rail was cycled
+    ******************************************************************************/
+    bool power_cycle(Device device)
+    {
+        Rail rail_id = DEVICES[device].rail;
+        RailState *rail = &_rails[rail_id];
+        bool cycled = false;
+
+        if(!lock())
+            return false;
+
+        if(rail->refs > 0 && rail->refs == _device_refs[device])
+        {
+            debug_print(F("Cycling power of: "));
+            debug_println(DEVICES[device].name);
+
+            switch_rail(rail_id, false);
+            switch_rail(rail_id, true);
+            rail_powered_up(rail_id);
+            cycled = true;
+        }
+
+        unlock();
+
+        if(cycled)
+            wait_settled(device);
+        else
+            debug_println(F("Rail shared, not cycled."));
+
+        return cycled;
+    }
+
+    /******************************************************************************
+    * Check if rail is on
+    ******************************************************************************/
+    bool is_on(Rail rail)
+    {
+        return _rails[rail].refs > 0;
+    }
+
+    /******************************************************************************
+    * Device gave its first valid response since power up, record the warm-up
+    * time. Later responses are ignored
+    ******************************************************************************/
+    void ready(Device device)
+    {
+        if(!lock())
+            return;
+
+        if(_ready_pending[device])
+        {
+            uint32_t elapsed_ms = millis() - _rails[DEVICES[device].rail].on_ms;
+
+            _warmup_ms[device][_warmup_next[device]] = elapsed_ms < UINT16_MAX ? elapsed_ms : UINT16_MAX;
+            _warmup_next[device] = (_warmup_next[device] + 1) % POWER_WARMUP_HISTORY_LEN;
+
+            if(_warmup_count[device] < POWER_WARMUP_HISTORY_LEN)
+                _warmup_count[device]++;
+
+            _ready_pending[device] = false;
+
+            debug_printf("%s ready after (ms): %u\n", DEVICES[device].name, elapsed_ms);
+        }
+
+        unlock();
+    }
+
+    /******************************************************************************
+    * After a failed attempt, check if the device may just not be ready yet: it
+    * has not responded since power up and its settle time has not passed. Waits
+    * POWER_WARMUP_POLL_MS before returning true, so the caller tries again right
+    * away instead of counting a failure
+    ******************************************************************************/
+    bool retry_warming_up(Device device)
+    {
+        uint32_t elapsed_ms = millis() - _rails[DEVICES[device].rail].on_ms;
+
+        if(!_ready_pending[device] || elapsed_ms >= DEVICES[device].settle_ms)
+            return false;
+
+        debug_printf("%s not ready yet, polling.\n", DEVICES[device].name);
+
+        delay(POWER_WARMUP_POLL_MS);
+
+        return true;
+    }
+
+    /******************************************************************************
+    * Get warm-up to wait after rail power up: POWER_WARMUP_PERCENTILE of recent
+    * warm-up times less the probe step. Settle time until some are known, and
+    * never more than it
+    ******************************************************************************/
+    uint32_t get_warmup_ms(Device device)
+    {
+        int count = _warmup_count[device];
+
+        if(count == 0)
+            return DEVICES[device].settle_ms;
+
+        uint16_t sorted[POWER_WARMUP_HISTORY_LEN];
+        memcpy(sorted, _warmup_ms[device], sizeof(sorted));
+
+        // Insertion sort, a handful of samples
+        for(int i = 1; i < count; i++)
+        {
+            uint16_t val = sorted[i];
+            int j = i - 1;
+
+            for(; j >= 0 && sorted[j] > val; j--)
+                sorted[j + 1] = sorted[j];
+
+            sorted[j + 1] = val;
+        }
+
+        uint32_t warmup_ms = sorted[(count - 1) * POWER_WARMUP_PERCENTILE / 100];
+
+        warmup_ms = warmup_ms > POWER_WARMUP_PROBE_MS + POWER_WARMUP_MIN_MS ? warmup_ms - POWER_WARMUP_PROBE_MS : POWER_WARMUP_MIN_MS;
+
+        return warmup_ms < DEVICES[device].settle_ms ? warmup_ms : DEVICES[device].settle_ms;
+    }
+
+    /******************************************************************************
+    * Release a device held by the caller but keep its rail on for it until
+    * acquired again or until_tstamp passes (see expire_parks())
+    ******************************************************************************/
+    void park(Device device, uint32_t until_tstamp)
+    {
+        if(!lock())
+            return;
+
+        bool held = _device_refs[device] > 0;
+
+        if(held)
+            _park_until[device] = until_tstamp;
+
+        unlock();
+
+        if(held)
+            debug_printf("%s parked until: %u\n", DEVICES[device].name, until_tstamp);
+    }
+
+    /******************************************************************************
+    * Check if device is parked, so has been powered since its last use
+    ******************************************************************************/
+    bool is_parked(Device device)
+    {
+        return _park_until[device] != 0;
+    }
+
+    /******************************************************************************
+    * Release parked devices whose park has expired, eg. when the schedule changed
+    * and the device is not used again in time. Called before sleeping
+    * @param all Release all parked devices (eg. low battery)
+    ******************************************************************************/
+    void expire_parks(bool all)
+    {
+        uint32_t now = RTC::get_timestamp();
+
+        for(int i = 0; i < DEVICE_COUNT; i++)
+        {
+            if(_park_until[i] == 0 || (!all && now < _park_until[i]))
+                continue;
+
+            debug_printf("Park of %s expired.\n", DEVICES[i].name);
+
+            _park_until[i] = 0;
+            release((Device)i);
+        }
+    }
+
+    /******************************************************************************
+    * Save parked devices before deep sleep. Their rails stay on while sleeping
+    ******************************************************************************/
+    void save_state(RetainedState *state)
+    {
+        memcpy(state->park_until, _park_until, sizeof(state->park_until));
+        memcpy(state->warmup_ms, _warmup_ms, sizeof(state->warmup_ms));
+        memcpy(state->warmup_count, _warmup_count, sizeof(state->warmup_count));
+        memcpy(state->warmup_next, _warmup_next, sizeof(state->warmup_next));
+    }
+
+    /******************************************************************************
+    * Restore parked devices after deep sleep, holding their rails again. Rails not
+    * held by any parked device are switched off. Parked devices have long settled
+    ******************************************************************************/
+    void restore_state(const RetainedState *state)
+    {
+        if(!lock())
+            return;
+
+        memcpy(_warmup_ms, state->warmup_ms, sizeof(_warmup_ms));
+        memcpy(_warmup_count, state->warmup_count, sizeof(_warmup_count));
+        memcpy(_warmup_next, state->warmup_next, sizeof(_warmup_next));
+
+        for(int i = 0; i < DEVICE_COUNT; i++)
+        {
+            _park_until[i] = state->park_until[i];
+
+            if(_park_until[i] == 0)
+                continue;
+
+            RailState *rail = &_rails[DEVICES[i].rail];
+
+            rail->refs++;
+            rail->on_ms = millis() - DEVICES[i].settle_ms;
+            _device_refs[i] = 1;
+
+            if(DEVICES[i].energy_state >= 0)
+                EnergyProfiler::begin((EnergyProfiler::State)DEVICES[i].energy_state);
+        }
+
+        for(int i = 0; i < RAIL_COUNT; i++)
+        {
+            switch_rail((Rail)i, _rails[i].refs > 0);
+        }
+
+        unlock();
+    }
+
+    /******************************************************************************
+    * Switch rail pin
+    ******************************************************************************/
+    void switch_rail(Rail rail, bool on)
+    {
+        gpio_num_t pin = RAIL_PINS[rail];
+
         if(on)
         {
-            digitalWrite(PIN_WATER_SENSORS_PWR, 0);
+            debug_println(F("Sensor rail ON."));
+
+            #ifdef TCALL_H
+                // Power boost feeds the rail
+                Utils::ip5306_set_power_boost_state(true);
+            #endif
+
+            pinMode(pin, OUTPUT);
+            digitalWrite(pin, 1);
+            EnergyProfiler::begin(EnergyProfiler::STATE_WATER_SENSORS_POWER);
         }
         else
         {
-            digitalWrite(PIN_WATER_SENSORS_PWR, 1);
+            debug_println(F("Sensor rail OFF."));
+
+            pinMode(pin, OUTPUT);
+            digitalWrite(pin, 0);
+            rtc_gpio_set_level(pin, 0);
+            EnergyProfiler::end(EnergyProfiler::STATE_WATER_SENSORS_POWER);
+            delay(RAIL_OFF_DELAY_MS);
+
+            #ifdef TCALL_H
+                // Turn IP5306 power boost OFF to reduce idle current
+                Utils::ip5306_set_power_boost_state(false);
+            #endif
         }
     }
-}
\ No newline at end of file
+
+    /******************************************************************************
+    * Wait what is left of the warm-up of a device since its rail came on (see
+    * get_warmup_ms())
+    ******************************************************************************/
+    void wait_settled(Device device)
+    {
+        uint32_t elapsed_ms = millis() - _rails[DEVICES[device].rail].on_ms;
+        uint32_t warmup_ms = get_warmup_ms(device);
+
+        if(elapsed_ms < warmup_ms)
+        {
+            debug_printf("Waiting for %s to warm up (ms): %u\n", DEVICES[device].name, warmup_ms - elapsed_ms);
+            delay(warmup_ms - elapsed_ms);
+        }
+    }
+
+    /******************************************************************************
+    * Rail was just powered up, warm-up of all its devices starts
+    ******************************************************************************/
+    void rail_powered_up(Rail rail)
+    {
+        _rails[rail].on_ms = millis();
+
+        for(int i = 0; i < DEVICE_COUNT; i++)
+        {
+            if(DEVICES[i].rail == rail)
+                _ready_pending[i] = true;
+        }
+    }
+
+    bool lock()
+    {
+        if(_mutex == NULL)
+            _mutex = xSemaphoreCreateMutex();
+
+        return _mutex != NULL && xSemaphoreTake(_mutex, portMAX_DELAY) == pdTRUE;
+    }
+
+    void unlock()
+    {
+        xSemaphoreGive(_mutex);
+    }
+}
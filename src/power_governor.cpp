@@ -0,0 +1,223 @@
+#include "power_governor.h"
+#include "const.h"
+#include "common.h"
+#include "utils.h"
+#include "rtc.h"
+#include "battery.h"
+#include "battery_gauge.h"
+#include "solar_monitor.h"
+#include <math.h>
+
+namespace PowerGovernor
+{
+	//
+	// Private functions
+	//
+	void update_balance();
+	float calc_target_scale(int battery_pct);
+	int snap_interval(float wakeup_int);
+
+	// Private vars
+	/** Smoothed scale factor, 0 when not decided yet */
+	float _scale = 0;
+
+	/** Gauge charge and time of last balance measurement */
+	float _last_mah = 0;
+	uint32_t _last_mah_tstamp = 0;
+
+	/** Net battery current, positive when charging. From gauge or solar monitor */
+	float _net_ma = 0;
+	bool _net_valid = false;
+
+	/******************************************************************************
+	* Decide scale factor from current battery level and energy balance
+	* @return Smoothed scale factor
+	******************************************************************************/
+	float update()
+	{
+		uint16_t mv = 0, pct = 0;
+
+		Battery::read_adc(&mv, &pct);
+		update_balance();
+
+		float target = calc_target_scale(pct);
+
+		// Smooth so a noisy reading doesn't move the whole schedule
+		if(_scale <= 0)
+			_scale = target;
+		else
+			_scale += POWER_GOVERNOR_SMOOTHING_ALPHA * (target - _scale);
+
+		_scale = constrain(_scale, POWER_GOVERNOR_MIN_SCALE, POWER_GOVERNOR_MAX_SCALE);
+
+		return _scale;
+	}
+
+	/******************************************************************************
+	* Get last decided scale factor, 1 when not decided yet
+	******************************************************************************/
+	float get_scale()
+	{
+		return _scale > 0 ? _scale : 1;
+	}
+
+	/******************************************************************************
+	* Last measured net current shows at least min_ma going into the battery
+	******************************************************************************/
+	bool has_surplus(float min_ma)
+	{
+		return _net_valid && _net_ma >= min_ma;
+	}
+
+	/******************************************************************************
+	* Scale intervals of schedule. Scaled intervals are snapped to valid values so
+	* events still occur at the same minute/hour. Disabled events are kept.
+	******************************************************************************/
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[])
+	{
+		float scale = get_scale();
+
+		for(int i = 0; i < WAKEUP_SCHEDULE_LEN; i++)
+		{
+			if(schedule[i].wakeup_int > 0)
+				schedule[i].wakeup_int = snap_interval(schedule[i].wakeup_int * scale);
+		}
+	}
+
+	/******************************************************************************
+	* Print governor state
+	******************************************************************************/
+	void print()
+	{
+		debug_printf("Power scale: %.2f", get_scale());
+
+		if(_net_valid)
+			debug_printf(" - Net current: %.1fmA", _net_ma);
+
+		debug_println();
+	}
+
+	/******************************************************************************
+	* Measure net battery current. The gauge gives the average over the time
+	* since the last measurement. Without a gauge solar current is used, it only
+	* tells about surplus since load is unknown.
+	******************************************************************************/
+	void update_balance()
+	{
+		float mah = 0;
+		uint32_t t_now = RTC::get_timestamp();
+
+		if(BatteryGauge::read_mah(&mah) == RET_OK)
+		{
+			// Time unknown or went back, start over
+			if(_last_mah_tstamp == 0 || t_now < _last_mah_tstamp)
+			{
+				_last_mah = mah;
+				_last_mah_tstamp = t_now;
+				return;
+			}
+
+			uint32_t elapsed_secs = t_now - _last_mah_tstamp;
+
+			// Too short for the gauge resolution, keep last value
+			if(elapsed_secs < POWER_GOVERNOR_MIN_BALANCE_SECS)
+				return;
+
+			_net_ma = (mah - _last_mah) * 3600 / elapsed_secs;
+			_net_valid = true;
+
+			_last_mah = mah;
+			_last_mah_tstamp = t_now;
+			return;
+		}
+
+		float solar_ma = 0;
+
+		if(SolarMonitor::read_current_ma(&solar_ma) == RET_OK)
+		{
+			_net_ma = solar_ma;
+			_net_valid = true;
+		}
+	}
+
+	/******************************************************************************
+	* Scale factor for given battery level and last net current
+	* Factor rises from 1 when full to max at BATTERY_LEVEL_LOW, where the fixed
+	* battery low schedule takes over. Drain over budget stretches further,
+	* charging surplus when full compresses down to min.
+	******************************************************************************/
+	float calc_target_scale(int battery_pct)
+	{
+		float level = (float)(POWER_GOVERNOR_FULL_PCT - battery_pct) / (POWER_GOVERNOR_FULL_PCT - BATTERY_LEVEL_LOW);
+		level = constrain(level, 0, 1);
+
+		float scale = 1 + level * (POWER_GOVERNOR_MAX_SCALE - 1);
+
+		if(!_net_valid)
+			return scale;
+
+		if(_net_ma < 0)
+		{
+			float drain = constrain(-_net_ma / POWER_GOVERNOR_DRAIN_BUDGET_MA - 1, 0, 1);
+			scale *= 1 + drain;
+		}
+		else if(level == 0)
+		{
+			float surplus = constrain(_net_ma / POWER_GOVERNOR_SURPLUS_MA, 0, 1);
+			scale = 1 - surplus * (1 - POWER_GOVERNOR_MIN_SCALE);
+		}
+
+		return constrain(scale, POWER_GOVERNOR_MIN_SCALE, POWER_GOVERNOR_MAX_SCALE);
+	}
+
+	/******************************************************************************
+	* Closest valid schedule value to a scaled interval, by ratio. Never 0
+	******************************************************************************/
+	int snap_interval(float wakeup_int)
+	{
+		int best = 0;
+		float best_dist = 0;
+
+		for(int i = 0; i < sizeof(WAKEUP_SCHEDULE_VALID_VALUES) / sizeof(WAKEUP_SCHEDULE_VALID_VALUES[0]); i++)
+		{
+			int value = WAKEUP_SCHEDULE_VALID_VALUES[i];
+
+			if(value <= 0)
+				continue;
+
+			float dist = fabsf(logf(value / wakeup_int));
+
+			if(best == 0 || dist < best_dist)
+			{
+				best = value;
+				best_dist = dist;
+			}
+		}
+
+		return best;
+	}
+
+	/******************************************************************************
+	* Save state before entering deep sleep
+	******************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->scale = _scale;
+		state->last_mah = _last_mah;
+		state->last_mah_tstamp = _last_mah_tstamp;
+		state->net_ma = _net_ma;
+		state->net_valid = _net_valid;
+	}
+
+	/******************************************************************************
+	* Restore state after waking up from deep sleep
+	******************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_scale = state->scale;
+		_last_mah = state->last_mah;
+		_last_mah_tstamp = state->last_mah_tstamp;
+		_net_ma = state->net_ma;
+		_net_valid = state->net_valid;
+	}
+}
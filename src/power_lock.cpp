@@ -0,0 +1,166 @@
+#include "power_lock.h"
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "const.h"
+#include "common.h"
+#include "energy_profiler.h"
+
+#if CONFIG_PM_ENABLE
+	#include <esp_pm.h>
+	#include <esp32/pm.h>
+#endif
+
+namespace PowerLock
+{
+	//
+	// Private functions
+	//
+	void apply();
+
+	//
+	// Private vars
+	//
+	/** Holders of each lock */
+	int _counts[LOCK_COUNT] = {0};
+
+	/** Guards counts and frequency changes, recursive since profiling a state
+	 * change reads the gauge over I2C, which takes LOCK_APB_MAX */
+	SemaphoreHandle_t _mutex = NULL;
+
+	#if CONFIG_PM_ENABLE
+		esp_pm_lock_handle_t _handles[LOCK_COUNT] = {NULL};
+	#endif
+
+	/******************************************************************************
+	 * Start scaling, CPU drops to DFS_MIN_CPU_MHZ. Called once on boot
+	 * @return RET_ERROR if scaling is off or could not be set up, CPU stays at
+	 * the boot frequency and locks do nothing
+	 *****************************************************************************/
+	RetResult init()
+	{
+		if(!FLAGS.DYNAMIC_FREQ || _mutex != NULL)
+			return RET_ERROR;
+
+		_mutex = xSemaphoreCreateRecursiveMutex();
+		if(_mutex == NULL)
+			return RET_ERROR;
+
+		#if CONFIG_PM_ENABLE
+			esp_pm_config_esp32_t config = {};
+			config.max_freq_mhz = DFS_MAX_CPU_MHZ;
+			config.min_freq_mhz = DFS_MIN_CPU_MHZ;
+			#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+				config.light_sleep_enable = DFS_AUTO_LIGHT_SLEEP;
+			#endif
+
+			if(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "cpu_max", &_handles[LOCK_CPU_MAX]) != ESP_OK ||
+				esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "apb_max", &_handles[LOCK_APB_MAX]) != ESP_OK ||
+				esp_pm_configure(&config) != ESP_OK)
+			{
+				debug_println_e(F("Could not set up power management."));
+
+				vSemaphoreDelete(_mutex);
+				_mutex = NULL;
+
+				return RET_ERROR;
+			}
+		#else
+			apply();
+		#endif
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Hold a lock until release()
+	 *****************************************************************************/
+	void acquire(Lock lock)
+	{
+		if(_mutex == NULL)
+			return;
+
+		xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+
+		if(_counts[lock]++ == 0)
+		{
+			#if CONFIG_PM_ENABLE
+				esp_pm_lock_acquire(_handles[lock]);
+			#else
+				apply();
+			#endif
+
+			if(lock == LOCK_CPU_MAX)
+				EnergyProfiler::begin(EnergyProfiler::STATE_CPU_MAX);
+		}
+
+		xSemaphoreGiveRecursive(_mutex);
+	}
+
+	/******************************************************************************
+	 * Release a lock taken with acquire()
+	 *****************************************************************************/
+	void release(Lock lock)
+	{
+		if(_mutex == NULL)
+			return;
+
+		xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+
+		if(_counts[lock] > 0 && --_counts[lock] == 0)
+		{
+			if(lock == LOCK_CPU_MAX)
+				EnergyProfiler::end(EnergyProfiler::STATE_CPU_MAX);
+
+			#if CONFIG_PM_ENABLE
+				esp_pm_lock_release(_handles[lock]);
+			#else
+				apply();
+			#endif
+		}
+
+		xSemaphoreGiveRecursive(_mutex);
+	}
+
+	/******************************************************************************
+	 * Current CPU frequency (MHz)
+	 *****************************************************************************/
+	uint32_t get_cpu_mhz()
+	{
+		return getCpuFrequencyMhz();
+	}
+
+	/******************************************************************************
+	 * Switch CPU to the lowest frequency locks held allow. APB runs at the CPU
+	 * frequency below 80MHz, so LOCK_APB_MAX keeps at least 80MHz. Caller holds
+	 * the mutex
+	 *****************************************************************************/
+	void apply()
+	{
+		uint32_t mhz = DFS_MIN_CPU_MHZ;
+
+		if(_counts[LOCK_CPU_MAX] > 0)
+			mhz = DFS_MAX_CPU_MHZ;
+		else if(_counts[LOCK_APB_MAX] > 0 && mhz < DFS_APB_MAX_CPU_MHZ)
+			mhz = DFS_APB_MAX_CPU_MHZ;
+
+		if(getCpuFrequencyMhz() != mhz)
+			setCpuFrequencyMhz(mhz);
+	}
+
+	/******************************************************************************
+	 * Take lock
+	 *****************************************************************************/
+	Scoped::Scoped(Lock lock) : _lock(lock)
+	{
+		acquire(_lock);
+	}
+
+	/******************************************************************************
+	 * Release lock
+	 *****************************************************************************/
+	Scoped::~Scoped()
+	{
+		release(_lock);
+	}
+}
@@ -0,0 +1,77 @@
+#include "Arduino.h"
+#include "psram.h"
+#include <esp_heap_caps.h>
+#include "globals.h"
+#include "store_registry.h"
+#include "common.h"
+
+namespace Psram
+{
+	//
+	// Private vars
+	//
+	/** PSRAM found and staging enabled */
+	bool _available = false;
+
+	/******************************************************************************
+	* Move scratch arena and store buffers to PSRAM if the board has it. Call on
+	* boot before anything is stored or allocated from the arena
+	******************************************************************************/
+	void init()
+	{
+		_available = FLAGS.PSRAM_STAGING && psramFound();
+
+		if(!_available)
+		{
+			if(FLAGS.GZIP_TELEMETRY)
+				debug_println_w(F("GZIP_TELEMETRY needs PSRAM, telemetry is sent uncompressed."));
+
+			return;
+		}
+
+		debug_printf("PSRAM free: %u\n", get_free());
+
+		void *arena = alloc(SCRATCH_PSRAM_ARENA_SIZE);
+
+		if(arena == NULL || Scratch::use_region(arena, SCRATCH_PSRAM_ARENA_SIZE) != RET_OK)
+		{
+			debug_println_e(F("Could not move scratch arena to PSRAM."));
+
+			if(arena != NULL)
+				free(arena);
+		}
+
+		StoreRegistry::use_psram_buffers();
+	}
+
+	/******************************************************************************
+	* PSRAM can be used (see init())
+	******************************************************************************/
+	bool available()
+	{
+		return _available;
+	}
+
+	/******************************************************************************
+	* Allocate from PSRAM, free with free()
+	* @return NULL without PSRAM or if it has no room
+	******************************************************************************/
+	void* alloc(size_t size)
+	{
+		if(!_available)
+			return NULL;
+
+		return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	}
+
+	/******************************************************************************
+	* Free PSRAM bytes, 0 without PSRAM
+	******************************************************************************/
+	size_t get_free()
+	{
+		if(!_available)
+			return 0;
+
+		return heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+	}
+}
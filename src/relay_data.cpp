@@ -0,0 +1,45 @@
+#include "relay_data.h"
+#include "common.h"
+
+namespace RelayData
+{
+	/** Store for leaf sensor data relayed through this gateway */
+    DataStore<RelayData::Entry> store(RELAY_DATA_PATH, RELAY_DATA_ENTRIES_PER_SUBMIT_REQ);
+
+    /******************************************************************************
+    * Add relayed entry to store
+    ******************************************************************************/
+    RetResult add(RelayData::Entry *data)
+    {
+		return store.add(data);
+    }
+
+    /******************************************************************************
+    * Get pointer to store (for use with reader)
+    ******************************************************************************/
+    DataStore<RelayData::Entry>* get_store()
+    {
+        return &store;
+    }
+
+    /******************************************************************************
+    * Gateway API device name of a device id
+    ******************************************************************************/
+    void get_device_name(uint32_t id, char *buff, int buff_size)
+    {
+        snprintf(buff, buff_size, "%s%08X", RELAY_DATA_DEVICE_NAME_PREFIX, id);
+    }
+
+    /********************************************************************************
+	 * Print a relayed entry
+	 * @param data Relayed entry structure
+	 *******************************************************************************/
+	void print(const RelayData::Entry *data)
+	{
+		uint32_t tstamp = 0;
+		memcpy(&tstamp, data->data, sizeof(tstamp));
+
+		debug_printf("Leaf: %08X, store: %s, timestamp: %u, size: %u, RSSI: %d\n", data->leaf_id,
+			data->store < SENSOR_STORE_COUNT ? SENSOR_STORE_KEYS[data->store] : "?", tstamp, data->size, data->rssi);
+	}
+}
@@ -11,10 +11,17 @@
 #include "utils.h"
 #include "ota.h"
 #include "call_home.h"
+#include "mqtt.h"
+#include "coap.h"
 #include "test_utils.h"
 #include "fo_sniffer.h"
 #include "rtc.h"
+#include "flash.h"
+#include "sdi12_log.h"
+#include "trace.h"
 #include "common.h"
+#include "deadband.h"
+#include "backfill.h"
 
 /******************************************************************************
  * Routines for controlling the device remotely through thingsboard.
@@ -27,11 +34,16 @@ namespace RemoteControl
 	// Private funcs
 	//
 	RetResult json_to_data_struct(const JsonObject &json, RemoteControl::Data *data);
+	RetResult fetch_data_id(long long *data_id);
+	void build_filter(JsonDocument &filter);
 
 	RetResult handle_user_config(JsonObject json);
 	RetResult handle_reboot(JsonObject json);
 	RetResult handle_format_spiffs(JsonObject json);
 	RetResult handle_rtc_sync(JsonObject json);
+	RetResult handle_backfill(JsonObject json);
+	RetResult handle_sdi12_log(JsonObject json);
+	RetResult handle_trace(JsonObject json);
 	void set_reboot_pending(bool val);
 
 	void set_last_error(int error);
@@ -57,6 +69,24 @@ namespace RemoteControl
 
 		set_last_error(ERROR_NONE);
 
+		//
+		// Check data id first, most call homes have no new remote control data
+		//
+		long long new_data_id = 0;
+
+		if(fetch_data_id(&new_data_id) != RET_OK)
+		{
+			set_last_error(ERROR_REQUEST_FAILED);
+
+			return RET_ERROR;
+		}
+
+		if(new_data_id == DeviceConfig::get_last_rc_data_id())
+		{
+			debug_println(F("Remote control data id unchanged, skipping."));
+			return RET_OK;
+		}
+
 		//
 		// Send request
 		//
@@ -70,7 +100,55 @@ namespace RemoteControl
 		RetResult ret = RET_ERROR;
 
 		debug_println(F("Getting TB shared attributes."));
-		ret = http_req.get(url, g_resp_buffer, sizeof(g_resp_buffer));
+
+		// Response buffer and docs from scratch arena, freed on return. Parsed JSON
+		// strings point into the response buffer
+		Scratch::Scope scratch;
+		ScratchBuffer resp_buff(GLOBAL_HTTP_RESPONSE_BUFFER_LEN);
+
+		// Only remote control keys are kept from the response
+		ScratchJsonDocument filter(REMOTE_CONTROL_FILTER_DOC_SIZE);
+		ScratchJsonDocument json_remote(REMOTE_CONTROL_JSON_DOC_SIZE);
+
+		if(resp_buff.get() == NULL || filter.capacity() == 0 || json_remote.capacity() == 0)
+		{
+			set_last_error(ERROR_REQUEST_FAILED);
+
+			return RET_ERROR;
+		}
+
+		build_filter(filter);
+
+		DeserializationError error;
+
+		// Same response format with MQTT, CoAP and HTTP
+		MQTT *mqtt = CallHome::get_mqtt();
+		if(mqtt != NULL)
+		{
+			ret = mqtt->request(TB_MQTT_ATTRIBUTES_REQ_TOPIC, TB_MQTT_SHARED_ATTRIBUTES_REQ,
+				TB_MQTT_ATTRIBUTES_RESP_TOPIC, resp_buff.get(), resp_buff.size());
+
+			if(ret == RET_OK)
+				error = deserializeJson(json_remote, resp_buff.get(), DeserializationOption::Filter(filter));
+		}
+		else if(Coap::is_open())
+		{
+			char path[URL_BUFFER_SIZE] = "";
+			snprintf(path, sizeof(path), TB_COAP_ATTRIBUTES_PATH_FORMAT, DeviceConfig::get_tb_device_token());
+
+			ret = Coap::get(path, TB_COAP_SHARED_ATTRIBUTES_QUERY, resp_buff.get(), resp_buff.size());
+
+			if(ret == RET_OK)
+				error = deserializeJson(json_remote, resp_buff.get(), DeserializationOption::Filter(filter));
+		}
+		else
+		{
+			// Parsed as it arrives, no response buffer
+			ret = http_req.get(url, [&](Stream &in, int content_length) {
+				error = deserializeJson(json_remote, in, DeserializationOption::Filter(filter));
+				return RET_OK;
+			});
+		}
 
 		if(ret != RET_OK)
 		{
@@ -83,15 +161,6 @@ namespace RemoteControl
 			return RET_ERROR;
 		}
 
-		debug_println(F("Remote control raw data:"));
-		debug_println(F(g_resp_buffer));
-
-		//
-		// Deserialize received data
-		//
-		StaticJsonDocument<REMOTE_CONTROL_JSON_DOC_SIZE> json_remote;
-		DeserializationError error = deserializeJson(json_remote, g_resp_buffer, strlen(g_resp_buffer));
-
 		// Could not deserialize
 		if(error)
 		{
@@ -104,9 +173,11 @@ namespace RemoteControl
 			return RET_ERROR;
 		}
 
-		debug_println(F("Remote control JSON: "));
-		serializeJsonPretty(json_remote, Serial);
-		debug_println();
+		#if DEBUG
+			debug_println(F("Remote control JSON: "));
+			serializeJsonPretty(json_remote, Serial);
+			debug_println();
+		#endif
 
 		// Get shared attributes key
 		if(!json_remote.containsKey("shared"))
@@ -131,7 +202,7 @@ namespace RemoteControl
 		// Check if ID is new
 		// If remote control ID is old, remote control data is ignored
 		// ID is new when it is different than the one stored from the previous remote control
-		long long new_data_id = (int)json_shared[RC_TB_KEY_REMOTE_CONTROL_DATA_ID];
+		new_data_id = (int)json_shared[RC_TB_KEY_REMOTE_CONTROL_DATA_ID];
 
 		debug_print(F("Remote control data id: Current "));
 		debug_print(DeviceConfig::get_last_rc_data_id());
@@ -152,7 +223,6 @@ namespace RemoteControl
 
 			// Data id is new, update in config to avoid rc data from being applied every time
 			DeviceConfig::set_last_rc_data_id(new_data_id);
-			DeviceConfig::commit();
 		}
 
 		Utils::serial_style(STYLE_BLUE);
@@ -172,6 +242,15 @@ namespace RemoteControl
 		// Handle RTC sync
 		RemoteControl::handle_rtc_sync(json_shared);
 
+		// Handle backfill request, submitted with telemetry of this call home
+		RemoteControl::handle_backfill(json_shared);
+
+		// Handle SDI12 transcript request, persisted on next measurements
+		RemoteControl::handle_sdi12_log(json_shared);
+
+		// Handle tracing request, uploaded on following call homes
+		RemoteControl::handle_trace(json_shared);
+
 		// Handle OTA if OTA requested
 		if(json_shared.containsKey(RC_TB_KEY_DO_OTA) && ((bool)json_shared[RC_TB_KEY_DO_OTA]) == true)
 		{
@@ -189,6 +268,102 @@ namespace RemoteControl
 		return RET_OK;
 	}
 
+	/******************************************************************************
+	 * Request data id only
+	 * @param data_id Received data id, 0 if no data id set in TB
+	 *****************************************************************************/
+	RetResult fetch_data_id(long long *data_id)
+	{
+		char resp[REMOTE_CONTROL_ID_RESP_BUFF_LEN] = "";
+		RetResult ret = RET_ERROR;
+		uint16_t response_code = 0;
+
+		MQTT *mqtt = CallHome::get_mqtt();
+		if(mqtt != NULL)
+		{
+			ret = mqtt->request(TB_MQTT_ATTRIBUTES_REQ_TOPIC, TB_MQTT_SHARED_ATTRIBUTES_ID_REQ,
+				TB_MQTT_ATTRIBUTES_RESP_TOPIC, resp, sizeof(resp));
+		}
+		else if(Coap::is_open())
+		{
+			char path[URL_BUFFER_SIZE] = "";
+			snprintf(path, sizeof(path), TB_COAP_ATTRIBUTES_PATH_FORMAT, DeviceConfig::get_tb_device_token());
+
+			ret = Coap::get(path, TB_COAP_SHARED_ATTRIBUTES_ID_QUERY, resp, sizeof(resp));
+		}
+		else
+		{
+			char url[URL_BUFFER_SIZE_LARGE] = "";
+			Utils::tb_build_attributes_url_path(url, sizeof(url), TB_SHARED_ATTRIBUTES_ID_URL_FORMAT);
+
+			HttpRequest http_req(GSM::get_modem(), TB_SERVER);
+			http_req.set_port(TB_PORT);
+
+			ret = http_req.get(url, resp, sizeof(resp));
+			response_code = http_req.get_response_code();
+		}
+
+		if(ret != RET_OK)
+		{
+			debug_println(F("Could not send request for remote control data id."));
+
+			Log::log(Log::RC_REQUEST_FAILED, response_code);
+
+			return RET_ERROR;
+		}
+
+		StaticJsonDocument<REMOTE_CONTROL_ID_JSON_DOC_SIZE> json;
+
+		// Unparsable id, full request decides
+		if(deserializeJson(json, resp))
+		{
+			*data_id = -1;
+			return RET_OK;
+		}
+
+		*data_id = json["shared"][RC_TB_KEY_REMOTE_CONTROL_DATA_ID] | 0;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Build deserialization filter keeping only remote control keys
+	 *****************************************************************************/
+	void build_filter(JsonDocument &filter)
+	{
+		const char *keys[] = {
+			RC_TB_KEY_REMOTE_CONTROL_DATA_ID,
+			RC_TB_KEY_MEASURE_WATER_SENSORS_INT,
+			RC_TB_KEY_MEASURE_WEATHER_STATION_INT,
+			RC_TB_KEY_MEASURE_SOIL_MOISTURE_SENSORS_INT,
+			RC_TB_KEY_CALL_HOME_INT,
+			RC_TB_KEY_DO_REBOOT,
+			RC_TB_KEY_DO_OTA,
+			RC_TB_KEY_FO_ENABLED,
+			RC_TB_KEY_DO_FO_SCAN,
+			RC_TB_KEY_DO_FORMAT_SPIFFS,
+			RC_TB_KEY_DO_RTC_SYNC,
+			RC_TB_KEY_FW_URL,
+			RC_TB_KEY_FW_VERSION,
+			RC_TB_KEY_FW_MD5,
+			RC_TB_KEY_FW_DELTA_URL,
+			RC_TB_KEY_FW_DELTA_BASE,
+			RC_TB_KEY_DEADBANDS,
+			RC_TB_KEY_DEADBAND_HEARTBEAT,
+			RC_TB_KEY_CALL_HOME_PHASE,
+			RC_TB_KEY_DO_BACKFILL,
+			RC_TB_KEY_SDI12_LOG,
+			RC_TB_KEY_TRACE
+		};
+
+		JsonObject shared = filter.createNestedObject("shared");
+
+		for(size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+		{
+			shared[keys[i]] = true;
+		}
+	}
+
 	/******************************************************************************
 	 * User config
 	 *****************************************************************************/
@@ -196,6 +371,9 @@ namespace RemoteControl
 	{
 		debug_println(F("Applying new user config."));
 
+		// Config is committed only if a value differs from the stored one
+		bool changed = false;
+
 		//
 		// Water sensors measure interval
 		//
@@ -210,8 +388,13 @@ namespace RemoteControl
 			debug_print(was_int);
 			debug_println(F(". "));
 
+			// Same as stored, nothing to apply
+			if(was_int == DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS))
+			{
+				debug_println(F("Unchanged."));
+			}
 			// Check if value valid. 
-			if(Utils::in_array(was_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
+			else if(Utils::in_array(was_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
 			{
 				debug_println(F("Invalid value, ignoring."));
 				Log::log(Log::RC_WATER_SENSORS_READ_INT_SET_FAILED, was_int);
@@ -220,6 +403,7 @@ namespace RemoteControl
 			{
 				DeviceConfig::set_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS, was_int);
 				debug_println(F("Applied."));
+				changed = true;
 
 				Log::log(Log::RC_WATER_SENSORS_READ_INT_SET_SUCCESS, was_int);
 			}			
@@ -239,8 +423,13 @@ namespace RemoteControl
 			debug_print(wes_int);
 			debug_println(F(". "));
 
+			// Same as stored, nothing to apply
+			if(wes_int == DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_WEATHER_STATION))
+			{
+				debug_println(F("Unchanged."));
+			}
 			// Check if value valid. 
-			if(Utils::in_array(wes_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
+			else if(Utils::in_array(wes_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
 			{
 				debug_println(F("Invalid value, ignoring."));
 				Log::log(Log::RC_WEATHER_STATION_READ_INT_SET_FAILED, wes_int);
@@ -249,6 +438,7 @@ namespace RemoteControl
 			{
 				DeviceConfig::set_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_WEATHER_STATION, wes_int);
 				debug_println(F("Applied."));
+				changed = true;
 
 				Log::log(Log::RC_WEATHER_STATION_READ_INT_SET_SUCCESS, wes_int);
 			}			
@@ -268,8 +458,13 @@ namespace RemoteControl
 			debug_print(sm_int);
 			debug_println(F(". "));
 
+			// Same as stored, nothing to apply
+			if(sm_int == DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_SOIL_MOISTURE_SENSOR))
+			{
+				debug_println(F("Unchanged."));
+			}
 			// Check if value valid. 
-			if(Utils::in_array(sm_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
+			else if(Utils::in_array(sm_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1)
 			{
 				debug_println(F("Invalid value, ignoring."));
 				Log::log(Log::RC_SOIL_MOISTURE_READ_INT_SET_FAILED, sm_int);
@@ -278,6 +473,7 @@ namespace RemoteControl
 			{
 				DeviceConfig::set_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_READ_SOIL_MOISTURE_SENSOR, sm_int);
 				debug_println(F("Applied."));
+				changed = true;
 
 				Log::log(Log::RC_SOIL_MOISTURE_READ_INT_SET_SUCCESS, sm_int);
 			}			
@@ -296,8 +492,13 @@ namespace RemoteControl
 			debug_print(F(" - New "));
 			debug_println(ch_int);
 
+			// Same as stored, nothing to apply
+			if(ch_int == DeviceConfig::get_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_CALL_HOME))
+			{
+				debug_println(F("Unchanged."));
+			}
 			// Check if value valid. Call Home int cannot be 0
-			if(Utils::in_array(ch_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1 ||
+			else if(Utils::in_array(ch_int, WAKEUP_SCHEDULE_VALID_VALUES, sizeof(WAKEUP_SCHEDULE_VALID_VALUES)) == -1 ||
 				ch_int == 0) 
 			{
 				debug_println(F("Invalid value, ignoring."));
@@ -307,6 +508,7 @@ namespace RemoteControl
 			{
 				DeviceConfig::set_wakeup_schedule_reason_int(SleepScheduler::WakeupReason::REASON_CALL_HOME, ch_int);
 				debug_println(F("Applied."));
+				changed = true;
 
 				Log::log(Log::RC_CALL_HOME_INT_SET_SUCCESS, ch_int);
 			}			
@@ -327,10 +529,13 @@ namespace RemoteControl
 
 			bool prev_val = DeviceConfig::get_fo_enabled();
 
-			DeviceConfig::set_fo_enabled((bool)json[RC_TB_KEY_FO_ENABLED]);
-			DeviceConfig::commit();
+			if(prev_val != (bool)json[RC_TB_KEY_FO_ENABLED])
+			{
+				DeviceConfig::set_fo_enabled((bool)json[RC_TB_KEY_FO_ENABLED]);
+				changed = true;
 
-			Log::log(Log::FO_ENABLED_STATUS, prev_val, DeviceConfig::get_fo_enabled());
+				Log::log(Log::FO_ENABLED_STATUS, prev_val, DeviceConfig::get_fo_enabled());
+			}
 
 			debug_print(F("Previous value: "));
 			debug_print(prev_val, DEC);
@@ -339,10 +544,53 @@ namespace RemoteControl
 			debug_println();
 		}
 
-		DeviceConfig::print_current();
+		//
+		// Call home phase. Stored under its own key, not part of config
+		//
+		if(json.containsKey(RC_TB_KEY_CALL_HOME_PHASE))
+		{
+			int ch_phase = (int)json[RC_TB_KEY_CALL_HOME_PHASE];
+			int prev_phase = SleepScheduler::get_call_home_phase();
+
+			debug_print(F("Call home phase: "));
+			debug_print(F("Current "));
+			debug_print(prev_phase);
+			debug_print(F(" - New "));
+			debug_println(ch_phase);
+
+			if(ch_phase < -1 || ch_phase >= CALL_HOME_PHASE_MAX_SECS)
+			{
+				debug_println(F("Invalid value, ignoring."));
+			}
+			else if(ch_phase == prev_phase)
+			{
+				debug_println(F("Unchanged."));
+			}
+			else
+			{
+				SleepScheduler::set_call_home_phase(ch_phase);
+				debug_println(F("Applied."));
+
+				Log::log(Log::RC_CALL_HOME_PHASE_SET, prev_phase, ch_phase);
+			}
+		}
+
+		//
+		// Deadbands and heartbeat of report by exception filter. Stored under their
+		// own key, not part of config
+		//
+		if(json.containsKey(RC_TB_KEY_DEADBANDS) || json.containsKey(RC_TB_KEY_DEADBAND_HEARTBEAT))
+		{
+			debug_println(F("Deadband filter config"));
+
+			Deadband::set_config(json[RC_TB_KEY_DEADBANDS], json[RC_TB_KEY_DEADBAND_HEARTBEAT] | -1);
+		}
 
-		// Commit all changes
-		DeviceConfig::commit();
+		// Changes are committed before sleeping
+		if(changed)
+		{
+			DeviceConfig::print_current();
+		}
 
 		return RET_OK;
 	}
@@ -380,21 +628,15 @@ namespace RemoteControl
 
 			// TODO: Submit logs before formatting SPIFFS?
 
-			int bytes_before_format = SPIFFS.usedBytes();
-
-			if(SPIFFS.format())
+			// Logs result
+			if(Flash::format() == RET_OK)
 			{
 				debug_println(F("Format complete"));
-
-				Log::log(Log::SPIFFS_FORMATTED, bytes_before_format);
 			}
 			else
 			{
 				debug_println(F("Format failed!"));
 
-				// Try to log in case format failed but FS still accessible
-				Log::log(Log::SPIFFS_FORMAT_FAILED);
-
 				return RET_ERROR;
 			}
 		}
@@ -402,6 +644,72 @@ namespace RemoteControl
 		return RET_OK;
 	}
 
+	/******************************************************************************
+	 * Resubmit archived data of a time range (see Backfill)
+	 *****************************************************************************/
+	RetResult handle_backfill(JsonObject json)
+	{
+		if(!json.containsKey(RC_TB_KEY_DO_BACKFILL))
+			return RET_OK;
+
+		JsonObject backfill = json[RC_TB_KEY_DO_BACKFILL];
+
+		uint32_t from = backfill[RC_TB_KEY_BACKFILL_FROM] | 0;
+		uint32_t to = backfill[RC_TB_KEY_BACKFILL_TO] | 0;
+		uint32_t stores = backfill[RC_TB_KEY_BACKFILL_STORES] | 0;
+
+		debug_print(F("Backfill: from "));
+		debug_print(from);
+		debug_print(F(" to "));
+		debug_print(to);
+		debug_print(F(" - stores "));
+		debug_println(stores, BIN);
+
+		if(to == 0 || from > to)
+		{
+			debug_println(F("Invalid range, ignoring."));
+			return RET_ERROR;
+		}
+
+		return Backfill::request(from, to, stores);
+	}
+
+	/******************************************************************************
+	 * Persist SDI12 transcripts of the next measurements (see SDI12Log)
+	 *****************************************************************************/
+	RetResult handle_sdi12_log(JsonObject json)
+	{
+		if(!json.containsKey(RC_TB_KEY_SDI12_LOG))
+			return RET_OK;
+
+		int measurements = (int)json[RC_TB_KEY_SDI12_LOG];
+
+		debug_print(F("Persisting SDI12 transcripts of next measurements: "));
+		debug_println(measurements);
+
+		SDI12Log::request_persist(measurements);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Arm detailed tracing for a number of wake cycles or minutes (see Trace)
+	 *****************************************************************************/
+	RetResult handle_trace(JsonObject json)
+	{
+		if(!json.containsKey(RC_TB_KEY_TRACE))
+			return RET_OK;
+
+		JsonObject trace = json[RC_TB_KEY_TRACE];
+
+		int cycles = trace[RC_TB_KEY_TRACE_CYCLES] | 0;
+		int mins = trace[RC_TB_KEY_TRACE_MINS] | 0;
+
+		Trace::arm(cycles, mins);
+
+		return RET_OK;
+	}
+
 	/******************************************************************************
 	 * Sync RTC
 	 *****************************************************************************/
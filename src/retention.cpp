@@ -0,0 +1,161 @@
+#include "retention.h"
+#include "storage.h"
+#include "utils.h"
+#include "common.h"
+#include <math.h>
+#include <string.h>
+
+namespace Retention
+{
+	/** Rollup being built */
+	struct Accumulator
+	{
+		RollupData::Entry rollup;
+
+		/** Sums and value counts of fields, NAN values are skipped */
+		double sum[ROLLUP_MAX_FIELDS];
+		uint16_t values[ROLLUP_MAX_FIELDS];
+	};
+
+	//
+	// Private functions
+	//
+	void begin_rollup(SensorStore store, uint32_t period_tstamp, int field_count);
+	void add_entry(const TbJsonSchema *schema, const uint8_t *entry);
+	void flush_rollup();
+
+	// Private vars
+	/** Kept over files of a cleanup, consecutive files usually share a period */
+	Accumulator _acc;
+	bool _acc_active = false;
+
+	/******************************************************************************
+	* Roll entries of a store file up
+	* @param path File about to be deleted, NULL when cleanup ends
+	******************************************************************************/
+	void rollup_file(SensorStore store, const TbJsonSchema *schema, int entry_size, const char *path)
+	{
+		if(!FLAGS.ROLLUP_EVICTED_DATA)
+			return;
+
+		// Cleanup done, last rollup is complete
+		if(path == NULL)
+		{
+			flush_rollup();
+			RollupData::get_store()->commit();
+			return;
+		}
+
+		File file = STORAGE_FS.open(path, FILE_READ);
+		if(!file)
+			return;
+
+		int field_count = schema->field_count < ROLLUP_MAX_FIELDS ? schema->field_count : ROLLUP_MAX_FIELDS;
+
+		// Stored as DataStore::Entry, header (CRC32, sequence number) followed by struct
+		uint8_t buff[DATA_STORE_ENTRY_HEADER_SIZE + ROLLUP_MAX_ENTRY_SIZE];
+		int record_size = DATA_STORE_ENTRY_HEADER_SIZE + entry_size;
+		const uint8_t *entry = buff + DATA_STORE_ENTRY_HEADER_SIZE;
+		int entries = 0;
+
+		while(file.read(buff, record_size) == record_size)
+		{
+			uint32_t crc32;
+			memcpy(&crc32, buff, sizeof(crc32));
+
+			if(crc32 != Utils::crc32((uint8_t*)entry, entry_size))
+				continue;
+
+			uint32_t tstamp;
+			memcpy(&tstamp, entry, sizeof(tstamp));
+
+			uint32_t period_tstamp = tstamp - tstamp % ROLLUP_PERIOD_SECS;
+
+			if(_acc_active && (_acc.rollup.store != store || _acc.rollup.timestamp != period_tstamp))
+				flush_rollup();
+
+			if(!_acc_active)
+				begin_rollup(store, period_tstamp, field_count);
+
+			add_entry(schema, entry);
+			entries++;
+		}
+
+		file.close();
+
+		debug_printf("Rolled up %d entries of %s\n", entries, path);
+	}
+
+	/******************************************************************************
+	* Start rollup of a period
+	******************************************************************************/
+	void begin_rollup(SensorStore store, uint32_t period_tstamp, int field_count)
+	{
+		memset(&_acc, 0, sizeof(_acc));
+
+		_acc.rollup.timestamp = period_tstamp;
+		_acc.rollup.store = store;
+		_acc.rollup.field_count = field_count;
+
+		for(int i = 0; i < ROLLUP_MAX_FIELDS; i++)
+		{
+			_acc.rollup.min[i] = INFINITY;
+			_acc.rollup.max[i] = -INFINITY;
+		}
+
+		_acc_active = true;
+	}
+
+	/******************************************************************************
+	* Add entry values to rollup
+	******************************************************************************/
+	void add_entry(const TbJsonSchema *schema, const uint8_t *entry)
+	{
+		for(int i = 0; i < _acc.rollup.field_count; i++)
+		{
+			if(!schema->is_present(&schema->fields[i], entry))
+				continue;
+
+			float val = schema->fields[i].read(entry);
+
+			if(isnan(val))
+				continue;
+
+			_acc.sum[i] += val;
+			_acc.values[i]++;
+
+			if(val < _acc.rollup.min[i])
+				_acc.rollup.min[i] = val;
+			if(val > _acc.rollup.max[i])
+				_acc.rollup.max[i] = val;
+		}
+
+		if(_acc.rollup.count < UINT16_MAX)
+			_acc.rollup.count++;
+	}
+
+	/******************************************************************************
+	* Add finished rollup to store
+	******************************************************************************/
+	void flush_rollup()
+	{
+		if(!_acc_active)
+			return;
+
+		_acc_active = false;
+
+		for(int i = 0; i < ROLLUP_MAX_FIELDS; i++)
+		{
+			if(i < _acc.rollup.field_count && _acc.values[i] > 0)
+			{
+				_acc.rollup.mean[i] = _acc.sum[i] / _acc.values[i];
+			}
+			else
+			{
+				_acc.rollup.mean[i] = _acc.rollup.min[i] = _acc.rollup.max[i] = NAN;
+			}
+		}
+
+		RollupData::add(&_acc.rollup);
+	}
+}
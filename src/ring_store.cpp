@@ -0,0 +1,506 @@
+#include "ring_store.h"
+#include "ring_store_reader.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "atmos41_data.h"
+#include "fo_data.h"
+#include "sdi12_log.h"
+#include "log.h"
+#include "utils.h"
+#include "common.h"
+#include "trace.h"
+#include "board_features.h"
+
+/******************************************************************************
+ * RingStore
+ * Alternative to DataStore that stores entries sequentially in a region of a
+ * raw data partition instead of files, without any filesystem overhead.
+ * Region is used as a ring of flash sectors. Every sector starts with a header
+ * (magic, sequence number, CRC32) followed by entries split into blocks. A
+ * block is the equivalent of a DataStore file: it is read and submitted as a
+ * whole and then marked as submitted by clearing its bit in the sector header.
+ * Sectors with all blocks submitted are erased. When the ring is full the
+ * oldest sector is overwritten.
+ * Head sector is found by its sequence number and the write position within
+ * it by binary search, so no state has to be persisted elsewhere.
+ ******************************************************************************/
+
+/******************************************************************************
+ * Constructor
+ * @param partition_label Label of data partition to use
+ * @param first_sector First sector of partition used by this store
+ * @param sector_count Number of sectors used by this store
+ * @param max_entries_per_file Entries per block (submitted with a single request)
+ ******************************************************************************/
+template <class TStruct>
+RingStore<TStruct>::RingStore(const char *partition_label, int first_sector, int sector_count, int max_entries_per_file)
+{
+	_partition_label = partition_label;
+	_first_sector = first_sector;
+	_sector_count = sector_count;
+
+	// Blocks are read at once by the reader, must fit its buffer
+	_entries_per_block = max_entries_per_file < DATA_STORE_READER_BUFF_ENTRIES ? max_entries_per_file : DATA_STORE_READER_BUFF_ENTRIES;
+
+	int entries_per_sector = (RING_STORE_SECTOR_SIZE - sizeof(SectorHeader)) / sizeof(Entry);
+	_blocks_per_sector = _entries_per_block > 0 ? entries_per_sector / _entries_per_block : 0;
+
+	// One bit per block in sector header
+	if(_blocks_per_sector > 32)
+		_blocks_per_sector = 32;
+}
+
+/******************************************************************************
+ * Find partition and recover head sector/write position. Called automatically
+ * on first use.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::init()
+{
+	if(_partition != NULL)
+		return RET_OK;
+
+	_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, _partition_label);
+
+	if(_partition == NULL)
+	{
+		debug_print_e(F("Ring store partition not found: "));
+		debug_println(_partition_label);
+		return RET_ERROR;
+	}
+
+	if(_sector_count < 2 || _blocks_per_sector < 1 ||
+		(uint32_t)(_first_sector + _sector_count) * RING_STORE_SECTOR_SIZE > _partition->size)
+	{
+		debug_println_e(F("Invalid ring store region."));
+		_partition = NULL;
+		return RET_ERROR;
+	}
+
+	// Head is the sector with the highest sequence number
+	_head_sector = -1;
+	SectorHeader header;
+
+	for(int i = 0; i < _sector_count; i++)
+	{
+		if(read_header(i, &header) != RET_OK || !header_valid(&header))
+			continue;
+
+		if(_head_sector < 0 || header.seq > _head_seq)
+		{
+			_head_sector = i;
+			_head_seq = header.seq;
+		}
+	}
+
+	return find_write_slot();
+}
+
+/******************************************************************************
+ * Add data structure to buffer. If buffer is full, data is automatically commited
+ * to make space in buffer.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::add(TStruct *data)
+{
+	// Buffer full? Commit it to flash and clear
+	if(_buffer_element_count >= DATA_STORE_BUFFER_ELEMENTS)
+	{
+		if(commit() != RET_OK)
+		{
+			// When commiting fails, empty buffer and log this event
+			Log::log(Log::DATA_STORE_COMMIT_FAILED);
+
+			clear_buffer();
+		}
+	}
+
+	Entry *new_entry = &_buffer[_buffer_element_count];
+
+	new_entry->crc32 = Utils::crc32((uint8_t*)data, sizeof(TStruct));
+	new_entry->seq = 0;
+	memcpy(&new_entry->data, data, sizeof(TStruct));
+
+	_buffer_element_count++;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write all buffered entries to flash, oldest first, with a single write per
+ * sector. Entries that could not be written remain in buffer.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::commit()
+{
+	if(_buffer_element_count == 0)
+		return RET_OK;
+
+	Trace::Span span(Trace::SPAN_STORE_COMMIT);
+
+	if(init() != RET_OK)
+		return RET_ERROR;
+
+	int entries_per_sector = _blocks_per_sector * _entries_per_block;
+	uint32_t written = 0;
+	RetResult ret = RET_OK;
+
+	// Block being filled may have been submitted already, continue on the next one
+	if(_head_sector >= 0 && _write_slot < entries_per_sector && _write_slot % _entries_per_block != 0)
+		ret = pad_to_block_end();
+
+	while(ret == RET_OK && written < _buffer_element_count)
+	{
+		if(_head_sector < 0 || _write_slot >= entries_per_sector)
+		{
+			if(start_new_sector() != RET_OK)
+			{
+				ret = RET_ERROR;
+				break;
+			}
+		}
+
+		int count = _buffer_element_count - written;
+		if(count > entries_per_sector - _write_slot)
+			count = entries_per_sector - _write_slot;
+
+		if(esp_partition_write(_partition, slot_addr(_head_sector, _write_slot), &_buffer[written], count * sizeof(Entry)) != ESP_OK)
+		{
+			debug_println_e(F("Could not write to ring store."));
+
+			// Slot state unknown, find it again
+			find_write_slot();
+			ret = RET_ERROR;
+			break;
+		}
+
+		_write_slot += count;
+		written += count;
+	}
+
+	// Keep entries that were not written
+	if(written > 0)
+	{
+		memmove(&_buffer[0], &_buffer[written], (_buffer_element_count - written) * sizeof(Entry));
+		_buffer_element_count -= written;
+	}
+
+	return ret;
+}
+
+/******************************************************************************
+ * Clear buffer data
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::clear_buffer()
+{
+	_buffer_element_count = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Erase all data of the store
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::clear_all()
+{
+	clear_buffer();
+
+	if(init() != RET_OK)
+		return RET_ERROR;
+
+	if(esp_partition_erase_range(_partition, sector_addr(0), _sector_count * RING_STORE_SECTOR_SIZE) != ESP_OK)
+		return RET_ERROR;
+
+	// Sequence continues from last value
+	_head_sector = -1;
+	_write_slot = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Get number of items in buffer
+ ******************************************************************************/
+template <class TStruct>
+unsigned int RingStore<TStruct>::get_buffer_element_count() const
+{
+	return _buffer_element_count;
+}
+
+/******************************************************************************
+ * Get buffer element
+ ******************************************************************************/
+template <class TStruct>
+const typename RingStore<TStruct>::Entry* RingStore<TStruct>::get_buffer_element(unsigned int index) const
+{
+	if(_buffer_element_count == 0 || index > _buffer_element_count - 1)
+		return NULL;
+
+	return &(_buffer[index]);
+}
+
+/******************************************************************************
+ * Ring overwrites the oldest data when full so cleanup is only needed when
+ * forced, in which case the oldest sector is erased.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::cleanup(bool force)
+{
+	if(!force)
+		return RET_OK;
+
+	if(init() != RET_OK || _head_sector < 0)
+		return RET_ERROR;
+
+	SectorHeader header;
+
+	for(int i = 1; i < _sector_count; i++)
+	{
+		int sector = (_head_sector + i) % _sector_count;
+
+		if(read_header(sector, &header) != RET_OK || !header_valid(&header))
+			continue;
+
+		if(esp_partition_erase_range(_partition, sector_addr(sector), RING_STORE_SECTOR_SIZE) != ESP_OK)
+			return RET_ERROR;
+
+		Log::log(Log::DATA_STORE_CLEANUP, 1, RING_STORE_SECTOR_SIZE);
+
+		return RET_OK;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Entries of ring stores have no sequence number (see DataStore::Entry), none
+ * is ever acknowledged
+ ******************************************************************************/
+template <class TStruct>
+uint32_t RingStore<TStruct>::get_acked_seq()
+{
+	return 0;
+}
+
+template <class TStruct>
+RetResult RingStore<TStruct>::set_acked_seq(uint32_t seq)
+{
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Read a sector header
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::read_header(int sector, SectorHeader *header) const
+{
+	if(esp_partition_read(_partition, sector_addr(sector), header, sizeof(SectorHeader)) != ESP_OK)
+		return RET_ERROR;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Check if sector header belongs to a sector in use
+ ******************************************************************************/
+template <class TStruct>
+bool RingStore<TStruct>::header_valid(const SectorHeader *header) const
+{
+	return header->magic == RING_STORE_SECTOR_MAGIC &&
+		header->crc32 == Utils::crc32((uint8_t*)header, sizeof(header->magic) + sizeof(header->seq));
+}
+
+/******************************************************************************
+ * Move head to next sector. Sector is erased first, if it still has data that
+ * was not submitted (ring full), data is lost and this is logged.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::start_new_sector()
+{
+	int next = _head_sector < 0 ? 0 : (_head_sector + 1) % _sector_count;
+
+	SectorHeader header;
+
+	if(read_header(next, &header) == RET_OK && header_valid(&header))
+	{
+		uint32_t pending = header.pending_blocks & (0xFFFFFFFF >> (32 - _blocks_per_sector));
+
+		if(pending != 0)
+		{
+			debug_println_w(F("Ring store full, overwriting oldest sector."));
+			Log::log(Log::RING_STORE_SECTOR_OVERWRITTEN, next, __builtin_popcount(pending));
+		}
+	}
+
+	if(esp_partition_erase_range(_partition, sector_addr(next), RING_STORE_SECTOR_SIZE) != ESP_OK)
+	{
+		debug_println_e(F("Could not erase ring store sector."));
+		return RET_ERROR;
+	}
+
+	header.magic = RING_STORE_SECTOR_MAGIC;
+	header.seq = _head_seq + 1;
+	header.crc32 = Utils::crc32((uint8_t*)&header, sizeof(header.magic) + sizeof(header.seq));
+	header.pending_blocks = RING_STORE_ERASED_WORD;
+
+	if(esp_partition_write(_partition, sector_addr(next), &header, sizeof(header)) != ESP_OK)
+	{
+		debug_println_e(F("Could not write ring store sector header."));
+		return RET_ERROR;
+	}
+
+	_head_sector = next;
+	_head_seq = header.seq;
+	_write_slot = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Find first free entry slot in head sector. Slots are written in order so
+ * the first erased slot is found with a binary search.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::find_write_slot()
+{
+	_write_slot = 0;
+
+	if(_head_sector < 0)
+		return RET_OK;
+
+	int low = 0;
+	int high = _blocks_per_sector * _entries_per_block;
+
+	while(low < high)
+	{
+		int mid = (low + high) / 2;
+		uint32_t crc = 0;
+
+		if(esp_partition_read(_partition, slot_addr(_head_sector, mid), &crc, sizeof(crc)) != ESP_OK)
+			return RET_ERROR;
+
+		if(crc != RING_STORE_ERASED_WORD)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	_write_slot = low;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * If the block currently being filled has been submitted, fill the rest of it
+ * with padding entries (all zeros, skipped by reader) so new entries go to the
+ * next block.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::pad_to_block_end()
+{
+	SectorHeader header;
+	if(read_header(_head_sector, &header) != RET_OK)
+		return RET_ERROR;
+
+	int block = _write_slot / _entries_per_block;
+
+	// Still pending, keep filling
+	if(header.pending_blocks & (1UL << block))
+		return RET_OK;
+
+	Entry padding[DATA_STORE_READER_BUFF_ENTRIES];
+	memset(padding, 0, sizeof(padding));
+
+	int count = (block + 1) * _entries_per_block - _write_slot;
+
+	if(esp_partition_write(_partition, slot_addr(_head_sector, _write_slot), padding, count * sizeof(Entry)) != ESP_OK)
+		return RET_ERROR;
+
+	_write_slot += count;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Mark block as submitted by clearing its bit in sector header (no erase needed).
+ * Sectors other than head are erased once all of their blocks are submitted.
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStore<TStruct>::mark_block_submitted(int sector, int block)
+{
+	SectorHeader header;
+	if(read_header(sector, &header) != RET_OK || !header_valid(&header))
+		return RET_ERROR;
+
+	header.pending_blocks &= ~(1UL << block);
+
+	if(esp_partition_write(_partition, sector_addr(sector) + offsetof(SectorHeader, pending_blocks),
+		&header.pending_blocks, sizeof(header.pending_blocks)) != ESP_OK)
+	{
+		return RET_ERROR;
+	}
+
+	uint32_t pending = header.pending_blocks & (0xFFFFFFFF >> (32 - _blocks_per_sector));
+
+	if(pending == 0 && sector != _head_sector)
+	{
+		if(esp_partition_erase_range(_partition, sector_addr(sector), RING_STORE_SECTOR_SIZE) != ESP_OK)
+			return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Address of sector in partition
+ ******************************************************************************/
+template <class TStruct>
+uint32_t RingStore<TStruct>::sector_addr(int sector) const
+{
+	return (_first_sector + sector) * RING_STORE_SECTOR_SIZE;
+}
+
+/******************************************************************************
+ * Address of entry slot in partition
+ ******************************************************************************/
+template <class TStruct>
+uint32_t RingStore<TStruct>::slot_addr(int sector, int slot) const
+{
+	return sector_addr(sector) + sizeof(SectorHeader) + slot * sizeof(Entry);
+}
+
+/******************************************************************************
+ * Number of written entries in a block
+ * @param block Block index in sector
+ * @param written_slots Number of written slots in sector
+ ******************************************************************************/
+template <class TStruct>
+int RingStore<TStruct>::get_block_entries(int block, int written_slots) const
+{
+	int start = block * _entries_per_block;
+
+	if(start >= written_slots)
+		return 0;
+
+	return written_slots - start < _entries_per_block ? written_slots - start : _entries_per_block;
+}
+
+// Forward declarations
+template class RingStore<WaterSensorData::Entry>;
+#if FEATURE_ATMOS41
+template class RingStore<Atmos41Data::Entry>;
+#endif
+#if FEATURE_SOIL_MOISTURE
+template class RingStore<SoilMoistureData::Entry>;
+#endif
+template class RingStore<Log::Entry>;
+template class RingStore<SDI12Log::Entry>;
+template class RingStore<FoData::StoreEntry>;
+#if FEATURE_LIGHTNING
+template class RingStore<LightningData::Entry>;
+#endif
+template class RingStore<EnergyProfileData::Entry>;
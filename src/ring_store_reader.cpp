@@ -0,0 +1,378 @@
+#include "ring_store_reader.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "atmos41_data.h"
+#include "fo_data.h"
+#include "sdi12_log.h"
+#include "log.h"
+#include "utils.h"
+#include "common.h"
+#include "board_features.h"
+
+/******************************************************************************
+* Constructor
+* @param store Store object to read from
+******************************************************************************/
+template <class TStruct>
+RingStoreReader<TStruct>::RingStoreReader(RingStore<TStruct> *store)
+{
+	_store = store;
+}
+
+/******************************************************************************
+* Default constructor (private)
+******************************************************************************/
+template <class TStruct>
+RingStoreReader<TStruct>::RingStoreReader()
+{}
+
+/******************************************************************************
+* Init store if needed and reset reader
+******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::begin()
+{
+	if(_store->init() != RET_OK)
+		return RET_ERROR;
+
+	reset();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Get next block with data not yet submitted
+* @return True while there are still blocks in store
+******************************************************************************/
+template <class TStruct>
+bool RingStoreReader<TStruct>::next_file()
+{
+	if(_store->init() != RET_OK || _store->_head_sector < 0)
+		return false;
+
+	reset_data_state();
+
+	while(true)
+	{
+		// Next pending block of current sector
+		if(_cur_sector >= 0)
+		{
+			for(int block = _cur_block + 1; block < _store->_blocks_per_sector; block++)
+			{
+				// No more written blocks
+				if(_store->get_block_entries(block, _cur_sector_slots) == 0)
+					break;
+
+				if(_cur_pending_blocks & (1UL << block))
+				{
+					_cur_block = block;
+					return true;
+				}
+			}
+		}
+
+		// All sectors visited, head was the last one
+		if(_sectors_visited >= _store->_sector_count)
+			return false;
+
+		// Oldest sector is the one after head
+		_cur_sector = (_store->_head_sector + 1 + _sectors_visited) % _store->_sector_count;
+		_sectors_visited++;
+		_cur_block = -1;
+
+		typename RingStore<TStruct>::SectorHeader header;
+
+		if(_store->read_header(_cur_sector, &header) != RET_OK || !_store->header_valid(&header))
+		{
+			_cur_sector = -1;
+			continue;
+		}
+
+		_cur_pending_blocks = header.pending_blocks;
+		_cur_sector_slots = _cur_sector == _store->_head_sector ?
+			_store->_write_slot : _store->_blocks_per_sector * _store->_entries_per_block;
+	}
+}
+
+/******************************************************************************
+* Get next item in current block
+* @return Entry data, NULL when no more entries in block
+******************************************************************************/
+template <class TStruct>
+TStruct* RingStoreReader<TStruct>::next_entry()
+{
+	if(_cur_block < 0)
+		return NULL;
+
+	if(!_block_loaded)
+		fill_read_buffer();
+
+	if(_read_buff_index >= _read_buff_count)
+	{
+		_cur_entry = NULL;
+		return NULL;
+	}
+
+	_cur_entry = &_read_buff[_read_buff_index++];
+
+	return &_cur_entry->data;
+}
+
+/******************************************************************************
+ * Check if current entry's CRC is valid
+ ******************************************************************************/
+template <class TStruct>
+bool RingStoreReader<TStruct>::entry_crc_valid()
+{
+	if(_cur_entry == NULL)
+		return false;
+
+	// Checked when block was read
+	return _read_buff_crc_valid & (1UL << (_read_buff_index - 1));
+}
+
+/******************************************************************************
+ * Sequence number of current entry. Not tracked by ring stores, always 0
+ ******************************************************************************/
+template <class TStruct>
+uint32_t RingStoreReader<TStruct>::entry_seq()
+{
+	return 0;
+}
+
+/******************************************************************************
+ * Entries of ring stores are never acknowledged by sequence number
+ ******************************************************************************/
+template <class TStruct>
+bool RingStoreReader<TStruct>::entry_acked()
+{
+	return false;
+}
+
+/******************************************************************************
+ * Mark current block as submitted
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::delete_file()
+{
+	if(_cur_sector < 0 || _cur_block < 0)
+		return RET_ERROR;
+
+	if(_store->mark_block_submitted(_cur_sector, _cur_block) != RET_OK)
+		return RET_ERROR;
+
+	_cur_pending_blocks &= ~(1UL << _cur_block);
+
+	reset_data_state();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Queue current block to be marked submitted by commit_deletes()
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::queue_delete_file()
+{
+	if(_cur_sector < 0 || _cur_block < 0 || _delete_queue_count >= TELEMETRY_MAX_FILES_PER_REQ)
+		return RET_ERROR;
+
+	_delete_queue_sectors[_delete_queue_count] = _cur_sector;
+	_delete_queue_blocks[_delete_queue_count] = _cur_block;
+	_delete_queue_count++;
+
+	_cur_pending_blocks &= ~(1UL << _cur_block);
+
+	reset_data_state();
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Mark the first count queued blocks as submitted
+ * @param count Blocks to mark, oldest queued first
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::commit_deletes(int count)
+{
+	RetResult ret = RET_OK;
+
+	if(count > _delete_queue_count)
+		count = _delete_queue_count;
+
+	for(int i = 0; i < count; i++)
+	{
+		if(_store->mark_block_submitted(_delete_queue_sectors[i], _delete_queue_blocks[i]) != RET_OK)
+			ret = RET_ERROR;
+	}
+
+	discard_deletes(count);
+
+	return ret;
+}
+
+/******************************************************************************
+ * Drop the first count queued blocks, they remain pending (request failed,
+ * retry next time)
+ ******************************************************************************/
+template <class TStruct>
+void RingStoreReader<TStruct>::discard_deletes(int count)
+{
+	if(count > _delete_queue_count)
+		count = _delete_queue_count;
+
+	for(int i = count; i < _delete_queue_count; i++)
+	{
+		_delete_queue_sectors[i - count] = _delete_queue_sectors[i];
+		_delete_queue_blocks[i - count] = _delete_queue_blocks[i];
+	}
+
+	_delete_queue_count -= count;
+}
+
+/******************************************************************************
+ * Number of blocks queued to be marked submitted
+ ******************************************************************************/
+template <class TStruct>
+int RingStoreReader<TStruct>::get_queued_deletes() const
+{
+	return _delete_queue_count;
+}
+
+/******************************************************************************
+ * Mark entries of current block as submitted. Entries are overwritten with
+ * zeros (no erase needed) so they are skipped as padding the next time the block
+ * is read.
+ * @param count Entries read from current block so far that were submitted
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::ack_entries(int count)
+{
+	if(_cur_sector < 0 || _cur_block < 0 || count > _read_buff_count)
+		return RET_ERROR;
+
+	typename RingStore<TStruct>::Entry zeros;
+	memset(&zeros, 0, sizeof(zeros));
+
+	int first_slot = _cur_block * _store->_entries_per_block;
+
+	for(; _read_buff_acked < count; _read_buff_acked++)
+	{
+		if(esp_partition_write(_store->_partition,
+			_store->slot_addr(_cur_sector, first_slot + _read_buff_slot[_read_buff_acked]),
+			&zeros, sizeof(zeros)) != ESP_OK)
+		{
+			debug_println_e(F("Could not ack ring store entry."));
+			return RET_ERROR;
+		}
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Reset reader to enable re-iteration
+ ******************************************************************************/
+template <class TStruct>
+void RingStoreReader<TStruct>::reset()
+{
+	_sectors_visited = 0;
+	_cur_sector = -1;
+	_cur_block = -1;
+
+	reset_data_state();
+}
+
+/******************************************************************************
+ * Reset state of data iterator. Must be done every time a new block is selected
+ ******************************************************************************/
+template <class TStruct>
+RetResult RingStoreReader<TStruct>::reset_data_state()
+{
+	_block_loaded = false;
+	_read_buff_count = 0;
+	_read_buff_index = 0;
+	_read_buff_crc_valid = 0;
+	_read_buff_acked = 0;
+	_cur_entry = NULL;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Read current block with a single read, drop padding entries and check CRCs
+ * @return Number of entries read
+ ******************************************************************************/
+template <class TStruct>
+int RingStoreReader<TStruct>::fill_read_buffer()
+{
+	_block_loaded = true;
+	_read_buff_count = 0;
+	_read_buff_index = 0;
+	_read_buff_crc_valid = 0;
+	_read_buff_acked = 0;
+
+	int entries = _store->get_block_entries(_cur_block, _cur_sector_slots);
+	int first_slot = _cur_block * _store->_entries_per_block;
+
+	if(esp_partition_read(_store->_partition, _store->slot_addr(_cur_sector, first_slot),
+		_read_buff, entries * sizeof(_read_buff[0])) != ESP_OK)
+	{
+		debug_println_e(F("Could not read ring store block."));
+		return 0;
+	}
+
+	for(int i = 0; i < entries; i++)
+	{
+		if(is_padding(&_read_buff[i]))
+			continue;
+
+		if(i != _read_buff_count)
+			memcpy(&_read_buff[_read_buff_count], &_read_buff[i], sizeof(_read_buff[0]));
+
+		_read_buff_slot[_read_buff_count] = i;
+
+		if(Utils::crc32((uint8_t*)&_read_buff[_read_buff_count].data, sizeof(TStruct)) == _read_buff[_read_buff_count].crc32)
+			_read_buff_crc_valid |= (1UL << _read_buff_count);
+
+		_read_buff_count++;
+	}
+
+	return _read_buff_count;
+}
+
+/******************************************************************************
+ * Padding entries are all zeros. A real entry can't be, CRC32 of zeroed data is
+ * not zero.
+ ******************************************************************************/
+template <class TStruct>
+bool RingStoreReader<TStruct>::is_padding(const typename RingStore<TStruct>::Entry *entry)
+{
+	const uint8_t *bytes = (const uint8_t*)entry;
+
+	for(unsigned int i = 0; i < sizeof(*entry); i++)
+	{
+		if(bytes[i] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Define uses
+template class RingStoreReader<WaterSensorData::Entry>;
+#if FEATURE_ATMOS41
+template class RingStoreReader<Atmos41Data::Entry>;
+#endif
+#if FEATURE_SOIL_MOISTURE
+template class RingStoreReader<SoilMoistureData::Entry>;
+#endif
+template class RingStoreReader<Log::Entry>;
+template class RingStoreReader<FoData::StoreEntry>;
+#if FEATURE_LIGHTNING
+template class RingStoreReader<LightningData::Entry>;
+#endif
+template class RingStoreReader<EnergyProfileData::Entry>;
+template class RingStoreReader<SDI12Log::Entry>;
@@ -0,0 +1,44 @@
+#include "rollup_data.h"
+#include "common.h"
+
+namespace RollupData
+{
+	/** 
+	 * Store for rollups of evicted sensor data. Deleted oldest first by cleanup
+	 * like any other store, without being rolled up again
+	 */
+    DataStore<RollupData::Entry> store(ROLLUP_DATA_PATH, ROLLUP_DATA_ENTRIES_PER_SUBMIT_REQ);
+
+    /******************************************************************************
+    * Add rollup to store. Committed by Retention once a whole file is rolled up
+    ******************************************************************************/
+    RetResult add(RollupData::Entry *data)
+    {
+		return store.add(data);
+    }   
+
+    /******************************************************************************
+    * Get pointer to store (for use with reader)
+    ******************************************************************************/
+    DataStore<RollupData::Entry>* get_store()
+    {
+        return &store;
+    }
+
+    /********************************************************************************
+	 * Print a rollup
+	 * @param data Rollup structure
+	 *******************************************************************************/
+	void print(const RollupData::Entry *data)
+	{
+		debug_print(F("Timestamp: "));
+		debug_println(data->timestamp);
+
+		debug_printf("Store: %s, entries: %u\n", SENSOR_STORE_KEYS[data->store], data->count);
+
+		for(int i = 0; i < data->field_count; i++)
+		{
+			debug_printf("%d: %.2f (%.2f - %.2f)\n", i, data->mean[i], data->min[i], data->max[i]);
+		}
+	}
+}
@@ -2,6 +2,9 @@
 #include <Wire.h>
 #include <RtcDS3231.h>
 #include "Arduino.h"
+#include <esp_sleep.h>
+#include "esp_clk.h"
+#include "soc/rtc.h"
 #include "rtc.h"
 #include "gsm.h"
 #include "const.h"
@@ -9,6 +12,7 @@
 #include "log.h"
 #include "utils.h"
 #include "http_request.h"
+#include "device_config.h"
 #include "common.h"
 
 namespace RTC
@@ -29,11 +33,40 @@ namespace RTC
 
     bool _timechange_safety_enabled = true;
 
+    /** Sync postponed (eg. warm boot), done on next call home */
+    bool _sync_pending = false;
+
+    /** Drift model of the clock time is kept with, loaded on first use */
+    DeviceConfig::ClockModel _model;
+    bool _model_loaded = false;
+
+    /** Slow clock runs from DS3231 32K output (see init_slow_clock()) */
+    bool _slow_clock_ext = false;
+
+    /** Start of current slow clock calibration interval: ext RTC time and RTC ticks */
+    uint32_t _cal_ext_tstamp = 0;
+    uint64_t _cal_ticks = 0;
+
+    /** Measured slow clock period (us per tick). 0 until calibrated */
+    float _slow_clock_period = 0;
+
+    /** DS3231 alarm is set for the next wake up (see set_wakeup_alarm()) */
+    bool _alarm_set = false;
+
+    /** Last ext RTC temperature read and its tick (see get_external_rtc_temp()) */
+    float _temp_cache = 0;
+    uint32_t _temp_cache_tick = 0;
+    bool _temp_cache_valid = false;
+
     //
     // Private functions
     //
     void reset_drift_check();
     bool check_timechange_safe(uint32_t tstamp);
+    void load_clock_model();
+    void update_clock_model(uint32_t local_tstamp, uint32_t ref_tstamp);
+    void init_slow_clock();
+    void update_slow_clock_cal(uint32_t ext_rtc_tstamp);
 
     /******************************************************************************
      * Initialization
@@ -46,6 +79,11 @@ namespace RTC
             ret = init_external_rtc();
         }
 
+        if(ret == RET_OK)
+        {
+            init_slow_clock();
+        }
+
         reset_drift_check();
 
         return ret;
@@ -181,11 +219,18 @@ namespace RTC
             set_external_rtc_time(time(NULL));
         }
 
+        // Only network time is a reference good enough to learn drift from
+        if(ret == RET_OK && (time_source == TIME_SOURCE_HTTP || time_source == TIME_SOURCE_NTP))
+        {
+            update_clock_model(tstamp_before_sync, get_timestamp());
+        }
+
         // Log AFTER finishing so the log entry has the correct timestamp
         Log::log(Log::RTC_SYNC, tstamp_before_sync, time_source);
 
         // Keep track of last time sync, failed or not
         _last_sync_tick = millis();
+        _sync_pending = false;
 
         // Keep track of last set timestmap
         if(ret == RET_OK)
@@ -372,6 +417,12 @@ namespace RTC
 
         uint32_t ext_rtc_tstamp = _ext_rtc.GetDateTime().Epoch32Time();
 
+        if(tstamp_valid(ext_rtc_tstamp))
+        {
+            update_slow_clock_cal(ext_rtc_tstamp);
+            ext_rtc_tstamp = correct_timestamp(ext_rtc_tstamp);
+        }
+
         if(!check_timechange_safe(ext_rtc_tstamp))
         {
             debug_print(F("Got invalid timestamp from ext rtc: "));
@@ -442,7 +493,11 @@ namespace RTC
             _ext_rtc.SetIsRunning(true);
         }
 
+#ifdef BOARD_EXT_32K_CLOCK
+        _ext_rtc.Enable32kHzPin(true);
+#else
         _ext_rtc.Enable32kHzPin(false);
+#endif
         _ext_rtc.SetSquareWavePin(DS3231SquareWavePin_ModeNone); 
 
         debug_print(F("External RTC init complete. Time: "));
@@ -460,6 +515,10 @@ namespace RTC
         uint32_t secs_since_2000 = timestamp - SECONDS_IN_2000;
         
         _ext_rtc.SetDateTime(secs_since_2000);
+
+        // Calibration interval measured against old time is lost
+        _cal_ext_tstamp = 0;
+
         if(_ext_rtc.LastError() != 0)
         {
             debug_print(F("Could not set ext RTC time to: "));
@@ -526,6 +585,10 @@ namespace RTC
      *****************************************************************************/
     float get_external_rtc_temp()
     {
+        // Sensor converts every 64 secs, a forced conversion within that gives no new information
+        if(_temp_cache_valid && millis() - _temp_cache_tick < RTC_TEMP_CACHE_SECS * 1000)
+            return _temp_cache;
+
         // Force compensation update to force sensor to update temp
         _ext_rtc.ForceTemperatureCompensationUpdate(false);
 
@@ -533,7 +596,11 @@ namespace RTC
         // timeout and can freeze the system (A+ quality arduino libraries)
         delay(200);
 
-        return _ext_rtc.GetTemperature().AsFloatDegC();
+        _temp_cache = _ext_rtc.GetTemperature().AsFloatDegC();
+        _temp_cache_tick = millis();
+        _temp_cache_valid = true;
+
+        return _temp_cache;
     }
 
      /******************************************************************************
@@ -544,6 +611,381 @@ namespace RTC
         return _last_sync_tick;
     }
 
+    /******************************************************************************
+     * Postpone sync to next call home
+     *****************************************************************************/
+    void set_sync_pending()
+    {
+        _sync_pending = true;
+    }
+
+    /******************************************************************************
+     * Check if a postponed sync is due
+     *****************************************************************************/
+    bool is_sync_pending()
+    {
+        return _sync_pending;
+    }
+
+    /******************************************************************************
+     * Correct a timestamp of the clock time is kept with by the drift estimated
+     * since last network sync. Only ext RTC readings are corrected, system time is
+     * set from them.
+     *****************************************************************************/
+    uint32_t correct_timestamp(uint32_t tstamp)
+    {
+        load_clock_model();
+
+        if(!_model.ext_rtc || _model.samples == 0 || _model.last_sync_tstamp == 0 ||
+            tstamp <= _model.last_sync_tstamp)
+        {
+            return tstamp;
+        }
+
+        float correction = _model.drift_ppm * (tstamp - _model.last_sync_tstamp) / 1000000;
+
+        return tstamp + (int32_t)lroundf(correction);
+    }
+
+    /******************************************************************************
+     * Error the clock is expected to have gathered since last network sync (secs)
+     *****************************************************************************/
+    float get_predicted_error(uint32_t tstamp)
+    {
+        load_clock_model();
+
+        if(_model.last_sync_tstamp == 0 || tstamp <= _model.last_sync_tstamp)
+        {
+            return 0;
+        }
+
+        return _model.error_ppm * (tstamp - _model.last_sync_tstamp) / 1000000;
+    }
+
+    /******************************************************************************
+     * Check if a network sync is needed. True when there was none yet, the max
+     * auto sync interval passed or the predicted error exceeds the allowed one.
+     * Time is not checked by powering the modem, the drift model is used instead.
+     *****************************************************************************/
+    bool is_sync_needed()
+    {
+        load_clock_model();
+
+        uint32_t tstamp = get_timestamp();
+
+        if(!tstamp_valid(tstamp) || _model.last_sync_tstamp == 0 || tstamp < _model.last_sync_tstamp)
+        {
+            return true;
+        }
+
+        float error = get_predicted_error(tstamp);
+        debug_printf("RTC predicted error: %.2f secs\n", error);
+
+        return error >= RTC_AUTOSYNC_MAX_ERROR_SECS ||
+            tstamp - _model.last_sync_tstamp >= RTC_AUTOSYNC_MAX_INTERVAL_SECS;
+    }
+
+    /******************************************************************************
+     * Load clock model from NVS. A missing model or one of a different clock
+     * starts over with the default drift of the clock.
+     *****************************************************************************/
+    void load_clock_model()
+    {
+        if(_model_loaded)
+        {
+            return;
+        }
+
+        _model_loaded = true;
+
+        if(DeviceConfig::get_clock_model(&_model) == RET_OK && _model.ext_rtc == FLAGS.EXTERNAL_RTC_ENABLED)
+        {
+            return;
+        }
+
+        memset(&_model, 0, sizeof(_model));
+        _model.ext_rtc = FLAGS.EXTERNAL_RTC_ENABLED;
+        _model.error_ppm = _model.ext_rtc ? RTC_DRIFT_DEFAULT_EXT_RTC_PPM : RTC_DRIFT_DEFAULT_SYSTEM_PPM;
+    }
+
+    /******************************************************************************
+     * Update clock model on a network sync.
+     * Time steps of syncs are summed until the interval since anchor is long
+     * enough, then the drift over the interval updates the estimation. Ext RTC
+     * readings are already corrected, so what is measured is the drift left.
+     * @param local_tstamp Time before sync
+     * @param ref_tstamp Network time
+     *****************************************************************************/
+    void update_clock_model(uint32_t local_tstamp, uint32_t ref_tstamp)
+    {
+        load_clock_model();
+
+        if(!tstamp_valid(local_tstamp) || _model.last_sync_tstamp == 0 || ref_tstamp <= _model.anchor_tstamp)
+        {
+            // Nothing to measure against, start a new interval
+            _model.anchor_tstamp = ref_tstamp;
+            _model.anchor_offset = 0;
+        }
+        else
+        {
+            _model.anchor_offset += (int32_t)(ref_tstamp - local_tstamp);
+
+            uint32_t interval = ref_tstamp - _model.anchor_tstamp;
+            if(interval >= RTC_DRIFT_MIN_INTERVAL_SECS)
+            {
+                float measured_ppm = (float)_model.anchor_offset * 1000000 / interval;
+
+                if(_model.ext_rtc)
+                {
+                    // Drift left after correction
+                    _model.drift_ppm = _model.samples == 0 ? measured_ppm :
+                        _model.drift_ppm + RTC_DRIFT_GAIN * measured_ppm;
+                }
+                else
+                {
+                    // System time is not corrected, whole drift is measured
+                    _model.drift_ppm = _model.samples == 0 ? measured_ppm :
+                        _model.drift_ppm + RTC_DRIFT_GAIN * (measured_ppm - _model.drift_ppm);
+                }
+
+                _model.error_ppm += RTC_DRIFT_GAIN * (fabsf(measured_ppm) - _model.error_ppm);
+
+                if(_model.samples < UINT16_MAX)
+                {
+                    _model.samples++;
+                }
+
+                debug_printf_i("RTC drift: %.2f ppm, error: %.2f ppm\n", _model.drift_ppm, _model.error_ppm);
+                Log::log(Log::RTC_DRIFT_ESTIMATED, (int)(_model.drift_ppm * 1000), _model.anchor_offset);
+
+                _model.anchor_tstamp = ref_tstamp;
+                _model.anchor_offset = 0;
+            }
+        }
+
+        _model.last_sync_tstamp = ref_tstamp;
+
+        DeviceConfig::set_clock_model(&_model);
+    }
+
+    /******************************************************************************
+     * Switch the slow clock to DS3231 32K output on boards that have it wired to
+     * 32K_XN (BOARD_EXT_32K_CLOCK in board header). Sleep timer is then as accurate
+     * as the ext RTC and needs no calibration. Boards without it keep the RC slow
+     * clock, calibrated against the ext RTC (see update_slow_clock_cal()).
+     *****************************************************************************/
+    void init_slow_clock()
+    {
+#ifdef BOARD_EXT_32K_CLOCK
+        if(_slow_clock_ext)
+        {
+            return;
+        }
+
+        rtc_clk_32k_enable_external();
+
+        uint32_t cal = rtc_clk_cal(RTC_CAL_32K_XTAL, RTC_SLOW_CLOCK_CAL_CYCLES);
+        if(cal == 0)
+        {
+            debug_println_e(F("No 32K clock from ext RTC, keeping RC slow clock."));
+            rtc_clk_32k_enable(false);
+            return;
+        }
+
+        rtc_clk_slow_freq_set(RTC_SLOW_FREQ_32K_XTAL);
+        esp_clk_slowclk_cal_set(cal);
+        _slow_clock_ext = true;
+
+        debug_println_i(F("Slow clock from ext RTC 32K output."));
+#endif
+    }
+
+    /******************************************************************************
+     * Measure slow clock period against ext RTC. RTC ticks are compared with ext
+     * RTC time passed, once an interval of RTC_SLOW_CLOCK_CAL_INTERVAL_SECS passes.
+     * Ticks are used and not RTC time because time conversion uses the calibration
+     * done on each boot, which changes on every wake up from deep sleep.
+     * Called when ext RTC is read, so it costs no extra I2C transactions.
+     *****************************************************************************/
+    void update_slow_clock_cal(uint32_t ext_rtc_tstamp)
+    {
+        if(_slow_clock_ext)
+        {
+            return;
+        }
+
+        uint64_t ticks = rtc_time_get();
+
+        if(_cal_ext_tstamp == 0 || ext_rtc_tstamp < _cal_ext_tstamp || ticks < _cal_ticks)
+        {
+            _cal_ext_tstamp = ext_rtc_tstamp;
+            _cal_ticks = ticks;
+            return;
+        }
+
+        uint32_t interval = ext_rtc_tstamp - _cal_ext_tstamp;
+        if(interval < RTC_SLOW_CLOCK_CAL_INTERVAL_SECS)
+        {
+            return;
+        }
+
+        float period = (float)interval * 1000000 / (ticks - _cal_ticks);
+        float boot_period = (float)esp_clk_slowclk_cal_get() / (1 << RTC_CLK_CAL_FRACT);
+
+        _cal_ext_tstamp = ext_rtc_tstamp;
+        _cal_ticks = ticks;
+
+        // Ext RTC time changed in between or bad reading
+        if(fabsf(period / boot_period - 1) > RTC_SLOW_CLOCK_MAX_ERROR)
+        {
+            debug_printf_w("Slow clock calibration out of range: %.4f us\n", period);
+            return;
+        }
+
+        _slow_clock_period = _slow_clock_period == 0 ? period :
+            _slow_clock_period + RTC_SLOW_CLOCK_CAL_GAIN * (period - _slow_clock_period);
+
+        int error_ppm = (int)((_slow_clock_period / boot_period - 1) * 1000000);
+        debug_printf_i("Slow clock calibrated, error: %d ppm\n", error_ppm);
+        Log::log(Log::RTC_SLOW_CLOCK_CALIBRATED, error_ppm, interval);
+    }
+
+    /******************************************************************************
+     * Check if sleep duration can be trusted, either because the slow clock comes
+     * from the ext RTC or because it has been calibrated against it
+     *****************************************************************************/
+    bool is_slow_clock_calibrated()
+    {
+        return _slow_clock_ext || _slow_clock_period != 0;
+    }
+
+    /******************************************************************************
+     * Get value for esp_sleep_enable_timer_wakeup() so that the device sleeps for
+     * secs of ext RTC time. Sleep timer converts using boot calibration, scale it
+     * by the measured slow clock period.
+     *****************************************************************************/
+    uint64_t get_sleep_us(uint32_t secs)
+    {
+        uint64_t sleep_us = (uint64_t)secs * 1000000;
+
+        if(_slow_clock_ext || _slow_clock_period == 0)
+        {
+            return sleep_us;
+        }
+
+        float boot_period = (float)esp_clk_slowclk_cal_get() / (1 << RTC_CLK_CAL_FRACT);
+
+        return (uint64_t)(sleep_us * (double)(boot_period / _slow_clock_period));
+    }
+
+    /******************************************************************************
+     * Check if wake ups can be done by DS3231 alarm. Needs the INT/SQW pin wired
+     * to an RTC GPIO (PIN_EXT_RTC_INT in board header) with a pull-up, INT is
+     * open drain active low
+     *****************************************************************************/
+    bool wakeup_alarm_available()
+    {
+#ifdef PIN_EXT_RTC_INT
+        return FLAGS.EXTERNAL_RTC_ENABLED;
+#else
+        return false;
+#endif
+    }
+
+    /******************************************************************************
+     * Set DS3231 Alarm1 to wake up at tstamp. Alarm matches ext RTC time, so the
+     * drift correction of ext RTC readings is taken off. Wake up is immune to slow
+     * clock drift and needs no correction.
+     * @param tstamp System time to wake up at
+     *****************************************************************************/
+    RetResult set_wakeup_alarm(uint32_t tstamp)
+    {
+        _alarm_set = false;
+
+        if(!wakeup_alarm_available())
+        {
+            return RET_ERROR;
+        }
+
+        uint32_t ext_rtc_tstamp = tstamp - (correct_timestamp(tstamp) - tstamp);
+        RtcDateTime alarm_time(ext_rtc_tstamp - SECONDS_IN_2000);
+
+        DS3231AlarmOne alarm(alarm_time.Day(), alarm_time.Hour(), alarm_time.Minute(), alarm_time.Second(),
+            DS3231AlarmOneControl_HoursMinutesSecondsDayOfMonthMatch);
+
+        _ext_rtc.SetAlarmOne(alarm);
+        _ext_rtc.LatchAlarmsTriggeredFlags();
+        _ext_rtc.SetSquareWavePin(DS3231SquareWavePin_ModeAlarmOne);
+
+        if(_ext_rtc.LastError() != 0)
+        {
+            debug_println_e(F("Could not set ext RTC alarm."));
+            return RET_ERROR;
+        }
+
+        debug_printf("Ext RTC alarm set: %u\n", ext_rtc_tstamp);
+        _alarm_set = true;
+
+        return RET_OK;
+    }
+
+    /******************************************************************************
+     * Enable ext1 wake up on DS3231 alarm, if set. Called before any sleep,
+     * coexists with ext0 (eg. lightning IRQ) and timer wake ups
+     *****************************************************************************/
+    void enable_alarm_wakeup()
+    {
+#ifdef PIN_EXT_RTC_INT
+        if(_alarm_set)
+        {
+            esp_sleep_enable_ext1_wakeup(1ULL << PIN_EXT_RTC_INT, ESP_EXT1_WAKEUP_ALL_LOW);
+        }
+#endif
+    }
+
+    /******************************************************************************
+     * Clear DS3231 alarm after waking up, INT is released
+     * @return True if the alarm fired
+     *****************************************************************************/
+    bool clear_wakeup_alarm()
+    {
+        if(!_alarm_set)
+        {
+            return false;
+        }
+
+        _alarm_set = false;
+
+        DS3231AlarmFlag flags = _ext_rtc.LatchAlarmsTriggeredFlags();
+        _ext_rtc.SetSquareWavePin(DS3231SquareWavePin_ModeNone);
+
+        return (flags & DS3231AlarmFlag_Alarm1) != 0;
+    }
+
+    /******************************************************************************
+     * Save state before entering deep sleep
+     *****************************************************************************/
+    void save_state(RetainedState *state)
+    {
+        state->sync_pending = _sync_pending;
+        state->cal_ext_tstamp = _cal_ext_tstamp;
+        state->cal_ticks = _cal_ticks;
+        state->slow_clock_period = _slow_clock_period;
+        state->alarm_set = _alarm_set;
+    }
+
+    /******************************************************************************
+     * Restore state after waking up from deep sleep
+     *****************************************************************************/
+    void restore_state(const RetainedState *state)
+    {
+        _sync_pending = state->sync_pending;
+        _cal_ext_tstamp = state->cal_ext_tstamp;
+        _cal_ticks = state->cal_ticks;
+        _slow_clock_period = state->slow_clock_period;
+        _alarm_set = state->alarm_set;
+    }
+
     /******************************************************************************
     * Check timestamp for validity by comparing to a recent tstamp
     ******************************************************************************/
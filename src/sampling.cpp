@@ -0,0 +1,178 @@
+#include "sampling.h"
+#include "common.h"
+
+namespace Sampling
+{
+	//
+	// Private functions
+	//
+	float median(float vals[], int count);
+	void calc_stats(const float samples[], int count, float *median_out, float *mad_out);
+	float calc_outlier_bound(float mad, float tolerance);
+
+	/******************************************************************************
+	* Median of vals, sorts vals in place
+	******************************************************************************/
+	float median(float vals[], int count)
+	{
+		// Insertion sort, count is small
+		for(int i = 1; i < count; i++)
+		{
+			float val = vals[i];
+			int j = i - 1;
+			for(; j >= 0 && vals[j] > val; j--)
+				vals[j + 1] = vals[j];
+			vals[j + 1] = val;
+		}
+
+		if(count % 2)
+			return vals[count / 2];
+		return (vals[count / 2 - 1] + vals[count / 2]) / 2;
+	}
+
+	/******************************************************************************
+	* Calc median and median absolute deviation of samples
+	******************************************************************************/
+	void calc_stats(const float samples[], int count, float *median_out, float *mad_out)
+	{
+		float sorted[SAMPLING_MAX_SAMPLES];
+		memcpy(sorted, samples, count * sizeof(float));
+
+		float med = median(sorted, count);
+
+		for(int i = 0; i < count; i++)
+			sorted[i] = fabs(samples[i] - med);
+
+		*median_out = med;
+		*mad_out = median(sorted, count);
+	}
+
+	/******************************************************************************
+	* Max distance from median for a sample not to be an outlier. Never less than
+	* tolerance so quantized sources with MAD 0 don't reject neighbouring values
+	******************************************************************************/
+	float calc_outlier_bound(float mad, float tolerance)
+	{
+		float bound = SAMPLING_OUTLIER_MADS * SAMPLING_MAD_TO_STD_DEV * mad;
+		return bound > tolerance ? bound : tolerance;
+	}
+
+	/******************************************************************************
+	* Sample a source according to plan
+	* @param plan Sampling limits and convergence tolerance
+	* @param read Reads a single sample
+	* @param ctx Passed to read
+	* @param result Receives value and quality metrics
+	* @return RET_ERROR if not enough valid samples could be read
+	******************************************************************************/
+	RetResult run(const Plan *plan, ReadFunc read, void *ctx, Result *result)
+	{
+		float samples[SAMPLING_MAX_SAMPLES];
+		uint16_t max_samples = plan->max_samples < SAMPLING_MAX_SAMPLES ? plan->max_samples : SAMPLING_MAX_SAMPLES;
+		float bound = 0;
+
+		memset(result, 0, sizeof(Result));
+		result->status = STATUS_OK;
+
+		uint32_t start_ms = millis();
+
+		while(result->samples < max_samples)
+		{
+			if(plan->timeout_ms > 0 && millis() - start_ms >= plan->timeout_ms)
+			{
+				result->status = STATUS_TIMEOUT;
+				break;
+			}
+
+			float sample = 0;
+			if(!read(ctx, &sample))
+			{
+				if(plan->max_invalid > 0 && ++result->invalid >= plan->max_invalid)
+				{
+					result->status = STATUS_TOO_MANY_INVALID;
+					break;
+				}
+				continue;
+			}
+
+			samples[result->samples++] = sample;
+
+			// Check convergence once enough samples are in
+			if(plan->tolerance > 0 && result->samples >= plan->min_valid)
+			{
+				calc_stats(samples, result->samples, &result->median, &result->mad);
+
+				float std_err = SAMPLING_MAD_TO_STD_DEV * result->mad / sqrt(result->samples);
+				bound = calc_outlier_bound(result->mad, plan->tolerance);
+
+				int inliers = 0;
+				for(int i = 0; i < result->samples; i++)
+				{
+					if(fabs(samples[i] - result->median) <= bound)
+						inliers++;
+				}
+
+				if(std_err <= plan->tolerance && inliers >= plan->min_valid)
+				{
+					result->converged = true;
+					break;
+				}
+			}
+
+			if(plan->delay_ms > 0)
+				delay(plan->delay_ms);
+		}
+
+		result->elapsed_ms = millis() - start_ms;
+
+		if(result->status != STATUS_OK)
+			return RET_ERROR;
+
+		if(result->samples == 0)
+		{
+			result->status = STATUS_HIGH_FLUCTUATION;
+			return RET_ERROR;
+		}
+
+		//
+		// Average samples within outlier bounds
+		//
+		calc_stats(samples, result->samples, &result->median, &result->mad);
+		bound = calc_outlier_bound(result->mad, plan->tolerance);
+
+		float total = 0;
+		int inliers = 0;
+		for(int i = 0; i < result->samples; i++)
+		{
+			if(fabs(samples[i] - result->median) <= bound)
+			{
+				total += samples[i];
+				inliers++;
+			}
+		}
+
+		result->outliers = result->samples - inliers;
+
+		// Value is set even when there are too few inliers, as a best effort
+		if(inliers > 0)
+			result->value = total / inliers;
+
+		if(inliers == 0 || inliers < plan->min_valid)
+		{
+			result->status = STATUS_HIGH_FLUCTUATION;
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Print sampling result
+	******************************************************************************/
+	void print(const Result *result)
+	{
+		debug_printf("Sampled: %.2f, median: %.2f, MAD: %.2f, samples: %u, invalid: %u, outliers: %u, %s, %u ms\n",
+			result->value, result->median, result->mad, result->samples, result->invalid, result->outliers,
+			result->converged ? "converged" : "not converged", result->elapsed_ms);
+	}
+}
@@ -1,42 +1,85 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_SDI12
+
 #include "sdi12.h"
 #include "common.h"
 
 /******************************************************************************
 * Constructor
-* Set hw serial and rx/tx pin on construct
-* @param serial HW serial instance to use. Must be initiated externally
-*               and provided by user
+* Install UART driver once, with the data pin routed to both TX and RX and
+* both lines inverted as per the SDI12 standard
+* @param uart_num UART to use
 * @param data_pin Pin to use for data comm pin
 ******************************************************************************/
-Sdi12::Sdi12(int uart_num, gpio_num_t data_pin) : _serial(uart_num)
+Sdi12::Sdi12(int uart_num, gpio_num_t data_pin)
 {
+	_uart_num = (uart_port_t)uart_num;
 	_data_pin = data_pin;
+	_timeout_ms = RESPONSE_TIMEOUT_MS;
+
+	uart_config_t config = {};
+	config.baud_rate = BAUD_RATE;
+	config.data_bits = UART_DATA_7_BITS;
+	config.parity = UART_PARITY_EVEN;
+	config.stop_bits = UART_STOP_BITS_1;
+	config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+
+	uart_param_config(_uart_num, &config);
+	uart_set_pin(_uart_num, _data_pin, _data_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+	uart_set_line_inverse(_uart_num, UART_INVERSE_TXD | UART_INVERSE_RXD);
+
+	if(uart_driver_install(_uart_num, RX_BUFF_SIZE, 0, EVENT_QUEUE_SIZE, &_events, 0) != ESP_OK)
+	{
+		debug_println(F("Could not install SDI12 UART driver."));
+	}
+
+	// Every response ends with <CR><LF>
+	uart_enable_pattern_det_intr(_uart_num, '\n', 1, 9, 0, 0);
+	uart_pattern_queue_reset(_uart_num, EVENT_QUEUE_SIZE);
 
 	switch_to_rx();
 }
 
 /******************************************************************************
-* Switch serial to TX mode
+* Destructor
+* Remove UART driver
+******************************************************************************/
+Sdi12::~Sdi12()
+{
+	uart_driver_delete(_uart_num);
+	gpio_set_direction(_data_pin, gpio_mode_t::GPIO_MODE_DISABLE);
+}
+
+/******************************************************************************
+* Switch to TX mode. Enables the data pin output, UART stays routed to it
 ******************************************************************************/
 void Sdi12::switch_to_tx()
 {
     _state = STATE_TX;
 
-    // Restart UART with data pin set to TX and a dummy pin for RX
-    gpio_set_direction(_data_pin, gpio_mode_t::GPIO_MODE_DISABLE);
-    _serial.begin(BAUD_RATE, SERIAL_7E1, 999, _data_pin, true, UART_TIMEOUT_MS);
+    gpio_set_direction(_data_pin, gpio_mode_t::GPIO_MODE_INPUT_OUTPUT);
 }
 
 /******************************************************************************
-* Switch serial to RX mode
+* Switch to RX mode. Releases the data pin so the sensor can drive the line
 ******************************************************************************/
 void Sdi12::switch_to_rx()
 {
     _state = STATE_LISTENING;
 
-    // Restart UART with data pin set to RX and a dummy pin for TX
-    gpio_set_direction(_data_pin, gpio_mode_t::GPIO_MODE_DISABLE);
-    _serial.begin(BAUD_RATE, SERIAL_7E1, _data_pin, 999, true, UART_TIMEOUT_MS);
+    gpio_set_direction(_data_pin, gpio_mode_t::GPIO_MODE_INPUT);
+}
+
+/******************************************************************************
+* Send break followed by marking to wake up sensors. Idle TX is marking, with
+* TX inversion dropped the idle line goes high which is a break (spacing)
+******************************************************************************/
+void Sdi12::send_break()
+{
+	uart_set_line_inverse(_uart_num, UART_INVERSE_RXD);
+	delay(BREAK_MS);
+
+	uart_set_line_inverse(_uart_num, UART_INVERSE_TXD | UART_INVERSE_RXD);
+	delay(MARKING_MS);
 }
 
 /******************************************************************************
@@ -45,54 +88,245 @@ void Sdi12::switch_to_rx()
 ******************************************************************************/
 int Sdi12::available(void)
 {
-	return _serial.available();
+	size_t len = 0;
+	uart_get_buffered_data_len(_uart_num, &len);
+
+	return len;
 }
 
 /******************************************************************************
 * Read a byte from the rx buffer
-* @returns Number of bytes read, -1 if no data available
+* @returns Byte read, -1 if no data available
 ******************************************************************************/
 int Sdi12::read()
 {
 	if(_state != STATE_LISTENING)
 		switch_to_rx();
 
-	return _serial.read();
+	uint8_t c = 0;
+
+	if(uart_read_bytes(_uart_num, &c, 1, 0) != 1)
+		return -1;
+
+	return c;
 }
 
 /******************************************************************************
-* Read bytes from the rx buffer until a delimiter is found
-* @returns Number of bytes read
+* Read a whole response. Waits for the pattern detect event on the terminating
+* <LF>, so returns as soon as the response is complete
+* @param buffer Receives the response without <CR><LF>
+* @param length Size of buffer
+* @returns Number of bytes read, 0 on timeout
 ******************************************************************************/
-size_t Sdi12::readBytesUntil(char terminator, char *buffer, size_t length)
+size_t Sdi12::read_response(char *buffer, size_t length)
 {
 	if(_state != STATE_LISTENING)
 		switch_to_rx();
 
-	return _serial.readBytesUntil(terminator, buffer, length);
+	uint32_t t_start = millis();
+	uart_event_t event;
+
+	while(millis() - t_start < _timeout_ms)
+	{
+		uint32_t remaining_ms = _timeout_ms - (millis() - t_start);
+
+		if(xQueueReceive(_events, &event, pdMS_TO_TICKS(remaining_ms)) != pdTRUE)
+			break;
+
+		if(event.type != UART_PATTERN_DET)
+			continue;
+
+		// Position of <LF> in RX buffer, -1 if pattern queue overflowed
+		int pos = uart_pattern_pop_pos(_uart_num);
+		if(pos < 0)
+		{
+			flush();
+			continue;
+		}
+
+		size_t frame_len = pos + 1;
+		size_t bytes = frame_len < length ? frame_len : length;
+
+		bytes = uart_read_bytes(_uart_num, (uint8_t*)buffer, bytes, 0);
+
+		// Discard what did not fit
+		for(size_t i = bytes; i < frame_len; i++)
+			read();
+
+		// Strip <CR><LF>
+		while(bytes > 0 && (buffer[bytes - 1] == '\n' || buffer[bytes - 1] == '\r'))
+			bytes--;
+
+		return bytes;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+* Capture the DDI serial string some sensors (eg. Teros12) send right after
+* power up, when alone on the line. DDI is 1200 8N1 and not inverted, UART is
+* switched to it while capturing. Call right after powering the sensor up
+* @param buffer Receives the string, null terminated
+* @param length Size of buffer
+* @param timeout_ms Max time to wait for the string to start
+* @returns Number of bytes read, 0 on timeout
+******************************************************************************/
+size_t Sdi12::read_ddi(char *buffer, size_t length, unsigned long timeout_ms)
+{
+	if(_state != STATE_LISTENING)
+		switch_to_rx();
+
+	set_ddi_framing(true);
+	flush();
+
+	size_t bytes = 0;
+	uint32_t t_start = millis();
+	uint32_t t_last_rx = 0;
+
+	while(bytes < length - 1)
+	{
+		uint8_t c = 0;
+
+		if(uart_read_bytes(_uart_num, &c, 1, pdMS_TO_TICKS(5)) == 1)
+		{
+			buffer[bytes++] = c;
+			t_last_rx = millis();
+			continue;
+		}
+
+		// String ended
+		if(bytes > 0 && millis() - t_last_rx >= DDI_IDLE_MS)
+			break;
+
+		if(bytes == 0 && millis() - t_start >= timeout_ms)
+			break;
+	}
+
+	buffer[bytes] = '\0';
+
+	set_ddi_framing(false);
+	flush();
+
+	return bytes;
+}
+
+/******************************************************************************
+* Switch UART framing between DDI serial (8N1, not inverted) and SDI12 (7E1,
+* inverted)
+******************************************************************************/
+void Sdi12::set_ddi_framing(bool ddi)
+{
+	uart_set_word_length(_uart_num, ddi ? UART_DATA_8_BITS : UART_DATA_7_BITS);
+	uart_set_parity(_uart_num, ddi ? UART_PARITY_DISABLE : UART_PARITY_EVEN);
+	uart_set_line_inverse(_uart_num, ddi ? UART_INVERSE_DISABLE : UART_INVERSE_TXD | UART_INVERSE_RXD);
+}
+
+/******************************************************************************
+* Discard received data and pending events
+******************************************************************************/
+void Sdi12::flush()
+{
+	uart_flush_input(_uart_num);
+	uart_pattern_queue_reset(_uart_num, EVENT_QUEUE_SIZE);
+	xQueueReset(_events);
+}
+
+/******************************************************************************
+* Get data pin
+******************************************************************************/
+gpio_num_t Sdi12::get_data_pin()
+{
+	return _data_pin;
+}
+
+/******************************************************************************
+* Set timeout for reading a response
+******************************************************************************/
+void Sdi12::set_timeout(unsigned long timeout_ms)
+{
+	_timeout_ms = timeout_ms;
 }
 
 /******************************************************************************
-* Write an SDI12 command
+* Write an SDI12 command, preceded by break and marking
 * @returns Number of bytes written
 ******************************************************************************/
 size_t Sdi12::write_command(char *cmd)
 {
-	pinMode(_data_pin, OUTPUT);
-	digitalWrite(_data_pin, 1);
-	delay(20);
-	digitalWrite(_data_pin, 0);
-	delay(15);
-
 	switch_to_tx();
 
-	size_t ret = _serial.write(cmd);
-	_serial.flush();
-	_serial.end();
+	send_break();
+
+	int ret = uart_write_bytes(_uart_num, cmd, strlen(cmd));
+	uart_wait_tx_done(_uart_num, pdMS_TO_TICKS(_timeout_ms));
 
 	switch_to_rx();
 
-	return ret;
+	// Drop own transmission echoed on RX and break frame errors
+	flush();
+
+	return ret > 0 ? ret : 0;
+}
+
+/******************************************************************************
+* CRC-16/ARC (poly 0xA001 reflected) lookup table, one entry per byte value
+******************************************************************************/
+static const uint16_t CRC16_TABLE[256] =
+{
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+/** Powers of 10 to scale parsed mantissas, values have at most 9 digits */
+static const float POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+/******************************************************************************
+* Update CRC with a byte
+******************************************************************************/
+static inline uint16_t crc16_update(uint16_t crc, char c)
+{
+	return (crc >> 8) ^ CRC16_TABLE[(crc ^ (uint8_t)c) & 0xFF];
+}
+
+/******************************************************************************
+* Check CRC chars (3 chars, 6 bits each with 0x40 set) against a calculated CRC
+******************************************************************************/
+static bool crc_chars_match(const char *crc_chars, uint16_t crc)
+{
+	return crc_chars[0] == (char)(0x40 | (crc >> 12)) &&
+		crc_chars[1] == (char)(0x40 | ((crc >> 6) & 0x3F)) &&
+		crc_chars[2] == (char)(0x40 | (crc & 0x3F));
 }
 
 /******************************************************************************
@@ -105,49 +339,162 @@ bool Sdi12::check_crc(const char *buff)
 {
 	int data_length = strlen(buff);
 
-    debug_print(F("LEN: "));
-    debug_println(data_length, DEC);
-
-    debug_print(F("Checking CRC for: "));
-    debug_println(buff);
-
 	// No point in calculating CRC if there's no data
 	if(data_length < 4)
 		return false;
 
-	// Extract crc from string
-	char input_crc[4] = "";
-	strncpy(input_crc, (const char*)&buff[data_length-3], 3);
-	input_crc[3] = '\0';
+	uint16_t crc = 0;
 
-    debug_print(F("CRC: "));
-    debug_println(input_crc);
+	for(int i = 0; i < data_length - 3; i++)
+		crc = crc16_update(crc, buff[i]);
 
-	// Calculate
-	uint16_t calced_crc = 0;
+	return crc_chars_match(&buff[data_length - 3], crc);
+}
 
-	for (int i = 0; i < data_length - 3; i++)
+/******************************************************************************
+* Parse a data response (a<values><CRC>) in a single pass. Values in the signed
+* SDI12 format (eg. +1.23-4) are parsed directly into floats while the CRC is
+* calculated, without copies or allocations
+* @param buff		Response without <CR><LF>
+* @param address	Expected sensor address
+* @param values		Receives parsed values
+* @param max_vals	Size of values
+* @param count_out	Number of values found (output var)
+* @returns PARSE_OK, PARSE_CRC_FAIL, or PARSE_INVALID if response is malformed,
+*			address does not match or more than max_vals values found
+******************************************************************************/
+Sdi12::ParseResult Sdi12::parse_data(const char *buff, char address, float *values, uint8_t max_vals, uint8_t *count_out)
+{
+	*count_out = 0;
+
+	if(buff[0] != address)
+		return PARSE_INVALID;
+
+	uint16_t crc = crc16_update(0, buff[0]);
+	const char *p = &buff[1];
+	uint8_t count = 0;
+
+	while(*p == '+' || *p == '-')
 	{
-		calced_crc = buff[i] ^ calced_crc;
+		bool negative = *p == '-';
+		crc = crc16_update(crc, *p++);
 
-		for (int j = 1; j <= 8; j++)
+		uint32_t mantissa = 0;
+		int digits = 0;
+		// Digits after decimal point, -1 if no point yet
+		int decimals = -1;
+
+		while((*p >= '0' && *p <= '9') || (*p == '.' && decimals < 0))
 		{
-			if (calced_crc & 0x01)
+			if(*p == '.')
 			{
-				calced_crc = calced_crc >> 1;
-				calced_crc = 0xA001 ^ calced_crc;
+				decimals = 0;
 			}
 			else
 			{
-				calced_crc = calced_crc >> 1;
+				mantissa = mantissa * 10 + (*p - '0');
+				digits++;
+
+				if(decimals >= 0)
+					decimals++;
 			}
+
+			crc = crc16_update(crc, *p++);
+
+			if(digits > 9)
+				return PARSE_INVALID;
 		}
+
+		if(digits == 0)
+			return PARSE_INVALID;
+
+		if(count < max_vals)
+		{
+			float val = decimals > 0 ? mantissa / POW10[decimals] : mantissa;
+			values[count] = negative ? -val : val;
+		}
+
+		count++;
+	}
+
+	// Exactly 3 CRC chars must be left
+	for(int i = 0; i < 3; i++)
+	{
+		if(p[i] < 0x40)
+			return PARSE_INVALID;
+	}
+
+	if(p[3] != '\0')
+		return PARSE_INVALID;
+
+	if(!crc_chars_match(p, crc))
+		return PARSE_CRC_FAIL;
+
+	if(count > max_vals)
+		return PARSE_INVALID;
+
+	*count_out = count;
+
+	return PARSE_OK;
+}
+
+/******************************************************************************
+* Parse a DDI serial string: <TAB><value> <value> ...<CR><type><checksum>,
+* optionally followed by a CRC6 char. Checksum is the sum of all chars up to
+* and including the sensor type, mod 64, plus 32. Power up glitches before
+* <TAB> are skipped
+* @param buff		Captured string, null terminated
+* @param values		Receives parsed values
+* @param max_vals	Size of values
+* @param count_out	Number of values found (output var)
+* @returns PARSE_OK, PARSE_CRC_FAIL, or PARSE_INVALID if string is malformed
+*			or more than max_vals values found
+******************************************************************************/
+Sdi12::ParseResult Sdi12::parse_ddi(const char *buff, float *values, uint8_t max_vals, uint8_t *count_out)
+{
+	*count_out = 0;
+
+	const char *start = strchr(buff, '\t');
+	if(start == NULL)
+		return PARSE_INVALID;
+
+	const char *end = strchr(start, '\r');
+	// Sensor type and checksum must follow <CR>
+	if(end == NULL || end[1] == '\0' || end[2] == '\0')
+		return PARSE_INVALID;
+
+	uint32_t sum = 0;
+	for(const char *p = start; p <= &end[1]; p++)
+		sum += (uint8_t)*p;
+
+	if((char)(sum % 64 + 32) != end[2])
+		return PARSE_CRC_FAIL;
+
+	uint8_t count = 0;
+	const char *p = start + 1;
+
+	while(p < end)
+	{
+		char *parsed_end = NULL;
+		float val = strtof(p, &parsed_end);
+
+		if(parsed_end == p || parsed_end > end)
+			return PARSE_INVALID;
+
+		if(count >= max_vals)
+			return PARSE_INVALID;
+
+		values[count++] = val;
+
+		p = parsed_end;
+		while(p < end && *p == ' ')
+			p++;
 	}
 
-	char calced_crc_str[4] = "";
-	calced_crc_str[0] = 0x40 | (calced_crc >> 12);
-	calced_crc_str[1] = 0x40 | ((calced_crc >> 6) & 0x3F);
-	calced_crc_str[2] = 0x40 | (calced_crc & 0x3F);
+	if(count == 0)
+		return PARSE_INVALID;
 
-	return strcmp(input_crc, calced_crc_str) == 0;
-}
\ No newline at end of file
+	*count_out = count;
+
+	return PARSE_OK;
+}
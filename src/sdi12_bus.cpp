@@ -0,0 +1,174 @@
+#include "sdi12_bus.h"
+
+/******************************************************************************
+ * Constructor
+ * @param data_pin	SDI12 data pin shared by all sensors
+ * @param power_pin	Sensors power pin, held while waiting for measurements
+ *****************************************************************************/
+Sdi12Bus::Sdi12Bus(gpio_num_t data_pin, gpio_num_t power_pin) : _sensor(data_pin)
+{
+	_power_pin = power_pin;
+}
+
+/******************************************************************************
+ * Add a measurement request
+ * @param address		Sensor address
+ * @param values		Receives measured values
+ * @param max_values	Size of values
+ * @return RET_ERROR if too many requests or address already added
+ *****************************************************************************/
+RetResult Sdi12Bus::add(char address, float *values, uint8_t max_values)
+{
+	if(_request_count >= SDI12_BUS_MAX_REQUESTS)
+	{
+		debug_println(F("Too many SDI12 bus requests."));
+		return RET_ERROR;
+	}
+
+	// Concurrent measurements need a different address per sensor
+	for(int i = 0; i < _request_count; i++)
+	{
+		if(_requests[i].address == address)
+		{
+			debug_print(F("SDI12 address already requested: "));
+			debug_println(address);
+			return RET_ERROR;
+		}
+	}
+
+	Request *request = &_requests[_request_count++];
+
+	memset(request, 0, sizeof(Request));
+	request->address = address;
+	request->values = values;
+	request->max_values = max_values;
+	request->result = RET_ERROR;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Start all measurements concurrently, sleep once until the last one is ready
+ * and collect results. Awake time is the longest sensor wait instead of the sum
+ * of them. Check each request's result afterwards
+ * @return RET_ERROR if any request failed
+ *****************************************************************************/
+RetResult Sdi12Bus::measure()
+{
+	uint32_t t_last_ready_ms = millis();
+	int started = 0;
+
+	//
+	// Start measurements
+	//
+	for(int i = 0; i < _request_count; i++)
+	{
+		Request *request = &_requests[i];
+
+		uint16_t secs_to_wait = 0;
+		uint8_t vals = 0;
+
+		_sensor.set_address(request->address);
+
+		if(_sensor.measure_concurrent(&secs_to_wait, &vals) != RET_OK)
+		{
+			debug_print(F("Could not start measurement, address: "));
+			debug_println(request->address);
+			continue;
+		}
+
+		if(vals > request->max_values)
+		{
+			debug_printf("Too many values (%d) returned, address: %c\n", vals, request->address);
+			continue;
+		}
+
+		request->expected_values = vals;
+		request->t_ready_ms = millis() + (secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000;
+
+		// Later start may still be ready first
+		if((int32_t)(request->t_ready_ms - t_last_ready_ms) > 0)
+			t_last_ready_ms = request->t_ready_ms;
+
+		started++;
+	}
+
+	if(started == 0)
+		return RET_ERROR;
+
+	//
+	// Wait for the slowest sensor
+	//
+	int32_t wait_ms = t_last_ready_ms - millis();
+	if(wait_ms > 0)
+	{
+		// wait_measurement() adds SDI12_MEASURE_EXTRA_WAIT_SECS, already included
+		int wait_secs = (wait_ms + 999) / 1000 - SDI12_MEASURE_EXTRA_WAIT_SECS;
+		_sensor.wait_measurement(wait_secs > 0 ? wait_secs : 0, _power_pin, false);
+	}
+
+	//
+	// Collect
+	//
+	RetResult ret = RET_OK;
+
+	for(int i = 0; i < _request_count; i++)
+	{
+		if(_requests[i].t_ready_ms == 0 || collect(&_requests[i]) != RET_OK)
+			ret = RET_ERROR;
+	}
+
+	return ret;
+}
+
+/******************************************************************************
+ * Read all expected values of a started request (aD0! to aD9!)
+ *****************************************************************************/
+RetResult Sdi12Bus::collect(Request *request)
+{
+	_sensor.set_address(request->address);
+
+	for(uint8_t batch = 0; batch < 10 && request->count < request->expected_values; batch++)
+	{
+		uint8_t count = 0;
+		int tries = 3;
+
+		while(tries--)
+		{
+			if(_sensor.read_values(batch, &request->values[request->count], request->max_values - request->count, &count) == RET_OK)
+				break;
+
+			debug_printf("Could not get batch %d, address: %c\n", batch, request->address);
+			count = 0;
+		}
+
+		// Sensor has no more data
+		if(count == 0)
+			break;
+
+		request->count += count;
+	}
+
+	request->result = request->count == request->expected_values ? RET_OK : RET_ERROR;
+
+	return request->result;
+}
+
+/******************************************************************************
+ * Get number of requests added
+ *****************************************************************************/
+int Sdi12Bus::get_request_count()
+{
+	return _request_count;
+}
+
+/******************************************************************************
+ * Get request, NULL if index out of range
+ *****************************************************************************/
+const Sdi12Bus::Request* Sdi12Bus::get_request(int index)
+{
+	if(index < 0 || index >= _request_count)
+		return NULL;
+
+	return &_requests[index];
+}
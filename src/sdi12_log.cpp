@@ -1,6 +1,7 @@
 #include "sdi12_log.h"
 #include "utils.h"
 #include "rtc.h"
+#include "trace.h"
 #include "common.h"
 
 /******************************************************************************
@@ -8,41 +9,170 @@
  *****************************************************************************/
 namespace SDI12Log
 {
+	//
+	// Private types
+	//
+	/** Ring line header, followed by len chars without NUL */
+	struct LineHeader
+	{
+		/** millis() when recorded */
+		uint32_t ms;
+		uint8_t len;
+	} __attribute__((packed));
+
+	/** Measurements left to persist whatever their result. RTC_NOINIT memory
+	 * survives deep sleep and resets (but not power loss) */
+	struct PersistRequest
+	{
+		uint32_t magic;
+		int32_t measurements;
+		uint32_t crc32;
+	} __attribute__((packed));
+
+	//
+	// Private functions
+	//
+	void ring_write(const uint8_t *data, int len);
+	void ring_read(int pos, uint8_t *data, int len);
+	int get_persist_requested();
+	void set_persist_requested(int measurements);
+
+	//
+	// Private vars
+	//
 	DataStore<SDI12Log::Entry> store("/sdi12", 8);
 
+	/** Lines of the current measurement */
+	uint8_t _ring[SDI12_LOG_RING_SIZE];
+	int _ring_head = 0;
+	int _ring_used = 0;
+
+	/** Guards ring, jobs on other buses may record (see Acquisition) */
+	portMUX_TYPE _ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+	RTC_NOINIT_ATTR PersistRequest _persist_request;
+
 	/******************************************************************************
-	 * Add entry
+	 * Add a command or response to the ring, dropping oldest lines to fit it.
+	 * Lines are cut to fit an Entry
 	 *****************************************************************************/
-	RetResult add(char *response)
+	void record(const char *line)
 	{
-		// To prevent duplicate timestamps (as in Log)
-		static uint32_t _last_log_tstamp = 0;
-		static int _last_log_tstamp_counter = 0;
+		LineHeader header;
+		header.ms = millis();
+		header.len = strnlen(line, sizeof(Entry::response) - 1);
 
-		Entry entry = {0};
+		int size = sizeof(header) + header.len;
 
-		uint32_t cur_tstamp = RTC::get_timestamp();
-		entry.timestamp = cur_tstamp * 1000LL;	
+		portENTER_CRITICAL(&_ring_mux);
 
-		// If its not the first log within this second, add +1 mS to make sure TB doesn't overwrite
-		// its value (since TB uses the timestamp as the primary key for each record.)
-		if(cur_tstamp == _last_log_tstamp)
+		while(_ring_used + size > SDI12_LOG_RING_SIZE)
 		{
-			_last_log_tstamp_counter++;
-			entry.timestamp += _last_log_tstamp_counter;
+			// Oldest line starts at the tail
+			LineHeader oldest;
+			ring_read((_ring_head - _ring_used + SDI12_LOG_RING_SIZE) % SDI12_LOG_RING_SIZE, (uint8_t*)&oldest, sizeof(oldest));
+			_ring_used -= sizeof(oldest) + oldest.len;
 		}
-		else
+
+		ring_write((uint8_t*)&header, sizeof(header));
+		ring_write((const uint8_t*)line, header.len);
+
+		portEXIT_CRITICAL(&_ring_mux);
+	}
+
+	/******************************************************************************
+	 * Start the transcript of a measurement
+	 *****************************************************************************/
+	void begin_measurement()
+	{
+		portENTER_CRITICAL(&_ring_mux);
+		_ring_head = 0;
+		_ring_used = 0;
+		portEXIT_CRITICAL(&_ring_mux);
+	}
+
+	/******************************************************************************
+	 * End the transcript of a measurement, persisted if it failed, requested or
+	 * while detailed tracing is armed
+	 *****************************************************************************/
+	RetResult end_measurement(bool failed)
+	{
+		bool traced = Trace::is_armed();
+
+		if(!FLAGS.LOG_RAW_SDI12_COMMS && !traced)
+			return RET_OK;
+
+		int requested = get_persist_requested();
+
+		if(!failed && requested == 0 && !traced)
+			return RET_OK;
+
+		if(requested > 0)
+			set_persist_requested(requested - 1);
+
+		debug_println(failed ? F("Measurement failed, persisting SDI12 transcript.") : F("Persisting requested SDI12 transcript."));
+
+		return persist();
+	}
+
+	/******************************************************************************
+	 * Persist transcripts of the next measurements, failed or not (remote control)
+	 *****************************************************************************/
+	void request_persist(int measurements)
+	{
+		set_persist_requested(measurements > 0 ? measurements : 0);
+	}
+
+	/******************************************************************************
+	 * Add every line of the ring to the store, with a single commit
+	 *****************************************************************************/
+	RetResult persist()
+	{
+		// Copied out first, store writes can't run in a critical section
+		static uint8_t lines[SDI12_LOG_RING_SIZE];
+		int used = 0;
+
+		portENTER_CRITICAL(&_ring_mux);
+		used = _ring_used;
+		ring_read((_ring_head - _ring_used + SDI12_LOG_RING_SIZE) % SDI12_LOG_RING_SIZE, lines, used);
+		_ring_head = 0;
+		_ring_used = 0;
+		portEXIT_CRITICAL(&_ring_mux);
+
+		if(used == 0)
+			return RET_OK;
+
+		uint32_t now_ms = millis();
+		unsigned long long now_tstamp = RTC::get_timestamp() * 1000LL;
+
+		// TB uses the timestamp as the primary key of a record, keep them unique
+		unsigned long long last_tstamp = 0;
+
+		RetResult ret = RET_OK;
+
+		for(int pos = 0; pos < used;)
 		{
-			_last_log_tstamp_counter = 0;
-		}
+			LineHeader header;
+			memcpy(&header, lines + pos, sizeof(header));
+			pos += sizeof(header);
+
+			Entry entry = {0};
+			entry.timestamp = now_tstamp - (now_ms - header.ms);
+
+			if(entry.timestamp <= last_tstamp)
+				entry.timestamp = last_tstamp + 1;
 
-		_last_log_tstamp = cur_tstamp;	
+			last_tstamp = entry.timestamp;
 
-		// Populate response
-		strncpy(entry.response, response, sizeof(entry.response));
+			memcpy(entry.response, lines + pos, header.len);
+			pos += header.len;
 
-		RetResult ret = store.add(&entry);
-		store.commit();
+			if(store.add(&entry) != RET_OK)
+				ret = RET_ERROR;
+		}
+
+		if(store.commit() != RET_OK)
+			ret = RET_ERROR;
 
 		return ret;
 	}
@@ -71,4 +201,48 @@ namespace SDI12Log
 
 		Utils::print_separator(NULL);
 	}
-}
\ No newline at end of file
+
+	/******************************************************************************
+	 * Append to ring at head, must fit
+	 *****************************************************************************/
+	void ring_write(const uint8_t *data, int len)
+	{
+		for(int i = 0; i < len; i++)
+		{
+			_ring[_ring_head] = data[i];
+			_ring_head = (_ring_head + 1) % SDI12_LOG_RING_SIZE;
+		}
+
+		_ring_used += len;
+	}
+
+	/******************************************************************************
+	 * Read from ring, wrapping around its end
+	 *****************************************************************************/
+	void ring_read(int pos, uint8_t *data, int len)
+	{
+		for(int i = 0; i < len; i++)
+			data[i] = _ring[(pos + i) % SDI12_LOG_RING_SIZE];
+	}
+
+	/******************************************************************************
+	 * Measurements left to persist, 0 after power loss
+	 *****************************************************************************/
+	int get_persist_requested()
+	{
+		if(_persist_request.magic != SDI12_LOG_PERSIST_MAGIC ||
+			Utils::crc32((uint8_t*)&_persist_request, sizeof(_persist_request) - sizeof(_persist_request.crc32)) != _persist_request.crc32)
+		{
+			set_persist_requested(0);
+		}
+
+		return _persist_request.measurements;
+	}
+
+	void set_persist_requested(int measurements)
+	{
+		_persist_request.magic = SDI12_LOG_PERSIST_MAGIC;
+		_persist_request.measurements = measurements;
+		_persist_request.crc32 = Utils::crc32((uint8_t*)&_persist_request, sizeof(_persist_request) - sizeof(_persist_request.crc32));
+	}
+}
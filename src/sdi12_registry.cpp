@@ -0,0 +1,252 @@
+#include <Preferences.h>
+#include "sdi12_registry.h"
+#include "sdi12_sensor.h"
+#include "water_sensors.h"
+#include "common.h"
+#include "utils.h"
+#include "log.h"
+#include "power_control.h"
+
+namespace Sdi12Registry
+{
+	//
+	// Private vars
+	//
+
+	// Maps aI! vendor and model fields to a model. Fields are matched as prefixes
+	struct ModelId
+	{
+		Model model;
+		const char *vendor;
+		const char *model_id;
+	};
+
+	const ModelId MODEL_IDS[] =
+	{
+		{MODEL_AQUATROLL400, "In-Situ", "AT400"},
+		{MODEL_AQUATROLL500, "In-Situ", "AT500"},
+		{MODEL_AQUATROLL600, "In-Situ", "AT600"},
+		{MODEL_ATMOS41, "METER", "ATM41"},
+		{MODEL_TEROS12, "METER", "TER12"}
+	};
+
+	/** Currently loaded registry */
+	Data _data = {0};
+
+	/** Preferences api store */
+	Preferences _prefs;
+
+	//
+	// Private functions
+	//
+	RetResult load();
+	RetResult commit();
+	Model match_model(const char *id);
+
+	/******************************************************************************
+	* Load registry from NVS. Empty registry if none stored yet
+	******************************************************************************/
+	RetResult init()
+	{
+		if(load() != RET_OK)
+		{
+			memset(&_data, 0, sizeof(_data));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Scan bus for sensors and identify them. Powers sensors on while scanning.
+	* Addresses 0-9 are acknowledged one by one. If none responds, ?! finds a
+	* single sensor at any other address. Registry is stored if changed
+	******************************************************************************/
+	RetResult discover()
+	{
+		Data found = {0};
+
+		PowerControl::acquire(PowerControl::DEVICE_SDI12_BUS);
+
+		Sdi12Sensor sensor(PIN_SDI12_DATA);
+		sensor.set_timeout(SDI12_DISCOVERY_TIMEOUT_MS);
+
+		for(char address = '0'; address <= '9' && found.count < SDI12_REGISTRY_MAX_SENSORS; address++)
+		{
+			sensor.set_address(address);
+
+			if(sensor.acknowledge() == RET_OK)
+				found.sensors[found.count++].address = address;
+		}
+
+		char address = 0;
+		if(found.count == 0 && sensor.query_address(&address) == RET_OK)
+			found.sensors[found.count++].address = address;
+
+		// Identify
+		int models = 0;
+
+		for(int i = 0; i < found.count; i++)
+		{
+			Sensor *entry = &found.sensors[i];
+
+			sensor.set_address(entry->address);
+
+			if(sensor.identify(entry->id, sizeof(entry->id)) == RET_OK)
+				entry->model = match_model(entry->id);
+
+			models |= 1 << entry->model;
+		}
+
+		PowerControl::release(PowerControl::DEVICE_SDI12_BUS);
+
+		Log::log(Log::SDI12_SENSORS_DISCOVERED, found.count, models);
+
+		// Nothing changed, do not wear NVS
+		if(found.count == _data.count && memcmp(found.sensors, _data.sensors, sizeof(found.sensors)) == 0)
+			return RET_OK;
+
+		_data = found;
+
+		print();
+
+		return commit();
+	}
+
+	/******************************************************************************
+	* Get number of sensors in registry
+	******************************************************************************/
+	int get_count()
+	{
+		return _data.count;
+	}
+
+	/******************************************************************************
+	* Get sensor, NULL if index out of range
+	******************************************************************************/
+	const Sensor* get(int index)
+	{
+		if(index < 0 || index >= _data.count)
+			return NULL;
+
+		return &_data.sensors[index];
+	}
+
+	/******************************************************************************
+	* Find first sensor of a model, NULL if none discovered
+	******************************************************************************/
+	const Sensor* find(Model model)
+	{
+		for(int i = 0; i < _data.count; i++)
+		{
+			if(_data.sensors[i].model == model)
+				return &_data.sensors[i];
+		}
+
+		return NULL;
+	}
+
+	/******************************************************************************
+	* Get bus address of a model. '0' if not discovered, single sensor setups
+	* keep working without discovery
+	******************************************************************************/
+	char get_address(Model model)
+	{
+		const Sensor *sensor = find(model);
+
+		return sensor != NULL ? sensor->address : '0';
+	}
+
+	/******************************************************************************
+	* Print registry
+	******************************************************************************/
+	void print()
+	{
+		Utils::print_separator(F("SDI12 Sensors"));
+
+		for(int i = 0; i < _data.count; i++)
+		{
+			debug_printf("Address: %c - Model: %d - Id: %s\n", _data.sensors[i].address,
+				_data.sensors[i].model, _data.sensors[i].id);
+		}
+
+		Utils::print_separator(NULL);
+	}
+
+	/******************************************************************************
+	* Match aI! response to a known model
+	* Format: llccccccccmmmmmmvvv.. (address already removed)
+	******************************************************************************/
+	Model match_model(const char *id)
+	{
+		// Vendor and model fields
+		if(strlen(id) < 16)
+			return MODEL_UNKNOWN;
+
+		const char *vendor = &id[2];
+		const char *model_id = &id[10];
+
+		for(int i = 0; i < sizeof(MODEL_IDS) / sizeof(MODEL_IDS[0]); i++)
+		{
+			if(strncmp(vendor, MODEL_IDS[i].vendor, strlen(MODEL_IDS[i].vendor)) == 0 &&
+				strncmp(model_id, MODEL_IDS[i].model_id, strlen(MODEL_IDS[i].model_id)) == 0)
+			{
+				return MODEL_IDS[i].model;
+			}
+		}
+
+		return MODEL_UNKNOWN;
+	}
+
+	/******************************************************************************
+	* Load registry from NVS and check CRC
+	******************************************************************************/
+	RetResult load()
+	{
+		if(!_prefs.begin(SDI12_REGISTRY_NVS_NAMESPACE_NAME, true))
+			return RET_ERROR;
+
+		Data data;
+		size_t bytes = _prefs.getBytes(SDI12_REGISTRY_NVS_NAMESPACE_NAME, &data, sizeof(data));
+
+		_prefs.end();
+
+		if(bytes != sizeof(data))
+			return RET_ERROR;
+
+		uint32_t crc32 = data.crc32;
+		data.crc32 = 0;
+
+		if(Utils::crc32((uint8_t*)&data, sizeof(data)) != crc32 || data.count > SDI12_REGISTRY_MAX_SENSORS)
+		{
+			debug_println_e(F("SDI12 registry CRC error."));
+			return RET_ERROR;
+		}
+
+		data.crc32 = crc32;
+		_data = data;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* Write registry to NVS
+	******************************************************************************/
+	RetResult commit()
+	{
+		if(!_prefs.begin(SDI12_REGISTRY_NVS_NAMESPACE_NAME))
+		{
+			debug_println(F("Could not begin SDI12 registry NVS store."));
+			return RET_ERROR;
+		}
+
+		_data.crc32 = 0;
+		_data.crc32 = Utils::crc32((uint8_t*)&_data, sizeof(_data));
+
+		size_t bytes = _prefs.putBytes(SDI12_REGISTRY_NVS_NAMESPACE_NAME, &_data, sizeof(_data));
+
+		_prefs.end();
+
+		return bytes == sizeof(_data) ? RET_OK : RET_ERROR;
+	}
+}
@@ -1,6 +1,12 @@
+#include <esp_sleep.h>
+#include <driver/gpio.h>
 #include "sdi12_sensor.h"
 #include "app_config.h"
 #include "sdi12_log.h"
+#include "energy_profiler.h"
+#include "trace.h"
+#include "acquisition.h"
+#include "capture.h"
 
 /******************************************************************************
  * Default constructor (private)
@@ -15,13 +21,20 @@ Sdi12Sensor::Sdi12Sensor(gpio_num_t data_pin) : _sdi12(SDI12_UART_NUM, data_pin)
 }
 
 /******************************************************************************
-* Read whole response (until \r) into buffer. Times out if no response.
-* Removes \r charcater and replaces with \0
+* Read whole response (until <CR><LF>) into buffer. Times out if no response.
+* Removes <CR><LF> and terminates with \0
 * @return Number of bytes read or 0 on timeout or failure
 ******************************************************************************/
 size_t Sdi12Sensor::read_response()
 {
-    size_t bytes = _sdi12.readBytesUntil('\r', _buff, sizeof(_buff));
+    size_t bytes = _sdi12.read_response(_buff, sizeof(_buff));
+
+    // Transaction from command written to response read
+    if(_cmd_start_us != 0)
+    {
+        Trace::record(Trace::SPAN_SDI12, _cmd_start_us);
+        _cmd_start_us = 0;
+    }
 
     // Put string termination at the end of the response
     if(bytes > sizeof(_buff) - 1)
@@ -33,6 +46,8 @@ size_t Sdi12Sensor::read_response()
         _buff[bytes] = '\0';
     }
 
+    Capture::record(Capture::KIND_SDI12_RESP, _buff, strlen(_buff), bytes > 0);
+
     #ifdef DEBUG
         debug_print(F("SDI12 response: "));
         if(bytes == 0)
@@ -45,10 +60,10 @@ size_t Sdi12Sensor::read_response()
         }
     #endif
 
-	// Log comms if enabled in config
-	if(FLAGS.LOG_RAW_SDI12_COMMS)
+	// Log comms if enabled in config or tracing
+	if(FLAGS.LOG_RAW_SDI12_COMMS || Trace::is_armed())
 	{
-		SDI12Log::add(_buff);
+		SDI12Log::record(_buff);
 	}	
 
 
@@ -66,11 +81,15 @@ size_t Sdi12Sensor::write_command(char *cmd)
     #endif
 
 	// Log comms if enabled in config
-	if(FLAGS.LOG_RAW_SDI12_COMMS)
+	if(FLAGS.LOG_RAW_SDI12_COMMS || Trace::is_armed())
 	{
-		SDI12Log::add(cmd);
+		SDI12Log::record(cmd);
 	}	
 
+    Capture::record(Capture::KIND_SDI12_CMD, cmd, strlen(cmd), true);
+
+    _cmd_start_us = Trace::now_us();
+
     return _sdi12.write_command(cmd);
 }
 
@@ -79,18 +98,41 @@ size_t Sdi12Sensor::write_command(char *cmd)
  * Sensor responds with time to wait until measurement results are ready
  *****************************************************************************/
 RetResult Sdi12Sensor::measure(uint16_t *secs_to_wait, uint8_t *measurement_vals)
+{
+	return start_measurement("MC", "%c%3d%1d", secs_to_wait, measurement_vals);
+}
+
+/******************************************************************************
+ * Send concurrent measure command with CRC (aCC!)
+ * Sensor responds with time to wait until measurement results are ready. Other
+ * sensors on the bus can be started while this one measures. No service request
+ * is sent when data is ready
+ *****************************************************************************/
+RetResult Sdi12Sensor::measure_concurrent(uint16_t *secs_to_wait, uint8_t *measurement_vals)
+{
+	return start_measurement("CC", "%c%3d%2d", secs_to_wait, measurement_vals);
+}
+
+/******************************************************************************
+ * Send a measurement start command and parse the response
+ * @param cmd 			Command without address and terminator (eg. "MC")
+ * @param parse_format	Response format: address, seconds, number of values
+ *****************************************************************************/
+RetResult Sdi12Sensor::start_measurement(const char *cmd, const char *parse_format, uint16_t *secs_to_wait, uint8_t *measurement_vals)
 {
     set_last_error(ERROR_NONE);
 
 	// Address parsed from response
 	// // All responses contain the SDI12 device address as the first char
-	int addr = 0;
+	char addr = 0;
 	// // Number of vals parsed from response
 	int vals = 0;
 
 	// // Request measurement start
-    write_command("0MC!");
-	delay(SDI12_COMMAND_WAIT_TIME_MS);
+	char cmd_buff[8] = "";
+	snprintf(cmd_buff, sizeof(cmd_buff), "%c%s!", _address, cmd);
+
+    write_command(cmd_buff);
 	
     if(read_response() == 0)
     {
@@ -99,12 +141,12 @@ RetResult Sdi12Sensor::measure(uint16_t *secs_to_wait, uint8_t *measurement_vals
     }
 
 	// // Parse response.
-	// Response format must be ABBBC
+	// Response format must be ABBBC (or ABBBCC for concurrent)
 	// BBB: seconds to wait
 	// C: number of measurements to be returned
 	int response_secs = 0, response_vals = 0;
 
-	vals = sscanf(_buff, "%1d%3d%1d", &addr, &response_secs, &response_vals);
+	vals = sscanf(_buff, parse_format, &addr, &response_secs, &response_vals);
 
 	// // Must be exactly 3 vals
 	if(vals != 3)
@@ -118,10 +160,10 @@ RetResult Sdi12Sensor::measure(uint16_t *secs_to_wait, uint8_t *measurement_vals
 
 	// // Validate vals
 	// // Check address
-	if(addr != 0)
+	if(addr != _address)
 	{
 		debug_print("Invalid address value, expected: ");
-		debug_println(addr);
+		debug_println(_address);
 
 		set_last_error(ERROR_INVALID_RESPONSE);
 
@@ -134,6 +176,106 @@ RetResult Sdi12Sensor::measure(uint16_t *secs_to_wait, uint8_t *measurement_vals
 	return RET_OK;
 }
 
+/******************************************************************************
+ * Wait for measurement results after measure(). Light sleeps instead of busy
+ * waiting, with the sensor power pin held so the sensor stays on. Wakes up
+ * early on the service request (a<CR><LF>) the sensor sends when data is ready.
+ * Waits awake, polling for the service request, while other measurement jobs
+ * run (see Acquisition::can_light_sleep())
+ * @param secs_to_wait	Seconds to wait returned by measure()
+ * @param power_pin		Sensor power pin, held while sleeping
+ * @param service_request_wakeup Wake up on service request. Concurrent
+ *						measurements (aC!) do not send one
+ * @return True if woken up by a service request before the wait was over
+ *****************************************************************************/
+bool Sdi12Sensor::wait_measurement(uint16_t secs_to_wait, gpio_num_t power_pin, bool service_request_wakeup)
+{
+	uint32_t wait_ms = (secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000;
+	uint32_t t_start = millis();
+	bool service_request = false;
+
+	debug_print(F("Waiting (sec): "));
+	debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
+
+	// Line idles low (inverted UART), start bit of the service request pulls it high
+	gpio_num_t data_pin = _sdi12.get_data_pin();
+
+	bool light_sleep = Acquisition::can_light_sleep();
+
+	Serial.flush();
+
+	gpio_hold_en(power_pin);
+
+	if(service_request_wakeup)
+	{
+		gpio_wakeup_enable(data_pin, GPIO_INTR_HIGH_LEVEL);
+		esp_sleep_enable_gpio_wakeup();
+	}
+
+	while(millis() - t_start < wait_ms)
+	{
+		// Other measurement jobs running, wait awake
+		if(!light_sleep)
+		{
+			delay(ACQUISITION_WAIT_POLL_MS);
+
+			if(service_request_wakeup && _sdi12.available() > 0)
+			{
+				delay(SDI12_SERVICE_REQUEST_DRAIN_MS);
+				service_request = true;
+				break;
+			}
+
+			continue;
+		}
+
+		esp_sleep_enable_timer_wakeup((uint64_t)(wait_ms - (millis() - t_start)) * 1000);
+		EnergyProfiler::light_sleep();
+
+		esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
+
+		// Other pins can wake up on GPIO too (eg. FO continuous RX), a service
+		// request leaves bytes on the bus
+		if(wakeup_cause == ESP_SLEEP_WAKEUP_GPIO)
+		{
+			delay(SDI12_SERVICE_REQUEST_DRAIN_MS);
+
+			if(_sdi12.available() > 0)
+			{
+				service_request = true;
+				break;
+			}
+		}
+		// Woken up by another source (eg. lightning IRQ), it could keep waking
+		// us up, wait the rest of the time awake
+		else if(wakeup_cause != ESP_SLEEP_WAKEUP_TIMER)
+		{
+			uint32_t elapsed_ms = millis() - t_start;
+
+			if(elapsed_ms < wait_ms)
+				delay(wait_ms - elapsed_ms);
+		}
+	}
+
+	if(service_request_wakeup)
+	{
+		gpio_wakeup_disable(data_pin);
+		esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+	}
+	esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+	gpio_hold_dis(power_pin);
+
+	if(service_request)
+	{
+		debug_printf("Service request after %d ms\n", millis() - t_start);
+
+		// Discard service request, it only tells data is ready
+		_sdi12.flush();
+	}
+
+	return service_request;
+}
+
 /******************************************************************************
  * Request measurement results from sensor (aDx!), check CRC and parse into variables
  * @param adapter       SDI12Adapter to use
@@ -144,16 +286,6 @@ RetResult Sdi12Sensor::measure(uint16_t *secs_to_wait, uint8_t *measurement_vals
  *****************************************************************************/
 RetResult Sdi12Sensor::read_measurement_data(uint8_t batch, float *o1, float *o2, float *o3)
 {
-	set_last_error(ERROR_NONE);
-
-	// Expected response format
-	// aadr+val1+val2+val3
-	const char *parse_format = "%1d%f%f%f";
-	// Parsed device address
-	uint8_t addr = 0;
-	// Parsed vals
-	float d1 = 0, d2 = 0, d3 = 0;
-
 	// Number of vars to expect
 	// If less than this count parsed, abort
 	uint8_t var_count = 0;
@@ -167,58 +299,246 @@ RetResult Sdi12Sensor::read_measurement_data(uint8_t batch, float *o1, float *o2
 
 	debug_printf("Getting batch %d - Vars: %d\n", batch, var_count);
 
-	//
-	// Request data
-	//
-	char cmd[10] = "";
+	// Parsed vals
+	float d[3] = {0};
+	uint8_t count = 0;
+
+	if(read_values(batch, d, sizeof(d) / sizeof(d[0]), &count) != RET_OK)
+		return RET_ERROR;
+
+	// // Check var count. If not expected amount of vars, abort
+	if(count != var_count)
+	{
+		debug_println("Could not parse response.");
+
+		set_last_error(ERROR_INVALID_RESPONSE);
+		
+		return RET_ERROR;
+	}
+
+	// All ok
+	if(o1 != nullptr) *o1 = d[0];
+	if(o2 != nullptr) *o2 = d[1];
+	if(o3 != nullptr) *o3 = d[2];
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Request measurement results from sensor (aDx!) and parse any number of values
+ * into out. CRC is checked while parsing (see Sdi12::parse_data)
+ * @param batch			0 indexed batch number (0-9)
+ * @param out			Receives the values
+ * @param max_vals		Size of out
+ * @param count_out		Number of values parsed (output var)
+ * @return RET_ERROR if no data received, could not parse or crc failure
+ *****************************************************************************/
+RetResult Sdi12Sensor::read_values(uint8_t batch, float *out, uint8_t max_vals, uint8_t *count_out)
+{
+	return request_values("D", batch, out, max_vals, count_out);
+}
+
+/******************************************************************************
+ * Read continuous measurement values with CRC (aRCx!). Sensors supporting it
+ * keep these up to date while powered, no measure command or wait is needed
+ * @param index			0 indexed continuous measurement (0-9)
+ * @param out			Receives the values
+ * @param max_vals		Size of out
+ * @param count_out		Number of values parsed (output var)
+ * @return RET_ERROR if no data received, could not parse or crc failure
+ *****************************************************************************/
+RetResult Sdi12Sensor::read_continuous(uint8_t index, float *out, uint8_t max_vals, uint8_t *count_out)
+{
+	return request_values("RC", index, out, max_vals, count_out);
+}
+
+/******************************************************************************
+ * Send a value request command and parse the values in the response
+ * @param cmd_name	Command without address, index and terminator (eg. "D")
+ *****************************************************************************/
+RetResult Sdi12Sensor::request_values(const char *cmd_name, uint8_t index, float *out, uint8_t max_vals, uint8_t *count_out)
+{
+	set_last_error(ERROR_NONE);
+
+	*count_out = 0;
 
-	snprintf(cmd, sizeof(cmd), "0D%d!", batch);
+	char cmd[10] = "";
+	snprintf(cmd, sizeof(cmd), "%c%s%d!", _address, cmd_name, index);
 
 	write_command(cmd);
-	delay(SDI12_COMMAND_WAIT_TIME_MS);
-	read_response();
 
-	if(!_sdi12.check_crc(_buff))
+	if(read_response() == 0)
 	{
-		debug_println("Response failed CRC check.");
+		set_last_error(ERROR_NO_RESPONSE);
+		return RET_ERROR;
+	}
 
-		set_last_error(ERROR_CRC_FAIL);
+	switch(Sdi12::parse_data(_buff, _address, out, max_vals, count_out))
+	{
+		case Sdi12::PARSE_OK:
+			return RET_OK;
+		case Sdi12::PARSE_CRC_FAIL:
+			debug_println("Response failed CRC check.");
+			set_last_error(ERROR_CRC_FAIL);
+			return RET_ERROR;
+		default:
+			debug_println("Could not parse response.");
+			set_last_error(ERROR_INVALID_RESPONSE);
+			return RET_ERROR;
+	}
+}
+
+/******************************************************************************
+ * Capture and parse the DDI serial string the sensor sends on power up, instead
+ * of a measure cycle. Only when the sensor is alone on the bus and must be
+ * called right after powering it (see Sdi12::read_ddi)
+ * @param out			Receives the values
+ * @param max_vals		Size of out
+ * @param count_out		Number of values parsed (output var)
+ * @param timeout_ms	Max time to wait for the string
+ * @return RET_ERROR if nothing received, could not parse or checksum failure
+ *****************************************************************************/
+RetResult Sdi12Sensor::read_ddi(float *out, uint8_t max_vals, uint8_t *count_out, unsigned long timeout_ms)
+{
+	set_last_error(ERROR_NONE);
 
+	*count_out = 0;
+
+	if(_sdi12.read_ddi(_buff, sizeof(_buff), timeout_ms) == 0)
+	{
+		set_last_error(ERROR_NO_RESPONSE);
 		return RET_ERROR;
 	}
 
-	// Parse data
-	uint8_t vals = sscanf(_buff, parse_format, &addr, &d1, &d2, &d3);
+	switch(Sdi12::parse_ddi(_buff, out, max_vals, count_out))
+	{
+		case Sdi12::PARSE_OK:
+			return RET_OK;
+		case Sdi12::PARSE_CRC_FAIL:
+			debug_println("DDI string failed checksum.");
+			set_last_error(ERROR_CRC_FAIL);
+			return RET_ERROR;
+		default:
+			debug_println("Could not parse DDI string.");
+			set_last_error(ERROR_INVALID_RESPONSE);
+			return RET_ERROR;
+	}
+}
+
+/******************************************************************************
+ * Check if a sensor responds at the address (a!)
+ *****************************************************************************/
+RetResult Sdi12Sensor::acknowledge()
+{
+	set_last_error(ERROR_NONE);
 
-	// // Check response dev address and var count. If not expected amount of vars, abort
-	if(addr != 0 || vals != (var_count + 1))
+	char cmd[4] = "";
+	snprintf(cmd, sizeof(cmd), "%c!", _address);
+
+	write_command(cmd);
+
+	if(read_response() == 0)
 	{
-		debug_println("Could not parse response.");
+		set_last_error(ERROR_NO_RESPONSE);
+		return RET_ERROR;
+	}
 
+	if(_buff[0] != _address)
+	{
 		set_last_error(ERROR_INVALID_RESPONSE);
-		
 		return RET_ERROR;
 	}
 
+	return RET_OK;
+}
 
-	// debug_print(F("Parsed: "));
-	// if(o1 != nullptr)
-	// 	debug_printf("%f - ", d1);
-	// if(o2 != nullptr)
-	// 	debug_printf("%f - ", d2);
-	// if(o3 != nullptr)
-	// 	debug_printf("%f", d3);
+/******************************************************************************
+ * Query address of the sensor on the bus (?!). Only reliable with a single
+ * sensor on the bus, responses of more sensors collide
+ *****************************************************************************/
+RetResult Sdi12Sensor::query_address(char *address_out)
+{
+	set_last_error(ERROR_NONE);
 
-	// debug_println();
+	write_command("?!");
 
-	// All ok
-	if(o1 != nullptr) *o1 = d1;
-	if(o2 != nullptr) *o2 = d2;
-	if(o3 != nullptr) *o3 = d3;
+	if(read_response() == 0)
+	{
+		set_last_error(ERROR_NO_RESPONSE);
+		return RET_ERROR;
+	}
+
+	// Exactly one address char expected
+	if(strlen(_buff) != 1 || !isalnum(_buff[0]))
+	{
+		set_last_error(ERROR_INVALID_RESPONSE);
+		return RET_ERROR;
+	}
+
+	*address_out = _buff[0];
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Send identification command (aI!)
+ * Response format: allccccccccmmmmmmvvvxxx..
+ * ll: SDI12 version, cccccccc: vendor, mmmmmm: model, vvv: sensor version,
+ * xxx..: optional (eg. serial number)
+ * @param id_out	Receives the response without the address
+ * @param size		Size of id_out
+ *****************************************************************************/
+RetResult Sdi12Sensor::identify(char *id_out, size_t size)
+{
+	set_last_error(ERROR_NONE);
+
+	char cmd[4] = "";
+	snprintf(cmd, sizeof(cmd), "%cI!", _address);
+
+	write_command(cmd);
+
+	if(read_response() == 0)
+	{
+		set_last_error(ERROR_NO_RESPONSE);
+		return RET_ERROR;
+	}
+
+	if(_buff[0] != _address)
+	{
+		set_last_error(ERROR_INVALID_RESPONSE);
+		return RET_ERROR;
+	}
+
+	strncpy(id_out, &_buff[1], size - 1);
+	id_out[size - 1] = '\0';
 
 	return RET_OK;
 }
 
+/******************************************************************************
+ * Set response timeout
+ *****************************************************************************/
+void Sdi12Sensor::set_timeout(unsigned long timeout_ms)
+{
+	_sdi12.set_timeout(timeout_ms);
+}
+
+/******************************************************************************
+ * Set sensor address used in commands ('0'-'9', 'a'-'z', 'A'-'Z')
+ *****************************************************************************/
+void Sdi12Sensor::set_address(char address)
+{
+	_address = address;
+}
+
+/******************************************************************************
+ * Get sensor address
+ *****************************************************************************/
+char Sdi12Sensor::get_address()
+{
+	return _address;
+}
+
 /******************************************************************************
  * Get last received data from adater (for debug)
  *****************************************************************************/
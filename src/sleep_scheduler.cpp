@@ -1,17 +1,28 @@
+#define LOG_MODULE_LEVEL LOG_LEVEL_SLEEP_SCHEDULER
+
 #include <HardwareSerial.h>
 #include <esp_sleep.h>
+#include <esp_system.h>
 #include "sleep_scheduler.h"
 #include "common.h"
 #include "const.h"
 #include "app_config.h"
 #include "struct.h"
 #include "log.h"
+#include "store_registry.h"
 #include "device_config.h"
 #include "battery.h"
+#include "power_governor.h"
+#include "energy_profiler.h"
 #include "rtc.h"
 #include "fo_sniffer.h"
 #include "fo_uart.h"
 #include "fo_data.h"
+#include "deep_sleep.h"
+#include "trace.h"
+#include "water_presence.h"
+#include "adaptive_sampling.h"
+#include "backlog_drain.h"
 
 namespace SleepScheduler
 {
@@ -26,25 +37,104 @@ namespace SleepScheduler
 	uint32_t _t_last_wakeup_ms = 0;
 
 	/** Millis of last time events were set to be handled
-	 *  Used to calculate missed events.
+	 *  Used to calculate awake time.
 	 */
 	uint32_t _t_last_event_ms = 0;
 
 	/** Reasons of last wake up event */
 	int _last_wakeup_reasons = 0;
 
+	/** Seconds the device was supposed to sleep on last sleep */
+	int _sleep_secs = 0;
+
+	/** Woke up from deep sleep, next sleep_to_next() returns to handle wake up reasons */
+	bool _resumed = false;
+
+	/** Deadline queue, sorted by due time (earliest first) */
+	Deadline _deadlines[MAX_TASKS];
+
+	/** Tasks in queue */
+	int _deadline_count = 0;
+
+	/** Due time of the wake up the device is sleeping to. Tasks due by then fire on a
+	 * timer wake up, other wake ups (eg. lightning IRQ) leave them pending */
+	uint32_t _planned_due = 0;
+
+	/** Wake ups saved by coalescing nearby events since last SLEEP log */
+	int _saved_wakeups = 0;
+
+	/** Call home pulled forward on store backlog: when it runs and where the
+	 * regular one was (0 when none pending) */
+	uint32_t _pulled_call_home_due = 0;
+	uint32_t _pulled_call_home_grid_due = 0;
+
+	/** Call home offset from the interval grid set by remote control, -1 for MAC derived */
+	int _call_home_phase_secs = -1;
+	bool _call_home_phase_loaded = false;
+
+	/** Call homes pulled forward on the day (days since epoch) */
+	uint16_t _pulled_call_home_day = 0;
+	uint8_t _pulled_call_homes = 0;
+
+	/** Time deferrable work was first held back since it last ran, 0 if not deferred */
+	uint32_t _deferred_since[WORK_COUNT] = {0};
+
+	const uint32_t DEFERRAL_DEADLINES[] = {
+		[WORK_OTA] = DEFERRAL_DEADLINE_OTA_SECS,
+		[WORK_BACKLOG] = DEFERRAL_DEADLINE_BACKLOG_SECS,
+		[WORK_COMPACTION] = DEFERRAL_DEADLINE_COMPACTION_SECS
+	};
+
+	static_assert(sizeof(DEFERRAL_DEADLINES) / sizeof(DEFERRAL_DEADLINES[0]) == WORK_COUNT, "Deadline for every work");
+
+	/** Tier of the wake up being handled, and when it woke up (0 when not timed) */
+	WakeTier _wake_tier = TIER_CALL_HOME;
+	int64_t _wake_start_us = 0;
+
+	const Trace::SpanId TIER_SPANS[] = {
+		[TIER_FO] = Trace::SPAN_WAKE_FO,
+		[TIER_SENSOR] = Trace::SPAN_WAKE_SENSOR,
+		[TIER_CALL_HOME] = Trace::SPAN_WAKE_CALL_HOME
+	};
+
 	//
 	// Private functions
 	//
+	void on_wakeup();
+	WakeTier tier_of(int reasons);
+	void update_schedule_tasks(uint32_t t_now_sec, const WakeupScheduleEntry schedule[]);
+	void update_fo_task(uint32_t t_now_sec);
+	void update_backlog_call_home(uint32_t t_now_sec);
+	float sim_drain_mah(float ma, uint32_t secs);
+	int fire_due_tasks(uint32_t t_sec, int *missed_out);
+	uint32_t plan_wakeup(int *reasons_out, int *saved_out);
+	uint16_t get_reason_tolerance(WakeupReason reason);
+	Deadline* find_task(uint16_t id);
+	void sort_deadlines();
+	void print_deadlines(uint32_t t_now_sec);
 	RetResult get_current_schedule(SleepScheduler::WakeupScheduleEntry *schedule_out);
 	RetResult decide_schedule(SleepScheduler::WakeupScheduleEntry schedule_out[]);
-	int calc_secs_to_event(uint32_t t_now_sec, int event_interval_secs);
+	int calc_secs_to_event(uint32_t t_now_sec, int event_interval_secs, int phase_secs = 0);
+	int get_reason_phase(WakeupReason reason, int interval_secs);
 
 	/******************************************************************************
-	* Decide minutes to sleep and go to sleep
+	* Find next deadline and go to sleep
 	******************************************************************************/
 	RetResult sleep_to_next()
 	{
+		if(_resumed)
+		{
+			_resumed = false;
+			return RET_OK;
+		}
+
+		// Wake up handled
+		if(_wake_start_us > 0)
+		{
+			Trace::record(TIER_SPANS[_wake_tier], _wake_start_us);
+			_wake_start_us = 0;
+		}
+
 		// Sleep time will be calculated using this timestamp as a reference
 		uint32_t t_now_sec = RTC::get_timestamp();
 
@@ -56,18 +146,37 @@ namespace SleepScheduler
 		Battery::print_mode();
 		print_schedule(schedule);
 
-		//
-		// If call home event missed because of another event that took too long to finish,
-		// set as event and return to execute immediately
-		//
+		// Tasks fired on previous wake up have been handled, one-shot tasks are done
+		for(int i = 0; i < _deadline_count; )
+		{
+			if(_deadlines[i].fired && _deadlines[i].interval_secs == 0)
+			{
+				remove_task(_deadlines[i].id);
+				continue;
+			}
+
+			_deadlines[i].fired = false;
+			i++;
+		}
+
+		update_schedule_tasks(t_now_sec, schedule);
+		update_fo_task(t_now_sec);
+
+		if(FLAGS.BACKLOG_CALL_HOME)
+			update_backlog_call_home(t_now_sec);
+
 		int awake_ms = _t_last_event_ms == 0 ? 0 : (millis() - _t_last_event_ms);
 		int awake_sec = awake_ms / 1000;
 
-		int missed_reasons = check_missed_reasons(schedule, t_now_sec - awake_sec, awake_sec);
-		missed_reasons = missed_reasons & ~_last_wakeup_reasons;
-
-		if(missed_reasons != 0)
+		//
+		// Tasks already due became due while handling the previous wake up (eg. call home
+		// took too long). Fire and return to handle immediately
+		//
+		if(_deadline_count > 0 && _deadlines[0].due <= t_now_sec)
 		{
+			int missed = 0;
+			int missed_reasons = fire_due_tasks(t_now_sec, &missed);
+
 			debug_println_e("=====================================================");
 			debug_print_i(F("Missed events found, handling immediately: "));
 			debug_println_i(missed_reasons, DEC);
@@ -76,33 +185,44 @@ namespace SleepScheduler
 			_last_wakeup_reasons = missed_reasons;
 			_t_last_event_ms = millis();
 
-			Log::log(Log::WAKEUP_EVENTS_MISSED, missed_reasons);
+			_wake_tier = tier_of(missed_reasons);
+			_wake_start_us = Trace::now_us();
+
+			Log::log(Log::WAKEUP_EVENTS_MISSED, missed_reasons, missed);
 
 			// Return to handle
 			return RET_OK;
 		}
 
-		//
-		// Calc next wake up for all events except FO sniffer
-		//
-
 		// Keep var before its changed, to use it in log later
 		int prev_last_wakeup_reasons = _last_wakeup_reasons;
 
 		// Output var
-		int next_event_seconds_left = 0;
-		RetResult ret = calc_next_wakeup(t_now_sec, schedule, &next_event_seconds_left, &_last_wakeup_reasons);
+		int next_event_seconds_left = MAX_SLEEP_TIME_SEC;
+		_last_wakeup_reasons = 0;
 
-		// Temp for debug
-		// Log::log(Log::CALCULATING_SLEEP, t_now_sec, RTC::get_external_rtc_timestamp()); 
-
-		if(ret != RET_OK)
+		if(_deadline_count == 0)
 		{
 			Utils::serial_style(STYLE_RED);
 			debug_println(F("Could not calculate wake up time!"));
-			Log::log(Log::SLEEP_COULD_NOT_CALC_WAKEUP_TIME, t_now_sec, next_event_seconds_left);
+			Log::log(Log::SLEEP_COULD_NOT_CALC_WAKEUP_TIME, t_now_sec, 0);
 			Utils::serial_style(STYLE_RESET);
-		}	
+
+			_planned_due = t_now_sec + next_event_seconds_left;
+		}
+		else
+		{
+			int saved = 0;
+
+			_planned_due = plan_wakeup(&_last_wakeup_reasons, &saved);
+			next_event_seconds_left = _planned_due - t_now_sec;
+			_saved_wakeups += saved;
+
+			if(saved > 0)
+				debug_printf("Coalesced wake ups: %d\n", saved);
+		}
+
+		print_deadlines(t_now_sec);
 
 		RTC::print_time();
 
@@ -130,7 +250,11 @@ namespace SleepScheduler
 
 		// If going to sleep from FO wake up only (no other reasons), do not log
 		if(prev_last_wakeup_reasons != SleepScheduler::REASON_FO)
-			Log::log(Log::SLEEP, awake_sec, next_event_seconds_left);
+		{
+			int saved_wakeups = _saved_wakeups > 0xFF ? 0xFF : _saved_wakeups;
+			Log::log(Log::SLEEP, awake_sec, next_event_seconds_left | (saved_wakeups << 24));
+			_saved_wakeups = 0;
+		}
 
 		// Force max sleep time (fail safe)
 		if(next_event_seconds_left > MAX_SLEEP_TIME_SEC)
@@ -142,15 +266,91 @@ namespace SleepScheduler
 		// Sleep
 		//
 		_t_last_sleep = RTC::get_timestamp();	
+		_sleep_secs = next_event_seconds_left;
+
+		// Store energy summary when day changed
+		EnergyProfiler::update();
+
+		// Write config changed during this cycle and buffered logs to flash before sleeping
+		DeviceConfig::commit();
+		Log::commit();
 
 		Serial.flush();
+
+		// Does not return, boot continues with resume()
+		// Scaled by slow clock calibration, so a single sleep lasts as long as planned
+		uint64_t sleep_us = RTC::get_sleep_us(next_event_seconds_left);
+
+		// DS3231 alarm wakes up at the exact time, timer is only the fallback
+		if(RTC::wakeup_alarm_available() && RTC::set_wakeup_alarm(_planned_due) == RET_OK)
+			sleep_us = RTC::get_sleep_us(next_event_seconds_left + SLEEP_ALARM_FALLBACK_SEC);
+
+		if(DeepSleep::allowed(next_event_seconds_left))
+			DeepSleep::start(sleep_us, DeepSleep::SOURCE_SLEEP_SCHEDULER);
 		
-		esp_sleep_enable_timer_wakeup((uint64_t)next_event_seconds_left * 1000000);
-		esp_light_sleep_start();
+		esp_sleep_enable_timer_wakeup(sleep_us);
+		RTC::enable_alarm_wakeup();
+		WaterPresence::arm_wakeup(false);
 
-		//
-		// Wake up
-		//
+		if(FoSniffer::continuous_rx_active())
+			FoSniffer::arm_rx_wakeup();
+
+		int64_t sleep_start_us = Trace::now_us();
+
+		EnergyProfiler::light_sleep();
+
+		// Woken up by an FO frame, queued by the RX task. Sleep again for the rest
+		// of the time unless the queue needs decoding or water presence changed
+		while(FoSniffer::continuous_rx_active() && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO &&
+			!WaterPresence::level_changed())
+		{
+			FoSniffer::wait_rx_serviced();
+
+			int secs_left = (int)(_planned_due - RTC::get_timestamp());
+
+			if(FoSniffer::rx_queue_half_full() || secs_left <= 0)
+				break;
+
+			esp_sleep_enable_timer_wakeup(RTC::get_sleep_us(secs_left));
+			RTC::enable_alarm_wakeup();
+			WaterPresence::arm_wakeup(false);
+			FoSniffer::arm_rx_wakeup();
+			EnergyProfiler::light_sleep();
+		}
+
+		Trace::record(Trace::SPAN_SLEEP, sleep_start_us);
+
+		on_wakeup();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Continue after waking up from deep sleep (see DeepSleep). Handles wake up
+	 * like after a light sleep, next sleep_to_next() returns right away so
+	 * wake up reasons are handled
+	 *****************************************************************************/
+	RetResult resume()
+	{
+		on_wakeup();
+
+		_resumed = true;
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Wake up from main sleep
+	 *****************************************************************************/
+	void on_wakeup()
+	{
+		_wake_start_us = Trace::now_us();
+
+		// Reasons planned on sleep. Woken up late, more may fire below
+		WakeTier planned_tier = tier_of(_last_wakeup_reasons);
+
+		// Woken up by DS3231 alarm, at the planned time
+		bool alarm_wakeup = RTC::clear_wakeup_alarm() && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1;
 
 		//
 		// ESP32 internal clock drifts, calculate how much time left for actual wakeup time and sleep again
@@ -159,13 +359,16 @@ namespace SleepScheduler
 		// How much time were we supposed to sleep?
 		// supposed - slept = more sleep time
 		// Calculated using timestamp from external RTC
-		if(FLAGS.EXTERNAL_RTC_ENABLED)
+		// Not needed once the slow clock is calibrated (or from ext RTC), sleep was
+		// already scaled to last as planned
+		// FO wake ups don't need it, the sniffer listens ahead of the packet anyway
+		if(FLAGS.EXTERNAL_RTC_ENABLED && !RTC::is_slow_clock_calibrated() && !alarm_wakeup && planned_tier > TIER_FO)
 		{
 			int t_wakeup = RTC::get_external_rtc_timestamp();
 
 			if(RTC::tstamp_valid(_t_last_sleep) && RTC::tstamp_valid(t_wakeup))
 			{
-				int underslept_secs = next_event_seconds_left - (t_wakeup - _t_last_sleep);
+				int underslept_secs = _sleep_secs - (t_wakeup - _t_last_sleep);
 				if(underslept_secs > 0 && underslept_secs <= MAX_SLEEP_CORRECTION_SEC)
 				{
 					debug_print(F("Slept at: "));
@@ -180,8 +383,8 @@ namespace SleepScheduler
 
 					Serial.flush();
 					esp_sleep_enable_timer_wakeup((uint64_t)underslept_secs * 1000000);
-					esp_light_sleep_start();
-					Serial.println(F("Woke up from correction."));
+					EnergyProfiler::light_sleep();
+					debug_println(F("Woke up from correction."));
 					Serial.flush();
 				}
 				else
@@ -202,8 +405,33 @@ namespace SleepScheduler
 		// Keep track of last time events were calculated and function returned to let them be handled
 		_t_last_event_ms = millis();
 
-		// ESP32 RTC drifts, sync internal RTC from external on every wake up
-		RTC::sync_time_from_ext_rtc();
+		// ESP32 RTC drifts, sync internal RTC from external on every wake up but FO
+		// ones, time is only checked against the next sniff then
+		if(planned_tier > TIER_FO)
+			RTC::sync_time_from_ext_rtc();
+
+		// Fire tasks planned for this wake up, also the ones that became due if woken
+		// up late. Otherwise (eg. lightning IRQ) they stay pending for next sleep
+		if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER || alarm_wakeup)
+		{
+			uint32_t t_now_sec = RTC::get_timestamp();
+			_last_wakeup_reasons = fire_due_tasks(t_now_sec > _planned_due ? t_now_sec : _planned_due, NULL);
+		}
+		// Continuous RX queue needs decoding
+		else if(FoSniffer::continuous_rx_active() && FoSniffer::rx_queue_half_full())
+		{
+			_last_wakeup_reasons = REASON_FO;
+		}
+		else
+		{
+			_last_wakeup_reasons = 0;
+		}
+
+		_wake_tier = tier_of(_last_wakeup_reasons);
+
+		// More than FO became due while waking up
+		if(planned_tier == TIER_FO && _wake_tier > TIER_FO)
+			RTC::sync_time_from_ext_rtc();
 
 		// If woke up for FO only (no other reasons), do not log wake up event, increase wakeup counter instead
 		if(_last_wakeup_reasons == SleepScheduler::REASON_FO)
@@ -213,92 +441,251 @@ namespace SleepScheduler
 		else
 			Log::log(Log::WAKEUP, _last_wakeup_reasons);
 
+		if(_wake_tier == TIER_FO)
+		{
+			debug_println(F("Waking up for FO."));
+			return;
+		}
+
 		Utils::serial_style(STYLE_YELLOW);
 		Utils::print_block(F("Waking up!"));
 		RTC::print_time();
 		Utils::serial_style(STYLE_RESET);
+	}
 
-		return RET_OK;
+	/******************************************************************************
+	 * Tier of a wake up for its reasons. No reasons (eg. lightning IRQ) is a
+	 * sensor wake up
+	 *****************************************************************************/
+	WakeTier tier_of(int reasons)
+	{
+		if(reasons & REASON_CALL_HOME)
+			return TIER_CALL_HOME;
+
+		if(reasons == REASON_FO && FLAGS.TIERED_WAKE)
+			return TIER_FO;
+
+		return TIER_SENSOR;
 	}
 
 	/******************************************************************************
-	* Calculate minutes left until next wake up event in the schedule, if current
-	* time is t. Outputs seconds left to nearest wakeup and events occurring at that
-	* time
-	* @param t_now_sec  Current time in seconds
-	* @schedule         Schedule to use for calculation
-	* @schedule_len     Size of wake up schedule array
-	* @seconds_left		Seconds to next event (output var)
-	* @event_reasons	Reasons of next event (output var)
+	 * Tier of the wake up being handled
+	 *****************************************************************************/
+	WakeTier get_wake_tier()
+	{
+		return _wake_tier;
+	}
+
+	/******************************************************************************
+	* Calculate seconds left to event from t_now_sec
+	* @param phase_secs Events are at this offset from the interval grid
 	******************************************************************************/
-	RetResult calc_next_wakeup(uint32_t t_now_sec, const WakeupScheduleEntry schedule[], int *seconds_left, int *event_reasons)
+	int calc_secs_to_event(uint32_t t_now_sec, int event_interval_secs, int phase_secs)
 	{
-		//
-		// Iterate schedule and find the closest reason to current time
-		//
-		// Seconds to nearest event
-		int min_seconds_to_event = 0;
-		// Nearest event interval seconds
-		int min_interval_secs = 0;
+		const int SECONDS_IN_DAY = 86400;
 
-		// All reasons occurring at that time
-		int reasons = 0;
+		if(event_interval_secs < 1)
+		{
+			return -1;
+		}
 
-		for(int i = 0; i < WAKEUP_SCHEDULE_LEN; i++)
+		// Grid shifted by phase
+		t_now_sec -= phase_secs;
+
+		// Current second from the start of this day
+		int cur_sec_in_day = t_now_sec - ((t_now_sec / SECONDS_IN_DAY) * SECONDS_IN_DAY);
+
+		int seconds_to_event = 0;
+
+		// No more events in this day for this reason
+		// Next event at the start of next hour
+		if(cur_sec_in_day >= SECONDS_IN_DAY - event_interval_secs)
+		{
+			seconds_to_event = SECONDS_IN_DAY - cur_sec_in_day;
+		}
+		else
 		{
-			WakeupScheduleEntry entry = schedule[i];
+			// Calculate next wakeup for this reason
+			seconds_to_event = ((cur_sec_in_day / event_interval_secs + 1) * event_interval_secs) - cur_sec_in_day;
+		}
 
-			int wakeup_int = entry.wakeup_int;
+		return seconds_to_event;
+	}
 
-			// Ignore events where interval is 0
-			if(wakeup_int == 0)
+	/******************************************************************************
+	 * Add a task to the deadline queue, or update it if a task with the same id
+	 * exists
+	 * @param id WakeupReason bit, or TASK_ID_CUSTOM and up for ad-hoc tasks
+	 * @param due Timestamp (sec) the task is due
+	 * @param interval_secs Repeat interval from the due time, 0 for a one-shot task
+	 * @param handler Run by run_tasks() when fired. NULL for wake up reasons
+	 * @param tolerance_secs How late the task may run to share a wake up with others
+	 *****************************************************************************/
+	RetResult add_task(uint16_t id, uint32_t due, int interval_secs, TaskHandler handler, uint16_t tolerance_secs)
+	{
+		Deadline *task = find_task(id);
+
+		if(task == NULL)
+		{
+			if(_deadline_count >= MAX_TASKS)
 			{
-				//printf("Event %d ignored because frequency is out of range: %d\n", entry.reason, wakeup_int);
-				continue;
+				debug_println_e(F("Deadline queue full."));
+				return RET_ERROR;
 			}
 
+			task = &_deadlines[_deadline_count++];
+			task->id = id;
+			task->fired = false;
+		}
+
+		task->due = due;
+		task->interval_secs = interval_secs < 0 ? 0 : interval_secs;
+		task->handler = handler;
+		task->tolerance_secs = tolerance_secs;
+
+		sort_deadlines();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Remove task from deadline queue
+	 *****************************************************************************/
+	void remove_task(uint16_t id)
+	{
+		Deadline *task = find_task(id);
+
+		if(task == NULL)
+			return;
+
+		int index = task - _deadlines;
+
+		memmove(&_deadlines[index], &_deadlines[index + 1], (_deadline_count - index - 1) * sizeof(Deadline));
+		_deadline_count--;
+	}
+
+	/******************************************************************************
+	 * Get earliest deadline, NULL if queue is empty
+	 *****************************************************************************/
+	const Deadline* get_next_deadline()
+	{
+		return _deadline_count > 0 ? &_deadlines[0] : NULL;
+	}
+
+	/******************************************************************************
+	 * Run handlers of ad-hoc tasks fired on last wake up
+	 *****************************************************************************/
+	void run_tasks()
+	{
+		for(int i = 0; i < _deadline_count; i++)
+		{
+			if(_deadlines[i].fired && _deadlines[i].handler != NULL)
+			{
+				debug_printf("Running task: %d\n", _deadlines[i].id);
+				_deadlines[i].handler();
+			}
+		}
+	}
+
+	/******************************************************************************
+	 * Heavy work may run now: there is solar surplus or the battery is high, or
+	 * the work was held back for its deadline. Ask only when the work is pending,
+	 * the deadline counts from the first time it was held back
+	 *****************************************************************************/
+	bool may_run(DeferrableWork work)
+	{
+		if(!FLAGS.SOLAR_DEFERRAL)
+			return true;
+
+		uint32_t t_now = RTC::get_timestamp();
+
+		if(has_energy_surplus())
+		{
+			_deferred_since[work] = 0;
+			return true;
+		}
+
+		// Time unknown or went back, start over
+		if(_deferred_since[work] == 0 || t_now < _deferred_since[work])
+		{
+			debug_printf("Work %d deferred until energy surplus.\n", work);
+			Log::log(Log::WORK_DEFERRED, work, 0);
+
+			_deferred_since[work] = t_now;
+			return false;
+		}
+
+		if(t_now - _deferred_since[work] < DEFERRAL_DEADLINES[work])
+			return false;
+
+		debug_printf("Work %d deferred to deadline, running.\n", work);
+		Log::log(Log::WORK_DEFERRED, work, 1);
+
+		_deferred_since[work] = 0;
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * There is solar surplus or the battery is high (DEFERRAL_* thresholds)
+	 *****************************************************************************/
+	bool has_energy_surplus()
+	{
+		uint16_t mv = 0, pct = 0;
+		uint16_t solar_mv = 0;
+
+		return PowerGovernor::has_surplus(DEFERRAL_SURPLUS_MA) ||
+			(Battery::read_adc(&mv, &pct) == RET_OK && pct >= DEFERRAL_BATTERY_PCT) ||
+			(Battery::read_solar_mv(&solar_mv) == RET_OK && solar_mv >= DEFERRAL_SOLAR_MV);
+	}
+
+	/******************************************************************************
+	 * Keep wake up reason tasks in line with the schedule and FO source
+	 * A task is (re)aligned to the schedule grid when added, when its interval
+	 * changed or when time moved back. Otherwise it is left to repeat from its
+	 * own due time.
+	 *****************************************************************************/
+	void update_schedule_tasks(uint32_t t_now_sec, const WakeupScheduleEntry schedule[])
+	{
+		for(int i = 0; i < WAKEUP_SCHEDULE_LEN; i++)
+		{
 			// Calculate interval between wakeups for given rate
-			int interval_secs = wakeup_int * 60;
+			int interval_secs = schedule[i].wakeup_int * 60;
 
 			// Treat minutes as seconds when flag is enabled for faster debugging
 			if(FLAGS.SLEEP_MINS_AS_SECS)
 			{
-				interval_secs = wakeup_int;
+				interval_secs = schedule[i].wakeup_int;
 			}
 
-			// Seconds left to event
-			int seconds_to_event = calc_secs_to_event(t_now_sec, interval_secs);
-
-			// Failed, ignore
-			if(seconds_to_event < 1)
+			// Ignore events where interval is 0
+			if(interval_secs < 1)
 			{
+				remove_task(schedule[i].reason);
 				continue;
 			}
 
-			// New minimum found
-			if(seconds_to_event < min_seconds_to_event || min_seconds_to_event == 0)
-			{
-				min_seconds_to_event = seconds_to_event;
-				reasons = entry.reason;
-			}
-			// Event has the same wakeup time as the one(s) already found, add to reasons
-			// (events occurring athe same time)
-			else if(seconds_to_event == min_seconds_to_event)
+			Deadline *task = find_task(schedule[i].reason);
+
+			if(task == NULL || task->interval_secs != interval_secs || task->due > t_now_sec + interval_secs)
 			{
-				reasons |= entry.reason;
+				int phase_secs = get_reason_phase(schedule[i].reason, interval_secs);
+				add_task(schedule[i].reason, t_now_sec + calc_secs_to_event(t_now_sec, interval_secs, phase_secs), interval_secs, NULL, get_reason_tolerance(schedule[i].reason));
 			}
 		}
+	}
 
-		// debug_printf("Calculated - Time left: %d - Next events: %d\n", min_seconds_to_event , reasons);
+	/******************************************************************************
+	 * Next FO sniff depends on when the last packet was received, one-shot
+	 *****************************************************************************/
+	void update_fo_task(uint32_t t_now_sec)
+	{
+		int secs_to_next_sniff = 0;
 
-		//
-		// Calculate wakeup for next FO sniff and add to reasons
-		//
 		if(DeviceConfig::get_fo_enabled())
 		{
-			int secs_to_next_sniff = 0;
-
-			if(FO_SOURCE == FO_SOURCE_SNIFFER)
+			// Continuous RX queues frames on its own, no sniff wake ups
+			if(FO_SOURCE == FO_SOURCE_SNIFFER && !FoSniffer::continuous_rx_active())
 			{
 				secs_to_next_sniff = FoSniffer::calc_secs_to_next_sniff();
 			}
@@ -307,98 +694,301 @@ namespace SleepScheduler
 				secs_to_next_sniff = FoUart::calc_secs_to_next_packet();	
 			}
 
-			Serial.print(F("Secs to next sniff: "));
-			Serial.println(secs_to_next_sniff, DEC);
+			debug_print(F("Secs to next sniff: "));
+			debug_println(secs_to_next_sniff, DEC);
+		}
+
+		if(secs_to_next_sniff > 0)
+			add_task(REASON_FO, t_now_sec + secs_to_next_sniff, 0);
+		else
+			remove_task(REASON_FO);
+	}
+
+	/******************************************************************************
+	 * Pull next call home forward when stores fill up faster than call homes empty
+	 * them (StoreRegistry::backlog_high()), before cleanup starts deleting data.
+	 * Up to BACKLOG_MAX_EXTRA_CALL_HOMES per day (no limit while BacklogDrain is
+	 * active), in normal battery mode only. Regular call home keeps its place on
+	 * the schedule grid.
+	 *****************************************************************************/
+	void update_backlog_call_home(uint32_t t_now_sec)
+	{
+		Deadline *task = find_task(REASON_CALL_HOME);
+
+		if(task == NULL)
+		{
+			_pulled_call_home_due = 0;
+			return;
+		}
 
-			if(secs_to_next_sniff > 0)
+		// Pulled call home pending, once it ran (task repeated from its due time)
+		// the regular one is put back where it was
+		if(_pulled_call_home_due != 0)
+		{
+			if(task->due > _pulled_call_home_due)
 			{
-				// If sniff event is closer than calculated events, set it as next event instead
-				if(secs_to_next_sniff < min_seconds_to_event)
+				if(_pulled_call_home_grid_due > t_now_sec)
 				{
-					reasons = REASON_FO;
-					min_seconds_to_event = secs_to_next_sniff;
-				}
-				// If sniff event is scheduled to happen with calculated events, include it with next events
-				else if(secs_to_next_sniff == min_seconds_to_event)
-				{
-					reasons |= REASON_FO;
+					task->due = _pulled_call_home_grid_due;
+					sort_deadlines();
 				}
+
+				_pulled_call_home_due = 0;
 			}
+
+			return;
 		}
-		///
 
-		// No valid event(s) could be calculated, fail
-		if(min_seconds_to_event == 0 || reasons == 0)
-			return RET_ERROR;
-		else
+		// Due soon anyway
+		if(task->due <= t_now_sec + BACKLOG_CALL_HOME_LEAD_SECS)
+			return;
+
+		if(Battery::get_current_mode() != BATTERY_MODE::BATTERY_MODE_NORMAL)
+			return;
+
+		uint16_t day = t_now_sec / 86400;
+		if(day != _pulled_call_home_day)
 		{
-			// Update output vars
-			*seconds_left = min_seconds_to_event;
-			*event_reasons = reasons;
+			_pulled_call_home_day = day;
+			_pulled_call_homes = 0;
 		}
 
-		return RET_OK;
+		// Drain catches up until the backlog is cleared
+		if(!BacklogDrain::is_active() &&
+			(_pulled_call_homes >= BACKLOG_MAX_EXTRA_CALL_HOMES || !StoreRegistry::backlog_high()))
+		{
+			return;
+		}
+
+		_pulled_call_home_grid_due = task->due;
+		_pulled_call_home_due = t_now_sec + BACKLOG_CALL_HOME_LEAD_SECS;
+		_pulled_call_homes++;
+
+		task->due = _pulled_call_home_due;
+		sort_deadlines();
+
+		debug_printf("Store backlog high, call home pulled forward by %u secs\n", _pulled_call_home_grid_due - _pulled_call_home_due);
+
+		Log::log(Log::BACKLOG_CALL_HOME, _pulled_call_homes, _pulled_call_home_grid_due - _pulled_call_home_due);
 	}
 
 	/******************************************************************************
-	* Calculate seconds left to event from t_now_sec
-	******************************************************************************/
-	int calc_secs_to_event(uint32_t t_now_sec, int event_interval_secs)
+	 * Plan next wake up. Wakes up at the latest time every task can still run
+	 * within its tolerance, so tasks due by then share one wake up
+	 * @param reasons_out Wake up reasons of tasks due by then (output var)
+	 * @param saved_out Wake ups saved by coalescing (output var)
+	 * @return Wake up timestamp (sec)
+	 *****************************************************************************/
+	uint32_t plan_wakeup(int *reasons_out, int *saved_out)
 	{
-		const int SECONDS_IN_DAY = 86400;
+		uint32_t t_wakeup = _deadlines[0].due;
 
-		if(event_interval_secs < 1)
+		// Latest time no task runs later than its tolerance
+		for(int i = 0; i < _deadline_count; i++)
 		{
-			return -1;
+			int tolerance = _deadlines[i].tolerance_secs;
+
+			if(tolerance > SLEEP_COALESCE_WINDOW_SEC)
+				tolerance = SLEEP_COALESCE_WINDOW_SEC;
+
+			// Do not slide into the next interval
+			if(_deadlines[i].interval_secs > 0 && tolerance > _deadlines[i].interval_secs / 2)
+				tolerance = _deadlines[i].interval_secs / 2;
+
+			uint32_t t_latest = _deadlines[i].due + tolerance;
+
+			if(i == 0 || t_latest < t_wakeup)
+				t_wakeup = t_latest;
 		}
 
-		// Current second from the start of this day
-		int cur_sec_in_day = t_now_sec - ((t_now_sec / SECONDS_IN_DAY) * SECONDS_IN_DAY);
+		// Tasks due by then, each distinct due time is a wake up on its own
+		int reasons = 0;
+		int wakeups = 0;
 
-		int seconds_to_event = 0;
+		for(int i = 0; i < _deadline_count && _deadlines[i].due <= t_wakeup; i++)
+		{
+			if(i == 0 || _deadlines[i].due != _deadlines[i - 1].due)
+				wakeups++;
 
-		// No more events in this day for this reason
-		// Next event at the start of next hour
-		if(cur_sec_in_day >= SECONDS_IN_DAY - event_interval_secs)
+			if(_deadlines[i].id < TASK_ID_CUSTOM)
+				reasons |= _deadlines[i].id;
+		}
+
+		*reasons_out = reasons;
+		*saved_out = wakeups > 1 ? wakeups - 1 : 0;
+
+		return t_wakeup;
+	}
+
+	/******************************************************************************
+	 * Seconds a wake up reason may be delayed to share a wake up. FO packets
+	 * arrive at fixed times so FO is strict, sensor readings can slide
+	 *****************************************************************************/
+	uint16_t get_reason_tolerance(WakeupReason reason)
+	{
+		switch(reason)
 		{
-			seconds_to_event = SECONDS_IN_DAY - cur_sec_in_day;
+			case REASON_FO:
+				return 0;
+			case REASON_CALL_HOME:
+				return SLEEP_COALESCE_WINDOW_SEC / 2;
+			default:
+				return SLEEP_COALESCE_WINDOW_SEC;
 		}
-		else
+	}
+
+	/******************************************************************************
+	 * Offset of a reason's events from the interval grid, spreads call homes of a
+	 * fleet with the same interval (see set_call_home_phase()). Sensor reads stay
+	 * on the grid so measurements of all devices line up.
+	 *****************************************************************************/
+	int get_reason_phase(WakeupReason reason, int interval_secs)
+	{
+		switch(reason)
 		{
-			// Calculate next wakeup for this reason
-			seconds_to_event = ((cur_sec_in_day / event_interval_secs + 1) * event_interval_secs) - cur_sec_in_day;
+			case REASON_CALL_HOME:
+				// Relay leaves and gateway call home together
+				if(FLAGS.LORA_RELAY)
+					return 0;
+
+				return get_call_home_phase() % interval_secs;
+			default:
+				return 0;
 		}
+	}
 
-		return seconds_to_event;
+	/******************************************************************************
+	 * Call home phase (secs). Set by remote control, else derived from the MAC so
+	 * it is the same on every boot and spread evenly over the fleet
+	 *****************************************************************************/
+	int get_call_home_phase()
+	{
+		if(!_call_home_phase_loaded)
+		{
+			_call_home_phase_loaded = true;
+
+			DeviceConfig::CallHomePhase phase;
+			_call_home_phase_secs = DeviceConfig::get_call_home_phase(&phase) == RET_OK ? phase.phase_secs : -1;
+		}
+
+		if(_call_home_phase_secs >= 0)
+			return _call_home_phase_secs;
+
+		uint8_t mac[6];
+		esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+		return Utils::crc32(mac, sizeof(mac)) % CALL_HOME_PHASE_MAX_SECS;
 	}
 
 	/******************************************************************************
-	 * Checks if any events were missed if device woke up at t_since and stayed
-	 * awake for awake_sec.
-	 * Checks only for the next wakeup events after t_since, not all subsequent ones
-	 * @param schedule		Schedule to use to find out the next events after t_since
-	 * @param t_since 		Start time from which to calculate next event
-	 * @param awake_sec	Seconds the device was awake starting from t_since
+	 * Set call home phase, call home is realigned on next sleep
+	 * @param phase_secs Offset from the interval grid, -1 to derive from the MAC
 	 *****************************************************************************/
-	int check_missed_reasons(const WakeupScheduleEntry schedule[], uint32_t t_since, uint32_t awake_sec)
+	RetResult set_call_home_phase(int phase_secs)
+	{
+		DeviceConfig::CallHomePhase phase;
+		phase.phase_secs = phase_secs;
+
+		RetResult ret = DeviceConfig::set_call_home_phase(&phase);
+
+		_call_home_phase_secs = phase_secs;
+		_call_home_phase_loaded = true;
+
+		remove_task(REASON_CALL_HOME);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Fire all tasks due by t_sec. Repeating tasks are rescheduled from their own
+	 * due time (skipping intervals missed), one-shot tasks are removed on next sleep
+	 * @param t_sec Timestamp (sec)
+	 * @param missed_out Intervals skipped because they were already past (output var, can be NULL)
+	 * @return Wake up reasons of fired tasks
+	 *****************************************************************************/
+	int fire_due_tasks(uint32_t t_sec, int *missed_out)
 	{
 		int reasons = 0;
+		int missed = 0;
 
-		for(int i = 0; i < WAKEUP_SCHEDULE_LEN; i++)
+		for(int i = 0; i < _deadline_count && _deadlines[i].due <= t_sec; )
+		{
+			Deadline *task = &_deadlines[i];
+
+			if(task->id < TASK_ID_CUSTOM)
+				reasons |= task->id;
+
+			task->fired = true;
+			i++;
+
+			// One-shot, removed on next sleep once its handler has run
+			if(task->interval_secs == 0)
+				continue;
+
+			// Next due time after t, intervals in between are missed
+			int intervals = (t_sec - task->due) / task->interval_secs + 1;
+			missed += intervals - 1;
+
+			task->due += intervals * task->interval_secs;
+		}
+
+		sort_deadlines();
+
+		if(missed_out != NULL)
+			*missed_out = missed;
+
+		return reasons;
+	}
+
+	/******************************************************************************
+	 * Find task in deadline queue, NULL if not found
+	 *****************************************************************************/
+	Deadline* find_task(uint16_t id)
+	{
+		for(int i = 0; i < _deadline_count; i++)
 		{
-			WakeupScheduleEntry entry = schedule[i];
+			if(_deadlines[i].id == id)
+				return &_deadlines[i];
+		}
 
-			int wakeup_int = entry.wakeup_int;
+		return NULL;
+	}
 
-			int secs_to_event = calc_secs_to_event(t_since, wakeup_int * 60);
+	/******************************************************************************
+	 * Sort deadline queue by due time. Insertion sort, queue is short and mostly
+	 * sorted
+	 *****************************************************************************/
+	void sort_deadlines()
+	{
+		for(int i = 1; i < _deadline_count; i++)
+		{
+			Deadline task = _deadlines[i];
+			int j = i - 1;
 
-			if(secs_to_event > 0 && secs_to_event <= awake_sec)
+			while(j >= 0 && _deadlines[j].due > task.due)
 			{
-				reasons |= entry.reason;
+				_deadlines[j + 1] = _deadlines[j];
+				j--;
 			}
+
+			_deadlines[j + 1] = task;
 		}
+	}
 
-		return reasons;
+	/******************************************************************************
+	 * Print deadline queue
+	 *****************************************************************************/
+	void print_deadlines(uint32_t t_now_sec)
+	{
+		Utils::print_separator(F("Deadlines"));
+
+		for(int i = 0; i < _deadline_count; i++)
+		{
+			debug_printf("Task %d: in %d s (every %d s)\n", _deadlines[i].id,
+				(int)(_deadlines[i].due - t_now_sec), _deadlines[i].interval_secs);
+		}
+
+		Utils::print_separator(NULL);
 	}
 
 	/******************************************************************************
@@ -452,6 +1042,17 @@ namespace SleepScheduler
 			memcpy(schedule_out, WAKEUP_SCHEDULE_DEFAULT, sizeof(WAKEUP_SCHEDULE_DEFAULT));
 		}
 
+		// Battery low schedule is fixed, normal one follows available energy
+		if(battery_mode == BATTERY_MODE::BATTERY_MODE_NORMAL)
+		{
+			// Water sensors follow the measurements, then everything is scaled by energy
+			AdaptiveSampling::apply(schedule_out);
+
+			PowerGovernor::update();
+			PowerGovernor::apply(schedule_out);
+			PowerGovernor::print();
+		}
+
 		return RET_OK;
 	}
 		
@@ -556,4 +1157,255 @@ namespace SleepScheduler
 
 		debug_println();
 	}
+
+	/******************************************************************************
+	 * Save state to RTC memory before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->t_last_sleep = _t_last_sleep;
+		state->last_wakeup_reasons = _last_wakeup_reasons;
+		state->sleep_secs = _sleep_secs;
+		state->planned_due = _planned_due;
+		state->saved_wakeups = _saved_wakeups;
+		state->deadline_count = _deadline_count;
+		memcpy(state->deadlines, _deadlines, sizeof(_deadlines));
+		state->pulled_call_home_due = _pulled_call_home_due;
+		state->pulled_call_home_grid_due = _pulled_call_home_grid_due;
+		state->pulled_call_home_day = _pulled_call_home_day;
+		state->pulled_call_homes = _pulled_call_homes;
+		memcpy(state->deferred_since, _deferred_since, sizeof(_deferred_since));
+	}
+
+	/******************************************************************************
+	 * Simulate the scheduler for a number of days with a virtual clock. Drives
+	 * the real deadline queue (schedule alignment, coalescing, missed events)
+	 * and switches schedule by the battery charge of the energy model, with the
+	 * thresholds of Battery. Scheduler state is restored after, so it can run on
+	 * a live device.
+	 * FO sniffs follow the packet interval (packet always received) and the
+	 * PowerGovernor scaling of the normal schedule is not applied.
+	 * @param schedule Normal battery mode schedule
+	 * @param model Energy model
+	 * @param days Days to simulate
+	 * @param result_out Simulation output (output var)
+	 *****************************************************************************/
+	RetResult simulate(const WakeupScheduleEntry schedule[], const SimEnergyModel *model, int days, SimResult *result_out)
+	{
+		if(!schedule_valid(schedule) || days < 1 || model->battery_mah <= 0)
+			return RET_ERROR;
+
+		RetainedState saved;
+		save_state(&saved);
+
+		_deadline_count = 0;
+
+		memset(result_out, 0, sizeof(SimResult));
+		result_out->min_battery_pct = 100;
+
+		// Start of a day, so the schedule grid starts aligned
+		const uint32_t t_start = 1600000000 - 1600000000 % 86400;
+		const uint32_t t_end = t_start + days * 86400;
+
+		uint32_t t = t_start;
+		uint32_t t_last_packet = 0;
+		float charge_mah = model->battery_mah;
+		BATTERY_MODE mode = BATTERY_MODE_NORMAL;
+
+		while(t < t_end)
+		{
+			uint32_t t_step = t;
+			float drain_mah = 0;
+
+			if(mode == BATTERY_MODE_SLEEP_CHARGE)
+			{
+				// All functions off, wake up only to check the battery
+				int secs = SLEEP_CHARGE_CHECK_INT_MINS * (FLAGS.SLEEP_MINS_AS_SECS ? 1 : 60);
+
+				drain_mah += sim_drain_mah(model->sleep_ua / 1000, secs);
+				drain_mah += sim_drain_mah(model->awake_ma, model->wake_secs);
+
+				result_out->wakeups++;
+				result_out->awake_secs += model->wake_secs;
+
+				t += secs + model->wake_secs;
+			}
+			else
+			{
+				// As on sleep_to_next(), one-shot tasks fired on last wake up are done
+				for(int i = 0; i < _deadline_count; )
+				{
+					if(_deadlines[i].fired && _deadlines[i].interval_secs == 0)
+					{
+						remove_task(_deadlines[i].id);
+						continue;
+					}
+
+					_deadlines[i].fired = false;
+					i++;
+				}
+
+				update_schedule_tasks(t, mode == BATTERY_MODE_NORMAL ? schedule : WAKEUP_SCHEDULE_BATT_LOW);
+
+				// Wake up just before the next packet, as calc_secs_to_next_sniff()
+				if(model->fo_enabled && find_task(REASON_FO) == NULL)
+				{
+					uint32_t due = t + 1;
+
+					if(t_last_packet != 0)
+					{
+						due = t_last_packet + FO_SNIFFER_PACKET_INTERVAL_SEC - FO_SNIFFER_WAIT_PACKET_EARLY_WAKEUP_SEC;
+						while(due <= t)
+							due += FO_SNIFFER_PACKET_INTERVAL_SEC;
+					}
+
+					add_task(REASON_FO, due, 0);
+				}
+
+				int reasons = 0;
+
+				if(_deadlines[0].due <= t)
+				{
+					// Became due while awake, handled right away
+					reasons = fire_due_tasks(t, NULL);
+					result_out->missed++;
+				}
+				else
+				{
+					int saved_wakeups = 0;
+					uint32_t t_wakeup = plan_wakeup(&reasons, &saved_wakeups);
+					int sleep_secs = t_wakeup - t;
+
+					drain_mah += sim_drain_mah(model->sleep_ua / 1000, sleep_secs);
+
+					// Uncalibrated slow clock wakes up early, slept again until due
+					if(sleep_secs * model->clock_error_ppm / 1000000 >= 1)
+						result_out->corrections++;
+
+					result_out->coalesced += saved_wakeups;
+					result_out->wakeups++;
+
+					t = t_wakeup;
+					reasons = fire_due_tasks(t, NULL);
+				}
+
+				int awake_secs = model->wake_secs;
+
+				if(reasons & REASON_CALL_HOME)
+				{
+					awake_secs += model->call_home_secs;
+					drain_mah += sim_drain_mah(model->modem_ma, model->call_home_secs);
+
+					result_out->modem_sessions++;
+					result_out->modem_secs += model->call_home_secs;
+				}
+
+				if(reasons & (REASON_READ_WATER_SENSORS | REASON_READ_WEATHER_STATION | REASON_READ_SOIL_MOISTURE_SENSOR))
+				{
+					awake_secs += model->sensors_secs;
+					result_out->sensor_reads++;
+				}
+
+				if(reasons & REASON_FO)
+				{
+					awake_secs += model->fo_secs;
+					t_last_packet = t + FO_SNIFFER_WAIT_PACKET_EARLY_WAKEUP_SEC;
+					result_out->fo_sniffs++;
+				}
+
+				drain_mah += sim_drain_mah(model->awake_ma, awake_secs);
+				result_out->awake_secs += awake_secs;
+
+				t += awake_secs;
+			}
+
+			if(mode == BATTERY_MODE_LOW)
+				result_out->low_mode_secs += t - t_step;
+			else if(mode == BATTERY_MODE_SLEEP_CHARGE)
+				result_out->sleep_charge_secs += t - t_step;
+
+			// Solar charge over this step, net drain can be negative
+			drain_mah -= model->solar_mah_per_day * (t - t_step) / 86400;
+
+			if(drain_mah > 0)
+				result_out->mah += drain_mah;
+
+			charge_mah -= drain_mah;
+			charge_mah = charge_mah < 0 ? 0 : (charge_mah > model->battery_mah ? model->battery_mah : charge_mah);
+
+			// Battery mode from charge left, as Battery::get_current_mode()
+			float pct = charge_mah * 100 / model->battery_mah;
+
+			if(pct < result_out->min_battery_pct)
+				result_out->min_battery_pct = pct;
+
+			if(mode == BATTERY_MODE_SLEEP_CHARGE && pct < BATTERY_LEVEL_SLEEP_RECHARGED)
+				mode = BATTERY_MODE_SLEEP_CHARGE;
+			else if(pct > BATTERY_LEVEL_LOW)
+				mode = BATTERY_MODE_NORMAL;
+			else if(pct > BATTERY_LEVEL_SLEEP_CHARGE)
+				mode = BATTERY_MODE_LOW;
+			else
+				mode = BATTERY_MODE_SLEEP_CHARGE;
+
+			// Long runs, let other tasks run
+			if(result_out->wakeups % 1000 == 0)
+				yield();
+		}
+
+		restore_state(&saved);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Charge used (mAh) drawing ma for secs
+	 *****************************************************************************/
+	float sim_drain_mah(float ma, uint32_t secs)
+	{
+		return ma * secs / 3600;
+	}
+
+	/******************************************************************************
+	 * Print simulation output
+	 * @param result Simulation output
+	 * @param days Days simulated
+	 *****************************************************************************/
+	void print_sim_result(const SimResult *result, int days)
+	{
+		Utils::print_separator(F("Simulation"));
+
+		debug_printf("Days: %d\n", days);
+		debug_printf("Wake ups: %u (%u/day), coalesced: %u, missed: %u, corrected: %u\n", result->wakeups,
+			result->wakeups / days, result->coalesced, result->missed, result->corrections);
+		debug_printf("Modem sessions: %u (%u/day), %u s/day\n", result->modem_sessions,
+			result->modem_sessions / days, result->modem_secs / days);
+		debug_printf("Sensor reads: %u/day, FO sniffs: %u/day\n", result->sensor_reads / days, result->fo_sniffs / days);
+		debug_printf("Awake: %u s/day, duty cycle %.3f%%\n", result->awake_secs / days,
+			(float)result->awake_secs * 100 / ((float)days * 86400));
+		debug_printf("Battery low mode: %u s, sleep charge: %u s, min charge %.1f%%\n",
+			result->low_mode_secs, result->sleep_charge_secs, result->min_battery_pct);
+		debug_printf("Consumption: %.1f mAh, %.2f mAh/day\n", result->mah, result->mah / days);
+
+		Utils::print_separator(NULL);
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_t_last_sleep = state->t_last_sleep;
+		_last_wakeup_reasons = state->last_wakeup_reasons;
+		_sleep_secs = state->sleep_secs;
+		_planned_due = state->planned_due;
+		_saved_wakeups = state->saved_wakeups;
+		_deadline_count = state->deadline_count <= MAX_TASKS ? state->deadline_count : 0;
+		memcpy(_deadlines, state->deadlines, sizeof(_deadlines));
+		_pulled_call_home_due = state->pulled_call_home_due;
+		_pulled_call_home_grid_due = state->pulled_call_home_grid_due;
+		_pulled_call_home_day = state->pulled_call_home_day;
+		_pulled_call_homes = state->pulled_call_homes;
+		memcpy(_deferred_since, state->deferred_since, sizeof(_deferred_since));
+	}
 }
\ No newline at end of file
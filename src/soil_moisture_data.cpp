@@ -2,6 +2,11 @@
 #include "CRC32.h"
 #include "utils.h"
 #include "common.h"
+#include "deadband.h"
+#include "retention.h"
+#include "board_features.h"
+
+#if FEATURE_SOIL_MOISTURE
 
 namespace SoilMoistureData
 {
@@ -11,7 +16,8 @@ namespace SoilMoistureData
 	 * This way if a request succeeds, a whole file can be deleted, if not the file remains
 	 * to be resent at a later time
 	 */
-    DataStore<SoilMoistureData::Entry> store(SOIL_MOISTURE_DATA_PATH, SOIL_MOISTURE_DATA_ENTRIES_PER_SUBMIT_REQ);
+    DataStore<SoilMoistureData::Entry> store(SOIL_MOISTURE_DATA_PATH, SOIL_MOISTURE_DATA_ENTRIES_PER_SUBMIT_REQ,
+		Retention::on_evict<SoilMoistureData::Entry, SENSOR_STORE_SOIL_MOISTURE>);
 
     /******************************************************************************
     * Add water sensor data to storage
@@ -19,6 +25,10 @@ namespace SoilMoistureData
     ******************************************************************************/
     RetResult add(SoilMoistureData::Entry *data)
     {
+		// Unchanged within deadbands, left out
+		if(!Deadband::should_store(SENSOR_STORE_SOIL_MOISTURE, data))
+			return RET_OK;
+
 		RetResult ret = store.add(data);
 
 		// Commit on every add
@@ -53,4 +63,6 @@ namespace SoilMoistureData
 		debug_print(F("Conductivity: "));
 		debug_println(data->conductivity);
 	}
-}
\ No newline at end of file
+}
+
+#endif
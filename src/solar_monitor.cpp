@@ -4,6 +4,9 @@ namespace SolarMonitor
 {
     Adafruit_INA219 _ina219;
 
+    /** Monitor inited. Warm boot skips init, done on first use */
+    bool _inited = false;
+
     /******************************************************************************
 	 * Init
 	 *****************************************************************************/
@@ -20,6 +23,8 @@ namespace SolarMonitor
             return RET_ERROR;
         }
 
+        _inited = true;
+
         return RET_OK;
     }
 
@@ -28,7 +33,7 @@ namespace SolarMonitor
 	 *****************************************************************************/
     RetResult log()
     {
-        if (!FLAGS.SOLAR_CURRENT_MONITOR_ENABLED)
+        if (!FLAGS.SOLAR_CURRENT_MONITOR_ENABLED || (!_inited && init() != RET_OK))
             return RET_ERROR;
 
         debug_println(F("Logging solar monitor."));
@@ -37,12 +42,25 @@ namespace SolarMonitor
         return RET_OK;
     }
 
+    /******************************************************************************
+	 * Read current from solar panel
+	 *****************************************************************************/
+    RetResult read_current_ma(float *ma)
+    {
+        if (!FLAGS.SOLAR_CURRENT_MONITOR_ENABLED || (!_inited && init() != RET_OK))
+            return RET_ERROR;
+
+        *ma = _ina219.getCurrent_mA();
+
+        return RET_OK;
+    }
+
     /******************************************************************************
 	 * Print solar monitor
 	 *****************************************************************************/
     RetResult print()
     {
-        if(!FLAGS.SOLAR_CURRENT_MONITOR_ENABLED)
+        if(!FLAGS.SOLAR_CURRENT_MONITOR_ENABLED || (!_inited && init() != RET_OK))
             return RET_ERROR;
 
         debug_println_i(F("Solar monitor data:"))
@@ -0,0 +1,715 @@
+#include "store_registry.h"
+#include "data_store.h"
+#include "data_store_reader.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "atmos41_data.h"
+#include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "rollup_data.h"
+#include "relay_data.h"
+#include "fo_data.h"
+#include "sdi12_log.h"
+#include "log.h"
+#include "flash.h"
+#include "storage.h"
+#include "psram.h"
+#include "common.h"
+#include "board_features.h"
+
+namespace StoreRegistry
+{
+	/******************************************************************************
+	 * StoreOps of the DataStore returned by TGetStore
+	 ******************************************************************************/
+	template <typename TStruct, DataStore<TStruct>* (*TGetStore)()>
+	struct StoreOpsOf
+	{
+		static const char* get_dir_path()
+		{
+			return TGetStore()->get_dir_path();
+		}
+
+		static RetResult cleanup(bool force)
+		{
+			return TGetStore()->cleanup(force);
+		}
+
+		static int compact(int max_sources)
+		{
+			return TGetStore()->compact(max_sources);
+		}
+
+		static RetResult clear_all()
+		{
+			DataStore<TStruct> *store = TGetStore();
+
+			for(int i = 0; i < DATA_STORE_TWIN_COUNT; i++)
+			{
+				DataStore<TStruct> *twin = store->get_twin((DataStoreTwin)i);
+
+				if(twin != NULL)
+					twin->clear_all();
+			}
+
+			return store->clear_all();
+		}
+
+		static bool get_usage(int *file_count, int *entry_count)
+		{
+			const typename DataStore<TStruct>::Index *index = TGetStore()->get_index();
+
+			if(index == NULL)
+				return false;
+
+			*file_count = index->file_count;
+			*entry_count = index->entry_count;
+
+			return true;
+		}
+
+		static RetResult prune_archive(bool force)
+		{
+			DataStore<TStruct> *archive = TGetStore()->get_twin(DATA_STORE_TWIN_ARCHIVE);
+
+			return archive != NULL ? archive->cleanup(force) : RET_ERROR;
+		}
+
+		static int stage_backfill(uint32_t from, uint32_t to)
+		{
+			DataStore<TStruct> *archive = TGetStore()->get_twin(DATA_STORE_TWIN_ARCHIVE);
+			DataStore<TStruct> *backfill = TGetStore()->get_twin(DATA_STORE_TWIN_BACKFILL);
+
+			if(archive == NULL || backfill == NULL)
+				return -1;
+
+			DataStoreReader<TStruct> reader(archive);
+			reader.seek(from);
+
+			int count = 0;
+			TStruct *entry;
+
+			while(reader.next_file())
+			{
+				while((entry = reader.next_entry()) != NULL)
+				{
+					if(!reader.entry_crc_valid())
+						continue;
+
+					// Entries of a file are in time order, rest of file is newer
+					if(StoreEntryTstamp<TStruct>::get(entry) > to)
+						break;
+
+					// Keeps seq, server drops entries it already has
+					if(backfill->add(entry, reader.entry_seq()) == RET_OK)
+						count++;
+				}
+			}
+
+			if(backfill->get_buffer_element_count() > 0)
+			{
+				if(backfill->commit() != RET_OK)
+					return -1;
+
+				backfill->clear_buffer();
+			}
+
+			return count;
+		}
+
+		static bool backfill_pending()
+		{
+			DataStore<TStruct> *backfill = TGetStore()->get_twin(DATA_STORE_TWIN_BACKFILL);
+
+			return backfill != NULL && (backfill->get_file_count() != 0 || backfill->get_buffer_element_count() > 0);
+		}
+
+		static RetResult use_psram_buffer()
+		{
+			typedef typename DataStore<TStruct>::Entry Entry;
+
+			void *buffer = Psram::alloc(DATA_STORE_PSRAM_BUFFER_ELEMENTS * sizeof(Entry));
+
+			if(buffer == NULL)
+				return RET_ERROR;
+
+			if(TGetStore()->move_buffer(buffer, DATA_STORE_PSRAM_BUFFER_ELEMENTS) != RET_OK)
+			{
+				free(buffer);
+				return RET_ERROR;
+			}
+
+			return RET_OK;
+		}
+
+		static RetResult remove_file(const char *path, int size)
+		{
+			return TGetStore()->remove_file(path, size);
+		}
+
+		static bool get_stats(StoreStats *stats)
+		{
+			DataStore<TStruct> *store = TGetStore();
+			const typename DataStore<TStruct>::Index *index = store->get_index();
+
+			if(index == NULL)
+				return false;
+
+			stats->file_count = index->file_count;
+			stats->entry_count = index->entry_count;
+			stats->capacity = index->file_count * store->get_max_entries_per_file();
+			stats->oldest_tstamp = index->file_count > 0 ? index->oldest_file_tstamp : 0;
+
+			return true;
+		}
+
+		static int migrate(const int *old_data_sizes, int count, DataStoreUpgrader upgrade)
+		{
+			DataStore<TStruct> *store = TGetStore();
+			int migrated = 0;
+			bool mismatch = false;
+
+			for(int i = 0; i < DATA_STORE_TWIN_COUNT; i++)
+			{
+				DataStore<TStruct> *twin = store->get_twin((DataStoreTwin)i);
+				int files = twin != NULL ? twin->migrate(old_data_sizes, count, upgrade) : 0;
+
+				mismatch |= files < 0;
+				migrated += max(files, 0);
+			}
+
+			int files = store->migrate(old_data_sizes, count, upgrade);
+
+			mismatch |= files < 0;
+			migrated += max(files, 0);
+
+			return mismatch ? -1 : migrated;
+		}
+
+		static const StoreOps OPS;
+	};
+
+	template <typename TStruct, DataStore<TStruct>* (*TGetStore)()>
+	const StoreOps StoreOpsOf<TStruct, TGetStore>::OPS = {
+		get_dir_path, cleanup, compact, clear_all, get_usage, prune_archive, stage_backfill,
+		backfill_pending, use_psram_buffer, remove_file, get_stats, migrate
+	};
+
+	/******************************************************************************
+	 * StoreOps of a store not built for the board (see board_features.h). Has no
+	 * index and nothing to submit, files of an older image in its dir are left
+	 ******************************************************************************/
+	template <const char* const *TDirPath>
+	struct UnbuiltStoreOps
+	{
+		static const char* get_dir_path()
+		{
+			return *TDirPath;
+		}
+
+		static RetResult cleanup(bool force)
+		{
+			return RET_OK;
+		}
+
+		static int compact(int max_sources)
+		{
+			return 0;
+		}
+
+		static RetResult clear_all()
+		{
+			return RET_OK;
+		}
+
+		static bool get_usage(int *file_count, int *entry_count)
+		{
+			return false;
+		}
+
+		static RetResult prune_archive(bool force)
+		{
+			return RET_ERROR;
+		}
+
+		static int stage_backfill(uint32_t from, uint32_t to)
+		{
+			return -1;
+		}
+
+		static bool backfill_pending()
+		{
+			return false;
+		}
+
+		static RetResult use_psram_buffer()
+		{
+			return RET_OK;
+		}
+
+		static RetResult remove_file(const char *path, int size)
+		{
+			return RET_ERROR;
+		}
+
+		static bool get_stats(StoreStats *stats)
+		{
+			return false;
+		}
+
+		static int migrate(const int *old_data_sizes, int count, DataStoreUpgrader upgrade)
+		{
+			return 0;
+		}
+
+		static const StoreOps OPS;
+	};
+
+	template <const char* const *TDirPath>
+	const StoreOps UnbuiltStoreOps<TDirPath>::OPS = {
+		get_dir_path, cleanup, compact, clear_all, get_usage, prune_archive, stage_backfill,
+		backfill_pending, use_psram_buffer, remove_file, get_stats, migrate
+	};
+
+	/******************************************************************************
+	 * Older entry layouts of a store, migrated by check_format(). Fields are only
+	 * ever appended to entry structs, a layout is the data size before an append
+	 ******************************************************************************/
+	struct StoreLayouts
+	{
+		StoreId id;
+
+		/** Data sizes, oldest first */
+		int old_data_sizes[STORE_MAX_OLD_LAYOUTS];
+		int count;
+
+		/** Sets appended fields of migrated data, NULL leaves them 0 */
+		DataStoreUpgrader upgrade;
+	};
+
+	//
+	// Private functions
+	//
+	uint8_t fragmentation_percent(const StoreStats *stats);
+	void upgrade_water_sensor_data(void *data, int old_data_size);
+	const StoreLayouts* get_old_layouts(StoreId id);
+
+	//
+	// Private vars
+	//
+	/** Every store, in StoreId order. Stores not built for the board are described
+	 * with UnbuiltStoreOps, not submitted */
+	const StoreDescriptor STORES[] = {
+		[STORE_LOG] = {STORE_LOG, "log", sizeof(DataStore<Log::Entry>::Entry),
+			false, TELEMETRY_PRIORITY_NORMAL, 100, STORE_QUOTA_LOG_BYTES,
+			&StoreOpsOf<Log::Entry, Log::get_store>::OPS},
+		[STORE_WATER_SENSORS] = {STORE_WATER_SENSORS, "water sensor", sizeof(DataStore<WaterSensorData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<WaterSensorData::Entry, WaterSensorData::get_store>::OPS},
+#if FEATURE_ATMOS41
+		[STORE_ATMOS41] = {STORE_ATMOS41, "weather", sizeof(DataStore<Atmos41Data::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<Atmos41Data::Entry, Atmos41Data::get_store>::OPS},
+#else
+		[STORE_ATMOS41] = {STORE_ATMOS41, "weather", sizeof(DataStore<Atmos41Data::Entry>::Entry),
+			false, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&UnbuiltStoreOps<&ATMOS41_DATA_PATH>::OPS},
+#endif
+#if FEATURE_SOIL_MOISTURE
+		[STORE_SOIL_MOISTURE] = {STORE_SOIL_MOISTURE, "soil moisture", sizeof(DataStore<SoilMoistureData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<SoilMoistureData::Entry, SoilMoistureData::get_store>::OPS},
+#else
+		[STORE_SOIL_MOISTURE] = {STORE_SOIL_MOISTURE, "soil moisture", sizeof(DataStore<SoilMoistureData::Entry>::Entry),
+			false, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&UnbuiltStoreOps<&SOIL_MOISTURE_DATA_PATH>::OPS},
+#endif
+		[STORE_FO] = {STORE_FO, "FineOffset weather", sizeof(DataStore<FoData::StoreEntry>::Entry),
+			true, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<FoData::StoreEntry, FoData::get_store>::OPS},
+#if FEATURE_LIGHTNING
+		[STORE_LIGHTNING] = {STORE_LIGHTNING, "lightning", sizeof(DataStore<LightningData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_NORMAL, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<LightningData::Entry, LightningData::get_store>::OPS},
+#else
+		[STORE_LIGHTNING] = {STORE_LIGHTNING, "lightning", sizeof(DataStore<LightningData::Entry>::Entry),
+			false, TELEMETRY_PRIORITY_NORMAL, 100, STORE_QUOTA_SENSOR_BYTES,
+			&UnbuiltStoreOps<&LIGHTNING_DATA_PATH>::OPS},
+#endif
+		[STORE_ENERGY_PROFILE] = {STORE_ENERGY_PROFILE, "energy profile", sizeof(DataStore<EnergyProfileData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_NORMAL, 100, STORE_QUOTA_SENSOR_BYTES,
+			&StoreOpsOf<EnergyProfileData::Entry, EnergyProfileData::get_store>::OPS},
+		[STORE_RELAY] = {STORE_RELAY, "relayed", sizeof(DataStore<RelayData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_HIGH, 100, STORE_QUOTA_RELAY_BYTES,
+			&StoreOpsOf<RelayData::Entry, RelayData::get_store>::OPS},
+		[STORE_ROLLUP] = {STORE_ROLLUP, "rollup", sizeof(DataStore<RollupData::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_NORMAL, 100, STORE_QUOTA_ROLLUP_BYTES,
+			&StoreOpsOf<RollupData::Entry, RollupData::get_store>::OPS},
+		[STORE_SDI12_LOG] = {STORE_SDI12_LOG, "SDI12 debug", sizeof(DataStore<SDI12Log::Entry>::Entry),
+			true, TELEMETRY_PRIORITY_LOW, TELEMETRY_LOW_PRIORITY_BUDGET_PERCENT, STORE_QUOTA_SDI12_LOG_BYTES,
+			&StoreOpsOf<SDI12Log::Entry, SDI12Log::get_store>::OPS}
+	};
+
+	static_assert(sizeof(STORES) / sizeof(STORES[0]) == STORE_COUNT, "Describe every store");
+
+	/** Stores whose entry struct had fields appended. Entries of every store also
+	 * had no seq before format version 2 */
+	const StoreLayouts OLD_LAYOUTS[] = {
+		// Presence mask, version 3
+		{STORE_WATER_SENSORS, {offsetof(WaterSensorData::Entry, present)}, 1, upgrade_water_sensor_data},
+		// Aggregated sample stats, before version 2
+		{STORE_FO, {offsetof(FoData::StoreEntry, temp_std)}, 1, NULL},
+		// NVS commits before version 2, CPU max frequency time in version 4
+		{STORE_ENERGY_PROFILE, {offsetof(EnergyProfileData::Entry, nvs_commits),
+			offsetof(EnergyProfileData::Entry, cpu_max_secs)}, 2, NULL}
+	};
+
+	/******************************************************************************
+	 * Get descriptor of a store
+	 ******************************************************************************/
+	const StoreDescriptor* get(StoreId id)
+	{
+		if(id < 0 || id >= STORE_COUNT)
+			return NULL;
+
+		return &STORES[id];
+	}
+
+	/******************************************************************************
+	 * Bytes of entries a store keeps in flash, 0 if unknown
+	 ******************************************************************************/
+	uint32_t get_stored_bytes(const StoreDescriptor *store)
+	{
+		int file_count = 0, entry_count = 0;
+
+		if(!store->ops->get_usage(&file_count, &entry_count))
+			return 0;
+
+		return (uint32_t)entry_count * store->entry_size;
+	}
+
+	/******************************************************************************
+	 * Bytes of entries all stores keep in flash
+	 ******************************************************************************/
+	uint32_t get_total_stored_bytes()
+	{
+		uint32_t total = 0;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+			total += get_stored_bytes(&STORES[i]);
+
+		return total;
+	}
+
+	/******************************************************************************
+	 * Files waiting to be submitted by telemetry stores, -1 if unknown
+	 ******************************************************************************/
+	int get_telemetry_file_count()
+	{
+		int total = 0;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			int file_count = 0, entry_count = 0;
+
+			if(!STORES[i].telemetry)
+				continue;
+
+			if(!STORES[i].ops->get_usage(&file_count, &entry_count))
+				return -1;
+
+			total += file_count;
+		}
+
+		return total;
+	}
+
+	/******************************************************************************
+	 * Migrate stores written with an older entry format (DATA_STORE_FORMAT_VERSION)
+	 * to the current one, a store whose files match none of its layouts is cleared
+	 * (see DataStore::migrate()). Call after mounting flash, before anything is
+	 * logged
+	 ******************************************************************************/
+	void check_format()
+	{
+		uint16_t version = 0;
+		bool version_read = true;
+
+		// Not written by FW before format versions (version 0) or on a new flash
+		if(STORAGE_FS.exists(DATA_STORE_FORMAT_PATH))
+		{
+			File f = STORAGE_FS.open(DATA_STORE_FORMAT_PATH, FILE_READ);
+			version_read = f && f.read((uint8_t*)&version, sizeof(version)) == sizeof(version);
+
+			if(f)
+				f.close();
+		}
+
+		if(version_read && version == DATA_STORE_FORMAT_VERSION)
+			return;
+
+		if(version_read)
+		{
+			debug_print(F("Store format changed, migrating stores. Previous version: "));
+			debug_println(version, DEC);
+		}
+		else
+			debug_println_e(F("Could not read store format version, migrating stores."));
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			const StoreDescriptor *store = &STORES[i];
+			const StoreLayouts *layouts = get_old_layouts(store->id);
+
+			int migrated = layouts != NULL ?
+				store->ops->migrate(layouts->old_data_sizes, layouts->count, layouts->upgrade) :
+				store->ops->migrate(NULL, 0, NULL);
+
+			// Files of no known layout can't be read back. Kept when the version is
+			// unknown, the store may be fine and reads skip entries failing CRC
+			if(migrated < 0 && version_read)
+			{
+				debug_print_w(F("Store format unknown, clearing: "));
+				debug_println(store->name);
+
+				store->ops->clear_all();
+				Log::log(Log::DATA_STORE_FORMAT_MISMATCH, store->id, version);
+			}
+		}
+
+		File f = STORAGE_FS.open(DATA_STORE_FORMAT_PATH, FILE_WRITE);
+		if(!f || f.write((uint8_t*)&DATA_STORE_FORMAT_VERSION, sizeof(DATA_STORE_FORMAT_VERSION)) != sizeof(DATA_STORE_FORMAT_VERSION))
+			debug_println_e(F("Could not write store format version."));
+
+		if(f)
+			f.close();
+
+		Log::log(Log::DATA_STORE_FORMAT_CHANGED, version, DATA_STORE_FORMAT_VERSION);
+	}
+
+	/******************************************************************************
+	 * Clean up every store that reached its file count limit or is over its quota
+	 * Temporary solution to work around SPIFFS bugs, until migration to LittleFS
+	 ******************************************************************************/
+	void cleanup_all()
+	{
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			const StoreDescriptor *store = &STORES[i];
+
+			store->ops->cleanup(false);
+
+			if(store->quota_bytes > 0 && get_stored_bytes(store) > store->quota_bytes)
+			{
+				debug_print_w(F("Store over quota, cleaning up: "));
+				debug_println(store->name);
+
+				store->ops->cleanup(true);
+			}
+		}
+
+		if(FLAGS.STORE_ARCHIVE)
+			prune_archives();
+	}
+
+	/******************************************************************************
+	 * Merge partially filled files of stores, up to STORE_COMPACT_MAX_FILES files
+	 * in total so an idle wake up stays short
+	 ******************************************************************************/
+	void compact_all()
+	{
+		int budget = STORE_COMPACT_MAX_FILES;
+
+		for(int i = 0; i < STORE_COUNT && budget > 0; i++)
+			budget -= STORES[i].ops->compact(budget);
+	}
+
+	/******************************************************************************
+	 * Delete all data of every store
+	 ******************************************************************************/
+	void clear_all()
+	{
+		for(int i = 0; i < STORE_COUNT; i++)
+			STORES[i].ops->clear_all();
+	}
+
+	/******************************************************************************
+	 * Data waiting for call home is about to fill flash: free space is low or a
+	 * store is close to the file count that triggers cleanup
+	 ******************************************************************************/
+	bool backlog_high()
+	{
+		if(Flash::mount() != RET_OK)
+			return false;
+
+		if(STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes() < BACKLOG_MIN_FREE_BYTES)
+			return true;
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			int file_count = 0, entry_count = 0;
+
+			if(!STORES[i].ops->get_usage(&file_count, &entry_count))
+				continue;
+
+			if(file_count >= BACKLOG_FILE_COUNT_WATERMARK ||
+				(uint32_t)entry_count * STORES[i].entry_size >= BACKLOG_STORE_BYTES_WATERMARK)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/******************************************************************************
+	 * Clean up archives that reached their file count limit, then delete their
+	 * oldest files store by store while flash free space is below
+	 * STORE_ARCHIVE_MIN_FREE_BYTES
+	 ******************************************************************************/
+	void prune_archives()
+	{
+		for(int i = 0; i < STORE_COUNT; i++)
+			STORES[i].ops->prune_archive(false);
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			if(Flash::mount() != RET_OK ||
+				STORAGE_FS.totalBytes() - STORAGE_FS.usedBytes() >= STORE_ARCHIVE_MIN_FREE_BYTES)
+			{
+				return;
+			}
+
+			debug_print_w(F("Flash space low, pruning archive: "));
+			debug_println(STORES[i].name);
+
+			STORES[i].ops->prune_archive(true);
+		}
+	}
+
+	/******************************************************************************
+	 * Move write buffers of stores to PSRAM, larger ones so more entries are
+	 * written to flash at once. Log store is left out, its buffer is shadowed in
+	 * RTC memory (see Log)
+	 ******************************************************************************/
+	void use_psram_buffers()
+	{
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			if(STORES[i].id == STORE_LOG)
+				continue;
+
+			if(STORES[i].ops->use_psram_buffer() != RET_OK)
+			{
+				debug_print_w(F("Could not move store buffer to PSRAM: "));
+				debug_println(STORES[i].name);
+			}
+		}
+	}
+
+	/******************************************************************************
+	 * Print files, bytes, oldest file and fragmentation of every store and flash
+	 * usage. Taken from store indexes, no dir is listed (see Flash::ls())
+	 ******************************************************************************/
+	void print_stats()
+	{
+		if(Flash::mount() != RET_OK)
+			return;
+
+		debug_printf("Flash used: %u / %u bytes\n", STORAGE_FS.usedBytes(), STORAGE_FS.totalBytes());
+
+		for(int i = 0; i < STORE_COUNT; i++)
+		{
+			StoreStats stats;
+
+			if(!STORES[i].ops->get_stats(&stats))
+			{
+				debug_printf("%s: no index\n", STORES[i].name);
+				continue;
+			}
+
+			if(stats.file_count == 0)
+				continue;
+
+			debug_printf("%s: %d files, %u bytes, oldest: %u, fragmentation: %u%%\n", STORES[i].name,
+				stats.file_count, (uint32_t)stats.entry_count * STORES[i].entry_size, stats.oldest_tstamp,
+				fragmentation_percent(&stats));
+		}
+	}
+
+	/******************************************************************************
+	 * Build FS_STATS telemetry entry, flash usage and per store stats of stores
+	 * with files. Stores are keyed by their dir name
+	 * @param tstamp Timestamp of entry
+	 * @return Length, 0 if it did not fit
+	 ******************************************************************************/
+	int build_fs_stats_payload(char *buff, int buff_size, uint32_t tstamp)
+	{
+		if(Flash::mount() != RET_OK)
+			return 0;
+
+		int len = snprintf(buff, buff_size, TB_FS_STATS_PAYLOAD_HEAD_FORMAT, tstamp, STORAGE_FS.usedBytes(),
+			STORAGE_FS.totalBytes());
+
+		for(int i = 0; i < STORE_COUNT && len > 0 && len < buff_size; i++)
+		{
+			StoreStats stats;
+
+			if(!STORES[i].ops->get_stats(&stats) || stats.file_count == 0)
+				continue;
+
+			// Dir path without the leading /
+			const char *key = STORES[i].ops->get_dir_path() + 1;
+
+			len += snprintf(buff + len, buff_size - len, TB_FS_STATS_STORE_FORMAT, key, stats.file_count,
+				key, (uint32_t)stats.entry_count * STORES[i].entry_size, key, stats.oldest_tstamp,
+				key, fragmentation_percent(&stats));
+		}
+
+		if(len > 0 && len < buff_size)
+			len += snprintf(buff + len, buff_size - len, "}}");
+
+		return len > 0 && len < buff_size ? len : 0;
+	}
+
+	/******************************************************************************
+	 * Share (%) of store file capacity left unused by partly filled files
+	 ******************************************************************************/
+	uint8_t fragmentation_percent(const StoreStats *stats)
+	{
+		if(stats->capacity <= 0)
+			return 0;
+
+		return 100 - (uint64_t)stats->entry_count * 100 / stats->capacity;
+	}
+
+	/******************************************************************************
+	 * Presence mask of water sensor data stored before it had one: fields sent
+	 * by that FW, quality fields only when any of them is set
+	 ******************************************************************************/
+	void upgrade_water_sensor_data(void *data, int old_data_size)
+	{
+		WaterSensorData::Entry *entry = (WaterSensorData::Entry*)data;
+
+		entry->present = WaterSensorData::PRESENT_PRESENCE | WaterSensorData::PRESENT_WATER_LEVEL;
+
+		if(entry->temperature != 0 || entry->dissolved_oxygen != 0 || entry->conductivity != 0 ||
+			entry->ph != 0 || entry->orp != 0 || entry->pressure != 0 || entry->depth_cm != 0 ||
+			entry->depth_ft != 0 || entry->tss != 0)
+			entry->present |= WaterSensorData::PRESENT_QUALITY;
+	}
+
+	/******************************************************************************
+	 * Older entry layouts of a store, NULL if its entry struct never changed
+	 ******************************************************************************/
+	const StoreLayouts* get_old_layouts(StoreId id)
+	{
+		for(unsigned int i = 0; i < sizeof(OLD_LAYOUTS) / sizeof(OLD_LAYOUTS[0]); i++)
+		{
+			if(OLD_LAYOUTS[i].id == id)
+				return &OLD_LAYOUTS[i];
+		}
+
+		return NULL;
+	}
+}
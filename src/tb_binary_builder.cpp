@@ -0,0 +1,285 @@
+#include "tb_binary_builder.h"
+#include "globals.h"
+#include "water_sensor_data.h"
+#include "soil_moisture_data.h"
+#include "atmos41_data.h"
+#include "lightning_data.h"
+#include "energy_profile_data.h"
+#include "fo_data.h"
+#include "common.h"
+#include "mbedtls/base64.h"
+#include <math.h>
+#include "board_features.h"
+
+/******************************************************************************
+ * Default constructor
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+TbBinaryBuilder<TStruct, TSchemaId>::TbBinaryBuilder()
+{
+	reset();
+}
+
+/******************************************************************************
+ * Append entry to payload. Nothing is added if it doesn't fit
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::add(const TStruct *entry)
+{
+	const TbJsonSchema &schema = TbJsonSchemaOf<TStruct>::SCHEMA;
+	Header *header = (Header*)_buff;
+	int start_len = _buff_len;
+	uint32_t tstamp = entry->timestamp;
+	uint16_t present = schema.present_mask(entry);
+
+	RetResult ret = header->count < 0xFF ? RET_OK : RET_ERROR;
+
+	if(ret == RET_OK)
+		ret = append(&tstamp, sizeof(tstamp));
+
+	if(ret == RET_OK && schema.is_sparse())
+		ret = append(&present, sizeof(present));
+
+	for(int i = 0; i < schema.field_count && ret == RET_OK; i++)
+	{
+		const TbJsonField *field = &schema.fields[i];
+
+		// Fields not measured are left out
+		if(!schema.is_present(field, entry))
+			continue;
+
+		if(field->type == TB_JSON_FIELD_FLOAT && field->decimals >= 0)
+			ret = append_scaled(field->read(entry), field->decimals);
+		else
+			ret = append((const uint8_t*)entry + field->offset, field->size());
+	}
+
+	if(ret != RET_OK)
+	{
+		debug_println(F("Could not add entry to binary payload."));
+		_buff_len = start_len;
+		return RET_ERROR;
+	}
+
+	_entry_ends[header->count++] = _buff_len;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Append raw bytes to payload
+ * @return RET_ERROR if they don't fit
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::append(const void *data, int size)
+{
+	if(_buff_len + size > (int)sizeof(_buff))
+		return RET_ERROR;
+
+	memcpy(_buff + _buff_len, data, size);
+	_buff_len += size;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Append value multiplied by 10^decimals and rounded, as a zigzag varint (7
+ * bits per byte, low first, high bit set on all but the last byte). Values at
+ * sensor resolution take 1-3 bytes instead of 4. NaN/Inf is written as
+ * INT32_MIN, out of range values are clamped
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::append_scaled(double val, int8_t decimals)
+{
+	int32_t scaled = INT32_MIN;
+
+	if(isfinite(val))
+	{
+		double rounded = round(val * pow(10, decimals));
+		scaled = (int32_t)constrain(rounded, (double)INT32_MIN + 1, (double)INT32_MAX);
+	}
+
+	uint32_t zigzag = ((uint32_t)scaled << 1) ^ (uint32_t)(scaled >> 31);
+
+	do
+	{
+		uint8_t byte = zigzag & 0x7F;
+		zigzag >>= 7;
+
+		if(zigzag != 0)
+			byte |= 0x80;
+
+		if(append(&byte, sizeof(byte)) != RET_OK)
+			return RET_ERROR;
+	}while(zigzag != 0);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Build and write output (JSON wrapped base64) to buffer
+ * @param beautify Ignored, kept for JsonBuilderBase compatibility
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::build(char *buff_out, int buff_size, bool beautify)
+{
+	const char prefix[] = "{\"" BINARY_TELEMETRY_KEY "\":\"";
+	const char suffix[] = "\"}";
+
+	int prefix_len = strlen(prefix);
+	size_t encoded_len = 0;
+
+	// Room for prefix, suffix and null termination
+	if(buff_size < prefix_len + (int)sizeof(suffix))
+		return RET_ERROR;
+
+	memcpy(buff_out, prefix, prefix_len);
+
+	if(mbedtls_base64_encode((unsigned char*)buff_out + prefix_len, buff_size - prefix_len - sizeof(suffix) + 1,
+		&encoded_len, _buff, _buff_len) != 0)
+	{
+		debug_println_e(F("Binary payload does not fit output buffer."));
+		buff_out[0] = '\0';
+		return RET_ERROR;
+	}
+
+	memcpy(buff_out + prefix_len + encoded_len, suffix, sizeof(suffix));
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write output (JSON wrapped base64) directly to a stream, measure() bytes
+ * are written
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::build(Print &out)
+{
+	// Encode in chunks of whole 3 byte groups so no padding is added in between
+	const int chunk_size = 48;
+	unsigned char encoded[(chunk_size / 3) * 4 + 1];
+	size_t encoded_len = 0;
+
+	out.print("{\"" BINARY_TELEMETRY_KEY "\":\"");
+
+	for(int offset = 0; offset < _buff_len; offset += chunk_size)
+	{
+		int len = _buff_len - offset < chunk_size ? _buff_len - offset : chunk_size;
+
+		if(mbedtls_base64_encode(encoded, sizeof(encoded), &encoded_len, _buff + offset, len) != 0)
+			return RET_ERROR;
+
+		out.write(encoded, encoded_len);
+	}
+
+	out.print("\"}");
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Check if no entries have been added
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+bool TbBinaryBuilder<TStruct, TSchemaId>::is_empty()
+{
+	return _buff_len <= (int)sizeof(Header);
+}
+
+/******************************************************************************
+ * Number of entries added
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int TbBinaryBuilder<TStruct, TSchemaId>::get_count()
+{
+	return ((Header*)_buff)->count;
+}
+
+/******************************************************************************
+ * Sequence numbers are not part of the binary format, ignored
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::set_seq(uint32_t seq)
+{
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Remove entries added after the first count ones
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::truncate(int count)
+{
+	Header *header = (Header*)_buff;
+
+	if(count >= header->count)
+		return RET_OK;
+
+	if(count < 0)
+		count = 0;
+
+	_buff_len = count > 0 ? _entry_ends[count - 1] : sizeof(Header);
+	header->count = count;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Length of output build() would write, without null termination
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int TbBinaryBuilder<TStruct, TSchemaId>::measure()
+{
+	// Base64 output is 4 bytes for every 3 input bytes, padded
+	return strlen("{\"" BINARY_TELEMETRY_KEY "\":\"\"}") + ((_buff_len + 2) / 3) * 4;
+}
+
+/******************************************************************************
+ * Reset object for reuse
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbBinaryBuilder<TStruct, TSchemaId>::reset()
+{
+	Header *header = (Header*)_buff;
+
+	header->version = BINARY_TELEMETRY_VERSION;
+	header->schema_id = TSchemaId;
+	// Entries are variable length
+	header->entry_size = 0;
+	header->count = 0;
+
+	_buff_len = sizeof(Header);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Print payload. Used for debugging
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+void TbBinaryBuilder<TStruct, TSchemaId>::print()
+{
+	ScratchBuffer buff(TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE);
+	if(buff.get() == NULL)
+		return;
+
+	build(buff.get(), buff.size(), false);
+
+	debug_println(buff.get());
+	debug_print(F("Length: "));
+	debug_println(strlen(buff.get()), DEC);
+}
+
+// Forward declarations
+template class TbBinaryBuilder<WaterSensorData::Entry, BINARY_SCHEMA_WATER_SENSOR_DATA>;
+#if FEATURE_ATMOS41
+template class TbBinaryBuilder<Atmos41Data::Entry, BINARY_SCHEMA_ATMOS41_DATA>;
+#endif
+#if FEATURE_SOIL_MOISTURE
+template class TbBinaryBuilder<SoilMoistureData::Entry, BINARY_SCHEMA_SOIL_MOISTURE_DATA>;
+#endif
+template class TbBinaryBuilder<FoData::StoreEntry, BINARY_SCHEMA_FO_DATA>;
+#if FEATURE_LIGHTNING
+template class TbBinaryBuilder<LightningData::Entry, BINARY_SCHEMA_LIGHTNING_DATA>;
+#endif
+template class TbBinaryBuilder<EnergyProfileData::Entry, BINARY_SCHEMA_ENERGY_PROFILE_DATA>;
@@ -0,0 +1,363 @@
+#include "tb_columnar_builder.h"
+#include "common.h"
+#include <math.h>
+#include "board_features.h"
+
+/******************************************************************************
+* Print adapters used to build into a buffer and to measure output
+******************************************************************************/
+class ColumnarBufferPrint : public Print
+{
+public:
+	ColumnarBufferPrint(char *buff, int size) : _buff(buff), _size(size) {}
+
+	size_t write(uint8_t c)
+	{
+		if(_len >= _size - 1)
+		{
+			_overflow = true;
+			return 0;
+		}
+
+		_buff[_len++] = c;
+		_buff[_len] = '\0';
+
+		return 1;
+	}
+
+	bool overflow() const
+	{
+		return _overflow;
+	}
+
+private:
+	char *_buff;
+	int _size;
+	int _len = 0;
+	bool _overflow = false;
+};
+
+class ColumnarCountPrint : public Print
+{
+public:
+	size_t write(uint8_t c)
+	{
+		_len++;
+		return 1;
+	}
+
+	size_t write(const uint8_t *buff, size_t size)
+	{
+		_len += size;
+		return size;
+	}
+
+	int length() const
+	{
+		return _len;
+	}
+
+private:
+	int _len = 0;
+};
+
+/******************************************************************************
+ * Default constructor
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+TbColumnarBuilder<TStruct, TSchemaId>::TbColumnarBuilder()
+{
+	reset();
+}
+
+/******************************************************************************
+ * Add entry to request
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::add(const TStruct *entry)
+{
+	if(_count >= COLUMNAR_TELEMETRY_MAX_ENTRIES)
+	{
+		debug_println(F("Could not add entry to columnar payload."));
+		return RET_ERROR;
+	}
+
+	memcpy(&_entries[_count++], entry, sizeof(TStruct));
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Build and write output to buffer
+ * @param beautify Ignored, kept for JsonBuilderBase compatibility
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::build(char *buff_out, int buff_size, bool beautify)
+{
+	if(buff_size < 1)
+		return RET_ERROR;
+
+	buff_out[0] = '\0';
+
+	ColumnarBufferPrint out(buff_out, buff_size);
+	build(out);
+
+	if(out.overflow())
+	{
+		debug_println_e(F("Columnar payload does not fit output buffer."));
+		buff_out[0] = '\0';
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Encode entries and write output directly to a stream
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::build(Print &out)
+{
+	const TbJsonSchema &schema = TbJsonSchemaOf<TStruct>::SCHEMA;
+
+	out.printf("{\"" COLUMNAR_TELEMETRY_KEY "\":{\"v\":%u,\"s\":%u,\"n\":%d,\"t0\":%u",
+		COLUMNAR_TELEMETRY_VERSION, TSchemaId, _count, _count > 0 ? _entries[0].timestamp : 0);
+
+	//
+	// Timestamps, base and interval if evenly spaced, all deltas otherwise
+	//
+	int32_t interval = _count > 1 ? (int32_t)(_entries[1].timestamp - _entries[0].timestamp) : 0;
+	bool even = true;
+
+	for(int i = 2; i < _count && even; i++)
+	{
+		if((int32_t)(_entries[i].timestamp - _entries[i - 1].timestamp) != interval)
+			even = false;
+	}
+
+	if(even)
+	{
+		out.printf(",\"dt\":%d", interval);
+	}
+	else
+	{
+		out.print(",\"td\":[");
+
+		for(int i = 1; i < _count; i++)
+			out.printf(i > 1 ? ",%d" : "%d", (int32_t)(_entries[i].timestamp - _entries[i - 1].timestamp));
+
+		out.print("]");
+	}
+
+	//
+	// Presence masks, only if they differ between entries. Columns not
+	// present in any entry are left out
+	//
+	uint16_t present_any = 0;
+	bool present_same = true;
+
+	for(int i = 0; i < _count; i++)
+	{
+		uint16_t mask = schema.present_mask(&_entries[i]);
+
+		present_any |= mask;
+
+		if(i > 0 && mask != schema.present_mask(&_entries[0]))
+			present_same = false;
+	}
+
+	if(!present_same)
+	{
+		out.print(",\"p\":[");
+
+		for(int i = 0; i < _count; i++)
+			out.printf(i > 0 ? ",%u" : "%u", schema.present_mask(&_entries[i]));
+
+		out.print("]");
+	}
+
+	//
+	// Keys and scale of every column
+	//
+	bool first = true;
+
+	out.print(",\"k\":[");
+	for(int f = 0; f < schema.field_count; f++)
+	{
+		if(!column_present(&schema.fields[f], present_any))
+			continue;
+
+		out.printf(first ? "\"%s\"" : ",\"%s\"", schema.fields[f].key);
+		first = false;
+	}
+
+	first = true;
+
+	out.print("],\"x\":[");
+	for(int f = 0; f < schema.field_count; f++)
+	{
+		if(!column_present(&schema.fields[f], present_any))
+			continue;
+
+		out.printf(first ? "%d" : ",%d", decimals(&schema.fields[f]));
+		first = false;
+	}
+
+	//
+	// Columns, first value followed by deltas. Value of an entry without the
+	// field repeats the previous one (delta 0)
+	//
+	first = true;
+
+	out.print("],\"d\":[");
+	for(int f = 0; f < schema.field_count; f++)
+	{
+		if(!column_present(&schema.fields[f], present_any))
+			continue;
+
+		out.print(first ? "[" : ",[");
+		first = false;
+
+		int32_t prev = 0;
+		for(int i = 0; i < _count; i++)
+		{
+			int32_t val = schema.is_present(&schema.fields[f], &_entries[i]) ?
+				scaled(&schema.fields[f], &_entries[i]) : prev;
+
+			out.printf(i > 0 ? ",%d" : "%d", val - prev);
+			prev = val;
+		}
+
+		out.print("]");
+	}
+
+	out.print("]}}");
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Field value of entry multiplied by 10^decimals and rounded
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int32_t TbColumnarBuilder<TStruct, TSchemaId>::scaled(const TbJsonField *field, const TStruct *entry)
+{
+	double val = field->read(entry);
+
+	if(!isfinite(val))
+		return 0;
+
+	return (int32_t)lround(val * pow(10, decimals(field)));
+}
+
+/******************************************************************************
+ * Check if field is present in any entry
+ * @param present_any Presence masks of all entries or'ed
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+bool TbColumnarBuilder<TStruct, TSchemaId>::column_present(const TbJsonField *field, uint16_t present_any)
+{
+	return field->present_bit == 0 || (present_any & field->present_bit);
+}
+
+/******************************************************************************
+ * Decimals field is scaled by
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int TbColumnarBuilder<TStruct, TSchemaId>::decimals(const TbJsonField *field)
+{
+	if(field->type != TB_JSON_FIELD_FLOAT)
+		return 0;
+
+	return field->decimals >= 0 ? field->decimals : COLUMNAR_TELEMETRY_DEFAULT_DECIMALS;
+}
+
+/******************************************************************************
+ * Check if no entries have been added
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+bool TbColumnarBuilder<TStruct, TSchemaId>::is_empty()
+{
+	return _count < 1;
+}
+
+/******************************************************************************
+ * Number of entries added
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int TbColumnarBuilder<TStruct, TSchemaId>::get_count()
+{
+	return _count;
+}
+
+/******************************************************************************
+ * Sequence numbers are not part of the binary format, ignored
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::set_seq(uint32_t seq)
+{
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Remove entries added after the first count ones
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::truncate(int count)
+{
+	if(count < _count)
+		_count = count < 0 ? 0 : count;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Length of output build() would write, without null termination
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+int TbColumnarBuilder<TStruct, TSchemaId>::measure()
+{
+	ColumnarCountPrint out;
+	build(out);
+
+	return out.length();
+}
+
+/******************************************************************************
+ * Reset object for reuse
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+RetResult TbColumnarBuilder<TStruct, TSchemaId>::reset()
+{
+	_count = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Print payload. Used for debugging
+ *****************************************************************************/
+template <typename TStruct, uint8_t TSchemaId>
+void TbColumnarBuilder<TStruct, TSchemaId>::print()
+{
+	#if DEBUG
+		build(Serial);
+	#endif
+	debug_println();
+	debug_print(F("Length: "));
+	debug_println(measure(), DEC);
+}
+
+// Forward declarations
+template class TbColumnarBuilder<WaterSensorData::Entry, BINARY_SCHEMA_WATER_SENSOR_DATA>;
+#if FEATURE_ATMOS41
+template class TbColumnarBuilder<Atmos41Data::Entry, BINARY_SCHEMA_ATMOS41_DATA>;
+#endif
+#if FEATURE_SOIL_MOISTURE
+template class TbColumnarBuilder<SoilMoistureData::Entry, BINARY_SCHEMA_SOIL_MOISTURE_DATA>;
+#endif
+template class TbColumnarBuilder<FoData::StoreEntry, BINARY_SCHEMA_FO_DATA>;
+#if FEATURE_LIGHTNING
+template class TbColumnarBuilder<LightningData::Entry, BINARY_SCHEMA_LIGHTNING_DATA>;
+#endif
+template class TbColumnarBuilder<EnergyProfileData::Entry, BINARY_SCHEMA_ENERGY_PROFILE_DATA>;
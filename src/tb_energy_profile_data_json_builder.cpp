@@ -0,0 +1,46 @@
+#include "tb_energy_profile_data_json_builder.h"
+#include "utils.h"
+#include "common.h"
+
+/******************************************************************************
+ * Add daily summary to request
+ *****************************************************************************/
+RetResult TbEnergyProfileDataJsonBuilder::add(const EnergyProfileData::Entry *entry)
+{
+	JsonObject json_entry = _root_array.createNestedObject();
+
+	json_entry[ENERGY_PROFILE_DATA_KEY_TIMESTAMP] = (long long)entry->timestamp * 1000;
+	JsonObject values = json_entry.createNestedObject("values");
+
+	values[ENERGY_PROFILE_DATA_KEY_TIMESTAMP] = entry->timestamp;
+
+	values[ENERGY_PROFILE_DATA_KEY_SLEEP_SECS] = entry->sleep_secs;
+	values[ENERGY_PROFILE_DATA_KEY_ACTIVE_SECS] = entry->active_secs;
+	values[ENERGY_PROFILE_DATA_KEY_GSM_SECS] = entry->gsm_secs;
+	values[ENERGY_PROFILE_DATA_KEY_GPRS_SECS] = entry->gprs_secs;
+	values[ENERGY_PROFILE_DATA_KEY_RF_SECS] = entry->rf_secs;
+	values[ENERGY_PROFILE_DATA_KEY_SDI12_SECS] = entry->sdi12_secs;
+	values[ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_SECS] = entry->water_sensors_secs;
+
+	values[ENERGY_PROFILE_DATA_KEY_SLEEP_MAH] = entry->sleep_mah;
+	values[ENERGY_PROFILE_DATA_KEY_ACTIVE_MAH] = entry->active_mah;
+	values[ENERGY_PROFILE_DATA_KEY_GSM_MAH] = entry->gsm_mah;
+	values[ENERGY_PROFILE_DATA_KEY_GPRS_MAH] = entry->gprs_mah;
+	values[ENERGY_PROFILE_DATA_KEY_RF_MAH] = entry->rf_mah;
+	values[ENERGY_PROFILE_DATA_KEY_SDI12_MAH] = entry->sdi12_mah;
+	values[ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_MAH] = entry->water_sensors_mah;
+	values[ENERGY_PROFILE_DATA_KEY_SOLAR_MAH] = entry->solar_mah;
+	values[ENERGY_PROFILE_DATA_KEY_NVS_COMMITS] = entry->nvs_commits;
+	values[ENERGY_PROFILE_DATA_KEY_CPU_MAX_SECS] = entry->cpu_max_secs;
+	values[ENERGY_PROFILE_DATA_KEY_CPU_MAX_MAH] = entry->cpu_max_mah;
+
+	// Check the last one, no need to check all, if last doesnt fit into
+	// the json doc, doc is full already
+	if((values[ENERGY_PROFILE_DATA_KEY_NVS_COMMIT_MS] = entry->nvs_commit_ms) == false)
+	{
+		debug_println(F("Could not add energy profile data to JSON."));
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
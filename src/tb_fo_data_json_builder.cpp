@@ -14,16 +14,19 @@ RetResult TbFoDataJsonBuilder::add(const FoData::StoreEntry *entry)
 	JsonObject values = json_entry.createNestedObject("values");
 
 	values[FO_DATA_KEY_PACKETS] = entry->packets;
-	values[FO_DATA_KEY_TEMP] = entry->temp;
+	values[FO_DATA_KEY_TEMP] = round(entry->temp * 10) / 10;
 	values[FO_DATA_KEY_HUMIDITY] = entry->hum;	
-	values[FO_DATA_KEY_RAIN] = entry->rain;
-	values[FO_DATA_KEY_RAIN_RATE_HR] = entry->rain_hourly;
+	values[FO_DATA_KEY_RAIN] = round(entry->rain * 100) / 100;
+	values[FO_DATA_KEY_RAIN_RATE_HR] = round(entry->rain_hourly * 100) / 100;
 	values[FO_DATA_KEY_WIND_DIR] = entry->wind_dir;
-	values[FO_DATA_KEY_WIND_SPEED] = entry->wind_speed;
-	values[FO_DATA_KEY_WIND_GUST] = entry->wind_gust;
+	values[FO_DATA_KEY_WIND_SPEED] = round(entry->wind_speed * 100) / 100;
+	values[FO_DATA_KEY_WIND_GUST] = round(entry->wind_gust * 10) / 10;
 	values[FO_DATA_KEY_UV] = entry->uv;
 	values[FO_DATA_KEY_UV_INDEX] = entry->uv_index;
 	values[FO_DATA_KEY_SOLAR_RADIATION] = entry->solar_radiation;
+	values[FO_DATA_KEY_TEMP_STD] = round(entry->temp_std * 100) / 100;
+	values[FO_DATA_KEY_WIND_SPEED_STD] = round(entry->wind_speed_std * 100) / 100;
+	values[FO_DATA_KEY_WIND_GUST_MAX] = round(entry->wind_gust_max * 10) / 10;
 
 	// Check the last one, no need to check all, if last doesnt fit into
 	// the json doc, doc is full already
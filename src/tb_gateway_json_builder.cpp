@@ -0,0 +1,187 @@
+#include "tb_gateway_json_builder.h"
+#include "tb_json_schema.h"
+#include "globals.h"
+#include "common.h"
+
+/******************************************************************************
+ * Default constructor
+ *****************************************************************************/
+TbGatewayJsonBuilder::TbGatewayJsonBuilder()
+{
+	reset();
+}
+
+/******************************************************************************
+ * Add entry to the array of its device. Values are written with the schema of
+ * the entry's store
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::add(const RelayData::Entry *entry)
+{
+	if(entry->store >= SENSOR_STORE_COUNT || _count >= TB_GATEWAY_JSON_MAX_ENTRIES)
+		return RET_ERROR;
+
+	const TbJsonSchema *schema = tb_json_sensor_store_schema((SensorStore)entry->store);
+
+	char name[TB_GATEWAY_DEVICE_NAME_SIZE];
+	RelayData::get_device_name(entry->leaf_id, name, sizeof(name));
+
+	// Added before the array lookup, truncate() finds it by id
+	_entry_devices[_count++] = entry->leaf_id;
+
+	JsonArray device_array = _root[name];
+	if(device_array.isNull())
+		device_array = _root.createNestedArray(name);
+
+	// All sensor data structs start with the timestamp
+	uint32_t tstamp = 0;
+	memcpy(&tstamp, entry->data, sizeof(tstamp));
+
+	JsonObject json_entry = device_array.createNestedObject();
+	json_entry[RELAY_DATA_KEY_TS] = (long long)tstamp * schema->ts_multiplier;
+
+	JsonObject values = json_entry.createNestedObject("values");
+
+	for(int i = 0; i < schema->field_count; i++)
+	{
+		if(schema->is_present(&schema->fields[i], entry->data))
+			values[schema->fields[i].key] = schema->fields[i].read(entry->data);
+	}
+
+	// Check the last one, no need to check all, if last doesnt fit into
+	// the json doc, doc is full already
+	if((values[RELAY_DATA_KEY_RSSI] = entry->rssi) == false)
+	{
+		debug_println(F("Could not add relayed data to JSON."));
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Set sequence number (see DataStore::Entry) of last entry added, sent as
+ * the "seq" value so the server can drop resent entries
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::set_seq(uint32_t seq)
+{
+	if(_count < 1)
+		return RET_ERROR;
+
+	char name[TB_GATEWAY_DEVICE_NAME_SIZE];
+	RelayData::get_device_name(_entry_devices[_count - 1], name, sizeof(name));
+
+	JsonArray device_array = _root[name];
+	if(device_array.isNull() || device_array.size() < 1)
+		return RET_ERROR;
+
+	JsonObject values = device_array[device_array.size() - 1]["values"];
+
+	if(values.isNull() || !values[TB_TELEMETRY_SEQ_KEY].set(seq))
+		return RET_ERROR;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Build and write output json to buffer
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::build(char *buff_out, int buff_size, bool beautify)
+{
+	if(beautify)
+	{
+		serializeJsonPretty(_json_doc, buff_out, buff_size);
+	}
+	else
+	{
+		serializeJson(_json_doc, buff_out, buff_size);
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Serialize output json directly to a stream, measure() bytes are written
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::build(Print &out)
+{
+	serializeJson(_json_doc, out);
+
+	return RET_OK;
+}
+
+bool TbGatewayJsonBuilder::is_empty()
+{
+	return _count < 1;
+}
+
+/******************************************************************************
+ * Number of entries added, of all devices
+ *****************************************************************************/
+int TbGatewayJsonBuilder::get_count()
+{
+	return _count;
+}
+
+/******************************************************************************
+ * Remove entries added after the first count ones, last added first. Device
+ * is removed when its last entry is
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::truncate(int count)
+{
+	char name[TB_GATEWAY_DEVICE_NAME_SIZE];
+
+	while(_count > count)
+	{
+		_count--;
+
+		RelayData::get_device_name(_entry_devices[_count], name, sizeof(name));
+
+		JsonArray device_array = _root[name];
+		if(device_array.isNull())
+			continue;
+
+		device_array.remove(device_array.size() - 1);
+
+		if(device_array.size() == 0)
+			_root.remove(name);
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Length of JSON build() would output, without null termination
+ *****************************************************************************/
+int TbGatewayJsonBuilder::measure()
+{
+	return measureJson(_json_doc);
+}
+
+/******************************************************************************
+ * Reset object for reuse
+ *****************************************************************************/
+RetResult TbGatewayJsonBuilder::reset()
+{
+	_json_doc.clear();
+	_root = _json_doc.to<JsonObject>();
+	_count = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Serialize beautified and print
+ * Used for debugging
+ *****************************************************************************/
+void TbGatewayJsonBuilder::print()
+{
+	ScratchBuffer buff(JSON_BUILDER_PRINT_BUFF_SIZE);
+	if(buff.get() == NULL)
+		return;
+
+	build(buff.get(), buff.size(), true);
+
+	debug_println(buff.get());
+	debug_print(F("Length: "));
+	debug_println(strlen(buff.get()), DEC);
+}
@@ -0,0 +1,295 @@
+#include "tb_json_emitter.h"
+#include "common.h"
+#include <stdarg.h>
+#include <math.h>
+#include "board_features.h"
+
+/******************************************************************************
+ * Default constructor
+ *****************************************************************************/
+template <typename TStruct>
+TbJsonEmitter<TStruct>::TbJsonEmitter()
+{
+	reset();
+}
+
+/******************************************************************************
+ * Append entry to output. Nothing is added if it doesn't fit
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::add(const TStruct *entry)
+{
+	const TbJsonSchema &schema = TbJsonSchemaOf<TStruct>::SCHEMA;
+	int start_len = _len;
+
+	if(_count >= TB_JSON_EMITTER_MAX_ENTRIES)
+	{
+		debug_println(F("Could not add entry to JSON, max entries reached."));
+		return RET_ERROR;
+	}
+
+	RetResult ret = append("%s{\"%s\":%llu,\"values\":{", _count > 0 ? "," : "", schema.ts_key,
+		(unsigned long long)entry->timestamp * schema.ts_multiplier);
+
+	bool first = true;
+	for(int i = 0; i < schema.field_count && ret == RET_OK; i++)
+	{
+		// Fields not measured are left out
+		if(!schema.is_present(&schema.fields[i], entry))
+			continue;
+
+		ret = append_field(&schema.fields[i], entry, first);
+		first = false;
+	}
+
+	if(ret == RET_OK)
+		ret = append("}}");
+
+	if(ret != RET_OK)
+	{
+		debug_println(F("Could not add sensor data to JSON."));
+		_len = start_len;
+		_buff[_len] = '\0';
+		return RET_ERROR;
+	}
+
+	_entry_ends[_count++] = _len;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Set sequence number (see DataStore::Entry) of last entry added, written as
+ * the "seq" value so the server can drop resent entries
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::set_seq(uint32_t seq)
+{
+	// Last entry ends with "}}", reopen its values
+	if(_count < 1 || _len < 3)
+		return RET_ERROR;
+
+	int start_len = _len;
+	bool empty_values = _buff[_len - 3] == '{';
+
+	_len -= 2;
+
+	if(append("%s\"%s\":%u}}", empty_values ? "" : ",", TB_TELEMETRY_SEQ_KEY, seq) != RET_OK)
+	{
+		_len = start_len;
+		strcpy(_buff + _len - 2, "}}");
+		return RET_ERROR;
+	}
+
+	_entry_ends[_count - 1] = _len;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write a single "key":value pair
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::append_field(const TbJsonField *field, const TStruct *entry, bool first)
+{
+	// Struct is packed, copy member out instead of dereferencing it
+	const uint8_t *src = (const uint8_t*)entry + field->offset;
+	const char *sep = first ? "" : ",";
+
+	switch(field->type)
+	{
+		case TB_JSON_FIELD_BOOL:
+		{
+			// Written as int, same as the JSON builders
+			bool val;
+			memcpy(&val, src, sizeof(val));
+			return append("%s\"%s\":%d", sep, field->key, val ? 1 : 0);
+		}
+		case TB_JSON_FIELD_UINT8:
+			return append("%s\"%s\":%u", sep, field->key, *src);
+		case TB_JSON_FIELD_INT16:
+		{
+			int16_t val;
+			memcpy(&val, src, sizeof(val));
+			return append("%s\"%s\":%d", sep, field->key, val);
+		}
+		case TB_JSON_FIELD_UINT16:
+		{
+			uint16_t val;
+			memcpy(&val, src, sizeof(val));
+			return append("%s\"%s\":%u", sep, field->key, val);
+		}
+		case TB_JSON_FIELD_INT32:
+		{
+			int32_t val;
+			memcpy(&val, src, sizeof(val));
+			return append("%s\"%s\":%ld", sep, field->key, (long)val);
+		}
+		case TB_JSON_FIELD_UINT32:
+		{
+			uint32_t val;
+			memcpy(&val, src, sizeof(val));
+			return append("%s\"%s\":%lu", sep, field->key, (unsigned long)val);
+		}
+		case TB_JSON_FIELD_FLOAT:
+		{
+			float val;
+			memcpy(&val, src, sizeof(val));
+
+			// No NaN/Inf in JSON
+			if(!isfinite(val))
+				return append("%s\"%s\":null", sep, field->key);
+
+			if(field->decimals >= 0)
+			{
+				float scale = powf(10, field->decimals);
+				val = roundf(val * scale) / scale;
+			}
+
+			return append("%s\"%s\":%.7g", sep, field->key, val);
+		}
+	}
+
+	return RET_ERROR;
+}
+
+/******************************************************************************
+ * Append formatted text to output
+ * @return RET_ERROR if it doesn't fit (room for the closing bracket is kept)
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::append(const char *format, ...)
+{
+	int room = sizeof(_buff) - 1 - _len;
+
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(_buff + _len, room, format, args);
+	va_end(args);
+
+	if(written < 0 || written >= room)
+		return RET_ERROR;
+
+	_len += written;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write output json to buffer
+ * @param beautify Ignored, kept for JsonBuilderBase compatibility
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::build(char *buff_out, int buff_size, bool beautify)
+{
+	if(buff_size < measure() + 1)
+	{
+		debug_println_e(F("JSON does not fit output buffer."));
+		if(buff_size > 0)
+			buff_out[0] = '\0';
+
+		return RET_ERROR;
+	}
+
+	memcpy(buff_out, _buff, _len);
+	buff_out[_len] = ']';
+	buff_out[_len + 1] = '\0';
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Write output json directly to a stream, measure() bytes are written
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::build(Print &out)
+{
+	out.write((const uint8_t*)_buff, _len);
+	out.write(']');
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Check if no entries have been added
+ *****************************************************************************/
+template <typename TStruct>
+bool TbJsonEmitter<TStruct>::is_empty()
+{
+	return _count < 1;
+}
+
+/******************************************************************************
+ * Number of entries added
+ *****************************************************************************/
+template <typename TStruct>
+int TbJsonEmitter<TStruct>::get_count()
+{
+	return _count;
+}
+
+/******************************************************************************
+ * Remove entries added after the first count ones
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::truncate(int count)
+{
+	if(count < _count)
+	{
+		_count = count < 0 ? 0 : count;
+		_len = _count > 0 ? _entry_ends[_count - 1] : 1;
+		_buff[_len] = '\0';
+	}
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Length of JSON build() would output, without null termination
+ *****************************************************************************/
+template <typename TStruct>
+int TbJsonEmitter<TStruct>::measure()
+{
+	// Closing bracket
+	return _len + 1;
+}
+
+/******************************************************************************
+ * Reset object for reuse
+ *****************************************************************************/
+template <typename TStruct>
+RetResult TbJsonEmitter<TStruct>::reset()
+{
+	_buff[0] = '[';
+	_buff[1] = '\0';
+	_len = 1;
+	_count = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+ * Print output. Used for debugging
+ *****************************************************************************/
+template <typename TStruct>
+void TbJsonEmitter<TStruct>::print()
+{
+	debug_print(_buff);
+	debug_println("]");
+	debug_print(F("Length: "));
+	debug_println(measure(), DEC);
+}
+
+// Forward declarations
+template class TbJsonEmitter<WaterSensorData::Entry>;
+#if FEATURE_ATMOS41
+template class TbJsonEmitter<Atmos41Data::Entry>;
+#endif
+#if FEATURE_SOIL_MOISTURE
+template class TbJsonEmitter<SoilMoistureData::Entry>;
+#endif
+template class TbJsonEmitter<FoData::StoreEntry>;
+#if FEATURE_LIGHTNING
+template class TbJsonEmitter<LightningData::Entry>;
+#endif
+template class TbJsonEmitter<EnergyProfileData::Entry>;
@@ -0,0 +1,246 @@
+#include "tb_json_schema.h"
+#include <string.h>
+
+/******************************************************************************
+ * Read field value of entry. Struct is packed, member is copied out instead of
+ * being dereferenced
+ *****************************************************************************/
+double TbJsonField::read(const void *entry) const
+{
+	const uint8_t *src = (const uint8_t*)entry + offset;
+
+	switch(type)
+	{
+		case TB_JSON_FIELD_BOOL:
+			return *src ? 1 : 0;
+		case TB_JSON_FIELD_UINT8:
+			return *src;
+		case TB_JSON_FIELD_INT16:
+		{
+			int16_t val;
+			memcpy(&val, src, sizeof(val));
+			return val;
+		}
+		case TB_JSON_FIELD_UINT16:
+		{
+			uint16_t val;
+			memcpy(&val, src, sizeof(val));
+			return val;
+		}
+		case TB_JSON_FIELD_INT32:
+		{
+			int32_t val;
+			memcpy(&val, src, sizeof(val));
+			return val;
+		}
+		case TB_JSON_FIELD_UINT32:
+		{
+			uint32_t val;
+			memcpy(&val, src, sizeof(val));
+			return val;
+		}
+		case TB_JSON_FIELD_FLOAT:
+		{
+			float val;
+			memcpy(&val, src, sizeof(val));
+			return val;
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * Size of field value in struct (bytes)
+ *****************************************************************************/
+int TbJsonField::size() const
+{
+	switch(type)
+	{
+		case TB_JSON_FIELD_BOOL:
+		case TB_JSON_FIELD_UINT8:
+			return 1;
+		case TB_JSON_FIELD_INT16:
+		case TB_JSON_FIELD_UINT16:
+			return 2;
+		default:
+			return 4;
+	}
+}
+
+/******************************************************************************
+ * Check if entries carry a presence mask
+ *****************************************************************************/
+bool TbJsonSchema::is_sparse() const
+{
+	return present_offset >= 0;
+}
+
+/******************************************************************************
+ * Read presence mask of entry, all bits set if schema has none
+ *****************************************************************************/
+uint16_t TbJsonSchema::present_mask(const void *entry) const
+{
+	if(!is_sparse())
+		return 0xFFFF;
+
+	uint16_t mask;
+	memcpy(&mask, (const uint8_t*)entry + present_offset, sizeof(mask));
+
+	return mask;
+}
+
+/******************************************************************************
+ * Check if field was measured in entry
+ *****************************************************************************/
+bool TbJsonSchema::is_present(const TbJsonField *field, const void *entry) const
+{
+	return field->present_bit == 0 || (present_mask(entry) & field->present_bit);
+}
+
+/******************************************************************************
+ * Schemas. Same keys and rounding as the Tb*JsonBuilder classes. Decimals
+ * follow the sensor resolution documented in each Entry
+ *****************************************************************************/
+const TbJsonField WATER_SENSOR_DATA_FIELDS[] = {
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, dissolved_oxygen, WATER_SENSOR_DATA_KEY_DISSOLVED_OXYGEN,2,
+		WaterSensorData::PRESENT_DISSOLVED_OXYGEN),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, temperature, WATER_SENSOR_DATA_KEY_TEMPERATURE,2,
+		WaterSensorData::PRESENT_TEMPERATURE),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, conductivity, WATER_SENSOR_DATA_KEY_CONDUCTIVITY,1,
+		WaterSensorData::PRESENT_CONDUCTIVITY),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, ph, WATER_SENSOR_DATA_KEY_PH,2,
+		WaterSensorData::PRESENT_PH),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, orp, WATER_SENSOR_DATA_KEY_ORP,1,
+		WaterSensorData::PRESENT_ORP),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, pressure, WATER_SENSOR_DATA_KEY_PRESSURE,2,
+		WaterSensorData::PRESENT_PRESSURE),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, depth_cm, WATER_SENSOR_DATA_KEY_DEPTH_CM,1,
+		WaterSensorData::PRESENT_DEPTH_CM),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, depth_ft, WATER_SENSOR_DATA_KEY_DEPTH_FT,2,
+		WaterSensorData::PRESENT_DEPTH_FT),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, tss, WATER_SENSOR_DATA_KEY_TSS, -1,
+		WaterSensorData::PRESENT_TSS),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, water_level, WATER_SENSOR_DATA_KEY_WATER_LEVEL,1,
+		WaterSensorData::PRESENT_WATER_LEVEL),
+	TB_JSON_SPARSE_FIELD(WaterSensorData::Entry, presence, WATER_SENSOR_DATA_KEY_WATER_PRESENCE, -1,
+		WaterSensorData::PRESENT_PRESENCE)
+};
+
+const TbJsonField ATMOS41_DATA_FIELDS[] = {
+	TB_JSON_FIELD(Atmos41Data::Entry, solar, ATMOS41_DATA_KEY_SOLAR, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, precipitation, ATMOS41_DATA_KEY_PRECIPITATION, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, strikes, ATMOS41_DATA_KEY_STRIKES, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, wind_speed, ATMOS41_DATA_KEY_WIND_SPEED, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, wind_dir, ATMOS41_DATA_KEY_WIND_DIR, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, wind_gust_speed, ATMOS41_DATA_KEY_WIND_GUST, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, air_temp, ATMOS41_DATA_KEY_AIR_TEMP, 1),
+	TB_JSON_FIELD(Atmos41Data::Entry, vapor_pressure, ATMOS41_DATA_KEY_VAPOR_PRESSURE, -1),
+	TB_JSON_FIELD(Atmos41Data::Entry, atm_pressure, ATMOS41_DATA_KEY_ATM_PRESSURE, 1),
+	TB_JSON_FIELD(Atmos41Data::Entry, rel_humidity, ATMOS41_DATA_KEY_REL_HUMIDITY, 1),
+	TB_JSON_FIELD(Atmos41Data::Entry, dew_point, ATMOS41_DATA_KEY_DEW_POINT, 1)
+};
+
+const TbJsonField SOIL_MOISTURE_DATA_FIELDS[] = {
+	TB_JSON_FIELD(SoilMoistureData::Entry, vwc, SOIL_MOISTURE_DATA_KEY_VWC, -1),
+	TB_JSON_FIELD(SoilMoistureData::Entry, temperature, SOIL_MOISTURE_DATA_KEY_TEMPERATURE, -1),
+	TB_JSON_FIELD(SoilMoistureData::Entry, conductivity, SOIL_MOISTURE_DATA_KEY_CONDUCTIVITY, -1)
+};
+
+const TbJsonField FO_DATA_FIELDS[] = {
+	TB_JSON_FIELD(FoData::StoreEntry, packets, FO_DATA_KEY_PACKETS, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, temp, FO_DATA_KEY_TEMP, 1),
+	TB_JSON_FIELD(FoData::StoreEntry, hum, FO_DATA_KEY_HUMIDITY, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, rain, FO_DATA_KEY_RAIN, 2),
+	TB_JSON_FIELD(FoData::StoreEntry, rain_hourly, FO_DATA_KEY_RAIN_RATE_HR, 2),
+	TB_JSON_FIELD(FoData::StoreEntry, wind_dir, FO_DATA_KEY_WIND_DIR, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, wind_speed, FO_DATA_KEY_WIND_SPEED, 2),
+	TB_JSON_FIELD(FoData::StoreEntry, wind_gust, FO_DATA_KEY_WIND_GUST, 1),
+	TB_JSON_FIELD(FoData::StoreEntry, uv, FO_DATA_KEY_UV, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, uv_index, FO_DATA_KEY_UV_INDEX, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, solar_radiation, FO_DATA_KEY_SOLAR_RADIATION, -1),
+	TB_JSON_FIELD(FoData::StoreEntry, temp_std, FO_DATA_KEY_TEMP_STD, 2),
+	TB_JSON_FIELD(FoData::StoreEntry, wind_speed_std, FO_DATA_KEY_WIND_SPEED_STD, 2),
+	TB_JSON_FIELD(FoData::StoreEntry, wind_gust_max, FO_DATA_KEY_WIND_GUST_MAX, 1),
+	TB_JSON_FIELD(FoData::StoreEntry, light, FO_DATA_KEY_LIGHT, -1)
+};
+
+const TbJsonField LIGHTNING_DATA_FIELDS[] = {
+	TB_JSON_FIELD(LightningData::Entry, timestamp, LIGHTNING_DATA_KEY_TIMESTAMP, -1),
+	TB_JSON_FIELD(LightningData::Entry, distance, LIGHTNING_DATA_KEY_DISTANCE, -1),
+	TB_JSON_FIELD(LightningData::Entry, energy, LIGHTNING_DATA_KEY_ENERGY, -1)
+};
+
+const TbJsonField ENERGY_PROFILE_DATA_FIELDS[] = {
+	TB_JSON_FIELD(EnergyProfileData::Entry, timestamp, ENERGY_PROFILE_DATA_KEY_TIMESTAMP, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, sleep_secs, ENERGY_PROFILE_DATA_KEY_SLEEP_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, active_secs, ENERGY_PROFILE_DATA_KEY_ACTIVE_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, gsm_secs, ENERGY_PROFILE_DATA_KEY_GSM_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, gprs_secs, ENERGY_PROFILE_DATA_KEY_GPRS_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, rf_secs, ENERGY_PROFILE_DATA_KEY_RF_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, sdi12_secs, ENERGY_PROFILE_DATA_KEY_SDI12_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, water_sensors_secs, ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, sleep_mah, ENERGY_PROFILE_DATA_KEY_SLEEP_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, active_mah, ENERGY_PROFILE_DATA_KEY_ACTIVE_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, gsm_mah, ENERGY_PROFILE_DATA_KEY_GSM_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, gprs_mah, ENERGY_PROFILE_DATA_KEY_GPRS_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, rf_mah, ENERGY_PROFILE_DATA_KEY_RF_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, sdi12_mah, ENERGY_PROFILE_DATA_KEY_SDI12_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, water_sensors_mah, ENERGY_PROFILE_DATA_KEY_WATER_SENSORS_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, solar_mah, ENERGY_PROFILE_DATA_KEY_SOLAR_MAH, 2),
+	TB_JSON_FIELD(EnergyProfileData::Entry, nvs_commits, ENERGY_PROFILE_DATA_KEY_NVS_COMMITS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, nvs_commit_ms, ENERGY_PROFILE_DATA_KEY_NVS_COMMIT_MS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, cpu_max_secs, ENERGY_PROFILE_DATA_KEY_CPU_MAX_SECS, -1),
+	TB_JSON_FIELD(EnergyProfileData::Entry, cpu_max_mah, ENERGY_PROFILE_DATA_KEY_CPU_MAX_MAH, 2)
+};
+
+#define TB_JSON_FIELD_COUNT(fields) (sizeof(fields) / sizeof(fields[0]))
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<WaterSensorData::Entry>::SCHEMA = {
+	WATER_SENSOR_DATA_KEY_TIMESTAMP, 1000, WATER_SENSOR_DATA_FIELDS, TB_JSON_FIELD_COUNT(WATER_SENSOR_DATA_FIELDS),
+	offsetof(WaterSensorData::Entry, present)
+};
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<Atmos41Data::Entry>::SCHEMA = {
+	ATMOS41_DATA_KEY_TIMESTAMP, 1000, ATMOS41_DATA_FIELDS, TB_JSON_FIELD_COUNT(ATMOS41_DATA_FIELDS), -1
+};
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<SoilMoistureData::Entry>::SCHEMA = {
+	SOIL_MOISTURE_DATA_KEY_TIMESTAMP, 1000, SOIL_MOISTURE_DATA_FIELDS, TB_JSON_FIELD_COUNT(SOIL_MOISTURE_DATA_FIELDS), -1
+};
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<FoData::StoreEntry>::SCHEMA = {
+	FO_DATA_KEY_TIMESTAMP, 1000, FO_DATA_FIELDS, TB_JSON_FIELD_COUNT(FO_DATA_FIELDS), -1
+};
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<LightningData::Entry>::SCHEMA = {
+	LIGHTNING_DATA_KEY_TIMESTAMP, 1000, LIGHTNING_DATA_FIELDS, TB_JSON_FIELD_COUNT(LIGHTNING_DATA_FIELDS), -1
+};
+
+template <>
+const TbJsonSchema TbJsonSchemaOf<EnergyProfileData::Entry>::SCHEMA = {
+	ENERGY_PROFILE_DATA_KEY_TIMESTAMP, 1000, ENERGY_PROFILE_DATA_FIELDS, TB_JSON_FIELD_COUNT(ENERGY_PROFILE_DATA_FIELDS), -1
+};
+
+/******************************************************************************
+ * Schema of entries of a sensor store (see Deadband, Retention)
+ *****************************************************************************/
+const TbJsonSchema* tb_json_sensor_store_schema(SensorStore store)
+{
+	switch(store)
+	{
+		case SENSOR_STORE_WATER_SENSORS:
+			return &TbJsonSchemaOf<WaterSensorData::Entry>::SCHEMA;
+		case SENSOR_STORE_SOIL_MOISTURE:
+			return &TbJsonSchemaOf<SoilMoistureData::Entry>::SCHEMA;
+		case SENSOR_STORE_ATMOS41:
+			return &TbJsonSchemaOf<Atmos41Data::Entry>::SCHEMA;
+		default:
+			return &TbJsonSchemaOf<FoData::StoreEntry>::SCHEMA;
+	}
+}
@@ -1,6 +1,9 @@
 #include "tb_lightning_data_json_builder.h"
 #include "utils.h"
 #include "common.h"
+#include "board_features.h"
+
+#if FEATURE_LIGHTNING
 
 /******************************************************************************
  * Add packet to request
@@ -24,4 +27,6 @@ RetResult TbLightningDataJsonBuilder::add(const LightningData::Entry *entry)
 	}
 
 	return RET_OK;
-} 
\ No newline at end of file
+}
+
+#endif
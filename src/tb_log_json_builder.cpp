@@ -8,13 +8,19 @@ RetResult TbLogJsonBuilder::add(const Log::Entry *entry)
 {
 	JsonObject json_entry = _root_array.createNestedObject();
 
-	json_entry["ts"] = (long long)entry->timestamp;
+	json_entry["ts"] = (long long)Log::get_tb_timestamp(entry);
 	JsonObject values = json_entry.createNestedObject("values");
 
-	char log_entry[48] = "";
+	char log_entry[80] = "";
 
-	// Build log value as a comma separated string
-	snprintf(log_entry, sizeof(log_entry), "%d,%d,%d", entry->code, entry->meta1, entry->meta2);
+	uint32_t metas[LOG_ENTRY_MAX_METAS] = {0};
+	int count = Log::get_metas(entry, metas, LOG_ENTRY_MAX_METAS);
+
+	// Build log value as a comma separated string. Always code and two metas, as before
+	int len = snprintf(log_entry, sizeof(log_entry), "%d,%d,%d", entry->code, metas[0], metas[1]);
+
+	for(int i = 2; i < count; i++)
+		len += snprintf(&log_entry[len], sizeof(log_entry) - len, ",%d", metas[i]);
 
 	// values["log"] = log_entry;
 
@@ -0,0 +1,49 @@
+#include "tb_rollup_data_json_builder.h"
+#include "tb_json_schema.h"
+#include "utils.h"
+#include "common.h"
+#include <math.h>
+
+/******************************************************************************
+ * Add rollup to request. Fields without values in the period are left out
+ *****************************************************************************/
+RetResult TbRollupDataJsonBuilder::add(const RollupData::Entry *entry)
+{
+	if(entry->store >= SENSOR_STORE_COUNT)
+		return RET_ERROR;
+
+	const char *store_key = SENSOR_STORE_KEYS[entry->store];
+	const TbJsonSchema *schema = tb_json_sensor_store_schema((SensorStore)entry->store);
+
+	JsonObject json_entry = _root_array.createNestedObject();
+
+	json_entry[ROLLUP_DATA_KEY_TIMESTAMP] = (long long)entry->timestamp * 1000;
+	JsonObject values = json_entry.createNestedObject("values");
+
+	char key[48];
+
+	for(int i = 0; i < entry->field_count && i < schema->field_count; i++)
+	{
+		if(isnan(entry->mean[i]))
+			continue;
+
+		snprintf(key, sizeof(key), "%s_%s%s", store_key, schema->fields[i].key, ROLLUP_DATA_KEY_MEAN_SUFFIX);
+		values[key] = entry->mean[i];
+		snprintf(key, sizeof(key), "%s_%s%s", store_key, schema->fields[i].key, ROLLUP_DATA_KEY_MIN_SUFFIX);
+		values[key] = entry->min[i];
+		snprintf(key, sizeof(key), "%s_%s%s", store_key, schema->fields[i].key, ROLLUP_DATA_KEY_MAX_SUFFIX);
+		values[key] = entry->max[i];
+	}
+
+	snprintf(key, sizeof(key), "%s%s", store_key, ROLLUP_DATA_KEY_COUNT_SUFFIX);
+
+	// Check the last one, no need to check all, if last doesnt fit into
+	// the json doc, doc is full already
+	if((values[key] = entry->count) == false)
+	{
+		debug_println(F("Could not add rollup data to JSON."));
+		return RET_ERROR;
+	}
+
+	return RET_OK;
+}
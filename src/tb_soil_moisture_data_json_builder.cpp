@@ -1,6 +1,9 @@
 #include "tb_soil_moisture_data_json_builder.h"
 #include "utils.h"
 #include "common.h"
+#include "board_features.h"
+
+#if FEATURE_SOIL_MOISTURE
 
 /******************************************************************************
  * Add packet to request
@@ -24,4 +27,6 @@ RetResult TbSoilMoistureDataJsonBuilder::add(const SoilMoistureData::Entry *entr
 	}
 
 	return RET_OK;
-} 
\ No newline at end of file
+}
+
+#endif
@@ -12,33 +12,35 @@ RetResult TbWaterSensorDataJsonBuilder::add(const WaterSensorData::Entry *entry)
 	json_entry[WATER_SENSOR_DATA_KEY_TIMESTAMP] = (long long)entry->timestamp * 1000;
 	JsonObject values = json_entry.createNestedObject("values");
 
-	// Do not include water quality fields if they are all 0
-	// The same does not apply for the water level sensor
-	// TODO: Should this function fail if no keys are added at all (both wl and quality)
-	// Because calling functions keeps track of how many entries there are in the packet
-	// Another possible solution is to add an int entry_count member and a getter which will
-	// be used by calling function
-	if(entry->dissolved_oxygen != 0 || entry->temperature != 0 ||
-		entry->ph != 0 || entry->conductivity != 0 || entry->ph != 0 ||
-		entry->orp != 0 || entry->pressure != 0 || entry->depth_cm != 0 ||
-		entry->depth_ft != 0 || entry->tss != 0)
-	{
-		values[WATER_SENSOR_DATA_KEY_DISSOLVED_OXYGEN] = entry->dissolved_oxygen;
-		values[WATER_SENSOR_DATA_KEY_TEMPERATURE] = entry->temperature;
-		values[WATER_SENSOR_DATA_KEY_CONDUCTIVITY] = entry->conductivity;
-		values[WATER_SENSOR_DATA_KEY_PH] = entry->ph;
-		values[WATER_SENSOR_DATA_KEY_ORP] = entry->orp;
-		values[WATER_SENSOR_DATA_KEY_PRESSURE] = entry->pressure;
-		values[WATER_SENSOR_DATA_KEY_DEPTH_CM] = entry->depth_cm;
-		values[WATER_SENSOR_DATA_KEY_DEPTH_FT] = entry->depth_ft;
+	// Only fields measured (see WaterSensorData::Entry::present). Rounded to
+	// sensor resolution, as in the schema (see tb_json_schema.cpp)
+	uint16_t present = entry->present;
+
+	if(present & WaterSensorData::PRESENT_DISSOLVED_OXYGEN)
+		values[WATER_SENSOR_DATA_KEY_DISSOLVED_OXYGEN] = round(entry->dissolved_oxygen * 100) / 100;
+	if(present & WaterSensorData::PRESENT_TEMPERATURE)
+		values[WATER_SENSOR_DATA_KEY_TEMPERATURE] = round(entry->temperature * 100) / 100;
+	if(present & WaterSensorData::PRESENT_CONDUCTIVITY)
+		values[WATER_SENSOR_DATA_KEY_CONDUCTIVITY] = round(entry->conductivity * 10) / 10;
+	if(present & WaterSensorData::PRESENT_PH)
+		values[WATER_SENSOR_DATA_KEY_PH] = round(entry->ph * 100) / 100;
+	if(present & WaterSensorData::PRESENT_ORP)
+		values[WATER_SENSOR_DATA_KEY_ORP] = round(entry->orp * 10) / 10;
+	if(present & WaterSensorData::PRESENT_PRESSURE)
+		values[WATER_SENSOR_DATA_KEY_PRESSURE] = round(entry->pressure * 100) / 100;
+	if(present & WaterSensorData::PRESENT_DEPTH_CM)
+		values[WATER_SENSOR_DATA_KEY_DEPTH_CM] = round(entry->depth_cm * 10) / 10;
+	if(present & WaterSensorData::PRESENT_DEPTH_FT)
+		values[WATER_SENSOR_DATA_KEY_DEPTH_FT] = round(entry->depth_ft * 100) / 100;
+	if(present & WaterSensorData::PRESENT_TSS)
 		values[WATER_SENSOR_DATA_KEY_TSS] = entry->tss;
-	}
-
-	values[WATER_SENSOR_DATA_KEY_WATER_LEVEL] = entry->water_level;
-	values[WATER_SENSOR_DATA_KEY_WATER_PRESENCE] = (int)entry->presence;
+	if(present & WaterSensorData::PRESENT_WATER_LEVEL)
+		values[WATER_SENSOR_DATA_KEY_WATER_LEVEL] = round(entry->water_level * 10) / 10;
+	if(present & WaterSensorData::PRESENT_PRESENCE)
+		values[WATER_SENSOR_DATA_KEY_WATER_PRESENCE] = (int)entry->presence;
 
-	// If lastkey didn't fit into object, object buffer is not large enough
-	if(!values.containsKey(WATER_SENSOR_DATA_KEY_WATER_PRESENCE))
+	// If a key didn't fit into object, object buffer is not large enough
+	if(_json_doc.overflowed())
 	{
 		debug_println_e(F("Could not add sensor data to JSON."));
 		return RET_ERROR;
@@ -1,6 +1,9 @@
 #include "tb_atmos41_data_json_builder.h"
 #include "utils.h"
 #include "common.h"
+#include "board_features.h"
+
+#if FEATURE_ATMOS41
 
 /******************************************************************************
  * Add packet to request
@@ -32,4 +35,6 @@ RetResult TbAtmos41DataJsonBuilder::add(const Atmos41Data::Entry *entry)
 	}
 
 	return RET_OK;
-} 
\ No newline at end of file
+}
+
+#endif
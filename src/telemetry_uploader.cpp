@@ -0,0 +1,171 @@
+#include "telemetry_uploader.h"
+#include "memory_monitor.h"
+#include "common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+namespace TelemetryUploader
+{
+	//
+	// Private functions
+	//
+	void task(void *params);
+
+	//
+	// Private vars
+	//
+	/** Uploader task handle */
+	TaskHandle_t _task = NULL;
+
+	/** Given when a job is dispatched (or task must exit) */
+	SemaphoreHandle_t _job_sem = NULL;
+
+	/** Given when a job completes (or task exited) */
+	SemaphoreHandle_t _done_sem = NULL;
+
+	/** Function sending requests */
+	SendFunc _send = NULL;
+
+	/** Current job */
+	const char *_job_data = NULL;
+	int _job_size = 0;
+	int _job_sent_size = 0;
+	RetResult _job_ret = RET_ERROR;
+
+	/** A job has been dispatched and not waited for */
+	bool _busy = false;
+
+	/** Task must exit */
+	volatile bool _stopping = false;
+
+	/******************************************************************************
+	 * Create uploader task
+	 * @param send Function that submits a single request
+	 *****************************************************************************/
+	RetResult start(SendFunc send)
+	{
+		if(_task != NULL)
+			return RET_OK;
+
+		_send = send;
+		_busy = false;
+		_stopping = false;
+
+		_job_sem = xSemaphoreCreateBinary();
+		_done_sem = xSemaphoreCreateBinary();
+
+		if(_job_sem == NULL || _done_sem == NULL ||
+			xTaskCreatePinnedToCore(task, "uploader", TELEMETRY_UPLOADER_STACK_SIZE, NULL,
+				TELEMETRY_UPLOADER_PRIORITY, &_task, TELEMETRY_UPLOADER_CORE) != pdPASS)
+		{
+			debug_println_e(F("Could not start telemetry uploader."));
+			_task = NULL;
+			stop();
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Wait for running job and delete task
+	 *****************************************************************************/
+	void stop()
+	{
+		if(_task != NULL)
+		{
+			if(_busy)
+				wait(NULL);
+
+			_stopping = true;
+			xSemaphoreGive(_job_sem);
+
+			// Task gives done semaphore right before deleting itself
+			xSemaphoreTake(_done_sem, portMAX_DELAY);
+			_task = NULL;
+		}
+
+		if(_job_sem != NULL)
+		{
+			vSemaphoreDelete(_job_sem);
+			_job_sem = NULL;
+		}
+
+		if(_done_sem != NULL)
+		{
+			vSemaphoreDelete(_done_sem);
+			_done_sem = NULL;
+		}
+	}
+
+	/******************************************************************************
+	 * Check if uploader task is running
+	 *****************************************************************************/
+	bool is_running()
+	{
+		return _task != NULL;
+	}
+
+	/******************************************************************************
+	 * Send request in the background. Data buffer must remain untouched until
+	 * wait() returns.
+	 * @return RET_ERROR if uploader not running or a request is still in flight
+	 *****************************************************************************/
+	RetResult dispatch(const char *data, int data_size)
+	{
+		if(_task == NULL || _busy)
+			return RET_ERROR;
+
+		_job_data = data;
+		_job_size = data_size;
+		_job_sent_size = data_size;
+		_job_ret = RET_ERROR;
+		_busy = true;
+
+		xSemaphoreGive(_job_sem);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Wait for dispatched request to complete
+	 * @param sent_size Bytes actually sent. Can be NULL
+	 * @return Request result
+	 *****************************************************************************/
+	RetResult wait(int *sent_size)
+	{
+		if(!_busy)
+			return RET_ERROR;
+
+		xSemaphoreTake(_done_sem, portMAX_DELAY);
+		_busy = false;
+
+		if(sent_size != NULL)
+			*sent_size = _job_sent_size;
+
+		return _job_ret;
+	}
+
+	/******************************************************************************
+	 * Uploader task
+	 *****************************************************************************/
+	void task(void *params)
+	{
+		while(true)
+		{
+			xSemaphoreTake(_job_sem, portMAX_DELAY);
+
+			if(_stopping)
+				break;
+
+			_job_ret = _send(_job_data, _job_size, &_job_sent_size);
+			MemoryMonitor::sample_task(MemoryMonitor::TASK_UPLOADER);
+
+			xSemaphoreGive(_done_sem);
+		}
+
+		xSemaphoreGive(_done_sem);
+		vTaskDelete(NULL);
+	}
+}
@@ -2,10 +2,13 @@
 #include "rtc.h"
 #include "log.h"
 #include "sdi12_sensor.h"
+#include "sdi12_registry.h"
 #include "common.h"
 #include "teros12.h"
 #include "power_control.h"
-#include "water_sensors.h"
+#include "board_features.h"
+
+#if FEATURE_SOIL_MOISTURE
 
 namespace Teros12
 {
@@ -13,6 +16,9 @@ namespace Teros12
     * Private functions
     ******************************************************************************/
    RetResult measure_data(SoilMoistureData::Entry *data);
+   RetResult measure_ddi(SoilMoistureData::Entry *data);
+   bool can_capture_ddi();
+   RetResult save(SoilMoistureData::Entry *data);
 
     /******************************************************************************
      * Initialization
@@ -30,11 +36,31 @@ namespace Teros12
     {
         debug_println("Measuring Teros12");
 
-        WaterSensors::on();
+        RetResult ret = RET_ERROR;
 
-        RetResult ret = measure_data(data);
+        if(can_capture_ddi())
+        {
+            // Listen from power up on, sensor settles only if falling back
+            PowerControl::acquire(PowerControl::DEVICE_TEROS12, false);
 
-        WaterSensors::off();
+            ret = measure_ddi(data);
+
+            if(ret == RET_OK)
+                PowerControl::ready(PowerControl::DEVICE_TEROS12);
+            else
+                PowerControl::wait_settled(PowerControl::DEVICE_TEROS12);
+        }
+        else
+        {
+            PowerControl::acquire(PowerControl::DEVICE_TEROS12);
+        }
+
+        if(ret != RET_OK)
+        {
+            while((ret = measure_data(data)) != RET_OK && PowerControl::retry_warming_up(PowerControl::DEVICE_TEROS12));
+        }
+
+        PowerControl::release(PowerControl::DEVICE_TEROS12);
 
         return ret;
     }
@@ -56,6 +82,7 @@ namespace Teros12
 
         // I2C slave SDI12 adapter
         Sdi12Sensor sensor(PIN_SDI12_DATA);
+        sensor.set_address(Sdi12Registry::get_address(Sdi12Registry::MODEL_TEROS12));
 
         // Output variables
         // Seconds to wait
@@ -78,6 +105,8 @@ namespace Teros12
             return RET_ERROR;
         }
 
+        PowerControl::ready(PowerControl::DEVICE_TEROS12);
+
         // Check if seconds within range. Range values are chosen empirically.
         // If values not within range, something is wrong with the response or with the
         // configuration of Aquatroll
@@ -94,9 +123,7 @@ namespace Teros12
             return RET_ERROR;
         }
 
-        debug_print(F("Waiting (sec): "));
-        debug_println(secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS);
-        delay((secs_to_wait + SDI12_MEASURE_EXTRA_WAIT_SECS) * 1000);
+        sensor.wait_measurement(secs_to_wait, PIN_WATER_SENSORS_PWR);
 
         //
         // Request measurement data
@@ -164,6 +191,62 @@ namespace Teros12
         return RET_OK;
     }
 
+    /******************************************************************************
+     * Check if the DDI string can be captured: only sent on power up and only
+     * readable when Teros12 is the only sensor on the bus
+     ******************************************************************************/
+    bool can_capture_ddi()
+    {
+        if(!FLAGS.TEROS12_DDI_CAPTURE)
+            return false;
+
+        // Already powered, power up string is gone
+        if(PowerControl::is_on(PowerControl::RAIL_SENSORS))
+            return false;
+
+        return Sdi12Registry::get_count() == 1 && Sdi12Registry::find(Sdi12Registry::MODEL_TEROS12) != NULL;
+    }
+
+    /******************************************************************************
+     * Fill data structure from the DDI string sent on power up. Values come in
+     * the same order and units as the SDI12 measurement
+     * @param data Output structure
+     ******************************************************************************/
+    RetResult measure_ddi(SoilMoistureData::Entry *data)
+    {
+        memset(data, 0, sizeof(SoilMoistureData::Entry));
+
+        Sdi12Sensor sensor(PIN_SDI12_DATA);
+
+        float vals[TEROS12_NUMBER_OF_MEASUREMENTS] = {0};
+        uint8_t count = 0;
+
+        if(sensor.read_ddi(vals, TEROS12_NUMBER_OF_MEASUREMENTS, &count, TEROS12_DDI_TIMEOUT_MS) != RET_OK ||
+            count != TEROS12_NUMBER_OF_MEASUREMENTS)
+        {
+            debug_println(F("No valid DDI string, measuring over SDI12."));
+            Log::log(Log::SOIL_MOISTURE_DDI_FAILED, sensor.get_last_error());
+            return RET_ERROR;
+        }
+
+        // All zero is as invalid as over SDI12, let SDI12 retry it
+        if(vals[0] == 0 && vals[1] == 0 && vals[2] == 0)
+        {
+            Log::log(Log::SOIL_MOISTURE_DDI_FAILED, Sdi12Sensor::ERROR_INVALID_RESPONSE);
+            return RET_ERROR;
+        }
+
+        data->vwc = vals[0];
+        data->temperature = vals[1];
+        data->conductivity = vals[2];
+
+        Utils::serial_style(STYLE_GREEN);
+        debug_println(F("Teros12 data received from DDI string."));
+        Utils::serial_style(STYLE_RESET);
+
+        return RET_OK;
+    }
+
     /******************************************************************************
 	* Read soil moisture sensor and log data in memory
 	* @return RET_ERROR Failed to read
@@ -179,22 +262,65 @@ namespace Teros12
         // 
         if(Teros12::measure(&data) != RET_OK)
         {
-            Serial.println(F("Failed reading soil moisture"));
+            debug_println_e(F("Failed reading soil moisture"));
             Log::log(Log::SOIL_MOISTURE_MEASUREMENT_FAILED);
             return RET_ERROR;
         }
 
-		//
-		// Set timestamp and save
-		//
-		data.timestamp = RTC::get_timestamp();
+		return save(&data);
+	}
+
+    /******************************************************************************
+	* Log values measured by the caller, eg. together with other sensors on the
+    * bus (see Sdi12Bus). Sensor power is up to the caller
+	* @param values Values in measurement order: VWC, temperature, conductivity
+	* @param count Number of values received
+	* @return RET_ERROR Not all values received or all of them 0
+	******************************************************************************/
+	RetResult log_values(const float *values, uint8_t count)
+	{
+		SoilMoistureData::Entry data = {0};
+
+        Log::log(Log::SOIL_MOISTURE_SENSOR_MEASUREMENT_LOG);
+
+        if(count != TEROS12_NUMBER_OF_MEASUREMENTS)
+        {
+            debug_println_e(F("Failed reading soil moisture"));
+            Log::log(Log::SOIL_MOISTURE_MEASUREMENT_FAILED);
+            return RET_ERROR;
+        }
+
+        data.vwc = values[0];
+        data.temperature = values[1];
+        data.conductivity = values[2];
+
+        // Same check as measured here (see measure_data())
+        if(data.conductivity == 0 && data.temperature == 0 && data.vwc == 0)
+        {
+            debug_println(F("All measured vals are 0, aborting."));
+            Log::log(Log::SOIL_MOISTURE_ZERO_VALS);
+            Log::log(Log::SOIL_MOISTURE_MEASUREMENT_FAILED);
+            return RET_ERROR;
+        }
+
+		return save(&data);
+	}
+
+    /******************************************************************************
+	* Set timestamp and save measured data
+	******************************************************************************/
+	RetResult save(SoilMoistureData::Entry *data)
+	{
+		data->timestamp = RTC::get_timestamp();
 
 		debug_println(F("Soil moisture data"));
-		SoilMoistureData::print(&data);
+		SoilMoistureData::print(data);
 
-		SoilMoistureData::add(&data);
+		SoilMoistureData::add(data);
 		SoilMoistureData::get_store()->commit();
 
 		return RET_OK;
 	}
-}
\ No newline at end of file
+}
+
+#endif
@@ -46,6 +46,8 @@ namespace TestUtils
 			data.conductivity = i;
 			data.ph = i;
 			data.water_level = i;
+			data.present = WaterSensorData::PRESENT_TEMPERATURE | WaterSensorData::PRESENT_DISSOLVED_OXYGEN |
+				WaterSensorData::PRESENT_CONDUCTIVITY | WaterSensorData::PRESENT_PH | WaterSensorData::PRESENT_WATER_LEVEL;
 
 			WaterSensorData::add(&data);
 		}
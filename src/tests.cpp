@@ -1,7 +1,7 @@
 #include "tests.h"
 #include <Preferences.h>
 #include "CRC32.h"
-#include "SPIFFS.h"
+#include "storage.h"
 #include "const.h"
 #include "app_config.h"
 #include "gsm.h"
@@ -11,12 +11,33 @@
 #include "data_store.h"
 #include "data_store_reader.h"
 #include "water_sensor_data.h"
+#include "atmos41_data.h"
+#include "soil_moisture_data.h"
+#include "lightning_data.h"
+#include "fo_data.h"
+#include "sdi12_log.h"
+#include "log.h"
 #include "sleep_scheduler.h"
 #include "device_config.h"
 #include "limits.h"
 #include "remote_control.h"
 #include "device_config.h"
 #include "common.h"
+#include "tb_water_sensor_data_json_builder.h"
+#include "tb_json_emitter.h"
+#include "sdi12.h"
+#include "fo_sniffer.h"
+#include "sdi12_sensor.h"
+#include "sdi12_registry.h"
+#include "atmos41.h"
+#include "http_request.h"
+#include "tb_atmos41_data_json_builder.h"
+#include "tb_binary_builder.h"
+#include "tb_columnar_builder.h"
+#include "capture.h"
+#include "ipfs.h"
+#include "board_features.h"
+#include <new>
 
 namespace Tests
 {
@@ -37,7 +58,20 @@ namespace Tests
 		[RTC_FROM_GSM] = rtc_from_gsm,
 		[DATA_STORE] = data_store,
 		[WAKEUP_TIMES] = wakeup_times,
-		[DEVICE_CONFIG] = device_config
+		[DEVICE_CONFIG] = device_config,
+		[DATA_STORE_COMMIT_BENCHMARK] = data_store_commit_benchmark,
+		[JSON_EMITTER_BENCHMARK] = json_emitter_benchmark,
+		[SDI12_PARSE] = sdi12_parse,
+		[FO_DECODE_BENCHMARK] = fo_decode_benchmark,
+		[DATA_STORE_FILL_BENCHMARK] = data_store_fill_benchmark,
+		[JSON_BUILD_BENCHMARK] = json_build_benchmark,
+		[CRC32_BENCHMARK] = crc32_benchmark,
+		[SDI12_ROUNDTRIP_BENCHMARK] = sdi12_roundtrip_benchmark,
+		[HTTP_POST_BENCHMARK] = http_post_benchmark,
+		[SLEEP_SIMULATION] = sleep_simulation,
+		[DATA_STORE_ADD_BENCHMARK] = data_store_add_benchmark,
+		[CAPTURE_REPLAY] = capture_replay,
+		[IPFS_CID] = ipfs_cid
 	};
 
 	/** Test names mapped to their type */
@@ -45,7 +79,20 @@ namespace Tests
 		[RTC_FROM_GSM] = "RTC from GSM",
 		[DATA_STORE] = "Buffered data store",
 		[WAKEUP_TIMES] = "Wake-up times",
-		[DEVICE_CONFIG] = "Device configuration store"
+		[DEVICE_CONFIG] = "Device configuration store",
+		[DATA_STORE_COMMIT_BENCHMARK] = "Data store commit benchmark",
+		[JSON_EMITTER_BENCHMARK] = "JSON builder vs emitter benchmark",
+		[SDI12_PARSE] = "SDI12 response parsing",
+		[FO_DECODE_BENCHMARK] = "FineOffset frame decode benchmark",
+		[DATA_STORE_FILL_BENCHMARK] = "Data store add/commit/read benchmark",
+		[JSON_BUILD_BENCHMARK] = "Telemetry builders benchmark",
+		[CRC32_BENCHMARK] = "CRC32 throughput benchmark",
+		[SDI12_ROUNDTRIP_BENCHMARK] = "SDI12 command round-trip benchmark",
+		[HTTP_POST_BENCHMARK] = "HTTP POST latency benchmark",
+		[SLEEP_SIMULATION] = "Month-long sleep schedule simulation",
+		[DATA_STORE_ADD_BENCHMARK] = "Data store add latency benchmark",
+		[CAPTURE_REPLAY] = "Raw capture replay",
+		[IPFS_CID] = "IPFS CID computation"
 	};
 
 	/******************************************************************************
@@ -73,8 +120,160 @@ namespace Tests
 	//
 	// Wakeup times
 	//
-	// How many wake up "times" to calculate starting from now
-	const int WAKEUP_TIMES_SERIES_LEN = 100;
+	// Test tasks are scheduled this far in the future so they are after any real tasks
+	const int WAKEUP_TIMES_OFFSET_SEC = 60 * 60 * 24 * 7;
+
+	//
+	// Data store commit benchmark
+	//
+	// Path of benchmark data store
+	const char *BENCHMARK_STORE_PATH = "/bench";
+
+	// Times the store buffer is filled and commited for each commit mode
+	const int BENCHMARK_COMMIT_ROUNDS = 20;
+
+	template <typename TStruct>
+	RetResult benchmark_store_commit(const char *name);
+
+	//
+	// JSON emitter benchmark
+	//
+	// Times a full request is built with each method
+	const int BENCHMARK_JSON_ROUNDS = 20;
+
+	// Stack of the task each method runs in. Peak usage is measured with its high water mark
+	const int BENCHMARK_JSON_TASK_STACK_SIZE = 8192;
+
+	/** Results of a JSON benchmark task */
+	struct JsonBenchmarkResult
+	{
+		uint32_t elapsed_us;
+		uint32_t bytes;
+		uint32_t stack_used;
+		RetResult ret;
+		volatile bool done;
+	};
+
+	template <typename TBuilder>
+	void benchmark_json_task(void *param);
+
+	//
+	// FO decode benchmark
+	//
+	// Frames decoded in each timed loop
+	const int BENCHMARK_FO_DECODE_ROUNDS = 10000;
+
+	/** A captured frame and the values it decodes to */
+	struct FoFrameSample
+	{
+		uint8_t frame[FO_SNIFFER_FRAME_LEN];
+		float temp;
+		uint8_t hum;
+		uint16_t wind_dir;
+		uint32_t light;
+	};
+
+	const FoFrameSample FO_FRAME_CORPUS[] = {
+		{{0x24, 0x5A, 0xC8, 0x42, 0x67, 0x41, 0x20, 0x30, 0x00, 0x12, 0x03, 0x00, 0x01, 0x86, 0xA0, 0x57, 0x13}, 21.5, 65, 200, 10000},
+		{{0x24, 0x5A, 0x2C, 0x91, 0x5C, 0x5B, 0x05, 0x80, 0x01, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74, 0xE0}, -5.2, 91, 300, 0},
+		{{0x24, 0x5A, 0x2D, 0x42, 0xEE, 0x14, 0x07, 0x09, 0x00, 0x00, 0x05, 0xAA, 0x09, 0xFB, 0xF1, 0x10, 0xB3}, 35.0, 20, 45, 65432}
+	};
+
+	const int FO_FRAME_CORPUS_LEN = sizeof(FO_FRAME_CORPUS) / sizeof(FO_FRAME_CORPUS[0]);
+
+	//
+	// Timed benchmarks
+	//
+	/** Time spent in a benchmarked block, accumulated over its runs */
+	struct BenchTime
+	{
+		uint32_t start_cycles;
+		uint32_t start_us;
+		uint64_t cycles;
+		uint64_t us;
+	};
+
+	void bench_start(BenchTime *time);
+	void bench_stop(BenchTime *time);
+	void print_bench(const char *name, const BenchTime *time, uint32_t ops);
+
+	//
+	// Data store fill benchmark
+	//
+	// Stored entries before each timed add/commit/read round. Reads get slower as files pile up
+	const int BENCHMARK_FILL_LEVELS[] = {0, 100, 500};
+	const int BENCHMARK_FILL_LEVELS_LEN = sizeof(BENCHMARK_FILL_LEVELS) / sizeof(BENCHMARK_FILL_LEVELS[0]);
+
+	template <typename TStruct>
+	RetResult benchmark_store_fill(const char *name);
+
+	//
+	// Data store add latency benchmark
+	//
+	// Buffers filled with each of add() and reserve()/publish(), commits are not timed
+	const int BENCHMARK_ADD_ROUNDS = 20;
+
+	template <typename TStruct>
+	RetResult benchmark_store_add(const char *name);
+
+	//
+	// Telemetry builders benchmark
+	//
+	// Times a full request is built with each builder
+	const int BENCHMARK_BUILD_ROUNDS = 20;
+
+	template <typename TBuilder, typename TEntry>
+	RetResult benchmark_build(const char *name, int entries_per_req);
+
+	//
+	// CRC32 benchmark
+	//
+	// Buffer sizes checksummed, small entries up to OTA chunks
+	const int BENCHMARK_CRC32_SIZES[] = {32, 256, 4096};
+	const int BENCHMARK_CRC32_SIZES_LEN = sizeof(BENCHMARK_CRC32_SIZES) / sizeof(BENCHMARK_CRC32_SIZES[0]);
+
+	// Bytes checksummed for each size
+	const int BENCHMARK_CRC32_TOTAL_BYTES = 256 * 1024;
+
+	// Store entries checked per round with the library, per entry and per read buffer
+	const int BENCHMARK_CRC32_ENTRIES = 1000;
+
+	//
+	// SDI12 round-trip benchmark
+	//
+	// Acknowledge commands sent to the sensor
+	const int BENCHMARK_SDI12_ROUNDS = 20;
+
+	//
+	// HTTP POST benchmark
+	//
+	// Body sizes posted as client attributes
+	const int BENCHMARK_HTTP_SIZES[] = {256, 1024, 4096};
+	const int BENCHMARK_HTTP_SIZES_LEN = sizeof(BENCHMARK_HTTP_SIZES) / sizeof(BENCHMARK_HTTP_SIZES[0]);
+
+	// Requests posted for each size
+	const int BENCHMARK_HTTP_ROUNDS = 3;
+
+	//
+	// Sleep simulation
+	//
+	// Days simulated
+	const int SLEEP_SIMULATION_DAYS = 30;
+
+	// Rough figures of a TSIM node with an 18650 cell and a small panel
+	const SleepScheduler::SimEnergyModel SLEEP_SIMULATION_MODEL = {
+		.sleep_ua = 800,
+		.awake_ma = 45,
+		.modem_ma = 120,
+		.wake_secs = 2,
+		.call_home_secs = 60,
+		.sensors_secs = 10,
+		.fo_secs = 4,
+		.fo_enabled = true,
+		.battery_mah = 3000,
+		.solar_mah_per_day = 150,
+		.clock_error_ppm = 500
+	};
 
 
 	/******************************************************************************
@@ -144,7 +343,7 @@ namespace Tests
 		Utils::serial_style(STYLE_BLUE);
 		debug_println(F("# Formatting"));
 		Utils::serial_style(STYLE_RESET);
-		if(!SPIFFS.format())
+		if(Flash::format() != RET_OK)
 		{
 			debug_println(F("# Format failed."));
 			return RET_ERROR;
@@ -202,7 +401,7 @@ namespace Tests
 			debug_print(F("Smallest file must be: "));
 			debug_println(expected_smallest_file_size);
 			// Iterate all files and check if above above data is true
-			File dir = SPIFFS.open(DATA_STORE_PATH);
+			File dir = STORAGE_FS.open(DATA_STORE_PATH);
 			if(!dir)
 			{
 				debug_println(F("Could not open data store dir."));
@@ -382,7 +581,7 @@ namespace Tests
 		Utils::serial_style(STYLE_BLUE);
 		debug_println(F("# Formatting for clean up."));
 		Utils::serial_style(STYLE_RESET);
-		if(!SPIFFS.format())
+		if(Flash::format() != RET_OK)
 		{
 			debug_println(F("# Format failed."));
 			return RET_ERROR;
@@ -396,33 +595,182 @@ namespace Tests
 
 	/******************************************************************************
 	 * Sleep
-	 * Use dummy wakeup schedule and check if calc_next_wakeup returns correct vals
+	 * Add ad-hoc tasks to the deadline queue and check they come out in order
 	 ******************************************************************************/
 	RetResult wakeup_times()
 	{
-		const SleepScheduler::WakeupScheduleEntry ref_schedule[] = 
-		{
-			{ SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS, 2},
-			{ SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS, 5},
-			{ SleepScheduler::WakeupReason::REASON_CALL_HOME, 7},
-			{ SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS, 10},
-			{ SleepScheduler::WakeupReason::REASON_CALL_HOME, 40},
-			{ SleepScheduler::WakeupReason::REASON_READ_WATER_SENSORS, 42},
-			{ SleepScheduler::WakeupReason::REASON_CALL_HOME, 84},
-		};
-		const int ref_schedule_len = sizeof(ref_schedule) / sizeof(ref_schedule[0]);
+		const uint16_t ids[] = {SleepScheduler::TASK_ID_CUSTOM, SleepScheduler::TASK_ID_CUSTOM + 1,
+			SleepScheduler::TASK_ID_CUSTOM + 2};
+		const int ids_len = sizeof(ids) / sizeof(ids[0]);
+
+		uint32_t t_now = RTC::get_timestamp() + WAKEUP_TIMES_OFFSET_SEC;
+		RetResult ret = RET_OK;
+
+		// Added out of order, sub-minute interval
+		SleepScheduler::add_task(ids[0], t_now + 30, 0);
+		SleepScheduler::add_task(ids[1], t_now + 10, 15);
+		SleepScheduler::add_task(ids[2], t_now + 20, 0);
+
+		const SleepScheduler::Deadline *next = SleepScheduler::get_next_deadline();
+		if(next == NULL || next->id != ids[1] || next->due != t_now + 10)
+		{
+			debug_println_e(F("Wrong first deadline."));
+			ret = RET_ERROR;
+		}
+
+		// Update existing task, moves behind the others
+		SleepScheduler::add_task(ids[1], t_now + 40, 15);
+		next = SleepScheduler::get_next_deadline();
+		if(next == NULL || next->id != ids[2])
+		{
+			debug_println_e(F("Updated task not rescheduled."));
+			ret = RET_ERROR;
+		}
 
-		for(int i = 0; i < WAKEUP_TIMES_SERIES_LEN; i++)
+		SleepScheduler::remove_task(ids[2]);
+		next = SleepScheduler::get_next_deadline();
+		if(next == NULL || next->id != ids[0])
 		{
-			// Check which is closer
-			for(int j = 0; j < ref_schedule_len; j++)
+			debug_println_e(F("Removed task still first."));
+			ret = RET_ERROR;
+		}
+
+		for(int i = 0; i < ids_len; i++)
+		{
+			SleepScheduler::remove_task(ids[i]);
+		}
+
+		debug_println(ret == RET_OK ? F("Deadline queue OK.") : F("Deadline queue failed."));
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * SDI12
+	 * Parse a data response with more than 3 values and a valid CRC, then the
+	 * same response with a corrupted CRC. Same for a Teros12 DDI string
+	 ******************************************************************************/
+	RetResult sdi12_parse()
+	{
+		const float expected[] = {3.14, -2.5, 100, 0.001};
+		const int expected_len = sizeof(expected) / sizeof(expected[0]);
+
+		char response[] = "0+3.14-2.5+100+0.001Kef";
+		float values[expected_len] = {0};
+		uint8_t count = 0;
+
+		if(Sdi12::parse_data(response, '0', values, expected_len, &count) != Sdi12::PARSE_OK || count != expected_len)
+		{
+			debug_println_e(F("Valid response not parsed."));
+			return RET_ERROR;
+		}
+
+		for(int i = 0; i < expected_len; i++)
+		{
+			if(fabs(values[i] - expected[i]) > 0.0001)
 			{
+				debug_printf("Value %d: %f, expected: %f\n", i, values[i], expected[i]);
+				return RET_ERROR;
+			}
+		}
+
+		// Last CRC char changed
+		response[sizeof(response) - 2] = 'g';
+
+		if(Sdi12::parse_data(response, '0', values, expected_len, &count) != Sdi12::PARSE_CRC_FAIL)
+		{
+			debug_println_e(F("Corrupted CRC not detected."));
+			return RET_ERROR;
+		}
+
+		// Power up glitch, <TAB>raw temp EC<CR>, sensor type and checksum
+		char ddi[] = "\xff\t1803.55 21.6 12\rf*";
 
+		if(Sdi12::parse_ddi(ddi, values, expected_len, &count) != Sdi12::PARSE_OK || count != 3 ||
+			fabs(values[0] - 1803.55) > 0.001 || fabs(values[1] - 21.6) > 0.001 || values[2] != 12)
+		{
+			debug_println_e(F("Valid DDI string not parsed."));
+			return RET_ERROR;
+		}
+
+		ddi[sizeof(ddi) - 2] = '+';
+
+		if(Sdi12::parse_ddi(ddi, values, expected_len, &count) != Sdi12::PARSE_CRC_FAIL)
+		{
+			debug_println_e(F("Corrupted DDI checksum not detected."));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	* FineOffset frame decode. Checks decoded values of captured frames, that
+	* corruption is detected and times decode against a bitwise CRC reference
+	******************************************************************************/
+	RetResult fo_decode_benchmark()
+	{
+		for(int i = 0; i < FO_FRAME_CORPUS_LEN; i++)
+		{
+			FoDecodedPacket decoded = {0};
+			const FoFrameSample *sample = &FO_FRAME_CORPUS[i];
+
+			if(FoSniffer::decode_packet(sample->frame, &decoded) != RET_OK)
+			{
+				debug_printf("Frame %d not decoded.\n", i);
+				return RET_ERROR;
+			}
+
+			if(fabs(decoded.temp - sample->temp) > 0.01 || decoded.hum != sample->hum ||
+				decoded.wind_dir != sample->wind_dir || decoded.light != sample->light)
+			{
+				debug_printf("Frame %d decoded wrong: %2.1fC %d%% %ddeg %u lux\n", i,
+					decoded.temp, decoded.hum, decoded.wind_dir, decoded.light);
+				return RET_ERROR;
+			}
+
+			// Flip a bit, both CRC and checksum fail
+			uint8_t corrupted[FO_SNIFFER_FRAME_LEN];
+			memcpy(corrupted, sample->frame, FO_SNIFFER_FRAME_LEN);
+			corrupted[4] ^= 0x08;
+
+			if(FoSniffer::decode_packet(corrupted, &decoded) != RET_ERROR)
+			{
+				debug_printf("Corrupted frame %d not detected.\n", i);
+				return RET_ERROR;
 			}
 		}
 
-		// TODO: Not ready
+		// Bitwise CRC, checksum and decode calls, as before the lookup table
+		uint32_t start_us = micros();
+		volatile uint8_t sink = 0;
+		for(int round = 0; round < BENCHMARK_FO_DECODE_ROUNDS; round++)
+		{
+			const uint8_t *frame = FO_FRAME_CORPUS[round % FO_FRAME_CORPUS_LEN].frame;
+			uint8_t crc = 0, checksum = 0;
+			for(int i = 0; i < FO_SNIFFER_FRAME_LEN - 2; i++)
+			{
+				crc ^= frame[i];
+				for(int j = 0; j < 8; j++)
+					crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+			}
+			for(int i = 0; i < FO_SNIFFER_FRAME_LEN - 1; i++)
+				checksum += frame[i];
+			sink = sink + crc + checksum;
+		}
+		uint32_t bitwise_us = micros() - start_us;
+
+		BenchTime decode_time = {0};
+		bench_start(&decode_time);
+		FoDecodedPacket decoded;
+		for(int round = 0; round < BENCHMARK_FO_DECODE_ROUNDS; round++)
+			FoSniffer::decode_packet(FO_FRAME_CORPUS[round % FO_FRAME_CORPUS_LEN].frame, &decoded);
+		bench_stop(&decode_time);
+
+		debug_printf("%d frames, bitwise integrity check only: %u us, table integrity check and decode: %u us\n",
+			BENCHMARK_FO_DECODE_ROUNDS, bitwise_us, (uint32_t)decode_time.us);
 
+		print_bench("Decode per frame", &decode_time, BENCHMARK_FO_DECODE_ROUNDS);
 
 		return RET_OK;
 	}
@@ -477,6 +825,7 @@ namespace Tests
 		DeviceConfig::Data dummy_config;
 		dummy_config.clean_reboot = random(INT_MAX) % 2;
 		dummy_config.ota_flashed = random(INT_MAX) % 2;
+		dummy_config.fo_sniffer_id = random(0xFF);
 
 
 		// Do not include crc32 field in the calculation
@@ -486,10 +835,18 @@ namespace Tests
 		// Set
 		DeviceConfig::set_clean_reboot(dummy_config.clean_reboot);
 		DeviceConfig::set_ota_flashed(dummy_config.ota_flashed);
+		DeviceConfig::set_fo_sniffer_id(dummy_config.fo_sniffer_id);
 
 		// Write
 		DeviceConfig::commit();
 
+		// Nothing changed since commit
+		if(DeviceConfig::is_dirty())
+		{
+			debug_println(F("Config still dirty after commit."));
+			return RET_ERROR;
+		}
+
 		DeviceConfig::print(&dummy_config);
 
 		//
@@ -510,14 +867,871 @@ namespace Tests
 
 		DeviceConfig::print(read_back);
 
+		if(read_back->fo_sniffer_id != dummy_config.fo_sniffer_id ||
+			DeviceConfig::get_clean_reboot() != dummy_config.clean_reboot ||
+			DeviceConfig::get_ota_flashed() != dummy_config.ota_flashed)
+		{
+			debug_println(F("Read back config does not match."));
+			return RET_ERROR;
+		}
+
 		// Clear to finish
 		prefs.remove(DEVICE_CONFIG_NVS_NAMESPACE_NAME);
+		prefs.remove(DEVICE_CONFIG_RUNTIME_FLAGS_KEY);
 
 		debug_println(F("Done!"));
 
 		return RET_OK;
 	}
 
+	/******************************************************************************
+	 * Data store commit benchmark
+	 * Compare time needed to commit a full buffer entry by entry and as a single
+	 * block, for every store entry type
+	 ******************************************************************************/
+	RetResult data_store_commit_benchmark()
+	{
+		if(Flash::mount() != RET_OK)
+		{
+			debug_println(F("# Could not begin SPIFFS."));
+			return RET_ERROR;
+		}
+
+		RetResult ret = RET_OK;
+
+		ret = benchmark_store_commit<WaterSensorData::Entry>("WaterSensorData") == RET_OK ? ret : RET_ERROR;
+#if FEATURE_ATMOS41
+		ret = benchmark_store_commit<Atmos41Data::Entry>("Atmos41Data") == RET_OK ? ret : RET_ERROR;
+#endif
+#if FEATURE_SOIL_MOISTURE
+		ret = benchmark_store_commit<SoilMoistureData::Entry>("SoilMoistureData") == RET_OK ? ret : RET_ERROR;
+#endif
+		ret = benchmark_store_commit<Log::Entry>("Log") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_commit<SDI12Log::Entry>("SDI12Log") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_commit<FoData::StoreEntry>("FoData") == RET_OK ? ret : RET_ERROR;
+#if FEATURE_LIGHTNING
+		ret = benchmark_store_commit<LightningData::Entry>("LightningData") == RET_OK ? ret : RET_ERROR;
+#endif
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Time commits of a store of the given type, per-entry then block mode
+	 * @param name Store name to print
+	 ******************************************************************************/
+	template <typename TStruct>
+	RetResult benchmark_store_commit(const char *name)
+	{
+		DataStore<TStruct> store(BENCHMARK_STORE_PATH, DATA_STORE_BUFFER_ELEMENTS);
+
+		TStruct dummy_entry;
+		memset(&dummy_entry, 0, sizeof(dummy_entry));
+
+		// Elapsed uS, [0]: per-entry, [1]: block
+		uint32_t elapsed_us[2] = {0};
+
+		for(int mode = 0; mode < 2; mode++)
+		{
+			store.clear_all();
+			store.set_block_commit(mode == 1);
+
+			for(int round = 0; round < BENCHMARK_COMMIT_ROUNDS; round++)
+			{
+				for(int i = 0; i < DATA_STORE_BUFFER_ELEMENTS; i++)
+					store.add(&dummy_entry);
+
+				uint32_t start_us = micros();
+
+				if(store.commit() != RET_OK)
+				{
+					debug_print_e(F("Could not commit data: "));
+					debug_println(name);
+
+					store.clear_all();
+					return RET_ERROR;
+				}
+
+				elapsed_us[mode] += micros() - start_us;
+			}
+		}
+
+		store.clear_all();
+
+		int entries = BENCHMARK_COMMIT_ROUNDS * DATA_STORE_BUFFER_ELEMENTS;
+
+		debug_printf("%s (%d bytes/entry): per-entry %u us (%u us/entry), block %u us (%u us/entry)\n",
+			name, sizeof(typename DataStore<TStruct>::Entry),
+			elapsed_us[0], elapsed_us[0] / entries,
+			elapsed_us[1], elapsed_us[1] / entries);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * JSON emitter benchmark
+	 * Compare throughput and peak stack of the ArduinoJson based builder and the
+	 * direct emitter, building full water sensor data requests. Both outputs must
+	 * match.
+	 ******************************************************************************/
+	RetResult json_emitter_benchmark()
+	{
+		const char *names[2] = {"DOM builder", "Emitter"};
+		void (*tasks[2])(void*) = {
+			benchmark_json_task<TbWaterSensorDataJsonBuilder>,
+			benchmark_json_task<TbJsonEmitter<WaterSensorData::Entry>>
+		};
+
+		JsonBenchmarkResult results[2];
+		memset(results, 0, sizeof(results));
+
+		for(int i = 0; i < 2; i++)
+		{
+			if(xTaskCreate(tasks[i], "json_bench", BENCHMARK_JSON_TASK_STACK_SIZE, &results[i], 1, NULL) != pdPASS)
+			{
+				debug_println_e(F("Could not create benchmark task."));
+				return RET_ERROR;
+			}
+
+			while(!results[i].done)
+				delay(10);
+
+			if(results[i].ret != RET_OK)
+			{
+				debug_print_e(F("Benchmark failed: "));
+				debug_println(names[i]);
+				return RET_ERROR;
+			}
+
+			debug_printf("%s: %u bytes in %u us, %u bytes/sec, peak stack %u bytes\n", names[i],
+				results[i].bytes, results[i].elapsed_us,
+				(uint32_t)((uint64_t)results[i].bytes * 1000000 / (results[i].elapsed_us ? results[i].elapsed_us : 1)),
+				results[i].stack_used);
+		}
+
+		// Same entries, same output expected
+		if(results[0].bytes != results[1].bytes)
+		{
+			debug_println_e(F("Builder and emitter output lengths differ."));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Build full requests of dummy water sensor entries with TBuilder
+	 * @param param JsonBenchmarkResult to fill
+	 ******************************************************************************/
+	template <typename TBuilder>
+	void benchmark_json_task(void *param)
+	{
+		JsonBenchmarkResult *result = (JsonBenchmarkResult*)param;
+
+		// Off the task stack, only the building itself is measured
+		TBuilder *builder = new (std::nothrow) TBuilder();
+		char *out = (char*)malloc(TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE);
+
+		result->ret = builder != NULL && out != NULL ? RET_OK : RET_ERROR;
+
+		// Values exactly representable as floats, so both methods format them the same
+		WaterSensorData::Entry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.timestamp = 1600000000;
+		entry.temperature = 21.5;
+		entry.dissolved_oxygen = 8.25;
+		entry.conductivity = 512.5;
+		entry.ph = 7.125;
+		entry.water_level = 123;
+		entry.present = WaterSensorData::PRESENT_QUALITY | WaterSensorData::PRESENT_WATER_LEVEL |
+			WaterSensorData::PRESENT_PRESENCE;
+
+		for(int round = 0; round < BENCHMARK_JSON_ROUNDS && result->ret == RET_OK; round++)
+		{
+			uint32_t start_us = micros();
+
+			builder->reset();
+
+			// Fill up to the request byte budget, as when submitting
+			for(int i = 0; i < WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ; i++)
+			{
+				entry.timestamp += 60;
+
+				if(builder->add(&entry) != RET_OK)
+				{
+					result->ret = RET_ERROR;
+					break;
+				}
+			}
+
+			builder->build(out, TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE, false);
+
+			result->elapsed_us += micros() - start_us;
+			result->bytes += strlen(out);
+		}
+
+		result->stack_used = BENCHMARK_JSON_TASK_STACK_SIZE - uxTaskGetStackHighWaterMark(NULL);
+
+		delete builder;
+		free(out);
+
+		result->done = true;
+		vTaskDelete(NULL);
+	}
+
+	/******************************************************************************
+	 * Data store add/commit/read benchmark
+	 * For each entry type, time adding a buffer of entries, committing it and
+	 * reading back the whole store, with the store at increasing fill levels
+	 ******************************************************************************/
+	RetResult data_store_fill_benchmark()
+	{
+		RetResult ret = RET_OK;
+
+		ret = benchmark_store_fill<WaterSensorData::Entry>("WaterSensorData") == RET_OK ? ret : RET_ERROR;
+#if FEATURE_ATMOS41
+		ret = benchmark_store_fill<Atmos41Data::Entry>("Atmos41Data") == RET_OK ? ret : RET_ERROR;
+#endif
+#if FEATURE_SOIL_MOISTURE
+		ret = benchmark_store_fill<SoilMoistureData::Entry>("SoilMoistureData") == RET_OK ? ret : RET_ERROR;
+#endif
+		ret = benchmark_store_fill<Log::Entry>("Log") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_fill<SDI12Log::Entry>("SDI12Log") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_fill<FoData::StoreEntry>("FoData") == RET_OK ? ret : RET_ERROR;
+#if FEATURE_LIGHTNING
+		ret = benchmark_store_fill<LightningData::Entry>("LightningData") == RET_OK ? ret : RET_ERROR;
+#endif
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Time add, commit and read of a store of the given type at each fill level
+	 * @param name Store name to print
+	 ******************************************************************************/
+	template <typename TStruct>
+	RetResult benchmark_store_fill(const char *name)
+	{
+		DataStore<TStruct> store(BENCHMARK_STORE_PATH, DATA_STORE_BUFFER_ELEMENTS);
+
+		TStruct dummy_entry;
+		memset(&dummy_entry, 0, sizeof(dummy_entry));
+
+		store.clear_all();
+
+		int stored = 0;
+		char label[64] = "";
+
+		for(int level = 0; level < BENCHMARK_FILL_LEVELS_LEN; level++)
+		{
+			// Fill up to this level, untimed. Full buffers are commited by add
+			while(stored < BENCHMARK_FILL_LEVELS[level])
+			{
+				store.add(&dummy_entry);
+				stored++;
+			}
+
+			if(store.commit() != RET_OK)
+			{
+				debug_print_e(F("Could not fill store: "));
+				debug_println(name);
+
+				store.clear_all();
+				return RET_ERROR;
+			}
+
+			BenchTime add_time = {0}, commit_time = {0}, read_time = {0};
+
+			bench_start(&add_time);
+			for(int i = 0; i < DATA_STORE_BUFFER_ELEMENTS; i++)
+				store.add(&dummy_entry);
+			bench_stop(&add_time);
+
+			bench_start(&commit_time);
+			RetResult commit_ret = store.commit();
+			bench_stop(&commit_time);
+
+			if(commit_ret != RET_OK)
+			{
+				debug_print_e(F("Could not commit data: "));
+				debug_println(name);
+
+				store.clear_all();
+				return RET_ERROR;
+			}
+
+			stored += DATA_STORE_BUFFER_ELEMENTS;
+
+			// Read back the whole store
+			DataStoreReader<TStruct> reader(&store);
+			int read = 0;
+
+			bench_start(&read_time);
+			reader.begin();
+			while(reader.next_file())
+			{
+				while(reader.next_entry())
+					read++;
+			}
+			bench_stop(&read_time);
+
+			if(read != stored)
+			{
+				debug_printf("%s: read %d entries, %d stored\n", name, read, stored);
+
+				store.clear_all();
+				return RET_ERROR;
+			}
+
+			snprintf(label, sizeof(label), "%s add @ %d", name, BENCHMARK_FILL_LEVELS[level]);
+			print_bench(label, &add_time, DATA_STORE_BUFFER_ELEMENTS);
+			snprintf(label, sizeof(label), "%s commit @ %d", name, BENCHMARK_FILL_LEVELS[level]);
+			print_bench(label, &commit_time, DATA_STORE_BUFFER_ELEMENTS);
+			snprintf(label, sizeof(label), "%s read @ %d", name, BENCHMARK_FILL_LEVELS[level]);
+			print_bench(label, &read_time, read);
+		}
+
+		store.clear_all();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Telemetry builders benchmark
+	 * Time building full requests with each builder of the water sensor and
+	 * weather station data
+	 ******************************************************************************/
+	RetResult json_build_benchmark()
+	{
+		RetResult ret = RET_OK;
+
+		ret = benchmark_build<TbWaterSensorDataJsonBuilder, WaterSensorData::Entry>(
+			"WaterSensorData DOM builder", WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbJsonEmitter<WaterSensorData::Entry>, WaterSensorData::Entry>(
+			"WaterSensorData emitter", WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbBinaryBuilder<WaterSensorData::Entry, BINARY_SCHEMA_WATER_SENSOR_DATA>, WaterSensorData::Entry>(
+			"WaterSensorData binary", WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbColumnarBuilder<WaterSensorData::Entry, BINARY_SCHEMA_WATER_SENSOR_DATA>, WaterSensorData::Entry>(
+			"WaterSensorData columnar", WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+
+#if FEATURE_ATMOS41
+		ret = benchmark_build<TbAtmos41DataJsonBuilder, Atmos41Data::Entry>(
+			"Atmos41Data DOM builder", ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbJsonEmitter<Atmos41Data::Entry>, Atmos41Data::Entry>(
+			"Atmos41Data emitter", ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbBinaryBuilder<Atmos41Data::Entry, BINARY_SCHEMA_ATMOS41_DATA>, Atmos41Data::Entry>(
+			"Atmos41Data binary", ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_build<TbColumnarBuilder<Atmos41Data::Entry, BINARY_SCHEMA_ATMOS41_DATA>, Atmos41Data::Entry>(
+			"Atmos41Data columnar", ATMOS41_DATA_ENTRIES_PER_SUBMIT_REQ) == RET_OK ? ret : RET_ERROR;
+#endif
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Build full requests of zeroed entries with TBuilder and print throughput
+	 * @param name Builder name to print
+	 * @param entries_per_req Entries added to each request
+	 ******************************************************************************/
+	template <typename TBuilder, typename TEntry>
+	RetResult benchmark_build(const char *name, int entries_per_req)
+	{
+		// Off the stack, only the building itself is measured
+		TBuilder *builder = new (std::nothrow) TBuilder();
+		char *out = (char*)malloc(TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE);
+
+		RetResult ret = builder != NULL && out != NULL ? RET_OK : RET_ERROR;
+
+		TEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.timestamp = 1600000000;
+
+		// Every field present, full size entries
+		const TbJsonSchema &schema = TbJsonSchemaOf<TEntry>::SCHEMA;
+		if(schema.is_sparse())
+			memset((uint8_t*)&entry + schema.present_offset, 0xFF, sizeof(uint16_t));
+
+		BenchTime time = {0};
+		uint32_t bytes = 0;
+
+		for(int round = 0; round < BENCHMARK_BUILD_ROUNDS && ret == RET_OK; round++)
+		{
+			bench_start(&time);
+
+			builder->reset();
+
+			for(int i = 0; i < entries_per_req; i++)
+			{
+				entry.timestamp += 60;
+
+				if(builder->add(&entry) != RET_OK)
+				{
+					ret = RET_ERROR;
+					break;
+				}
+			}
+
+			if(builder->build(out, TELEMETRY_DATA_JSON_OUTPUT_BUFF_SIZE, false) != RET_OK)
+				ret = RET_ERROR;
+
+			bench_stop(&time);
+
+			bytes += builder->measure();
+		}
+
+		delete builder;
+		free(out);
+
+		if(ret != RET_OK)
+		{
+			debug_print_e(F("Benchmark failed: "));
+			debug_println(name);
+			return RET_ERROR;
+		}
+
+		print_bench(name, &time, BENCHMARK_BUILD_ROUNDS);
+		debug_printf("%s: %u bytes/request, %u bytes/sec\n", name, bytes / BENCHMARK_BUILD_ROUNDS,
+			(uint32_t)((uint64_t)bytes * 1000000 / (time.us ? time.us : 1)));
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * CRC32 throughput benchmark
+	 * Checksum the same total bytes in buffers of increasing size, so per call
+	 * overhead and per byte cost can be told apart. Then time checking 1000 store
+	 * entries with the library, the ROM CRC per entry and per read buffer
+	 ******************************************************************************/
+	RetResult crc32_benchmark()
+	{
+		const int max_size = BENCHMARK_CRC32_SIZES[BENCHMARK_CRC32_SIZES_LEN - 1];
+
+		uint8_t *buff = (uint8_t*)malloc(max_size);
+		if(buff == NULL)
+		{
+			debug_println_e(F("Could not allocate CRC32 buffer."));
+			return RET_ERROR;
+		}
+
+		for(int i = 0; i < max_size; i++)
+			buff[i] = i * 31 + 7;
+
+		char label[32] = "";
+		volatile uint32_t sink = 0;
+
+		for(int i = 0; i < BENCHMARK_CRC32_SIZES_LEN; i++)
+		{
+			const int size = BENCHMARK_CRC32_SIZES[i];
+			const int calls = BENCHMARK_CRC32_TOTAL_BYTES / size;
+
+			BenchTime time = {0};
+
+			bench_start(&time);
+			for(int call = 0; call < calls; call++)
+				sink = sink + Utils::crc32(buff, size);
+			bench_stop(&time);
+
+			snprintf(label, sizeof(label), "%d byte buffers", size);
+			print_bench(label, &time, calls);
+			debug_printf("%s: %u KB/sec\n", label,
+				(uint32_t)((uint64_t)calls * size * 1000000 / 1024 / (time.us ? time.us : 1)));
+
+			// ROM CRC must match the library stores were written with
+			if(Utils::crc32(buff, size) != CRC32::calculate(buff, size) ||
+				Utils::crc32_update(Utils::crc32(buff, size / 2), buff + size / 2, size - size / 2) != Utils::crc32(buff, size))
+			{
+				debug_printf("CRC32 of %d bytes does not match CRC32 library.\n", size);
+				free(buff);
+				return RET_ERROR;
+			}
+		}
+
+		free(buff);
+
+		// Water sensor store entries, as DataStoreReader checks them
+		typedef DataStore<WaterSensorData::Entry>::Entry StoreEntry;
+		StoreEntry entries[DATA_STORE_READER_BUFF_ENTRIES];
+
+		for(int i = 0; i < DATA_STORE_READER_BUFF_ENTRIES; i++)
+		{
+			memset(&entries[i], i, sizeof(entries[i]));
+			entries[i].crc32 = Utils::crc32((uint8_t*)&entries[i].data, sizeof(entries[i].data));
+		}
+
+		const int rounds = BENCHMARK_CRC32_ENTRIES / DATA_STORE_READER_BUFF_ENTRIES;
+		BenchTime library_time = {0}, entry_time = {0}, buffer_time = {0};
+		uint32_t valid = 0;
+
+		bench_start(&library_time);
+		for(int round = 0; round < rounds; round++)
+		{
+			for(int i = 0; i < DATA_STORE_READER_BUFF_ENTRIES; i++)
+				sink = sink + (CRC32::calculate((uint8_t*)&entries[i].data, sizeof(entries[i].data)) == entries[i].crc32);
+		}
+		bench_stop(&library_time);
+
+		bench_start(&entry_time);
+		for(int round = 0; round < rounds; round++)
+		{
+			for(int i = 0; i < DATA_STORE_READER_BUFF_ENTRIES; i++)
+				sink = sink + (Utils::crc32((uint8_t*)&entries[i].data, sizeof(entries[i].data)) == entries[i].crc32);
+		}
+		bench_stop(&entry_time);
+
+		bench_start(&buffer_time);
+		for(int round = 0; round < rounds; round++)
+		{
+			valid = Utils::crc32_check_entries((uint8_t*)entries, DATA_STORE_READER_BUFF_ENTRIES, sizeof(StoreEntry),
+				offsetof(StoreEntry, data), sizeof(entries[0].data));
+		}
+		bench_stop(&buffer_time);
+
+		debug_printf("Per %d entries (%d bytes): library %u us, ROM per entry %u us, ROM per read buffer %u us\n",
+			rounds * DATA_STORE_READER_BUFF_ENTRIES, sizeof(StoreEntry), (uint32_t)library_time.us,
+			(uint32_t)entry_time.us, (uint32_t)buffer_time.us);
+
+		if(valid != (1UL << DATA_STORE_READER_BUFF_ENTRIES) - 1)
+		{
+			debug_println_e(F("Valid entries failed buffer CRC check."));
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * SDI12 round-trip benchmark
+	 * Time acknowledge commands to the weather station, from writing the command
+	 * until the response is received. Needs the sensor connected.
+	 ******************************************************************************/
+	RetResult sdi12_roundtrip_benchmark()
+	{
+		#if FEATURE_ATMOS41
+			Atmos41::on();
+
+			Sdi12Sensor sensor(PIN_SDI12_DATA);
+			sensor.set_address(Sdi12Registry::get_address(Sdi12Registry::MODEL_ATMOS41));
+
+			BenchTime time = {0};
+			int failed = 0;
+
+			for(int round = 0; round < BENCHMARK_SDI12_ROUNDS; round++)
+			{
+				bench_start(&time);
+				if(sensor.acknowledge() != RET_OK)
+					failed++;
+				bench_stop(&time);
+			}
+
+			Atmos41::off();
+
+			if(failed == BENCHMARK_SDI12_ROUNDS)
+			{
+				debug_println_e(F("Sensor did not respond."));
+				return RET_ERROR;
+			}
+
+			debug_printf("%d/%d commands failed\n", failed, BENCHMARK_SDI12_ROUNDS);
+			print_bench("Acknowledge round-trip", &time, BENCHMARK_SDI12_ROUNDS);
+
+			return RET_OK;
+		#else
+			debug_println(F("Board has no weather station."));
+			return RET_ERROR;
+		#endif
+	}
+
+	/******************************************************************************
+	 * HTTP POST latency benchmark
+	 * Post client attribute bodies of increasing size to TB and time each full
+	 * request. Connects to the network first, connection time is not measured.
+	 ******************************************************************************/
+	RetResult http_post_benchmark()
+	{
+		const int max_size = BENCHMARK_HTTP_SIZES[BENCHMARK_HTTP_SIZES_LEN - 1];
+
+		char *body = (char*)malloc(max_size + 1);
+		if(body == NULL)
+		{
+			debug_println_e(F("Could not allocate request body."));
+			return RET_ERROR;
+		}
+
+		GSM::init();
+		if(GSM::on() != RET_OK || GSM::connect_persist() != RET_OK)
+		{
+			debug_println_e(F("Could not connect to network."));
+
+			GSM::off();
+			free(body);
+			return RET_ERROR;
+		}
+
+		char url[URL_BUFFER_SIZE_LARGE] = "";
+		snprintf(url, sizeof(url), TB_CLIENT_ATTRIBUTES_URL_FORMAT, DeviceConfig::get_tb_device_token());
+
+		RetResult ret = RET_OK;
+		char label[32] = "";
+
+		for(int i = 0; i < BENCHMARK_HTTP_SIZES_LEN && ret == RET_OK; i++)
+		{
+			const int size = BENCHMARK_HTTP_SIZES[i];
+
+			// {"bench_pad":"xxx...x"}, padded to the exact size
+			memset(body, 'x', size);
+			memcpy(body, "{\"bench_pad\":\"", 14);
+			memcpy(body + size - 2, "\"}", 2);
+			body[size] = '\0';
+
+			BenchTime time = {0};
+
+			for(int round = 0; round < BENCHMARK_HTTP_ROUNDS; round++)
+			{
+				HttpRequest http_req(GSM::get_modem(), TB_SERVER);
+				http_req.set_port(TB_PORT);
+
+				bench_start(&time);
+				RetResult post_ret = http_req.post(url, (uint8_t*)body, size, "application/json", NULL, 0);
+				bench_stop(&time);
+
+				if(post_ret != RET_OK || http_req.get_response_code() != 200)
+				{
+					debug_printf("%d byte POST failed.\n", size);
+					ret = RET_ERROR;
+					break;
+				}
+			}
+
+			if(ret == RET_OK)
+			{
+				snprintf(label, sizeof(label), "%d byte POST", size);
+				print_bench(label, &time, BENCHMARK_HTTP_ROUNDS);
+			}
+		}
+
+		GSM::off();
+		free(body);
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Data store add latency benchmark
+	 * Time adding a single entry by copy (add()) and in place (reserve()/publish())
+	 ******************************************************************************/
+	RetResult data_store_add_benchmark()
+	{
+		RetResult ret = RET_OK;
+
+		ret = benchmark_store_add<WaterSensorData::Entry>("WaterSensorData") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_add<Log::Entry>("Log") == RET_OK ? ret : RET_ERROR;
+		ret = benchmark_store_add<FoData::StoreEntry>("FoData") == RET_OK ? ret : RET_ERROR;
+#if FEATURE_LIGHTNING
+		ret = benchmark_store_add<LightningData::Entry>("LightningData") == RET_OK ? ret : RET_ERROR;
+#endif
+
+		return ret;
+	}
+
+	/******************************************************************************
+	 * Time add() and reserve()/publish() of a store of the given type
+	 * @param name Store name to print
+	 ******************************************************************************/
+	template <typename TStruct>
+	RetResult benchmark_store_add(const char *name)
+	{
+		DataStore<TStruct> store(BENCHMARK_STORE_PATH, DATA_STORE_BUFFER_ELEMENTS);
+
+		TStruct dummy_entry;
+		memset(&dummy_entry, 0, sizeof(dummy_entry));
+
+		store.clear_all();
+
+		BenchTime add_time = {0}, reserve_time = {0};
+		char label[64] = "";
+
+		for(int round = 0; round < BENCHMARK_ADD_ROUNDS; round++)
+		{
+			bench_start(&add_time);
+			for(int i = 0; i < DATA_STORE_BUFFER_ELEMENTS; i++)
+				store.add(&dummy_entry);
+			bench_stop(&add_time);
+
+			store.clear_buffer();
+
+			bench_start(&reserve_time);
+			for(int i = 0; i < DATA_STORE_BUFFER_ELEMENTS; i++)
+			{
+				TStruct *slot = store.reserve();
+
+				if(slot == NULL || store.publish() != RET_OK)
+				{
+					bench_stop(&reserve_time);
+
+					debug_print_e(F("Could not reserve entry: "));
+					debug_println(name);
+
+					store.clear_all();
+					return RET_ERROR;
+				}
+			}
+			bench_stop(&reserve_time);
+
+			store.clear_buffer();
+		}
+
+		int ops = BENCHMARK_ADD_ROUNDS * DATA_STORE_BUFFER_ELEMENTS;
+
+		snprintf(label, sizeof(label), "%s add", name);
+		print_bench(label, &add_time, ops);
+		snprintf(label, sizeof(label), "%s reserve/publish", name);
+		print_bench(label, &reserve_time, ops);
+
+		store.clear_all();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Sleep schedule simulation
+	 * Run the configured schedule for a month with the sim energy model, with
+	 * and without FO sniffing
+	 ******************************************************************************/
+	RetResult sleep_simulation()
+	{
+		const DeviceConfig::Data *device_config = DeviceConfig::get();
+
+		SleepScheduler::SimEnergyModel model = SLEEP_SIMULATION_MODEL;
+		SleepScheduler::SimResult result;
+
+		for(int fo = 1; fo >= 0; fo--)
+		{
+			model.fo_enabled = fo;
+
+			BenchTime time = {0};
+
+			bench_start(&time);
+			RetResult ret = SleepScheduler::simulate(device_config->wakeup_schedule, &model, SLEEP_SIMULATION_DAYS, &result);
+			bench_stop(&time);
+
+			if(ret != RET_OK)
+			{
+				debug_println_e(F("Invalid schedule or energy model."));
+				return RET_ERROR;
+			}
+
+			debug_println(fo ? F("FO enabled") : F("FO disabled"));
+			SleepScheduler::print_sim_result(&result, SLEEP_SIMULATION_DAYS);
+			print_bench("Simulation", &time, result.wakeups);
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Raw capture replay
+	 * Feed the recorded FO frames, FO UART lines and SDI12 transcripts (see
+	 * Capture) through the decoders. Fails if a decode result differs from the
+	 * live one
+	 ******************************************************************************/
+	RetResult capture_replay()
+	{
+		Capture::ReplayStats stats;
+
+		if(Capture::replay(&stats) != RET_OK)
+			return RET_ERROR;
+
+		uint32_t records = 0;
+		for(int i = 0; i < Capture::KIND_COUNT; i++)
+			records += stats.records[i];
+
+		if(records > 0)
+			debug_printf("Decode per record (us): %.2f\n", (float)stats.decode_us / records);
+
+		return stats.mismatches == 0 ? RET_OK : RET_ERROR;
+	}
+
+	/******************************************************************************
+	 * CIDs computed on device match the ones IPFS gives the same raw blocks
+	 ******************************************************************************/
+	RetResult ipfs_cid()
+	{
+		#if FEATURE_IPFS
+			const char *blocks[] = {"", "hello world"};
+			const char *expected[] = {
+				"bafkreihdwdcefgh4dqkjv67uzcmw7ojee6xedzdetojuzjevtenxquvyku",
+				"bafkreifzjut3te2nhyekklss27nh3k72ysco7y32koao5eei66wof36n5e"
+			};
+
+			for(int i = 0; i < 2; i++)
+			{
+				uint8_t cid[IPFS_CID_LEN];
+				char cid_str[IPFS_CID_STR_SIZE] = "";
+
+				if(Ipfs::compute_cid((const uint8_t*)blocks[i], strlen(blocks[i]), cid) != RET_OK)
+					return RET_ERROR;
+
+				Ipfs::cid_to_str(cid, cid_str, sizeof(cid_str));
+
+				if(strcmp(cid_str, expected[i]) != 0)
+				{
+					debug_printf("CID %s, expected %s\n", cid_str, expected[i]);
+					return RET_ERROR;
+				}
+			}
+
+			return RET_OK;
+		#else
+			debug_println(F("IPFS is not built for this board."));
+			return RET_ERROR;
+		#endif
+	}
+
+	/******************************************************************************
+	 * Start timing a benchmarked block
+	 * @param time Accumulated time of the block
+	 ******************************************************************************/
+	void bench_start(BenchTime *time)
+	{
+		time->start_us = micros();
+		time->start_cycles = ESP.getCycleCount();
+	}
+
+	/******************************************************************************
+	 * Stop timing a benchmarked block and add elapsed time to its total.
+	 * The cycle counter wraps in seconds, longer blocks get cycles from uS
+	 * @param time Accumulated time of the block
+	 ******************************************************************************/
+	void bench_stop(BenchTime *time)
+	{
+		uint32_t cycles = ESP.getCycleCount() - time->start_cycles;
+		uint32_t elapsed_us = micros() - time->start_us;
+
+		uint32_t cpu_mhz = getCpuFrequencyMhz();
+
+		if((uint64_t)elapsed_us * cpu_mhz > UINT32_MAX)
+			time->cycles += (uint64_t)elapsed_us * cpu_mhz;
+		else
+			time->cycles += cycles;
+
+		time->us += elapsed_us;
+	}
+
+	/******************************************************************************
+	 * Print totals and per op cycles and uS of a benchmarked block
+	 * @param name Block name
+	 * @param time Accumulated time of the block
+	 * @param ops Operations timed
+	 ******************************************************************************/
+	void print_bench(const char *name, const BenchTime *time, uint32_t ops)
+	{
+		if(ops == 0)
+			ops = 1;
+
+		debug_printf("%s: %u ops, %llu cycles (%llu/op), %llu us (%llu/op)\n", name, ops,
+			time->cycles, time->cycles / ops, time->us, time->us / ops);
+	}
+
 	/******************************************************************************
 	 * Run all tests and print report
 	******************************************************************************/    
@@ -0,0 +1,556 @@
+#include "tls_client.h"
+#include "common.h"
+#include "utils.h"
+#include "rtc.h"
+#include "log.h"
+#include "uplink_controller.h"
+#include "power_lock.h"
+#include "mbedtls/net_sockets.h"
+
+/******************************************************************************
+* Session of last full handshake, resumed by later connections. RTC_NOINIT memory
+* survives deep sleep (but not power loss)
+******************************************************************************/
+struct TlsCachedSession
+{
+	uint32_t magic;
+
+	/** Server the session is with */
+	uint32_t host_crc;
+	uint16_t port;
+
+	/** Timestamp of the full handshake */
+	uint32_t tstamp;
+
+	int32_t ciphersuite;
+	uint8_t id_len;
+	uint8_t id[32];
+	uint8_t master[48];
+
+	/** Session ticket, 0 if the server uses session IDs */
+	uint16_t ticket_len;
+	uint8_t ticket[TLS_SESSION_TICKET_MAX_LEN];
+	uint32_t ticket_lifetime;
+
+	uint8_t mfl_code;
+	uint8_t trunc_hmac;
+	uint8_t encrypt_then_mac;
+
+	uint32_t crc32;
+}__attribute__((packed));
+
+RTC_NOINIT_ATTR TlsCachedSession _tls_session;
+
+/******************************************************************************
+* Key of a server in the session cache
+******************************************************************************/
+static uint32_t tls_host_crc(const char *host)
+{
+	return Utils::crc32((uint8_t*)host, strlen(host));
+}
+
+/******************************************************************************
+* Check if the cached session is for this server and not too old
+******************************************************************************/
+static bool tls_session_valid(const char *host, uint16_t port)
+{
+	if(_tls_session.magic != TLS_SESSION_MAGIC ||
+		Utils::crc32((uint8_t*)&_tls_session, sizeof(_tls_session) - sizeof(_tls_session.crc32)) != _tls_session.crc32)
+		return false;
+
+	if(_tls_session.host_crc != tls_host_crc(host) || _tls_session.port != port)
+		return false;
+
+	// Clock stepped back counts as expired
+	uint32_t now = RTC::get_timestamp();
+	return now >= _tls_session.tstamp && now - _tls_session.tstamp < TLS_SESSION_MAX_AGE_SECS;
+}
+
+/******************************************************************************
+* Offer the cached session to the server
+* @return False if there is none for this server
+******************************************************************************/
+static bool tls_session_load(mbedtls_ssl_context *ssl, const char *host, uint16_t port)
+{
+	if(!tls_session_valid(host, port))
+		return false;
+
+	mbedtls_ssl_session session;
+	mbedtls_ssl_session_init(&session);
+
+	session.ciphersuite = _tls_session.ciphersuite;
+	session.id_len = _tls_session.id_len;
+	memcpy(session.id, _tls_session.id, sizeof(session.id));
+	memcpy(session.master, _tls_session.master, sizeof(session.master));
+
+	#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+		// Copied by mbedtls_ssl_set_session, not owned by session
+		session.ticket = _tls_session.ticket_len > 0 ? _tls_session.ticket : NULL;
+		session.ticket_len = _tls_session.ticket_len;
+		session.ticket_lifetime = _tls_session.ticket_lifetime;
+	#endif
+	#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+		session.mfl_code = _tls_session.mfl_code;
+	#endif
+	#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+		session.trunc_hmac = _tls_session.trunc_hmac;
+	#endif
+	#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+		session.encrypt_then_mac = _tls_session.encrypt_then_mac;
+	#endif
+
+	int ret = mbedtls_ssl_set_session(ssl, &session);
+
+	#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+		session.ticket = NULL;
+	#endif
+	mbedtls_ssl_session_free(&session);
+
+	return ret == 0;
+}
+
+/******************************************************************************
+* Keep session of the handshake just done
+* @param resumed Handshake was abbreviated, age is kept from the full one
+******************************************************************************/
+static void tls_session_save(mbedtls_ssl_context *ssl, const char *host, uint16_t port, bool resumed)
+{
+	mbedtls_ssl_session session;
+	mbedtls_ssl_session_init(&session);
+
+	if(mbedtls_ssl_get_session(ssl, &session) != 0)
+	{
+		mbedtls_ssl_session_free(&session);
+		return;
+	}
+
+	uint32_t tstamp = resumed ? _tls_session.tstamp : RTC::get_timestamp();
+
+	memset(&_tls_session, 0, sizeof(_tls_session));
+	_tls_session.host_crc = tls_host_crc(host);
+	_tls_session.port = port;
+	_tls_session.tstamp = tstamp;
+	_tls_session.ciphersuite = session.ciphersuite;
+	_tls_session.id_len = session.id_len <= sizeof(_tls_session.id) ? session.id_len : 0;
+	memcpy(_tls_session.id, session.id, sizeof(_tls_session.id));
+	memcpy(_tls_session.master, session.master, sizeof(_tls_session.master));
+
+	#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+		// Ticket too large for RTC memory, resumed with session ID only
+		if(session.ticket != NULL && session.ticket_len <= sizeof(_tls_session.ticket))
+		{
+			memcpy(_tls_session.ticket, session.ticket, session.ticket_len);
+			_tls_session.ticket_len = session.ticket_len;
+			_tls_session.ticket_lifetime = session.ticket_lifetime;
+		}
+	#endif
+	#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+		_tls_session.mfl_code = session.mfl_code;
+	#endif
+	#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+		_tls_session.trunc_hmac = session.trunc_hmac;
+	#endif
+	#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+		_tls_session.encrypt_then_mac = session.encrypt_then_mac;
+	#endif
+
+	mbedtls_ssl_session_free(&session);
+
+	// Nothing to resume with
+	if(_tls_session.id_len == 0 && _tls_session.ticket_len == 0)
+		return;
+
+	_tls_session.magic = TLS_SESSION_MAGIC;
+	_tls_session.crc32 = Utils::crc32((uint8_t*)&_tls_session, sizeof(_tls_session) - sizeof(_tls_session.crc32));
+}
+
+/******************************************************************************
+* Constructor
+* @param transport Client to run TLS over, must outlive this client
+******************************************************************************/
+TlsClient::TlsClient(Client *transport)
+{
+	_transport = transport;
+}
+
+/******************************************************************************
+* Destructor, closes connection
+******************************************************************************/
+TlsClient::~TlsClient()
+{
+	stop();
+
+	if(_setup)
+	{
+		mbedtls_ssl_free(&_ssl);
+		mbedtls_ssl_config_free(&_conf);
+		mbedtls_ctr_drbg_free(&_drbg);
+		mbedtls_entropy_free(&_entropy);
+	}
+}
+
+/******************************************************************************
+* Check if requests to port are done with TLS
+******************************************************************************/
+bool TlsClient::is_tls_port(int port)
+{
+	return port == TLS_PORT;
+}
+
+/******************************************************************************
+* Connect to IP, used as server name
+******************************************************************************/
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+	return connect(ip.toString().c_str(), port);
+}
+
+/******************************************************************************
+* Connect transport and do the TLS handshake, abbreviated if a session with
+* this server is cached
+* @return 1 on success, 0 on failure (Client interface)
+******************************************************************************/
+int TlsClient::connect(const char *host, uint16_t port)
+{
+	stop();
+
+	if(setup() != RET_OK)
+		return 0;
+
+	if(!_transport->connect(host, port))
+	{
+		debug_println(F("TLS transport could not connect."));
+		return 0;
+	}
+
+	if(handshake(host, port) != RET_OK)
+	{
+		_transport->stop();
+		return 0;
+	}
+
+	_connected = true;
+
+	return 1;
+}
+
+/******************************************************************************
+* Set up contexts, once per client
+******************************************************************************/
+RetResult TlsClient::setup()
+{
+	if(_setup)
+	{
+		// Reused for another connection
+		return mbedtls_ssl_session_reset(&_ssl) == 0 ? RET_OK : RET_ERROR;
+	}
+
+	mbedtls_ssl_init(&_ssl);
+	mbedtls_ssl_config_init(&_conf);
+	mbedtls_ctr_drbg_init(&_drbg);
+	mbedtls_entropy_init(&_entropy);
+	_setup = true;
+
+	const char pers[] = "tls_client";
+
+	if(mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, (const unsigned char*)pers, strlen(pers)) != 0)
+	{
+		debug_println_e(F("TLS RNG seed failed."));
+		return RET_ERROR;
+	}
+
+	if(mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+		MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+	{
+		debug_println_e(F("TLS config failed."));
+		return RET_ERROR;
+	}
+
+	mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_NONE);
+	mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+	mbedtls_ssl_conf_read_timeout(&_conf, UplinkController::get_response_timeout());
+
+	#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+		mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+	#endif
+
+	if(mbedtls_ssl_setup(&_ssl, &_conf) != 0)
+	{
+		debug_println_e(F("TLS setup failed, out of memory?"));
+		return RET_ERROR;
+	}
+
+	mbedtls_ssl_set_bio(&_ssl, this, bio_send, NULL, bio_recv);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Do the handshake, offering the cached session. Server falls back to a full
+* handshake if it no longer knows the session
+******************************************************************************/
+RetResult TlsClient::handshake(const char *host, uint16_t port)
+{
+	uint32_t start_ms = millis();
+
+	// Key exchange is the longest CPU burst of a call home
+	PowerLock::Scoped cpu_lock(PowerLock::LOCK_CPU_MAX);
+
+	mbedtls_ssl_set_hostname(&_ssl, host);
+
+	bool offered = tls_session_load(&_ssl, host, port);
+
+	int ret;
+	while((ret = mbedtls_ssl_handshake(&_ssl)) != 0)
+	{
+		if((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+			millis() - start_ms > TLS_HANDSHAKE_TIMEOUT_MS)
+		{
+			debug_printf("TLS handshake failed: -0x%04x\n", -ret);
+
+			// Do not offer it again
+			if(offered)
+				_tls_session.magic = 0;
+
+			return RET_ERROR;
+		}
+	}
+
+	// Master secret is kept only if the server resumed the session
+	bool resumed = offered && memcmp(_ssl.session->master, _tls_session.master, sizeof(_tls_session.master)) == 0;
+
+	tls_session_save(&_ssl, host, port, resumed);
+
+	uint32_t took_ms = millis() - start_ms;
+
+	debug_printf("TLS handshake (%s) in %ums, %s\n", resumed ? "resumed" : "full", took_ms,
+		mbedtls_ssl_get_ciphersuite(&_ssl));
+
+	Log::log(Log::TLS_HANDSHAKE, took_ms, resumed);
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Buffer bytes, sent when buffer is full or before reading
+******************************************************************************/
+size_t TlsClient::write(uint8_t byte)
+{
+	return write(&byte, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buff, size_t size)
+{
+	if(!_connected)
+		return 0;
+
+	for(size_t i = 0; i < size; i++)
+	{
+		if(_tx_len >= (int)sizeof(_tx_buff) && flush_write() != RET_OK)
+			return i;
+
+		_tx_buff[_tx_len++] = buff[i];
+	}
+
+	return size;
+}
+
+/******************************************************************************
+* Send buffered bytes as TLS records
+******************************************************************************/
+RetResult TlsClient::flush_write()
+{
+	int sent = 0;
+
+	while(sent < _tx_len)
+	{
+		int ret = mbedtls_ssl_write(&_ssl, _tx_buff + sent, _tx_len - sent);
+
+		if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+			continue;
+
+		if(ret < 0)
+		{
+			debug_printf("TLS write failed: -0x%04x\n", -ret);
+			_connected = false;
+			_tx_len = 0;
+			return RET_ERROR;
+		}
+
+		sent += ret;
+	}
+
+	_tx_len = 0;
+
+	return RET_OK;
+}
+
+/******************************************************************************
+* Bytes that can be read without waiting. Processes a record if the transport
+* has data
+******************************************************************************/
+int TlsClient::available()
+{
+	if(!_connected)
+		return 0;
+
+	flush_write();
+
+	int avail = mbedtls_ssl_get_bytes_avail(&_ssl);
+
+	if(avail == 0 && _transport->available() > 0)
+	{
+		int ret = mbedtls_ssl_read(&_ssl, NULL, 0);
+
+		if(ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE &&
+			ret != MBEDTLS_ERR_SSL_TIMEOUT)
+			_connected = false;
+
+		avail = mbedtls_ssl_get_bytes_avail(&_ssl);
+	}
+
+	return avail + (_peeked >= 0 ? 1 : 0);
+}
+
+/******************************************************************************
+* Read a byte
+* @return -1 if none received within read timeout
+******************************************************************************/
+int TlsClient::read()
+{
+	uint8_t byte;
+
+	return read(&byte, 1) == 1 ? byte : -1;
+}
+
+/******************************************************************************
+* Read up to size bytes, waits up to read timeout for data
+* @return Bytes read, -1 if none
+******************************************************************************/
+int TlsClient::read(uint8_t *buff, size_t size)
+{
+	if(size == 0)
+		return 0;
+
+	int len = 0;
+
+	if(_peeked >= 0)
+	{
+		buff[len++] = _peeked;
+		_peeked = -1;
+
+		if(size == 1 || mbedtls_ssl_get_bytes_avail(&_ssl) == 0)
+			return len;
+	}
+
+	if(!_connected)
+		return len > 0 ? len : -1;
+
+	flush_write();
+
+	int ret = mbedtls_ssl_read(&_ssl, buff + len, size - len);
+
+	if(ret > 0)
+		return len + ret;
+
+	// Closed by server (close notify or EOF), anything else is a timeout
+	if(ret == 0 || (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_TIMEOUT))
+		_connected = false;
+
+	return len > 0 ? len : -1;
+}
+
+/******************************************************************************
+* Peek next byte
+******************************************************************************/
+int TlsClient::peek()
+{
+	if(_peeked < 0)
+		_peeked = read();
+
+	return _peeked;
+}
+
+/******************************************************************************
+* Send buffered bytes
+******************************************************************************/
+void TlsClient::flush()
+{
+	if(_connected)
+		flush_write();
+}
+
+/******************************************************************************
+* Close connection, session stays cached
+******************************************************************************/
+void TlsClient::stop()
+{
+	if(_connected)
+	{
+		flush_write();
+		mbedtls_ssl_close_notify(&_ssl);
+	}
+
+	if(_setup || _connected)
+		_transport->stop();
+
+	_connected = false;
+	_peeked = -1;
+	_tx_len = 0;
+}
+
+/******************************************************************************
+* Connection open or received data left to read
+******************************************************************************/
+uint8_t TlsClient::connected()
+{
+	if(_peeked >= 0 || (_setup && mbedtls_ssl_get_bytes_avail(&_ssl) > 0))
+		return 1;
+
+	return _connected && _transport->connected();
+}
+
+TlsClient::operator bool()
+{
+	return connected();
+}
+
+/******************************************************************************
+* mbedTLS send callback, writes to transport
+******************************************************************************/
+int TlsClient::bio_send(void *ctx, const unsigned char *buff, size_t len)
+{
+	TlsClient *client = (TlsClient*)ctx;
+
+	if(!client->_transport->connected())
+		return MBEDTLS_ERR_NET_CONN_RESET;
+
+	int ret = client->_transport->write(buff, len);
+
+	return ret > 0 ? ret : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+/******************************************************************************
+* mbedTLS receive callback, waits up to timeout (ms) for transport data
+******************************************************************************/
+int TlsClient::bio_recv(void *ctx, unsigned char *buff, size_t len, uint32_t timeout)
+{
+	TlsClient *client = (TlsClient*)ctx;
+	uint32_t start_ms = millis();
+
+	while(client->_transport->available() <= 0)
+	{
+		// EOF
+		if(!client->_transport->connected())
+			return 0;
+
+		if(timeout > 0 && millis() - start_ms >= timeout)
+			return MBEDTLS_ERR_SSL_TIMEOUT;
+
+		delay(TLS_CLIENT_POLL_MS);
+	}
+
+	int ret = client->_transport->read(buff, len);
+
+	return ret > 0 ? ret : MBEDTLS_ERR_SSL_WANT_READ;
+}
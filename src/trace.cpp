@@ -0,0 +1,403 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <HardwareSerial.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "const.h"
+#include "app_config.h"
+#include "common.h"
+#include "globals.h"
+#include "log.h"
+#include "rtc.h"
+#include "storage.h"
+#include "mbedtls/base64.h"
+
+namespace Trace
+{
+	//
+	// Private vars
+	//
+
+	/** Finished spans, oldest overwritten when full */
+	Record _ring[TRACE_RING_LEN];
+
+	/** Next slot to write */
+	int _head = 0;
+
+	/** Records in ring */
+	int _count = 0;
+
+	/** Spans finish in several tasks */
+	portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+	/** Timestamp of last summary logged, 0 if none since power on */
+	uint32_t _last_summary_tstamp = 0;
+
+	/** Detailed tracing armed for this many more wake cycles or until then */
+	uint16_t _armed_cycles = 0;
+	uint32_t _armed_until = 0;
+
+	const char *SPAN_NAMES[] = {
+		[SPAN_GSM_ON] = "gsm_on",
+		[SPAN_GSM_ATTACH] = "gsm_attach",
+		[SPAN_GSM_PDP] = "gsm_pdp",
+		[SPAN_HTTP_REQUEST] = "http",
+		[SPAN_STORE_COMMIT] = "store_commit",
+		[SPAN_STORE_READ] = "store_read",
+		[SPAN_SDI12] = "sdi12",
+		[SPAN_FO_RX] = "fo_rx",
+		[SPAN_SLEEP] = "sleep",
+		[SPAN_AT] = "at",
+		[SPAN_WAKE_FO] = "wake_fo",
+		[SPAN_WAKE_SENSOR] = "wake_sensor",
+		[SPAN_WAKE_CALL_HOME] = "wake_call_home"
+	};
+
+	/** Unit (uS) of durations in summary, so they fit the log entry */
+	const uint32_t SUMMARY_UNITS_US[] = {
+		[SPAN_GSM_ON] = 1000,
+		[SPAN_GSM_ATTACH] = 1000,
+		[SPAN_GSM_PDP] = 1000,
+		[SPAN_HTTP_REQUEST] = 1000,
+		[SPAN_STORE_COMMIT] = 1000,
+		[SPAN_STORE_READ] = 1000,
+		[SPAN_SDI12] = 1000,
+		[SPAN_FO_RX] = 1000,
+		[SPAN_SLEEP] = 1000000,
+		[SPAN_AT] = 1000,
+		[SPAN_WAKE_FO] = 1000,
+		[SPAN_WAKE_SENSOR] = 1000,
+		[SPAN_WAKE_CALL_HOME] = 1000
+	};
+
+	static_assert(sizeof(SPAN_NAMES) / sizeof(SPAN_NAMES[0]) == SPAN_COUNT, "Name every span");
+	static_assert(sizeof(SUMMARY_UNITS_US) / sizeof(SUMMARY_UNITS_US[0]) == SPAN_COUNT, "Unit of every span");
+	static_assert(SPAN_COUNT <= 16, "Span id is 4 bits in summary");
+
+	//
+	// Private functions
+	//
+	int compare_durations(const void *a, const void *b);
+
+	/******************************************************************************
+	 * Start a span
+	 *****************************************************************************/
+	Span::Span(SpanId id) : _id(id), _start_us(now_us())
+	{
+	}
+
+	/******************************************************************************
+	 * End a span, recorded in the ring
+	 *****************************************************************************/
+	Span::~Span()
+	{
+		record(_id, _start_us);
+	}
+
+	/******************************************************************************
+	 * uS since boot, keeps counting over light sleep
+	 *****************************************************************************/
+	int64_t now_us()
+	{
+		return esp_timer_get_time();
+	}
+
+	/******************************************************************************
+	 * Record a span started at start_us and ending now
+	 * @param id Span
+	 * @param start_us Start, from now_us()
+	 *****************************************************************************/
+	void record(SpanId id, int64_t start_us)
+	{
+		int64_t dur_us = now_us() - start_us;
+
+		Record rec;
+		rec.start_us = (uint32_t)start_us;
+		rec.dur_us = dur_us < 0 ? 0 : (dur_us > UINT32_MAX ? UINT32_MAX : (uint32_t)dur_us);
+		rec.span = id;
+
+		portENTER_CRITICAL(&_mux);
+
+		_ring[_head] = rec;
+		_head = (_head + 1) % TRACE_RING_LEN;
+
+		if(_count < TRACE_RING_LEN)
+			_count++;
+
+		portEXIT_CRITICAL(&_mux);
+	}
+
+	/******************************************************************************
+	 * Log p50/p95 of each span recorded since last summary, once every
+	 * TRACE_SUMMARY_INTERVAL_SECS. Ring is cleared after
+	 *****************************************************************************/
+	void log_summary()
+	{
+		uint32_t now = RTC::get_timestamp();
+
+		if(_last_summary_tstamp != 0 && now >= _last_summary_tstamp &&
+			now - _last_summary_tstamp < TRACE_SUMMARY_INTERVAL_SECS)
+			return;
+
+		Scratch::Scope scratch;
+		uint32_t *durations = (uint32_t*)Scratch::alloc(TRACE_RING_LEN * sizeof(uint32_t));
+
+		if(durations == NULL)
+			return;
+
+		_last_summary_tstamp = now;
+
+		for(int span = 0; span < SPAN_COUNT; span++)
+		{
+			int samples = 0;
+
+			portENTER_CRITICAL(&_mux);
+			for(int i = 0; i < _count; i++)
+			{
+				if(_ring[i].span == span)
+					durations[samples++] = _ring[i].dur_us;
+			}
+			portEXIT_CRITICAL(&_mux);
+
+			if(samples == 0)
+				continue;
+
+			qsort(durations, samples, sizeof(uint32_t), compare_durations);
+
+			uint32_t p50 = durations[(samples - 1) * 50 / 100];
+			uint32_t p95 = durations[(samples - 1) * 95 / 100];
+
+			debug_printf("Span %s: %d samples, p50 %u us, p95 %u us\n", SPAN_NAMES[span], samples, p50, p95);
+
+			const uint32_t metas[] = {
+				span | ((uint32_t)samples << 4),
+				p50 / SUMMARY_UNITS_US[span],
+				p95 / SUMMARY_UNITS_US[span]
+			};
+
+			Log::log_metas(Log::TRACE_SUMMARY, metas, 3);
+		}
+
+		clear();
+	}
+
+	/******************************************************************************
+	 * Print recorded spans, oldest first, as CSV. Always to serial (also in
+	 * release builds), it is how the trace is downloaded in config mode
+	 *****************************************************************************/
+	void print()
+	{
+		Serial.println(F("start_us,span,dur_us"));
+
+		int first = (_head - _count + TRACE_RING_LEN) % TRACE_RING_LEN;
+
+		for(int i = 0; i < _count; i++)
+		{
+			Record rec;
+
+			portENTER_CRITICAL(&_mux);
+			rec = _ring[(first + i) % TRACE_RING_LEN];
+			portEXIT_CRITICAL(&_mux);
+
+			Serial.printf("%u,%s,%u\n", rec.start_us, SPAN_NAMES[rec.span], rec.dur_us);
+		}
+	}
+
+	/******************************************************************************
+	 * Drop all recorded spans
+	 *****************************************************************************/
+	void clear()
+	{
+		portENTER_CRITICAL(&_mux);
+		_head = 0;
+		_count = 0;
+		portEXIT_CRITICAL(&_mux);
+	}
+
+	/******************************************************************************
+	 * Arm detailed tracing for the next wake cycles or minutes, whichever lasts
+	 * longer. 0 for both disarms
+	 *****************************************************************************/
+	void arm(int cycles, int mins)
+	{
+		_armed_cycles = cycles < 0 ? 0 : (cycles > UINT16_MAX ? UINT16_MAX : cycles);
+		_armed_until = mins > 0 ? RTC::get_timestamp() + mins * 60 : 0;
+
+		debug_printf("Tracing armed for %u cycles, until %u\n", _armed_cycles, _armed_until);
+	}
+
+	/******************************************************************************
+	 * Detailed tracing armed
+	 *****************************************************************************/
+	bool is_armed()
+	{
+		return _armed_cycles > 0 || (_armed_until != 0 && RTC::get_timestamp() < _armed_until);
+	}
+
+	/******************************************************************************
+	 * End of a wake cycle, before deep sleep. When armed, spans of the cycle are
+	 * appended to the trace file and one armed cycle is used up
+	 *****************************************************************************/
+	RetResult end_cycle()
+	{
+		if(!is_armed())
+		{
+			_armed_until = 0;
+			return RET_OK;
+		}
+
+		if(_armed_cycles > 0)
+			_armed_cycles--;
+
+		if(_count == 0)
+			return RET_OK;
+
+		File f = STORAGE_FS.open(TRACE_PATH, "a");
+		if(!f)
+		{
+			debug_println_e(F("Could not open trace file."));
+			return RET_ERROR;
+		}
+
+		CycleHeader header = {RTC::get_timestamp(), (uint16_t)_count};
+
+		if(f.size() + sizeof(header) + _count * sizeof(Record) > TRACE_FILE_MAX_SIZE)
+		{
+			debug_println_w(F("Trace file full, cycle dropped."));
+			f.close();
+			clear();
+			return RET_ERROR;
+		}
+
+		bool ok = f.write((uint8_t*)&header, sizeof(header)) == sizeof(header);
+
+		int first = (_head - _count + TRACE_RING_LEN) % TRACE_RING_LEN;
+
+		for(int i = 0; ok && i < _count; i++)
+			ok = f.write((uint8_t*)&_ring[(first + i) % TRACE_RING_LEN], sizeof(Record)) == sizeof(Record);
+
+		f.close();
+		clear();
+
+		if(!ok)
+		{
+			// A partial cycle would misalign all after it
+			debug_println_e(F("Could not write trace file, dropped."));
+			STORAGE_FS.remove(TRACE_PATH);
+			return RET_ERROR;
+		}
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Build telemetry of a cycle in the trace file
+	 * @param index Cycle, oldest first
+	 * @return Payload length, 0 if no such cycle
+	 *****************************************************************************/
+	int build_upload_payload(int index, char *buff, int buff_size)
+	{
+		File f = STORAGE_FS.open(TRACE_PATH, FILE_READ);
+		if(!f)
+			return 0;
+
+		CycleHeader header;
+		uint32_t pos = 0;
+
+		// Skip to cycle
+		for(int i = 0; ; i++)
+		{
+			f.seek(pos);
+
+			if(f.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.count > TRACE_RING_LEN)
+			{
+				f.close();
+				return 0;
+			}
+
+			if(i == index)
+				break;
+
+			pos += sizeof(header) + header.count * sizeof(Record);
+		}
+
+		Scratch::Scope scratch;
+		int raw_len = 1 + sizeof(header) + header.count * sizeof(Record);
+		uint8_t *raw = (uint8_t*)Scratch::alloc(raw_len);
+
+		if(raw == NULL)
+		{
+			f.close();
+			return 0;
+		}
+
+		raw[0] = TRACE_UPLOAD_VERSION;
+		memcpy(raw + 1, &header, sizeof(header));
+
+		int records_len = header.count * sizeof(Record);
+		bool ok = f.read(raw + 1 + sizeof(header), records_len) == (size_t)records_len;
+
+		f.close();
+
+		if(!ok)
+			return 0;
+
+		// Cycles of a second apart, ms keep TB keys unique
+		int len = snprintf(buff, buff_size, TB_TRACE_PAYLOAD_FORMAT, (unsigned long long)header.tstamp * 1000 + index % 1000);
+		const char suffix[] = "\"}}";
+
+		size_t encoded_len = 0;
+
+		if(len <= 0 || len >= buff_size ||
+			mbedtls_base64_encode((unsigned char*)buff + len, buff_size - len - sizeof(suffix) + 1,
+			&encoded_len, raw, raw_len) != 0)
+		{
+			debug_println_e(F("Trace cycle does not fit payload."));
+			return 0;
+		}
+
+		len += encoded_len;
+		memcpy(buff + len, suffix, sizeof(suffix));
+
+		return len + sizeof(suffix) - 1;
+	}
+
+	/******************************************************************************
+	 * Drop uploaded cycles
+	 *****************************************************************************/
+	void clear_upload()
+	{
+		if(STORAGE_FS.exists(TRACE_PATH))
+			STORAGE_FS.remove(TRACE_PATH);
+	}
+
+	/******************************************************************************
+	 * Sort helper, ascending durations
+	 *****************************************************************************/
+	int compare_durations(const void *a, const void *b)
+	{
+		uint32_t da = *(const uint32_t*)a, db = *(const uint32_t*)b;
+
+		return da < db ? -1 : (da > db ? 1 : 0);
+	}
+
+	/******************************************************************************
+	 * Save state before deep sleep. Spans are not kept
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->last_summary_tstamp = _last_summary_tstamp;
+		state->armed_cycles = _armed_cycles;
+		state->armed_until = _armed_until;
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_last_summary_tstamp = state->last_summary_tstamp;
+		_armed_cycles = state->armed_cycles;
+		_armed_until = state->armed_until;
+	}
+}
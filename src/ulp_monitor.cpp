@@ -0,0 +1,173 @@
+#include "ulp_monitor.h"
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <driver/adc.h>
+#include "esp32/ulp.h"
+#include "soc/rtc_cntl_reg.h"
+#include "sdkconfig.h"
+#include "adc_manager.h"
+#include "const.h"
+#include "app_config.h"
+#include "common.h"
+
+#ifndef CONFIG_ULP_COPROC_ENABLED
+#error "ULP monitor needs CONFIG_ULP_COPROC_ENABLED (RTC slow memory reserved for the ULP)"
+#endif
+
+namespace UlpMonitor
+{
+	//
+	// Private vars
+	//
+
+	/** Shared vars, words at the start of RTC slow memory. ULP writes the low 16 bits */
+	enum Var
+	{
+		VAR_BATTERY_RAW,
+		VAR_BATTERY_CHECKS,
+		VAR_COUNT
+	};
+
+	/** Program is loaded after the shared vars */
+	const uint32_t PROG_ADDR = VAR_COUNT;
+
+	/** Program labels */
+	enum Label
+	{
+		LABEL_WAKE
+	};
+
+	/** Monitor started and not stopped yet */
+	bool _running = false;
+
+	/******************************************************************************
+	 * Load and start battery monitor program
+	 * @param threshold_mv Battery mV (before the 1/2 divider) CPU is woken up at
+	 *****************************************************************************/
+	RetResult start_battery(uint16_t threshold_mv)
+	{
+		int adc_channel = digitalPinToAnalogChannel(PIN_ADC_BAT);
+
+		// ULP can only sample ADC1
+		if(adc_channel < 0 || adc_channel >= 10)
+		{
+			debug_println_e(F("ULP: battery pin is not an ADC1 pin."));
+			return RET_ERROR;
+		}
+
+		int threshold_raw = AdcManager::mv_to_raw(AdcManager::CHANNEL_BATTERY, threshold_mv / 2);
+		if(threshold_raw < 0)
+			return RET_ERROR;
+
+		// Average of 4 samples. Checks are counted, reading is kept for the CPU
+		// and the CPU is woken up once the threshold is reached. The ULP timer
+		// is stopped then, the CPU restarts the program if going back to sleep
+		const ulp_insn_t program[] = {
+			I_MOVI(R3, 0),
+			I_LD(R1, R3, VAR_BATTERY_CHECKS),
+			I_ADDI(R1, R1, 1),
+			I_ST(R1, R3, VAR_BATTERY_CHECKS),
+
+			I_ADC(R0, 0, adc_channel),
+			I_MOVR(R1, R0),
+			I_ADC(R0, 0, adc_channel),
+			I_ADDR(R1, R1, R0),
+			I_ADC(R0, 0, adc_channel),
+			I_ADDR(R1, R1, R0),
+			I_ADC(R0, 0, adc_channel),
+			I_ADDR(R1, R1, R0),
+			I_RSHI(R0, R1, 2),
+			I_ST(R0, R3, VAR_BATTERY_RAW),
+
+			M_BGE(LABEL_WAKE, threshold_raw),
+			I_HALT(),
+
+			M_LABEL(LABEL_WAKE),
+			I_WAKE(),
+			I_END(),
+			I_HALT()
+		};
+
+		size_t size = sizeof(program) / sizeof(ulp_insn_t);
+
+		if(PROG_ADDR + size > CONFIG_ULP_COPROC_RESERVE_MEM / 4)
+		{
+			debug_println_e(F("ULP: program does not fit reserved memory."));
+			return RET_ERROR;
+		}
+
+		for(int i = 0; i < VAR_COUNT; i++)
+			RTC_SLOW_MEM[i] = 0;
+
+		// Atten/width already configured by AdcManager
+		adc1_ulp_enable();
+
+		if(ulp_process_macros_and_load(PROG_ADDR, program, &size) != ESP_OK ||
+			ulp_set_wakeup_period(0, (uint32_t)ULP_BATTERY_CHECK_INT_SECS * 1000000) != ESP_OK ||
+			ulp_run(PROG_ADDR) != ESP_OK)
+		{
+			debug_println_e(F("ULP: could not start battery monitor."));
+			return RET_ERROR;
+		}
+
+		debug_printf("ULP: battery monitor started, wake up at %dmV (raw %d)\n", threshold_mv, threshold_raw);
+
+		_running = true;
+		enable_wakeup();
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Stop program timer and ULP wake up
+	 *****************************************************************************/
+	void stop()
+	{
+		CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+		esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ULP);
+
+		_running = false;
+	}
+
+	/******************************************************************************
+	 * Check if monitor has been started
+	 *****************************************************************************/
+	bool running()
+	{
+		return _running;
+	}
+
+	/******************************************************************************
+	 * Enable ULP wake up if monitor is running. Called again by DeepSleep::start()
+	 * that resets wake up sources
+	 *****************************************************************************/
+	void enable_wakeup()
+	{
+		if(_running)
+			esp_sleep_enable_ulp_wakeup();
+	}
+
+	/******************************************************************************
+	 * Check if last wake up was from ULP
+	 *****************************************************************************/
+	bool woke_up()
+	{
+		return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP;
+	}
+
+	/******************************************************************************
+	 * Get last averaged battery ADC reading taken by ULP (raw, after divider)
+	 *****************************************************************************/
+	uint16_t get_last_battery_raw()
+	{
+		return RTC_SLOW_MEM[VAR_BATTERY_RAW] & 0xFFFF;
+	}
+
+	/******************************************************************************
+	 * Get battery checks the ULP has done since started
+	 *****************************************************************************/
+	uint16_t get_battery_checks()
+	{
+		return RTC_SLOW_MEM[VAR_BATTERY_CHECKS] & 0xFFFF;
+	}
+}
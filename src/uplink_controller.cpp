@@ -0,0 +1,166 @@
+#include "uplink_controller.h"
+#include "common.h"
+#include "log.h"
+
+namespace UplinkController
+{
+	//
+	// Private functions
+	//
+	void update_quality();
+
+	//
+	// Private vars
+	//
+	/** RSSI (dBm) when session started */
+	int _rssi = 0;
+
+	/** Smoothed round-trip time of requests in this session, 0 if none yet */
+	uint32_t _rtt_avg_ms = 0;
+
+	/** Results of latest requests, a bit per request (1 = failed), newest is LSB.
+	 * Kept across sessions, RAM is retained during sleep */
+	uint32_t _history = 0;
+
+	/** Failed requests in a row, resets on success */
+	int _consecutive_failures = 0;
+
+	/** Current estimate */
+	Quality _quality = QUALITY_GOOD;
+
+	/******************************************************************************
+	 * Start of a call home session
+	 * @param rssi RSSI (dBm) after connecting
+	 *****************************************************************************/
+	void start(int rssi)
+	{
+		_rssi = rssi;
+		_rtt_avg_ms = 0;
+		_consecutive_failures = 0;
+
+		update_quality();
+
+		debug_print(F("Uplink quality: "));
+		debug_println(_quality, DEC);
+	}
+
+	/******************************************************************************
+	 * End of a call home session, log what the session looked like
+	 *****************************************************************************/
+	void end()
+	{
+		Log::log(Log::UPLINK_QUALITY, _quality, _rtt_avg_ms);
+	}
+
+	/******************************************************************************
+	 * Record result of a request
+	 * @param success Request succeeded
+	 * @param rtt_ms Time from sending the request until the response was read
+	 *****************************************************************************/
+	void on_request_complete(bool success, uint32_t rtt_ms)
+	{
+		_history = ((_history << 1) | (success ? 0 : 1)) & ((1UL << UPLINK_HISTORY_LEN) - 1);
+
+		if(success)
+		{
+			_consecutive_failures = 0;
+
+			// Exponential moving average, new sample weighs 1/4
+			_rtt_avg_ms = _rtt_avg_ms == 0 ? rtt_ms : (_rtt_avg_ms * 3 + rtt_ms) / 4;
+		}
+		else
+		{
+			_consecutive_failures++;
+		}
+
+		update_quality();
+	}
+
+	/******************************************************************************
+	 * Estimate quality, the worst of RSSI, RTT and failure history
+	 *****************************************************************************/
+	void update_quality()
+	{
+		Quality rssi_quality = _rssi >= UPLINK_RSSI_GOOD ? QUALITY_GOOD :
+			_rssi >= UPLINK_RSSI_FAIR ? QUALITY_FAIR : QUALITY_BAD;
+
+		Quality rtt_quality = _rtt_avg_ms == 0 || _rtt_avg_ms <= UPLINK_RTT_GOOD_MS ? QUALITY_GOOD :
+			_rtt_avg_ms <= UPLINK_RTT_FAIR_MS ? QUALITY_FAIR : QUALITY_BAD;
+
+		int failures = __builtin_popcount(_history);
+		Quality history_quality = failures <= UPLINK_HISTORY_FAILURES_GOOD ? QUALITY_GOOD :
+			failures <= UPLINK_HISTORY_FAILURES_FAIR ? QUALITY_FAIR : QUALITY_BAD;
+
+		Quality quality = rssi_quality;
+		if(rtt_quality < quality)
+			quality = rtt_quality;
+		if(history_quality < quality)
+			quality = history_quality;
+
+		_quality = quality;
+	}
+
+	/******************************************************************************
+	 * Current link quality estimate
+	 *****************************************************************************/
+	Quality get_quality()
+	{
+		return _quality;
+	}
+
+	/******************************************************************************
+	 * Telemetry request size for current quality
+	 * @param max_budget Size used on a good link
+	 *****************************************************************************/
+	int get_req_byte_budget(int max_budget)
+	{
+		int budget = max_budget;
+
+		if(_quality == QUALITY_FAIR)
+			budget = max_budget / 2;
+		else if(_quality == QUALITY_BAD)
+			budget = max_budget / 4;
+
+		return budget < UPLINK_MIN_REQ_BYTE_BUDGET ? UPLINK_MIN_REQ_BYTE_BUDGET : budget;
+	}
+
+	/******************************************************************************
+	 * HTTP client stream timeout for current quality
+	 *****************************************************************************/
+	int get_stream_timeout()
+	{
+		return HTTP_CLIENT_STREAM_TIMEOUT * (_quality == QUALITY_GOOD ? 1 : _quality == QUALITY_FAIR ? 2 : 3);
+	}
+
+	/******************************************************************************
+	 * HTTP response timeout for current quality
+	 *****************************************************************************/
+	int get_response_timeout()
+	{
+		return _quality == QUALITY_GOOD ? HTTL_CLIENT_REPONSE_TIMEOUT :
+			_quality == QUALITY_FAIR ? UPLINK_FAIR_RESPONSE_TIMEOUT : UPLINK_BAD_RESPONSE_TIMEOUT;
+	}
+
+	/******************************************************************************
+	 * Time to wait before the request following a failed one. Doubles with every
+	 * failure in a row
+	 *****************************************************************************/
+	uint32_t get_retry_backoff()
+	{
+		if(_consecutive_failures == 0)
+			return 0;
+
+		uint32_t backoff = UPLINK_RETRY_BACKOFF_MS << (_consecutive_failures - 1);
+
+		return backoff > UPLINK_MAX_RETRY_BACKOFF_MS ? UPLINK_MAX_RETRY_BACKOFF_MS : backoff;
+	}
+
+	/******************************************************************************
+	 * Failed requests after which telemetry submission is aborted. Bad links give
+	 * up earlier to save energy
+	 *****************************************************************************/
+	int get_failed_req_threshold()
+	{
+		return _quality == QUALITY_BAD ? UPLINK_BAD_FAILED_REQ_THRESHOLD : FAILED_TELEMETRY_REQ_THRESHOLD;
+	}
+}
@@ -0,0 +1,175 @@
+#include "uplink_metrics.h"
+#include "common.h"
+#include "gsm.h"
+
+namespace UplinkMetrics
+{
+	//
+	// Private types
+	//
+	/** Counters of a session */
+	struct Metrics
+	{
+		/** Network attach and PDP activation, summed over connect tries */
+		uint32_t attach_ms;
+		uint32_t pdp_ms;
+
+		/** Body bytes of all requests and responses */
+		uint32_t sent_bytes;
+		uint32_t recv_bytes;
+
+		uint16_t requests;
+
+		/** Requests by HTTP status class, 1xx/3xx counted as other */
+		uint16_t status_2xx;
+		uint16_t status_4xx;
+		uint16_t status_5xx;
+		uint16_t status_other;
+
+		/** Requests without a response */
+		uint16_t timeouts;
+
+		/** Requests resent after a failure */
+		uint16_t retries;
+
+		uint32_t rtt_max_ms;
+
+		/** Round-trip times of the first UPLINK_METRICS_RTT_SAMPLES requests, for the median */
+		uint32_t rtt_ms[UPLINK_METRICS_RTT_SAMPLES];
+		int rtt_count;
+
+		int rssi;
+		GSM::ServingCell cell;
+	};
+
+	//
+	// Private functions
+	//
+	uint32_t rtt_median();
+
+	//
+	// Private vars
+	//
+	Metrics _metrics = {0};
+
+	/******************************************************************************
+	 * Record a successful network attach
+	 * @param attach_ms Time until registered
+	 * @param pdp_ms Time to activate PDP context after registering
+	 *****************************************************************************/
+	void on_attach(uint32_t attach_ms, uint32_t pdp_ms)
+	{
+		_metrics.attach_ms += attach_ms;
+		_metrics.pdp_ms += pdp_ms;
+	}
+
+	/******************************************************************************
+	 * Record signal and serving cell once connected
+	 * @param rssi RSSI (dBm)
+	 *****************************************************************************/
+	void on_radio(int rssi)
+	{
+		if(!FLAGS.UPLINK_METRICS)
+			return;
+
+		_metrics.rssi = rssi;
+
+		if(GSM::get_serving_cell(&_metrics.cell) != RET_OK)
+			debug_println_w(F("Could not read serving cell."));
+	}
+
+	/******************************************************************************
+	 * Record a completed request
+	 * @param rtt_ms Time from sending the request until the response was read
+	 * @param sent_bytes Body bytes sent
+	 * @param recv_bytes Body bytes received
+	 * @param status HTTP status, 0 if no response, -1 for a successful request of
+	 * 	another transport (MQTT, CoAP)
+	 *****************************************************************************/
+	void on_request(uint32_t rtt_ms, int sent_bytes, int recv_bytes, int status)
+	{
+		_metrics.requests++;
+		_metrics.sent_bytes += sent_bytes > 0 ? sent_bytes : 0;
+		_metrics.recv_bytes += recv_bytes > 0 ? recv_bytes : 0;
+
+		if(status == 0)
+			_metrics.timeouts++;
+		else if(status >= 200 && status < 300)
+			_metrics.status_2xx++;
+		else if(status >= 400 && status < 500)
+			_metrics.status_4xx++;
+		else if(status >= 500 && status < 600)
+			_metrics.status_5xx++;
+		else if(status > 0)
+			_metrics.status_other++;
+
+		// Failed requests would skew RTT towards the timeouts
+		if(status != 0)
+		{
+			if(rtt_ms > _metrics.rtt_max_ms)
+				_metrics.rtt_max_ms = rtt_ms;
+
+			if(_metrics.rtt_count < UPLINK_METRICS_RTT_SAMPLES)
+				_metrics.rtt_ms[_metrics.rtt_count++] = rtt_ms;
+		}
+	}
+
+	/******************************************************************************
+	 * Record a request resent after a failure
+	 *****************************************************************************/
+	void on_retry()
+	{
+		_metrics.retries++;
+	}
+
+	/******************************************************************************
+	 * Build TB telemetry entry of the session
+	 * @param tstamp Timestamp of entry
+	 * @return Length, 0 if it did not fit
+	 *****************************************************************************/
+	int build_payload(char *buff, int buff_size, uint32_t tstamp)
+	{
+		int len = snprintf(buff, buff_size, TB_UPLINK_METRICS_PAYLOAD_FORMAT, tstamp,
+			_metrics.attach_ms, _metrics.pdp_ms, _metrics.sent_bytes, _metrics.recv_bytes,
+			_metrics.requests, rtt_median(), _metrics.rtt_max_ms,
+			_metrics.status_2xx, _metrics.status_4xx, _metrics.status_5xx, _metrics.status_other,
+			_metrics.timeouts, _metrics.retries, _metrics.rssi, _metrics.cell.rsrp, _metrics.cell.rsrq,
+			_metrics.cell.oper, _metrics.cell.rat);
+
+		return len > 0 && len < buff_size ? len : 0;
+	}
+
+	/******************************************************************************
+	 * Start counting a new session
+	 *****************************************************************************/
+	void reset()
+	{
+		memset(&_metrics, 0, sizeof(_metrics));
+	}
+
+	/******************************************************************************
+	 * Median of recorded round-trip times, sorts the samples
+	 *****************************************************************************/
+	uint32_t rtt_median()
+	{
+		if(_metrics.rtt_count == 0)
+			return 0;
+
+		// Insertion sort, few samples
+		for(int i = 1; i < _metrics.rtt_count; i++)
+		{
+			uint32_t rtt = _metrics.rtt_ms[i];
+			int j = i - 1;
+
+			while(j >= 0 && _metrics.rtt_ms[j] > rtt)
+			{
+				_metrics.rtt_ms[j + 1] = _metrics.rtt_ms[j];
+				j--;
+			}
+
+			_metrics.rtt_ms[j + 1] = rtt;
+		}
+
+		return _metrics.rtt_ms[_metrics.rtt_count / 2];
+	}
+}
@@ -1,10 +1,13 @@
 #include <Arduino.h>
 #include "utils.h"
-#include "SPIFFS.h"
+#include "storage.h"
+#include "flash.h"
 #include "app_config.h"
 #include "struct.h"
-#include "CRC32.h"
+#include "rom/crc.h"
 #include "Wire.h"
+#include "i2c_bus.h"
+#include "power_lock.h"
 #include "const.h"
 #include "device_config.h"
 #include "rom/rtc.h"
@@ -14,6 +17,13 @@
 #include "water_sensor_data.h"
 #include "soil_moisture_data.h"
 #include "atmos41_data.h"
+#include "lightning_data.h"
+#include "fo_data.h"
+#include "rollup_data.h"
+#include "relay_data.h"
+#include "energy_profile_data.h"
+#include "sdi12_log.h"
+#include "log.h"
 
 namespace Utils
 {
@@ -40,8 +50,10 @@ namespace Utils
 
 		esp_read_mac(mac, ESP_MAC_WIFI_STA);
 
-		uint32_t meta1 = (uint32_t)mac;
-		uint32_t meta2 = (uint32_t)mac[4];
+		// First 4 bytes and last 2 bytes of the MAC
+		uint32_t meta1, meta2;
+		memcpy(&meta1, mac, sizeof(meta1));
+		memcpy(&meta2, mac + 4, sizeof(meta2));
 
 		Log::log(Log::MAC_ADDRESS, meta1, meta2);
 	}
@@ -118,12 +130,12 @@ namespace Utils
 	{
 		for(int i = 0; i < len; i++)
 		{
-			Serial.printf("%02x ", buff[i]);
+			debug_printf("%02x ", buff[i]);
 
 			if((i + 1) % break_pos == 0)
-				Serial.println();
+				debug_println();
 		}
-		Serial.println();
+		debug_println();
 	}
 
 	/********************************************************************************
@@ -136,12 +148,46 @@ namespace Utils
 	}
 
     /********************************************************************************
-	 * Calculate CRC32 of a data buffer
+	 * Calculate CRC32 of a data buffer. Table-driven ROM implementation, same
+	 * result as the CRC32 library used before (IEEE 802.3)
 	 * @param data Data packet
 	 *******************************************************************************/
 	uint32_t crc32(uint8_t *buff, uint32_t buff_size)
 	{
-		return CRC32::calculate((uint8_t*)buff, buff_size);
+		return crc32_le(0, buff, buff_size);
+	}
+
+    /********************************************************************************
+	 * Continue a CRC32 with more data, crc32(a + b) == crc32_update(crc32(a), b)
+	 * @param crc CRC32 of data so far, 0 to start
+	 *******************************************************************************/
+	uint32_t crc32_update(uint32_t crc, const uint8_t *buff, uint32_t buff_size)
+	{
+		return crc32_le(crc, buff, buff_size);
+	}
+
+    /********************************************************************************
+	 * Check CRC32 of a buffer of entries in one call. Each entry starts with the
+	 * CRC32 of its data (DataStore::Entry layout)
+	 * @param count Entries in buffer, max 32
+	 * @param entry_size Size of an entry, header included
+	 * @param data_offset Offset of checksummed data in an entry
+	 * @return Bit per entry, set if CRC is valid
+	 *******************************************************************************/
+	uint32_t crc32_check_entries(const uint8_t *entries, int count, int entry_size, int data_offset, int data_size)
+	{
+		uint32_t valid = 0;
+
+		for(int i = 0; i < count && i < 32; i++, entries += entry_size)
+		{
+			uint32_t crc;
+			memcpy(&crc, entries, sizeof(crc));
+
+			if(crc32_le(0, entries + data_offset, data_size) == crc)
+				valid |= 1UL << i;
+		}
+
+		return valid;
 	}
 
 	/******************************************************************************
@@ -156,10 +202,7 @@ namespace Utils
         
 		debug_println(F("Setting IP5306 power registers"));
 
-		Wire.beginTransmission(IP5306_I2C_ADDR);
-		Wire.write(IP5306_REG_SYS_CTL0);
-	    Wire.write(IP5306_BOOST_FLAGS); 
-   		Wire.endTransmission() ;
+		RetResult ret = I2CBus::write_reg(IP5306_I2C_ADDR, IP5306_REG_SYS_CTL0, IP5306_BOOST_FLAGS);
 		
 		if (enable)
 		{
@@ -173,8 +216,7 @@ namespace Utils
 			digitalWrite(PIN_GSM_POWER_ON, LOW);
 		}
 	
-		//TODO check success?
-		return RET_OK;
+		return ret;
 
 
 		// if(Wire.requestFrom(IP5306_I2C_ADDR, 1))
@@ -301,9 +343,9 @@ namespace Utils
 	 * Build TB attributes API URL for this device
 	 *****************************************************************************/
 	// TODO: Useless?? Can be inline
-	RetResult tb_build_attributes_url_path(char *buff, int buff_size)
+	RetResult tb_build_attributes_url_path(char *buff, int buff_size, const char *format)
 	{
-		snprintf(buff, buff_size, TB_SHARED_ATTRIBUTES_URL_FORMAT, DeviceConfig::get_tb_device_token());
+		snprintf(buff, buff_size, format, DeviceConfig::get_tb_device_token());
 
 		return RET_OK;
 	}
@@ -323,45 +365,16 @@ namespace Utils
 	 *****************************************************************************/
 	RetResult restart_device()
 	{
-		DeviceConfig::set_clean_reboot(true);
+		Log::flush_windows();
+		Log::commit();
+
+		// Write config changed during this cycle
 		DeviceConfig::commit();
+		DeviceConfig::set_clean_reboot(true);
 
 		ESP.restart();
 	}
 
-	/******************************************************************************
-	* Read ADC and convert to mV
-	* @param pin ADC pin
-	* @param samples Number of samples to read
-	* @param sampling_delay_ms mS to wait between samples
-	* @return Value in mV
-	******************************************************************************/
-	int read_adc_mv(uint8_t pin, int samples, int sampling_delay_ms)
-	{
-		if(samples < 0)
-		{
-			return -1;
-		}
-
-		if(sampling_delay_ms < 0)
-		{
-			return -1;
-		}
-
-		int level_raw = 0;
-		for(int i = 0; i < samples; i++)
-		{
-			level_raw += analogRead(pin);
-			delay(sampling_delay_ms);
-		}
-		level_raw /= samples;
-
-		// Convert to mV
-		int mv = ((float)3600 / 4096) * level_raw;
-
-		return mv;
-	}
-
 	/******************************************************************************
 	 * Print reset reason
 	 *****************************************************************************/
@@ -681,7 +694,6 @@ namespace Utils
 			if(strlen(DeviceConfig::get_tb_device_token()) == 0)
 			{
 				DeviceConfig::set_tb_device_token((char*)FALLBACK_TB_DEVICE_TOKEN);
-				DeviceConfig::commit();
 			}
 
 			Utils::print_separator(NULL);
@@ -700,7 +712,6 @@ namespace Utils
 			if(strlen(DeviceConfig::get_cellular_apn()) == 0)
 			{
 				DeviceConfig::set_cellular_apn((char*)FALLBACK_CELL_APN);
-				DeviceConfig::commit();				
 			}
 
 			Utils::print_separator(NULL);
@@ -744,62 +755,6 @@ namespace Utils
 		serializeJson(_json_doc, buff, buff_size);
 	}
 
-	/**
-	 * Filter outliers in an array (std dev).
-	 * Outliers are marked as -1.
-	 * @param vals  Value array
-	 * @param count Size of array
-	 * @param avg   Outputs avg of filtered array
-	 * @return      Outlier count
-	 */
-	int filter_outliers(int vals[], int count, float *avg_out)
-	{
-		float avg = 0;
-
-		// Calc avg
-		for (int i = 0; i < count; ++i)
-		{
-			avg += vals[i];
-		}
-		avg /= count;
-		printf("Avg: %3.3f\n", avg);
-
-		// Calc std dev
-		float std_dev = 0;
-		for (int i = 0; i < count; ++i)
-		{
-			std_dev += pow(vals[i] - avg, 2);
-		}
-		std_dev /= count;
-		std_dev = sqrt(std_dev);
-		printf("Std dev: %f\n", std_dev);
-
-		// Mark outliers as -1
-		// Also calc avg of clean values
-		int outlier_count = 0;
-		float valid_avg = 0;
-		for(int i=0; i<count; i++)
-		{
-			if(vals[i] < (avg - std_dev) || vals[i] > (avg + std_dev))
-			{
-				// Mark outlier
-				vals[i] = -1;
-				outlier_count++;
-			}
-			else
-			{
-				valid_avg += vals[i];
-			}
-		}
-
-		valid_avg /= (count - outlier_count);
-
-		if(avg_out != nullptr)
-			*avg_out = valid_avg;
-
-		return outlier_count;
-	}
-
 	/******************************************************************************
     * Print array
     ******************************************************************************/
@@ -814,16 +769,4 @@ namespace Utils
                 Serial.print("\n");
         }
     }
-
-	/******************************************************************************
-	* Check if any store needs cleanup
-	* Temporary solution to work around SPIFFS bugs, until migration to LittleFS
-	******************************************************************************/
-	void cleanup_stores()
-	{
-		Log::get_store()->cleanup(false);
-		WaterSensorData::get_store()->cleanup(false);
-		SoilMoistureData::get_store()->cleanup(false);
-		Atmos41Data::get_store()->cleanup(false);
-	}
 }
\ No newline at end of file
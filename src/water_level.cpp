@@ -6,6 +6,10 @@
 #include "common.h"
 #include "log.h"
 #include "log_codes.h"
+#include "sampling.h"
+#include "adc_manager.h"
+#include "power_lock.h"
+#include <driver/rmt.h>
 
 namespace WaterLevel
 {
@@ -19,10 +23,24 @@ namespace WaterLevel
 	RetResult measure_dfrobot_ultrasonic_serial(WaterSensorData::Entry *data);
 	uint8_t calc_dfrobot_checksum(char *data);
 	void set_last_error(ErrorCode error);
+	Sampling::Plan make_plan(float tolerance);
+	RetResult sample(const Sampling::Plan *plan, Sampling::ReadFunc read, void *ctx);
+	RetResult start_pwm_capture();
+	void stop_pwm_capture();
+	bool read_pwm_sample(void *ctx, float *out);
+	RetResult read_analog_mv(int *mv);
+	bool read_dfrobot_serial_sample(void *ctx, float *out);
+	bool read_maxbotix_serial_sample(void *ctx, float *out);
 
 	// Private members
 	ErrorCode _last_error = ERROR_NONE;
 
+	/** Value and quality of last measurement */
+	Sampling::Result _last_result = {};
+
+	/** Captured PWM pulses, valid while capture runs */
+	RingbufHandle_t _pwm_ringbuf = NULL;
+
 	/******************************************************************************
 	 * Init
 	 *****************************************************************************/	
@@ -52,22 +70,24 @@ namespace WaterLevel
 	 *****************************************************************************/
 	RetResult measure(WaterSensorData::Entry *data)
 	{
+		RetResult ret = RET_ERROR;
+
 		switch(WATER_LEVEL_INPUT_CHANNEL)
 		{
 		case WATER_LEVEL_CHANNEL_MAXBOTIX_PWM:
-			return measure_maxbotix_pwm(data);
+			ret = measure_maxbotix_pwm(data);
 			break;
 		case WATER_LEVEL_CHANNEL_MAXBOTIX_ANALOG:
-			return measure_maxbotix_analog(data);
+			ret = measure_maxbotix_analog(data);
 			break;
 		case WATER_LEVEL_CHANNEL_MAXBOTIX_SERIAL:
-			return measure_maxbotix_serial(data);
+			ret = measure_maxbotix_serial(data);
 			break;
 		case WATER_LEVEL_CHANNEL_DFROBOT_PRESSURE_ANALOG:
-			return measure_dfrobot_pressure_analog(data);
+			ret = measure_dfrobot_pressure_analog(data);
 			break;
 		case WATER_LEVEL_CHANNEL_DFROBOT_ULTRASONIC_SERIAL:
-			return measure_dfrobot_ultrasonic_serial(data);
+			ret = measure_dfrobot_ultrasonic_serial(data);
 			break;
 		default:
 			Utils::serial_style(STYLE_RED);
@@ -76,135 +96,279 @@ namespace WaterLevel
 
 			return RET_ERROR;
 		}
+
+		if(ret == RET_OK)
+			data->present |= WaterSensorData::PRESENT_WATER_LEVEL;
+
+		return ret;
 	}
 
 	/******************************************************************************
-	 * Read water level sensor and populate SensorData entry structure
-	 * Use sensors PWM channel
+	 * Sampling plan shared by all channels
+	 * @param tolerance Convergence tolerance in the channel's sample units
 	 *****************************************************************************/
-	RetResult measure_maxbotix_pwm(WaterSensorData::Entry *data)
+	Sampling::Plan make_plan(float tolerance)
 	{
-		debug_println(F("Measuring water level (PWM)"));
-		set_last_error(ERROR_NONE);
+		Sampling::Plan plan = {0};
+		plan.max_samples = WATER_LEVEL_MEASUREMENTS_COUNT;
+		plan.min_valid = WATER_LEVEL_MIN_VALID_MEASUREMENTS;
+		plan.max_invalid = WATER_LEVEL_PWM_FAILED_MEAS_LIMIT;
+		plan.delay_ms = WATER_LEVEL_DELAY_BETWEEN_MEAS_MS;
+		plan.timeout_ms = WATER_LEVEL_US_TIMEOUT_MS;
+		plan.tolerance = tolerance;
+
+		return plan;
+	}
 
-        // Return dummy values switch
-        if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
-        {
-            return measure_dummy(data);
-        }
+	/******************************************************************************
+	 * Run sampling plan, set last error from its status
+	 *****************************************************************************/
+	RetResult sample(const Sampling::Plan *plan, Sampling::ReadFunc read, void *ctx)
+	{
+		RetResult ret = Sampling::run(plan, read, ctx, &_last_result);
+		Sampling::print(&_last_result);
 
-		// Number of valid measurements
-		int cur_sample = 0;
-		int failures = 0;
+		switch(_last_result.status)
+		{
+		case Sampling::STATUS_OK:
+			break;
+		case Sampling::STATUS_TOO_MANY_INVALID:
+			set_last_error(ErrorCode::ERROR_TOO_MANY_INVALID_VALUES);
+			debug_println_e(F("Too many invalid values, aborting."));
+			break;
+		case Sampling::STATUS_TIMEOUT:
+			set_last_error(ErrorCode::ERROR_TIMEOUT);
+			debug_println_e(F("Timeout, aborting."));
+			break;
+		case Sampling::STATUS_HIGH_FLUCTUATION:
+			set_last_error(ErrorCode::ERROR_HIGH_VAL_FLUCTUATION);
+			debug_println_e(F("Too few valid values after filtering."));
+			break;
+		}
 
-		int samples[WATER_LEVEL_MEASUREMENTS_COUNT] = {0};
-		float avg = 0;
-		uint32_t start_ms = millis();
+		return ret;
+	}
 
-		while(millis() - start_ms < WATER_LEVEL_US_TIMEOUT_MS && cur_sample < WATER_LEVEL_MEASUREMENTS_COUNT)
+	/******************************************************************************
+	 * Set up RMT receiver on the PWM pin. Pulse widths are timestamped in hardware
+	 * at 1uS/tick, every pulse ends up as a separate frame in the ring buffer once
+	 * the line has been idle for WATER_LEVEL_PWM_RMT_IDLE_US
+	 *****************************************************************************/
+	RetResult start_pwm_capture()
+	{
+		rmt_config_t config = {};
+		config.rmt_mode = RMT_MODE_RX;
+		config.channel = (rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL;
+		config.gpio_num = (gpio_num_t)PIN_WATER_LEVEL_PWM;
+		config.clk_div = 80;
+		config.mem_block_num = 1;
+		config.rx_config.filter_en = true;
+		config.rx_config.filter_ticks_thresh = WATER_LEVEL_PWM_RMT_FILTER_TICKS;
+		config.rx_config.idle_threshold = WATER_LEVEL_PWM_RMT_IDLE_US;
+
+		if(rmt_config(&config) != ESP_OK ||
+			rmt_driver_install((rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL, WATER_LEVEL_PWM_RMT_BUFF_SIZE, 0) != ESP_OK)
 		{
-			int level = pulseIn(PIN_WATER_LEVEL_PWM, 1, WATER_LEVEL_PWM_TIMEOUT_MS * 1000);
-			Serial.print(F("Level: "));
-			Serial.println(level, DEC);
-
-			// Ignore invalid values
-			// 0 returned when no pulse before timeout
-			// Sensor returns max range when no target detected within rage
-			// Since PWM has an offset take into account a small tolerance
-			if(level == 0 || level >= (WATER_LEVEL_MAX_RANGE_MM - WATER_LEVEL_PWM_MAX_VAL_TOL))
-			{
-				if(++failures >= WATER_LEVEL_PWM_FAILED_MEAS_LIMIT)
-				{
-					set_last_error(ErrorCode::ERROR_TOO_MANY_INVALID_VALUES);
-					debug_println_e("Too many invalid values, aborting.");
-					return RET_ERROR;
-				}
-				else
-				{
-					debug_println_e("Invalid value, ignoring.");
-					continue;
-				}
-			}
+			debug_println_e(F("Could not set up PWM capture."));
+			return RET_ERROR;
+		}
 
-			avg += level;
-			samples[cur_sample++] = level;
+		// RMT ticks off APB, pulse widths are off if it changes while capturing
+		PowerLock::acquire(PowerLock::LOCK_APB_MAX);
 
-			delay(WATER_LEVEL_DELAY_BETWEEN_MEAS_MS);
+		rmt_get_ringbuf_handle((rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL, &_pwm_ringbuf);
+		rmt_rx_start((rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL, true);
+
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Stop RMT receiver and free its driver
+	 *****************************************************************************/
+	void stop_pwm_capture()
+	{
+		rmt_rx_stop((rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL);
+		rmt_driver_uninstall((rmt_channel_t)WATER_LEVEL_PWM_RMT_CHANNEL);
+		_pwm_ringbuf = NULL;
+
+		PowerLock::release(PowerLock::LOCK_APB_MAX);
+	}
+
+	/******************************************************************************
+	 * Read a PWM sample from the pulses captured so far, task blocks until the
+	 * next pulse if none is buffered. Pulse width is 1uS/mm
+	 *****************************************************************************/
+	bool read_pwm_sample(void *ctx, float *out)
+	{
+		size_t size = 0;
+		rmt_item32_t *items = (rmt_item32_t*)xRingbufferReceive(_pwm_ringbuf, &size,
+			pdMS_TO_TICKS(WATER_LEVEL_PWM_TIMEOUT_MS));
+
+		if(items == NULL)
+		{
+			debug_println_e(F("No pulse, ignoring."));
+			return false;
 		}
 
-		
-		if(millis() - start_ms >= WATER_LEVEL_US_TIMEOUT_MS)
+		// Width of first high level in frame. Frame may start with the tail of a
+		// pulse that was high when capture started, that one has no high level
+		uint32_t level = 0;
+		for(int i = 0; i < (int)(size / sizeof(rmt_item32_t)) && level == 0; i++)
 		{
-			set_last_error(ErrorCode::ERROR_TIMEOUT);
-			debug_println_e(F("Timeout, aborting."));
-			return RET_ERROR;
+			if(items[i].level0 == 1)
+				level = items[i].duration0;
+			else if(items[i].level1 == 1)
+				level = items[i].duration1;
 		}
 
-		// Print samples
-		// for (size_t i = 0; i < WATER_LEVEL_MEASUREMENTS_COUNT; i++)
-		// {
-			// TODO: Temp
-			// Log::log(Log::WATER_LEVEL_RAW_READING, samples[i]);
+		vRingbufferReturnItem(_pwm_ringbuf, items);
 
-			// debug_print(samples[i]);
-			// debug_print(", ");
-		// }
-		debug_println();
+		debug_print(F("Level: "));
+		debug_println(level, DEC);
+
+		// 0 when no complete pulse in frame
+		// Sensor returns max range when no target detected within rage
+		// Since PWM has an offset take into account a small tolerance
+		if(level == 0 || level >= (WATER_LEVEL_MAX_RANGE_MM - WATER_LEVEL_PWM_MAX_VAL_TOL))
+		{
+			debug_println_e(F("Invalid value, ignoring."));
+			return false;
+		}
 
-		// Pre-filtered values avg
-		avg /= WATER_LEVEL_MEASUREMENTS_COUNT;
+		*out = level;
+		return true;
+	}
 
-		// Calc standard deviation
-		float std_dev = 0;
-		for(int i=0; i<WATER_LEVEL_MEASUREMENTS_COUNT; i++)
+	/******************************************************************************
+	 * Sample analog channel, set last error from its sampling status
+	 * @param mv Calibrated mV
+	 *****************************************************************************/
+	RetResult read_analog_mv(int *mv)
+	{
+		AdcManager::Reading reading;
+
+		AdcManager::sample(1 << AdcManager::CHANNEL_WATER_LEVEL);
+		AdcManager::read(AdcManager::CHANNEL_WATER_LEVEL, &reading);
+
+		_last_result = reading.stats;
+		Sampling::print(&_last_result);
+
+		if(reading.ret != RET_OK)
 		{
-			std_dev += pow((float)samples[i] - avg, 2);
+			set_last_error(_last_result.status == Sampling::STATUS_TOO_MANY_INVALID ?
+				ErrorCode::ERROR_TOO_MANY_INVALID_VALUES : ErrorCode::ERROR_HIGH_VAL_FLUCTUATION);
+			debug_println_e(F("Could not sample analog channel."));
+			return RET_ERROR;
 		}
-		std_dev /= WATER_LEVEL_MEASUREMENTS_COUNT;
-		std_dev = sqrt(std_dev);
 
-		// Mark outliers by setting them to -1
-		debug_print(F("Std dev: "));
-		debug_println(std_dev, DEC);
+		*mv = reading.mv;
+		return RET_OK;
+	}
+
+	/******************************************************************************
+	 * Read a DFRobot ultrasonic serial packet, level in mm
+	 * @param ctx Serial port
+	 *****************************************************************************/
+	bool read_dfrobot_serial_sample(void *ctx, float *out)
+	{
+		HardwareSerial *us_serial = (HardwareSerial*)ctx;
+		char buff[10] = "";
+
+		int read_bytes = us_serial->readBytes(buff, 8);
+
+		// Not enough bytes read, skip
+		if(read_bytes < 4)
+			return false;
 
-		debug_print(F("Filtering outliers: "));
-		for(int i=0; i<WATER_LEVEL_MEASUREMENTS_COUNT; i++)
+		// Find packet start
+		char *packet = nullptr;
+		for (size_t i = 0; i < 4; i++)
 		{
-			if(samples[i] < (avg - std_dev) || samples[i] > (avg + std_dev))
+			if(buff[i] == 0xFF)
 			{
-				debug_print_i(samples[i], DEC);
-				debug_print(F(" "));
+				packet = (char*)&buff[i];
 
-				// Filter outlier
-				samples[i] = -1;
+				break;
 			}
 		}
-		debug_print(F(" "));
 
-		// Calculate avg for valid values
-		float level = 0;
-		int valid_val_count = 0;
-		for(int i=0; i<WATER_LEVEL_MEASUREMENTS_COUNT; i++)
+		if(packet == nullptr)
 		{
-			if(samples[i] != -1)
-			{
-				valid_val_count++;
-				level += samples[i];
-			}
+			debug_println_i(F("Packet start not found, skipping"));
+			return false;
+		}
+		
+		uint8_t checksum = calc_dfrobot_checksum(packet);
+		if(checksum != packet[3])
+		{
+			debug_print_e(F("Calculated checksum invalid: "));
+			debug_println(checksum, HEX);
+			return false;
+		}
+
+		uint16_t level = (packet[1] << 8) | packet[2];
+
+		debug_print(F("Current measurement: "));
+		debug_println(level, DEC);
+
+		*out = level;
+		return true;
+	}
+
+	/******************************************************************************
+	 * Read a MaxBotix ultrasonic serial reading ("R<level>\r")
+	 * @param ctx Serial port
+	 *****************************************************************************/
+	bool read_maxbotix_serial_sample(void *ctx, float *out)
+	{
+		HardwareSerial *us_serial = (HardwareSerial*)ctx;
+		char buff[10] = "";
+		int level = 0;
+
+		us_serial->readBytes(buff, 5);
+
+		if(sscanf(buff, "R%d\r", &level) != 1)
+		{
+			debug_println_w(F("Level sensor returned invalid data."));
+			return false;
 		}
 
-		if(valid_val_count < WATER_LEVEL_MIN_VALID_MEASUREMENTS)
+		*out = level;
+		return true;
+	}
+
+	/******************************************************************************
+	 * Read water level sensor and populate SensorData entry structure
+	 * Use sensors PWM channel
+	 *****************************************************************************/
+	RetResult measure_maxbotix_pwm(WaterSensorData::Entry *data)
+	{
+		debug_println(F("Measuring water level (PWM)"));
+		set_last_error(ERROR_NONE);
+
+        // Return dummy values switch
+        if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
+        {
+            return measure_dummy(data);
+        }
+
+		// Pulses are captured by the RMT receiver in the background while sampling
+		if(start_pwm_capture() != RET_OK)
 		{
-			set_last_error(ErrorCode::ERROR_HIGH_VAL_FLUCTUATION);
-			debug_println_e(F("Too few valid values after filtering."));
+			set_last_error(ErrorCode::ERROR_OTHER);
 			return RET_ERROR;
 		}
 
-		// Calc average
-		level /= valid_val_count;
+		Sampling::Plan plan = make_plan(WATER_LEVEL_CONVERGED_TOLERANCE_MM);
+		RetResult ret = sample(&plan, read_pwm_sample, NULL);
+
+		stop_pwm_capture();
+
+		if(ret != RET_OK)
+			return RET_ERROR;
 
 		// Convert mm to cm
-		data->water_level = (float)level / 10;
+		data->water_level = _last_result.value / 10;
 
 		return RET_OK;
 	}
@@ -216,6 +380,7 @@ namespace WaterLevel
 	RetResult measure_maxbotix_analog(WaterSensorData::Entry *data)
     {
 		debug_println(F("Measuring water level (analog)"));
+		set_last_error(ERROR_NONE);
 
         // Return dummy values switch
         if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
@@ -223,19 +388,9 @@ namespace WaterLevel
             return measure_dummy(data);
         }
 
-		// TODO: Refactor to use Utils::read_adc_mv
-
-		// X measurements, calc average
-		int level_raw = 0;
-		for(int i = 0; i < WATER_LEVEL_MEASUREMENTS_COUNT; i++)
-		{
-			level_raw += analogRead(PIN_WATER_LEVEL_ANALOG);
-			delay(WATER_LEVEL_DELAY_BETWEEN_MEAS_MS);
-		}
-		level_raw /= WATER_LEVEL_MEASUREMENTS_COUNT;
-
-		// Convert to mV
-		int mv = ((float)3600 / 4096) * level_raw;
+		int mv = 0;
+		if(read_analog_mv(&mv) != RET_OK)
+			return RET_ERROR;
 
 		// Convert to CM
 		int cm = (mv / WATER_LEVEL_MV_PER_MM) * 10;
@@ -251,6 +406,7 @@ namespace WaterLevel
 	RetResult measure_dfrobot_pressure_analog(WaterSensorData::Entry *data)
 	{
         debug_println(F("Measuring water level (DFRobot pressure analog)"));
+		set_last_error(ERROR_NONE);
 
         // Return dummy values switch
         if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
@@ -258,17 +414,9 @@ namespace WaterLevel
             return measure_dummy(data);
         }
 
-		// X measurements, calc average
-		int level_raw = 0;
-		for(int i = 0; i < WATER_LEVEL_MEASUREMENTS_COUNT; i++)
-		{
-			level_raw += analogRead(PIN_WATER_LEVEL_ANALOG);
-			delay(WATER_LEVEL_DELAY_BETWEEN_MEAS_MS);
-		}
-		level_raw /= WATER_LEVEL_MEASUREMENTS_COUNT;
-
-		// Convert to mV
-		int mv = ((float)3600 / 4096) * level_raw;
+		int mv = 0;
+		if(read_analog_mv(&mv) != RET_OK)
+			return RET_ERROR;
 
 		data->water_level = mv;
 
@@ -284,6 +432,7 @@ namespace WaterLevel
 	RetResult measure_dfrobot_ultrasonic_serial(WaterSensorData::Entry *data)
 	{
         debug_println(F("Measuring water level (DFRobot ultrasonic serial)"));
+		set_last_error(ERROR_NONE);
 
         // Return dummy values switch
         if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
@@ -291,87 +440,27 @@ namespace WaterLevel
             return measure_dummy(data);
         }
 
-		float level_avg = 0;
-
 		HardwareSerial us_serial(1);
 		us_serial.begin(9600, SERIAL_8N1, PIN_WATER_LEVEL_SERIAL_RX, 0);
 		us_serial.flush();
 
-		uint32_t start_ms = millis();
-		int valid_packets = 0;
-
-		while(millis() - start_ms < WATER_LEVEL_US_TIMEOUT_MS && valid_packets < WATER_LEVEL_MEASUREMENTS_COUNT)
-		{
-			char buff[10] = "";
-
-			int read_bytes = us_serial.readBytes(buff, 8);
-
-			// Not enough bytes read, skip
-			if(read_bytes < 4)
-			{
-				continue;
-			}
-
-			// debug_println_i(F("Read bytes: "));
-
-			// for (size_t i = 0; i < read_bytes; i++)
-			// {
-			// 	Serial.printf("%02x ", buff[i]);
-			// }
-
-			// Find packet start
-			char *packet = nullptr;
-			for (size_t i = 0; i < 4; i++)
-			{
-				if(buff[i] == 0xFF)
-				{
-					packet = (char*)&buff[i];
-
-					break;
-				}
-			}
-
-			if(packet == nullptr)
-			{
-				debug_println_i(F("Packet start not found, skipping"));
-				continue;
-			}
-			
-			uint8_t checksum = calc_dfrobot_checksum(packet);
-			if(checksum != packet[3])
-			{
-				debug_print_e(F("Calculated checksum invalid: "));
-				debug_println(checksum, HEX);
-				continue;
-			}
-
-			uint16_t level = (packet[1] << 8) | packet[2];
-			level_avg += level;
-
-			debug_print(F("Current measurement: "));
-			debug_println(level, DEC);
-
-			valid_packets++;
-
-			Serial.println("\n---");
-		}
+		Sampling::Plan plan = make_plan(WATER_LEVEL_CONVERGED_TOLERANCE_MM);
+		RetResult ret = sample(&plan, read_dfrobot_serial_sample, &us_serial);
 
 		us_serial.end();
 
-		if(valid_packets < WATER_LEVEL_MEASUREMENTS_COUNT)
+		if(ret != RET_OK)
 		{
 			debug_print_e(F("Could not read enough valid values from sensor: "));
-			debug_println(valid_packets);
+			debug_println(_last_result.samples);
 			return RET_ERROR;
 		}
 
-		level_avg /= valid_packets;
-		
 		// Convert to cm
-		data->water_level = level_avg / 10;
+		data->water_level = _last_result.value / 10;
 
-		Serial.print(F("Measured level: "));
-		Serial.println(level_avg, DEC);
+		debug_print(F("Measured level: "));
+		debug_println(_last_result.value, DEC);
 
 		return RET_OK;	
 	}
@@ -382,8 +471,7 @@ namespace WaterLevel
 	RetResult measure_maxbotix_serial(WaterSensorData::Entry *data)
 	{
         debug_println(F("Measuring water level (MaxBotix ultrasonic serial)"));
-
-		const int MEASUREMENTS = 10;
+		set_last_error(ERROR_NONE);
 
         // Return dummy values switch
         if(FLAGS.MEASURE_DUMMY_WATER_LEVEL)
@@ -391,36 +479,21 @@ namespace WaterLevel
             return measure_dummy(data);
         }
 
-		int level_avg = 0;
-
 		HardwareSerial us_serial(1);
 		us_serial.begin(9600, SERIAL_8N1, PIN_WATER_LEVEL_SERIAL_RX, 0, true);
 
-		for (int i = 0; i < MEASUREMENTS; i++)
-		{
-			char buff[10] = "";
-			us_serial.readBytes(buff, 5);
-			int level = 0;
-
-			int read = sscanf(buff, "R%d\r", &level);	
-
-			if (read != 1)
-			{
-				Serial.println(F("Level sensor returned invalid data."));
-				continue;
-			}
-
-			level_avg += level;
-		}
+		Sampling::Plan plan = make_plan(WATER_LEVEL_CONVERGED_TOLERANCE_MM);
+		RetResult ret = sample(&plan, read_maxbotix_serial_sample, &us_serial);
 
 		us_serial.end();
 
-		level_avg /= MEASUREMENTS;
+		if(ret != RET_OK)
+			return RET_ERROR;
 
-		Serial.print(F("LEVEL: "));
-		Serial.println(level_avg, DEC);
+		debug_print(F("LEVEL: "));
+		debug_println(_last_result.value, DEC);
 
-		data->water_level = level_avg;
+		data->water_level = (int)_last_result.value;
 
 		return RET_OK;
 	}
@@ -459,6 +532,14 @@ namespace WaterLevel
 		return _last_error;	
 	}
 
+	/******************************************************************************
+	 * Get value and quality metrics of last measurement
+	 *****************************************************************************/
+	const Sampling::Result* get_last_result()
+	{
+		return &_last_result;
+	}
+
 	/******************************************************************************
 	* Set last error
 	******************************************************************************/
@@ -6,9 +6,22 @@
 #include "common.h"
 #include "log.h"
 #include "log_codes.h"
+#include "rtc.h"
+#include <esp_sleep.h>
+#include <driver/gpio.h>
 
 namespace WaterPresence
 {
+	//
+	// Private vars
+	//
+
+	/** Level the wake up was armed against, -1 if not armed */
+	int8_t _level = -1;
+
+	/** Timestamp of last expedited uplink */
+	uint32_t _last_uplink_tstamp = 0;
+
 	//
 	// Private functions
 	//
@@ -19,6 +32,8 @@ namespace WaterPresence
 	RetResult init()
 	{
         pinMode(PIN_WATER_PRESENCE, INPUT);
+
+        return RET_OK;
 	}
 
 	/******************************************************************************
@@ -28,7 +43,98 @@ namespace WaterPresence
 	RetResult measure(WaterSensorData::Entry *data)
 	{
         data->presence = digitalRead(PIN_WATER_PRESENCE);
+        data->present |= WaterSensorData::PRESENT_PRESENCE;
 
         return RET_OK;
 	}
+
+	/******************************************************************************
+	 * Wake up on the next presence change. Wake ups are level triggered, so the
+	 * opposite of the current level is armed. Called before every sleep
+	 * Light sleep uses GPIO wake up (ext0 is taken by the lightning sensor), deep
+	 * sleep uses ext0 (ext1 is taken by the ext RTC alarm)
+	 * @param deep_sleep Arm for deep sleep
+	 *****************************************************************************/
+	void arm_wakeup(bool deep_sleep)
+	{
+		if(!FLAGS.WATER_PRESENCE_SENSOR_ENABLED || !WATER_PRESENCE_EDGE_WAKEUP)
+			return;
+
+		_level = digitalRead(PIN_WATER_PRESENCE);
+
+		if(deep_sleep)
+		{
+			esp_sleep_enable_ext0_wakeup((gpio_num_t)PIN_WATER_PRESENCE, !_level);
+		}
+		else
+		{
+			gpio_wakeup_enable((gpio_num_t)PIN_WATER_PRESENCE, _level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+			esp_sleep_enable_gpio_wakeup();
+		}
+	}
+
+	/******************************************************************************
+	 * Check if presence changed since wake up was armed
+	 *****************************************************************************/
+	bool level_changed()
+	{
+		return _level >= 0 && digitalRead(PIN_WATER_PRESENCE) != _level;
+	}
+
+	/******************************************************************************
+	 * Handle wake up. If presence changed, logs the new level right away and
+	 * disarms the wake up until next sleep
+	 * @return True if presence changed
+	 *****************************************************************************/
+	bool check_edge()
+	{
+		if(!level_changed())
+			return false;
+
+		gpio_wakeup_disable((gpio_num_t)PIN_WATER_PRESENCE);
+
+		_level = !_level;
+
+		debug_printf("Water presence changed: %d\n", _level);
+		Log::log(Log::WATER_PRESENCE_CHANGED, _level);
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * Check if a presence change should be uplinked now. Expedited uplinks are
+	 * rate limited, later changes wait for the scheduled call home
+	 *****************************************************************************/
+	bool uplink_due()
+	{
+		if(!WATER_PRESENCE_EXPEDITED_UPLINK)
+			return false;
+
+		uint32_t t_now = RTC::get_timestamp();
+
+		if(_last_uplink_tstamp != 0 && t_now - _last_uplink_tstamp < WATER_PRESENCE_UPLINK_MIN_INTERVAL_SECS)
+			return false;
+
+		_last_uplink_tstamp = t_now;
+
+		return true;
+	}
+
+	/******************************************************************************
+	 * Save state before deep sleep
+	 *****************************************************************************/
+	void save_state(RetainedState *state)
+	{
+		state->level = _level;
+		state->last_uplink_tstamp = _last_uplink_tstamp;
+	}
+
+	/******************************************************************************
+	 * Restore state after waking up from deep sleep
+	 *****************************************************************************/
+	void restore_state(const RetainedState *state)
+	{
+		_level = state->level;
+		_last_uplink_tstamp = state->last_uplink_tstamp;
+	}
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
+#include <stddef.h>
 #include "water_sensor_data.h"
 #include "CRC32.h"
 #include "utils.h"
 #include "common.h"
+#include "deadband.h"
+#include "retention.h"
 
 namespace WaterSensorData
 {
@@ -11,7 +14,8 @@ namespace WaterSensorData
 	 * This way if a request succeeds, a whole file can be deleted, if not the file remains
 	 * to be resent at a later time
 	 */
-    DataStore<WaterSensorData::Entry> store(WATER_SENSOR_DATA_PATH, WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ);
+    DataStore<WaterSensorData::Entry> store(WATER_SENSOR_DATA_PATH, WATER_SENSOR_DATA_ENTRIES_PER_SUBMIT_REQ,
+		Retention::on_evict<WaterSensorData::Entry, SENSOR_STORE_WATER_SENSORS>);
 
     /******************************************************************************
     * Add water sensor data to storage
@@ -19,6 +23,10 @@ namespace WaterSensorData
     ******************************************************************************/
     RetResult add(WaterSensorData::Entry *data)
     {
+		// Unchanged within deadbands, left out
+		if(!Deadband::should_store(SENSOR_STORE_WATER_SENSORS, data))
+			return RET_OK;
+
 		RetResult ret = store.add(data);
 
 		// Commit on every add
@@ -27,6 +35,30 @@ namespace WaterSensorData
         return ret;
     }   
 
+    /******************************************************************************
+    * Get presence bit of an Entry field
+    * @param offset Field offset in Entry
+    * @return 0 if not a measured field
+    ******************************************************************************/
+    uint16_t present_bit(int offset)
+    {
+		switch(offset)
+		{
+			case offsetof(Entry, temperature): return PRESENT_TEMPERATURE;
+			case offsetof(Entry, dissolved_oxygen): return PRESENT_DISSOLVED_OXYGEN;
+			case offsetof(Entry, conductivity): return PRESENT_CONDUCTIVITY;
+			case offsetof(Entry, ph): return PRESENT_PH;
+			case offsetof(Entry, orp): return PRESENT_ORP;
+			case offsetof(Entry, pressure): return PRESENT_PRESSURE;
+			case offsetof(Entry, depth_cm): return PRESENT_DEPTH_CM;
+			case offsetof(Entry, depth_ft): return PRESENT_DEPTH_FT;
+			case offsetof(Entry, tss): return PRESENT_TSS;
+			case offsetof(Entry, presence): return PRESENT_PRESENCE;
+			case offsetof(Entry, water_level): return PRESENT_WATER_LEVEL;
+			default: return 0;
+		}
+    }
+
     /******************************************************************************
     * Get pointer to store (for use with reader)
     ******************************************************************************/
@@ -73,6 +105,9 @@ namespace WaterSensorData
 
 		debug_print(F("Water Presence: "));
 		debug_println(data->presence);
+
+		debug_print(F("Present fields: "));
+		debug_println(data->present, HEX);
 	}
 
 	/******************************************************************************
@@ -132,7 +167,7 @@ namespace WaterSensorData
 		debug_print_i(F("Printing file: "));
 		debug_println(name);
 
-		File f = SPIFFS.open(name, "r");
+		File f = STORAGE_FS.open(name, "r");
 		if(!f)
 		{
 			debug_println_e(F("Could not open file for reading."));
@@ -6,84 +6,66 @@
 #include "utils.h"
 #include "log.h"
 #include "common.h"
-#include "driver/rtc_io.h"
+#include "energy_profiler.h"
+#include "adaptive_sampling.h"
+#include "acquisition.h"
+#include "power_control.h"
 
 namespace WaterSensors
 {
+	//
+	// Private functions
+	//
+	RetResult log_quality(void *ctx);
+	RetResult log_level(void *ctx);
+
 	/******************************************************************************
 	 * Init
 	 *****************************************************************************/
 	RetResult init()
 	{
-		// Make sure sensors are off
-		off();
-
-		// Setup RTC GPIO
-		esp_sleep_pd_config(esp_sleep_pd_domain_t::ESP_PD_DOMAIN_RTC_PERIPH, esp_sleep_pd_option_t::ESP_PD_OPTION_ON);
-		rtc_gpio_pulldown_en(PIN_WATER_SENSORS_PWR);
-		rtc_gpio_set_direction(PIN_WATER_SENSORS_PWR, rtc_gpio_mode_t::RTC_GPIO_MODE_OUTPUT_ONLY);
-
-		return RET_OK;
+		// Make sure sensors are off, rail pins set up as RTC GPIO
+		return PowerControl::init();
 	}
 
 	/******************************************************************************
 	 * Turn water sensors ON
-	 * Both water sensors' power is controlled from the same GPIO
+	 * Both water sensors are powered from the sensor rail (see PowerControl)
 	 *****************************************************************************/
 	RetResult on()
 	{
 		debug_println(F("Water sensors ON."));
 
-		#ifdef TCALL_H
-			// Turn IP5306 power boost OFF to reduce idle current
-			Utils::ip5306_set_power_boost_state(true);
-		#endif
-
-		// TODO: Power on/off mgmt should be moved to Power::switch
-		pinMode(PIN_WATER_SENSORS_PWR, OUTPUT);
-		digitalWrite(PIN_WATER_SENSORS_PWR, 1);
-		delay(WATER_SENSORS_POWER_ON_DELAY_MS);
-
-		delay(200);
+		if(PowerControl::acquire(PowerControl::DEVICE_AQUATROLL) != RET_OK)
+			return RET_ERROR;
 
-        return RET_OK;
+		return PowerControl::acquire(PowerControl::DEVICE_WATER_LEVEL);
 	}
 
 	/******************************************************************************
-	 * Turn water sensors OFF
+	 * Turn water sensors OFF, rail stays on if other devices hold it
 	 *****************************************************************************/
 	RetResult off()
 	{
 		debug_println(F("Water sensors OFF."));
 
-		// TODO: Power on/off mgmt should be moved to Power::switch
-
-		pinMode(PIN_WATER_SENSORS_PWR, OUTPUT);
-		digitalWrite(PIN_WATER_SENSORS_PWR, 0);
-
-		// Set to input instead of driving low to prevent LED on TSIM from turning ON
-		// pinMode(PIN_WATER_SENSORS_PWR, INPUT);
-
-		rtc_gpio_set_level(PIN_WATER_SENSORS_PWR, 0);
-		delay(100);
-
-		#ifdef TCALL_H
-			// Turn IP5306 power boost OFF to reduce idle current
-			Utils::ip5306_set_power_boost_state(false);
-		#endif
+		PowerControl::release(PowerControl::DEVICE_WATER_LEVEL);
+		PowerControl::release(PowerControl::DEVICE_AQUATROLL);
 
         return RET_OK;
 	}
 
 	/******************************************************************************
-	* Read all water sensors and log their data in memory
+	* Read all water sensors and log their data in memory. Water quality (SDI12)
+	* and water level are measured concurrently (see Acquisition)
 	* @return RET_ERROR only if failed to read BOTH sensors
 	******************************************************************************/
 	RetResult log()
 	{
 		WaterSensorData::Entry data = {0};
-		int tries = 3;
-		RetResult ret_quality = RET_ERROR, ret_level;
+		// Water quality measurement zeroes its entry, level is measured into its own
+		WaterSensorData::Entry level_data = {0};
+		RetResult ret_quality = RET_ERROR, ret_level = RET_ERROR;
 
 		if(!FLAGS.WATER_QUALITY_SENSOR_ENABLED & !FLAGS.WATER_LEVEL_SENSOR_ENABLED)
 		{
@@ -91,97 +73,34 @@ namespace WaterSensors
 			return RET_ERROR;
 		}
 
-		WaterSensors::on();
+		Acquisition::Job jobs[2];
+		int job_count = 0;
 
 		if(FLAGS.WATER_QUALITY_SENSOR_ENABLED)
-		{
-			Log::log(Log::WATER_SENSORS_MEASUREMENT_LOG);
+			jobs[job_count++] = {"water quality", Acquisition::BUS_SDI12, log_quality, &data, RET_ERROR};
 
-			//
-			// Read water quality sensor
-			// Try reading X times. If fails, cycle power and try once more.
-			WaterSensors::on();
-
-			do
-			{
-				ret_quality = Aquatroll::measure(&data);
+		if(FLAGS.WATER_LEVEL_SENSOR_ENABLED)
+			jobs[job_count++] = {"water level", Acquisition::BUS_WATER_LEVEL, log_level, &level_data, RET_ERROR};
 
-				if(ret_quality != RET_OK)
-				{
-					Utils::serial_style(STYLE_RED);
-					debug_print(F("Failed to read water quality sensor."));
-					Utils::serial_style(STYLE_RESET);
-
-					if(tries > 1)
-					{
-						debug_print(F("Retrying..."));
-						delay(WATER_QUALITY_RETRY_WAIT_MS);
-					}
-					debug_println();
-
-					// Next try is last, cycle power
-					if(tries == 2)
-					{
-						debug_println(F("Cycling sensor power."));	
-						WaterSensors::off();
-						WaterSensors::on();
-					}
-				}
-				else
-					break;
+		// Rail held over both jobs, each job holds its own device as well
+		WaterSensors::on();
 
-			}while(--tries);
+		Acquisition::run(jobs, job_count);
 
-			// Log possible error
-			if(ret_quality == RET_ERROR)
-			{
-				Log::log(Log::WATER_QUALITY_MEASUREMENT_FAILED);
-			}
+		for(int i = 0; i < job_count; i++)
+		{
+			if(jobs[i].run == log_quality)
+				ret_quality = jobs[i].result;
+			else
+				ret_level = jobs[i].result;
 		}
 
-		//
-		// Read water level
-		//
-		tries = 3;
-		if(FLAGS.WATER_LEVEL_SENSOR_ENABLED)
-		{
-			do
-			{
-				ret_level = WaterLevel::measure(&data);
+		// Failed measurements may have left fields set, not sent
+		if(ret_quality != RET_OK)
+			data.present = 0;
 
-				if(ret_level != RET_OK)
-				{
-					debug_print_e(F("Failed to read water level sensor."));
-
-					Log::log(Log::WATER_LEVEL_MEASURE_FAILED, WaterLevel::get_last_error());
-
-					if(tries > 1)
-					{
-						debug_print(F("Retrying..."));
-						delay(WATER_LEVEL_RETRY_WAIT_MS);
-					}
-					debug_println();
-
-					// Next try is last, cycle power
-					if(tries == 2)
-					{
-						debug_println(F("Cycling sensor power."));	
-						WaterSensors::off();
-						WaterSensors::on();
-					}
-				}
-				else
-				{
-					break;
-				}
-			}while(--tries);
-		
-			// Log possible error
-			// if(ret_level != RET_OK)
-			// {
-			// 	Log::log(Log::WATER_LEVEL_MEASURE_FAILED);
-			// }
-		}
+		data.water_level = level_data.water_level;
+		data.present |= level_data.present & WaterSensorData::PRESENT_WATER_LEVEL;
 
 		//
 		// Read water presence sensor
@@ -211,6 +130,116 @@ namespace WaterSensors
 		WaterSensorData::add(&data);
 		WaterSensorData::get_store()->commit();
 
+		// Decide next interval
+		AdaptiveSampling::update(&data);
+
 		return RET_OK;
 	}
+
+	/******************************************************************************
+	* Measure water quality sensor, measurement job of log()
+	* Try reading X times, backing off between tries. Sensor not ready yet after
+	* power up is polled without counting a try. If fails, cycle power and try
+	* once more.
+	* @param ctx WaterSensorData::Entry to measure into
+	******************************************************************************/
+	RetResult log_quality(void *ctx)
+	{
+		WaterSensorData::Entry *data = (WaterSensorData::Entry*)ctx;
+		RetResult ret_quality = RET_ERROR;
+		int tries = 3;
+		uint32_t retry_wait_ms = WATER_QUALITY_RETRY_WAIT_MS;
+
+		PowerControl::acquire(PowerControl::DEVICE_AQUATROLL);
+
+		Log::log(Log::WATER_SENSORS_MEASUREMENT_LOG);
+
+		do
+		{
+			while((ret_quality = Aquatroll::measure(data)) != RET_OK &&
+				PowerControl::retry_warming_up(PowerControl::DEVICE_AQUATROLL));
+
+			if(ret_quality != RET_OK)
+			{
+				Utils::serial_style(STYLE_RED);
+				debug_print(F("Failed to read water quality sensor."));
+				Utils::serial_style(STYLE_RESET);
+
+				if(tries > 1)
+				{
+					debug_print(F("Retrying..."));
+					delay(retry_wait_ms);
+					retry_wait_ms *= 2;
+				}
+				debug_println();
+
+				// Next try is last, cycle power. Not if rail is shared with other devices
+				if(tries == 2)
+					PowerControl::power_cycle(PowerControl::DEVICE_AQUATROLL);
+			}
+			else
+				break;
+
+		}while(--tries);
+
+		PowerControl::release(PowerControl::DEVICE_AQUATROLL);
+
+		// Log possible error
+		if(ret_quality == RET_ERROR)
+		{
+			Log::log(Log::WATER_QUALITY_MEASUREMENT_FAILED);
+		}
+
+		return ret_quality;
+	}
+
+	/******************************************************************************
+	* Measure water level sensor, measurement job of log(). Retried like water
+	* quality (see log_quality())
+	* @param ctx WaterSensorData::Entry to measure into
+	******************************************************************************/
+	RetResult log_level(void *ctx)
+	{
+		WaterSensorData::Entry *data = (WaterSensorData::Entry*)ctx;
+		RetResult ret_level = RET_ERROR;
+		int tries = 3;
+		uint32_t retry_wait_ms = WATER_LEVEL_RETRY_WAIT_MS;
+
+		PowerControl::acquire(PowerControl::DEVICE_WATER_LEVEL);
+
+		do
+		{
+			while((ret_level = WaterLevel::measure(data)) != RET_OK &&
+				PowerControl::retry_warming_up(PowerControl::DEVICE_WATER_LEVEL));
+
+			if(ret_level != RET_OK)
+			{
+				debug_print_e(F("Failed to read water level sensor."));
+
+				Log::log(Log::WATER_LEVEL_MEASURE_FAILED, WaterLevel::get_last_error());
+
+				if(tries > 1)
+				{
+					debug_print(F("Retrying..."));
+					delay(retry_wait_ms);
+					retry_wait_ms *= 2;
+				}
+				debug_println();
+
+				// Next try is last, cycle power. Not if rail is shared with other devices
+				if(tries == 2)
+					PowerControl::power_cycle(PowerControl::DEVICE_WATER_LEVEL);
+			}
+			else
+			{
+				// No response to take warm-up from
+				PowerControl::ready(PowerControl::DEVICE_WATER_LEVEL);
+				break;
+			}
+		}while(--tries);
+
+		PowerControl::release(PowerControl::DEVICE_WATER_LEVEL);
+
+		return ret_level;
+	}
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "wifi_modem.h"
 #include "const.h"
 #include "common.h"
+#include "utils.h"
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <wifi_modem.h>
@@ -13,9 +14,38 @@
 ******************************************************************************/
 namespace WifiModem
 {
+	//
+	// Private functions
+	//
+	bool wait_connected(uint32_t timeout_ms);
+	bool cache_valid();
+	void update_cache();
+	void apply_static_config();
+
+	//
+	// Private types
+	//
+	/**
+	 * AP and IP config of last connection. RTC_NOINIT memory survives deep sleep
+	 * and resets (but not power loss) so reconnect skips the scan and DHCP
+	 */
+	struct FastConnectCache
+	{
+		uint32_t magic;
+		uint8_t bssid[6];
+		int32_t channel;
+		uint32_t ip;
+		uint32_t gateway;
+		uint32_t subnet;
+		uint32_t dns;
+		uint32_t crc32;
+	}__attribute__((packed));
+
 	//
 	// Private vars
 	// 
+	RTC_NOINIT_ATTR FastConnectCache _cache;
+
 	/******************************************************************************
 	* Init
 	******************************************************************************/
@@ -24,9 +54,11 @@ namespace WifiModem
 	}
 
 	/******************************************************************************
-	* Connect to network
+	* Connect to network. Reconnects to the AP of the last connection with its IP
+	* config first, falls back to a full scan (and DHCP) if that fails
+	* @param timeout_ms Timeout of the full scan connect
 	******************************************************************************/
-	RetResult connect()
+	RetResult connect(uint32_t timeout_ms)
 	{
 		Serial.print(F("Connecting to WiFi network: "));
 		Serial.print(WIFI_SSID);
@@ -39,14 +71,35 @@ namespace WifiModem
 			return RET_OK;
 		}
 
-		WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-		
-		int connect_timeout_sec = WIFI_CONNECT_TIMEOUT_SEC;
-		while(WiFi.status() != WL_CONNECTED && connect_timeout_sec--)
+		WiFi.mode(WIFI_STA);
+
+		if(cache_valid())
 		{
-			delay(1000);
-			Serial.print(".");
+			WiFi.config(IPAddress(_cache.ip), IPAddress(_cache.gateway), IPAddress(_cache.subnet), IPAddress(_cache.dns));
+			WiFi.begin(WIFI_SSID, WIFI_PASSWORD, _cache.channel, _cache.bssid);
+
+			if(wait_connected(WIFI_FAST_CONNECT_TIMEOUT_MS))
+			{
+				Serial.println();
+				Serial.println(F("WiFi connected (fast)!"));
+				return RET_OK;
+			}
+
+			debug_println();
+			debug_println_w(F("Fast reconnect failed, scanning."));
+
+			// AP or lease changed
+			_cache.magic = 0;
+			WiFi.disconnect();
 		}
+
+		// DHCP unless static IP configured
+		WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+		apply_static_config();
+
+		WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+
+		wait_connected(timeout_ms);
 		Serial.println();
 
 		if(WiFi.status() != WL_CONNECTED)
@@ -64,15 +117,23 @@ namespace WifiModem
 
 		Serial.println(F("WiFi connected!"));
 
+		update_cache();
+
 		return RET_OK;
 	}
 
 	/******************************************************************************
-	* Disconnect from network
+	* Disconnect from network. Radio is turned off unless the debug console
+	* needs it
 	******************************************************************************/
 	RetResult disconnect()
 	{
-		WiFi.disconnect();
+		#if WIFI_DEBUG_CONSOLE
+			WiFi.disconnect();
+		#else
+			WiFi.disconnect(true);
+			WiFi.mode(WIFI_OFF);
+		#endif
 
 		return RET_OK;
 	}
@@ -85,5 +146,74 @@ namespace WifiModem
 	{
 		return WiFi.isConnected();
 	}
-}
 
+	/******************************************************************************
+	* Wait until connected
+	* @return True when connected within timeout
+	******************************************************************************/
+	bool wait_connected(uint32_t timeout_ms)
+	{
+		uint32_t start_ms = millis();
+		uint32_t last_dot_ms = start_ms;
+
+		while(WiFi.status() != WL_CONNECTED && millis() - start_ms < timeout_ms)
+		{
+			delay(WIFI_CONNECT_POLL_MS);
+
+			if(millis() - last_dot_ms >= 1000)
+			{
+				last_dot_ms = millis();
+				Serial.print(".");
+			}
+		}
+
+		return WiFi.status() == WL_CONNECTED;
+	}
+
+	/******************************************************************************
+	* Fast reconnect cache holds a previous connection
+	******************************************************************************/
+	bool cache_valid()
+	{
+		return _cache.magic == WIFI_FAST_CONNECT_MAGIC &&
+			Utils::crc32((uint8_t*)&_cache, sizeof(_cache) - sizeof(_cache.crc32)) == _cache.crc32;
+	}
+
+	/******************************************************************************
+	* Keep AP and IP config of current connection for next reconnect
+	******************************************************************************/
+	void update_cache()
+	{
+		const uint8_t *bssid = WiFi.BSSID();
+		if(bssid == NULL)
+			return;
+
+		memcpy(_cache.bssid, bssid, sizeof(_cache.bssid));
+		_cache.channel = WiFi.channel();
+		_cache.ip = (uint32_t)WiFi.localIP();
+		_cache.gateway = (uint32_t)WiFi.gatewayIP();
+		_cache.subnet = (uint32_t)WiFi.subnetMask();
+		_cache.dns = (uint32_t)WiFi.dnsIP();
+		_cache.magic = WIFI_FAST_CONNECT_MAGIC;
+		_cache.crc32 = Utils::crc32((uint8_t*)&_cache, sizeof(_cache) - sizeof(_cache.crc32));
+	}
+
+	/******************************************************************************
+	* Set static IP config, if configured (WIFI_STATIC_IP)
+	******************************************************************************/
+	void apply_static_config()
+	{
+		IPAddress ip, gateway, subnet, dns;
+
+		if(!ip.fromString(WIFI_STATIC_IP))
+			return;
+
+		gateway.fromString(WIFI_STATIC_GATEWAY);
+		subnet.fromString(WIFI_STATIC_SUBNET);
+
+		if(!dns.fromString(WIFI_STATIC_DNS))
+			dns = gateway;
+
+		WiFi.config(ip, gateway, subnet, dns);
+	}
+}
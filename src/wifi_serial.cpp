@@ -4,6 +4,7 @@
 #include "const.h"
 
 #include "wifi_modem.h"
+#include "memory_monitor.h"
 #include "common.h"
 
 #if WIFI_DEBUG_CONSOLE
@@ -14,6 +15,11 @@
 * When Wifi logging is enabled, all debug_print messages are forwarded to 
 * WifiSerial as well. Using debug_print messages in this class will result in
 * infinite recursion
+*
+* Printing only copies chars to a ring buffer. A background task collects
+* messages from it and sends them as a batch (one request with many messages)
+* every WIFI_DEBUG_CONSOLE_SEND_INTERVAL_MS, keeping the TLS connection open
+* between requests. Chars printed while the ring is full are dropped and counted.
 ******************************************************************************/
 
 /** Global serial object */
@@ -35,12 +41,8 @@ size_t WifiSerial::write(uint8_t c)
 {
     Serial.write(c);
 
-    append_char(c);
+    push(&c, 1);
 
-    // Utils::serial_style(STYLE_MAGENTA);
-    // Serial.print(F("Wifi write char: "));
-    // Serial.println(c);
-    // Utils::serial_style(STYLE_RESET);
     return 1;
 }
 
@@ -52,37 +54,140 @@ size_t WifiSerial::write(const uint8_t *buffer, size_t size)
 {
     Serial.write(buffer, size);
 
-    for (size_t i = 0; i < size; i++)
+    push(buffer, size);
+
+    return size;
+}
+
+/******************************************************************************
+* Wait for serial output and send buffered messages now
+******************************************************************************/
+void WifiSerial::flush()
+{
+    Serial.flush();
+
+    if(_task != NULL)
+        xTaskNotifyGive(_task);
+}
+
+/******************************************************************************
+* Chars dropped so far because ring buffer was full
+******************************************************************************/
+uint32_t WifiSerial::get_dropped()
+{
+    portENTER_CRITICAL(&_ring_mux);
+    uint32_t dropped = _dropped;
+    portEXIT_CRITICAL(&_ring_mux);
+
+    return dropped;
+}
+
+/******************************************************************************
+* Copy chars to ring buffer. Starts the background task on first write
+* @return Chars copied, rest are dropped
+******************************************************************************/
+size_t WifiSerial::push(const uint8_t *buffer, size_t size)
+{
+    start_task();
+
+    size_t copied = 0;
+
+    portENTER_CRITICAL(&_ring_mux);
+
+    for(; copied < size && _ring_head - _ring_tail < WIFI_SERIAL_RING_SIZE; copied++)
     {
-        append_char(buffer[i]);
+        _ring[_ring_head % WIFI_SERIAL_RING_SIZE] = buffer[copied];
+        _ring_head++;
     }
 
-    // Utils::serial_style(STYLE_MAGENTA);
-    // Serial.print(F("Wifi write buff: "));
-    // Serial.println((char*)buffer);
-    // Utils::serial_style(STYLE_RESET);
-    return size;
+    _dropped += size - copied;
+
+    portEXIT_CRITICAL(&_ring_mux);
+
+    return copied;
+}
+
+/******************************************************************************
+* Take next char from ring buffer
+* @return False if empty
+******************************************************************************/
+bool WifiSerial::pop(char *c)
+{
+    bool ret = false;
+
+    portENTER_CRITICAL(&_ring_mux);
+
+    if(_ring_tail != _ring_head)
+    {
+        *c = _ring[_ring_tail % WIFI_SERIAL_RING_SIZE];
+        _ring_tail++;
+        ret = true;
+    }
+
+    portEXIT_CRITICAL(&_ring_mux);
+
+    return ret;
+}
+
+/******************************************************************************
+* Create background task once
+******************************************************************************/
+void WifiSerial::start_task()
+{
+    portENTER_CRITICAL(&_ring_mux);
+    bool started = _task_started;
+    _task_started = true;
+    portEXIT_CRITICAL(&_ring_mux);
+
+    if(started)
+        return;
+
+    xTaskCreate(task, "wifi_serial", WIFI_SERIAL_TASK_STACK_SIZE, this, WIFI_SERIAL_TASK_PRIORITY, &_task);
 }
 
 /******************************************************************************
-* Append character to buffer, flush when full or newline detected
+* Background task. Collect messages from ring buffer and send them every
+* interval, or when flushed
+******************************************************************************/
+void WifiSerial::task(void *arg)
+{
+    WifiSerial *self = (WifiSerial*)arg;
+    char c;
+
+    while(true)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WIFI_DEBUG_CONSOLE_SEND_INTERVAL_MS));
+
+        while(self->pop(&c))
+        {
+            self->append_char(c);
+        }
+
+        self->send_frame();
+        MemoryMonitor::sample_task(MemoryMonitor::TASK_WIFI_SERIAL);
+    }
+}
+
+/******************************************************************************
+* Append character to message buffer, add message to frame when full or
+* newline detected
 ******************************************************************************/
 void WifiSerial::append_char(char c)
 {
     if(_buff_len >= WIFI_SERIAL_BUFFER_SIZE - 1)
     {
-        flush();
+        add_line();
     }
 
-    // Newlines mark the end of the log message so buffer is flushed and they
+    // Newlines mark the end of the log message so buffer is added and they
     // are ignored
     if(c == '\n')
     {
         // Ignore newlines at the beginning of a buffer (eg. logs that are just newlines)
         if(_buff_len != 0)
-            flush();
+            add_line();
     }
-    else
+    else if(c != '\r')
     {
         _buff[_buff_len] = c;
         _buff_len++;
@@ -90,27 +195,65 @@ void WifiSerial::append_char(char c)
 }
 
 /******************************************************************************
-* Flush buffer to HTTP service
+* Add message buffer to frame and reset it
 ******************************************************************************/
-void WifiSerial::flush()
+void WifiSerial::add_line()
+{
+    add_message(_buff, _buff_len);
+
+    _buff_len = 0;
+    _buff[0] = '\0';
+}
+
+/******************************************************************************
+* Add a message object to frame. Frame is sent first if message may not fit
+******************************************************************************/
+void WifiSerial::add_message(const char *msg, int len)
+{
+    // Escaped message may be twice as long. Keep room for dropped chars message
+    // and closing bracket
+    if(_frame_len + len * 2 + 100 >= WIFI_SERIAL_FRAME_SIZE)
+        send_frame();
+
+    _frame_len += snprintf(_frame + _frame_len, WIFI_SERIAL_FRAME_SIZE - _frame_len, "%s{\"message\": \"",
+        _frame_len == 0 ? "[" : ",");
+
+    for(int i = 0; i < len; i++)
+    {
+        // Drop control chars (eg. style escape codes)
+        if((uint8_t)msg[i] < 0x20)
+            continue;
+
+        if(msg[i] == '"' || msg[i] == '\\')
+            _frame[_frame_len++] = '\\';
+
+        _frame[_frame_len++] = msg[i];
+    }
+
+    _frame_len += snprintf(_frame + _frame_len, WIFI_SERIAL_FRAME_SIZE - _frame_len, "\"}");
+}
+
+/******************************************************************************
+* Send frame to HTTP service and reset it
+******************************************************************************/
+void WifiSerial::send_frame()
 {
-    _buff[_buff_len] = '\0';
+    uint32_t dropped = get_dropped();
 
-    int real_pos = 0;
-    for (size_t i = 0; i < _buff_len; i++)
+    if(dropped != _dropped_reported && _frame_len + 100 < WIFI_SERIAL_FRAME_SIZE)
     {
-        if(_buff[i] != '\n' && _buff[i] != '\r')
-        {
-            _buff[real_pos++] = _buff[i];
+        char msg[64] = "";
+        int len = snprintf(msg, sizeof(msg), "WifiSerial: %u chars dropped", dropped - _dropped_reported);
+        _dropped_reported = dropped;
 
-            if(_buff[i] == '\0')
-            {
-                break;
-            }
-        }
+        add_message(msg, len);
     }
-    _buff[real_pos] = '\0';
-    
+
+    if(_frame_len == 0)
+        return;
+
+    _frame_len += snprintf(_frame + _frame_len, WIFI_SERIAL_FRAME_SIZE - _frame_len, "]");
+
     // Connect to wifi
     if(!WifiModem::is_connected())
     {
@@ -119,22 +262,16 @@ void WifiSerial::flush()
     }
     
     //
-    // HTTP request
+    // HTTP request. Connection is kept open by end() for next frame
     //
+    _http_client.setReuse(true);
     _http_client.begin(_wifi_secure_client, TIMBER_API_URL);
 
     // Add headers
     _http_client.addHeader("Content-Type", "application/json");
 	_http_client.addHeader("Authorization", TIMBER_AUTH_HEADER);
 
-    // Prepare message
-    char req_buff[WIFI_SERIAL_BUFFER_SIZE + 300] = "";
-    snprintf(req_buff, sizeof(req_buff), "{\"message\": \"%s\"}", _buff);
-
-    // Serial.print(F("Msg: "));
-    // Serial.println(req_buff);
-
-    int code = _http_client.POST((uint8_t*)req_buff, strlen(req_buff));
+    int code = _http_client.POST((uint8_t*)_frame, _frame_len);
 
 	if(code != 202)
 	{
@@ -142,9 +279,11 @@ void WifiSerial::flush()
         Serial.println(code, DEC);
 	}
 
+    _http_client.end();
+
     // Reset
-    _buff_len = 0;
-    _buff[0] = '\0';
+    _frame_len = 0;
+    _frame[0] = '\0';
 }
 
 #endif
\ No newline at end of file
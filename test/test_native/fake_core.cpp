@@ -0,0 +1,726 @@
+/******************************************************************************
+ * Arduino-esp32 core, ESP-IDF and FreeRTOS on the host (see shim/)
+ *****************************************************************************/
+#include <stdarg.h>
+#include <map>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "Preferences.h"
+#include "Wire.h"
+#include "SPI.h"
+#include "esp_sleep.h"
+#include "rom/crc.h"
+#include "rom/md5_hash.h"
+#include "rom/rtc.h"
+#include "fakes.h"
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+EspClass ESP;
+TwoWire Wire(0);
+SPIClass SPI;
+
+namespace Fakes
+{
+	/** Virtual time since boot */
+	uint64_t _now_us = 0;
+
+	uint32_t _cpu_mhz = 240;
+	uint32_t _random_state = 1;
+	uint8_t _pin_levels[GPIO_NUM_MAX] = {0};
+	esp_sleep_wakeup_cause_t _wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+	/** NVS, by namespace and key */
+	std::map<std::string, std::map<std::string, std::vector<uint8_t>>> _nvs;
+
+	void advance_ms(uint32_t ms)
+	{
+		_now_us += (uint64_t)ms * 1000;
+	}
+
+	void set_wakeup_cause(esp_sleep_wakeup_cause_t cause)
+	{
+		_wakeup_cause = cause;
+	}
+
+	void reset_core()
+	{
+		_now_us = 0;
+		_cpu_mhz = 240;
+		_random_state = 1;
+		memset(_pin_levels, 0, sizeof(_pin_levels));
+		_wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+		_nvs.clear();
+	}
+}
+
+/******************************************************************************
+ * Time and pins
+ *****************************************************************************/
+unsigned long millis()
+{
+	return Fakes::_now_us / 1000;
+}
+
+unsigned long micros()
+{
+	return (unsigned long)Fakes::_now_us;
+}
+
+void delay(uint32_t ms)
+{
+	Fakes::advance_ms(ms);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	Fakes::_now_us += us;
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if(pin < GPIO_NUM_MAX)
+		Fakes::_pin_levels[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+	return pin < GPIO_NUM_MAX ? Fakes::_pin_levels[pin] : LOW;
+}
+
+uint16_t analogRead(uint8_t pin)
+{
+	return 0;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+}
+
+void detachInterrupt(uint8_t pin)
+{
+}
+
+/** Same sequence on every run */
+long random(long max)
+{
+	if(max <= 0)
+		return 0;
+
+	return esp_random() % max;
+}
+
+long random(long min, long max)
+{
+	if(min >= max)
+		return min;
+
+	return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed)
+{
+	Fakes::_random_state = seed != 0 ? seed : 1;
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz)
+{
+	Fakes::_cpu_mhz = mhz;
+	return true;
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+	return Fakes::_cpu_mhz;
+}
+
+void EspClass::restart()
+{
+	printf("ESP.restart() called\n");
+	exit(EXIT_FAILURE);
+}
+
+/******************************************************************************
+ * String
+ *****************************************************************************/
+String::String(int val, unsigned char base) : String((long)val, base) {}
+
+String::String(unsigned int val, unsigned char base) : String((unsigned long)val, base) {}
+
+String::String(long val, unsigned char base)
+{
+	if(base == DEC)
+		_str = std::to_string(val);
+	else if(val < 0)
+		_str = "-" + String((unsigned long)-val, base)._str;
+	else
+		_str = String((unsigned long)val, base)._str;
+}
+
+String::String(unsigned long val, unsigned char base)
+{
+	const char digits[] = "0123456789abcdef";
+
+	if(base < 2 || base > 16)
+		base = DEC;
+
+	do
+	{
+		_str.insert(_str.begin(), digits[val % base]);
+		val /= base;
+	} while(val > 0);
+}
+
+String::String(float val, unsigned char decimals) : String((double)val, decimals) {}
+
+String::String(double val, unsigned char decimals)
+{
+	char buff[64];
+	snprintf(buff, sizeof(buff), "%.*f", decimals, val);
+	_str = buff;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+	size_t pos = _str.find(c, from);
+	return pos == std::string::npos ? -1 : pos;
+}
+
+int String::indexOf(const char *str, unsigned int from) const
+{
+	size_t pos = _str.find(str, from);
+	return pos == std::string::npos ? -1 : pos;
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+	if(from > to)
+		std::swap(from, to);
+
+	if(from >= _str.length())
+		return String();
+
+	return String(_str.substr(from, std::min<size_t>(to, _str.length()) - from));
+}
+
+void String::trim()
+{
+	size_t start = _str.find_first_not_of(" \t\r\n");
+	if(start == std::string::npos)
+	{
+		_str.clear();
+		return;
+	}
+
+	_str = _str.substr(start, _str.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+void String::toCharArray(char *buff, unsigned int size) const
+{
+	if(size == 0)
+		return;
+
+	strncpy(buff, _str.c_str(), size - 1);
+	buff[size - 1] = '\0';
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+	String res = lhs;
+	res += rhs;
+	return res;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+	String res = lhs;
+	res += rhs;
+	return res;
+}
+
+/******************************************************************************
+ * Print and Stream
+ *****************************************************************************/
+size_t Print::write(const uint8_t *buff, size_t size)
+{
+	size_t written = 0;
+	while(written < size && write(buff[written]) == 1)
+		written++;
+
+	return written;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if(len <= 0)
+		return 0;
+
+	std::vector<char> buff(len + 1);
+	va_start(args, format);
+	vsnprintf(buff.data(), buff.size(), format, args);
+	va_end(args);
+
+	return write((const uint8_t *)buff.data(), len);
+}
+
+size_t Print::print(long val, int base)
+{
+	return print(String(val, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long val, int base)
+{
+	return print(String(val, (unsigned char)base));
+}
+
+size_t Print::print(long long val, int base)
+{
+	return print(String((long)val, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long long val, int base)
+{
+	return print(String((unsigned long)val, (unsigned char)base));
+}
+
+size_t Print::print(double val, int decimals)
+{
+	return print(String(val, (unsigned char)decimals));
+}
+
+/** Nothing arrives while a test runs, so reads don't wait for the timeout */
+size_t Stream::readBytes(char *buff, size_t len)
+{
+	size_t count = 0;
+	while(count < len)
+	{
+		int c = read();
+		if(c < 0)
+			break;
+
+		buff[count++] = (char)c;
+	}
+
+	return count;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+	String res;
+	int c;
+	while((c = read()) >= 0 && c != terminator)
+		res += (char)c;
+
+	return res;
+}
+
+String Stream::readString()
+{
+	String res;
+	int c;
+	while((c = read()) >= 0)
+		res += (char)c;
+
+	return res;
+}
+
+bool Stream::find(const char *target)
+{
+	size_t len = strlen(target), matched = 0;
+	if(len == 0)
+		return true;
+
+	int c;
+	while((c = read()) >= 0)
+	{
+		if(c == target[matched])
+		{
+			if(++matched == len)
+				return true;
+		}
+		else
+		{
+			matched = c == target[0] ? 1 : 0;
+		}
+	}
+
+	return false;
+}
+
+/******************************************************************************
+ * NVS
+ *****************************************************************************/
+bool Preferences::begin(const char *name, bool read_only, const char *partition_label)
+{
+	_name = name;
+	_read_only = read_only;
+	_started = true;
+
+	return true;
+}
+
+void Preferences::end()
+{
+	_started = false;
+}
+
+bool Preferences::clear()
+{
+	if(!_started || _read_only)
+		return false;
+
+	Fakes::_nvs[_name].clear();
+	return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+	if(!_started || _read_only)
+		return false;
+
+	return Fakes::_nvs[_name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+	return _started && Fakes::_nvs[_name].count(key) > 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+	if(!_started || _read_only)
+		return 0;
+
+	const uint8_t *bytes = (const uint8_t *)value;
+	Fakes::_nvs[_name][key] = std::vector<uint8_t>(bytes, bytes + len);
+
+	return len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buff, size_t max_len)
+{
+	if(!isKey(key))
+		return 0;
+
+	const std::vector<uint8_t> &value = Fakes::_nvs[_name][key];
+	if(value.size() > max_len)
+		return 0;
+
+	memcpy(buff, value.data(), value.size());
+	return value.size();
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+	return isKey(key) ? Fakes::_nvs[_name][key].size() : 0;
+}
+
+/******************************************************************************
+ * ESP-IDF
+ *****************************************************************************/
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+	const uint8_t native_mac[] = {0xA1, 0xB2, 0xC3, 0xD4, 0xE5, 0xF6};
+	memcpy(mac, native_mac, sizeof(native_mac));
+	mac[5] += type;
+
+	return ESP_OK;
+}
+
+/** xorshift32, same sequence on every run */
+uint32_t esp_random()
+{
+	uint32_t x = Fakes::_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Fakes::_random_state = x;
+
+	return x;
+}
+
+void esp_restart()
+{
+	ESP.restart();
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_us)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t pin, int level)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup()
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_wakeup_cause_t source)
+{
+	return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+	return Fakes::_wakeup_cause;
+}
+
+esp_err_t esp_light_sleep_start()
+{
+	return ESP_OK;
+}
+
+void esp_deep_sleep_start()
+{
+	printf("esp_deep_sleep_start() called\n");
+	exit(EXIT_FAILURE);
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t pin)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t pin)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t pin)
+{
+	return ESP_OK;
+}
+
+RESET_REASON rtc_get_reset_reason(int cpu_no)
+{
+	return POWERON_RESET;
+}
+
+/******************************************************************************
+ * ROM functions
+ *****************************************************************************/
+uint32_t crc32_le(uint32_t crc, const uint8_t *buff, uint32_t len)
+{
+	crc = ~crc;
+	for(uint32_t i = 0; i < len; i++)
+	{
+		crc ^= buff[i];
+		for(int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+	}
+
+	return ~crc;
+}
+
+/** Not a real MD5, same length and stable, enough for change detection on the host */
+void MD5Init(struct MD5Context *context)
+{
+	memset(context, 0, sizeof(*context));
+	context->buf[0] = 0x67452301;
+	context->buf[1] = 0xefcdab89;
+	context->buf[2] = 0x98badcfe;
+	context->buf[3] = 0x10325476;
+}
+
+void MD5Update(struct MD5Context *context, const uint8_t *buff, uint32_t len)
+{
+	for(int i = 0; i < 4; i++)
+		context->buf[i] = crc32_le(context->buf[i], buff, len);
+
+	context->bits[0] += len;
+}
+
+void MD5Final(uint8_t digest[16], struct MD5Context *context)
+{
+	memcpy(digest, context->buf, 16);
+}
+
+/******************************************************************************
+ * FreeRTOS, single threaded
+ *****************************************************************************/
+struct NativeQueue
+{
+	size_t item_size;
+	size_t length;
+	std::deque<std::vector<uint8_t>> items;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+	return new NativeSemaphore{1, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+	return new NativeSemaphore{1, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+	return new NativeSemaphore{0, 1};
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+	delete sem;
+}
+
+/** Nothing else runs to give it, so a take that would block fails at once */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	if(sem->count <= 0)
+		return pdFALSE;
+
+	sem->count--;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	if(sem->count >= sem->max)
+		return pdFALSE;
+
+	sem->count++;
+	return pdTRUE;
+}
+
+/** One thread always owns it, count is the nesting depth */
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	sem->count--;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+	if(sem->count >= sem->max)
+		return pdFALSE;
+
+	sem->count++;
+	return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	return new NativeQueue{item_size, length, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	if(queue->items.size() >= queue->length)
+		return pdFALSE;
+
+	const uint8_t *bytes = (const uint8_t *)item;
+	queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->item_size));
+
+	return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+	if(woken != NULL)
+		*woken = pdFALSE;
+
+	return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	if(queue->items.empty())
+		return pdFALSE;
+
+	memcpy(item, queue->items.front().data(), queue->item_size);
+	queue->items.pop_front();
+
+	return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	queue->items.clear();
+	return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	delete queue;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack_size, void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+	return pdFAIL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char *name, uint32_t stack_size, void *param, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+	return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	delay(ticks * portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	return 4096;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+	if(woken != NULL)
+		*woken = pdFALSE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+	return NULL;
+}
+
+BaseType_t xPortInIsrContext()
+{
+	return pdFALSE;
+}
@@ -0,0 +1,306 @@
+/******************************************************************************
+ * RAM SPIFFS (see shim/FS.h)
+ *****************************************************************************/
+#include <map>
+#include <vector>
+#include "SPIFFS.h"
+#include "fakes.h"
+
+namespace fs
+{
+	struct RamFile
+	{
+		std::vector<uint8_t> data;
+	};
+
+	class RamFs
+	{
+	public:
+		size_t used_bytes()
+		{
+			size_t used = 0;
+			for(auto &entry : files)
+				used += entry.second->data.size();
+
+			return used;
+		}
+
+		std::map<std::string, std::shared_ptr<RamFile>> files;
+		size_t total_bytes = FAKES_FS_DEFAULT_BYTES;
+		bool mounted = false;
+	};
+
+	/** Open file or dir listing. Files keep their data after remove() while open */
+	struct FileImpl
+	{
+		RamFs *fs;
+		std::string path;
+		bool open;
+
+		std::shared_ptr<RamFile> file;
+		size_t pos;
+		bool writable;
+
+		/** Dir listing, paths when opened */
+		std::vector<std::string> entries;
+		size_t next_entry;
+	};
+
+	RamFs _ram_fs;
+
+	size_t File::write(uint8_t c)
+	{
+		return write(&c, 1);
+	}
+
+	size_t File::write(const uint8_t *buff, size_t size)
+	{
+		if(!*this || !_impl->file || !_impl->writable)
+			return 0;
+
+		// Partition full, as much as fits is written
+		size_t free_bytes = _impl->fs->total_bytes - _impl->fs->used_bytes();
+		size_t grow = _impl->pos + size > _impl->file->data.size() ? _impl->pos + size - _impl->file->data.size() : 0;
+		if(grow > free_bytes)
+			size -= grow - free_bytes;
+
+		if(size == 0)
+			return 0;
+
+		std::vector<uint8_t> &data = _impl->file->data;
+		if(_impl->pos + size > data.size())
+			data.resize(_impl->pos + size);
+
+		memcpy(data.data() + _impl->pos, buff, size);
+		_impl->pos += size;
+
+		return size;
+	}
+
+	int File::available()
+	{
+		if(!*this || !_impl->file)
+			return 0;
+
+		return _impl->file->data.size() - std::min(_impl->pos, _impl->file->data.size());
+	}
+
+	int File::read()
+	{
+		uint8_t c;
+		return read(&c, 1) == 1 ? c : -1;
+	}
+
+	int File::peek()
+	{
+		if(available() <= 0)
+			return -1;
+
+		return _impl->file->data[_impl->pos];
+	}
+
+	size_t File::read(uint8_t *buff, size_t size)
+	{
+		size_t count = std::min(size, (size_t)available());
+		if(count == 0)
+			return 0;
+
+		memcpy(buff, _impl->file->data.data() + _impl->pos, count);
+		_impl->pos += count;
+
+		return count;
+	}
+
+	bool File::seek(uint32_t pos, SeekMode mode)
+	{
+		if(!*this || !_impl->file)
+			return false;
+
+		size_t size = _impl->file->data.size();
+		size_t base = mode == SeekSet ? 0 : mode == SeekCur ? _impl->pos : size;
+		if(base + pos > size)
+			return false;
+
+		_impl->pos = base + pos;
+		return true;
+	}
+
+	size_t File::position() const
+	{
+		return *this && _impl->file ? _impl->pos : 0;
+	}
+
+	size_t File::size() const
+	{
+		return *this && _impl->file ? _impl->file->data.size() : 0;
+	}
+
+	void File::close()
+	{
+		if(_impl)
+			_impl->open = false;
+
+		_impl.reset();
+	}
+
+	File::operator bool() const
+	{
+		return _impl && _impl->open && _impl->fs->mounted;
+	}
+
+	const char* File::name() const
+	{
+		return _impl ? _impl->path.c_str() : NULL;
+	}
+
+	bool File::isDirectory() const
+	{
+		return *this && !_impl->file;
+	}
+
+	File File::openNextFile(const char *mode)
+	{
+		if(!isDirectory())
+			return File();
+
+		while(_impl->next_entry < _impl->entries.size())
+		{
+			File file = FS(_impl->fs).open(_impl->entries[_impl->next_entry++].c_str(), mode);
+			if(file)
+				return file;
+		}
+
+		return File();
+	}
+
+	void File::rewindDirectory()
+	{
+		if(isDirectory())
+			_impl->next_entry = 0;
+	}
+
+	File FS::open(const char *path, const char *mode)
+	{
+		if(!_ram_fs->mounted || path == NULL || path[0] != '/')
+			return File();
+
+		std::shared_ptr<FileImpl> impl = std::make_shared<FileImpl>();
+		impl->fs = _ram_fs;
+		impl->path = path;
+		impl->open = true;
+		impl->pos = 0;
+		impl->writable = false;
+		impl->next_entry = 0;
+
+		auto found = _ram_fs->files.find(path);
+
+		if(strcmp(mode, FILE_READ) == 0)
+		{
+			if(found != _ram_fs->files.end())
+			{
+				impl->file = found->second;
+				return File(impl);
+			}
+
+			// Any other path is a dir, with the files under it
+			std::string prefix = path;
+			if(prefix.back() != '/')
+				prefix += '/';
+
+			for(auto &entry : _ram_fs->files)
+			{
+				if(entry.first.compare(0, prefix.length(), prefix) == 0)
+					impl->entries.push_back(entry.first);
+			}
+
+			return File(impl);
+		}
+
+		if(strcmp(mode, FILE_WRITE) != 0 && strcmp(mode, FILE_APPEND) != 0)
+			return File();
+
+		if(found == _ram_fs->files.end() || strcmp(mode, FILE_WRITE) == 0)
+		{
+			std::shared_ptr<RamFile> file = std::make_shared<RamFile>();
+			_ram_fs->files[path] = file;
+			impl->file = file;
+		}
+		else
+		{
+			impl->file = found->second;
+			impl->pos = impl->file->data.size();
+		}
+
+		impl->writable = true;
+
+		return File(impl);
+	}
+
+	bool FS::exists(const char *path)
+	{
+		return _ram_fs->mounted && _ram_fs->files.count(path) > 0;
+	}
+
+	bool FS::remove(const char *path)
+	{
+		return _ram_fs->mounted && _ram_fs->files.erase(path) > 0;
+	}
+
+	bool FS::rename(const char *path_from, const char *path_to)
+	{
+		if(!_ram_fs->mounted)
+			return false;
+
+		auto found = _ram_fs->files.find(path_from);
+		if(found == _ram_fs->files.end() || _ram_fs->files.count(path_to) > 0)
+			return false;
+
+		_ram_fs->files[path_to] = found->second;
+		_ram_fs->files.erase(path_from);
+
+		return true;
+	}
+
+	SPIFFSFS::SPIFFSFS() : FS(&fs::_ram_fs)
+	{
+	}
+
+	bool SPIFFSFS::begin(bool format_on_fail, const char *base_path, uint8_t max_open_files, const char *label)
+	{
+		_ram_fs->mounted = true;
+		return true;
+	}
+
+	void SPIFFSFS::end()
+	{
+		_ram_fs->mounted = false;
+	}
+
+	bool SPIFFSFS::format()
+	{
+		_ram_fs->files.clear();
+		return true;
+	}
+
+	size_t SPIFFSFS::totalBytes()
+	{
+		return _ram_fs->total_bytes;
+	}
+
+	size_t SPIFFSFS::usedBytes()
+	{
+		return _ram_fs->used_bytes();
+	}
+}
+
+fs::SPIFFSFS SPIFFS;
+
+namespace Fakes
+{
+	void fs_reset(size_t total_bytes)
+	{
+		fs::_ram_fs.files.clear();
+		fs::_ram_fs.total_bytes = total_bytes;
+		fs::_ram_fs.mounted = true;
+	}
+}
@@ -0,0 +1,411 @@
+/******************************************************************************
+ * Modules the natively built ones call into, left out of the native env since
+ * they talk to hardware (RTC, modem, battery gauge) or to whole subsystems.
+ * Each does the least its callers need: no errors, nothing to report
+ *****************************************************************************/
+#include <map>
+#include "adaptive_sampling.h"
+#include "backlog_drain.h"
+#include "battery.h"
+#include "bearer.h"
+#include "capture.h"
+#include "deep_sleep.h"
+#include "energy_profiler.h"
+#include "fo_data.h"
+#include "gsm.h"
+#include "http_session.h"
+#include "i2c_bus.h"
+#include "log.h"
+#include "memory_monitor.h"
+#include "power_governor.h"
+#include "psram.h"
+#include "rtc.h"
+#include "store_registry.h"
+#include "tls_client.h"
+#include "trace.h"
+#include "uplink_controller.h"
+#include "uplink_metrics.h"
+#include "water_presence.h"
+#include "fakes.h"
+
+namespace Fakes
+{
+	/** RTC time when set, and millis() then */
+	uint32_t _tstamp = 0;
+	uint32_t _tstamp_set_ms = 0;
+
+	std::map<int, int> _log_counts;
+
+	FoData::StoreEntry _fo_entry;
+
+	void reset()
+	{
+		reset_core();
+		reset_net();
+		reset_modules();
+		fs_reset();
+	}
+
+	void set_tstamp(uint32_t tstamp)
+	{
+		_tstamp = tstamp;
+		_tstamp_set_ms = millis();
+	}
+
+	int log_count(Log::Code code)
+	{
+		return _log_counts.count(code) ? _log_counts[code] : 0;
+	}
+
+	void reset_modules()
+	{
+		_tstamp = FAKES_DEFAULT_TSTAMP;
+		_tstamp_set_ms = 0;
+		_log_counts.clear();
+	}
+}
+
+namespace AdaptiveSampling
+{
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[])
+	{
+	}
+}
+
+namespace BacklogDrain
+{
+	bool is_active()
+	{
+		return false;
+	}
+}
+
+namespace Battery
+{
+	BATTERY_MODE get_current_mode()
+	{
+		return BATTERY_MODE_NORMAL;
+	}
+
+	void print_mode()
+	{
+	}
+
+	RetResult read_adc(uint16_t *voltage, uint16_t *pct)
+	{
+		*voltage = 4000;
+		*pct = 80;
+
+		return RET_OK;
+	}
+
+	RetResult read_solar_mv(uint16_t *voltage)
+	{
+		return RET_ERROR;
+	}
+}
+
+namespace Bearer
+{
+	TinyGsm _modem(Serial1);
+
+	bool is_connected()
+	{
+		return true;
+	}
+
+	Client* new_client(uint8_t mux)
+	{
+		return new TinyGsmClient(_modem, mux);
+	}
+
+	void on_request(uint32_t rtt_ms, bool ok)
+	{
+	}
+}
+
+namespace Capture
+{
+	void record(Kind kind, const void *data, int len, bool ok)
+	{
+	}
+}
+
+namespace DeepSleep
+{
+	bool allowed(int sleep_secs)
+	{
+		return false;
+	}
+
+	void start(uint64_t sleep_us, Source source)
+	{
+	}
+}
+
+namespace EnergyProfiler
+{
+	void begin(State state)
+	{
+	}
+
+	void end(State state)
+	{
+	}
+
+	void count_nvs_commit(uint32_t duration_ms)
+	{
+	}
+
+	esp_err_t light_sleep()
+	{
+		return esp_light_sleep_start();
+	}
+
+	void update()
+	{
+	}
+}
+
+namespace FoData
+{
+	StoreEntry* reserve()
+	{
+		return &Fakes::_fo_entry;
+	}
+
+	RetResult publish()
+	{
+		return RET_OK;
+	}
+
+	void inc_wakeup_count()
+	{
+	}
+}
+
+namespace GSM
+{
+	bool is_gprs_connected()
+	{
+		return true;
+	}
+}
+
+namespace HttpSession
+{
+	/** No sessions, every request opens its own connection */
+	HttpClient* get_client(const char *server, int port)
+	{
+		return NULL;
+	}
+
+	void on_request_complete(bool reusable)
+	{
+	}
+}
+
+namespace I2CBus
+{
+	RetResult write_reg(uint8_t addr, uint8_t reg, uint8_t value)
+	{
+		return RET_ERROR;
+	}
+}
+
+namespace Log
+{
+	bool log(Log::Code code, uint32_t meta1, uint32_t meta2)
+	{
+		Fakes::_log_counts[code]++;
+		return true;
+	}
+
+	RetResult commit()
+	{
+		return RET_OK;
+	}
+
+	void flush_windows()
+	{
+	}
+}
+
+namespace MemoryMonitor
+{
+	void sample_task(Task task)
+	{
+	}
+}
+
+namespace PowerGovernor
+{
+	float update()
+	{
+		return 0;
+	}
+
+	void apply(SleepScheduler::WakeupScheduleEntry schedule[])
+	{
+	}
+
+	bool has_surplus(float min_ma)
+	{
+		return false;
+	}
+
+	void print()
+	{
+	}
+}
+
+namespace Psram
+{
+	void* alloc(size_t size)
+	{
+		return NULL;
+	}
+}
+
+/******************************************************************************
+ * RTC runs on virtual time from the timestamp set with Fakes::set_tstamp()
+ *****************************************************************************/
+namespace RTC
+{
+	uint32_t get_timestamp()
+	{
+		if(Fakes::_tstamp == 0)
+			return 0;
+
+		return Fakes::_tstamp + (millis() - Fakes::_tstamp_set_ms) / 1000;
+	}
+
+	uint32_t get_external_rtc_timestamp()
+	{
+		return get_timestamp();
+	}
+
+	RetResult sync_time_from_ext_rtc()
+	{
+		return tstamp_valid(get_timestamp()) ? RET_OK : RET_ERROR;
+	}
+
+	void print_time()
+	{
+		debug_printf("Time: %u\n", get_timestamp());
+	}
+
+	bool tstamp_valid(uint32_t tstamp)
+	{
+		return (tstamp > FAIL_CHECK_TIMESTAMP_START && tstamp < FAIL_CHECK_TIMESTAMP_END);
+	}
+
+	bool is_slow_clock_calibrated()
+	{
+		return false;
+	}
+
+	uint64_t get_sleep_us(uint32_t secs)
+	{
+		return (uint64_t)secs * 1000000;
+	}
+
+	bool wakeup_alarm_available()
+	{
+		return false;
+	}
+
+	RetResult set_wakeup_alarm(uint32_t tstamp)
+	{
+		return RET_ERROR;
+	}
+
+	void enable_alarm_wakeup()
+	{
+	}
+
+	bool clear_wakeup_alarm()
+	{
+		return false;
+	}
+}
+
+namespace StoreRegistry
+{
+	bool backlog_high()
+	{
+		return false;
+	}
+}
+
+namespace Trace
+{
+	Span::Span(SpanId id) : _id(id), _start_us(now_us())
+	{
+	}
+
+	Span::~Span()
+	{
+		record(_id, _start_us);
+	}
+
+	int64_t now_us()
+	{
+		return micros();
+	}
+
+	void record(SpanId id, int64_t start_us)
+	{
+	}
+}
+
+namespace UplinkController
+{
+	int get_stream_timeout()
+	{
+		return HTTP_CLIENT_STREAM_TIMEOUT;
+	}
+
+	int get_response_timeout()
+	{
+		return HTTL_CLIENT_REPONSE_TIMEOUT;
+	}
+}
+
+namespace UplinkMetrics
+{
+	void on_request(uint32_t rtt_ms, int sent_bytes, int recv_bytes, int status)
+	{
+	}
+}
+
+namespace WaterPresence
+{
+	void arm_wakeup(bool deep_sleep)
+	{
+	}
+
+	bool level_changed()
+	{
+		return false;
+	}
+}
+
+/******************************************************************************
+ * No TLS on the host, TLS_PORT connections fail
+ *****************************************************************************/
+TlsClient::TlsClient(Client *transport) : _transport(transport) {}
+TlsClient::~TlsClient() {}
+bool TlsClient::is_tls_port(int port) { return port == TLS_PORT; }
+int TlsClient::connect(IPAddress ip, uint16_t port) { return 0; }
+int TlsClient::connect(const char *host, uint16_t port) { return 0; }
+size_t TlsClient::write(uint8_t byte) { return 0; }
+size_t TlsClient::write(const uint8_t *buff, size_t size) { return 0; }
+int TlsClient::available() { return 0; }
+int TlsClient::read() { return -1; }
+int TlsClient::read(uint8_t *buff, size_t size) { return -1; }
+int TlsClient::peek() { return -1; }
+void TlsClient::flush() {}
+void TlsClient::stop() {}
+uint8_t TlsClient::connected() { return 0; }
+TlsClient::operator bool() { return false; }
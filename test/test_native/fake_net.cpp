@@ -0,0 +1,129 @@
+/******************************************************************************
+ * Fake modem and HTTP client (see shim/TinyGsmClient.h, ArduinoHttpClient.h)
+ *****************************************************************************/
+#include "TinyGsmClient.h"
+#include "ArduinoHttpClient.h"
+#include "fakes.h"
+
+namespace Fakes
+{
+	int _http_status = 404;
+	std::string _http_response;
+
+	std::string _http_method;
+	std::string _http_path;
+	std::string _http_body;
+	int _http_request_count = 0;
+
+	void http_respond(int status, const char *body)
+	{
+		_http_status = status;
+		_http_response = body != NULL ? body : "";
+	}
+
+	const char* http_method()
+	{
+		return _http_method.c_str();
+	}
+
+	const char* http_path()
+	{
+		return _http_path.c_str();
+	}
+
+	const char* http_body()
+	{
+		return _http_body.c_str();
+	}
+
+	int http_request_count()
+	{
+		return _http_request_count;
+	}
+
+	void reset_net()
+	{
+		_http_status = 404;
+		_http_response.clear();
+		_http_method.clear();
+		_http_path.clear();
+		_http_body.clear();
+		_http_request_count = 0;
+	}
+}
+
+int8_t TinyGsm::next_response()
+{
+	if(responses.empty())
+		return 1;
+
+	int8_t res = responses.front();
+	responses.erase(responses.begin());
+
+	return res;
+}
+
+/******************************************************************************
+ * Request is answered when it ends, body written after the start line is the
+ * request body
+ *****************************************************************************/
+int HttpClient::start_request(const char *method, const char *path)
+{
+	_method = method;
+	_path = path;
+	_request_body.clear();
+	_status = 0;
+	_body.clear();
+	_body_pos = 0;
+
+	if(!_in_request)
+		return endRequest();
+
+	return HTTP_SUCCESS;
+}
+
+int HttpClient::endRequest()
+{
+	_in_request = false;
+
+	Fakes::_http_method = _method;
+	Fakes::_http_path = _path;
+	Fakes::_http_body = _request_body;
+	Fakes::_http_request_count++;
+
+	_status = Fakes::_http_status;
+	_body = Fakes::_http_response;
+	_body_pos = 0;
+
+	return HTTP_SUCCESS;
+}
+
+int HttpClient::post(const char *path, const char *content_type, int content_length, const uint8_t *body)
+{
+	_in_request = true;
+	start_request("POST", path);
+
+	if(body != NULL && content_length > 0)
+		write(body, content_length);
+
+	return endRequest();
+}
+
+int HttpClient::responseStatusCode()
+{
+	return _status != 0 ? _status : HTTP_ERROR_API;
+}
+
+int HttpClient::contentLength()
+{
+	return _body.length();
+}
+
+int HttpClient::read(uint8_t *buff, size_t size)
+{
+	size_t count = std::min(size, (size_t)available());
+	memcpy(buff, _body.data() + _body_pos, count);
+	_body_pos += count;
+
+	return count;
+}
@@ -0,0 +1,55 @@
+#ifndef NATIVE_FAKES_H
+#define NATIVE_FAKES_H
+
+/******************************************************************************
+ * Controls of the host fakes (see shim/ and fake_*.cpp). Modules built by the
+ * native env run against these in place of the board, SPIFFS, the modem and
+ * the modules that talk to hardware
+ *****************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_sleep.h"
+#include "log.h"
+
+/** RAM SPIFFS size after reset(), same as the device partition */
+#define FAKES_FS_DEFAULT_BYTES (1408 * 1024)
+
+/** RTC time after reset(), valid for RTC::tstamp_valid() */
+#define FAKES_DEFAULT_TSTAMP 1700000000
+
+namespace Fakes
+{
+	/** Put all fakes back to their boot state, empty SPIFFS and NVS */
+	void reset();
+
+	/** Move virtual time, millis(), micros() and the RTC */
+	void advance_ms(uint32_t ms);
+
+	/** Set RTC time, 0 for not synced */
+	void set_tstamp(uint32_t tstamp);
+
+	/** Format SPIFFS with a size, writes past it fail like on a full partition */
+	void fs_reset(size_t total_bytes = FAKES_FS_DEFAULT_BYTES);
+
+	/** Answer of the next HTTP requests */
+	void http_respond(int status, const char *body);
+
+	/** Last HTTP request sent, for checks */
+	const char* http_method();
+	const char* http_path();
+	const char* http_body();
+	int http_request_count();
+
+	/** Events logged with Log::log() since reset() */
+	int log_count(Log::Code code);
+
+	/** Cause returned by esp_sleep_get_wakeup_cause() */
+	void set_wakeup_cause(esp_sleep_wakeup_cause_t cause);
+
+	// Reset of each fake file, called by reset()
+	void reset_core();
+	void reset_net();
+	void reset_modules();
+}
+
+#endif
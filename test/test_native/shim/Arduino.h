@@ -0,0 +1,261 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+/******************************************************************************
+ * Host shim of the Arduino-esp32 core, just enough for the modules built by
+ * the native env (see platformio.ini). Time is virtual: millis() and micros()
+ * only move with delay() and Fakes::advance_ms(), so tests are deterministic
+ * and benchmarks don't sleep. Serial prints to stdout
+ *****************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define ONLOW 0x04
+#define ONHIGH 0x05
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define pgm_read_word(addr) (*(const unsigned short *)(addr))
+#define pgm_read_dword(addr) (*(const unsigned long *)(addr))
+#define pgm_read_float(addr) (*(const float *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define DRAM_ATTR
+
+class __FlashStringHelper;
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+#define F(s) FPSTR(PSTR(s))
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+/******************************************************************************
+ * String, backed by std::string
+ *****************************************************************************/
+class String
+{
+public:
+	String(const char *str = "") : _str(str != NULL ? str : "") {}
+	String(const __FlashStringHelper *str) : String(reinterpret_cast<const char *>(str)) {}
+	String(const std::string &str) : _str(str) {}
+	explicit String(char c) : _str(1, c) {}
+	explicit String(int val, unsigned char base = DEC);
+	explicit String(unsigned int val, unsigned char base = DEC);
+	explicit String(long val, unsigned char base = DEC);
+	explicit String(unsigned long val, unsigned char base = DEC);
+	explicit String(float val, unsigned char decimals = 2);
+	explicit String(double val, unsigned char decimals = 2);
+
+	const char* c_str() const { return _str.c_str(); }
+	unsigned int length() const { return _str.length(); }
+	bool reserve(unsigned int size) { _str.reserve(size); return true; }
+	bool isEmpty() const { return _str.empty(); }
+
+	bool concat(const char *str) { _str += str; return true; }
+	bool concat(const String &str) { _str += str._str; return true; }
+	bool concat(char c) { _str += c; return true; }
+
+	String& operator+=(const char *str) { concat(str); return *this; }
+	String& operator+=(const String &str) { concat(str); return *this; }
+	String& operator+=(char c) { concat(c); return *this; }
+
+	bool operator==(const String &other) const { return _str == other._str; }
+	bool operator==(const char *other) const { return _str == other; }
+	bool operator!=(const String &other) const { return _str != other._str; }
+	bool operator!=(const char *other) const { return _str != other; }
+	char operator[](unsigned int index) const { return index < _str.length() ? _str[index] : 0; }
+	char& operator[](unsigned int index) { return _str[index]; }
+
+	int indexOf(char c, unsigned int from = 0) const;
+	int indexOf(const char *str, unsigned int from = 0) const;
+	String substring(unsigned int from) const { return substring(from, length()); }
+	String substring(unsigned int from, unsigned int to) const;
+	bool startsWith(const char *prefix) const { return _str.compare(0, strlen(prefix), prefix) == 0; }
+	bool equals(const char *other) const { return _str == other; }
+	long toInt() const { return atol(_str.c_str()); }
+	float toFloat() const { return atof(_str.c_str()); }
+	void trim();
+	void toCharArray(char *buff, unsigned int size) const;
+
+private:
+	std::string _str;
+};
+
+String operator+(const String &lhs, const String &rhs);
+String operator+(const String &lhs, const char *rhs);
+
+/******************************************************************************
+ * Print and Stream
+ *****************************************************************************/
+class Print
+{
+public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buff, size_t size);
+	size_t write(const char *str) { return str == NULL ? 0 : write((const uint8_t *)str, strlen(str)); }
+	size_t write(const char *buff, size_t size) { return write((const uint8_t *)buff, size); }
+	virtual void flush() {}
+
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+	size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+	size_t print(const String &str) { return write(str.c_str()); }
+	size_t print(const char *str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char val, int base = DEC) { return print((unsigned long)val, base); }
+	size_t print(int val, int base = DEC) { return print((long)val, base); }
+	size_t print(unsigned int val, int base = DEC) { return print((unsigned long)val, base); }
+	size_t print(long val, int base = DEC);
+	size_t print(unsigned long val, int base = DEC);
+	size_t print(long long val, int base = DEC);
+	size_t print(unsigned long long val, int base = DEC);
+	size_t print(double val, int decimals = 2);
+
+	template <typename T, typename... TArgs>
+	size_t println(T val, TArgs... args) { size_t n = print(val, args...); return n + println(); }
+	size_t println() { return write("\r\n"); }
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout_ms) { _timeout_ms = timeout_ms; }
+	size_t readBytes(char *buff, size_t len);
+	size_t readBytes(uint8_t *buff, size_t len) { return readBytes((char *)buff, len); }
+	String readStringUntil(char terminator);
+	String readString();
+	bool find(const char *target);
+
+protected:
+	unsigned long _timeout_ms = 1000;
+};
+
+/** Serial port, TX goes to stdout, RX is fed by tests with inject() */
+class HardwareSerial : public Stream
+{
+public:
+	HardwareSerial(int uart_nr) : _uart_nr(uart_nr) {}
+
+	void begin(unsigned long baud, uint32_t config = 0, int8_t rx_pin = -1, int8_t tx_pin = -1, bool invert = false, unsigned long timeout_ms = 20000UL) {}
+	void end() {}
+	void updateBaudRate(unsigned long baud) {}
+	operator bool() const { return true; }
+
+	int available() override { return _rx.size() - _rx_pos; }
+	int read() override { return available() > 0 ? (uint8_t)_rx[_rx_pos++] : -1; }
+	int peek() override { return available() > 0 ? (uint8_t)_rx[_rx_pos] : -1; }
+
+	using Print::write;
+	size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+	size_t write(const uint8_t *buff, size_t size) override { return fwrite(buff, 1, size, stdout); }
+	void flush() override { fflush(stdout); }
+
+	void inject(const uint8_t *buff, size_t size) { _rx.append((const char *)buff, size); }
+
+private:
+	int _uart_nr;
+	std::string _rx;
+	size_t _rx_pos = 0;
+};
+
+#define SERIAL_8N1 0x800001c
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+/******************************************************************************
+ * ESP system info
+ *****************************************************************************/
+class EspClass
+{
+public:
+	uint32_t getFreeHeap() { return 200000; }
+	uint32_t getHeapSize() { return 320000; }
+	uint32_t getMinFreeHeap() { return 150000; }
+	uint32_t getMaxAllocHeap() { return 110000; }
+	uint32_t getPsramSize() { return 0; }
+	uint32_t getFreePsram() { return 0; }
+	uint32_t getCpuFreqMHz() { return getCpuFrequencyMhz(); }
+	uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+	uint32_t getFlashChipSize() { return 4 * 1024 * 1024; }
+	const char* getSdkVersion() { return "native"; }
+	void restart();
+};
+
+extern EspClass ESP;
+
+#endif
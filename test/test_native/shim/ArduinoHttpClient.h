@@ -0,0 +1,74 @@
+#ifndef NATIVE_ARDUINO_HTTP_CLIENT_H
+#define NATIVE_ARDUINO_HTTP_CLIENT_H
+
+/******************************************************************************
+ * Fake ArduinoHttpClient. Nothing goes over the client, requests are recorded
+ * and answered from Fakes::http_respond() (see fakes.h), 404 when none is set
+ *****************************************************************************/
+#include "Arduino.h"
+#include "Client.h"
+
+#define HTTP_SUCCESS 0
+#define HTTP_ERROR_CONNECTION_FAILED -1
+#define HTTP_ERROR_API -2
+#define HTTP_ERROR_TIMED_OUT -3
+#define HTTP_ERROR_INVALID_RESPONSE -4
+
+#define HTTP_HEADER_CONTENT_LENGTH "Content-Length"
+#define HTTP_HEADER_CONTENT_TYPE "Content-Type"
+#define HTTP_HEADER_CONNECTION "Connection"
+#define HTTP_HEADER_USER_AGENT "User-Agent"
+
+class HttpClient : public Client
+{
+public:
+	HttpClient(Client &client, const char *server, uint16_t port = 80) : _server(server), _port(port) {}
+	HttpClient(Client &client, const String &server, uint16_t port = 80) : _server(server.c_str()), _port(port) {}
+
+	void beginRequest() { _in_request = true; }
+	int endRequest();
+	void beginBody() {}
+
+	int get(const char *path) { return start_request("GET", path); }
+	int post(const char *path) { return start_request("POST", path); }
+	int post(const char *path, const char *content_type, int content_length, const uint8_t *body);
+
+	void sendHeader(const char *name, const char *value) {}
+	void sendHeader(const char *name, int value) {}
+	void connectionKeepAlive() {}
+	void noDefaultRequestHeaders() {}
+	void setHttpResponseTimeout(uint32_t timeout_ms) {}
+
+	int responseStatusCode();
+	int contentLength();
+	bool endOfBodyReached() { return _body_pos >= _body.length(); }
+	int skipResponseHeaders() { return HTTP_SUCCESS; }
+
+	int connect(IPAddress ip, uint16_t port) override { return 1; }
+	int connect(const char *host, uint16_t port) override { return 1; }
+	using Print::write;
+	size_t write(uint8_t c) override { _request_body += (char)c; return 1; }
+	size_t write(const uint8_t *buff, size_t size) override { _request_body.append((const char *)buff, size); return size; }
+	int available() override { return _body.length() - _body_pos; }
+	int read() override { return available() > 0 ? (uint8_t)_body[_body_pos++] : -1; }
+	int read(uint8_t *buff, size_t size) override;
+	int peek() override { return available() > 0 ? (uint8_t)_body[_body_pos] : -1; }
+	void stop() override {}
+	uint8_t connected() override { return true; }
+	operator bool() override { return true; }
+
+private:
+	int start_request(const char *method, const char *path);
+
+	std::string _server;
+	uint16_t _port;
+	bool _in_request = false;
+	std::string _method;
+	std::string _path;
+	std::string _request_body;
+	int _status = 0;
+	std::string _body;
+	size_t _body_pos = 0;
+};
+
+#endif
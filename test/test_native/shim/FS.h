@@ -0,0 +1,89 @@
+#ifndef NATIVE_FS_H
+#define NATIVE_FS_H
+
+/******************************************************************************
+ * Host shim of the Arduino-esp32 FS API over a RAM filesystem. Behaves like
+ * SPIFFS on the 1.0.x core: flat, dirs are path prefixes, any path opens as a
+ * dir when no file has that name, and names are returned as full paths
+ *****************************************************************************/
+#include <memory>
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+	enum SeekMode
+	{
+		SeekSet = 0,
+		SeekCur = 1,
+		SeekEnd = 2
+	};
+
+	class RamFs;
+	struct FileImpl;
+
+	class File : public Stream
+	{
+	public:
+		File() {}
+		File(std::shared_ptr<FileImpl> impl) : _impl(impl) {}
+
+		size_t write(uint8_t c) override;
+		size_t write(const uint8_t *buff, size_t size) override;
+		using Print::write;
+
+		int available() override;
+		int read() override;
+		int peek() override;
+		size_t read(uint8_t *buff, size_t size);
+		void flush() override {}
+
+		bool seek(uint32_t pos, SeekMode mode = SeekSet);
+		size_t position() const;
+		size_t size() const;
+		void close();
+		operator bool() const;
+
+		const char* name() const;
+		bool isDirectory() const;
+		File openNextFile(const char *mode = FILE_READ);
+		void rewindDirectory();
+
+	private:
+		std::shared_ptr<FileImpl> _impl;
+	};
+
+	class FS
+	{
+	public:
+		FS(RamFs *ram_fs) : _ram_fs(ram_fs) {}
+
+		File open(const char *path, const char *mode = FILE_READ);
+		File open(const String &path, const char *mode = FILE_READ) { return open(path.c_str(), mode); }
+
+		bool exists(const char *path);
+		bool exists(const String &path) { return exists(path.c_str()); }
+		bool remove(const char *path);
+		bool remove(const String &path) { return remove(path.c_str()); }
+		bool rename(const char *path_from, const char *path_to);
+		bool rename(const String &path_from, const String &path_to) { return rename(path_from.c_str(), path_to.c_str()); }
+		bool mkdir(const char *path) { return false; }
+		bool mkdir(const String &path) { return false; }
+		bool rmdir(const char *path) { return false; }
+
+	protected:
+		RamFs *_ram_fs;
+	};
+}
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
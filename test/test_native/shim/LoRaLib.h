@@ -0,0 +1,73 @@
+#ifndef NATIVE_LORALIB_H
+#define NATIVE_LORALIB_H
+
+/******************************************************************************
+ * Host shim of LoRaLib. The radio configures fine and never receives
+ * anything, FO packets are fed to FoSniffer::decode_packet() directly
+ *****************************************************************************/
+#include "Arduino.h"
+#include "SPI.h"
+
+#define ERR_NONE 0
+#define ERR_UNKNOWN -1
+#define ERR_CHIP_NOT_FOUND -2
+#define ERR_PACKET_TOO_LONG -4
+#define ERR_TX_TIMEOUT -5
+#define ERR_RX_TIMEOUT -6
+#define ERR_CRC_MISMATCH -7
+
+#define SX127X_RX 0b00000101
+#define SX127X_RXCONTINUOUS 0b00000101
+#define SX127X_RXSINGLE 0b00000110
+
+class Module
+{
+public:
+	Module(int cs, int irq, int rst, SPIClass &spi) {}
+};
+
+class SX1278
+{
+public:
+	SX1278(Module *mod) {}
+
+	int16_t begin(float freq = 434.0, float bw = 125.0, uint8_t sf = 9, uint8_t cr = 7, uint8_t sync_word = 0x12, int8_t power = 17, uint8_t current_limit = 100, uint16_t preamble_length = 8, uint8_t gain = 0) { return ERR_NONE; }
+	int16_t beginFSK(float freq = 434.0, float br = 48.0, float freq_dev = 50.0, float rx_bw = 125.0, int8_t power = 13, uint8_t current_limit = 100, uint16_t preamble_length = 16, bool enable_ook = false) { return ERR_NONE; }
+
+	int16_t setFrequency(float freq) { return ERR_NONE; }
+	int16_t setBitRate(float br) { return ERR_NONE; }
+	int16_t setFrequencyDeviation(float freq_dev) { return ERR_NONE; }
+	int16_t setRxBandwidth(float rx_bw) { return ERR_NONE; }
+	int16_t setEncoding(uint8_t encoding) { return ERR_NONE; }
+	int16_t setNodeAddress(uint8_t addr) { return ERR_NONE; }
+	int16_t setBroadcastAddress(uint8_t addr) { return ERR_NONE; }
+	int16_t disableAddressFiltering() { return ERR_NONE; }
+	int16_t setSyncWord(uint8_t *sync_word, size_t len) { return ERR_NONE; }
+	int16_t setSyncWord(uint8_t sync_word) { return ERR_NONE; }
+	int16_t setCRC(bool enable) { return ERR_NONE; }
+	int16_t setPreambleLength(uint16_t preamble_length) { return ERR_NONE; }
+	int16_t setOutputPower(int8_t power) { return ERR_NONE; }
+	int16_t setSpreadingFactor(uint8_t sf) { return ERR_NONE; }
+	int16_t setBandwidth(float bw) { return ERR_NONE; }
+	int16_t setCodingRate(uint8_t cr) { return ERR_NONE; }
+
+	int16_t startReceive(uint8_t len = 0, uint8_t mode = SX127X_RXCONTINUOUS) { return ERR_NONE; }
+	int16_t receive(uint8_t *data, size_t len) { return ERR_RX_TIMEOUT; }
+	int16_t readData(uint8_t *data, size_t len) { return ERR_RX_TIMEOUT; }
+	int16_t transmit(uint8_t *data, size_t len, uint8_t addr = 0) { return ERR_NONE; }
+	int16_t standby() { return ERR_NONE; }
+	int16_t sleep() { return ERR_NONE; }
+	size_t getPacketLength(bool update = true) { return 0; }
+	float getRSSI() { return -120; }
+	float getSNR() { return 0; }
+	void setDio0Action(void (*func)(void)) {}
+	void clearDio0Action() {}
+};
+
+class RFM95 : public SX1278
+{
+public:
+	RFM95(Module *mod) : SX1278(mod) {}
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+#include "Arduino.h"
+
+/** NVS namespace in RAM, kept for the life of the process like NVS over reboots */
+class Preferences
+{
+public:
+	bool begin(const char *name, bool read_only = false, const char *partition_label = NULL);
+	void end();
+
+	bool clear();
+	bool remove(const char *key);
+	bool isKey(const char *key);
+
+	size_t putBytes(const char *key, const void *value, size_t len);
+	size_t getBytes(const char *key, void *buff, size_t max_len);
+	size_t getBytesLength(const char *key);
+
+	size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+	uint32_t getUInt(const char *key, uint32_t default_value = 0) { getBytes(key, &default_value, sizeof(default_value)); return default_value; }
+	size_t putBool(const char *key, bool value) { return putBytes(key, &value, sizeof(value)); }
+	bool getBool(const char *key, bool default_value = false) { getBytes(key, &default_value, sizeof(default_value)); return default_value; }
+
+private:
+	std::string _name;
+	bool _read_only = true;
+	bool _started = false;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef NATIVE_SPI_H
+#define NATIVE_SPI_H
+
+#include "Arduino.h"
+
+class SPIClass
+{
+public:
+	SPIClass(uint8_t spi_bus = 3) {}
+
+	void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+	void end() {}
+};
+
+extern SPIClass SPI;
+
+#endif
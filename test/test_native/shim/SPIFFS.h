@@ -0,0 +1,24 @@
+#ifndef NATIVE_SPIFFS_H
+#define NATIVE_SPIFFS_H
+
+#include "FS.h"
+
+namespace fs
+{
+	/** SPIFFS partition in RAM, size is set with Fakes::fs_reset() */
+	class SPIFFSFS : public FS
+	{
+	public:
+		SPIFFSFS();
+
+		bool begin(bool format_on_fail = false, const char *base_path = "/spiffs", uint8_t max_open_files = 10, const char *label = NULL);
+		void end();
+		bool format();
+		size_t totalBytes();
+		size_t usedBytes();
+	};
+}
+
+extern fs::SPIFFSFS SPIFFS;
+
+#endif
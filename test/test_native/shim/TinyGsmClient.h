@@ -0,0 +1,119 @@
+#ifndef NATIVE_TINY_GSM_CLIENT_H
+#define NATIVE_TINY_GSM_CLIENT_H
+
+/******************************************************************************
+ * Fake TinyGsm modem. AT commands sent are recorded, and each waitResponse()
+ * returns the next scripted result (1, OK, when the script is empty). Data the
+ * modem "sends" is fed to the stream passed on construct, eg. with
+ * HardwareSerial::inject()
+ *****************************************************************************/
+#include <vector>
+#include "Arduino.h"
+#include "Client.h"
+
+#define GF(x) x
+#define GSM_NL "\r\n"
+
+enum SimStatus
+{
+	SIM_ERROR = 0,
+	SIM_READY = 1,
+	SIM_LOCKED = 2,
+	SIM_ANTITHEFT_LOCKED = 3
+};
+
+class TinyGsm
+{
+public:
+	TinyGsm(Stream &serial) : stream(serial) {}
+
+	template <typename... TArgs>
+	void sendAT(TArgs... cmd)
+	{
+		std::string at = "AT";
+		append_at(at, cmd...);
+		commands.push_back(at);
+	}
+
+	int8_t waitResponse() { return next_response(); }
+	int8_t waitResponse(uint32_t timeout_ms) { return next_response(); }
+	int8_t waitResponse(const char *r1) { return next_response(); }
+	int8_t waitResponse(uint32_t timeout_ms, const char *r1, const char *r2 = NULL, const char *r3 = NULL) { return next_response(); }
+	int8_t waitResponse(uint32_t timeout_ms, String &data, const char *r1 = NULL, const char *r2 = NULL) { return next_response(); }
+
+	bool testAT(uint32_t timeout_ms = 10000) { return true; }
+	bool init(const char *pin = NULL) { return true; }
+	bool restart(const char *pin = NULL) { return true; }
+	bool poweroff() { return true; }
+	bool streamSkipUntil(const char c, uint32_t timeout_ms = 1000) { return true; }
+	template <typename T> void streamWrite(T last) { stream.print(last); }
+
+	SimStatus getSimStatus(uint32_t timeout_ms = 10000) { return SIM_READY; }
+	bool waitForNetwork(uint32_t timeout_ms = 60000, bool check_signal = false) { return true; }
+	bool isNetworkConnected() { return true; }
+	bool gprsConnect(const char *apn, const char *user = NULL, const char *pwd = NULL) { return true; }
+	bool gprsDisconnect() { return true; }
+	bool isGprsConnected() { return true; }
+	int16_t getSignalQuality() { return 20; }
+	bool setPreferredMode(uint8_t mode) { return true; }
+	bool setPreferredLTEMode(uint8_t mode) { return true; }
+	bool setOperatingBand(uint8_t rat, uint8_t band) { return true; }
+
+	String getIMEI() { return "860000000000000"; }
+	String getSimCCID() { return "8930000000000000000"; }
+	String getOperator() { return "native"; }
+	String getModemName() { return "SIMCom SIM7000"; }
+	String getModemInfo() { return "SIM7000 R1351"; }
+	String getGSMDateTime(int format) { return ""; }
+	uint16_t getBattVoltage() { return 4000; }
+	int8_t getBattPercent() { return 80; }
+	byte NTPServerSync(String server = "pool.ntp.org", byte tz = 0) { return 1; }
+
+	/** Scripted waitResponse() results and AT commands sent, for tests */
+	std::vector<int8_t> responses;
+	std::vector<std::string> commands;
+
+	Stream &stream;
+
+private:
+	int8_t next_response();
+
+	void append_at(std::string &at) {}
+	template <typename T, typename... TArgs>
+	void append_at(std::string &at, T arg, TArgs... args) { at += String(arg).c_str(); append_at(at, args...); }
+	void append_at(std::string &at, const char *arg) { at += arg; }
+	template <typename... TArgs>
+	void append_at(std::string &at, const char *arg, TArgs... args) { at += arg; append_at(at, args...); }
+	template <typename... TArgs>
+	void append_at(std::string &at, char arg, TArgs... args) { at += arg; append_at(at, args...); }
+};
+
+/** Socket on a modem mux, data is exchanged through Fakes (see fakes.h) */
+class TinyGsmClient : public Client
+{
+public:
+	TinyGsmClient() {}
+	TinyGsmClient(TinyGsm &modem, uint8_t mux = 0) : _modem(&modem), _mux(mux) {}
+
+	bool init(TinyGsm *modem, uint8_t mux = 0) { _modem = modem; _mux = mux; return true; }
+
+	int connect(IPAddress ip, uint16_t port) override { _connected = true; return 1; }
+	int connect(const char *host, uint16_t port) override { _connected = true; return 1; }
+	using Print::write;
+	size_t write(uint8_t c) override { return 1; }
+	size_t write(const uint8_t *buff, size_t size) override { return size; }
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int read(uint8_t *buff, size_t size) override { return -1; }
+	int peek() override { return -1; }
+	void stop() override { _connected = false; }
+	uint8_t connected() override { return _connected; }
+	operator bool() override { return _connected; }
+
+private:
+	TinyGsm *_modem = NULL;
+	uint8_t _mux = 0;
+	bool _connected = false;
+};
+
+#endif
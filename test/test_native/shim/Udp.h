@@ -0,0 +1,19 @@
+#ifndef NATIVE_UDP_H
+#define NATIVE_UDP_H
+
+#include "Arduino.h"
+#include "Client.h"
+
+class UDP : public Stream
+{
+public:
+	virtual uint8_t begin(uint16_t port) = 0;
+	virtual void stop() = 0;
+	virtual int beginPacket(const char *host, uint16_t port) = 0;
+	virtual int endPacket() = 0;
+	virtual int parsePacket() = 0;
+	using Stream::read;
+	virtual int read(unsigned char *buff, size_t len) = 0;
+};
+
+#endif
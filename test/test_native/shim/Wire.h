@@ -0,0 +1,30 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+#include "Arduino.h"
+
+/** I2C master with no devices on the bus, every transaction is NACKed */
+class TwoWire : public Stream
+{
+public:
+	TwoWire(uint8_t bus_num) : _bus_num(bus_num) {}
+
+	bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+	void setClock(uint32_t frequency) {}
+	void beginTransmission(uint8_t address) {}
+	uint8_t endTransmission(bool send_stop = true) { return 2; }
+	uint8_t requestFrom(uint8_t address, uint8_t size, bool send_stop = true) { return 0; }
+
+	using Print::write;
+	size_t write(uint8_t c) override { return 1; }
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+
+private:
+	uint8_t _bus_num;
+};
+
+extern TwoWire Wire;
+
+#endif
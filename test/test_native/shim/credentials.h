@@ -0,0 +1,33 @@
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+#include "struct.h"
+
+/**
+ * Native env credentials, used when there is no include/credentials.h. Nothing
+ * connects to a server on the host, values only need to exist
+ */
+const char FALLBACK_TB_DEVICE_TOKEN[] = "native";
+const char FALLBACK_CELL_APN[] = "native";
+
+const char TB_SERVER[] = "tb.example.com";
+const int TB_PORT = 80;
+
+const char DEVICE_GEOHASH[] = "";
+
+const char IPFS_NODE_ADDR[] = "ipfs.example.com";
+const int IPFS_NODE_PORT = 5001;
+const char IPFS_MIDDLEWARE_URL[] = "ipfs-mw.example.com";
+const int IPFS_MIDDLEWARE_PORT = 3001;
+
+const char HTTP_TIME_SYNC_URL[] = "http://time.example.com/";
+
+const char WIFI_ROOT_CA_CERTIFICATE[] = "";
+const char WIFI_SSID[] = "";
+const char WIFI_PASSWORD[] = "";
+
+const char FIELD_OFFLOAD_AP_PASSWORD[] = "";
+#define TIMBER_SOURCE_ID ""
+#define TIMBER_API_KEY ""
+
+#endif // CREDENTIALS_H
@@ -0,0 +1,15 @@
+#ifndef NATIVE_DRIVER_UART_H
+#define NATIVE_DRIVER_UART_H
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+typedef enum
+{
+	UART_NUM_0,
+	UART_NUM_1,
+	UART_NUM_2,
+	UART_NUM_MAX
+} uart_port_t;
+
+#endif
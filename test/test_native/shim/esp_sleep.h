@@ -0,0 +1,37 @@
+#ifndef NATIVE_ESP_SLEEP_H
+#define NATIVE_ESP_SLEEP_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+typedef enum
+{
+	ESP_SLEEP_WAKEUP_UNDEFINED,
+	ESP_SLEEP_WAKEUP_ALL,
+	ESP_SLEEP_WAKEUP_EXT0,
+	ESP_SLEEP_WAKEUP_EXT1,
+	ESP_SLEEP_WAKEUP_TIMER,
+	ESP_SLEEP_WAKEUP_TOUCHPAD,
+	ESP_SLEEP_WAKEUP_ULP,
+	ESP_SLEEP_WAKEUP_GPIO,
+	ESP_SLEEP_WAKEUP_UART
+} esp_sleep_wakeup_cause_t;
+
+typedef enum
+{
+	ESP_EXT1_WAKEUP_ALL_LOW = 0,
+	ESP_EXT1_WAKEUP_ANY_HIGH = 1
+} esp_sleep_ext1_wakeup_mode_t;
+
+/** Sleeps return at once, the wake up cause is set with Fakes::set_wakeup_cause() */
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_us);
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t pin, int level);
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode);
+esp_err_t esp_sleep_enable_gpio_wakeup();
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_wakeup_cause_t source);
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+esp_err_t esp_light_sleep_start();
+void esp_deep_sleep_start();
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef NATIVE_ESP_SYSTEM_H
+#define NATIVE_ESP_SYSTEM_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum
+{
+	ESP_MAC_WIFI_STA,
+	ESP_MAC_WIFI_SOFTAP,
+	ESP_MAC_BT,
+	ESP_MAC_ETH
+} esp_mac_type_t;
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
+uint32_t esp_random();
+void esp_restart();
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef NATIVE_IPFS_CLIENT_H
+#define NATIVE_IPFS_CLIENT_H
+
+// Included by utils.h, nothing from it is used by the modules built natively
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef NATIVE_MBEDTLS_CTR_DRBG_H
+#define NATIVE_MBEDTLS_CTR_DRBG_H
+
+typedef struct { int reseed_counter; } mbedtls_ctr_drbg_context;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef NATIVE_MBEDTLS_ENTROPY_H
+#define NATIVE_MBEDTLS_ENTROPY_H
+
+typedef struct { int source_count; } mbedtls_entropy_context;
+
+#endif
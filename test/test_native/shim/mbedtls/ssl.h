@@ -0,0 +1,10 @@
+#ifndef NATIVE_MBEDTLS_SSL_H
+#define NATIVE_MBEDTLS_SSL_H
+
+// Context types only, for headers that embed them. TlsClient isn't built natively
+
+typedef struct { int state; } mbedtls_ssl_context;
+typedef struct { int endpoint; } mbedtls_ssl_config;
+typedef struct { int len; } mbedtls_ssl_session;
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef NATIVE_ROM_CRC_H
+#define NATIVE_ROM_CRC_H
+
+#include <stdint.h>
+
+/** CRC32 (IEEE 802.3, reflected) like the ROM one, crc is the previous result */
+uint32_t crc32_le(uint32_t crc, const uint8_t *buff, uint32_t len);
+
+#endif
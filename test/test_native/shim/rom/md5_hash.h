@@ -0,0 +1,17 @@
+#ifndef NATIVE_ROM_MD5_HASH_H
+#define NATIVE_ROM_MD5_HASH_H
+
+#include <stdint.h>
+
+struct MD5Context
+{
+	uint32_t buf[4];
+	uint32_t bits[2];
+	uint8_t in[64];
+};
+
+void MD5Init(struct MD5Context *context);
+void MD5Update(struct MD5Context *context, const uint8_t *buff, uint32_t len);
+void MD5Final(uint8_t digest[16], struct MD5Context *context);
+
+#endif
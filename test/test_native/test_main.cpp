@@ -0,0 +1,752 @@
+/******************************************************************************
+ * Host tests and benchmarks of the modules that don't need the board (see
+ * [env:native] in platformio.ini). Run with: pio test -e native -v
+ *
+ * Tests mirror the on-device ones in tests.cpp where there is one. Benchmarks
+ * time a hot path on the host, print "name iterations ns/op" and fail only if
+ * the path fails; numbers compare commits on the same machine, not with the
+ * device (see tests.cpp for on-device timings)
+ *****************************************************************************/
+#include <unity.h>
+#include <chrono>
+#include "data_store.h"
+#include "data_store_reader.h"
+#include "tb_water_sensor_data_json_builder.h"
+#include "water_sensor_data.h"
+#include "sleep_scheduler.h"
+#include "device_config.h"
+#include "fo_sniffer.h"
+#include "sampling.h"
+#include "http_request.h"
+#include "flash.h"
+#include "storage.h"
+#include "utils.h"
+#include "rtc.h"
+#include "log.h"
+#include "fakes.h"
+
+//
+// Data store
+//
+const char *DATA_STORE_PATH = "/test";
+
+// Entries written by the write/read test, spans several files
+const int DATA_STORE_ELEMENTS_TO_WRITE = 150;
+const int DATA_STORE_ENTRIES_PER_FILE = 12;
+
+const int DATA_STORE_ENTRY_SIZE = sizeof(DataStore<WaterSensorData::Entry>::Entry);
+const int DATA_STORE_FULL_FILE_SIZE = DATA_STORE_ENTRY_SIZE * DATA_STORE_ENTRIES_PER_FILE;
+
+// Partition of the full partition test, a few files
+const int DATA_STORE_SMALL_FS_BYTES = 8 * DATA_STORE_FULL_FILE_SIZE;
+
+//
+// Sleep
+//
+// Ad-hoc tasks are due this far in the future, after any task of the schedule
+const int WAKEUP_TIMES_OFFSET_SEC = 60 * 60 * 24 * 7;
+
+// Days simulated
+const int SLEEP_SIMULATION_DAYS = 30;
+
+// Same figures as the on-device simulation (see tests.cpp)
+const SleepScheduler::SimEnergyModel SLEEP_SIMULATION_MODEL = {
+	.sleep_ua = 800,
+	.awake_ma = 45,
+	.modem_ma = 120,
+	.wake_secs = 2,
+	.call_home_secs = 60,
+	.sensors_secs = 10,
+	.fo_secs = 4,
+	.fo_enabled = true,
+	.battery_mah = 3000,
+	.solar_mah_per_day = 150,
+	.clock_error_ppm = 500
+};
+
+//
+// FO decode
+//
+/** A captured frame and the values it decodes to */
+struct FoFrameSample
+{
+	uint8_t frame[FO_SNIFFER_FRAME_LEN];
+	float temp;
+	uint8_t hum;
+	uint16_t wind_dir;
+	uint32_t light;
+};
+
+// Same frames as the on-device decode test (see tests.cpp)
+const FoFrameSample FO_FRAME_CORPUS[] = {
+	{{0x24, 0x5A, 0xC8, 0x42, 0x67, 0x41, 0x20, 0x30, 0x00, 0x12, 0x03, 0x00, 0x01, 0x86, 0xA0, 0x57, 0x13}, 21.5, 65, 200, 10000},
+	{{0x24, 0x5A, 0x2C, 0x91, 0x5C, 0x5B, 0x05, 0x80, 0x01, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74, 0xE0}, -5.2, 91, 300, 0},
+	{{0x24, 0x5A, 0x2D, 0x42, 0xEE, 0x14, 0x07, 0x09, 0x00, 0x00, 0x05, 0xAA, 0x09, 0xFB, 0xF1, 0x10, 0xB3}, 35.0, 20, 45, 65432}
+};
+
+const int FO_FRAME_CORPUS_LEN = sizeof(FO_FRAME_CORPUS) / sizeof(FO_FRAME_CORPUS[0]);
+
+//
+// Sampling
+//
+/** Source returning samples of a list in turn, NAN is an invalid sample */
+struct SampleSource
+{
+	const float *samples;
+	int count;
+	int next;
+};
+
+//
+// Benchmarks
+//
+const int BENCHMARK_STORE_ENTRIES = 1000;
+// As many entries as fit the request doc, slots are twice as large on the host
+const int BENCHMARK_BUILD_ENTRIES = WATER_SENSOR_DATA_JSON_DOC_SIZE /
+	(JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(5));
+const int BENCHMARK_CRC32_SIZE = 4096;
+
+bool read_sample(void *ctx, float *out);
+WaterSensorData::Entry make_entry(uint32_t tstamp);
+template <typename TFunc>
+void bench(const char *name, int iterations, TFunc func);
+
+/******************************************************************************
+ * Fresh device before every test: empty flash and NVS, RTC synced
+ *****************************************************************************/
+void setUp()
+{
+	Fakes::reset();
+	Flash::mount();
+}
+
+void tearDown()
+{
+}
+
+/******************************************************************************
+ * Utils
+ * CRC32 is the ROM one, stores and configs written by the device must check
+ *****************************************************************************/
+void test_crc32_matches_rom()
+{
+	uint8_t check[] = "123456789";
+
+	TEST_ASSERT_EQUAL_HEX32(0xCBF43926, Utils::crc32(check, 9));
+
+	// Continued CRC of two parts is the CRC of the whole
+	uint32_t crc = Utils::crc32_update(0, check, 4);
+	TEST_ASSERT_EQUAL_HEX32(0xCBF43926, Utils::crc32_update(crc, check + 4, 5));
+}
+
+/******************************************************************************
+ * Data store
+ * Commit entries one at a time, check file sizes after every commit and read
+ * them all back with a reader
+ *****************************************************************************/
+void test_data_store_write_read()
+{
+	DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_ENTRIES_PER_FILE);
+
+	for(int i = 0; i < DATA_STORE_ELEMENTS_TO_WRITE; i++)
+	{
+		WaterSensorData::Entry entry = make_entry(i);
+
+		TEST_ASSERT_EQUAL(RET_OK, store.add(&entry));
+		TEST_ASSERT_EQUAL(RET_OK, store.commit());
+
+		// Full files and at most one smaller file of the rest
+		int full_files = ((i + 1) * DATA_STORE_ENTRY_SIZE) / DATA_STORE_FULL_FILE_SIZE;
+		int last_file_size = (i + 1) * DATA_STORE_ENTRY_SIZE - full_files * DATA_STORE_FULL_FILE_SIZE;
+
+		int found_full_files = 0, found_other_files = 0, found_bytes = 0;
+
+		File dir = STORAGE_FS.open(DATA_STORE_PATH);
+		TEST_ASSERT_TRUE(dir);
+
+		File f;
+		while(f = dir.openNextFile())
+		{
+			int size = f.size();
+			found_bytes += size;
+
+			if(size == DATA_STORE_FULL_FILE_SIZE)
+				found_full_files++;
+			else if(size > 0)
+			{
+				found_other_files++;
+				TEST_ASSERT_EQUAL(last_file_size, size);
+			}
+
+			f.close();
+		}
+		dir.close();
+
+		TEST_ASSERT_EQUAL(full_files, found_full_files);
+		TEST_ASSERT_LESS_OR_EQUAL(1, found_other_files);
+		TEST_ASSERT_EQUAL((i + 1) * DATA_STORE_ENTRY_SIZE, found_bytes);
+	}
+
+	DataStoreReader<WaterSensorData::Entry> reader(&store);
+	WaterSensorData::Entry *entry;
+	bool seen[DATA_STORE_ELEMENTS_TO_WRITE] = {false};
+	int read = 0;
+
+	TEST_ASSERT_EQUAL(RET_OK, reader.begin());
+	while(reader.next_file())
+	{
+		while((entry = reader.next_entry()) != NULL)
+		{
+			TEST_ASSERT_TRUE(reader.entry_crc_valid());
+			TEST_ASSERT_LESS_THAN(DATA_STORE_ELEMENTS_TO_WRITE, (int)entry->timestamp);
+
+			WaterSensorData::Entry expected = make_entry(entry->timestamp);
+			TEST_ASSERT_EQUAL_MEMORY(&expected, entry, sizeof(expected));
+			TEST_ASSERT_FALSE(seen[entry->timestamp]);
+
+			seen[entry->timestamp] = true;
+			read++;
+		}
+	}
+
+	TEST_ASSERT_EQUAL(DATA_STORE_ELEMENTS_TO_WRITE, read);
+}
+
+/******************************************************************************
+ * Data store
+ * A store opened after a reboot finds the entries already on flash
+ *****************************************************************************/
+void test_data_store_reopen()
+{
+	{
+		DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_ENTRIES_PER_FILE);
+
+		for(int i = 0; i < DATA_STORE_ENTRIES_PER_FILE * 2 + 1; i++)
+		{
+			WaterSensorData::Entry entry = make_entry(i);
+			store.add(&entry);
+		}
+
+		TEST_ASSERT_EQUAL(RET_OK, store.commit());
+	}
+
+	DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_ENTRIES_PER_FILE);
+	WaterSensorData::Entry entry = make_entry(1000);
+	store.add(&entry);
+	TEST_ASSERT_EQUAL(RET_OK, store.commit());
+
+	DataStoreReader<WaterSensorData::Entry> reader(&store);
+	int read = 0;
+
+	TEST_ASSERT_EQUAL(RET_OK, reader.begin());
+	while(reader.next_file())
+	{
+		while(reader.next_entry() != NULL)
+			read++;
+	}
+
+	TEST_ASSERT_EQUAL(DATA_STORE_ENTRIES_PER_FILE * 2 + 2, read);
+}
+
+/******************************************************************************
+ * Data store
+ * On a full partition commits fail and cleanup makes space, what stays on
+ * flash is still readable
+ *****************************************************************************/
+void test_data_store_full_partition()
+{
+	Fakes::fs_reset(DATA_STORE_SMALL_FS_BYTES);
+
+	DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_ENTRIES_PER_FILE);
+
+	for(int i = 0; i < DATA_STORE_SMALL_FS_BYTES / DATA_STORE_ENTRY_SIZE * 4; i++)
+	{
+		WaterSensorData::Entry entry = make_entry(i);
+		store.add(&entry);
+	}
+
+	TEST_ASSERT_GREATER_THAN(0, Fakes::log_count(Log::DATA_STORE_COMMIT_FAILED));
+	TEST_ASSERT_LESS_OR_EQUAL(STORAGE_FS.totalBytes(), STORAGE_FS.usedBytes());
+
+	DataStoreReader<WaterSensorData::Entry> reader(&store);
+	WaterSensorData::Entry *entry;
+	int read = 0;
+
+	TEST_ASSERT_EQUAL(RET_OK, reader.begin());
+	while(reader.next_file())
+	{
+		while((entry = reader.next_entry()) != NULL)
+		{
+			TEST_ASSERT_TRUE(reader.entry_crc_valid());
+
+			WaterSensorData::Entry expected = make_entry(entry->timestamp);
+			TEST_ASSERT_EQUAL_MEMORY(&expected, entry, sizeof(expected));
+			read++;
+		}
+	}
+
+	TEST_ASSERT_GREATER_THAN(0, read);
+}
+
+/******************************************************************************
+ * Data store
+ * A file of entries without seq and presence mask (older FW) is rewritten in
+ * the current layout, entries failing CRC are dropped. Migrated files are left
+ * alone, files of no known layout are reported
+ *****************************************************************************/
+void test_data_store_migrate()
+{
+	const int old_data_size = offsetof(WaterSensorData::Entry, present);
+	const int entries = 5;
+
+	File f = STORAGE_FS.open("/test/1000_0", FILE_WRITE);
+	TEST_ASSERT_TRUE(f);
+
+	for(int i = 0; i < entries; i++)
+	{
+		WaterSensorData::Entry entry = make_entry(i);
+		uint32_t crc32 = Utils::crc32((uint8_t*)&entry, old_data_size) + (i == 2 ? 1 : 0);
+
+		f.write((uint8_t*)&crc32, sizeof(crc32));
+		f.write((uint8_t*)&entry, old_data_size);
+	}
+	f.close();
+
+	DataStoreUpgrader upgrade = [](void *data, int old_size)
+	{
+		((WaterSensorData::Entry*)data)->present = make_entry(0).present;
+	};
+
+	DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_ENTRIES_PER_FILE);
+	TEST_ASSERT_EQUAL(1, store.migrate(&old_data_size, 1, upgrade));
+	TEST_ASSERT_EQUAL(0, store.migrate(&old_data_size, 1, upgrade));
+
+	DataStoreReader<WaterSensorData::Entry> reader(&store);
+	WaterSensorData::Entry *entry;
+	int read = 0;
+
+	TEST_ASSERT_EQUAL(RET_OK, reader.begin());
+	while(reader.next_file())
+	{
+		while((entry = reader.next_entry()) != NULL)
+		{
+			TEST_ASSERT_TRUE(reader.entry_crc_valid());
+			TEST_ASSERT_EQUAL(0, reader.entry_seq());
+			TEST_ASSERT_TRUE(entry->timestamp != 2);
+
+			WaterSensorData::Entry expected = make_entry(entry->timestamp);
+			TEST_ASSERT_EQUAL_MEMORY(&expected, entry, sizeof(expected));
+			read++;
+		}
+	}
+
+	TEST_ASSERT_EQUAL(entries - 1, read);
+
+	f = STORAGE_FS.open("/test/2000_0", FILE_WRITE);
+	uint8_t garbage[DATA_STORE_ENTRY_SIZE * 2];
+	memset(garbage, 0x5A, sizeof(garbage));
+	f.write(garbage, sizeof(garbage));
+	f.close();
+
+	TEST_ASSERT_EQUAL(-1, store.migrate(&old_data_size, 1, upgrade));
+}
+
+/******************************************************************************
+ * JSON builders
+ * Telemetry of a water sensor entry, sequence number and truncation
+ *****************************************************************************/
+void test_json_builder_water_sensor()
+{
+	TbWaterSensorDataJsonBuilder builder;
+	char buff[256];
+
+	WaterSensorData::Entry entry = {0};
+	entry.timestamp = FAKES_DEFAULT_TSTAMP;
+	entry.temperature = 21.5;
+	entry.ph = 7.25;
+	entry.present = WaterSensorData::PRESENT_TEMPERATURE | WaterSensorData::PRESENT_PH;
+
+	TEST_ASSERT_TRUE(builder.is_empty());
+	TEST_ASSERT_EQUAL(RET_OK, builder.add(&entry));
+	TEST_ASSERT_EQUAL(1, builder.get_count());
+
+	builder.build(buff, sizeof(buff), false);
+	TEST_ASSERT_EQUAL_STRING("[{\"ts\":1700000000000,\"values\":{\"s_temp\":21.5,\"s_ph\":7.25}}]", buff);
+	TEST_ASSERT_EQUAL((int)strlen(buff), builder.measure());
+
+	TEST_ASSERT_EQUAL(RET_OK, builder.set_seq(7));
+	builder.build(buff, sizeof(buff), false);
+	TEST_ASSERT_EQUAL_STRING("[{\"ts\":1700000000000,\"values\":{\"s_temp\":21.5,\"s_ph\":7.25,\"seq\":7}}]", buff);
+
+	entry.timestamp++;
+	TEST_ASSERT_EQUAL(RET_OK, builder.add(&entry));
+	TEST_ASSERT_EQUAL(2, builder.get_count());
+
+	builder.truncate(1);
+	TEST_ASSERT_EQUAL(1, builder.get_count());
+
+	builder.reset();
+	TEST_ASSERT_EQUAL(RET_ERROR, builder.set_seq(1));
+	builder.build(buff, sizeof(buff), false);
+	TEST_ASSERT_EQUAL_STRING("[]", buff);
+}
+
+/******************************************************************************
+ * Sleep
+ * Add ad-hoc tasks to the deadline queue and check they come out in order
+ *****************************************************************************/
+void test_deadline_queue()
+{
+	const uint16_t ids[] = {SleepScheduler::TASK_ID_CUSTOM, SleepScheduler::TASK_ID_CUSTOM + 1,
+		SleepScheduler::TASK_ID_CUSTOM + 2};
+
+	uint32_t t_now = RTC::get_timestamp() + WAKEUP_TIMES_OFFSET_SEC;
+
+	// Added out of order, sub-minute interval
+	TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::add_task(ids[0], t_now + 30, 0));
+	TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::add_task(ids[1], t_now + 10, 15));
+	TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::add_task(ids[2], t_now + 20, 0));
+
+	const SleepScheduler::Deadline *next = SleepScheduler::get_next_deadline();
+	TEST_ASSERT_NOT_NULL(next);
+	TEST_ASSERT_EQUAL(ids[1], next->id);
+	TEST_ASSERT_EQUAL_UINT32(t_now + 10, next->due);
+
+	// Update existing task, moves behind the others
+	SleepScheduler::add_task(ids[1], t_now + 40, 15);
+	next = SleepScheduler::get_next_deadline();
+	TEST_ASSERT_NOT_NULL(next);
+	TEST_ASSERT_EQUAL(ids[2], next->id);
+
+	SleepScheduler::remove_task(ids[2]);
+	next = SleepScheduler::get_next_deadline();
+	TEST_ASSERT_NOT_NULL(next);
+	TEST_ASSERT_EQUAL(ids[0], next->id);
+
+	for(int i = 0; i < 3; i++)
+		SleepScheduler::remove_task(ids[i]);
+}
+
+/******************************************************************************
+ * Sleep
+ * Simulated month of the default schedule, with and without FO sniffing
+ *****************************************************************************/
+void test_sleep_simulation()
+{
+	DeviceConfig::init();
+	const DeviceConfig::Data *device_config = DeviceConfig::get();
+
+	SleepScheduler::SimEnergyModel model = SLEEP_SIMULATION_MODEL;
+	SleepScheduler::SimResult with_fo, without_fo;
+
+	TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::simulate(device_config->wakeup_schedule, &model, SLEEP_SIMULATION_DAYS, &with_fo));
+
+	model.fo_enabled = false;
+	TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::simulate(device_config->wakeup_schedule, &model, SLEEP_SIMULATION_DAYS, &without_fo));
+
+	SleepScheduler::print_sim_result(&with_fo, SLEEP_SIMULATION_DAYS);
+
+	TEST_ASSERT_GREATER_THAN(0, without_fo.wakeups);
+	TEST_ASSERT_GREATER_THAN(0, without_fo.modem_sessions);
+	TEST_ASSERT_EQUAL(0, without_fo.fo_sniffs);
+	TEST_ASSERT_GREATER_THAN(0, with_fo.fo_sniffs);
+	TEST_ASSERT_TRUE(with_fo.mah > without_fo.mah);
+	TEST_ASSERT_TRUE(with_fo.min_battery_pct <= 100);
+
+	// Invalid model
+	model.battery_mah = 0;
+	TEST_ASSERT_EQUAL(RET_ERROR, SleepScheduler::simulate(device_config->wakeup_schedule, &model, SLEEP_SIMULATION_DAYS, &with_fo));
+}
+
+/******************************************************************************
+ * FineOffset frame decode
+ * Captured frames decode to their values, a flipped bit is detected
+ *****************************************************************************/
+void test_fo_decode()
+{
+	for(int i = 0; i < FO_FRAME_CORPUS_LEN; i++)
+	{
+		FoDecodedPacket decoded = {0};
+		const FoFrameSample *sample = &FO_FRAME_CORPUS[i];
+
+		TEST_ASSERT_EQUAL(RET_OK, FoSniffer::decode_packet(sample->frame, &decoded));
+		TEST_ASSERT_FLOAT_WITHIN(0.01, sample->temp, decoded.temp);
+		TEST_ASSERT_EQUAL(sample->hum, decoded.hum);
+		TEST_ASSERT_EQUAL(sample->wind_dir, decoded.wind_dir);
+		TEST_ASSERT_EQUAL(sample->light, decoded.light);
+
+		// Flip a bit, both CRC and checksum fail
+		uint8_t corrupted[FO_SNIFFER_FRAME_LEN];
+		memcpy(corrupted, sample->frame, FO_SNIFFER_FRAME_LEN);
+		corrupted[4] ^= 0x08;
+
+		TEST_ASSERT_EQUAL(RET_ERROR, FoSniffer::decode_packet(corrupted, &decoded));
+	}
+}
+
+/******************************************************************************
+ * Sampling
+ * A spike is left out of the value, converges once enough samples agree
+ *****************************************************************************/
+void test_sampling_outlier()
+{
+	const float samples[] = {20.0, 20.1, 19.9, 20.0, 95.0, 20.1, 19.9, 20.0, 20.0, 20.1};
+	SampleSource source = {samples, sizeof(samples) / sizeof(samples[0]), 0};
+
+	Sampling::Plan plan = {};
+	plan.max_samples = 10;
+	plan.min_valid = 5;
+	plan.delay_ms = 100;
+	plan.tolerance = 0.1;
+
+	Sampling::Result result;
+
+	TEST_ASSERT_EQUAL(RET_OK, Sampling::run(&plan, read_sample, &source, &result));
+	TEST_ASSERT_EQUAL(Sampling::STATUS_OK, result.status);
+	TEST_ASSERT_TRUE(result.converged);
+	TEST_ASSERT_EQUAL(6, result.samples);
+	TEST_ASSERT_EQUAL(1, result.outliers);
+	TEST_ASSERT_FLOAT_WITHIN(0.001, 20.02, result.value);
+
+	// Virtual time moved with the delays between samples
+	TEST_ASSERT_EQUAL(500, result.elapsed_ms);
+}
+
+/******************************************************************************
+ * Sampling
+ * Source rejecting its samples aborts the run
+ *****************************************************************************/
+void test_sampling_invalid()
+{
+	const float samples[] = {NAN, 20.0, NAN, NAN};
+	SampleSource source = {samples, sizeof(samples) / sizeof(samples[0]), 0};
+
+	Sampling::Plan plan = {};
+	plan.max_samples = 10;
+	plan.min_valid = 3;
+	plan.max_invalid = 3;
+
+	Sampling::Result result;
+
+	TEST_ASSERT_EQUAL(RET_ERROR, Sampling::run(&plan, read_sample, &source, &result));
+	TEST_ASSERT_EQUAL(Sampling::STATUS_TOO_MANY_INVALID, result.status);
+	TEST_ASSERT_EQUAL(1, result.samples);
+	TEST_ASSERT_EQUAL(3, result.invalid);
+}
+
+/******************************************************************************
+ * HTTP
+ * GET and POST over the bearer's client, response read into the buffer
+ *****************************************************************************/
+void test_http_request()
+{
+	TinyGsm modem(Serial1);
+	HttpRequest http(&modem, TB_SERVER);
+	char resp[64];
+
+	Fakes::http_respond(200, "{\"ok\":true}");
+
+	TEST_ASSERT_EQUAL(RET_OK, http.get("/api/v1/attributes", resp, sizeof(resp)));
+	TEST_ASSERT_EQUAL(200, http.get_response_code());
+	TEST_ASSERT_EQUAL_STRING("{\"ok\":true}", resp);
+	TEST_ASSERT_EQUAL_STRING("GET", Fakes::http_method());
+	TEST_ASSERT_EQUAL_STRING("/api/v1/attributes", Fakes::http_path());
+
+	const char body[] = "[{\"ts\":1}]";
+	char content_type[] = "application/json";
+
+	TEST_ASSERT_EQUAL(RET_OK, http.post("/api/v1/telemetry", (const unsigned char *)body, strlen(body),
+		content_type, resp, sizeof(resp)));
+	TEST_ASSERT_EQUAL_STRING("POST", Fakes::http_method());
+	TEST_ASSERT_EQUAL_STRING(body, Fakes::http_body());
+
+	// Response buffer too small, cut and terminated
+	char small_resp[4];
+	TEST_ASSERT_EQUAL(RET_OK, http.get("/api/v1/attributes", small_resp, sizeof(small_resp)));
+	TEST_ASSERT_EQUAL_STRING("{\"o", small_resp);
+
+	Fakes::http_respond(404, "");
+	TEST_ASSERT_EQUAL(RET_OK, http.get("/missing", resp, sizeof(resp)));
+	TEST_ASSERT_EQUAL(404, http.get_response_code());
+	TEST_ASSERT_EQUAL(4, Fakes::http_request_count());
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+void test_benchmarks()
+{
+	printf("%-40s %10s %12s\n", "Benchmark", "Iterations", "ns/op");
+
+	// Store, one commit per entry as sensors do
+	{
+		DataStore<WaterSensorData::Entry> store(DATA_STORE_PATH, DATA_STORE_BUFFER_ELEMENTS);
+		uint32_t tstamp = 0;
+
+		bench("DataStore add + commit", BENCHMARK_STORE_ENTRIES, [&]()
+		{
+			WaterSensorData::Entry entry = make_entry(tstamp++);
+			store.add(&entry);
+			TEST_ASSERT_EQUAL(RET_OK, store.commit());
+		});
+
+		DataStoreReader<WaterSensorData::Entry> reader(&store);
+		int read = 0;
+
+		bench("DataStoreReader full read", 1, [&]()
+		{
+			reader.begin();
+			while(reader.next_file())
+			{
+				while(reader.next_entry() != NULL)
+					read++;
+			}
+		});
+
+		TEST_ASSERT_EQUAL(BENCHMARK_STORE_ENTRIES, read);
+	}
+
+	// Telemetry request
+	{
+		TbWaterSensorDataJsonBuilder builder;
+		WaterSensorData::Entry entry = make_entry(FAKES_DEFAULT_TSTAMP);
+		static char buff[WATER_SENSOR_DATA_JSON_DOC_SIZE];
+
+		bench("TbWaterSensorDataJsonBuilder request", 1000, [&]()
+		{
+			builder.reset();
+			for(int i = 0; i < BENCHMARK_BUILD_ENTRIES; i++)
+				builder.add(&entry);
+			builder.build(buff, sizeof(buff), false);
+		});
+
+		TEST_ASSERT_EQUAL(BENCHMARK_BUILD_ENTRIES, builder.get_count());
+	}
+
+	// Month of the default schedule
+	{
+		DeviceConfig::init();
+		const SleepScheduler::WakeupScheduleEntry *schedule = DeviceConfig::get()->wakeup_schedule;
+		SleepScheduler::SimResult result;
+
+		bench("SleepScheduler::simulate 30 days", 10, [&]()
+		{
+			TEST_ASSERT_EQUAL(RET_OK, SleepScheduler::simulate(schedule, &SLEEP_SIMULATION_MODEL, SLEEP_SIMULATION_DAYS, &result));
+		});
+	}
+
+	// Frame decode
+	{
+		FoDecodedPacket decoded;
+		int round = 0;
+
+		bench("FoSniffer::decode_packet", 100000, [&]()
+		{
+			FoSniffer::decode_packet(FO_FRAME_CORPUS[round++ % FO_FRAME_CORPUS_LEN].frame, &decoded);
+		});
+	}
+
+	// Full run of noisy samples, no convergence
+	{
+		float samples[SAMPLING_MAX_SAMPLES];
+		for(int i = 0; i < SAMPLING_MAX_SAMPLES; i++)
+			samples[i] = 20 + (i % 7) * 0.3;
+
+		Sampling::Plan plan = {};
+		plan.max_samples = SAMPLING_MAX_SAMPLES;
+		plan.min_valid = SAMPLING_MAX_SAMPLES / 2;
+		plan.tolerance = 0.01;
+
+		Sampling::Result result;
+
+		bench("Sampling::run 32 samples", 10000, [&]()
+		{
+			SampleSource source = {samples, SAMPLING_MAX_SAMPLES, 0};
+			Sampling::run(&plan, read_sample, &source, &result);
+		});
+	}
+
+	// Checksum of an OTA chunk
+	{
+		static uint8_t buff[BENCHMARK_CRC32_SIZE];
+		volatile uint32_t crc = 0;
+
+		bench("Utils::crc32 4096 bytes", 10000, [&]()
+		{
+			crc = crc + Utils::crc32(buff, sizeof(buff));
+		});
+	}
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_crc32_matches_rom);
+	RUN_TEST(test_data_store_write_read);
+	RUN_TEST(test_data_store_reopen);
+	RUN_TEST(test_data_store_full_partition);
+	RUN_TEST(test_data_store_migrate);
+	RUN_TEST(test_json_builder_water_sensor);
+	RUN_TEST(test_deadline_queue);
+	RUN_TEST(test_sleep_simulation);
+	RUN_TEST(test_fo_decode);
+	RUN_TEST(test_sampling_outlier);
+	RUN_TEST(test_sampling_invalid);
+	RUN_TEST(test_http_request);
+	RUN_TEST(test_benchmarks);
+
+	return UNITY_END();
+}
+
+/******************************************************************************
+ * Next sample of a SampleSource, false if it is NAN or none are left
+ *****************************************************************************/
+bool read_sample(void *ctx, float *out)
+{
+	SampleSource *source = (SampleSource *)ctx;
+
+	if(source->next >= source->count)
+		return false;
+
+	*out = source->samples[source->next++];
+
+	return !isnan(*out);
+}
+
+/******************************************************************************
+ * Entry with values derived from its timestamp, so it can be checked on read
+ *****************************************************************************/
+WaterSensorData::Entry make_entry(uint32_t tstamp)
+{
+	WaterSensorData::Entry entry = {0};
+
+	entry.timestamp = tstamp;
+	entry.temperature = tstamp % 50;
+	entry.dissolved_oxygen = tstamp % 60;
+	entry.conductivity = tstamp * 10;
+	entry.ph = tstamp % 14;
+	entry.water_level = tstamp * 2;
+	entry.present = WaterSensorData::PRESENT_TEMPERATURE | WaterSensorData::PRESENT_DISSOLVED_OXYGEN |
+		WaterSensorData::PRESENT_CONDUCTIVITY | WaterSensorData::PRESENT_PH | WaterSensorData::PRESENT_WATER_LEVEL;
+
+	return entry;
+}
+
+/******************************************************************************
+ * Time iterations of func on the host clock (virtual time doesn't move while
+ * code runs) and print time per iteration
+ *****************************************************************************/
+template <typename TFunc>
+void bench(const char *name, int iterations, TFunc func)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for(int i = 0; i < iterations; i++)
+		func();
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+	printf("%-40s %10d %12.0f\n", name, iterations, ns / iterations);
+}